@@ -420,6 +420,18 @@ static void test_some(void)
 
     free(data);
 
+    TCP_Server_Stats stats;
+    tcp_server_get_stats(tcp_s, &stats);
+    ck_assert_msg(stats.routed_packets == 6 && stats.routed_bytes == 6 * sizeof(test_packet),
+                  "wrong routing stats: %u packets, %u bytes", (unsigned int)stats.routed_packets,
+                  (unsigned int)stats.routed_bytes);
+    ck_assert_msg(stats.routed_dropped == 0, "%u routed packets dropped", (unsigned int)stats.routed_dropped);
+    ck_assert_msg(stats.handshakes.accepted == 3, "%u handshakes accepted", (unsigned int)stats.handshakes.accepted);
+    // con2 never sent a packet, so only the other two are confirmed.
+    ck_assert_msg(stats.send_backlog[0] == 2 && stats.priority_queued == 0,
+                  "send gauges: %u connections with nothing to send, %u priority packets queued",
+                  (unsigned int)stats.send_backlog[0], (unsigned int)stats.priority_queued);
+
     // Kill off the connections
     kill_tcp_server(tcp_s);
     kill_tcp_con(con1);
@@ -942,6 +954,246 @@ static void test_tcp_connection2(void)
     mono_time_free(mem, mono_time);
 }
 
+#define SHARDED_THREADS 4
+#define SHARDED_PAIRS 8
+#define SHARDED_HANDSHAKE_WORKERS 2
+
+typedef struct Sharded_Client {
+    TCP_Client_Connection *conn;
+    uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t secret_key[CRYPTO_SECRET_KEY_SIZE];
+    bool requested;
+    uint8_t connection_id;
+    uint8_t status;
+    uint32_t received;
+    uint32_t oob_received;
+} Sharded_Client;
+
+static int sharded_status_callback(void *object, uint32_t number, uint8_t connection_id, uint8_t status)
+{
+    Sharded_Client *client = (Sharded_Client *)object;
+    client->connection_id = connection_id;
+    client->status = status;
+    return 0;
+}
+
+static int sharded_data_callback(void *object, uint32_t number, uint8_t connection_id, const uint8_t *data,
+                                 uint16_t length, void *userdata)
+{
+    Sharded_Client *client = (Sharded_Client *)object;
+
+    if (length == 5 && data[0] == 1 && data[4] == 5) {
+        ++client->received;
+    }
+
+    return 0;
+}
+
+static int sharded_oob_data_callback(void *object, const uint8_t *public_key, const uint8_t *data, uint16_t length,
+                                     void *userdata)
+{
+    ++((Sharded_Client *)object)->oob_received;
+    return 0;
+}
+
+static void do_sharded_clients(const Logger *logger, TCP_Server *tcp_s, Mono_Time *mono_time, Sharded_Client *clients)
+{
+    for (uint32_t i = 0; i < 2 * SHARDED_PAIRS; ++i) {
+        if (clients[i].conn != nullptr) {
+            do_tcp_connection(logger, mono_time, clients[i].conn, nullptr);
+        }
+    }
+
+    do_tcp_server_delay(tcp_s, mono_time, 10);
+}
+
+// Clients of a relay with several threads land on different shards, and are
+// routed to each other across them.
+static void test_sharded_relay(void)
+{
+    const Random *rng = os_random();
+    ck_assert(rng != nullptr);
+    const Network *ns = os_network();
+    ck_assert(ns != nullptr);
+    const Memory *mem = os_memory();
+    ck_assert(mem != nullptr);
+
+    Logger *logger = logger_new(mem);
+    Mono_Time *mono_time = mono_time_new(mem, nullptr, nullptr);
+
+    uint8_t self_public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t self_secret_key[CRYPTO_SECRET_KEY_SIZE];
+    crypto_new_keypair(rng, self_public_key, self_secret_key);
+    TCP_Server_Options options;
+    tcp_server_options_default(&options);
+    options.num_threads = SHARDED_THREADS;
+    options.handshake_workers = SHARDED_HANDSHAKE_WORKERS;
+    TCP_Server *tcp_s = new_tcp_server_with_options(logger, mem, rng, ns, USE_IPV6, NUM_PORTS, ports, self_secret_key,
+                        nullptr, nullptr, &options);
+    ck_assert_msg(tcp_s != nullptr, "Failed to create a sharded TCP relay server.");
+
+    IP_Port ip_port_tcp_s;
+    ip_port_tcp_s.ip = get_loopback();
+
+    Sharded_Client clients[2 * SHARDED_PAIRS] = {{nullptr}};
+
+    for (uint32_t i = 0; i < 2 * SHARDED_PAIRS; ++i) {
+        crypto_new_keypair(rng, clients[i].public_key, clients[i].secret_key);
+        ip_port_tcp_s.port = net_htons(ports[i % NUM_PORTS]);
+        clients[i].conn = new_tcp_connection(logger, mem, mono_time, rng, ns, &ip_port_tcp_s, self_public_key,
+                                             clients[i].public_key, clients[i].secret_key, nullptr, nullptr);
+        ck_assert_msg(clients[i].conn != nullptr, "Failed to create TCP client connection %u.", i);
+        routing_status_handler(clients[i].conn, sharded_status_callback, &clients[i]);
+        routing_data_handler(clients[i].conn, sharded_data_callback, &clients[i]);
+        oob_data_handler(clients[i].conn, sharded_oob_data_callback, &clients[i]);
+    }
+
+    // Every client asks for its partner (i ^ 1) once it is connected.
+    bool all_online = false;
+
+    for (uint32_t tries = 0; tries < 300 && !all_online; ++tries) {
+        do_sharded_clients(logger, tcp_s, mono_time, clients);
+        all_online = true;
+
+        for (uint32_t i = 0; i < 2 * SHARDED_PAIRS; ++i) {
+            if (!clients[i].requested && tcp_con_status(clients[i].conn) == TCP_CLIENT_CONFIRMED) {
+                clients[i].requested = send_routing_request(logger, clients[i].conn, clients[i ^ 1].public_key) == 1;
+            }
+
+            all_online = all_online && clients[i].status == 2;
+        }
+    }
+
+    ck_assert_msg(all_online, "Not all client pairs were routed to each other.");
+
+    const uint8_t data[5] = {1, 2, 3, 4, 5};
+
+    for (uint32_t i = 0; i < 2 * SHARDED_PAIRS; ++i) {
+        ck_assert(send_data(logger, clients[i].conn, clients[i].connection_id, data, sizeof(data)) == 1);
+        ck_assert(send_oob_packet(logger, clients[i].conn, clients[i ^ 1].public_key, data, sizeof(data)) == 1);
+    }
+
+    bool all_received = false;
+
+    for (uint32_t tries = 0; tries < 300 && !all_received; ++tries) {
+        do_sharded_clients(logger, tcp_s, mono_time, clients);
+        all_received = true;
+
+        for (uint32_t i = 0; i < 2 * SHARDED_PAIRS; ++i) {
+            all_received = all_received && clients[i].received == 1 && clients[i].oob_received == 1;
+        }
+    }
+
+    ck_assert_msg(all_received, "Not all data and OOB packets were relayed.");
+
+    // When one client of a pair goes away, the other one is told.
+    for (uint32_t i = 0; i < 2 * SHARDED_PAIRS; i += 2) {
+        kill_tcp_connection(clients[i].conn);
+        clients[i].conn = nullptr;
+    }
+
+    bool all_offline = false;
+
+    for (uint32_t tries = 0; tries < 300 && !all_offline; ++tries) {
+        do_sharded_clients(logger, tcp_s, mono_time, clients);
+        all_offline = true;
+
+        for (uint32_t i = 1; i < 2 * SHARDED_PAIRS; i += 2) {
+            all_offline = all_offline && clients[i].status == 1;
+        }
+    }
+
+    ck_assert_msg(all_offline, "Not all clients were told that their partner went offline.");
+
+    TCP_Server_Handshake_Stats stats;
+    tcp_server_get_handshake_stats(tcp_s, &stats);
+    ck_assert_msg(stats.accepted == 2 * SHARDED_PAIRS && stats.rejected == 0 && stats.failed == 0,
+                  "Unexpected handshake counts: %u accepted, %u rejected, %u failed.",
+                  (unsigned)stats.accepted, (unsigned)stats.rejected, (unsigned)stats.failed);
+
+    // Shards count a kill just after telling the partner about it.
+    TCP_Server_Stats relay_stats;
+    tcp_server_get_stats(tcp_s, &relay_stats);
+
+    for (uint32_t tries = 0; tries < 100 && relay_stats.kills[TCP_KILL_CLOSED] < SHARDED_PAIRS; ++tries) {
+        do_sharded_clients(logger, tcp_s, mono_time, clients);
+        tcp_server_get_stats(tcp_s, &relay_stats);
+    }
+
+    ck_assert_msg(relay_stats.routed_packets == 2 * SHARDED_PAIRS && relay_stats.routed_dropped == 0,
+                  "Unexpected routing counts: %u routed, %u dropped.",
+                  (unsigned)relay_stats.routed_packets, (unsigned)relay_stats.routed_dropped);
+    ck_assert_msg(relay_stats.kills[TCP_KILL_CLOSED] == SHARDED_PAIRS, "%u closed connections counted.",
+                  (unsigned)relay_stats.kills[TCP_KILL_CLOSED]);
+
+    for (uint32_t i = 1; i < 2 * SHARDED_PAIRS; i += 2) {
+        kill_tcp_connection(clients[i].conn);
+    }
+
+    kill_tcp_server(tcp_s);
+    logger_kill(logger);
+    mono_time_free(mem, mono_time);
+}
+
+#define RATE_LIMIT_BURST 2
+
+// Connections from an address that used up its handshakes are closed right away.
+static void test_handshake_rate_limit(void)
+{
+    const Random *rng = os_random();
+    ck_assert(rng != nullptr);
+    const Network *ns = os_network();
+    ck_assert(ns != nullptr);
+    const Memory *mem = os_memory();
+    ck_assert(mem != nullptr);
+
+    Mono_Time *mono_time = mono_time_new(mem, nullptr, nullptr);
+    Logger *logger = logger_new(mem);
+    logger_callback_log(logger, print_debug_logger, nullptr, nullptr);
+
+    uint8_t self_public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t self_secret_key[CRYPTO_SECRET_KEY_SIZE];
+    crypto_new_keypair(rng, self_public_key, self_secret_key);
+
+    TCP_Server_Options options;
+    tcp_server_options_default(&options);
+    options.handshake_rate = 1;
+    options.handshake_burst = RATE_LIMIT_BURST;
+    TCP_Server *tcp_s = new_tcp_server_with_options(logger, mem, rng, ns, USE_IPV6, NUM_PORTS, ports, self_secret_key,
+                        nullptr, nullptr, &options);
+    ck_assert_msg(tcp_s != nullptr, "Failed to create a TCP relay server.");
+
+    IP_Port localhost;
+    localhost.ip = get_loopback();
+    localhost.port = net_htons(ports[0]);
+
+    Socket socks[RATE_LIMIT_BURST + 1];
+
+    for (uint32_t i = 0; i < RATE_LIMIT_BURST + 1; ++i) {
+        socks[i] = net_socket(ns, net_family_ipv6(), TOX_SOCK_STREAM, TOX_PROTO_TCP);
+        Net_Err_Connect err;
+        ck_assert_msg(net_connect(ns, mem, logger, socks[i], &localhost, &err),
+                      "Failed to connect to the TCP relay server (%d, %s).", errno, net_err_connect_to_string(err));
+    }
+
+    TCP_Server_Handshake_Stats stats = {0};
+
+    for (uint32_t tries = 0; tries < 20 && stats.rejected == 0; ++tries) {
+        do_tcp_server_delay(tcp_s, mono_time, 50);
+        tcp_server_get_handshake_stats(tcp_s, &stats);
+    }
+
+    ck_assert_msg(stats.rejected == 1, "Expected 1 rejected connection, got %u.", (unsigned)stats.rejected);
+
+    for (uint32_t i = 0; i < RATE_LIMIT_BURST + 1; ++i) {
+        kill_sock(ns, socks[i]);
+    }
+
+    kill_tcp_server(tcp_s);
+    logger_kill(logger);
+    mono_time_free(mem, mono_time);
+}
+
 static void tcp_suite(void)
 {
     test_basic();
@@ -950,6 +1202,8 @@ static void tcp_suite(void)
     test_client_invalid();
     test_tcp_connection();
     test_tcp_connection2();
+    test_sharded_relay();
+    test_handshake_rate_limit();
 }
 
 int main(void)
@@ -9,31 +9,6 @@
 #include "auto_test_support.h"
 #include "check_compat.h"
 
-static void test_bucketnum(void)
-{
-    const Random *rng = os_random();
-    ck_assert(rng != nullptr);
-    uint8_t key1[CRYPTO_PUBLIC_KEY_SIZE], key2[CRYPTO_PUBLIC_KEY_SIZE];
-    random_bytes(rng, key1, sizeof(key1));
-    memcpy(key2, key1, CRYPTO_PUBLIC_KEY_SIZE);
-
-    ck_assert_msg(announce_get_bucketnum(key1, key2) == 0, "Bad bucketnum");
-
-    key2[4] ^= 0x09;
-    key2[5] ^= 0xc5;
-
-    ck_assert_msg(announce_get_bucketnum(key1, key2) == 7, "Bad bucketnum");
-
-    key2[4] ^= 0x09;
-
-    ck_assert_msg(announce_get_bucketnum(key1, key2) == 17, "Bad bucketnum");
-
-    key2[5] ^= 0xc5;
-    key2[31] ^= 0x09;
-
-    ck_assert_msg(announce_get_bucketnum(key1, key2) == 4, "Bad bucketnum");
-}
-
 typedef struct Announce_Test_Data {
     uint8_t data[MAX_ANNOUNCEMENT_SIZE];
     uint16_t length;
@@ -76,8 +51,12 @@ static void test_store_data(void)
     random_bytes(rng, test_data.data, sizeof(test_data.data));
     test_data.length = sizeof(test_data.data);
 
+    const uint8_t *const base = dht_get_self_public_key(dht);
+
     uint8_t key[CRYPTO_PUBLIC_KEY_SIZE];
     random_bytes(rng, key, sizeof(key));
+    /* Farther from our DHT key than all keys stored below. */
+    key[0] = base[0] ^ 0x80;
 
     ck_assert_msg(!announce_on_stored(announce, key, nullptr, nullptr), "Unstored announcement exists");
 
@@ -88,12 +67,16 @@ static void test_store_data(void)
 
     ck_assert_msg(test_data.passed, "Bad stored announcement data");
 
-    const uint8_t *const base = dht_get_self_public_key(dht);
+    ck_assert_msg(!announce_set_capacity(announce, 0), "accepted empty store");
+    ck_assert_msg(!announce_set_capacity(announce, ANNOUNCE_MAX_CAPACITY + 1), "accepted too large store");
+    /* Room for base and all but the farthest of the test keys. */
+    ck_assert_msg(announce_set_capacity(announce, 9), "failed to set capacity");
+
     ck_assert_msg(announce_store_data(announce, base, test_data.data, sizeof(test_data.data), 1), "failed to store base");
 
-    uint8_t test_keys[ANNOUNCE_BUCKET_SIZE + 1][CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t test_keys[9][CRYPTO_PUBLIC_KEY_SIZE];
 
-    for (uint8_t i = 0; i < ANNOUNCE_BUCKET_SIZE + 1; ++i) {
+    for (uint8_t i = 0; i < 9; ++i) {
         memcpy(test_keys[i], base, CRYPTO_PUBLIC_KEY_SIZE);
         test_keys[i][i] ^= 1;
         ck_assert_msg(announce_store_data(announce, test_keys[i], test_data.data, sizeof(test_data.data), 1),
@@ -103,6 +86,14 @@ static void test_store_data(void)
     ck_assert_msg(announce_on_stored(announce, base, nullptr, nullptr), "base was evicted");
     ck_assert_msg(!announce_on_stored(announce, test_keys[0], nullptr, nullptr), "furthest was not evicted");
     ck_assert_msg(!announce_store_data(announce, test_keys[0], nullptr, 0, 1), "furthest evicted closer");
+    ck_assert_msg(!announce_on_stored(announce, key, nullptr, nullptr), "first key was not evicted");
+
+    Announce_Stats stats;
+    announce_get_stats(announce, &stats);
+    ck_assert_msg(stats.size == 9 && stats.capacity == 9, "bad size %u/%u", stats.size, stats.capacity);
+    ck_assert_msg(stats.stored == 11, "bad stored count %u", (unsigned int)stats.stored);
+    ck_assert_msg(stats.evicted == 2, "bad evicted count %u", (unsigned int)stats.evicted);
+    ck_assert_msg(stats.rejected == 1, "bad rejected count %u", (unsigned int)stats.rejected);
 
     kill_announcements(announce);
     kill_forwarding(forwarding);
@@ -114,7 +105,6 @@ static void test_store_data(void)
 
 static void basic_announce_tests(void)
 {
-    test_bucketnum();
     test_store_data();
 }
 
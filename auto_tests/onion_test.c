@@ -314,8 +314,8 @@ static void test_basic(void)
 
     random_bytes(rng, sb_data, sizeof(sb_data));
     memcpy(&s, sb_data, sizeof(uint64_t));
-    memcpy(onion_announce_entry_public_key(onion2_a, 1), dht_get_self_public_key(onion2->dht), CRYPTO_PUBLIC_KEY_SIZE);
-    onion_announce_entry_set_time(onion2_a, 1, mono_time_get(mono_time2));
+    ck_assert_msg(onion_announce_entry_add(onion2_a, dht_get_self_public_key(onion2->dht), dht_get_self_public_key(onion2->dht)),
+                  "Failed to add an announce entry.");
     networking_registerhandler(onion1->net, NET_PACKET_ONION_DATA_RESPONSE, &handle_test_4, onion1);
     send_announce_request(log1, onion1->mem, onion1->net, rng, &path, &nodes[3],
                           dht_get_self_public_key(onion1->dht),
@@ -328,9 +328,7 @@ static void test_basic(void)
         do_onion(mono_time1, onion1);
         do_onion(mono_time2, onion2);
         c_sleep(50);
-    } while (memcmp(onion_announce_entry_public_key(onion2_a, ONION_ANNOUNCE_MAX_ENTRIES - 2),
-                    dht_get_self_public_key(onion1->dht),
-                    CRYPTO_PUBLIC_KEY_SIZE) != 0);
+    } while (!onion_announce_entry_exists(onion2_a, dht_get_self_public_key(onion1->dht)));
 
     c_sleep(1000);
     Logger *log3 = logger_new(mem);
@@ -151,7 +151,11 @@ static int tox_config_lookup_bool(const config_t *config, const char *path, bool
 
 bool get_general_config(const char *cfg_file_path, char **pid_file_path, char **keys_file_path, int *port,
                         bool *enable_ipv6, bool *enable_ipv4_fallback, bool *enable_lan_discovery, bool *enable_tcp_relay,
-                        uint16_t **tcp_relay_ports, int *tcp_relay_port_count, bool *enable_motd, char **motd)
+                        uint16_t **tcp_relay_ports, int *tcp_relay_port_count, bool *enable_motd, char **motd,
+                        int *threads, int *tcp_relay_threads, int *tcp_handshake_workers, int *tcp_handshake_rate,
+                        int *tcp_handshake_burst, int *tcp_stats_interval, int *shared_key_cache_size,
+                        int *shared_key_stats_interval, int *key_agreement_workers,
+                        int *onion_announce_entries, int *announce_entries, int *announce_stats_interval)
 {
     config_t cfg;
 
@@ -164,6 +168,18 @@ bool get_general_config(const char *cfg_file_path, char **pid_file_path, char **
     const char *const NAME_ENABLE_TCP_RELAY     = "enable_tcp_relay";
     const char *const NAME_ENABLE_MOTD          = "enable_motd";
     const char *const NAME_MOTD                 = "motd";
+    const char *const NAME_THREADS              = "threads";
+    const char *const NAME_TCP_RELAY_THREADS    = "tcp_relay_threads";
+    const char *const NAME_TCP_HANDSHAKE_WORKERS = "tcp_handshake_workers";
+    const char *const NAME_TCP_HANDSHAKE_RATE   = "tcp_handshake_rate";
+    const char *const NAME_TCP_HANDSHAKE_BURST  = "tcp_handshake_burst";
+    const char *const NAME_TCP_STATS_INTERVAL   = "tcp_stats_interval";
+    const char *const NAME_SHARED_KEY_CACHE_SIZE = "shared_key_cache_size";
+    const char *const NAME_SHARED_KEY_STATS_INTERVAL = "shared_key_stats_interval";
+    const char *const NAME_KEY_AGREEMENT_WORKERS = "key_agreement_workers";
+    const char *const NAME_ONION_ANNOUNCE_ENTRIES = "onion_announce_entries";
+    const char *const NAME_ANNOUNCE_ENTRIES     = "announce_entries";
+    const char *const NAME_ANNOUNCE_STATS_INTERVAL = "announce_stats_interval";
 
     config_init(&cfg);
 
@@ -278,6 +294,91 @@ bool get_general_config(const char *cfg_file_path, char **pid_file_path, char **
         snprintf(*motd, motd_length, "%s", tmp_motd);
     }
 
+    // Get number of request worker threads
+    if (config_lookup_int(&cfg, NAME_THREADS, threads) == CONFIG_FALSE) {
+        LOG_WRITE(LOG_LEVEL_WARNING, "No '%s' setting in configuration file.\n", NAME_THREADS);
+        LOG_WRITE(LOG_LEVEL_WARNING, "Using default '%s': %d\n", NAME_THREADS, DEFAULT_THREADS);
+        *threads = DEFAULT_THREADS;
+    }
+
+    // Get number of TCP relay threads
+    if (config_lookup_int(&cfg, NAME_TCP_RELAY_THREADS, tcp_relay_threads) == CONFIG_FALSE) {
+        LOG_WRITE(LOG_LEVEL_WARNING, "No '%s' setting in configuration file.\n", NAME_TCP_RELAY_THREADS);
+        LOG_WRITE(LOG_LEVEL_WARNING, "Using default '%s': %d\n", NAME_TCP_RELAY_THREADS, DEFAULT_TCP_RELAY_THREADS);
+        *tcp_relay_threads = DEFAULT_TCP_RELAY_THREADS;
+    }
+
+    // Get number of TCP handshake worker threads
+    if (config_lookup_int(&cfg, NAME_TCP_HANDSHAKE_WORKERS, tcp_handshake_workers) == CONFIG_FALSE) {
+        LOG_WRITE(LOG_LEVEL_WARNING, "No '%s' setting in configuration file.\n", NAME_TCP_HANDSHAKE_WORKERS);
+        LOG_WRITE(LOG_LEVEL_WARNING, "Using default '%s': %d\n", NAME_TCP_HANDSHAKE_WORKERS, DEFAULT_TCP_HANDSHAKE_WORKERS);
+        *tcp_handshake_workers = DEFAULT_TCP_HANDSHAKE_WORKERS;
+    }
+
+    // Get TCP handshake rate limit
+    if (config_lookup_int(&cfg, NAME_TCP_HANDSHAKE_RATE, tcp_handshake_rate) == CONFIG_FALSE) {
+        LOG_WRITE(LOG_LEVEL_WARNING, "No '%s' setting in configuration file.\n", NAME_TCP_HANDSHAKE_RATE);
+        LOG_WRITE(LOG_LEVEL_WARNING, "Using default '%s': %d\n", NAME_TCP_HANDSHAKE_RATE, DEFAULT_TCP_HANDSHAKE_RATE);
+        *tcp_handshake_rate = DEFAULT_TCP_HANDSHAKE_RATE;
+    }
+
+    if (config_lookup_int(&cfg, NAME_TCP_HANDSHAKE_BURST, tcp_handshake_burst) == CONFIG_FALSE) {
+        LOG_WRITE(LOG_LEVEL_WARNING, "No '%s' setting in configuration file.\n", NAME_TCP_HANDSHAKE_BURST);
+        LOG_WRITE(LOG_LEVEL_WARNING, "Using default '%s': %d\n", NAME_TCP_HANDSHAKE_BURST, DEFAULT_TCP_HANDSHAKE_BURST);
+        *tcp_handshake_burst = DEFAULT_TCP_HANDSHAKE_BURST;
+    }
+
+    // Get how often to log TCP relay statistics
+    if (config_lookup_int(&cfg, NAME_TCP_STATS_INTERVAL, tcp_stats_interval) == CONFIG_FALSE) {
+        LOG_WRITE(LOG_LEVEL_WARNING, "No '%s' setting in configuration file.\n", NAME_TCP_STATS_INTERVAL);
+        LOG_WRITE(LOG_LEVEL_WARNING, "Using default '%s': %d\n", NAME_TCP_STATS_INTERVAL, DEFAULT_TCP_STATS_INTERVAL);
+        *tcp_stats_interval = DEFAULT_TCP_STATS_INTERVAL;
+    }
+
+    // Get how many keys each shared key cache holds
+    if (config_lookup_int(&cfg, NAME_SHARED_KEY_CACHE_SIZE, shared_key_cache_size) == CONFIG_FALSE) {
+        LOG_WRITE(LOG_LEVEL_WARNING, "No '%s' setting in configuration file.\n", NAME_SHARED_KEY_CACHE_SIZE);
+        LOG_WRITE(LOG_LEVEL_WARNING, "Using default '%s': %d\n", NAME_SHARED_KEY_CACHE_SIZE, DEFAULT_SHARED_KEY_CACHE_SIZE);
+        *shared_key_cache_size = DEFAULT_SHARED_KEY_CACHE_SIZE;
+    }
+
+    // Get how often to log shared key cache statistics
+    if (config_lookup_int(&cfg, NAME_SHARED_KEY_STATS_INTERVAL, shared_key_stats_interval) == CONFIG_FALSE) {
+        LOG_WRITE(LOG_LEVEL_WARNING, "No '%s' setting in configuration file.\n", NAME_SHARED_KEY_STATS_INTERVAL);
+        LOG_WRITE(LOG_LEVEL_WARNING, "Using default '%s': %d\n", NAME_SHARED_KEY_STATS_INTERVAL,
+                  DEFAULT_SHARED_KEY_STATS_INTERVAL);
+        *shared_key_stats_interval = DEFAULT_SHARED_KEY_STATS_INTERVAL;
+    }
+
+    // Get how many threads compute the shared keys of new peers
+    if (config_lookup_int(&cfg, NAME_KEY_AGREEMENT_WORKERS, key_agreement_workers) == CONFIG_FALSE) {
+        LOG_WRITE(LOG_LEVEL_WARNING, "No '%s' setting in configuration file.\n", NAME_KEY_AGREEMENT_WORKERS);
+        LOG_WRITE(LOG_LEVEL_WARNING, "Using default '%s': %d\n", NAME_KEY_AGREEMENT_WORKERS, DEFAULT_KEY_AGREEMENT_WORKERS);
+        *key_agreement_workers = DEFAULT_KEY_AGREEMENT_WORKERS;
+    }
+
+    // Get how many onion announcements to store
+    if (config_lookup_int(&cfg, NAME_ONION_ANNOUNCE_ENTRIES, onion_announce_entries) == CONFIG_FALSE) {
+        LOG_WRITE(LOG_LEVEL_WARNING, "No '%s' setting in configuration file.\n", NAME_ONION_ANNOUNCE_ENTRIES);
+        LOG_WRITE(LOG_LEVEL_WARNING, "Using default '%s': %d\n", NAME_ONION_ANNOUNCE_ENTRIES, DEFAULT_ONION_ANNOUNCE_ENTRIES);
+        *onion_announce_entries = DEFAULT_ONION_ANNOUNCE_ENTRIES;
+    }
+
+    // Get how many DHT announcements to store
+    if (config_lookup_int(&cfg, NAME_ANNOUNCE_ENTRIES, announce_entries) == CONFIG_FALSE) {
+        LOG_WRITE(LOG_LEVEL_WARNING, "No '%s' setting in configuration file.\n", NAME_ANNOUNCE_ENTRIES);
+        LOG_WRITE(LOG_LEVEL_WARNING, "Using default '%s': %d\n", NAME_ANNOUNCE_ENTRIES, DEFAULT_ANNOUNCE_ENTRIES);
+        *announce_entries = DEFAULT_ANNOUNCE_ENTRIES;
+    }
+
+    // Get how often to log DHT announcement store statistics
+    if (config_lookup_int(&cfg, NAME_ANNOUNCE_STATS_INTERVAL, announce_stats_interval) == CONFIG_FALSE) {
+        LOG_WRITE(LOG_LEVEL_WARNING, "No '%s' setting in configuration file.\n", NAME_ANNOUNCE_STATS_INTERVAL);
+        LOG_WRITE(LOG_LEVEL_WARNING, "Using default '%s': %d\n", NAME_ANNOUNCE_STATS_INTERVAL,
+                  DEFAULT_ANNOUNCE_STATS_INTERVAL);
+        *announce_stats_interval = DEFAULT_ANNOUNCE_STATS_INTERVAL;
+    }
+
     config_destroy(&cfg);
 
     LOG_WRITE(LOG_LEVEL_INFO, "Successfully read:\n");
@@ -309,6 +410,19 @@ bool get_general_config(const char *cfg_file_path, char **pid_file_path, char **
         LOG_WRITE(LOG_LEVEL_INFO, "'%s': %s\n", NAME_MOTD, *motd);
     }
 
+    LOG_WRITE(LOG_LEVEL_INFO, "'%s': %d\n", NAME_THREADS,              *threads);
+    LOG_WRITE(LOG_LEVEL_INFO, "'%s': %d\n", NAME_TCP_RELAY_THREADS,    *tcp_relay_threads);
+    LOG_WRITE(LOG_LEVEL_INFO, "'%s': %d\n", NAME_TCP_HANDSHAKE_WORKERS, *tcp_handshake_workers);
+    LOG_WRITE(LOG_LEVEL_INFO, "'%s': %d\n", NAME_TCP_HANDSHAKE_RATE,   *tcp_handshake_rate);
+    LOG_WRITE(LOG_LEVEL_INFO, "'%s': %d\n", NAME_TCP_HANDSHAKE_BURST,  *tcp_handshake_burst);
+    LOG_WRITE(LOG_LEVEL_INFO, "'%s': %d\n", NAME_TCP_STATS_INTERVAL,   *tcp_stats_interval);
+    LOG_WRITE(LOG_LEVEL_INFO, "'%s': %d\n", NAME_SHARED_KEY_CACHE_SIZE, *shared_key_cache_size);
+    LOG_WRITE(LOG_LEVEL_INFO, "'%s': %d\n", NAME_SHARED_KEY_STATS_INTERVAL, *shared_key_stats_interval);
+    LOG_WRITE(LOG_LEVEL_INFO, "'%s': %d\n", NAME_KEY_AGREEMENT_WORKERS, *key_agreement_workers);
+    LOG_WRITE(LOG_LEVEL_INFO, "'%s': %d\n", NAME_ONION_ANNOUNCE_ENTRIES, *onion_announce_entries);
+    LOG_WRITE(LOG_LEVEL_INFO, "'%s': %d\n", NAME_ANNOUNCE_ENTRIES,     *announce_entries);
+    LOG_WRITE(LOG_LEVEL_INFO, "'%s': %d\n", NAME_ANNOUNCE_STATS_INTERVAL, *announce_stats_interval);
+
     return true;
 }
 
@@ -24,7 +24,11 @@
  */
 bool get_general_config(const char *cfg_file_path, char **pid_file_path, char **keys_file_path, int *port,
                         bool *enable_ipv6, bool *enable_ipv4_fallback, bool *enable_lan_discovery, bool *enable_tcp_relay,
-                        uint16_t **tcp_relay_ports, int *tcp_relay_port_count, bool *enable_motd, char **motd);
+                        uint16_t **tcp_relay_ports, int *tcp_relay_port_count, bool *enable_motd, char **motd,
+                        int *threads, int *tcp_relay_threads, int *tcp_handshake_workers, int *tcp_handshake_rate,
+                        int *tcp_handshake_burst, int *tcp_stats_interval, int *shared_key_cache_size,
+                        int *shared_key_stats_interval, int *key_agreement_workers,
+                        int *onion_announce_entries, int *announce_entries, int *announce_stats_interval);
 
 /**
  * Bootstraps off nodes listed in the config file.
@@ -24,5 +24,17 @@
 #define DEFAULT_TCP_RELAY_PORTS       443, 3389, 33445 // comma-separated list of ports
 #define DEFAULT_ENABLE_MOTD           true
 #define DEFAULT_MOTD                  DAEMON_NAME
+#define DEFAULT_THREADS               0 // handle all requests on the main thread
+#define DEFAULT_TCP_RELAY_THREADS     0 // relay all TCP connections on the main thread
+#define DEFAULT_TCP_HANDSHAKE_WORKERS 0 // verify TCP handshakes on the relay threads
+#define DEFAULT_TCP_HANDSHAKE_RATE    10 // handshakes per second per IP address
+#define DEFAULT_TCP_HANDSHAKE_BURST   40
+#define DEFAULT_TCP_STATS_INTERVAL    0 // don't log TCP relay statistics
+#define DEFAULT_SHARED_KEY_CACHE_SIZE 16384 // keys per cache, 7 caches of 72 bytes per key
+#define DEFAULT_SHARED_KEY_STATS_INTERVAL 0 // don't log shared key cache statistics
+#define DEFAULT_KEY_AGREEMENT_WORKERS 0 // compute shared keys in the packet handlers
+#define DEFAULT_ONION_ANNOUNCE_ENTRIES 160 // the toxcore default
+#define DEFAULT_ANNOUNCE_ENTRIES      256 // the toxcore default
+#define DEFAULT_ANNOUNCE_STATS_INTERVAL 0 // don't log DHT announcement store statistics
 
 #endif // C_TOXCORE_OTHER_BOOTSTRAP_DAEMON_SRC_CONFIG_DEFAULTS_H
@@ -0,0 +1,291 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <time.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../../../toxcore/DHT.h"
+#include "../../../toxcore/crypto_core.h"
+#include "../../../toxcore/ev.h"
+#include "../../../toxcore/logger.h"
+#include "../../../toxcore/mono_time.h"
+#include "../../../toxcore/net.h"
+#include "../../../toxcore/network.h"
+#include "../../../toxcore/os_event.h"
+#include "../../../toxcore/os_memory.h"
+#include "../../../toxcore/os_network.h"
+#include "../../../toxcore/os_random.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+/** The fixed sleep of the old tox-bootstrapd main loop. */
+constexpr auto kPollInterval = std::chrono::milliseconds(30);
+
+constexpr uint32_t kMaxEvResults = 16;
+
+constexpr uint16_t kNodesRequestSize
+    = 1 + CRYPTO_PUBLIC_KEY_SIZE + CRYPTO_NONCE_SIZE + CRYPTO_PUBLIC_KEY_SIZE + sizeof(uint64_t) + CRYPTO_MAC_SIZE;
+
+int64_t thread_cpu_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return int64_t{ts.tv_sec} * 1000000000 + ts.tv_nsec;
+}
+
+struct RecvCounter {
+    int64_t packets = 0;
+};
+
+/**
+ * @brief The tox-bootstrapd main loop, before and after moving it onto Ev.
+ *
+ * Arg 0 polls every 30 ms like the old loop. Arg 1 blocks in `ev_run` on the
+ * UDP socket with the timeout from `dht_run_interval`.
+ */
+class MainLoopBenchFixture : public benchmark::Fixture {
+public:
+    void SetUp(::benchmark::State &state) override
+    {
+        mem = os_memory();
+        rng = os_random();
+        ns = os_network();
+        if (rng == nullptr || ns == nullptr) {
+            setup_error = "os_random or os_network failed";
+            return;
+        }
+
+        log = logger_new(mem);
+        mono_time = mono_time_new(mem, nullptr, nullptr);
+        if (log == nullptr || mono_time == nullptr) {
+            setup_error = "failed to create logger or mono_time";
+            return;
+        }
+
+        IP ip;
+        ip_init(&ip, false);
+        ip.ip.v4 = get_ip4_loopback();
+
+        server_net = new_networking_ex(log, mem, ns, &ip, 33445, 33545, nullptr);
+        client_net = new_networking_ex(log, mem, ns, &ip, 33445, 33545, nullptr);
+        if (server_net == nullptr || client_net == nullptr) {
+            setup_error = "new_networking_ex failed";
+            return;
+        }
+
+        dht = new_dht(log, mem, rng, ns, mono_time, server_net, true, false);
+        if (dht == nullptr) {
+            setup_error = "new_dht failed";
+            return;
+        }
+
+        event_driven = state.range(0) != 0;
+        if (event_driven) {
+            ev = os_event_new(mem, log);
+            if (ev == nullptr || !ev_add(ev, net_sock(server_net), EV_READ, server_net)) {
+                setup_error = "failed to set up event loop";
+                return;
+            }
+        }
+
+        networking_registerhandler(
+            client_net, NET_PACKET_NODES_RESPONSE,
+            [](void *object, const IP_Port *, const uint8_t *, uint16_t, void *) {
+                ++static_cast<RecvCounter *>(object)->packets;
+                return 0;
+            },
+            &counter);
+
+        if (!make_request()) {
+            setup_error = "failed to create nodes request";
+            return;
+        }
+
+        server_ip_port.ip = ip;
+        server_ip_port.port = net_htons(net_port(server_net));
+
+        running = true;
+        server_thread = std::thread([this]() { run_server(); });
+    }
+
+    void TearDown(const ::benchmark::State &state) override
+    {
+        if (server_thread.joinable()) {
+            running = false;
+            // Wake the server up if it is blocked in ev_run.
+            const uint8_t wakeup = 0xff;
+            sendpacket(client_net, &server_ip_port, &wakeup, sizeof(wakeup));
+            server_thread.join();
+        }
+
+        kill_dht(dht);
+        ev_kill(ev);
+        kill_networking(client_net);
+        kill_networking(server_net);
+        mono_time_free(mem, mono_time);
+        logger_kill(log);
+        dht = nullptr;
+        ev = nullptr;
+        client_net = nullptr;
+        server_net = nullptr;
+        mono_time = nullptr;
+        log = nullptr;
+        counter = RecvCounter{};
+        server_cpu_ns = 0;
+        server_wakeups = 0;
+    }
+
+protected:
+    void run_server()
+    {
+        const int64_t cpu_start = thread_cpu_ns();
+        std::array<Ev_Result, kMaxEvResults> results;
+
+        while (running) {
+            mono_time_update(mono_time);
+            do_dht(dht);
+            networking_poll(server_net, nullptr);
+            networking_flush(server_net);
+
+            if (event_driven) {
+                mono_time_update(mono_time);
+                ev_run(ev, results.data(), results.size(), static_cast<int32_t>(dht_run_interval(dht)));
+            } else {
+                std::this_thread::sleep_for(kPollInterval);
+            }
+
+            ++server_wakeups;
+            server_cpu_ns = thread_cpu_ns() - cpu_start;
+        }
+    }
+
+    bool make_request()
+    {
+        std::array<uint8_t, CRYPTO_PUBLIC_KEY_SIZE> pk;
+        std::array<uint8_t, CRYPTO_SECRET_KEY_SIZE> sk;
+        crypto_new_keypair(rng, pk.data(), sk.data());
+
+        std::array<uint8_t, CRYPTO_SHARED_KEY_SIZE> shared_key;
+        if (encrypt_precompute(dht_get_self_public_key(dht), sk.data(), shared_key.data()) != 0) {
+            return false;
+        }
+
+        std::array<uint8_t, CRYPTO_PUBLIC_KEY_SIZE + sizeof(uint64_t)> plain;
+        random_bytes(rng, plain.data(), plain.size());
+
+        request.resize(kNodesRequestSize);
+        return dht_create_packet(mem, rng, pk.data(), shared_key.data(), NET_PACKET_NODES_REQUEST, plain.data(),
+                                 plain.size(), request.data(), request.size())
+               == kNodesRequestSize;
+    }
+
+    const Memory *mem = nullptr;
+    const Random *rng = nullptr;
+    const Network *ns = nullptr;
+    Logger *log = nullptr;
+    Mono_Time *mono_time = nullptr;
+    Networking_Core *server_net = nullptr;
+    Networking_Core *client_net = nullptr;
+    DHT *dht = nullptr;
+    Ev *ev = nullptr;
+    bool event_driven = false;
+    IP_Port server_ip_port{};
+    std::vector<uint8_t> request;
+    RecvCounter counter;
+    std::atomic<bool> running{false};
+    std::atomic<int64_t> server_cpu_ns{0};
+    std::atomic<int64_t> server_wakeups{0};
+    std::thread server_thread;
+    std::string setup_error;
+};
+
+/** @brief Server CPU time and wakeups while no packets arrive. */
+BENCHMARK_DEFINE_F(MainLoopBenchFixture, Idle)(benchmark::State &state)
+{
+    if (!setup_error.empty()) {
+        state.SkipWithError(setup_error.c_str());
+        return;
+    }
+
+    const int64_t cpu_before = server_cpu_ns;
+    const int64_t wakeups_before = server_wakeups;
+    const Clock::time_point start = Clock::now();
+
+    for (auto _ : state) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    const double wall_ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    state.counters["cpu_percent"] = 100.0 * static_cast<double>(server_cpu_ns - cpu_before) / wall_ns;
+    state.counters["wakeups_per_s"] = static_cast<double>(server_wakeups - wakeups_before) * 1e9 / wall_ns;
+}
+
+BENCHMARK_REGISTER_F(MainLoopBenchFixture, Idle)->Arg(0)->Arg(1)->Iterations(20)->UseRealTime();
+
+/**
+ * @brief Time from sending a nodes request to receiving the response.
+ *
+ * Requests are sent at random points in time, so the polling loop adds on
+ * average half its sleep to every reply.
+ */
+BENCHMARK_DEFINE_F(MainLoopBenchFixture, ReplyLatency)(benchmark::State &state)
+{
+    if (!setup_error.empty()) {
+        state.SkipWithError(setup_error.c_str());
+        return;
+    }
+
+    std::minstd_rand gen(42);
+    std::uniform_int_distribution<int> gap_us(0, 30000);
+    std::vector<double> latencies_us;
+    latencies_us.reserve(state.max_iterations);
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::this_thread::sleep_for(std::chrono::microseconds(gap_us(gen)));
+        state.ResumeTiming();
+
+        const int64_t expected = counter.packets + 1;
+        const Clock::time_point sent = Clock::now();
+        sendpacket(client_net, &server_ip_port, request.data(), request.size());
+
+        const Clock::time_point deadline = sent + std::chrono::seconds(1);
+        while (counter.packets < expected && Clock::now() < deadline) {
+            networking_poll(client_net, nullptr);
+        }
+
+        if (counter.packets >= expected) {
+            latencies_us.push_back(std::chrono::duration<double, std::micro>(Clock::now() - sent).count());
+        }
+    }
+
+    if (latencies_us.empty()) {
+        state.SkipWithError("no responses received");
+        return;
+    }
+
+    std::sort(latencies_us.begin(), latencies_us.end());
+    state.counters["p50_us"] = latencies_us[latencies_us.size() / 2];
+    state.counters["p99_us"] = latencies_us[latencies_us.size() * 99 / 100];
+    state.counters["lost"] = static_cast<double>(state.iterations()) - static_cast<double>(latencies_us.size());
+}
+
+BENCHMARK_REGISTER_F(MainLoopBenchFixture, ReplyLatency)->Arg(0)->Arg(1)->Iterations(300)->UseRealTime();
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,364 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+/*
+ * Tox DHT bootstrap daemon.
+ * Worker threads answering stateless requests in parallel.
+ */
+#include "request_workers.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../../toxcore/ccompat.h"
+#include "../../../toxcore/network.h"
+
+/** Number of received packets that can wait for a worker. */
+#define REQUEST_QUEUE_SIZE 1024
+
+/**
+ * Number of requests a worker handles per acquisition of the state lock. Keeps
+ * lock traffic low without making the main loop wait long for its turn.
+ */
+#define REQUESTS_PER_LOCK 8
+
+typedef struct Request_Job {
+    packet_handler_cb *_Nullable handler;
+    void *_Nullable handler_object;
+    IP_Port source;
+    uint16_t length;
+    uint8_t packet[MAX_UDP_PACKET_SIZE];
+} Request_Job;
+
+/**
+ * Readers-writer lock that lets a waiting writer in before new readers, so the
+ * main loop gets its turn even while the workers are saturated.
+ */
+typedef struct State_Lock {
+    pthread_mutex_t mutex;
+    pthread_cond_t readers_cond;
+    pthread_cond_t writer_cond;
+    uint32_t readers;
+    uint32_t writers_waiting;
+    bool writer;
+} State_Lock;
+
+struct Request_Workers {
+    Networking_Core *_Nonnull net;
+
+    State_Lock state;
+
+    pthread_mutex_t queue_mutex;
+    pthread_cond_t queue_not_empty;
+    pthread_cond_t queue_not_full;
+    Request_Job *_Nonnull queue;
+    uint32_t queue_head;
+    uint32_t queue_count;
+    bool stopping;
+
+    pthread_t *_Nonnull threads;
+    uint32_t num_threads;
+};
+
+static bool state_lock_init(State_Lock *_Nonnull lock)
+{
+    if (pthread_mutex_init(&lock->mutex, nullptr) != 0) {
+        return false;
+    }
+
+    if (pthread_cond_init(&lock->readers_cond, nullptr) != 0) {
+        pthread_mutex_destroy(&lock->mutex);
+        return false;
+    }
+
+    if (pthread_cond_init(&lock->writer_cond, nullptr) != 0) {
+        pthread_cond_destroy(&lock->readers_cond);
+        pthread_mutex_destroy(&lock->mutex);
+        return false;
+    }
+
+    lock->readers = 0;
+    lock->writers_waiting = 0;
+    lock->writer = false;
+    return true;
+}
+
+static void state_lock_destroy(State_Lock *_Nonnull lock)
+{
+    pthread_cond_destroy(&lock->writer_cond);
+    pthread_cond_destroy(&lock->readers_cond);
+    pthread_mutex_destroy(&lock->mutex);
+}
+
+static void state_lock_read(State_Lock *_Nonnull lock)
+{
+    pthread_mutex_lock(&lock->mutex);
+
+    while (lock->writer || lock->writers_waiting > 0) {
+        pthread_cond_wait(&lock->readers_cond, &lock->mutex);
+    }
+
+    ++lock->readers;
+    pthread_mutex_unlock(&lock->mutex);
+}
+
+static void state_unlock_read(State_Lock *_Nonnull lock)
+{
+    pthread_mutex_lock(&lock->mutex);
+    --lock->readers;
+
+    if (lock->readers == 0 && lock->writers_waiting > 0) {
+        pthread_cond_signal(&lock->writer_cond);
+    }
+
+    pthread_mutex_unlock(&lock->mutex);
+}
+
+static void state_lock_write(State_Lock *_Nonnull lock)
+{
+    pthread_mutex_lock(&lock->mutex);
+    ++lock->writers_waiting;
+
+    while (lock->writer || lock->readers > 0) {
+        pthread_cond_wait(&lock->writer_cond, &lock->mutex);
+    }
+
+    --lock->writers_waiting;
+    lock->writer = true;
+    pthread_mutex_unlock(&lock->mutex);
+}
+
+static void state_unlock_write(State_Lock *_Nonnull lock)
+{
+    pthread_mutex_lock(&lock->mutex);
+    lock->writer = false;
+
+    if (lock->writers_waiting > 0) {
+        pthread_cond_signal(&lock->writer_cond);
+    } else {
+        pthread_cond_broadcast(&lock->readers_cond);
+    }
+
+    pthread_mutex_unlock(&lock->mutex);
+}
+
+/** @brief Take the next job off the queue. The caller must hold the queue mutex. */
+static void queue_pop_locked(Request_Workers *_Nonnull workers, Request_Job *_Nonnull job)
+{
+    const Request_Job *const front = &workers->queue[workers->queue_head];
+    job->handler = front->handler;
+    job->handler_object = front->handler_object;
+    job->source = front->source;
+    job->length = front->length;
+    memcpy(job->packet, front->packet, front->length);
+
+    workers->queue_head = (workers->queue_head + 1) % REQUEST_QUEUE_SIZE;
+    --workers->queue_count;
+    pthread_cond_signal(&workers->queue_not_full);
+}
+
+static void *_Nullable request_worker_run(void *_Nonnull arg)
+{
+    Request_Workers *const workers = (Request_Workers *)arg;
+    Request_Job *const job = (Request_Job *)malloc(sizeof(Request_Job));
+
+    if (job == nullptr) {
+        return nullptr;
+    }
+
+    while (true) {
+        pthread_mutex_lock(&workers->queue_mutex);
+
+        while (workers->queue_count == 0 && !workers->stopping) {
+            pthread_cond_wait(&workers->queue_not_empty, &workers->queue_mutex);
+        }
+
+        if (workers->stopping) {
+            pthread_mutex_unlock(&workers->queue_mutex);
+            break;
+        }
+
+        pthread_mutex_unlock(&workers->queue_mutex);
+
+        state_lock_read(&workers->state);
+
+        for (uint32_t i = 0; i < REQUESTS_PER_LOCK; ++i) {
+            pthread_mutex_lock(&workers->queue_mutex);
+
+            if (workers->queue_count == 0) {
+                pthread_mutex_unlock(&workers->queue_mutex);
+                break;
+            }
+
+            queue_pop_locked(workers, job);
+            pthread_mutex_unlock(&workers->queue_mutex);
+
+            job->handler(job->handler_object, &job->source, job->packet, job->length, nullptr);
+        }
+
+        state_unlock_read(&workers->state);
+
+        // Replies are queued in batched mode, send them before waiting again.
+        networking_flush(workers->net);
+    }
+
+    free(job);
+    return nullptr;
+}
+
+static void request_workers_dispatch(void *_Nullable object, packet_handler_cb *_Nonnull handler, void *_Nullable handler_object,
+                                     const IP_Port *_Nonnull source, const uint8_t *_Nonnull packet, uint16_t length, bool concurrent,
+                                     void *_Nullable userdata)
+{
+    Request_Workers *const workers = (Request_Workers *)object;
+
+    if (!concurrent || length > MAX_UDP_PACKET_SIZE) {
+        state_lock_write(&workers->state);
+        handler(handler_object, source, packet, length, userdata);
+        state_unlock_write(&workers->state);
+        return;
+    }
+
+    pthread_mutex_lock(&workers->queue_mutex);
+
+    // Block the receiver rather than dropping requests. The kernel drops
+    // packets for us once the socket buffer is full.
+    while (workers->queue_count == REQUEST_QUEUE_SIZE && !workers->stopping) {
+        pthread_cond_wait(&workers->queue_not_full, &workers->queue_mutex);
+    }
+
+    if (workers->stopping) {
+        pthread_mutex_unlock(&workers->queue_mutex);
+        return;
+    }
+
+    Request_Job *const job = &workers->queue[(workers->queue_head + workers->queue_count) % REQUEST_QUEUE_SIZE];
+    job->handler = handler;
+    job->handler_object = handler_object;
+    job->source = *source;
+    job->length = length;
+    memcpy(job->packet, packet, length);
+    ++workers->queue_count;
+
+    pthread_cond_signal(&workers->queue_not_empty);
+    pthread_mutex_unlock(&workers->queue_mutex);
+}
+
+/** @brief Wake up and join the first `count` threads. */
+static void request_workers_stop(Request_Workers *_Nonnull workers, uint32_t count)
+{
+    pthread_mutex_lock(&workers->queue_mutex);
+    workers->stopping = true;
+    pthread_cond_broadcast(&workers->queue_not_empty);
+    pthread_cond_broadcast(&workers->queue_not_full);
+    pthread_mutex_unlock(&workers->queue_mutex);
+
+    for (uint32_t i = 0; i < count; ++i) {
+        pthread_join(workers->threads[i], nullptr);
+    }
+}
+
+static void request_workers_free(Request_Workers *_Nonnull workers)
+{
+    pthread_cond_destroy(&workers->queue_not_full);
+    pthread_cond_destroy(&workers->queue_not_empty);
+    pthread_mutex_destroy(&workers->queue_mutex);
+    state_lock_destroy(&workers->state);
+    free(workers->threads);
+    free(workers->queue);
+    free(workers);
+}
+
+Request_Workers *request_workers_new(Networking_Core *net, uint32_t threads)
+{
+    if (threads == 0 || threads > MAX_REQUEST_WORKERS) {
+        return nullptr;
+    }
+
+    Request_Workers *const workers = (Request_Workers *)calloc(1, sizeof(Request_Workers));
+
+    if (workers == nullptr) {
+        return nullptr;
+    }
+
+    Request_Job *const queue = (Request_Job *)calloc(REQUEST_QUEUE_SIZE, sizeof(Request_Job));
+    pthread_t *const thread_ids = (pthread_t *)calloc(threads, sizeof(pthread_t));
+
+    if (queue == nullptr || thread_ids == nullptr) {
+        free(thread_ids);
+        free(queue);
+        free(workers);
+        return nullptr;
+    }
+
+    workers->net = net;
+    workers->queue = queue;
+    workers->threads = thread_ids;
+
+    if (!state_lock_init(&workers->state)) {
+        free(thread_ids);
+        free(queue);
+        free(workers);
+        return nullptr;
+    }
+
+    if (pthread_mutex_init(&workers->queue_mutex, nullptr) != 0
+            || pthread_cond_init(&workers->queue_not_empty, nullptr) != 0
+            || pthread_cond_init(&workers->queue_not_full, nullptr) != 0) {
+        state_lock_destroy(&workers->state);
+        free(thread_ids);
+        free(queue);
+        free(workers);
+        return nullptr;
+    }
+
+    for (uint32_t i = 0; i < threads; ++i) {
+        if (pthread_create(&workers->threads[i], nullptr, request_worker_run, workers) != 0) {
+            request_workers_stop(workers, i);
+            request_workers_free(workers);
+            return nullptr;
+        }
+    }
+
+    workers->num_threads = threads;
+
+    if (!networking_set_dispatcher(net, request_workers_dispatch, workers)) {
+        request_workers_stop(workers, threads);
+        request_workers_free(workers);
+        return nullptr;
+    }
+
+    return workers;
+}
+
+void request_workers_kill(Request_Workers *workers)
+{
+    if (workers == nullptr) {
+        return;
+    }
+
+    networking_set_dispatcher(workers->net, nullptr, nullptr);
+    request_workers_stop(workers, workers->num_threads);
+    request_workers_free(workers);
+}
+
+void request_workers_lock(Request_Workers *workers)
+{
+    if (workers == nullptr) {
+        return;
+    }
+
+    state_lock_write(&workers->state);
+}
+
+void request_workers_unlock(Request_Workers *workers)
+{
+    if (workers == nullptr) {
+        return;
+    }
+
+    state_unlock_write(&workers->state);
+}
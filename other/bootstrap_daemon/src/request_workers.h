@@ -0,0 +1,64 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+/*
+ * Tox DHT bootstrap daemon.
+ * Worker threads answering stateless requests in parallel.
+ */
+#ifndef C_TOXCORE_OTHER_BOOTSTRAP_DAEMON_SRC_REQUEST_WORKERS_H
+#define C_TOXCORE_OTHER_BOOTSTRAP_DAEMON_SRC_REQUEST_WORKERS_H
+
+#include <stdint.h>
+
+#include "../../../toxcore/attributes.h"
+#include "../../../toxcore/network.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Upper bound for the `threads` config option. */
+#define MAX_REQUEST_WORKERS 64
+
+/**
+ * The receiving thread keeps calling `networking_poll`. Packets with a
+ * concurrent handler (see `networking_registerhandler_concurrent`) are queued
+ * for the workers, all other packets are handled right away on the receiving
+ * thread while holding the state lock exclusively.
+ *
+ * Workers hold the state lock shared while running handlers, so everything
+ * else that touches DHT, onion or TCP server state on the main thread
+ * (`do_dht`, `do_gca`, `do_tcp_server`, ...) must run between
+ * `request_workers_lock` and `request_workers_unlock`.
+ */
+typedef struct Request_Workers Request_Workers;
+
+/**
+ * Starts `threads` worker threads and installs the dispatcher on `net`.
+ *
+ * The modules whose concurrent handlers are registered on `net` must have their
+ * locks allocated first, e.g. with `dht_enable_thread_safety`.
+ *
+ * @return nullptr on failure.
+ */
+Request_Workers *_Nullable request_workers_new(Networking_Core *_Nonnull net, uint32_t threads);
+
+/**
+ * Stops and joins the worker threads and uninstalls the dispatcher. Requests
+ * still in the queue are dropped.
+ */
+void request_workers_kill(Request_Workers *_Nullable workers);
+
+/**
+ * Takes the state lock exclusively, waiting for running handlers to finish.
+ * Does nothing if `workers` is nullptr.
+ */
+void request_workers_lock(Request_Workers *_Nullable workers);
+void request_workers_unlock(Request_Workers *_Nullable workers);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif // C_TOXCORE_OTHER_BOOTSTRAP_DAEMON_SRC_REQUEST_WORKERS_H
@@ -0,0 +1,253 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../../../toxcore/DHT.h"
+#include "../../../toxcore/crypto_core.h"
+#include "../../../toxcore/logger.h"
+#include "../../../toxcore/mono_time.h"
+#include "../../../toxcore/net.h"
+#include "../../../toxcore/network.h"
+#include "../../../toxcore/os_memory.h"
+#include "../../../toxcore/os_network.h"
+#include "../../../toxcore/os_random.h"
+#include "request_workers.h"
+
+namespace {
+
+using PublicKey = std::array<uint8_t, CRYPTO_PUBLIC_KEY_SIZE>;
+
+/** Distinct clients, more than the shared key cache holds so most requests pay for a key exchange. */
+constexpr uint32_t kNumClients = 1024;
+/** Nodes offered to the server DHT so responses carry a full set of nodes. */
+constexpr uint32_t kNumNodes = 2000;
+constexpr int kBurstSize = 256;
+
+constexpr uint16_t kNodesRequestSize
+    = 1 + CRYPTO_PUBLIC_KEY_SIZE + CRYPTO_NONCE_SIZE + CRYPTO_PUBLIC_KEY_SIZE + sizeof(uint64_t) + CRYPTO_MAC_SIZE;
+
+struct RecvCounter {
+    int64_t packets = 0;
+};
+
+/**
+ * @brief Nodes requests answered per second by a bootstrap node.
+ *
+ * The argument is the number of request worker threads. 0 answers every
+ * request on the receiving thread, as tox-bootstrapd does with `threads = 0`.
+ */
+class RequestWorkersBenchFixture : public benchmark::Fixture {
+public:
+    void SetUp(::benchmark::State &state) override
+    {
+        mem = os_memory();
+        rng = os_random();
+        ns = os_network();
+        if (rng == nullptr || ns == nullptr) {
+            setup_error = "os_random or os_network failed";
+            return;
+        }
+
+        log = logger_new(mem);
+        mono_time = mono_time_new(mem, nullptr, nullptr);
+        if (log == nullptr || mono_time == nullptr) {
+            setup_error = "failed to create logger or mono_time";
+            return;
+        }
+
+        IP ip;
+        ip_init(&ip, false);
+        ip.ip.v4 = get_ip4_loopback();
+
+        server_net = new_networking_ex(log, mem, ns, &ip, 33445, 33545, nullptr);
+        client_net = new_networking_ex(log, mem, ns, &ip, 33445, 33545, nullptr);
+        if (server_net == nullptr || client_net == nullptr) {
+            setup_error = "new_networking_ex failed";
+            return;
+        }
+
+        if (!networking_set_batching(server_net, true) || !networking_set_batching(client_net, true)) {
+            setup_error = "networking_set_batching failed";
+            return;
+        }
+
+        dht = new_dht(log, mem, rng, ns, mono_time, server_net, true, false);
+        if (dht == nullptr) {
+            setup_error = "new_dht failed";
+            return;
+        }
+
+        for (uint32_t i = 0; i < kNumNodes; ++i) {
+            PublicKey pk;
+            random_bytes(rng, pk.data(), pk.size());
+
+            IP_Port ip_port{};
+            ip_port.ip.family = net_family_ipv4();
+            ip_port.ip.ip.v4.uint32 = net_htonl(0x0a000000 + i);
+            ip_port.port = net_htons(33445);
+
+            addto_lists(dht, &ip_port, pk.data());
+        }
+
+        const int64_t threads = state.range(0);
+        if (threads > 0) {
+            if (!dht_enable_thread_safety(dht)) {
+                setup_error = "dht_enable_thread_safety failed";
+                return;
+            }
+
+            workers = request_workers_new(server_net, static_cast<uint32_t>(threads));
+            if (workers == nullptr) {
+                setup_error = "request_workers_new failed";
+                return;
+            }
+        }
+
+        networking_registerhandler(
+            client_net, NET_PACKET_NODES_RESPONSE,
+            [](void *object, const IP_Port *, const uint8_t *, uint16_t, void *) {
+                ++static_cast<RecvCounter *>(object)->packets;
+                return 0;
+            },
+            &counter);
+
+        if (!make_requests()) {
+            setup_error = "failed to create nodes requests";
+            return;
+        }
+
+        server_ip_port.ip = ip;
+        server_ip_port.port = net_htons(net_port(server_net));
+
+        running = true;
+        server_thread = std::thread([this]() {
+            while (running) {
+                networking_poll(server_net, nullptr);
+                networking_flush(server_net);
+            }
+        });
+    }
+
+    void TearDown(const ::benchmark::State &state) override
+    {
+        if (server_thread.joinable()) {
+            running = false;
+            server_thread.join();
+        }
+
+        request_workers_kill(workers);
+        kill_dht(dht);
+        kill_networking(client_net);
+        kill_networking(server_net);
+        mono_time_free(mem, mono_time);
+        logger_kill(log);
+        workers = nullptr;
+        dht = nullptr;
+        client_net = nullptr;
+        server_net = nullptr;
+        mono_time = nullptr;
+        log = nullptr;
+        requests.clear();
+        counter = RecvCounter{};
+    }
+
+protected:
+    /** One encrypted nodes request per client, each asking for a random target. */
+    bool make_requests()
+    {
+        const uint8_t *server_pk = dht_get_self_public_key(dht);
+        requests.resize(kNumClients);
+
+        for (std::vector<uint8_t> &request : requests) {
+            PublicKey pk;
+            std::array<uint8_t, CRYPTO_SECRET_KEY_SIZE> sk;
+            crypto_new_keypair(rng, pk.data(), sk.data());
+
+            std::array<uint8_t, CRYPTO_SHARED_KEY_SIZE> shared_key;
+            if (encrypt_precompute(server_pk, sk.data(), shared_key.data()) != 0) {
+                return false;
+            }
+
+            std::array<uint8_t, CRYPTO_PUBLIC_KEY_SIZE + sizeof(uint64_t)> plain;
+            random_bytes(rng, plain.data(), plain.size());
+
+            request.resize(kNodesRequestSize);
+            const int len = dht_create_packet(mem, rng, pk.data(), shared_key.data(), NET_PACKET_NODES_REQUEST,
+                                              plain.data(), plain.size(), request.data(), request.size());
+            if (len != kNodesRequestSize) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    const Memory *mem = nullptr;
+    const Random *rng = nullptr;
+    const Network *ns = nullptr;
+    Logger *log = nullptr;
+    Mono_Time *mono_time = nullptr;
+    Networking_Core *server_net = nullptr;
+    Networking_Core *client_net = nullptr;
+    DHT *dht = nullptr;
+    Request_Workers *workers = nullptr;
+    IP_Port server_ip_port{};
+    std::vector<std::vector<uint8_t>> requests;
+    RecvCounter counter;
+    std::atomic<bool> running{false};
+    std::thread server_thread;
+    std::string setup_error;
+};
+
+BENCHMARK_DEFINE_F(RequestWorkersBenchFixture, NodesRequests)(benchmark::State &state)
+{
+    if (!setup_error.empty()) {
+        state.SkipWithError(setup_error.c_str());
+        return;
+    }
+
+    size_t next = 0;
+
+    for (auto _ : state) {
+        const int64_t expected = counter.packets + kBurstSize;
+
+        for (int i = 0; i < kBurstSize; ++i) {
+            const std::vector<uint8_t> &request = requests[next];
+            next = (next + 1) % requests.size();
+            sendpacket(client_net, &server_ip_port, request.data(), request.size());
+        }
+        networking_flush(client_net);
+
+        // Loopback UDP may still drop under pressure, so stop after a few idle polls.
+        for (int idle = 0; counter.packets < expected && idle < 1000;) {
+            const int64_t before = counter.packets;
+            networking_poll(client_net, nullptr);
+            idle = counter.packets == before ? idle + 1 : 0;
+        }
+    }
+
+    state.SetItemsProcessed(counter.packets);
+    state.counters["sent"] = static_cast<double>(state.iterations() * kBurstSize);
+}
+
+BENCHMARK_REGISTER_F(RequestWorkersBenchFixture, NodesRequests)
+    ->Arg(0)
+    ->Arg(1)
+    ->Arg(2)
+    ->Arg(4)
+    ->Arg(8)
+    ->UseRealTime();
+
+}  // namespace
+
+BENCHMARK_MAIN();
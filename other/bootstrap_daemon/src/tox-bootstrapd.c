@@ -32,16 +32,20 @@
 #include "../../../toxcore/announce.h"
 #include "../../../toxcore/ccompat.h"
 #include "../../../toxcore/crypto_core.h"
+#include "../../../toxcore/ev.h"
 #include "../../../toxcore/forwarding.h"
 #include "../../../toxcore/group_announce.h"
 #include "../../../toxcore/group_onion_announce.h"
+#include "../../../toxcore/key_agreement.h"
 #include "../../../toxcore/logger.h"
 #include "../../../toxcore/mono_time.h"
 #include "../../../toxcore/network.h"
 #include "../../../toxcore/onion.h"
 #include "../../../toxcore/onion_announce.h"
+#include "../../../toxcore/os_event.h"
 #include "../../../toxcore/os_memory.h"
 #include "../../../toxcore/os_random.h"
+#include "../../../toxcore/shared_key_cache.h"
 
 // misc
 #include "../../bootstrap_node_packets.h"
@@ -50,6 +54,7 @@
 #include "config.h"
 #include "global.h"
 #include "log.h"
+#include "request_workers.h"
 
 static void sleep_milliseconds(uint32_t ms)
 {
@@ -59,6 +64,28 @@ static void sleep_milliseconds(uint32_t ms)
     nanosleep(&req, nullptr);
 }
 
+/** How often the main loop runs when there is no event loop to wait on. */
+#define POLL_INTERVAL_MS 30
+
+/** Number of ready sockets taken from the event loop per wakeup. */
+#define MAX_EV_RESULTS 16
+
+/**
+ * Blocks until one of the sockets registered with `ev` has something to read
+ * or `timeout_ms` passes. The results are not needed: networking_poll and
+ * do_tcp_server find the ready sockets themselves.
+ */
+static void wait_for_events(Ev *ev, uint32_t timeout_ms)
+{
+    if (ev == nullptr) {
+        sleep_milliseconds(timeout_ms < POLL_INTERVAL_MS ? timeout_ms : POLL_INTERVAL_MS);
+        return;
+    }
+
+    Ev_Result results[MAX_EV_RESULTS];
+    ev_run(ev, results, MAX_EV_RESULTS, timeout_ms > INT32_MAX ? INT32_MAX : (int32_t)timeout_ms);
+}
+
 // Uses the already existing key or creates one if it didn't exist
 //
 // returns true on success
@@ -106,6 +133,84 @@ static bool manage_keys(DHT *dht, const char *keys_file_path)
     return true;
 }
 
+// Logs the load of the TCP relay, with rates over the `interval` seconds since `last`
+
+static void log_tcp_stats(const TCP_Server *tcp_server, TCP_Server_Stats *last, uint64_t interval)
+{
+    TCP_Server_Stats stats;
+    tcp_server_get_stats(tcp_server, &stats);
+
+    const double seconds = interval == 0 ? 1.0 : (double)interval;
+
+    LOG_WRITE(LOG_LEVEL_INFO,
+              "TCP relay: %u connections, %u unconfirmed, %u incoming; "
+              "handshakes %.1f/s, %ju rejected, %ju failed, %u queued; "
+              "routed %.1f packets/s, %.1f KiB/s, %ju dropped; "
+              "send backlog %u/%u/%u/%u/%u, %u priority packets; "
+              "dropped connections: %ju timed out, %ju closed, %ju invalid, %ju replaced, %ju errors; "
+              "loop lag %u ms\n",
+              stats.accepted, stats.unconfirmed, stats.incoming,
+              (double)(stats.handshakes.accepted - last->handshakes.accepted) / seconds,
+              (uintmax_t)stats.handshakes.rejected, (uintmax_t)stats.handshakes.failed, stats.handshakes.queued,
+              (double)(stats.routed_packets - last->routed_packets) / seconds,
+              (double)(stats.routed_bytes - last->routed_bytes) / seconds / 1024.0,
+              (uintmax_t)stats.routed_dropped,
+              stats.send_backlog[0], stats.send_backlog[1], stats.send_backlog[2], stats.send_backlog[3],
+              stats.send_backlog[4], stats.priority_queued,
+              (uintmax_t)stats.kills[TCP_KILL_TIMEOUT], (uintmax_t)stats.kills[TCP_KILL_CLOSED],
+              (uintmax_t)stats.kills[TCP_KILL_INVALID], (uintmax_t)stats.kills[TCP_KILL_REPLACED],
+              (uintmax_t)stats.kills[TCP_KILL_ERROR],
+              stats.loop_lag);
+
+    *last = stats;
+}
+
+// Logs how well the shared key caches work, with rates over the `interval` seconds since `last`
+
+static void log_shared_key_stats(const DHT *dht, const Onion *onion, const Onion_Announce *onion_a,
+                                 const Announcements *announce, Shared_Key_Cache_Stats *last, uint64_t interval)
+{
+    Shared_Key_Cache_Stats stats = {0};
+    dht_add_shared_key_stats(dht, &stats);
+    onion_add_shared_key_stats(onion, &stats);
+    onion_announce_add_shared_key_stats(onion_a, &stats);
+    announce_add_shared_key_stats(announce, &stats);
+
+    const double seconds = interval == 0 ? 1.0 : (double)interval;
+    const uint64_t hits = stats.hits - last->hits;
+    const uint64_t lookups = hits + (stats.misses - last->misses);
+
+    LOG_WRITE(LOG_LEVEL_INFO,
+              "Shared key caches: %u/%u keys; %.1f lookups/s, %.1f%% hits; "
+              "%.1f keys computed/s, %ju evicted, %ju expired\n",
+              stats.size, stats.capacity,
+              (double)lookups / seconds,
+              lookups == 0 ? 100.0 : 100.0 * (double)hits / (double)lookups,
+              (double)(stats.misses - last->misses) / seconds,
+              (uintmax_t)(stats.evictions - last->evictions), (uintmax_t)(stats.expired - last->expired));
+
+    *last = stats;
+}
+
+// Logs how full the DHT announcement store is, with counters over the `interval` seconds since `last`
+
+static void log_announce_stats(const Announcements *announce, Announce_Stats *last, uint64_t interval)
+{
+    Announce_Stats stats;
+    announce_get_stats(announce, &stats);
+
+    const double seconds = interval == 0 ? 1.0 : (double)interval;
+
+    LOG_WRITE(LOG_LEVEL_INFO,
+              "DHT announcements: %u/%u stored; %.1f stored/s, %ju rejected, %ju evicted, %ju expired\n",
+              stats.size, stats.capacity,
+              (double)(stats.stored - last->stored) / seconds,
+              (uintmax_t)(stats.rejected - last->rejected), (uintmax_t)(stats.evicted - last->evicted),
+              (uintmax_t)(stats.expired - last->expired));
+
+    *last = stats;
+}
+
 // Prints public key
 
 static void print_public_key(const uint8_t *public_key)
@@ -255,9 +360,25 @@ int main(int argc, char *argv[])
     int tcp_relay_port_count = 0;
     bool enable_motd = false;
     char *motd = nullptr;
+    int threads = 0;
+    int tcp_relay_threads = 0;
+    int tcp_handshake_workers = 0;
+    int tcp_handshake_rate = 0;
+    int tcp_handshake_burst = 0;
+    int tcp_stats_interval = 0;
+    int shared_key_cache_size = 0;
+    int shared_key_stats_interval = 0;
+    int key_agreement_workers = 0;
+    int onion_announce_entries = 0;
+    int announce_entries = 0;
+    int announce_stats_interval = 0;
 
     if (get_general_config(cfg_file_path, &pid_file_path, &keys_file_path, &start_port, &enable_ipv6, &enable_ipv4_fallback,
-                           &enable_lan_discovery, &enable_tcp_relay, &tcp_relay_ports, &tcp_relay_port_count, &enable_motd, &motd)) {
+                           &enable_lan_discovery, &enable_tcp_relay, &tcp_relay_ports, &tcp_relay_port_count, &enable_motd, &motd,
+                           &threads, &tcp_relay_threads, &tcp_handshake_workers, &tcp_handshake_rate,
+                           &tcp_handshake_burst, &tcp_stats_interval, &shared_key_cache_size,
+                           &shared_key_stats_interval, &key_agreement_workers,
+                           &onion_announce_entries, &announce_entries, &announce_stats_interval)) {
         LOG_WRITE(LOG_LEVEL_INFO, "General config read successfully\n");
     } else {
         LOG_WRITE(LOG_LEVEL_ERROR, "Couldn't read config file: %s. Exiting.\n", cfg_file_path);
@@ -274,6 +395,116 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    if (threads < 0 || threads > MAX_REQUEST_WORKERS) {
+        LOG_WRITE(LOG_LEVEL_ERROR, "Invalid number of threads: %d, should be in [0, %d]. Exiting.\n", threads,
+                  MAX_REQUEST_WORKERS);
+        free(motd);
+        free(tcp_relay_ports);
+        free(keys_file_path);
+        free(pid_file_path);
+        return 1;
+    }
+
+    if (tcp_relay_threads < 0 || tcp_relay_threads > TCP_SERVER_MAX_THREADS) {
+        LOG_WRITE(LOG_LEVEL_ERROR, "Invalid number of TCP relay threads: %d, should be in [0, %d]. Exiting.\n",
+                  tcp_relay_threads, TCP_SERVER_MAX_THREADS);
+        free(motd);
+        free(tcp_relay_ports);
+        free(keys_file_path);
+        free(pid_file_path);
+        return 1;
+    }
+
+    if (tcp_handshake_workers < 0 || tcp_handshake_workers > TCP_SERVER_MAX_HANDSHAKE_WORKERS) {
+        LOG_WRITE(LOG_LEVEL_ERROR, "Invalid number of TCP handshake workers: %d, should be in [0, %d]. Exiting.\n",
+                  tcp_handshake_workers, TCP_SERVER_MAX_HANDSHAKE_WORKERS);
+        free(motd);
+        free(tcp_relay_ports);
+        free(keys_file_path);
+        free(pid_file_path);
+        return 1;
+    }
+
+    if (tcp_handshake_rate < 0 || tcp_handshake_rate > UINT16_MAX
+            || tcp_handshake_burst < 0 || tcp_handshake_burst > UINT16_MAX) {
+        LOG_WRITE(LOG_LEVEL_ERROR, "Invalid TCP handshake rate limit: %d per second, burst %d, should be in [0, %d]. Exiting.\n",
+                  tcp_handshake_rate, tcp_handshake_burst, UINT16_MAX);
+        free(motd);
+        free(tcp_relay_ports);
+        free(keys_file_path);
+        free(pid_file_path);
+        return 1;
+    }
+
+    if (tcp_stats_interval < 0) {
+        LOG_WRITE(LOG_LEVEL_ERROR, "Invalid TCP stats interval: %d, should be at least 0. Exiting.\n", tcp_stats_interval);
+        free(motd);
+        free(tcp_relay_ports);
+        free(keys_file_path);
+        free(pid_file_path);
+        return 1;
+    }
+
+    if (shared_key_cache_size < 1 || (uint32_t)shared_key_cache_size > SHARED_KEY_CACHE_MAX_CAPACITY) {
+        LOG_WRITE(LOG_LEVEL_ERROR, "Invalid shared key cache size: %d, should be in [1, %u]. Exiting.\n",
+                  shared_key_cache_size, SHARED_KEY_CACHE_MAX_CAPACITY);
+        free(motd);
+        free(tcp_relay_ports);
+        free(keys_file_path);
+        free(pid_file_path);
+        return 1;
+    }
+
+    if (shared_key_stats_interval < 0) {
+        LOG_WRITE(LOG_LEVEL_ERROR, "Invalid shared key stats interval: %d, should be at least 0. Exiting.\n",
+                  shared_key_stats_interval);
+        free(motd);
+        free(tcp_relay_ports);
+        free(keys_file_path);
+        free(pid_file_path);
+        return 1;
+    }
+
+    if (key_agreement_workers < 0 || key_agreement_workers > KEY_AGREEMENT_MAX_THREADS) {
+        LOG_WRITE(LOG_LEVEL_ERROR, "Invalid number of key agreement workers: %d, should be between 0 and %d. Exiting.\n",
+                  key_agreement_workers, KEY_AGREEMENT_MAX_THREADS);
+        free(motd);
+        free(tcp_relay_ports);
+        free(keys_file_path);
+        free(pid_file_path);
+        return 1;
+    }
+
+    if (onion_announce_entries < 1 || (uint32_t)onion_announce_entries > ONION_ANNOUNCE_MAX_CAPACITY) {
+        LOG_WRITE(LOG_LEVEL_ERROR, "Invalid number of onion announce entries: %d, should be in [1, %u]. Exiting.\n",
+                  onion_announce_entries, ONION_ANNOUNCE_MAX_CAPACITY);
+        free(motd);
+        free(tcp_relay_ports);
+        free(keys_file_path);
+        free(pid_file_path);
+        return 1;
+    }
+
+    if (announce_entries < 1 || (uint32_t)announce_entries > ANNOUNCE_MAX_CAPACITY) {
+        LOG_WRITE(LOG_LEVEL_ERROR, "Invalid number of announce entries: %d, should be in [1, %u]. Exiting.\n",
+                  announce_entries, ANNOUNCE_MAX_CAPACITY);
+        free(motd);
+        free(tcp_relay_ports);
+        free(keys_file_path);
+        free(pid_file_path);
+        return 1;
+    }
+
+    if (announce_stats_interval < 0) {
+        LOG_WRITE(LOG_LEVEL_ERROR, "Invalid announce stats interval: %d, should be at least 0. Exiting.\n",
+                  announce_stats_interval);
+        free(motd);
+        free(tcp_relay_ports);
+        free(keys_file_path);
+        free(pid_file_path);
+        return 1;
+    }
+
     if (!run_in_foreground) {
         switch (daemonize(log_backend, pid_file_path)) {
             case CLI_STATUS_OK:
@@ -326,6 +557,10 @@ int main(int argc, char *argv[])
         }
     }
 
+    if (!networking_set_batching(net, true)) {
+        LOG_WRITE(LOG_LEVEL_WARNING, "Couldn't enable batched UDP I/O. Continuing without it.\n");
+    }
+
     Mono_Time *const mono_time = mono_time_new(mem, nullptr, nullptr);
 
     if (mono_time == nullptr) {
@@ -435,12 +670,49 @@ int main(int argc, char *argv[])
 
     gca_onion_init(group_announce, onion_a);
 
+    const uint32_t key_capacity = (uint32_t)shared_key_cache_size;
+
+    if (!dht_set_shared_key_capacity(dht, key_capacity)
+            || !onion_set_shared_key_capacity(onion, key_capacity)
+            || !onion_announce_set_shared_key_capacity(onion_a, key_capacity)
+            || !announce_set_shared_key_capacity(announce, key_capacity)) {
+        LOG_WRITE(LOG_LEVEL_WARNING, "Couldn't allocate shared key caches of %d keys. Continuing with smaller caches.\n",
+                  shared_key_cache_size);
+    }
+
+    if (!onion_announce_set_capacity(onion_a, (uint32_t)onion_announce_entries)) {
+        LOG_WRITE(LOG_LEVEL_WARNING, "Couldn't allocate %d onion announce entries. Continuing with %d.\n",
+                  onion_announce_entries, ONION_ANNOUNCE_MAX_ENTRIES);
+    }
+
+    if (!announce_set_capacity(announce, (uint32_t)announce_entries)) {
+        LOG_WRITE(LOG_LEVEL_WARNING, "Couldn't set %d announce entries. Continuing with %d.\n",
+                  announce_entries, ANNOUNCE_DEFAULT_CAPACITY);
+    }
+
+    Key_Agreement *key_agreement = nullptr;
+
+    if (key_agreement_workers > 0) {
+        key_agreement = key_agreement_new(logger, mem, net, (uint32_t)key_agreement_workers);
+
+        if (key_agreement != nullptr) {
+            dht_register_key_agreement(dht, key_agreement);
+            onion_register_key_agreement(onion, key_agreement);
+            onion_announce_register_key_agreement(onion_a, key_agreement);
+            LOG_WRITE(LOG_LEVEL_INFO, "Started %d key agreement worker threads.\n", key_agreement_workers);
+        } else {
+            LOG_WRITE(LOG_LEVEL_WARNING, "Couldn't start key agreement worker threads. "
+                      "Continuing to compute shared keys in the packet handlers.\n");
+        }
+    }
+
     if (enable_motd) {
         if (bootstrap_set_callbacks(net, DAEMON_VERSION_NUMBER, (uint8_t *)motd, strlen(motd) + 1) == 0) {
             LOG_WRITE(LOG_LEVEL_INFO, "Set MOTD successfully.\n");
             free(motd);
         } else {
             LOG_WRITE(LOG_LEVEL_ERROR, "Couldn't set MOTD: %s. Exiting.\n", motd);
+            key_agreement_kill(key_agreement);
             kill_onion_announce(onion_a);
             kill_gca(group_announce);
             kill_onion(onion);
@@ -462,6 +734,7 @@ int main(int argc, char *argv[])
         free(keys_file_path);
     } else {
         LOG_WRITE(LOG_LEVEL_ERROR, "Couldn't read/write: %s. Exiting.\n", keys_file_path);
+        key_agreement_kill(key_agreement);
         kill_onion_announce(onion_a);
         kill_gca(group_announce);
         kill_onion(onion);
@@ -481,6 +754,7 @@ int main(int argc, char *argv[])
     if (enable_tcp_relay) {
         if (tcp_relay_port_count == 0) {
             LOG_WRITE(LOG_LEVEL_ERROR, "No TCP relay ports read. Exiting.\n");
+            key_agreement_kill(key_agreement);
             kill_onion_announce(onion_a);
             kill_gca(group_announce);
             kill_announcements(announce);
@@ -494,9 +768,33 @@ int main(int argc, char *argv[])
             return 1;
         }
 
-        tcp_server = new_tcp_server(logger, mem, rng, ns, enable_ipv6,
-                                    tcp_relay_port_count, tcp_relay_ports,
-                                    dht_get_self_secret_key(dht), onion, forwarding);
+        TCP_Server_Options tcp_options;
+        tcp_server_options_default(&tcp_options);
+        tcp_options.handshake_rate = (uint16_t)tcp_handshake_rate;
+        tcp_options.handshake_burst = (uint16_t)tcp_handshake_burst;
+
+        if (tcp_relay_threads > 1 || tcp_handshake_workers > 0) {
+            tcp_options.num_threads = (uint16_t)tcp_relay_threads;
+            tcp_options.handshake_workers = (uint16_t)tcp_handshake_workers;
+            tcp_server = new_tcp_server_with_options(logger, mem, rng, ns, enable_ipv6,
+                         tcp_relay_port_count, tcp_relay_ports,
+                         dht_get_self_secret_key(dht), onion, forwarding, &tcp_options);
+
+            if (tcp_server != nullptr) {
+                LOG_WRITE(LOG_LEVEL_INFO, "Started %d TCP relay threads and %d handshake workers.\n", tcp_relay_threads,
+                          tcp_handshake_workers);
+            } else {
+                LOG_WRITE(LOG_LEVEL_WARNING, "Couldn't start TCP relay threads. Continuing single-threaded.\n");
+                tcp_options.num_threads = 1;
+                tcp_options.handshake_workers = 0;
+            }
+        }
+
+        if (tcp_server == nullptr) {
+            tcp_server = new_tcp_server_with_options(logger, mem, rng, ns, enable_ipv6,
+                         tcp_relay_port_count, tcp_relay_ports,
+                         dht_get_self_secret_key(dht), onion, forwarding, &tcp_options);
+        }
 
         free(tcp_relay_ports);
 
@@ -528,6 +826,7 @@ int main(int argc, char *argv[])
             }
         } else {
             LOG_WRITE(LOG_LEVEL_ERROR, "Couldn't initialize Tox TCP server. Exiting.\n");
+            key_agreement_kill(key_agreement);
             kill_onion_announce(onion_a);
             kill_gca(group_announce);
             kill_onion(onion);
@@ -546,6 +845,7 @@ int main(int argc, char *argv[])
     } else {
         LOG_WRITE(LOG_LEVEL_ERROR, "Couldn't read list of bootstrap nodes in %s. Exiting.\n", cfg_file_path);
         kill_tcp_server(tcp_server);
+        key_agreement_kill(key_agreement);
         kill_onion_announce(onion_a);
         kill_gca(group_announce);
         kill_onion(onion);
@@ -561,6 +861,12 @@ int main(int argc, char *argv[])
     print_public_key(dht_get_self_public_key(dht));
 
     uint64_t last_lan_discovery = 0;
+    uint64_t last_tcp_stats = mono_time_get(mono_time);
+    TCP_Server_Stats tcp_stats = {{0}};
+    uint64_t last_shared_key_stats = mono_time_get(mono_time);
+    Shared_Key_Cache_Stats shared_key_stats = {0};
+    uint64_t last_announce_stats = mono_time_get(mono_time);
+    Announce_Stats announce_stats = {0};
     const uint16_t net_htons_port = net_htons(start_port);
 
     bool waiting_for_dht_connection = true;
@@ -590,7 +896,42 @@ int main(int argc, char *argv[])
         LOG_WRITE(LOG_LEVEL_WARNING, "Couldn't set signal handler for SIGTERM. Continuing without the signal handler set.\n");
     }
 
+    Request_Workers *workers = nullptr;
+
+    if (threads > 0) {
+        if (dht_enable_thread_safety(dht) && onion_enable_thread_safety(onion)
+                && onion_announce_enable_thread_safety(onion_a)) {
+            workers = request_workers_new(net, (uint32_t)threads);
+        }
+
+        if (workers != nullptr) {
+            LOG_WRITE(LOG_LEVEL_INFO, "Started %d request worker threads.\n", threads);
+        } else {
+            LOG_WRITE(LOG_LEVEL_WARNING, "Couldn't start request worker threads. Continuing single-threaded.\n");
+        }
+    }
+
+    Ev *ev = os_event_new(mem, logger);
+
+    if (ev == nullptr) {
+        LOG_WRITE(LOG_LEVEL_WARNING, "Couldn't create event loop. Falling back to polling every %d ms.\n", POLL_INTERVAL_MS);
+    } else if (!ev_add(ev, net_sock(net), EV_READ, net)) {
+        LOG_WRITE(LOG_LEVEL_WARNING, "Couldn't add UDP socket to event loop. Falling back to polling every %d ms.\n",
+                  POLL_INTERVAL_MS);
+        ev_kill(ev);
+        ev = nullptr;
+    } else if (enable_tcp_relay && !tcp_server_register_ev(tcp_server, ev, tcp_server)) {
+        LOG_WRITE(LOG_LEVEL_WARNING, "Couldn't add TCP sockets to event loop. Falling back to polling every %d ms.\n",
+                  POLL_INTERVAL_MS);
+        ev_kill(ev);
+        ev = nullptr;
+    }
+
     while (caught_signal == 0) {
+        // Worker threads may be answering requests in the background, keep
+        // them out while the periodic work mutates shared state.
+        request_workers_lock(workers);
+
         mono_time_update(mono_time);
 
         do_dht(dht);
@@ -604,16 +945,64 @@ int main(int argc, char *argv[])
 
         if (enable_tcp_relay) {
             do_tcp_server(tcp_server, mono_time);
+
+            if (tcp_stats_interval > 0 && mono_time_is_timeout(mono_time, last_tcp_stats, tcp_stats_interval)) {
+                log_tcp_stats(tcp_server, &tcp_stats, mono_time_get(mono_time) - last_tcp_stats);
+                last_tcp_stats = mono_time_get(mono_time);
+            }
         }
 
-        networking_poll(net, nullptr);
+        if (shared_key_stats_interval > 0
+                && mono_time_is_timeout(mono_time, last_shared_key_stats, shared_key_stats_interval)) {
+            log_shared_key_stats(dht, onion, onion_a, announce, &shared_key_stats,
+                                 mono_time_get(mono_time) - last_shared_key_stats);
+            last_shared_key_stats = mono_time_get(mono_time);
+        }
+
+        if (announce_stats_interval > 0
+                && mono_time_is_timeout(mono_time, last_announce_stats, announce_stats_interval)) {
+            log_announce_stats(announce, &announce_stats, mono_time_get(mono_time) - last_announce_stats);
+            last_announce_stats = mono_time_get(mono_time);
+        }
 
         if (waiting_for_dht_connection && dht_isconnected(dht)) {
             LOG_WRITE(LOG_LEVEL_INFO, "Connected to another bootstrap node successfully.\n");
             waiting_for_dht_connection = false;
         }
 
-        sleep_milliseconds(30);
+        request_workers_unlock(workers);
+
+        networking_poll(net, nullptr);
+
+        if (key_agreement != nullptr) {
+            key_agreement_poll(key_agreement, nullptr);
+        }
+
+        networking_flush(net);
+
+        // Sleep until a packet or connection arrives, or until the next timer
+        // is due. LAN discovery and group announce timers have the same one
+        // second resolution as the DHT, so the DHT interval covers them.
+        mono_time_update(mono_time);
+        uint32_t timeout_ms = dht_run_interval(dht);
+
+        if (enable_tcp_relay) {
+            const uint32_t tcp_interval = tcp_server_run_interval(tcp_server, mono_time);
+
+            if (tcp_interval < timeout_ms) {
+                timeout_ms = tcp_interval;
+            }
+        }
+
+        if (key_agreement != nullptr) {
+            const uint32_t key_interval = key_agreement_run_interval(key_agreement);
+
+            if (key_interval < timeout_ms) {
+                timeout_ms = key_interval;
+            }
+        }
+
+        wait_for_events(ev, timeout_ms);
     }
 
     switch (caught_signal) {
@@ -629,8 +1018,11 @@ int main(int argc, char *argv[])
             LOG_WRITE(LOG_LEVEL_INFO, "Received (%ld) signal. Exiting.\n", (long)caught_signal);
     }
 
+    request_workers_kill(workers);
     lan_discovery_kill(broadcast);
     kill_tcp_server(tcp_server);
+    ev_kill(ev);
+    key_agreement_kill(key_agreement);
     kill_onion_announce(onion_a);
     kill_gca(group_announce);
     kill_onion(onion);
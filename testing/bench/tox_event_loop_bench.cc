@@ -0,0 +1,381 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "../../testing/support/public/simulation.hh"
+#include "../../toxcore/ev.h"
+#include "../../toxcore/net.h"
+#include "../../toxcore/network.h"
+#include "../../toxcore/tox.h"
+#include "../../toxcore/tox_private.h"
+
+namespace {
+
+using tox::test::FakeSocket;
+using tox::test::SimulatedNode;
+using tox::test::Simulation;
+
+/** Instances the others bootstrap from. */
+constexpr uint32_t kBootstrapNodes = 4;
+
+/** Simulated time to let the network settle before measuring. */
+constexpr uint64_t kWarmupMs = 15000;
+
+/**
+ * @brief One event loop shared by many simulated instances.
+ *
+ * Simulated nodes number their sockets independently, so each instance
+ * registers with its own `Ev` view that tags its sockets with the node. The
+ * views all feed the one registration list that `poll` checks, as an epoll
+ * set would.
+ */
+class SharedLoop {
+public:
+    struct View {
+        Ev ev;
+        SharedLoop *loop;
+        SimulatedNode *node;
+    };
+
+    Ev *view(SimulatedNode *node)
+    {
+        views_.push_back(std::make_unique<View>(View{{&kFuncs, nullptr}, this, node}));
+        View *v = views_.back().get();
+        v->ev.user_data = v;
+        return &v->ev;
+    }
+
+    /** @brief Append the data of every registration that is ready to @p ready. */
+    void poll(std::vector<void *> &ready) const
+    {
+        for (const Registration &reg : regs_) {
+            FakeSocket *sock = reg.node->fake_network().get_sock(reg.sock);
+
+            if (sock == nullptr) {
+                continue;
+            }
+
+            if (sock->is_readable() || ((reg.events & EV_WRITE) != 0 && sock->is_writable())) {
+                ready.push_back(reg.data);
+            }
+        }
+    }
+
+    std::size_t registrations() const { return regs_.size(); }
+
+private:
+    struct Registration {
+        SimulatedNode *node;
+        Socket sock;
+        Ev_Events events;
+        void *data;
+    };
+
+    Registration *find(const SimulatedNode *node, Socket sock)
+    {
+        for (Registration &reg : regs_) {
+            if (reg.node == node && net_socket_to_native(reg.sock) == net_socket_to_native(sock)) {
+                return &reg;
+            }
+        }
+
+        return nullptr;
+    }
+
+    static bool add(void *self, Socket sock, Ev_Events events, void *data)
+    {
+        View *v = static_cast<View *>(self);
+
+        if (v->loop->find(v->node, sock) != nullptr) {
+            return false;
+        }
+
+        v->loop->regs_.push_back(Registration{v->node, sock, events, data});
+        return true;
+    }
+
+    static bool mod(void *self, Socket sock, Ev_Events events, void *data)
+    {
+        View *v = static_cast<View *>(self);
+        Registration *reg = v->loop->find(v->node, sock);
+
+        if (reg == nullptr) {
+            return false;
+        }
+
+        reg->events = events;
+        reg->data = data;
+        return true;
+    }
+
+    static bool del(void *self, Socket sock)
+    {
+        View *v = static_cast<View *>(self);
+        Registration *reg = v->loop->find(v->node, sock);
+
+        if (reg == nullptr) {
+            return false;
+        }
+
+        *reg = v->loop->regs_.back();
+        v->loop->regs_.pop_back();
+        return true;
+    }
+
+    static int32_t run(void *self, Ev_Result results[], uint32_t max_results, int32_t timeout_ms)
+    {
+        // The benchmark polls the shared list itself.
+        return 0;
+    }
+
+    static void kill(Ev *ev) { }
+
+    static constexpr Ev_Funcs kFuncs = {add, mod, del, run, kill};
+
+    std::vector<Registration> regs_;
+    std::vector<std::unique_ptr<View>> views_;
+};
+
+/**
+ * @brief Many instances in one process, each bootstrapped to one of a few
+ *   bootstrap instances and a friend of its neighbour.
+ *
+ * The argument is the number of instances. Each benchmark iteration is one
+ * simulated second. `iterations_per_s` counts the `tox_iterate` calls of all
+ * instances and `busy_us_per_s` the real time spent in them.
+ */
+class ToxEventLoopFixture : public benchmark::Fixture {
+public:
+    void SetUp(benchmark::State &state) override
+    {
+        by_tox.clear();
+        instances.clear();
+        loop.reset();
+        sim.reset();
+
+        const uint32_t count = static_cast<uint32_t>(state.range(0));
+        sim = std::make_unique<Simulation>(4242);
+        sim->net().set_latency(5);
+        loop = std::make_unique<SharedLoop>();
+
+        auto opts = std::unique_ptr<Tox_Options, decltype(&tox_options_free)>(
+            tox_options_new(nullptr), tox_options_free);
+        tox_options_set_ipv6_enabled(opts.get(), false);
+        tox_options_set_local_discovery_enabled(opts.get(), false);
+
+        instances.reserve(count);
+
+        for (uint32_t i = 0; i < count; ++i) {
+            Instance inst;
+            inst.node = sim->create_node();
+            inst.tox = inst.node->create_tox(opts.get());
+            instances.push_back(std::move(inst));
+        }
+
+        for (uint32_t i = 0; i < count; ++i) {
+            const uint32_t bs = i < kBootstrapNodes ? (i + 1) % kBootstrapNodes : i % kBootstrapNodes;
+            bootstrap(instances[i], instances[bs]);
+
+            if (i >= kBootstrapNodes) {
+                bootstrap(instances[bs], instances[i]);
+            }
+        }
+
+        for (uint32_t i = kBootstrapNodes; i + 1 < count; i += 2) {
+            befriend(instances[i], instances[i + 1]);
+        }
+
+        for (Instance &inst : instances) {
+            by_tox[inst.tox.get()] = &inst;
+        }
+
+        const uint64_t end = sim->clock().current_time_ms() + kWarmupMs;
+        Stats ignored;
+
+        while (sim->clock().current_time_ms() < end) {
+            step_polling(ignored);
+        }
+    }
+
+    void TearDown(const benchmark::State &state) override
+    {
+        for (Instance &inst : instances) {
+            tox_unregister_ev(inst.tox.get());
+        }
+
+        by_tox.clear();
+        instances.clear();
+        loop.reset();
+        sim.reset();
+    }
+
+protected:
+    struct Instance {
+        std::unique_ptr<SimulatedNode> node;
+        SimulatedNode::ToxPtr tox;
+        uint64_t due = 0;
+        bool ready = false;
+    };
+
+    struct Stats {
+        uint64_t iterations = 0;
+        std::chrono::nanoseconds busy{0};
+    };
+
+    static void bootstrap(Instance &from, Instance &to)
+    {
+        uint8_t dht_id[TOX_PUBLIC_KEY_SIZE];
+        tox_self_get_dht_id(to.tox.get(), dht_id);
+        Ip_Ntoa ip_str;
+        tox_bootstrap(from.tox.get(), net_ip_ntoa(&to.node->ip, &ip_str),
+            to.node->get_primary_socket()->local_port(), dht_id, nullptr);
+    }
+
+    static void befriend(Instance &a, Instance &b)
+    {
+        uint8_t pk_a[TOX_PUBLIC_KEY_SIZE];
+        uint8_t pk_b[TOX_PUBLIC_KEY_SIZE];
+        tox_self_get_public_key(a.tox.get(), pk_a);
+        tox_self_get_public_key(b.tox.get(), pk_b);
+        tox_friend_add_norequest(a.tox.get(), pk_b, nullptr);
+        tox_friend_add_norequest(b.tox.get(), pk_a, nullptr);
+    }
+
+    static void iterate(Instance &inst, Stats &stats)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        tox_iterate(inst.tox.get(), nullptr);
+        stats.busy += std::chrono::steady_clock::now() - start;
+        ++stats.iterations;
+    }
+
+    /** @brief Advance 1ms, running each instance whose `tox_iteration_interval` is up. */
+    void step_polling(Stats &stats)
+    {
+        const uint64_t now = sim->clock().current_time_ms();
+
+        for (Instance &inst : instances) {
+            if (now >= inst.due) {
+                iterate(inst, stats);
+                inst.due = now + tox_iteration_interval(inst.tox.get());
+            }
+        }
+
+        sim->advance_time(1);
+    }
+
+    /**
+     * @brief Advance 1ms, running each instance with a ready socket or whose
+     *   `tox_timer_interval` is up.
+     */
+    void step_event_loop(Stats &stats, std::vector<void *> &ready)
+    {
+        const uint64_t now = sim->clock().current_time_ms();
+
+        ready.clear();
+        loop->poll(ready);
+
+        for (void *data : ready) {
+            by_tox.at(data)->ready = true;
+        }
+
+        for (Instance &inst : instances) {
+            if (inst.ready || now >= inst.due) {
+                inst.ready = false;
+                iterate(inst, stats);
+                inst.due = now + tox_timer_interval(inst.tox.get());
+            }
+        }
+
+        sim->advance_time(1);
+    }
+
+    uint32_t friends_online() const
+    {
+        uint32_t online = 0;
+
+        for (const Instance &inst : instances) {
+            if (tox_self_get_friend_list_size(inst.tox.get()) > 0
+                && tox_friend_get_connection_status(inst.tox.get(), 0, nullptr) != TOX_CONNECTION_NONE) {
+                ++online;
+            }
+        }
+
+        return online;
+    }
+
+    void report(benchmark::State &state, const Stats &stats)
+    {
+        state.counters["iterations_per_s"] = benchmark::Counter(
+            static_cast<double>(stats.iterations), benchmark::Counter::kAvgIterations);
+        state.counters["busy_us_per_s"]
+            = benchmark::Counter(std::chrono::duration<double, std::micro>(stats.busy).count(),
+                benchmark::Counter::kAvgIterations);
+        state.counters["friends_online"] = friends_online();
+    }
+
+    std::unique_ptr<Simulation> sim;
+    std::unique_ptr<SharedLoop> loop;
+    std::vector<Instance> instances;
+    std::unordered_map<const void *, Instance *> by_tox;
+};
+
+/**
+ * @brief Every instance sleeps for `tox_iteration_interval`, as with one
+ *   polling thread per instance.
+ */
+BENCHMARK_DEFINE_F(ToxEventLoopFixture, Polling)(benchmark::State &state)
+{
+    Stats stats;
+
+    for (auto _ : state) {
+        for (int ms = 0; ms < 1000; ++ms) {
+            step_polling(stats);
+        }
+    }
+
+    report(state, stats);
+}
+BENCHMARK_REGISTER_F(ToxEventLoopFixture, Polling)->Arg(200)->Unit(benchmark::kMillisecond);
+
+/**
+ * @brief All instances register with one event loop through `tox_register_ev`
+ *   and only run when it reports one of their sockets or their timer is up.
+ */
+BENCHMARK_DEFINE_F(ToxEventLoopFixture, SharedEventLoop)(benchmark::State &state)
+{
+    for (Instance &inst : instances) {
+        if (!tox_register_ev(inst.tox.get(), loop->view(inst.node.get()))) {
+            state.SkipWithError("tox_register_ev failed");
+            return;
+        }
+
+        inst.due = 0;
+    }
+
+    Stats stats;
+    std::vector<void *> ready;
+
+    for (auto _ : state) {
+        for (int ms = 0; ms < 1000; ++ms) {
+            step_event_loop(stats, ready);
+        }
+    }
+
+    report(state, stats);
+    state.counters["registered_sockets"] = static_cast<double>(loop->registrations());
+}
+BENCHMARK_REGISTER_F(ToxEventLoopFixture, SharedEventLoop)->Arg(200)->Unit(benchmark::kMillisecond);
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -4,18 +4,27 @@
 
 #include <benchmark/benchmark.h>
 
+#include <array>
+#include <chrono>
 #include <cstddef>
 #include <iostream>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "../../testing/support/public/simulation.hh"
 #include "../../testing/support/public/tox_network.hh"
+#include "../../toxcore/Messenger.h"
+#include "../../toxcore/net.h"
+#include "../../toxcore/net_crypto.h"
 #include "../../toxcore/tox.h"
+#include "../../toxcore/tox_private.h"
+#include "../../toxcore/tox_struct.h"
 
 namespace {
 
 using tox::test::ConnectedFriend;
+using tox::test::FakeSocket;
 using tox::test::setup_connected_friends;
 using tox::test::SimulatedNode;
 using tox::test::Simulation;
@@ -161,11 +170,107 @@ public:
     }
 
 protected:
+    struct IdleStats {
+        uint64_t wakeups = 0;
+        std::chrono::nanoseconds busy{0};
+    };
+
+    /** @brief How an application decides when to call `tox_iterate` again. */
+    enum class IdleLoop {
+        /** Sleep for `tox_iteration_interval`. */
+        kPolling,
+        /** Wait on `tox_get_sockets` for at most `tox_timer_interval`. */
+        kWaitingOnSockets,
+    };
+
+    struct IdleNode {
+        SimulatedNode *node;
+        Tox *tox;
+        uint64_t due = 0;
+        std::vector<Tox_Socket> sockets;
+    };
+
+    static bool sockets_ready(const IdleNode &n)
+    {
+        for (const Tox_Socket &s : n.sockets) {
+            FakeSocket *sock = n.node->fake_network().get_sock(net_socket_from_native(s.fd));
+
+            if (sock != nullptr && (sock->is_readable() || (s.wants_write && sock->is_writable()))) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /** @brief Run `n` if it is due, and return whether it ran. */
+    static bool run_if_due(IdleNode &n, IdleLoop loop, uint64_t now)
+    {
+        if (now < n.due && (loop == IdleLoop::kPolling || !sockets_ready(n))) {
+            return false;
+        }
+
+        tox_iterate(n.tox, nullptr);
+
+        if (loop == IdleLoop::kPolling) {
+            n.due = now + tox_iteration_interval(n.tox);
+        } else {
+            n.due = now + tox_timer_interval(n.tox);
+            n.sockets.resize(tox_get_sockets(n.tox, nullptr, 0));
+            tox_get_sockets(n.tox, n.sockets.data(), n.sockets.size());
+        }
+
+        return true;
+    }
+
+    /**
+     * @brief Run one simulated second in 1ms steps, with both instances
+     *   driven by `loop`.
+     *
+     * Only the main instance's `tox_iterate` calls count towards `stats`.
+     */
+    void run_idle_second(IdleStats &stats, IdleLoop loop)
+    {
+        const uint64_t end = sim->clock().current_time_ms() + 1000;
+
+        while (sim->clock().current_time_ms() < end) {
+            const uint64_t now = sim->clock().current_time_ms();
+
+            const auto start = std::chrono::steady_clock::now();
+            if (run_if_due(main_idle, loop, now)) {
+                stats.busy += std::chrono::steady_clock::now() - start;
+                ++stats.wakeups;
+            }
+
+            run_if_due(bootstrap_idle, loop, now);
+            sim->advance_time(1);
+        }
+    }
+
+    void run_idle(benchmark::State &state, IdleLoop loop)
+    {
+        main_idle = IdleNode{main_node.get(), main_tox.get()};
+        bootstrap_idle = IdleNode{bootstrap_node.get(), bootstrap_tox.get()};
+        IdleStats stats;
+
+        for (auto _ : state) {
+            run_idle_second(stats, loop);
+        }
+
+        state.counters["wakeups_per_s"] = benchmark::Counter(
+            static_cast<double>(stats.wakeups), benchmark::Counter::kAvgIterations);
+        state.counters["busy_us_per_s"] = benchmark::Counter(
+            std::chrono::duration<double, std::micro>(stats.busy).count(),
+            benchmark::Counter::kAvgIterations);
+    }
+
     std::unique_ptr<Simulation> sim;
     std::unique_ptr<SimulatedNode> main_node;
     SimulatedNode::ToxPtr main_tox;
     std::unique_ptr<SimulatedNode> bootstrap_node;
     SimulatedNode::ToxPtr bootstrap_tox;
+    IdleNode main_idle{};
+    IdleNode bootstrap_idle{};
 };
 
 BENCHMARK_DEFINE_F(ToxOnlineDisconnectedScalingFixture, Iterate)(benchmark::State &state)
@@ -194,6 +299,134 @@ BENCHMARK_REGISTER_F(ToxOnlineDisconnectedScalingFixture, Iterate)
     ->Arg(1000)
     ->Arg(2000);
 
+/**
+ * @brief Idle cost of instances that sleep for `tox_iteration_interval`
+ *   between iterations.
+ *
+ * Each benchmark iteration is one simulated second. `wakeups_per_s` counts
+ * the main instance's `tox_iterate` calls and `busy_us_per_s` the real time
+ * spent in them.
+ */
+BENCHMARK_DEFINE_F(ToxOnlineDisconnectedScalingFixture, IdlePolling)(benchmark::State &state)
+{
+    run_idle(state, IdleLoop::kPolling);
+}
+BENCHMARK_REGISTER_F(ToxOnlineDisconnectedScalingFixture, IdlePolling)->Arg(500);
+
+/**
+ * @brief Idle cost of instances that wait on their sockets, as applications
+ *   with their own event loop would.
+ */
+BENCHMARK_DEFINE_F(ToxOnlineDisconnectedScalingFixture, IdleWaitingOnSockets)
+(benchmark::State &state)
+{
+    run_idle(state, IdleLoop::kWaitingOnSockets);
+}
+BENCHMARK_REGISTER_F(ToxOnlineDisconnectedScalingFixture, IdleWaitingOnSockets)->Arg(500);
+
+/**
+ * @brief Measures the per-handshake connection lookup cost in net_crypto.
+ *
+ * Every incoming handshake and every `new_crypto_connection` looks up the
+ * peer's real public key among all crypto connections. This fixture creates
+ * N crypto connections directly on the main instance's Net_Crypto so that the
+ * lookup can be measured with friend counts far beyond what is practical to
+ * simulate as full Tox nodes.
+ */
+class NetCryptoHandshakeScalingFixture : public benchmark::Fixture {
+public:
+    using Key = std::array<uint8_t, CRYPTO_PUBLIC_KEY_SIZE>;
+
+    void SetUp(benchmark::State &state) override
+    {
+        peer_keys.clear();
+        main_tox.reset();
+        main_node.reset();
+        sim.reset();
+
+        sim = std::make_unique<Simulation>(12345);
+        main_node = sim->create_node();
+        main_tox = main_node->create_tox();
+
+        Net_Crypto *nc = main_tox->m->net_crypto;
+
+        // All connections share one DHT key so the shared key cache keeps the
+        // Curve25519 precomputation out of the measurement.
+        main_node->fake_random().bytes(dht_key.data(), dht_key.size());
+
+        const int num_conns = state.range(0);
+        for (int i = 0; i < num_conns; ++i) {
+            Key pk;
+            main_node->fake_random().bytes(pk.data(), pk.size());
+
+            if (new_crypto_connection(nc, pk.data(), dht_key.data()) == -1) {
+                setup_error = "new_crypto_connection failed";
+                return;
+            }
+
+            peer_keys.push_back(pk);
+        }
+    }
+
+protected:
+    std::unique_ptr<Simulation> sim;
+    std::unique_ptr<SimulatedNode> main_node;
+    SimulatedNode::ToxPtr main_tox;
+    std::vector<Key> peer_keys;
+    Key dht_key{};
+    std::string setup_error;
+};
+
+BENCHMARK_DEFINE_F(NetCryptoHandshakeScalingFixture, LookupExisting)(benchmark::State &state)
+{
+    if (!setup_error.empty()) {
+        state.SkipWithError(setup_error.c_str());
+        return;
+    }
+
+    Net_Crypto *nc = main_tox->m->net_crypto;
+    std::size_t i = 0;
+
+    for (auto _ : state) {
+        const Key &pk = peer_keys[i % peer_keys.size()];
+        benchmark::DoNotOptimize(new_crypto_connection(nc, pk.data(), dht_key.data()));
+        ++i;
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_REGISTER_F(NetCryptoHandshakeScalingFixture, LookupExisting)
+    ->Arg(100)
+    ->Arg(1000)
+    ->Arg(10000);
+
+BENCHMARK_DEFINE_F(NetCryptoHandshakeScalingFixture, CreateKill)(benchmark::State &state)
+{
+    if (!setup_error.empty()) {
+        state.SkipWithError(setup_error.c_str());
+        return;
+    }
+
+    Net_Crypto *nc = main_tox->m->net_crypto;
+    Key pk;
+
+    for (auto _ : state) {
+        main_node->fake_random().bytes(pk.data(), pk.size());
+        const int id = new_crypto_connection(nc, pk.data(), dht_key.data());
+        if (id == -1) {
+            state.SkipWithError("new_crypto_connection failed");
+            break;
+        }
+        crypto_kill(nc, id);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_REGISTER_F(NetCryptoHandshakeScalingFixture, CreateKill)
+    ->Arg(100)
+    ->Arg(1000)
+    ->Arg(10000);
+
 struct ConnectedContext {
     std::unique_ptr<Simulation> sim;
     std::unique_ptr<SimulatedNode> main_node;
@@ -6,10 +6,15 @@
 
 #include <cstddef>
 #include <iostream>
+#include <memory>
+#include <vector>
 
 #include "../../testing/support/public/simulation.hh"
+#include "../../toxcore/Messenger.h"
+#include "../../toxcore/net_crypto.h"
 #include "../../toxcore/network.h"
 #include "../../toxcore/tox.h"
+#include "../../toxcore/tox_struct.h"
 
 namespace {
 
@@ -217,6 +222,104 @@ void BM_ToxMessengerBidirectional(benchmark::State &state)
 
 BENCHMARK(BM_ToxMessengerBidirectional);
 
+/**
+ * @brief Lossless bulk throughput between two friends.
+ *
+ * Arg 0 disables the net_crypto packet pool so every buffered packet goes
+ * through the allocator, Arg 1 uses the default pool watermarks.
+ */
+void BM_ToxLosslessThroughput(benchmark::State &state)
+{
+    const bool use_pool = state.range(0) != 0;
+
+    Simulation sim{12345};
+    sim.net().set_latency(5);
+    auto node1 = sim.create_node();
+    auto node2 = sim.create_node();
+
+    auto opts = std::unique_ptr<Tox_Options, decltype(&tox_options_free)>(
+        tox_options_new(nullptr), tox_options_free);
+    tox_options_set_ipv6_enabled(opts.get(), false);
+    tox_options_set_local_discovery_enabled(opts.get(), false);
+
+    auto tox1 = node1->create_tox(opts.get());
+    auto tox2 = node2->create_tox(opts.get());
+
+    if (!tox1 || !tox2) {
+        state.SkipWithError("Failed to create Tox instances");
+        return;
+    }
+
+    if (!use_pool) {
+        nc_set_packet_pool_watermarks(tox1->m->net_crypto, 0, 0);
+        nc_set_packet_pool_watermarks(tox2->m->net_crypto, 0, 0);
+    }
+
+    uint8_t tox1_pk[TOX_PUBLIC_KEY_SIZE];
+    tox_self_get_public_key(tox1.get(), tox1_pk);
+    uint8_t tox2_pk[TOX_PUBLIC_KEY_SIZE];
+    tox_self_get_public_key(tox2.get(), tox2_pk);
+
+    uint8_t tox1_dht_id[TOX_PUBLIC_KEY_SIZE];
+    tox_self_get_dht_id(tox1.get(), tox1_dht_id);
+
+    const uint32_t f1 = tox_friend_add_norequest(tox1.get(), tox2_pk, nullptr);
+    const uint32_t f2 = tox_friend_add_norequest(tox2.get(), tox1_pk, nullptr);
+
+    char ip1[TOX_INET6_ADDRSTRLEN];
+    ip_parse_addr(&node1->ip, ip1, sizeof(ip1));
+    tox_bootstrap(
+        tox2.get(), ip1, node1->get_primary_socket()->local_port(), tox1_dht_id, nullptr);
+
+    bool connected = false;
+    sim.run_until(
+        [&]() {
+            tox_iterate(tox1.get(), nullptr);
+            tox_iterate(tox2.get(), nullptr);
+            sim.advance_time(90);
+            connected
+                = (tox_friend_get_connection_status(tox1.get(), f1, nullptr) != TOX_CONNECTION_NONE
+                    && tox_friend_get_connection_status(tox2.get(), f2, nullptr)
+                        != TOX_CONNECTION_NONE);
+            return connected;
+        },
+        60000);
+
+    if (!connected) {
+        state.SkipWithError("Failed to connect toxes within 60s");
+        return;
+    }
+
+    std::vector<uint8_t> packet(TOX_MAX_CUSTOM_PACKET_SIZE, 0xab);
+    packet[0] = 160;  // first lossless custom packet id
+
+    Context ctx;
+    tox_callback_friend_lossless_packet(
+        tox2.get(), [](Tox *, uint32_t, const uint8_t *, std::size_t length, void *user_data) {
+            static_cast<Context *>(user_data)->count += length;
+        });
+
+    for (auto _ : state) {
+        // Fill the send queue until congestion control pushes back.
+        while (tox_friend_send_lossless_packet(
+            tox1.get(), f1, packet.data(), packet.size(), nullptr)) {
+        }
+
+        sim.advance_time(1);
+        tox_iterate(tox1.get(), nullptr);
+        tox_iterate(tox2.get(), &ctx);
+    }
+
+    state.SetBytesProcessed(static_cast<int64_t>(ctx.count));
+
+    Net_Crypto_Packet_Pool_Stats stats;
+    nc_get_packet_pool_stats(tox1->m->net_crypto, &stats);
+    state.counters["pool_hits"] = static_cast<double>(stats.hits);
+    state.counters["pool_misses"] = static_cast<double>(stats.misses);
+}
+
+BENCHMARK(BM_ToxLosslessThroughput)->Arg(0)->Arg(1);
+
 }  // namespace
 
 BENCHMARK_MAIN();
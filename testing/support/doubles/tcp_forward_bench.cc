@@ -0,0 +1,292 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#else
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+#include "../../../toxcore/TCP_common.h"
+#include "../../../toxcore/logger.h"
+#include "../../../toxcore/os_memory.h"
+#include "../../../toxcore/os_random.h"
+#include "fake_network_stack.hh"
+#include "network_universe.hh"
+
+namespace tox::test {
+namespace {
+
+    /** Packets the sender writes before the relay gets to run. */
+    constexpr std::size_t kBurstSize = 32;
+
+    constexpr uint16_t kPort = 33445;
+
+    /** Connection id the relay rewrites the first byte of each packet to. */
+    constexpr uint8_t kOtherId = 17;
+
+    /**
+     * @brief Forwarding relay-sized data packets from one TCP connection to another.
+     *
+     * A sender writes a burst of encrypted packets to the relay's first
+     * connection. The relay reads them, rewrites the connection id in the
+     * first byte, and writes them to its second connection, as the TCP server
+     * does for routed data. The receiver then reads them back. The argument
+     * is the plain packet size. The `bytes_copied_per_packet` counter is the
+     * number of bytes the relay copies besides decrypting and encrypting.
+     */
+    class TcpForwardBenchFixture : public benchmark::Fixture {
+    public:
+        void SetUp(::benchmark::State &state) override
+        {
+            mem = os_memory();
+            rng = os_random();
+            if (rng == nullptr) {
+                setup_error = "os_random failed";
+                return;
+            }
+            log = logger_new(mem);
+
+            universe = std::make_unique<NetworkUniverse>();
+            stack = std::make_unique<FakeNetworkStack>(*universe, make_ip(0x0A000001));
+            ns = stack->c_network();
+
+            const Socket listener = stack->socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            IP_Port addr;
+            addr.ip = make_ip(0x0A000001);
+            addr.port = net_htons(kPort);
+            stack->bind(listener, &addr);
+            stack->listen(listener, 2);
+
+            const Socket sender_sock = stack->socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            stack->connect(sender_sock, &addr);
+            const Socket receiver_sock = stack->socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            stack->connect(receiver_sock, &addr);
+
+            for (int i = 0; i < 3; ++i) {
+                universe->process_events(0);
+            }
+
+            const Socket relay_in_sock = stack->accept(listener);
+            const Socket relay_out_sock = stack->accept(listener);
+
+            init_pair(&sender, sender_sock, &relay_in, relay_in_sock, relay_in_nonce);
+            init_pair(&relay_out, relay_out_sock, &receiver, receiver_sock, receiver_nonce);
+
+            payload.assign(static_cast<std::size_t>(state.range(0)), 0x42);
+            payload[0] = 16;
+        }
+
+        void TearDown(const ::benchmark::State &state) override
+        {
+            if (!setup_error.empty()) {
+                return;
+            }
+
+            wipe_connection_buffers(&sender);
+            wipe_connection_buffers(&relay_in);
+            wipe_connection_buffers(&relay_out);
+            wipe_connection_buffers(&receiver);
+            stack.reset();
+            universe.reset();
+            logger_kill(log);
+        }
+
+    protected:
+        static IP make_ip(uint32_t address)
+        {
+            IP ip;
+            ip_init(&ip, false);
+            ip.ip.v4.uint32 = net_htonl(address);
+            return ip;
+        }
+
+        void init_connection(TCP_Connection *con, Socket sock, const uint8_t *shared_key, const uint8_t *nonce)
+        {
+            memset(con, 0, sizeof(*con));
+            con->mem = mem;
+            con->rng = rng;
+            con->ns = &ns;
+            con->sock = sock;
+            memcpy(con->shared_key, shared_key, CRYPTO_SHARED_KEY_SIZE);
+            memcpy(con->sent_nonce, nonce, CRYPTO_NONCE_SIZE);
+        }
+
+        /** Set up a writing and a reading connection sharing a key. */
+        void init_pair(TCP_Connection *writer, Socket writer_sock, TCP_Connection *reader, Socket reader_sock,
+            uint8_t *recv_nonce)
+        {
+            uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
+            uint8_t nonce[CRYPTO_NONCE_SIZE];
+            new_symmetric_key(rng, shared_key);
+            random_nonce(rng, nonce);
+
+            init_connection(writer, writer_sock, shared_key, nonce);
+            init_connection(reader, reader_sock, shared_key, nonce);
+            memcpy(recv_nonce, nonce, CRYPTO_NONCE_SIZE);
+        }
+
+        /** Write one burst of packets and deliver it to the relay. */
+        bool send_burst()
+        {
+            for (std::size_t i = 0; i < kBurstSize; ++i) {
+                if (write_packet_tcp_secure_connection(log, &sender, payload.data(), payload.size(), false)
+                    != 1) {
+                    return false;
+                }
+            }
+
+            universe->process_events(0);
+            return true;
+        }
+
+        /** Deliver the forwarded burst and read it on the receiving end. */
+        bool receive_burst(std::size_t *received)
+        {
+            if (send_pending_data(log, &relay_out) == -1) {
+                return false;
+            }
+
+            universe->process_events(0);
+
+            uint8_t data[MAX_PACKET_SIZE];
+            int len;
+            while ((len = read_packet_tcp_secure_connection(
+                        log, &receiver, receiver_nonce, data, sizeof(data), &receiver.ip_port))
+                > 0) {
+                if (data[0] != kOtherId) {
+                    return false;
+                }
+                ++*received;
+            }
+
+            return len == 0;
+        }
+
+        void report(benchmark::State &state, std::size_t received, std::size_t copied)
+        {
+            state.SetItemsProcessed(static_cast<int64_t>(received));
+            state.SetBytesProcessed(static_cast<int64_t>(received * payload.size()));
+            state.counters["bytes_copied_per_packet"]
+                = static_cast<double>(copied) / static_cast<double>(received);
+        }
+
+        const Memory *mem = nullptr;
+        const Random *rng = nullptr;
+        Logger *log = nullptr;
+        std::unique_ptr<NetworkUniverse> universe;
+        std::unique_ptr<FakeNetworkStack> stack;
+        Network ns{};
+        TCP_Connection sender{};
+        TCP_Connection relay_in{};
+        TCP_Connection relay_out{};
+        TCP_Connection receiver{};
+        uint8_t relay_in_nonce[CRYPTO_NONCE_SIZE]{};
+        uint8_t receiver_nonce[CRYPTO_NONCE_SIZE]{};
+        std::vector<uint8_t> payload;
+        std::string setup_error;
+    };
+
+    /**
+     * @brief The previous forwarding: decrypt into a stack buffer, copy it to
+     * rewrite the connection id, and encrypt the copy.
+     */
+    BENCHMARK_DEFINE_F(TcpForwardBenchFixture, Copying)(benchmark::State &state)
+    {
+        if (!setup_error.empty()) {
+            state.SkipWithError(setup_error.c_str());
+            return;
+        }
+
+        std::size_t received = 0;
+        std::size_t copied = 0;
+
+        for (auto _ : state) {
+            if (!send_burst()) {
+                state.SkipWithError("send failed");
+                return;
+            }
+
+            uint8_t packet[MAX_PACKET_SIZE];
+            uint8_t new_data[MAX_PACKET_SIZE];
+            int len;
+            while ((len = read_packet_tcp_secure_connection(
+                        log, &relay_in, relay_in_nonce, packet, sizeof(packet), &relay_in.ip_port))
+                > 0) {
+                memcpy(new_data, packet, len);
+                new_data[0] = kOtherId;
+                copied += len;
+                if (write_packet_tcp_secure_connection(log, &relay_out, new_data, len, false) != 1) {
+                    state.SkipWithError("forward failed");
+                    return;
+                }
+            }
+
+            if (len == -1 || !receive_burst(&received)) {
+                state.SkipWithError("read failed");
+                return;
+            }
+        }
+
+        report(state, received, copied);
+    }
+
+    /**
+     * @brief In-place forwarding: decrypt in the input buffer, rewrite the id
+     * there, and encrypt straight into the output ring.
+     */
+    BENCHMARK_DEFINE_F(TcpForwardBenchFixture, InPlace)(benchmark::State &state)
+    {
+        if (!setup_error.empty()) {
+            state.SkipWithError(setup_error.c_str());
+            return;
+        }
+
+        std::size_t received = 0;
+
+        for (auto _ : state) {
+            if (!send_burst()) {
+                state.SkipWithError("send failed");
+                return;
+            }
+
+            uint8_t *packet = nullptr;
+            int len;
+            while ((len = read_packet_tcp_secure_connection_in_place(
+                        log, &relay_in, relay_in_nonce, &packet, &relay_in.ip_port))
+                > 0) {
+                packet[0] = kOtherId;
+                if (write_packet_tcp_secure_connection(log, &relay_out, packet, len, false) != 1) {
+                    state.SkipWithError("forward failed");
+                    return;
+                }
+            }
+
+            if (len == -1 || !receive_burst(&received)) {
+                state.SkipWithError("read failed");
+                return;
+            }
+        }
+
+        report(state, received, 0);
+    }
+
+    BENCHMARK_REGISTER_F(TcpForwardBenchFixture, Copying)->Arg(64)->Arg(512)->Arg(1300);
+    BENCHMARK_REGISTER_F(TcpForwardBenchFixture, InPlace)->Arg(64)->Arg(512)->Arg(1300);
+
+}  // namespace
+}  // namespace tox::test
+
+BENCHMARK_MAIN();
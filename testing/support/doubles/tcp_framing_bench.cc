@@ -0,0 +1,273 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#else
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+#include "../../../toxcore/TCP_common.h"
+#include "../../../toxcore/logger.h"
+#include "../../../toxcore/os_memory.h"
+#include "../../../toxcore/os_random.h"
+#include "fake_network_stack.hh"
+#include "network_universe.hh"
+
+namespace tox::test {
+namespace {
+
+    /** Packets the sender writes before the receiver gets to run. */
+    constexpr std::size_t kBurstSize = 32;
+
+    constexpr uint16_t kPort = 33445;
+
+    /** @brief The fake network stack, counting the socket calls made on the receiving side. */
+    struct CountingNetwork {
+        Network real;
+        std::size_t calls = 0;
+
+        explicit CountingNetwork(FakeNetworkStack &stack)
+            : real(stack.c_network())
+            , funcs(*real.funcs)
+        {
+            funcs.recv = [](void *obj, Socket sock, uint8_t *buf, std::size_t len) {
+                auto *net = static_cast<CountingNetwork *>(obj);
+                ++net->calls;
+                return net->real.funcs->recv(net->real.obj, sock, buf, len);
+            };
+            funcs.recvbuf = [](void *obj, Socket sock) {
+                auto *net = static_cast<CountingNetwork *>(obj);
+                ++net->calls;
+                return net->real.funcs->recvbuf(net->real.obj, sock);
+            };
+        }
+
+        Network c_network() { return Network{&funcs, this}; }
+
+    private:
+        Network_Funcs funcs;
+    };
+
+    /**
+     * @brief Draining bursts of relay-sized packets from one TCP connection.
+     *
+     * A sender writes a burst of encrypted packets through a fake TCP socket
+     * pair, and the receiver reads them back until the socket is empty. The
+     * argument is the plain packet size. The `calls_per_packet` counter is the
+     * number of recv and recv-buffer-size calls made per packet.
+     */
+    class TcpFramingBenchFixture : public benchmark::Fixture {
+    public:
+        void SetUp(::benchmark::State &state) override
+        {
+            mem = os_memory();
+            rng = os_random();
+            if (rng == nullptr) {
+                setup_error = "os_random failed";
+                return;
+            }
+            log = logger_new(mem);
+
+            universe = std::make_unique<NetworkUniverse>();
+            stack = std::make_unique<FakeNetworkStack>(*universe, make_ip(0x0A000001));
+            counting = std::make_unique<CountingNetwork>(*stack);
+            stack_ns = stack->c_network();
+            counting_ns = counting->c_network();
+
+            const Socket listener = stack->socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            IP_Port addr;
+            addr.ip = make_ip(0x0A000001);
+            addr.port = net_htons(kPort);
+            stack->bind(listener, &addr);
+            stack->listen(listener, 1);
+
+            const Socket client = stack->socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            stack->connect(client, &addr);
+
+            for (int i = 0; i < 3; ++i) {
+                universe->process_events(0);
+            }
+
+            const Socket accepted = stack->accept(listener);
+
+            uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
+            uint8_t nonce[CRYPTO_NONCE_SIZE];
+            new_symmetric_key(rng, shared_key);
+            random_nonce(rng, nonce);
+
+            init_connection(&sender, &stack_ns, client, shared_key, nonce);
+            init_connection(&receiver, &counting_ns, accepted, shared_key, nonce);
+            memcpy(recv_nonce, nonce, sizeof(recv_nonce));
+
+            payload.assign(static_cast<std::size_t>(state.range(0)), 0x42);
+        }
+
+        void TearDown(const ::benchmark::State &state) override
+        {
+            if (!setup_error.empty()) {
+                return;
+            }
+
+            wipe_connection_buffers(&sender);
+            wipe_connection_buffers(&receiver);
+            counting.reset();
+            stack.reset();
+            universe.reset();
+            logger_kill(log);
+        }
+
+    protected:
+        static IP make_ip(uint32_t address)
+        {
+            IP ip;
+            ip_init(&ip, false);
+            ip.ip.v4.uint32 = net_htonl(address);
+            return ip;
+        }
+
+        void init_connection(TCP_Connection *con, const Network *ns, Socket sock,
+            const uint8_t *shared_key, const uint8_t *nonce)
+        {
+            memset(con, 0, sizeof(*con));
+            con->mem = mem;
+            con->rng = rng;
+            con->ns = ns;
+            con->sock = sock;
+            memcpy(con->shared_key, shared_key, CRYPTO_SHARED_KEY_SIZE);
+            memcpy(con->sent_nonce, nonce, CRYPTO_NONCE_SIZE);
+        }
+
+        /** Write one burst of packets and deliver it to the receiving socket. */
+        bool send_burst()
+        {
+            for (std::size_t i = 0; i < kBurstSize; ++i) {
+                if (write_packet_tcp_secure_connection(log, &sender, payload.data(), payload.size(), false)
+                    != 1) {
+                    return false;
+                }
+            }
+
+            universe->process_events(0);
+            return true;
+        }
+
+        const Memory *mem = nullptr;
+        const Random *rng = nullptr;
+        Logger *log = nullptr;
+        std::unique_ptr<NetworkUniverse> universe;
+        std::unique_ptr<FakeNetworkStack> stack;
+        std::unique_ptr<CountingNetwork> counting;
+        Network stack_ns{};
+        Network counting_ns{};
+        TCP_Connection sender{};
+        TCP_Connection receiver{};
+        uint8_t recv_nonce[CRYPTO_NONCE_SIZE]{};
+        std::vector<uint8_t> payload;
+        std::string setup_error;
+    };
+
+    /**
+     * @brief The previous framing: a recv-buffer-size check and an exact-size
+     * recv for the length, then again for the packet.
+     */
+    BENCHMARK_DEFINE_F(TcpFramingBenchFixture, PerPacketReads)(benchmark::State &state)
+    {
+        if (!setup_error.empty()) {
+            state.SkipWithError(setup_error.c_str());
+            return;
+        }
+
+        std::size_t received = 0;
+
+        for (auto _ : state) {
+            if (!send_burst()) {
+                state.SkipWithError("send failed");
+                return;
+            }
+
+            while (true) {
+                uint8_t length_buf[sizeof(uint16_t)];
+                if (read_tcp_packet(log, mem, &counting_ns, receiver.sock, length_buf, sizeof(length_buf),
+                        &receiver.ip_port)
+                    == -1) {
+                    break;
+                }
+
+                uint16_t length;
+                net_unpack_u16(length_buf, &length);
+
+                uint8_t encrypted[MAX_PACKET_SIZE];
+                if (read_tcp_packet(log, mem, &counting_ns, receiver.sock, encrypted, length, &receiver.ip_port)
+                    == -1) {
+                    break;
+                }
+
+                uint8_t data[MAX_PACKET_SIZE];
+                const int len
+                    = decrypt_data_symmetric(mem, receiver.shared_key, recv_nonce, encrypted, length, data);
+                increment_nonce(recv_nonce);
+                benchmark::DoNotOptimize(len);
+                ++received;
+            }
+        }
+
+        state.SetItemsProcessed(static_cast<int64_t>(received));
+        state.counters["calls_per_packet"]
+            = static_cast<double>(counting->calls) / static_cast<double>(received);
+    }
+
+    /** @brief Buffered framing: `read_packet_tcp_secure_connection` until it returns 0. */
+    BENCHMARK_DEFINE_F(TcpFramingBenchFixture, Buffered)(benchmark::State &state)
+    {
+        if (!setup_error.empty()) {
+            state.SkipWithError(setup_error.c_str());
+            return;
+        }
+
+        std::size_t received = 0;
+
+        for (auto _ : state) {
+            if (!send_burst()) {
+                state.SkipWithError("send failed");
+                return;
+            }
+
+            uint8_t data[MAX_PACKET_SIZE];
+            int len;
+            while ((len = read_packet_tcp_secure_connection(
+                        log, &receiver, recv_nonce, data, sizeof(data), &receiver.ip_port))
+                > 0) {
+                ++received;
+            }
+
+            if (len == -1) {
+                state.SkipWithError("read failed");
+                return;
+            }
+        }
+
+        state.SetItemsProcessed(static_cast<int64_t>(received));
+        state.counters["calls_per_packet"]
+            = static_cast<double>(counting->calls) / static_cast<double>(received);
+    }
+
+    BENCHMARK_REGISTER_F(TcpFramingBenchFixture, PerPacketReads)->Arg(64)->Arg(512)->Arg(1300);
+    BENCHMARK_REGISTER_F(TcpFramingBenchFixture, Buffered)->Arg(64)->Arg(512)->Arg(1300);
+
+}  // namespace
+}  // namespace tox::test
+
+BENCHMARK_MAIN();
@@ -16,6 +16,7 @@
 #include "bin_pack.h"
 #include "ccompat.h"
 #include "crypto_core.h"
+#include "key_agreement.h"
 #include "logger.h"
 #include "mem.h"
 #include "mono_time.h"
@@ -52,7 +53,6 @@
 #define DHT_FRIEND_MAX_LOCKS 32
 
 /* Settings for the shared key cache */
-#define MAX_KEYS_PER_SLOT 4
 #define KEYS_TIMEOUT 600
 
 typedef struct NAT {
@@ -116,6 +116,8 @@ struct DHT {
     bool lan_discovery_enabled;
 
     Client_data    close_clientlist[LCLIENT_LIST];
+    /* close_clientlist slot numbers ordered by (public key, slot), see client_index_find(). */
+    uint16_t       close_sorted[LCLIENT_LIST];
     uint64_t       close_last_nodes_request;
     uint32_t       close_bootstrap_times;
 
@@ -284,6 +286,16 @@ const uint8_t *dht_get_shared_key_sent(DHT *dht, const uint8_t *public_key)
     return shared_key_cache_lookup(dht->shared_keys_sent, public_key);
 }
 
+bool dht_copy_shared_key_recv(DHT *dht, const uint8_t *public_key, uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE])
+{
+    return shared_key_cache_get(dht->shared_keys_recv, public_key, shared_key);
+}
+
+bool dht_copy_shared_key_sent(DHT *dht, const uint8_t *public_key, uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE])
+{
+    return shared_key_cache_get(dht->shared_keys_sent, public_key, shared_key);
+}
+
 #define CRYPTO_SIZE (1 + CRYPTO_PUBLIC_KEY_SIZE * 2 + CRYPTO_NONCE_SIZE)
 
 int create_request(const Memory *mem, const Random *rng, const uint8_t *send_public_key, const uint8_t *send_secret_key,
@@ -523,6 +535,106 @@ static uint32_t index_of_client_ip_port(const Client_data *_Nullable array, uint
     return UINT32_MAX;
 }
 
+static_assert(LCLIENT_LIST <= UINT16_MAX, "close_sorted slot numbers must fit in uint16_t");
+
+/** Below this many entries, a client index range is scanned rather than split further. */
+#define CLIENT_INDEX_LEAF_SIZE 8
+
+/**
+ * A client index is an array of slot numbers into a Client_data array, sorted
+ * by (public key, slot). Ties between equal keys (e.g. empty slots) are broken
+ * by slot number, so that every slot has exactly one position and lookups
+ * return the same slot as a linear scan would.
+ */
+static int client_index_cmp(const Client_data *_Nonnull list, uint16_t slot, const uint8_t *_Nonnull pk, uint32_t pk_slot)
+{
+    const int cmp = memcmp(list[slot].public_key, pk, CRYPTO_PUBLIC_KEY_SIZE);
+
+    if (cmp != 0) {
+        return cmp;
+    }
+
+    if (slot == pk_slot) {
+        return 0;
+    }
+
+    return slot < pk_slot ? -1 : 1;
+}
+
+/** @brief Find the first position in sorted[0..size) not ordered before (pk, pk_slot). */
+static uint32_t client_index_lower_bound(const Client_data *_Nonnull list, const uint16_t *_Nonnull sorted, uint32_t size,
+        const uint8_t *_Nonnull pk, uint32_t pk_slot)
+{
+    uint32_t lo = 0;
+    uint32_t hi = size;
+
+    while (lo < hi) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+
+        if (client_index_cmp(list, sorted[mid], pk, pk_slot) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/** @brief Find index of Client_data with public_key equal to pk using the client index.
+ *
+ * @return index or UINT32_MAX if not found.
+ */
+static uint32_t client_index_find(const Client_data *_Nonnull list, const uint16_t *_Nonnull sorted, uint32_t size, const uint8_t *_Nonnull pk)
+{
+    const uint32_t pos = client_index_lower_bound(list, sorted, size, pk, 0);
+
+    if (pos < size && pk_equal(list[sorted[pos]].public_key, pk)) {
+        return sorted[pos];
+    }
+
+    return UINT32_MAX;
+}
+
+/** @brief Change the public key of a slot and move it to its new position in the index. */
+static void client_index_set_pk(Client_data *_Nonnull list, uint16_t *_Nonnull sorted, uint32_t size, uint32_t slot, const uint8_t *_Nonnull pk)
+{
+    assert(slot < size);
+
+    if (pk_equal(list[slot].public_key, pk)) {
+        return;
+    }
+
+    const uint32_t old_pos = client_index_lower_bound(list, sorted, size, list[slot].public_key, slot);
+    assert(old_pos < size && sorted[old_pos] == slot);
+    memmove(&sorted[old_pos], &sorted[old_pos + 1], (size - old_pos - 1) * sizeof(sorted[0]));
+
+    pk_copy(list[slot].public_key, pk);
+
+    const uint32_t new_pos = client_index_lower_bound(list, sorted, size - 1, pk, slot);
+    memmove(&sorted[new_pos + 1], &sorted[new_pos], (size - 1 - new_pos) * sizeof(sorted[0]));
+    sorted[new_pos] = (uint16_t)slot;
+}
+
+/** @brief Initialise the index for a client list in which all public keys are equal (e.g. zeroed). */
+static void client_index_init(uint16_t *_Nonnull sorted, uint32_t size)
+{
+    for (uint32_t i = 0; i < size; ++i) {
+        sorted[i] = (uint16_t)i;
+    }
+}
+
+const Client_data *dht_find_close_client(const DHT *dht, const uint8_t *public_key)
+{
+    const uint32_t index = client_index_find(dht->close_clientlist, dht->close_sorted, LCLIENT_LIST, public_key);
+
+    if (index == UINT32_MAX) {
+        return nullptr;
+    }
+
+    return &dht->close_clientlist[index];
+}
+
 /** Update ip_port of client if it's needed. */
 static void update_client(const Logger *_Nonnull log, const Mono_Time *_Nonnull mono_time, int index, Client_data *_Nonnull client, const IP_Port *_Nonnull ip_port)
 {
@@ -563,12 +675,16 @@ static void update_client(const Logger *_Nonnull log, const Mono_Time *_Nonnull
  * If it is then set its corresponding timestamp to current time.
  * If the id is already in the list with a different ip_port, update it.
  * TODO(irungentoo): Maybe optimize this.
+ *
+ * @param sorted client index of the list, or null if the list is not indexed.
  */
-static bool client_or_ip_port_in_list(const Logger *_Nonnull log, const Mono_Time *_Nonnull mono_time, Client_data *_Nonnull list, uint16_t length, const uint8_t *_Nonnull public_key,
-                                      const IP_Port *_Nonnull ip_port)
+static bool client_or_ip_port_in_list(const Logger *_Nonnull log, const Mono_Time *_Nonnull mono_time, Client_data *_Nonnull list, uint16_t length, uint16_t *_Nullable sorted,
+                                      const uint8_t *_Nonnull public_key, const IP_Port *_Nonnull ip_port)
 {
     const uint64_t temp_time = mono_time_get(mono_time);
-    uint32_t index = index_of_client_pk(list, length, public_key);
+    uint32_t index = sorted != nullptr
+                     ? client_index_find(list, sorted, length, public_key)
+                     : index_of_client_pk(list, length, public_key);
 
     /* if public_key is in list, find it and maybe overwrite ip_port */
     if (index != UINT32_MAX) {
@@ -600,7 +716,12 @@ static bool client_or_ip_port_in_list(const Logger *_Nonnull log, const Mono_Tim
 
     /* Initialize client timestamp. */
     assoc->timestamp = temp_time;
-    memcpy(list[index].public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
+
+    if (sorted != nullptr) {
+        client_index_set_pk(list, sorted, length, index, public_key);
+    } else {
+        memcpy(list[index].public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    }
 
     LOGGER_DEBUG(log, "coipil[%u]: switching public_key (ipv%d)", index, ip_version);
 
@@ -649,67 +770,127 @@ bool add_to_list(
     return inserted;
 }
 
-/**
- * helper for `get_close_nodes()`. argument list is a monster :D
- */
-static void get_close_nodes_inner(uint64_t cur_time, const uint8_t *_Nonnull public_key, Node_format *_Nonnull nodes_list, uint32_t *_Nonnull num_nodes_ptr, Family sa_family,
-                                  const Client_data *_Nonnull client_list, uint32_t client_list_length, bool is_lan, bool want_announce)
-{
-    if (!net_family_is_ipv4(sa_family) && !net_family_is_ipv6(sa_family) && !net_family_is_unspec(sa_family)) {
+/** State shared by the helpers of `get_close_nodes()`. */
+typedef struct Close_Nodes_Search {
+    uint64_t cur_time;
+    const uint8_t *_Nonnull public_key;
+    Node_format *_Nonnull nodes_list;
+    uint32_t num_nodes;
+    Family sa_family;
+    bool is_lan;
+    bool want_announce;
+} Close_Nodes_Search;
+
+/** Offer a single client to the nodes_list of a `get_close_nodes()` search. */
+static void get_close_nodes_add(Close_Nodes_Search *_Nonnull search, const Client_data *_Nonnull client)
+{
+    const IPPTsPng *ipptp;
+
+    if (net_family_is_ipv4(search->sa_family)) {
+        ipptp = &client->assoc4;
+    } else if (net_family_is_ipv6(search->sa_family)) {
+        ipptp = &client->assoc6;
+    } else if (client->assoc4.timestamp >= client->assoc6.timestamp) {
+        ipptp = &client->assoc4;
+    } else {
+        ipptp = &client->assoc6;
+    }
+
+    /* node not in a good condition? */
+    if (assoc_timeout(search->cur_time, ipptp)) {
+        return;
+    }
+
+    /* don't send LAN ips to non LAN peers */
+    if (ip_is_lan(&ipptp->ip_port.ip) && !search->is_lan) {
+        return;
+    }
+
+#ifdef CHECK_ANNOUNCE_NODE
+
+    if (search->want_announce && !client->announce_node) {
         return;
     }
 
-    uint32_t num_nodes = *num_nodes_ptr;
+#endif /* CHECK_ANNOUNCE_NODE */
+
+    /* node already in list? */
+    if (index_of_node_pk(search->nodes_list, search->num_nodes, client->public_key) != UINT32_MAX) {
+        return;
+    }
 
+    if (search->num_nodes < MAX_SENT_NODES) {
+        memcpy(search->nodes_list[search->num_nodes].public_key, client->public_key, CRYPTO_PUBLIC_KEY_SIZE);
+        search->nodes_list[search->num_nodes].ip_port = ipptp->ip_port;
+        ++search->num_nodes;
+    } else {
+        // TODO(zugz): this could be made significantly more efficient by
+        // using a version of add_to_list which works with a sorted list.
+        add_to_list(search->nodes_list, MAX_SENT_NODES, client->public_key, &ipptp->ip_port, search->public_key);
+    }
+}
+
+static void get_close_nodes_inner(Close_Nodes_Search *_Nonnull search, const Client_data *_Nonnull client_list, uint32_t client_list_length)
+{
     for (uint32_t i = 0; i < client_list_length; ++i) {
-        const Client_data *const client = &client_list[i];
-        const IPPTsPng *ipptp;
-
-        if (net_family_is_ipv4(sa_family)) {
-            ipptp = &client->assoc4;
-        } else if (net_family_is_ipv6(sa_family)) {
-            ipptp = &client->assoc6;
-        } else if (client->assoc4.timestamp >= client->assoc6.timestamp) {
-            ipptp = &client->assoc4;
-        } else {
-            ipptp = &client->assoc6;
-        }
+        get_close_nodes_add(search, &client_list[i]);
+    }
+}
 
-        /* node not in a good condition? */
-        if (assoc_timeout(cur_time, ipptp)) {
-            continue;
-        }
+static bool pk_bit_is_set(const uint8_t *_Nonnull pk, uint32_t bit)
+{
+    return (pk[bit / 8] & (1 << (7 - (bit % 8)))) != 0;
+}
 
-        /* don't send LAN ips to non LAN peers */
-        if (ip_is_lan(&ipptp->ip_port.ip) && !is_lan) {
-            continue;
+/** @brief Search the client index range sorted[lo..hi) in order of XOR distance to the search key.
+ *
+ * All keys in the range share their first `depth` bits, so the range splits
+ * into a lower half with bit `depth` clear and an upper half with it set. Every
+ * key in the half that matches the search key is closer than every key in the
+ * other half, so the other half only needs to be visited if the nearer one did
+ * not yield enough nodes.
+ */
+static void get_close_nodes_indexed(Close_Nodes_Search *_Nonnull search, const Client_data *_Nonnull list, const uint16_t *_Nonnull sorted,
+                                    uint32_t lo, uint32_t hi, uint32_t depth)
+{
+    if (lo >= hi) {
+        return;
+    }
+
+    if (hi - lo <= CLIENT_INDEX_LEAF_SIZE || depth == CRYPTO_PUBLIC_KEY_SIZE * 8) {
+        for (uint32_t i = lo; i < hi; ++i) {
+            get_close_nodes_add(search, &list[sorted[i]]);
         }
 
-#ifdef CHECK_ANNOUNCE_NODE
+        return;
+    }
 
-        if (want_announce && !client->announce_node) {
-            continue;
+    uint32_t split_lo = lo;
+    uint32_t split_hi = hi;
+
+    while (split_lo < split_hi) {
+        const uint32_t mid = split_lo + (split_hi - split_lo) / 2;
+
+        if (pk_bit_is_set(list[sorted[mid]].public_key, depth)) {
+            split_hi = mid;
+        } else {
+            split_lo = mid + 1;
         }
+    }
 
-#endif /* CHECK_ANNOUNCE_NODE */
+    if (pk_bit_is_set(search->public_key, depth)) {
+        get_close_nodes_indexed(search, list, sorted, split_lo, hi, depth + 1);
 
-        /* node already in list? */
-        if (index_of_node_pk(nodes_list, num_nodes, client->public_key) != UINT32_MAX) {
-            continue;
+        if (search->num_nodes < MAX_SENT_NODES) {
+            get_close_nodes_indexed(search, list, sorted, lo, split_lo, depth + 1);
         }
+    } else {
+        get_close_nodes_indexed(search, list, sorted, lo, split_lo, depth + 1);
 
-        if (num_nodes < MAX_SENT_NODES) {
-            memcpy(nodes_list[num_nodes].public_key, client->public_key, CRYPTO_PUBLIC_KEY_SIZE);
-            nodes_list[num_nodes].ip_port = ipptp->ip_port;
-            ++num_nodes;
-        } else {
-            // TODO(zugz): this could be made significantly more efficient by
-            // using a version of add_to_list which works with a sorted list.
-            add_to_list(nodes_list, MAX_SENT_NODES, client->public_key, &ipptp->ip_port, public_key);
+        if (search->num_nodes < MAX_SENT_NODES) {
+            get_close_nodes_indexed(search, list, sorted, split_lo, hi, depth + 1);
         }
     }
-
-    *num_nodes_ptr = num_nodes;
 }
 
 /**
@@ -719,30 +900,32 @@ static void get_close_nodes_inner(uint64_t cur_time, const uint8_t *_Nonnull pub
  * want_announce: return only nodes which implement the dht announcements protocol.
  */
 static int get_somewhat_close_nodes(uint64_t cur_time, const uint8_t *_Nonnull public_key, Node_format nodes_list[_Nonnull MAX_SENT_NODES], Family sa_family,
-                                    const Client_data *_Nonnull close_clientlist, const DHT_Friend *_Nonnull friends_list, uint16_t friends_list_size, bool is_lan, bool want_announce)
+                                    const Client_data *_Nonnull close_clientlist, const uint16_t *_Nonnull close_sorted,
+                                    const DHT_Friend *_Nonnull friends_list, uint16_t friends_list_size, bool is_lan, bool want_announce)
 {
     for (uint16_t i = 0; i < MAX_SENT_NODES; ++i) {
         nodes_list[i] = empty_node_format;
     }
 
-    uint32_t num_nodes = 0;
-    get_close_nodes_inner(
+    if (!net_family_is_ipv4(sa_family) && !net_family_is_ipv6(sa_family) && !net_family_is_unspec(sa_family)) {
+        return 0;
+    }
+
+    Close_Nodes_Search search = {
         cur_time, public_key,
-        nodes_list, &num_nodes,
-        sa_family, close_clientlist, LCLIENT_LIST,
-        is_lan, want_announce);
+        nodes_list, 0,
+        sa_family, is_lan, want_announce,
+    };
+
+    get_close_nodes_indexed(&search, close_clientlist, close_sorted, 0, LCLIENT_LIST, 0);
 
     for (uint16_t i = 0; i < friends_list_size; ++i) {
         const DHT_Friend *dht_friend = &friends_list[i];
 
-        get_close_nodes_inner(
-            cur_time, public_key,
-            nodes_list, &num_nodes,
-            sa_family, dht_friend->client_list, MAX_FRIEND_CLIENTS,
-            is_lan, want_announce);
+        get_close_nodes_inner(&search, dht_friend->client_list, MAX_FRIEND_CLIENTS);
     }
 
-    return num_nodes;
+    return search.num_nodes;
 }
 
 int get_close_nodes(
@@ -752,7 +935,7 @@ int get_close_nodes(
 {
     return get_somewhat_close_nodes(
                dht->cur_time, public_key, nodes_list,
-               sa_family, dht->close_clientlist,
+               sa_family, dht->close_clientlist, dht->close_sorted,
                dht->friends_list, dht->num_friends,
                is_lan, want_announce);
 }
@@ -1062,7 +1245,7 @@ static bool add_to_close(DHT *_Nonnull dht, const uint8_t *_Nonnull public_key,
             return true;
         }
 
-        pk_copy(client->public_key, public_key);
+        client_index_set_pk(dht->close_clientlist, dht->close_sorted, LCLIENT_LIST, (index * LCLIENT_NODES) + i, public_key);
         update_client_with_reset(dht->mono_time, client, ip_port);
 #ifdef CHECK_ANNOUNCE_NODE
         client->announce_node = false;
@@ -1189,7 +1372,7 @@ uint32_t addto_lists(DHT *dht, const IP_Port *ip_port, const uint8_t *public_key
      * to replace the first ip by the second.
      */
     const bool in_close_list = client_or_ip_port_in_list(dht->log, dht->mono_time, dht->close_clientlist, LCLIENT_LIST,
-                               public_key, &ipp_copy);
+                               dht->close_sorted, public_key, &ipp_copy);
 
     /* add_to_close should be called only if !in_list (don't extract to variable) */
     if (in_close_list || !add_to_close(dht, public_key, &ipp_copy, false)) {
@@ -1200,7 +1383,7 @@ uint32_t addto_lists(DHT *dht, const IP_Port *ip_port, const uint8_t *public_key
 
     for (uint32_t i = 0; i < dht->num_friends; ++i) {
         const bool in_list = client_or_ip_port_in_list(dht->log, dht->mono_time, dht->friends_list[i].client_list,
-                             MAX_FRIEND_CLIENTS, public_key, &ipp_copy);
+                             MAX_FRIEND_CLIENTS, nullptr, public_key, &ipp_copy);
 
         /* replace_all should be called only if !in_list (don't extract to variable) */
         if (in_list
@@ -1231,10 +1414,9 @@ uint32_t addto_lists(DHT *dht, const IP_Port *ip_port, const uint8_t *public_key
     return used;
 }
 
-static bool update_client_data(const Mono_Time *_Nonnull mono_time, Client_data *_Nonnull array, size_t size, const IP_Port *_Nonnull ip_port, const uint8_t *_Nonnull pk, bool node_is_self)
+static bool update_client_data(const Mono_Time *_Nonnull mono_time, Client_data *_Nonnull array, uint32_t index, const IP_Port *_Nonnull ip_port, bool node_is_self)
 {
     const uint64_t temp_time = mono_time_get(mono_time);
-    const uint32_t index = index_of_client_pk(array, size, pk);
 
     if (index == UINT32_MAX) {
         return false;
@@ -1267,7 +1449,8 @@ static void returnedip_ports(DHT *_Nonnull dht, const IP_Port *_Nonnull ip_port,
     const IP_Port ipp_copy = ip_port_normalize(ip_port);
 
     if (pk_equal(public_key, dht->self_public_key)) {
-        update_client_data(dht->mono_time, dht->close_clientlist, LCLIENT_LIST, &ipp_copy, nodepublic_key, true);
+        const uint32_t index = client_index_find(dht->close_clientlist, dht->close_sorted, LCLIENT_LIST, nodepublic_key);
+        update_client_data(dht->mono_time, dht->close_clientlist, index, &ipp_copy, true);
         return;
     }
 
@@ -1275,7 +1458,9 @@ static void returnedip_ports(DHT *_Nonnull dht, const IP_Port *_Nonnull ip_port,
         if (pk_equal(public_key, dht->friends_list[i].public_key)) {
             Client_data *const client_list = dht->friends_list[i].client_list;
 
-            if (update_client_data(dht->mono_time, client_list, MAX_FRIEND_CLIENTS, &ipp_copy, nodepublic_key, false)) {
+            const uint32_t index = index_of_client_pk(client_list, MAX_FRIEND_CLIENTS, nodepublic_key);
+
+            if (update_client_data(dht->mono_time, client_list, index, &ipp_copy, false)) {
                 return;
             }
         }
@@ -1379,6 +1564,11 @@ static int send_nodes_response(const DHT *_Nonnull dht, const IP_Port *_Nonnull
 
 #define CRYPTO_NODE_SIZE (CRYPTO_PUBLIC_KEY_SIZE + sizeof(uint64_t))
 
+/** @brief Answer a nodes request.
+ *
+ * Registered as a concurrent handler: it only reads the client lists and
+ * uses the locked shared key cache and ping list.
+ */
 static int handle_nodes_request(void *_Nonnull object, const IP_Port *_Nonnull source, const uint8_t *_Nonnull packet, uint16_t length, void *_Nonnull userdata)
 {
     DHT *const dht = (DHT *)object;
@@ -1392,8 +1582,13 @@ static int handle_nodes_request(void *_Nonnull object, const IP_Port *_Nonnull s
         return 1;
     }
 
+    uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
+
+    if (!dht_copy_shared_key_recv(dht, packet + 1, shared_key)) {
+        return 1;
+    }
+
     uint8_t plain[CRYPTO_NODE_SIZE];
-    const uint8_t *shared_key = dht_get_shared_key_recv(dht, packet + 1);
     const int len = decrypt_data_symmetric(
                         dht->mem,
                         shared_key,
@@ -1879,20 +2074,19 @@ bool dht_bootstrap_from_address(DHT *dht, const char *address, bool ipv6enabled,
 
 int route_packet(const DHT *dht, const uint8_t *public_key, const uint8_t *packet, uint16_t length)
 {
-    for (uint32_t i = 0; i < LCLIENT_LIST; ++i) {
-        if (pk_equal(public_key, dht->close_clientlist[i].public_key)) {
-            const Client_data *const client = &dht->close_clientlist[i];
-            const IPPTsPng *const assocs[] = { &client->assoc6, &client->assoc4, nullptr };
+    const Client_data *const client = dht_find_close_client(dht, public_key);
 
-            for (const IPPTsPng * const *it = assocs; *it != nullptr; ++it) {
-                const IPPTsPng *const assoc = *it;
+    if (client == nullptr) {
+        return -1;
+    }
 
-                if (ip_isset(&assoc->ip_port.ip)) {
-                    return sendpacket(dht->net, &assoc->ip_port, packet, length);
-                }
-            }
+    const IPPTsPng *const assocs[] = { &client->assoc6, &client->assoc4, nullptr };
 
-            break;
+    for (const IPPTsPng * const *it = assocs; *it != nullptr; ++it) {
+        const IPPTsPng *const assoc = *it;
+
+        if (ip_isset(&assoc->ip_port.ip)) {
+            return sendpacket(dht->net, &assoc->ip_port, packet, length);
         }
     }
 
@@ -2528,6 +2722,8 @@ DHT *new_dht(const Logger *log, const Memory *mem, const Random *rng, const Netw
     dht->hole_punching_enabled = hole_punching_enabled;
     dht->lan_discovery_enabled = lan_discovery_enabled;
 
+    client_index_init(dht->close_sorted, LCLIENT_LIST);
+
     struct Ping *temp_ping = ping_new(mem, mono_time, rng, dht, net);
 
     if (temp_ping == nullptr) {
@@ -2538,7 +2734,7 @@ DHT *new_dht(const Logger *log, const Memory *mem, const Random *rng, const Netw
 
     dht->ping = temp_ping;
 
-    networking_registerhandler(dht->net, NET_PACKET_NODES_REQUEST, &handle_nodes_request, dht);
+    networking_registerhandler_concurrent(dht->net, NET_PACKET_NODES_REQUEST, &handle_nodes_request, dht);
     networking_registerhandler(dht->net, NET_PACKET_NODES_RESPONSE, &handle_nodes_response, dht);
     networking_registerhandler(dht->net, NET_PACKET_CRYPTO, &cryptopacket_handle, dht);
     networking_registerhandler(dht->net, NET_PACKET_LAN_DISCOVERY, &handle_lan_discovery, dht);
@@ -2550,7 +2746,7 @@ DHT *new_dht(const Logger *log, const Memory *mem, const Random *rng, const Netw
 
     crypto_new_keypair(rng, dht->self_public_key, dht->self_secret_key);
 
-    Shared_Key_Cache *const temp_shared_keys_recv = shared_key_cache_new(log, mono_time, mem, dht->self_secret_key, KEYS_TIMEOUT, MAX_KEYS_PER_SLOT);
+    Shared_Key_Cache *const temp_shared_keys_recv = shared_key_cache_new(log, mono_time, mem, dht->self_secret_key, KEYS_TIMEOUT, SHARED_KEY_CACHE_DEFAULT_CAPACITY);
 
     if (temp_shared_keys_recv == nullptr) {
         LOGGER_ERROR(log, "failed to initialise shared key cache");
@@ -2560,7 +2756,7 @@ DHT *new_dht(const Logger *log, const Memory *mem, const Random *rng, const Netw
 
     dht->shared_keys_recv = temp_shared_keys_recv;
 
-    Shared_Key_Cache *const temp_shared_keys_sent = shared_key_cache_new(log, mono_time, mem, dht->self_secret_key, KEYS_TIMEOUT, MAX_KEYS_PER_SLOT);
+    Shared_Key_Cache *const temp_shared_keys_sent = shared_key_cache_new(log, mono_time, mem, dht->self_secret_key, KEYS_TIMEOUT, SHARED_KEY_CACHE_DEFAULT_CAPACITY);
 
     if (temp_shared_keys_sent == nullptr) {
         LOGGER_ERROR(log, "failed to initialise shared key cache");
@@ -2624,6 +2820,18 @@ void do_dht(DHT *dht)
     ping_iterate(dht->ping);
 }
 
+uint32_t dht_run_interval(const DHT *dht)
+{
+    const uint64_t next_run = (dht->cur_time + 1) * 1000;
+    const uint64_t now = mono_time_get_ms(dht->mono_time);
+
+    if (now >= next_run) {
+        return 0;
+    }
+
+    return (uint32_t)(next_run - now);
+}
+
 void kill_dht(DHT *dht)
 {
     if (dht == nullptr) {
@@ -2883,6 +3091,32 @@ bool dht_non_lan_connected(const DHT *dht)
     return false;
 }
 
+bool dht_set_shared_key_capacity(DHT *dht, uint32_t capacity)
+{
+    return shared_key_cache_set_capacity(dht->shared_keys_recv, capacity)
+           && shared_key_cache_set_capacity(dht->shared_keys_sent, capacity);
+}
+
+bool dht_enable_thread_safety(DHT *dht)
+{
+    return shared_key_cache_enable_thread_safety(dht->shared_keys_recv)
+           && shared_key_cache_enable_thread_safety(dht->shared_keys_sent)
+           && ping_enable_thread_safety(dht->ping);
+}
+
+void dht_add_shared_key_stats(const DHT *dht, Shared_Key_Cache_Stats *stats)
+{
+    shared_key_cache_add_stats(dht->shared_keys_recv, stats);
+    shared_key_cache_add_stats(dht->shared_keys_sent, stats);
+}
+
+void dht_register_key_agreement(DHT *dht, Key_Agreement *ka)
+{
+    // Both requests start with the sender's public key.
+    key_agreement_register(ka, NET_PACKET_NODES_REQUEST, dht->shared_keys_recv, 1);
+    key_agreement_register(ka, NET_PACKET_PING_REQUEST, dht->shared_keys_recv, 1);
+}
+
 uint16_t dht_get_num_closelist(const DHT *dht)
 {
     uint16_t num_valid_close_clients = 0;
@@ -14,6 +14,7 @@
 
 #include "attributes.h"
 #include "crypto_core.h"
+#include "key_agreement.h"
 #include "logger.h"
 #include "mem.h"
 #include "mono_time.h"
@@ -21,6 +22,7 @@
 #include "network.h"
 #include "ping_array.h"
 #include "rng.h"
+#include "shared_key_cache.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -215,6 +217,11 @@ void dht_set_self_secret_key(DHT *_Nonnull dht, const uint8_t *_Nonnull key);
 struct Ping *_Nonnull dht_get_ping(const DHT *_Nonnull dht);
 const Client_data *_Nonnull dht_get_close_clientlist(const DHT *_Nonnull dht);
 const Client_data *_Nonnull dht_get_close_client(const DHT *_Nonnull dht, uint32_t client_num);
+/** @brief Find the close list entry for a public key.
+ *
+ * @return the entry, or null if the key is not in the close list.
+ */
+const Client_data *_Nullable dht_find_close_client(const DHT *_Nonnull dht, const uint8_t *_Nonnull public_key);
 uint16_t dht_get_num_friends(const DHT *_Nonnull dht);
 
 DHT_Friend *_Nonnull dht_get_friend(DHT *_Nonnull dht, uint32_t friend_num);
@@ -234,6 +241,15 @@ const uint8_t *_Nullable dht_get_shared_key_recv(DHT *_Nonnull dht, const uint8_
  */
 const uint8_t *_Nullable dht_get_shared_key_sent(DHT *_Nonnull dht, const uint8_t *_Nonnull public_key);
 
+/**
+ * Thread-safe variants of the above: copy the shared key for `public_key` into
+ * `shared_key`, for use in concurrent packet handlers.
+ *
+ * @retval false if the key could not be computed.
+ */
+bool dht_copy_shared_key_recv(DHT *_Nonnull dht, const uint8_t *_Nonnull public_key, uint8_t shared_key[_Nonnull CRYPTO_SHARED_KEY_SIZE]);
+bool dht_copy_shared_key_sent(DHT *_Nonnull dht, const uint8_t *_Nonnull public_key, uint8_t shared_key[_Nonnull CRYPTO_SHARED_KEY_SIZE]);
+
 /**
  * Sends a nodes request to `ip_port` with the public key `public_key` for nodes
  * that are close to `client_id`.
@@ -342,6 +358,14 @@ uint16_t closelist_nodes(const DHT *_Nonnull dht, Node_format *_Nonnull nodes, u
 /** Run this function at least a couple times per second (It's the main loop). */
 void do_dht(DHT *_Nonnull dht);
 
+/**
+ * @brief Return the time in milliseconds before `do_dht()` has work to do again.
+ *
+ * All DHT timers (pings, nodes requests, timeouts) have a resolution of one
+ * second, so this is the time until the next second of mono time starts.
+ */
+uint32_t dht_run_interval(const DHT *_Nonnull dht);
+
 /*
  *  Use these two functions to bootstrap the client.
  */
@@ -424,6 +448,30 @@ bool dht_isconnected(const DHT *_Nonnull dht);
  */
 bool dht_non_lan_connected(const DHT *_Nonnull dht);
 
+/**
+ * @brief Sets the capacity of the shared key caches for packets we send and
+ *   receive. See `shared_key_cache_set_capacity`.
+ *
+ * Must be called before other threads use the DHT.
+ */
+bool dht_set_shared_key_capacity(DHT *_Nonnull dht, uint32_t capacity);
+
+/**
+ * @brief Allocates the locks that let the DHT's concurrent packet handlers run
+ *   on other threads (see `networking_set_dispatcher`).
+ *
+ * Must be called before other threads use the DHT.
+ *
+ * @retval false if a lock could not be allocated.
+ */
+bool dht_enable_thread_safety(DHT *_Nonnull dht);
+
+/** @brief Adds the statistics of the DHT's shared key caches to @p stats. */
+void dht_add_shared_key_stats(const DHT *_Nonnull dht, Shared_Key_Cache_Stats *_Nonnull stats);
+
+/** @brief Lets @p ka compute the shared keys of nodes and ping requests from unknown nodes. */
+void dht_register_key_agreement(DHT *_Nonnull dht, Key_Agreement *_Nonnull ka);
+
 /**
  * This function returns the ratio of close dht nodes that are known to support announce/store.
  * This function returns the number of DHT nodes in the closelist.
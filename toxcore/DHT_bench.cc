@@ -0,0 +1,162 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "DHT.h"
+#include "crypto_core.h"
+#include "logger.h"
+#include "mono_time.h"
+#include "network.h"
+#include "os_memory.h"
+#include "os_network.h"
+#include "os_random.h"
+
+namespace {
+
+using PublicKey = std::array<uint8_t, CRYPTO_PUBLIC_KEY_SIZE>;
+
+/** Number of distinct nodes offered to the DHT, enough to fill most of the close list. */
+constexpr uint32_t kNumNodes = 20000;
+
+/**
+ * @brief Nodes request handling cost on a DHT with a well populated close list.
+ *
+ * The argument is the number of lookups per iteration, i.e. the load a
+ * bootstrap node sees in one second at 1k, 10k and 100k nodes requests/s.
+ */
+class DhtBenchFixture : public benchmark::Fixture {
+public:
+    void SetUp(::benchmark::State &state) override
+    {
+        mem = os_memory();
+        rng = os_random();
+        ns = os_network();
+        if (rng == nullptr || ns == nullptr) {
+            setup_error = "os_random or os_network failed";
+            return;
+        }
+
+        log = logger_new(mem);
+        mono_time = mono_time_new(mem, nullptr, nullptr);
+        net = new_networking_no_udp(log, mem, ns);
+        if (log == nullptr || mono_time == nullptr || net == nullptr) {
+            setup_error = "failed to create networking";
+            return;
+        }
+
+        dht = new_dht(log, mem, rng, ns, mono_time, net, true, true);
+        if (dht == nullptr) {
+            setup_error = "new_dht failed";
+            return;
+        }
+
+        for (uint32_t i = 0; i < kNumNodes; ++i) {
+            PublicKey pk;
+            random_bytes(rng, pk.data(), pk.size());
+
+            IP_Port ip_port{};
+            ip_port.ip.family = net_family_ipv4();
+            ip_port.ip.ip.v4.uint32 = net_htonl(0x0a000000 + i);
+            ip_port.port = net_htons(33445);
+
+            addto_lists(dht, &ip_port, pk.data());
+
+            if (dht_find_close_client(dht, pk.data()) != nullptr) {
+                known.push_back(pk);
+            }
+        }
+
+        targets.resize(1024);
+        for (PublicKey &target : targets) {
+            random_bytes(rng, target.data(), target.size());
+        }
+    }
+
+    void TearDown(const ::benchmark::State &state) override
+    {
+        kill_dht(dht);
+        kill_networking(net);
+        mono_time_free(mem, mono_time);
+        logger_kill(log);
+        dht = nullptr;
+        net = nullptr;
+        mono_time = nullptr;
+        log = nullptr;
+        known.clear();
+        targets.clear();
+    }
+
+protected:
+    const Memory *mem = nullptr;
+    const Random *rng = nullptr;
+    const Network *ns = nullptr;
+    Logger *log = nullptr;
+    Mono_Time *mono_time = nullptr;
+    Networking_Core *net = nullptr;
+    DHT *dht = nullptr;
+    std::vector<PublicKey> known;
+    std::vector<PublicKey> targets;
+    std::string setup_error;
+};
+
+BENCHMARK_DEFINE_F(DhtBenchFixture, GetCloseNodes)(benchmark::State &state)
+{
+    if (!setup_error.empty()) {
+        state.SkipWithError(setup_error.c_str());
+        return;
+    }
+
+    const int64_t lookups = state.range(0);
+    Node_format nodes[MAX_SENT_NODES];
+
+    for (auto _ : state) {
+        for (int64_t i = 0; i < lookups; ++i) {
+            const PublicKey &target = targets[i % targets.size()];
+            benchmark::DoNotOptimize(
+                get_close_nodes(dht, target.data(), nodes, net_family_unspec(), false, false));
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * lookups);
+    state.counters["close_nodes"] = static_cast<double>(known.size());
+}
+
+BENCHMARK_REGISTER_F(DhtBenchFixture, GetCloseNodes)->Arg(1000)->Arg(10000)->Arg(100000);
+
+BENCHMARK_DEFINE_F(DhtBenchFixture, FindCloseClient)(benchmark::State &state)
+{
+    if (!setup_error.empty()) {
+        state.SkipWithError(setup_error.c_str());
+        return;
+    }
+
+    if (known.empty()) {
+        state.SkipWithError("close list is empty");
+        return;
+    }
+
+    const int64_t lookups = state.range(0);
+
+    for (auto _ : state) {
+        for (int64_t i = 0; i < lookups; ++i) {
+            // Alternate between keys that are present and keys that are not.
+            const PublicKey &pk = (i % 2) == 0 ? known[i % known.size()] : targets[i % targets.size()];
+            benchmark::DoNotOptimize(dht_find_close_client(dht, pk.data()));
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * lookups);
+}
+
+BENCHMARK_REGISTER_F(DhtBenchFixture, FindCloseClient)->Arg(1000)->Arg(10000)->Arg(100000);
+
+}  // namespace
+
+BENCHMARK_MAIN();
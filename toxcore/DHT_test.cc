@@ -6,7 +6,9 @@
 #include <algorithm>
 #include <array>
 #include <cstring>
+#include <memory>
 #include <random>
+#include <vector>
 
 #include "../testing/support/public/simulated_environment.hh"
 #include "DHT_test_util.hh"
@@ -401,4 +403,135 @@ TEST(AnnounceNodes, SetAndTest)
     logger_kill(log);
 }
 
+class CloseListTest : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        node = env.create_node(33445);
+        net_struct = node->c_network;
+
+        log = logger_new(&c_mem);
+        ASSERT_NE(log, nullptr);
+
+        mono_time = mono_time_new(&c_mem, nullptr, nullptr);
+        ASSERT_NE(mono_time, nullptr);
+        mono_time_set_current_time_callback(
+            mono_time,
+            [](void *user_data) -> std::uint64_t {
+                return static_cast<FakeClock *>(user_data)->current_time_ms();
+            },
+            &env.fake_clock());
+
+        // Move past BAD_NODE_TIMEOUT so that empty close list slots count as timed out.
+        env.fake_clock().advance((BAD_NODE_TIMEOUT + 1) * 1000);
+        mono_time_update(mono_time);
+
+        net.reset(new_networking_no_udp(log, &c_mem, &net_struct));
+        ASSERT_NE(net, nullptr);
+        dht.reset(new_dht(log, &c_mem, &c_rng, &net_struct, mono_time, net.get(), true, true));
+        ASSERT_NE(dht, nullptr);
+    }
+
+    void TearDown() override
+    {
+        dht.reset();
+        net.reset();
+        mono_time_free(&c_mem, mono_time);
+        logger_kill(log);
+    }
+
+    IP_Port node_ip_port(std::uint32_t i) const
+    {
+        IP_Port ip_port = {0};
+        ip_port.ip.family = net_family_ipv4();
+        ip_port.ip.ip.v4.uint32 = net_htonl(0x0a000000 + i);
+        ip_port.port = net_htons(33445);
+        return ip_port;
+    }
+
+    SimulatedEnvironment env{12345};
+    Memory c_mem = env.fake_memory().c_memory();
+    Random c_rng = env.fake_random().c_random();
+    std::unique_ptr<ScopedToxSystem> node;
+    Network net_struct{};
+    Logger *log = nullptr;
+    Mono_Time *mono_time = nullptr;
+    Ptr<Networking_Core> net;
+    Ptr<DHT> dht;
+};
+
+TEST_F(CloseListTest, GetCloseNodesReturnsClosestKnownNodes)
+{
+    for (std::uint32_t i = 0; i < 2000; ++i) {
+        const PublicKey pk = random_pk(&c_rng);
+        const IP_Port ip_port = node_ip_port(i);
+        addto_lists(dht.get(), &ip_port, pk.data());
+    }
+
+    // get_close_nodes searches the close list and the client lists of all
+    // friends, including the fake friends that addto_lists also fills.
+    std::vector<PublicKey> known;
+    const auto add_known = [&known](const Client_data &client) {
+        const PublicKey pk(client.public_key);
+
+        if (client.assoc4.timestamp != 0 && std::find(known.begin(), known.end(), pk) == known.end()) {
+            known.push_back(pk);
+        }
+    };
+
+    const Client_data *close_list = dht_get_close_clientlist(dht.get());
+
+    for (std::uint32_t i = 0; i < LCLIENT_LIST; ++i) {
+        add_known(close_list[i]);
+    }
+
+    for (std::uint32_t i = 0; i < dht_get_num_friends(dht.get()); ++i) {
+        const DHT_Friend *dht_friend = dht_get_friend(dht.get(), i);
+
+        for (std::size_t j = 0; j < MAX_FRIEND_CLIENTS; ++j) {
+            add_known(*dht_friend_client(dht_friend, j));
+        }
+    }
+
+    ASSERT_GT(known.size(), MAX_SENT_NODES);
+
+    for (int i = 0; i < 100; ++i) {
+        const PublicKey target = random_pk(&c_rng);
+
+        std::sort(known.begin(), known.end(), [&](PublicKey const &a, PublicKey const &b) {
+            return id_closest(target.data(), a.data(), b.data()) == 1;
+        });
+
+        Node_format nodes[MAX_SENT_NODES];
+        ASSERT_EQ(get_close_nodes(dht.get(), target.data(), nodes, net_family_unspec(), true, false),
+            MAX_SENT_NODES);
+
+        std::vector<PublicKey> found;
+        for (const Node_format &node_format : nodes) {
+            found.emplace_back(to_array(node_format.public_key));
+        }
+
+        EXPECT_THAT(found,
+            ::testing::UnorderedElementsAreArray(known.begin(), known.begin() + MAX_SENT_NODES));
+    }
+}
+
+TEST_F(CloseListTest, FindCloseClientFollowsKeyChanges)
+{
+    const PublicKey pk1 = random_pk(&c_rng);
+    const PublicKey pk2 = random_pk(&c_rng);
+    const IP_Port ip_port = node_ip_port(1);
+
+    EXPECT_EQ(dht_find_close_client(dht.get(), pk1.data()), nullptr);
+    EXPECT_TRUE(addto_lists(dht.get(), &ip_port, pk1.data()));
+    ASSERT_NE(dht_find_close_client(dht.get(), pk1.data()), nullptr);
+    EXPECT_EQ(to_array(dht_find_close_client(dht.get(), pk1.data())->public_key), pk1);
+
+    // A new key on the same ip_port replaces the old key in the close list.
+    EXPECT_TRUE(addto_lists(dht.get(), &ip_port, pk2.data()));
+    EXPECT_EQ(dht_find_close_client(dht.get(), pk1.data()), nullptr);
+    ASSERT_NE(dht_find_close_client(dht.get(), pk2.data()), nullptr);
+    EXPECT_EQ(to_array(dht_find_close_client(dht.get(), pk2.data())->public_key), pk2);
+}
+
 }  // namespace
@@ -23,6 +23,7 @@
 #include "bin_unpack.h"
 #include "ccompat.h"
 #include "crypto_core.h"
+#include "ev.h"
 #include "forwarding.h"
 #include "friend_connection.h"
 #include "friend_requests.h"
@@ -2429,21 +2430,180 @@ static void m_connection_status_callback(Messenger *_Nonnull m, void *_Nullable
  */
 #define MIN_RUN_INTERVAL 50
 
+/** @brief Whether `do_reqchunk_filecb` would ask the client for more file data right now. */
+static bool file_chunks_wanted(const Messenger *_Nonnull m, int32_t friendnumber)
+{
+    const Friend *const f = &m->friendlist[friendnumber];
+
+    if (f->num_sending_files == 0) {
+        return false;
+    }
+
+    const int crypt_connection_id = friend_connection_crypt_connection_id(m->fr_c, f->friendcon_id);
+
+    if (crypto_num_free_sendqueue_slots(m->net_crypto, crypt_connection_id) <= MIN_SLOTS_FREE) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < MAX_CONCURRENT_FILE_PIPES; ++i) {
+        const struct File_Transfers *const ft = &f->file_sending[i];
+
+        if (ft->status == FILESTATUS_TRANSFERRING && ft->paused == FILE_PAUSE_NOT
+                && (ft->size == 0 || ft->requested < ft->size)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 /**
- * @brief Return the time in milliseconds before `do_messenger()` should be called again
- *   for optimal performance.
+ * @brief The time in milliseconds at which `do_friends` has work to do that no
+ *   packet starts.
  *
- * @return time (in ms) before the next `do_messenger()` needs to be run on success.
+ * Friend requests, status updates and file chunks that could not be sent wait
+ * for the onion client or the friend's connection to take them, and those run
+ * before `do_friends` in the same `do_messenger` call.
  */
+static uint64_t friends_deadline(const Messenger *_Nonnull m)
+{
+    uint64_t deadline = UINT64_MAX;
+
+    for (uint32_t i = 0; i < m->numfriends; ++i) {
+        const Friend *const f = &m->friendlist[i];
+
+        if (f->status == FRIEND_REQUESTED) {
+            deadline = min_u64(deadline, (f->friendrequest_lastsent + f->friendrequest_timeout + 1) * 1000);
+        } else if (f->status == FRIEND_ONLINE && file_chunks_wanted(m, i)) {
+            return 0;
+        }
+    }
+
+    return deadline;
+}
+
+uint32_t messenger_timer_interval(const Messenger *m)
+{
+    if (!m->has_added_relays) {
+        return 0;
+    }
+
+    uint32_t interval = crypto_run_interval(m->net_crypto);
+    interval = min_u32(interval, friend_connections_run_interval(m->fr_c));
+    interval = min_u32(interval, onion_client_run_interval(m->onion_c));
+
+    if (!m->options.udp_disabled) {
+        interval = min_u32(interval, dht_run_interval(m->dht));
+    }
+
+    if (m->tcp_server != nullptr) {
+        interval = min_u32(interval, tcp_server_run_interval(m->tcp_server, m->mono_time));
+    }
+
+    uint64_t deadline = friends_deadline(m);
+    deadline = min_u64(deadline, gc_deadline(m->group_handler));
+    deadline = min_u64(deadline, gca_deadline(m->group_announce));
+    deadline = min_u64(deadline, (m->lastdump + DUMPING_CLIENTS_FRIENDS_EVERY_N_SECONDS + 1) * 1000);
+
+    const uint64_t now = mono_time_get_ms(m->mono_time);
+
+    if (deadline <= now) {
+        return 0;
+    }
+
+    return (uint32_t)min_u64(interval, deadline - now);
+}
+
 uint32_t messenger_run_interval(const Messenger *m)
 {
-    const uint32_t crypto_interval = crypto_run_interval(m->net_crypto);
+    return min_u32(messenger_timer_interval(m), MIN_RUN_INTERVAL);
+}
 
-    if (crypto_interval > MIN_RUN_INTERVAL) {
-        return MIN_RUN_INTERVAL;
+/** @brief The part of @p interests after the first @p count entries, or null if there is no room left. */
+static Ev_Interest *_Nullable interests_tail(Ev_Interest *_Nullable interests, uint32_t count, uint32_t max_interests)
+{
+    return interests != nullptr && count < max_interests ? &interests[count] : nullptr;
+}
+
+uint32_t messenger_copy_interests(const Messenger *m, Ev_Interest *interests, uint32_t max_interests)
+{
+    uint32_t count = 0;
+
+    if (!m->options.udp_disabled) {
+        if (interests != nullptr && max_interests > 0) {
+            interests[0].sock = net_sock(m->net);
+            interests[0].events = EV_READ;
+        }
+
+        ++count;
+    }
+
+    Ev_Interest *tail = interests_tail(interests, count, max_interests);
+    count += tcp_connections_copy_interests(nc_get_tcp_c(m->net_crypto), tail, tail == nullptr ? 0 : max_interests - count);
+
+    if (m->tcp_server != nullptr) {
+        tail = interests_tail(interests, count, max_interests);
+        count += tcp_server_copy_interests(m->tcp_server, tail, tail == nullptr ? 0 : max_interests - count);
+    }
+
+    tail = interests_tail(interests, count, max_interests);
+    count += gc_copy_interests(m->group_handler, tail, tail == nullptr ? 0 : max_interests - count);
+
+    return count;
+}
+
+bool messenger_register_ev(Messenger *m, Ev *ev, void *data)
+{
+    if (m->ev != nullptr) {
+        return false;
+    }
+
+    if (!m->options.udp_disabled && !ev_add(ev, net_sock(m->net), EV_READ, data)) {
+        return false;
+    }
+
+    if (m->tcp_server != nullptr && !tcp_server_register_ev(m->tcp_server, ev, data)) {
+        if (!m->options.udp_disabled) {
+            ev_del(ev, net_sock(m->net));
+        }
+
+        return false;
+    }
+
+    m->ev = ev;
+    m->ev_data = data;
+    messenger_sync_ev(m);
+    return true;
+}
+
+void messenger_unregister_ev(Messenger *m)
+{
+    if (m->ev == nullptr) {
+        return;
+    }
+
+    if (!m->options.udp_disabled) {
+        ev_del(m->ev, net_sock(m->net));
     }
 
-    return crypto_interval;
+    if (m->tcp_server != nullptr) {
+        tcp_server_unregister_ev(m->tcp_server);
+    }
+
+    tcp_connections_sync_ev(nc_get_tcp_c(m->net_crypto), nullptr, nullptr);
+    gc_sync_ev(m->group_handler, nullptr, nullptr);
+    m->ev = nullptr;
+    m->ev_data = nullptr;
+}
+
+void messenger_sync_ev(Messenger *m)
+{
+    if (m->ev == nullptr) {
+        return;
+    }
+
+    tcp_connections_sync_ev(nc_get_tcp_c(m->net_crypto), m->ev, m->ev_data);
+    gc_sync_ev(m->group_handler, m->ev, m->ev_data);
 }
 
 /** @brief Attempts to create a DHT announcement for a group chat with our connection info. An
@@ -3503,6 +3663,11 @@ Messenger *new_messenger(Mono_Time *mono_time, const Memory *mem, const Random *
         if (m->forwarding != nullptr) {
             m->announce = new_announcements(m->log, m->mem, m->rng, m->mono_time, m->forwarding, m->dht, m->net);
         }
+
+        if (m->announce != nullptr && !announce_set_capacity(m->announce, options->dht_announcements_capacity)) {
+            LOGGER_WARNING(m->log, "invalid DHT announcements capacity %u, storing up to %u announcements",
+                           options->dht_announcements_capacity, ANNOUNCE_DEFAULT_CAPACITY);
+        }
     }
 
     Onion *onion = new_onion(m->log, m->mem, m->mono_time, m->rng, m->dht, m->net);
@@ -3620,6 +3785,8 @@ void kill_messenger(Messenger *m)
         return;
     }
 
+    messenger_unregister_ev(m);
+
     if (m->tcp_server != nullptr) {
         kill_tcp_server(m->tcp_server);
     }
@@ -19,6 +19,7 @@
 #include "announce.h"
 #include "attributes.h"
 #include "crypto_core.h"
+#include "ev.h"
 #include "forwarding.h"
 #include "friend_connection.h"
 #include "friend_requests.h"
@@ -85,6 +86,7 @@ typedef struct Messenger_Options {
     bool hole_punching_enabled;
     bool local_discovery_enabled;
     bool dht_announcements_enabled;
+    uint32_t dht_announcements_capacity;
     bool groups_persistence_enabled;
 
     Messenger_State_Plugin *_Nullable state_plugins;
@@ -284,6 +286,10 @@ struct Messenger {
 
     bool has_added_relays; // If the first connection has occurred in do_messenger
 
+    /* Event loop the sockets are registered with, see `messenger_register_ev`. */
+    Ev *_Nullable ev;
+    void *_Nullable ev_data;
+
     uint16_t num_loaded_relays;
     Node_format loaded_relays[NUM_SAVED_TCP_RELAYS]; // Relays loaded from config
 
@@ -743,10 +749,57 @@ void do_messenger(Messenger *_Nonnull m, void *_Nullable userdata);
  * @brief Return the time in milliseconds before `do_messenger()` should be called again
  *   for optimal performance.
  *
+ * This is at most 50ms so that callers that only sleep between calls still
+ * read the sockets often enough. Callers that wait on the sockets from
+ * `messenger_copy_interests` should use `messenger_timer_interval` instead.
+ *
  * @return time (in ms) before the next `do_messenger()` needs to be run on success.
  */
 uint32_t messenger_run_interval(const Messenger *_Nonnull m);
 
+/**
+ * @brief Return the time in milliseconds before `do_messenger()` has timer work to do.
+ *
+ * All other work starts with data on one of the sockets from
+ * `messenger_copy_interests`: pending resends, pings, announces, group and
+ * relay timers and file chunk requests are all accounted for here.
+ */
+uint32_t messenger_timer_interval(const Messenger *_Nonnull m);
+
+/**
+ * @brief Copy the sockets `do_messenger()` reads and writes, and the events it
+ *   waits for on them, into @p interests.
+ *
+ * Relay connections come and go, so the set should be copied again after each
+ * `do_messenger()`.
+ *
+ * @return the number of sockets, which may be more than @p max_interests.
+ */
+uint32_t messenger_copy_interests(const Messenger *_Nonnull m, Ev_Interest *_Nullable interests, uint32_t max_interests);
+
+/**
+ * @brief Register the sockets `do_messenger()` reads and writes with @p ev.
+ *
+ * These are the UDP socket, the TCP server's sockets and the sockets of all
+ * relay connections, including those of groups. They are added with @p data
+ * as their user data. Relay sockets are added when their connections open and
+ * removed before they close; `messenger_sync_ev` updates the events they wait
+ * for. The caller then only needs to run `do_messenger()` when one of the
+ * sockets is ready or `messenger_timer_interval` has passed.
+ *
+ * @retval false if an Ev is already registered or a socket could not be added.
+ */
+bool messenger_register_ev(Messenger *_Nonnull m, Ev *_Nonnull ev, void *_Nullable data);
+
+/** @brief Remove the sockets from the Ev they were registered with, if any. */
+void messenger_unregister_ev(Messenger *_Nonnull m);
+
+/**
+ * @brief Bring the Ev registrations in line with the sockets and the events
+ *   `do_messenger()` now waits for. Run this after each `do_messenger()`.
+ */
+void messenger_sync_ev(Messenger *_Nonnull m);
+
 /* SAVING AND LOADING FUNCTIONS: */
 
 /** @brief Registers a state plugin for saving, loading, and getting the size of a section of the save.
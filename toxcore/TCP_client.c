@@ -39,7 +39,6 @@ struct TCP_Client_Connection {
     IP_Port ip_port; /* The ip and port of the server */
     TCP_Proxy_Info proxy_info;
     uint8_t recv_nonce[CRYPTO_NONCE_SIZE]; /* Nonce of received packets. */
-    uint16_t next_packet_length;
 
     uint8_t temp_secret_key[CRYPTO_SECRET_KEY_SIZE];
 
@@ -146,10 +145,10 @@ static int proxy_http_generate_connection_request(TCP_Client_Connection *_Nonnul
     }
 
     const uint16_t port = net_ntohs(tcp_conn->ip_port.port);
-    const int written = snprintf((char *)tcp_conn->con.last_packet, MAX_PACKET_SIZE, "%s%s:%hu%s%s:%hu%s", one, ip, port,
+    const int written = snprintf((char *)tcp_conn->con.last_packet, sizeof(tcp_conn->con.last_packet), "%s%s:%hu%s%s:%hu%s", one, ip, port,
                                  two, ip, port, three);
 
-    if (written < 0 || MAX_PACKET_SIZE < written) {
+    if (written < 0 || (int)sizeof(tcp_conn->con.last_packet) <= written) {
         return 0;
     }
 
@@ -306,6 +305,9 @@ static int proxy_socks5_read_connection_response(const Logger *_Nonnull logger,
     return -1;
 }
 
+static_assert(TCP_CLIENT_HANDSHAKE_SIZE <= TCP_HANDSHAKE_BUFFER_SIZE,
+              "the client handshake must fit into the handshake buffer");
+
 /**
  * @retval 0 on success.
  * @retval -1 on failure.
@@ -896,8 +898,7 @@ static int handle_tcp_client_packet(const Logger *_Nonnull logger, TCP_Client_Co
 static bool tcp_process_packet(const Logger *_Nonnull logger, TCP_Client_Connection *_Nonnull conn, void *_Nullable userdata)
 {
     uint8_t packet[MAX_PACKET_SIZE];
-    const int len = read_packet_tcp_secure_connection(logger, conn->con.mem, conn->con.ns, conn->con.sock, &conn->next_packet_length, conn->con.shared_key, conn->recv_nonce, packet, sizeof(packet),
-                    &conn->ip_port);
+    const int len = read_packet_tcp_secure_connection(logger, &conn->con, conn->recv_nonce, packet, sizeof(packet), &conn->ip_port);
 
     if (len == 0) {
         return false;
@@ -1035,6 +1036,40 @@ void do_tcp_connection(const Logger *logger, const Mono_Time *mono_time,
     }
 }
 
+uint64_t tcp_con_deadline(const TCP_Client_Connection *con)
+{
+    if (con->status == TCP_CLIENT_DISCONNECTED) {
+        return 0;
+    }
+
+    uint64_t deadline = UINT64_MAX;
+
+    if (con->kill_at != UINT64_MAX) {
+        deadline = con->kill_at * 1000;
+    }
+
+    if (con->status == TCP_CLIENT_CONFIRMED) {
+        deadline = min_u64(deadline, (con->last_pinged + TCP_PING_FREQUENCY) * 1000);
+
+        if (con->ping_id != 0) {
+            deadline = min_u64(deadline, (con->last_pinged + TCP_PING_TIMEOUT) * 1000);
+        }
+    }
+
+    return deadline;
+}
+
+Socket tcp_con_sock(const TCP_Client_Connection *con)
+{
+    return con->con.sock;
+}
+
+bool tcp_con_wants_write(const TCP_Client_Connection *con)
+{
+    return con->con.last_packet_length != 0 || con->con.out_length != 0 || con->con.priority_queue_start != nullptr
+           || con->ping_request_id != 0 || con->ping_response_id != 0;
+}
+
 /** Kill the TCP connection */
 void kill_tcp_connection(TCP_Client_Connection *tcp_connection)
 {
@@ -1044,7 +1079,7 @@ void kill_tcp_connection(TCP_Client_Connection *tcp_connection)
 
     const Memory *mem = tcp_connection->con.mem;
 
-    wipe_priority_list(tcp_connection->con.mem, tcp_connection->con.priority_queue_start);
+    wipe_connection_buffers(&tcp_connection->con);
     kill_sock(tcp_connection->con.ns, tcp_connection->con.sock);
     crypto_memzero(tcp_connection, sizeof(TCP_Client_Connection));
     mem_delete(mem, tcp_connection);
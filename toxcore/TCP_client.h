@@ -69,6 +69,23 @@ TCP_Client_Connection *_Nullable new_tcp_connection(
 /** Run the TCP connection */
 void do_tcp_connection(const Logger *_Nonnull logger, const Mono_Time *_Nonnull mono_time,
                        TCP_Client_Connection *_Nonnull tcp_connection, void *_Nullable userdata);
+
+/**
+ * @brief The time in milliseconds at which `do_tcp_connection` has timer work
+ *   to do: sending a ping, or giving up on a handshake or an unanswered ping.
+ *
+ * Everything else it does waits for the socket.
+ *
+ * @retval 0 if the connection is disconnected and waits to be cleaned up.
+ * @retval UINT64_MAX if there is no timer work.
+ */
+uint64_t tcp_con_deadline(const TCP_Client_Connection *_Nonnull con);
+
+/** @brief The socket of the connection. */
+Socket tcp_con_sock(const TCP_Client_Connection *_Nonnull con);
+
+/** @brief Whether the connection has data queued until its socket becomes writable. */
+bool tcp_con_wants_write(const TCP_Client_Connection *_Nonnull con);
 /** Kill the TCP connection */
 void kill_tcp_connection(TCP_Client_Connection *_Nullable tcp_connection);
 typedef int tcp_onion_response_cb(void *_Nonnull object, const uint8_t *_Nonnull data, uint16_t length, void *_Nullable userdata);
@@ -5,6 +5,7 @@
 
 #include "TCP_common.h"
 
+#include <assert.h>
 #include <string.h>
 
 #include "attributes.h"
@@ -12,7 +13,9 @@
 #include "crypto_core.h"
 #include "logger.h"
 #include "mem.h"
+#include "net.h"
 #include "network.h"
+#include "util.h"
 
 void wipe_priority_list(const Memory *mem, TCP_Priority_List *p)
 {
@@ -24,32 +27,181 @@ void wipe_priority_list(const Memory *mem, TCP_Priority_List *p)
     }
 }
 
-/**
- * @retval 0 if pending data was sent completely
- * @retval -1 if it wasn't
+void wipe_connection_buffers(TCP_Connection *con)
+{
+    wipe_priority_list(con->mem, con->priority_queue_start);
+    con->priority_queue_start = nullptr;
+    con->priority_queue_end = nullptr;
+    con->priority_queue_length = 0;
+    con->priority_queue_bytes = 0;
+
+    mem_delete(con->mem, con->out_buffer);
+    con->out_buffer = nullptr;
+    con->out_start = 0;
+    con->out_length = 0;
+
+    mem_delete(con->mem, con->in_buffer);
+    con->in_buffer = nullptr;
+    con->in_start = 0;
+    con->in_length = 0;
+    con->in_drained = false;
+}
+
+void release_idle_buffers(TCP_Connection *con)
+{
+    if (con->out_length == 0) {
+        mem_delete(con->mem, con->out_buffer);
+        con->out_buffer = nullptr;
+        con->out_start = 0;
+    }
+
+    if (con->in_length == 0) {
+        mem_delete(con->mem, con->in_buffer);
+        con->in_buffer = nullptr;
+        con->in_start = 0;
+    }
+}
+
+bool tcp_flush_list_reserve(const Memory *mem, TCP_Flush_List *list, uint32_t size)
+{
+    if (size <= list->size) {
+        return true;
+    }
+
+    uint32_t *ids = (uint32_t *)mem_vrealloc(mem, list->ids, size, sizeof(uint32_t));
+
+    if (ids == nullptr) {
+        return false;
+    }
+
+    list->ids = ids;
+    list->size = size;
+    return true;
+}
+
+void tcp_flush_list_free(const Memory *mem, TCP_Flush_List *list)
+{
+    mem_delete(mem, list->ids);
+    list->ids = nullptr;
+    list->size = 0;
+    list->length = 0;
+}
+
+/** Number of bytes that can be written at the end of the ring without wrapping. */
+static uint16_t out_buffer_contiguous_free(const TCP_Connection *_Nonnull con)
+{
+    const uint32_t end = con->out_start + con->out_length;
+
+    if (end < TCP_OUT_BUFFER_SIZE) {
+        return TCP_OUT_BUFFER_SIZE - end;
+    }
+
+    return con->out_start - (end - TCP_OUT_BUFFER_SIZE);
+}
+
+static uint8_t *_Nonnull out_buffer_tail(const TCP_Connection *_Nonnull con)
+{
+    assert(con->out_buffer != nullptr);
+    return con->out_buffer + (con->out_start + con->out_length) % TCP_OUT_BUFFER_SIZE;
+}
+
+/** Copy data to the end of the ring, wrapping around if needed. The caller checks the space. */
+static void out_buffer_write(TCP_Connection *_Nonnull con, const uint8_t *_Nonnull data, uint16_t size)
+{
+    const uint16_t first = min_u16(size, out_buffer_contiguous_free(con));
+
+    memcpy(out_buffer_tail(con), data, first);
+    con->out_length += first;
+
+    if (first < size) {
+        memcpy(out_buffer_tail(con), data + first, size - first);
+        con->out_length += size - first;
+    }
+}
+
+static void out_buffer_consume(TCP_Connection *_Nonnull con, uint16_t size)
+{
+    con->out_length -= size;
+    con->out_start = con->out_length == 0 ? 0 : (con->out_start + size) % TCP_OUT_BUFFER_SIZE;
+}
+
+/** @brief Collect everything that is waiting to be sent, in the order it must be sent in.
+ *
+ * @return the number of buffers filled in.
  */
-int send_pending_data_nonpriority(const Logger *logger, TCP_Connection *con)
+static size_t pending_data_iov(const TCP_Connection *_Nonnull con, Net_Iovec *_Nonnull iov)
 {
-    if (con->last_packet_length == 0) {
-        return 0;
+    size_t count = 0;
+
+    if (con->last_packet_length != 0) {
+        iov[count].buf = con->last_packet + con->last_packet_sent;
+        iov[count].length = con->last_packet_length - con->last_packet_sent;
+        ++count;
     }
 
-    const uint16_t left = con->last_packet_length - con->last_packet_sent;
-    const int len = net_send(con->ns, logger, con->sock, con->last_packet + con->last_packet_sent, left, &con->ip_port,
-                             con->net_profile);
+    if (con->out_length != 0) {
+        const uint16_t first = min_u16(con->out_length, TCP_OUT_BUFFER_SIZE - con->out_start);
+        iov[count].buf = con->out_buffer + con->out_start;
+        iov[count].length = first;
+        ++count;
 
-    if (len <= 0) {
-        return -1;
+        if (first < con->out_length) {
+            iov[count].buf = con->out_buffer;
+            iov[count].length = con->out_length - first;
+            ++count;
+        }
+    }
+
+    for (const TCP_Priority_List *p = con->priority_queue_start; p != nullptr && count < NET_MAX_SEND_VECS; p = p->next) {
+        iov[count].buf = p->data + p->sent;
+        iov[count].length = p->size - p->sent;
+        ++count;
     }
 
-    if (len == left) {
+    return count;
+}
+
+/** Drop @p size bytes that were sent from the front of the pending data. */
+static void pending_data_consume(TCP_Connection *_Nonnull con, size_t size)
+{
+    if (con->last_packet_length != 0) {
+        const uint16_t left = con->last_packet_length - con->last_packet_sent;
+
+        if (size < left) {
+            con->last_packet_sent += size;
+            return;
+        }
+
         con->last_packet_length = 0;
         con->last_packet_sent = 0;
-        return 0;
+        size -= left;
+    }
+
+    const uint16_t ring = (uint16_t)min_u64(size, con->out_length);
+    out_buffer_consume(con, ring);
+    size -= ring;
+
+    while (size != 0 && con->priority_queue_start != nullptr) {
+        TCP_Priority_List *p = con->priority_queue_start;
+        const uint16_t left = p->size - p->sent;
+
+        if (size < left) {
+            p->sent += size;
+            con->priority_queue_bytes -= size;
+            return;
+        }
+
+        size -= left;
+        --con->priority_queue_length;
+        con->priority_queue_bytes -= left;
+        con->priority_queue_start = p->next;
+        mem_delete(con->mem, p->data);
+        mem_delete(con->mem, p);
     }
 
-    con->last_packet_sent += len;
-    return -1;
+    if (con->priority_queue_start == nullptr) {
+        con->priority_queue_end = nullptr;
+    }
 }
 
 /**
@@ -58,39 +210,33 @@ int send_pending_data_nonpriority(const Logger *logger, TCP_Connection *con)
  */
 int send_pending_data(const Logger *logger, TCP_Connection *con)
 {
-    /* finish sending current non-priority packet */
-    if (send_pending_data_nonpriority(logger, con) == -1) {
-        return -1;
-    }
+    Net_Iovec iov[NET_MAX_SEND_VECS];
+    size_t count = pending_data_iov(con, iov);
 
-    TCP_Priority_List *p = con->priority_queue_start;
+    while (count != 0) {
+        size_t total = 0;
 
-    while (p != nullptr) {
-        const uint16_t left = p->size - p->sent;
-        const int len = net_send(con->ns, logger, con->sock, p->data + p->sent, left, &con->ip_port, con->net_profile);
+        for (size_t i = 0; i < count; ++i) {
+            total += iov[i].length;
+        }
 
-        if (len != left) {
-            if (len > 0) {
-                p->sent += len;
-            }
+        const int len = net_sendv(con->ns, logger, con->sock, iov, count, &con->ip_port, con->net_profile);
 
-            break;
+        if (len <= 0) {
+            return -1;
         }
 
-        TCP_Priority_List *pp = p;
-        p = p->next;
-        mem_delete(con->mem, pp->data);
-        mem_delete(con->mem, pp);
-    }
+        pending_data_consume(con, (size_t)len);
 
-    con->priority_queue_start = p;
+        if ((size_t)len != total) {
+            return -1;
+        }
 
-    if (p == nullptr) {
-        con->priority_queue_end = nullptr;
-        return 0;
+        // Only more priority packets than fit into one call are left.
+        count = pending_data_iov(con, iov);
     }
 
-    return -1;
+    return 0;
 }
 
 /**
@@ -127,9 +273,63 @@ static bool add_priority(TCP_Connection *_Nonnull con, const uint8_t *_Nonnull p
     }
 
     con->priority_queue_end = new_list;
+    ++con->priority_queue_length;
+    con->priority_queue_bytes += size - sent;
     return true;
 }
 
+/** Whether a packet of @p size bytes can be appended to the ring without reordering it. */
+static bool out_buffer_has_room(TCP_Connection *_Nonnull con, uint16_t size)
+{
+    if (con->priority_queue_start != nullptr) {
+        return false;
+    }
+
+    if (con->out_buffer == nullptr) {
+        con->out_buffer = (uint8_t *)mem_balloc(con->mem, TCP_OUT_BUFFER_SIZE);
+
+        if (con->out_buffer == nullptr) {
+            return false;
+        }
+    }
+
+    return TCP_OUT_BUFFER_SIZE - con->out_length >= size;
+}
+
+/** Write the length prefix and the encrypted packet to @p packet. */
+static bool encrypt_packet(const TCP_Connection *_Nonnull con, const uint8_t *_Nonnull data, uint16_t length,
+                           uint8_t *_Nonnull packet)
+{
+    net_pack_u16(packet, length + CRYPTO_MAC_SIZE);
+    const int len = encrypt_data_symmetric(con->mem, con->shared_key, con->sent_nonce, data, length,
+                                           packet + sizeof(uint16_t));
+    return len == length + CRYPTO_MAC_SIZE;
+}
+
+static void schedule_flush(const Logger *_Nonnull logger, TCP_Connection *_Nonnull con)
+{
+    TCP_Flush_List *list = con->flush_list;
+
+    if (list == nullptr) {
+        send_pending_data(logger, con);
+        return;
+    }
+
+    if (con->flush_queued) {
+        return;
+    }
+
+    if (list->length == list->size) {
+        // Should not happen if the owner reserved one slot per connection.
+        send_pending_data(logger, con);
+        return;
+    }
+
+    list->ids[list->length] = con->flush_id;
+    ++list->length;
+    con->flush_queued = true;
+}
+
 /**
  * @retval 1 on success.
  * @retval 0 if could not send packet.
@@ -142,59 +342,36 @@ int write_packet_tcp_secure_connection(const Logger *logger, TCP_Connection *con
         return -1;
     }
 
-    bool sendpriority = true;
-
-    if (send_pending_data(logger, con) == -1) {
-        if (priority) {
-            sendpriority = false;
-        } else {
-            return 0;
-        }
-    }
-
     const uint16_t packet_size = sizeof(uint16_t) + length + CRYPTO_MAC_SIZE;
-    VLA(uint8_t, packet, packet_size);
 
-    uint16_t c_length = net_htons(length + CRYPTO_MAC_SIZE);
-    memcpy(packet, &c_length, sizeof(uint16_t));
-    int len = encrypt_data_symmetric(con->mem, con->shared_key, con->sent_nonce, data, length, packet + sizeof(uint16_t));
-
-    if ((unsigned int)len != (packet_size - sizeof(uint16_t))) {
-        return -1;
+    if (!out_buffer_has_room(con, packet_size)) {
+        // Give the socket a chance to take some of the queued data first.
+        send_pending_data(logger, con);
     }
 
-    if (priority) {
-        len = sendpriority ? net_send(con->ns, logger, con->sock, packet, packet_size, &con->ip_port,
-                                      con->net_profile) : 0;
-
-        if (len <= 0) {
-            len = 0;
+    if (out_buffer_has_room(con, packet_size) && out_buffer_contiguous_free(con) >= packet_size) {
+        // Common case: encrypt straight into the ring.
+        if (!encrypt_packet(con, data, length, out_buffer_tail(con))) {
+            return -1;
         }
 
-        increment_nonce(con->sent_nonce);
+        con->out_length += packet_size;
+    } else {
+        VLA(uint8_t, packet, packet_size);
 
-        if ((unsigned int)len == packet_size) {
-            return 1;
+        if (!encrypt_packet(con, data, length, packet)) {
+            return -1;
         }
 
-        return add_priority(con, packet, packet_size, len) ? 1 : 0;
-    }
-
-    len = net_send(con->ns, logger, con->sock, packet, packet_size, &con->ip_port, con->net_profile);
-
-    if (len <= 0) {
-        return 0;
+        if (out_buffer_has_room(con, packet_size)) {
+            out_buffer_write(con, packet, packet_size);
+        } else if (!priority || !add_priority(con, packet, packet_size, 0)) {
+            return 0;
+        }
     }
 
     increment_nonce(con->sent_nonce);
-
-    if ((unsigned int)len == packet_size) {
-        return 1;
-    }
-
-    memcpy(con->last_packet, packet, packet_size);
-    con->last_packet_length = packet_size;
-    con->last_packet_sent = len;
+    schedule_flush(logger, con);
     return 1;
 }
 
@@ -227,85 +404,153 @@ int read_tcp_packet(
     return len;
 }
 
-/** @brief Read the next two bytes in TCP stream then convert them to
- * length (host byte order).
+/** @brief Size of the packet (including its length) at the start of the input buffer.
  *
- * return length on success
- * return 0 if nothing has been read from socket.
- * return -1 on failure.
+ * @retval 0 if the buffer holds no complete packet.
+ * @retval -1 if the packet is too large (connection must be killed).
  */
-static uint16_t read_tcp_length(const Logger *_Nonnull logger, const Network *_Nonnull ns, Socket sock, const IP_Port *_Nonnull ip_port)
+static int in_buffer_next_packet(const Logger *_Nonnull logger, const TCP_Connection *_Nonnull con)
 {
-    const uint16_t count = net_socket_data_recv_buffer(ns, sock);
+    if (con->in_length < sizeof(uint16_t)) {
+        return 0;
+    }
 
-    if (count >= sizeof(uint16_t)) {
-        uint8_t length_buf[sizeof(uint16_t)];
-        const int len = net_recv(ns, logger, sock, length_buf, sizeof(length_buf), ip_port);
+    uint16_t length;
+    net_unpack_u16(con->in_buffer + con->in_start, &length);
 
-        if (len != sizeof(uint16_t)) {
-            LOGGER_ERROR(logger, "FAIL recv packet");
-            return 0;
-        }
+    if (length > MAX_PACKET_SIZE) {
+        LOGGER_ERROR(logger, "TCP packet too large: %d > %d", length, MAX_PACKET_SIZE);
+        return -1;
+    }
+
+    if (con->in_length < sizeof(uint16_t) + length) {
+        return 0;
+    }
 
-        uint16_t length;
-        net_unpack_u16(length_buf, &length);
+    return sizeof(uint16_t) + length;
+}
 
-        if (length > MAX_PACKET_SIZE) {
-            LOGGER_ERROR(logger, "TCP packet too large: %d > %d", length, MAX_PACKET_SIZE);
+/** @brief Append whatever the socket has to the input buffer, with one recv.
+ *
+ * @return number of bytes received.
+ * @retval 0 if nothing was received.
+ * @retval -1 on failure (connection must be killed).
+ */
+static int in_buffer_fill(const Logger *_Nonnull logger, TCP_Connection *_Nonnull con, const IP_Port *_Nonnull ip_port)
+{
+    if (con->in_drained) {
+        // The previous recv emptied the socket; try again on the next pass
+        // rather than making a call that is almost certain to return nothing.
+        con->in_drained = false;
+        return 0;
+    }
+
+    if (con->in_buffer == nullptr) {
+        con->in_buffer = (uint8_t *)mem_balloc(con->mem, TCP_IN_BUFFER_SIZE);
+
+        if (con->in_buffer == nullptr) {
+            LOGGER_ERROR(logger, "failed to allocate TCP input buffer");
             return -1;
         }
+    }
 
-        return length;
+    if (con->in_start != 0) {
+        // Move the partial packet to the front to make room after it.
+        memmove(con->in_buffer, con->in_buffer + con->in_start, con->in_length);
+        con->in_start = 0;
     }
 
-    return 0;
+    const uint16_t room = TCP_IN_BUFFER_SIZE - con->in_length;
+    const int len = net_recv(con->ns, logger, con->sock, con->in_buffer + con->in_length, room, ip_port);
+
+    if (len <= 0) {
+        return 0;
+    }
+
+    con->in_length += len;
+    con->in_drained = len < room;
+    return len;
 }
 
-/**
- * @return length of received packet on success.
- * @retval 0 if could not read any packet.
+/** @brief Take the next encrypted packet off the input buffer, refilling it if it holds none.
+ *
+ * @p encrypted is pointed at the packet, which stays in the buffer until the
+ * next call.
+ *
+ * @return length of the encrypted packet.
+ * @retval 0 if there is no complete packet.
  * @retval -1 on failure (connection must be killed).
  */
-int read_packet_tcp_secure_connection(
-    const Logger *logger, const Memory *mem, const Network *ns,
-    Socket sock, uint16_t *next_packet_length,
-    const uint8_t *shared_key, uint8_t *recv_nonce, uint8_t *data,
-    uint16_t max_len, const IP_Port *ip_port)
+static int in_buffer_take_packet(const Logger *_Nonnull logger, TCP_Connection *_Nonnull con, const IP_Port *_Nonnull ip_port,
+                                 uint8_t *_Nullable *_Nonnull encrypted)
 {
-    if (*next_packet_length == 0) {
-        const uint16_t len = read_tcp_length(logger, ns, sock, ip_port);
+    int packet_size = in_buffer_next_packet(logger, con);
 
-        if (len == (uint16_t) -1) {
-            return -1;
-        }
+    if (packet_size == 0) {
+        const int received = in_buffer_fill(logger, con, ip_port);
 
-        if (len == 0) {
-            return 0;
+        if (received <= 0) {
+            return received;
         }
 
-        *next_packet_length = len;
+        packet_size = in_buffer_next_packet(logger, con);
+    }
+
+    if (packet_size <= 0) {
+        return packet_size;
     }
 
-    if (max_len + CRYPTO_MAC_SIZE < *next_packet_length) {
+    *encrypted = con->in_buffer + con->in_start + sizeof(uint16_t);
+
+    con->in_start += packet_size;
+    con->in_length -= packet_size;
+
+    if (con->in_length == 0) {
+        con->in_start = 0;
+    }
+
+    return packet_size - sizeof(uint16_t);
+}
+
+int read_packet_tcp_secure_connection(
+    const Logger *logger, TCP_Connection *con, uint8_t *recv_nonce, uint8_t *data,
+    uint16_t max_len, const IP_Port *ip_port)
+{
+    uint8_t *data_encrypted = nullptr;
+    const int len_packet = in_buffer_take_packet(logger, con, ip_port, &data_encrypted);
+
+    if (len_packet <= 0) {
+        return len_packet;
+    }
+
+    if (max_len + CRYPTO_MAC_SIZE < len_packet) {
         LOGGER_DEBUG(logger, "packet too large");
         return -1;
     }
 
-    VLA(uint8_t, data_encrypted, (int) *next_packet_length);
-    const int len_packet = read_tcp_packet(logger, mem, ns, sock, data_encrypted, *next_packet_length, ip_port);
+    const int len = decrypt_data_symmetric(con->mem, con->shared_key, recv_nonce, data_encrypted, len_packet, data);
 
-    if (len_packet == -1) {
-        return 0;
+    if (len + CRYPTO_MAC_SIZE != len_packet) {
+        LOGGER_ERROR(logger, "decrypted length %d does not match expected length %d", len + CRYPTO_MAC_SIZE, len_packet);
+        return -1;
     }
 
-    if (len_packet != *next_packet_length) {
-        LOGGER_WARNING(logger, "invalid packet length: %d, expected %d", len_packet, *next_packet_length);
-        return 0;
-    }
+    increment_nonce(recv_nonce);
 
-    *next_packet_length = 0;
+    return len;
+}
+
+int read_packet_tcp_secure_connection_in_place(
+    const Logger *logger, TCP_Connection *con, uint8_t *recv_nonce, uint8_t **data, const IP_Port *ip_port)
+{
+    uint8_t *packet = nullptr;
+    const int len_packet = in_buffer_take_packet(logger, con, ip_port, &packet);
+
+    if (len_packet <= 0) {
+        return len_packet;
+    }
 
-    const int len = decrypt_data_symmetric(mem, shared_key, recv_nonce, data_encrypted, len_packet, data);
+    const int len = decrypt_data_symmetric(con->mem, con->shared_key, recv_nonce, packet, len_packet, packet);
 
     if (len + CRYPTO_MAC_SIZE != len_packet) {
         LOGGER_ERROR(logger, "decrypted length %d does not match expected length %d", len + CRYPTO_MAC_SIZE, len_packet);
@@ -314,6 +559,7 @@ int read_packet_tcp_secure_connection(
 
     increment_nonce(recv_nonce);
 
+    *data = packet;
     return len;
 }
 
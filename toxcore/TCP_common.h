@@ -63,6 +63,34 @@ bool tcp_packet_from_int(uint32_t value, Tcp_Packet *_Nonnull out_enum);
 
 #define MAX_PACKET_SIZE 2048
 
+/** Size of the buffer for unencrypted handshake data: the client handshake or a proxy request. */
+#define TCP_HANDSHAKE_BUFFER_SIZE 256
+
+/** Size of the per-connection output ring, enough for 4 packets of the maximum size. */
+#define TCP_OUT_BUFFER_SIZE (4 * (2 + MAX_PACKET_SIZE))
+
+/** Size of the per-connection input buffer, enough for 4 packets of the maximum size. */
+#define TCP_IN_BUFFER_SIZE (4 * (2 + MAX_PACKET_SIZE))
+
+/**
+ * @brief Connections that have packets queued but not yet sent.
+ *
+ * An owner of many connections (the TCP server) can give them a shared flush
+ * list. Writes to such a connection only queue the packet and add the
+ * connection's `flush_id` here once. The owner then calls `send_pending_data`
+ * for every listed connection after handling all its socket events, so the
+ * packets relayed to one connection in that pass go out in a single send.
+ */
+typedef struct TCP_Flush_List {
+    uint32_t *_Nullable ids;
+    uint32_t size;
+    uint32_t length;
+} TCP_Flush_List;
+
+/** @brief Make room for @p size ids in the flush list. */
+bool tcp_flush_list_reserve(const Memory *_Nonnull mem, TCP_Flush_List *_Nonnull list, uint32_t size);
+void tcp_flush_list_free(const Memory *_Nonnull mem, TCP_Flush_List *_Nonnull list);
+
 typedef struct TCP_Connection {
     const Memory *_Nonnull mem;
     const Random *_Nonnull rng;
@@ -71,31 +99,68 @@ typedef struct TCP_Connection {
     IP_Port ip_port;  // for debugging.
     uint8_t sent_nonce[CRYPTO_NONCE_SIZE]; /* Nonce of sent packets. */
     uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
-    uint8_t last_packet[2 + MAX_PACKET_SIZE];
+    /* Unencrypted handshake data, sent before anything else. */
+    uint8_t last_packet[TCP_HANDSHAKE_BUFFER_SIZE];
     uint16_t last_packet_length;
     uint16_t last_packet_sent;
 
+    /* Ring of encrypted packets waiting to be sent. Allocated on first use
+     * and released by `release_idle_buffers` while empty. */
+    uint8_t *_Nullable out_buffer;
+    uint16_t out_start;
+    uint16_t out_length;
+
+    /* Received bytes not yet parsed into packets. Allocated on first use
+     * and released by `release_idle_buffers` while empty. */
+    uint8_t *_Nullable in_buffer;
+    uint16_t in_start;
+    uint16_t in_length;
+    /* The last recv returned less than we asked for, so the socket is empty. */
+    bool in_drained;
+
+    /* Priority packets that did not fit into the ring, sent after it. */
     TCP_Priority_List *_Nullable priority_queue_start;
     TCP_Priority_List *_Nullable priority_queue_end;
+    /* Number of packets in the priority queue, and their bytes not sent yet. */
+    uint32_t priority_queue_length;
+    uint32_t priority_queue_bytes;
+
+    /* If set, writes are queued for the owner to flush (see TCP_Flush_List). */
+    TCP_Flush_List *_Nullable flush_list;
+    uint32_t flush_id;
+    bool flush_queued;
 
     // This is a shared pointer to the parent's respective Net_Profile object
     // (either TCP_Server for TCP server packets or TCP_Connections for TCP client packets).
     Net_Profile *_Nullable net_profile;
 } TCP_Connection;
 
-/**
- * @retval 0 if pending data was sent completely
- * @retval -1 if it wasn't
+/** @brief Free the queued output and buffered input of a connection that is being closed. */
+void wipe_connection_buffers(TCP_Connection *_Nonnull con);
+
+/** @brief Free the output ring and input buffer if they hold no data.
+ *
+ * Both are allocated again by the next write or read. Call this periodically
+ * rather than after every flush: freeing and re-allocating them on each burst
+ * makes the allocator return the memory to the OS and fault it back in.
  */
-int send_pending_data_nonpriority(const Logger *_Nonnull logger, TCP_Connection *_Nonnull con);
+void release_idle_buffers(TCP_Connection *_Nonnull con);
 
 /**
+ * @brief Send as much queued data as the socket takes, in one vectored send.
+ *
  * @retval 0 if pending data was sent completely
  * @retval -1 if it wasn't
  */
 int send_pending_data(const Logger *_Nonnull logger, TCP_Connection *_Nonnull con);
 
 /**
+ * @brief Encrypt a packet into the output ring of the connection.
+ *
+ * Unless the connection has a flush list, the queued data is sent right away.
+ * Priority packets that do not fit into the ring are kept in a separate list,
+ * other packets are refused until there is room again.
+ *
  * @retval 1 on success.
  * @retval 0 if could not send packet.
  * @retval -1 on failure (connection must be killed).
@@ -111,12 +176,34 @@ int read_tcp_packet(const Logger *_Nonnull logger, const Memory *_Nonnull mem, c
                     const IP_Port *_Nonnull ip_port);
 
 /**
+ * @brief Decrypt the next packet received on the connection.
+ *
+ * Packets are parsed out of the connection's input buffer. Only when it holds
+ * no complete packet, the buffer is refilled with a single recv of everything
+ * the socket has, so a burst of small packets costs one call.
+ *
+ * @return length of received packet on success.
+ * @retval 0 if could not read any packet.
+ * @retval -1 on failure (connection must be killed).
+ */
+int read_packet_tcp_secure_connection(const Logger *_Nonnull logger, TCP_Connection *_Nonnull con, uint8_t *_Nonnull recv_nonce, uint8_t *_Nonnull data, uint16_t max_len,
+                                      const IP_Port *_Nonnull ip_port);
+
+/**
+ * @brief Decrypt the next packet received on the connection where it is.
+ *
+ * Like `read_packet_tcp_secure_connection`, but the packet is decrypted in the
+ * input buffer rather than copied out of it. @p data is pointed at it, and the
+ * caller may change it, e.g. to forward it with
+ * `write_packet_tcp_secure_connection`. It is valid until the next read on
+ * the connection or `release_idle_buffers`.
+ *
  * @return length of received packet on success.
  * @retval 0 if could not read any packet.
  * @retval -1 on failure (connection must be killed).
  */
-int read_packet_tcp_secure_connection(const Logger *_Nonnull logger, const Memory *_Nonnull mem, const Network *_Nonnull ns, Socket sock, uint16_t *_Nonnull next_packet_length,
-                                      const uint8_t *_Nonnull shared_key, uint8_t *_Nonnull recv_nonce, uint8_t *_Nonnull data, uint16_t max_len, const IP_Port *_Nonnull ip_port);
+int read_packet_tcp_secure_connection_in_place(const Logger *_Nonnull logger, TCP_Connection *_Nonnull con, uint8_t *_Nonnull recv_nonce,
+        uint8_t *_Nullable *_Nonnull data, const IP_Port *_Nonnull ip_port);
 
 #ifdef __cplusplus
 } /* extern "C" */
@@ -2,7 +2,11 @@
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
 
 #include "logger.h"
 #include "os_memory.h"
@@ -10,91 +14,326 @@
 
 namespace {
 
-TEST(TCP_common, PriorityQueueOrderingAndIntegrity)
-{
-    constexpr Network_Funcs mock_funcs = {
-        nullptr,
-        nullptr,
-        nullptr,
-        nullptr,
-        nullptr,
-        nullptr,
-        nullptr,
-        nullptr,
-        // Mock net_send to simulate a full buffer (returns 0)
-        // This forces packets into the priority queue.
-        [](void *obj, Socket sock, const uint8_t *buf, std::size_t len) {
-            (void)obj;
-            (void)sock;
-            (void)buf;
-            (void)len;
+/** Socket whose send buffer is full until `writable` is set. */
+struct MockSocket {
+    bool writable = false;
+    /** Maximum number of bytes taken by one send call. */
+    std::size_t max_send = SIZE_MAX;
+    std::size_t send_calls = 0;
+    std::vector<std::uint8_t> sent;
+
+    /** Bytes waiting to be received. */
+    std::vector<std::uint8_t> incoming;
+    /** Maximum number of bytes returned by one recv call. */
+    std::size_t max_recv = SIZE_MAX;
+    std::size_t recv_calls = 0;
+};
+
+constexpr Network_Funcs mock_funcs = {
+    nullptr,
+    nullptr,
+    nullptr,
+    nullptr,
+    nullptr,
+    nullptr,
+    [](void *obj, Socket sock, uint8_t *buf, std::size_t len) {
+        (void)sock;
+        auto *mock = static_cast<MockSocket *>(obj);
+        ++mock->recv_calls;
+        len = std::min({len, mock->max_recv, mock->incoming.size()});
+        if (len == 0) {
+            return -1;
+        }
+        std::copy_n(mock->incoming.begin(), len, buf);
+        mock->incoming.erase(mock->incoming.begin(), mock->incoming.begin() + len);
+        return static_cast<int>(len);
+    },
+    nullptr,
+    [](void *obj, Socket sock, const uint8_t *buf, std::size_t len) {
+        (void)sock;
+        auto *mock = static_cast<MockSocket *>(obj);
+        ++mock->send_calls;
+        if (!mock->writable) {
             return 0;
-        },
-        nullptr,
-        nullptr,
-        nullptr,
-        nullptr,
-        nullptr,
-        nullptr,
-        nullptr,
-    };
+        }
+        len = std::min(len, mock->max_send);
+        mock->sent.insert(mock->sent.end(), buf, buf + len);
+        return static_cast<int>(len);
+    },
+    nullptr,
+    nullptr,
+    nullptr,
+    nullptr,
+    nullptr,
+    nullptr,
+    nullptr,
+};
 
-    TCP_Connection con;
-    memset(&con, 0, sizeof(con));
-    con.mem = os_memory();
-    con.rng = os_random();
-    Network ns = {&mock_funcs, nullptr};
-    con.ns = &ns;
+class TCPCommonTest : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        memset(&con, 0, sizeof(con));
+        con.mem = os_memory();
+        con.rng = os_random();
+        con.ns = &ns;
+
+        logger = logger_new(con.mem);
+        ASSERT_NE(logger, nullptr);
 
-    Logger *logger = logger_new(con.mem);
-    ASSERT_NE(logger, nullptr);
+        // Minimal initialization to make write_packet_tcp_secure_connection happy
+        // It calls encrypt_data_symmetric which needs shared_key and sent_nonce
+        memset(con.shared_key, 0x42, sizeof(con.shared_key));
+        memset(con.sent_nonce, 0x12, sizeof(con.sent_nonce));
+        memcpy(recv_nonce, con.sent_nonce, sizeof(recv_nonce));
+    }
 
-    // Minimal initialization to make write_packet_tcp_secure_connection happy
-    // It calls encrypt_data_symmetric which needs shared_key and sent_nonce
-    memset(con.shared_key, 0x42, sizeof(con.shared_key));
-    memset(con.sent_nonce, 0x12, sizeof(con.sent_nonce));
+    void TearDown() override
+    {
+        wipe_connection_buffers(&con);
+        logger_kill(logger);
+    }
 
+    /** Length prefixes of the packets in the sent stream. */
+    std::vector<std::size_t> sent_packet_sizes() const
+    {
+        std::vector<std::size_t> sizes;
+        std::size_t pos = 0;
+        while (pos + 2 <= socket.sent.size()) {
+            const std::size_t size = (socket.sent[pos] << 8) | socket.sent[pos + 1];
+            sizes.push_back(size - CRYPTO_MAC_SIZE);
+            pos += 2 + size;
+        }
+        EXPECT_EQ(pos, socket.sent.size());
+        return sizes;
+    }
+
+    /** Write packets and loop the sent bytes back as received data. */
+    void loop_back(const std::vector<std::vector<uint8_t>> &packets)
+    {
+        socket.writable = true;
+        for (const auto &packet : packets) {
+            ASSERT_EQ(write_packet_tcp_secure_connection(logger, &con, packet.data(), packet.size(), false), 1);
+        }
+        socket.incoming = std::move(socket.sent);
+        socket.sent.clear();
+    }
+
+    MockSocket socket;
+    Network ns = {&mock_funcs, &socket};
+    uint8_t recv_nonce[CRYPTO_NONCE_SIZE];
+    TCP_Connection con;
+    Logger *logger = nullptr;
+};
+
+TEST_F(TCPCommonTest, PacketsAreQueuedInTheRingWhileSocketIsFull)
+{
     uint8_t data1[] = "packet1";
     uint8_t data2[] = "packet2";
     uint8_t data3[] = "packet3";
 
-    // First packet: will fail net_send (mocked to 0) and go to add_priority
-    // Queue: [packet1]
-    int ret1 = write_packet_tcp_secure_connection(logger, &con, data1, sizeof(data1), true);
-    ASSERT_EQ(ret1, 1);
-    ASSERT_NE(con.priority_queue_start, nullptr);
-    ASSERT_EQ(con.priority_queue_start, con.priority_queue_end);
-
-    // Second packet: will go to add_priority
-    // Queue: [packet1] -> [packet2]
-    int ret2 = write_packet_tcp_secure_connection(logger, &con, data2, sizeof(data2), true);
-    ASSERT_EQ(ret2, 1);
-    ASSERT_NE(con.priority_queue_start->next, nullptr);
-    ASSERT_EQ(con.priority_queue_start->next, con.priority_queue_end);
-
-    // Third packet: will go to add_priority
-    // WITH BUG: Queue becomes [packet1] -> [packet3], packet2 is LOST
-    // WITHOUT BUG: Queue: [packet1] -> [packet2] -> [packet3]
-    int ret3 = write_packet_tcp_secure_connection(logger, &con, data3, sizeof(data3), true);
-    ASSERT_EQ(ret3, 1);
-
-    // Verify integrity
-    TCP_Priority_List *p = con.priority_queue_start;
+    ASSERT_EQ(write_packet_tcp_secure_connection(logger, &con, data1, sizeof(data1), true), 1);
+    ASSERT_EQ(write_packet_tcp_secure_connection(logger, &con, data2, sizeof(data2), false), 1);
+    ASSERT_EQ(write_packet_tcp_secure_connection(logger, &con, data3, sizeof(data3), true), 1);
+
+    EXPECT_EQ(con.out_length, 3 * (2 + sizeof(data1) + CRYPTO_MAC_SIZE));
+    EXPECT_EQ(con.priority_queue_start, nullptr);
+
+    socket.writable = true;
+    const std::size_t calls = socket.send_calls;
+    EXPECT_EQ(send_pending_data(logger, &con), 0);
+    EXPECT_EQ(socket.send_calls, calls + 1);
+    EXPECT_EQ(con.out_length, 0);
+    EXPECT_EQ(sent_packet_sizes(), (std::vector<std::size_t>{sizeof(data1), sizeof(data2), sizeof(data3)}));
+}
+
+TEST_F(TCPCommonTest, PriorityPacketsOverflowInOrderWhenRingIsFull)
+{
+    std::vector<uint8_t> big(MAX_PACKET_SIZE - CRYPTO_MAC_SIZE, 0xAB);
+    std::vector<std::size_t> expected;
+
+    while (con.priority_queue_start == nullptr) {
+        ASSERT_EQ(write_packet_tcp_secure_connection(logger, &con, big.data(), big.size(), true), 1);
+        expected.push_back(big.size());
+    }
+
+    uint8_t data1[] = "packet1";
+    uint8_t data2[] = "packet22";
+    ASSERT_EQ(write_packet_tcp_secure_connection(logger, &con, data1, sizeof(data1), true), 1);
+    expected.push_back(sizeof(data1));
+
+    // Non-priority packets are refused rather than sent ahead of the overflow.
+    EXPECT_EQ(write_packet_tcp_secure_connection(logger, &con, data1, sizeof(data1), false), 0);
+
+    ASSERT_EQ(write_packet_tcp_secure_connection(logger, &con, data2, sizeof(data2), true), 1);
+    expected.push_back(sizeof(data2));
+
     int count = 0;
-    while (p) {
-        count++;
-        p = p->next;
+    for (const TCP_Priority_List *p = con.priority_queue_start; p != nullptr; p = p->next) {
+        ++count;
     }
+    EXPECT_EQ(count, 3) << "Priority queue lost packets! (likely due to incorrect tail pointer usage)";
+    EXPECT_EQ(con.priority_queue_length, 3);
+    EXPECT_EQ(con.priority_queue_bytes,
+              3 * (2 + CRYPTO_MAC_SIZE) + big.size() + sizeof(data1) + sizeof(data2));
+
+    socket.writable = true;
+    EXPECT_EQ(send_pending_data(logger, &con), 0);
+    EXPECT_EQ(con.priority_queue_start, nullptr);
+    EXPECT_EQ(con.priority_queue_length, 0);
+    EXPECT_EQ(con.priority_queue_bytes, 0);
+    EXPECT_EQ(sent_packet_sizes(), expected);
+}
 
-    // This is where it will fail if the change in
-    // https://github.com/TokTok/c-toxcore/pull/2387 is applied.
-    // The count will be 2 instead of 3.
-    EXPECT_EQ(count, 3)
-        << "Priority queue lost packets! (likely due to incorrect tail pointer usage)";
+TEST_F(TCPCommonTest, RingWrapsAroundWithPartialSends)
+{
+    socket.writable = true;
+    socket.max_send = 1000;
+
+    std::vector<std::size_t> expected;
+    std::vector<uint8_t> data(MAX_PACKET_SIZE - CRYPTO_MAC_SIZE, 0x55);
+
+    for (std::size_t i = 0; i < 200; ++i) {
+        const std::size_t length = 1 + (i * 397) % data.size();
+        const int ret = write_packet_tcp_secure_connection(logger, &con, data.data(), length, i % 3 == 0);
+        ASSERT_NE(ret, -1);
+
+        if (ret == 1) {
+            expected.push_back(length);
+        }
+    }
 
-    // Clean up
-    wipe_priority_list(con.mem, con.priority_queue_start);
-    logger_kill(logger);
+    socket.max_send = SIZE_MAX;
+    EXPECT_EQ(send_pending_data(logger, &con), 0);
+    EXPECT_EQ(sent_packet_sizes(), expected);
+    EXPECT_EQ(con.priority_queue_bytes, 0);
 }
 
+TEST_F(TCPCommonTest, FlushListDefersSending)
+{
+    TCP_Flush_List list = {nullptr, 0, 0};
+    ASSERT_TRUE(tcp_flush_list_reserve(con.mem, &list, 4));
+    con.flush_list = &list;
+    con.flush_id = 3;
+    socket.writable = true;
+
+    uint8_t data[] = "packet";
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_EQ(write_packet_tcp_secure_connection(logger, &con, data, sizeof(data), false), 1);
+    }
+
+    EXPECT_EQ(socket.send_calls, 0);
+    ASSERT_EQ(list.length, 1);
+    EXPECT_EQ(list.ids[0], 3);
+    EXPECT_TRUE(con.flush_queued);
+
+    EXPECT_EQ(send_pending_data(logger, &con), 0);
+    EXPECT_EQ(socket.send_calls, 1);
+    EXPECT_EQ(sent_packet_sizes().size(), 10);
+
+    tcp_flush_list_free(con.mem, &list);
+}
+
+TEST_F(TCPCommonTest, BurstOfPacketsIsReadWithOneRecv)
+{
+    std::vector<std::vector<uint8_t>> packets;
+    for (uint8_t i = 0; i < 20; ++i) {
+        packets.emplace_back(10 + i * 7, i);
+    }
+    loop_back(packets);
+
+    uint8_t data[MAX_PACKET_SIZE];
+    for (const auto &packet : packets) {
+        const int len = read_packet_tcp_secure_connection(logger, &con, recv_nonce, data, sizeof(data), &con.ip_port);
+        ASSERT_EQ(len, packet.size());
+        EXPECT_EQ(std::vector<uint8_t>(data, data + len), packet);
+    }
+
+    EXPECT_EQ(read_packet_tcp_secure_connection(logger, &con, recv_nonce, data, sizeof(data), &con.ip_port), 0);
+    EXPECT_EQ(socket.recv_calls, 1);
+}
+
+TEST_F(TCPCommonTest, PacketsSplitAcrossRecvsAreReassembled)
+{
+    std::vector<std::vector<uint8_t>> packets;
+    for (uint8_t i = 0; i < 8; ++i) {
+        packets.emplace_back(MAX_PACKET_SIZE - CRYPTO_MAC_SIZE - i * 200, i);
+    }
+    loop_back(packets);
+    socket.max_recv = 777;
+
+    uint8_t data[MAX_PACKET_SIZE];
+    std::vector<std::vector<uint8_t>> received;
+    for (int i = 0; i < 1000 && !socket.incoming.empty(); ++i) {
+        const int len = read_packet_tcp_secure_connection(logger, &con, recv_nonce, data, sizeof(data), &con.ip_port);
+        ASSERT_NE(len, -1);
+        if (len > 0) {
+            received.emplace_back(data, data + len);
+        }
+    }
+
+    int len;
+    while ((len = read_packet_tcp_secure_connection(logger, &con, recv_nonce, data, sizeof(data), &con.ip_port)) > 0) {
+        received.emplace_back(data, data + len);
+    }
+
+    EXPECT_EQ(received, packets);
 }
+
+TEST_F(TCPCommonTest, InPlaceReadDecryptsInTheInputBuffer)
+{
+    const std::vector<std::vector<uint8_t>> packets = {{1, 2, 3}, std::vector<uint8_t>(1000, 0x77), {4}};
+    loop_back(packets);
+
+    for (const auto &packet : packets) {
+        uint8_t *data = nullptr;
+        const int len = read_packet_tcp_secure_connection_in_place(logger, &con, recv_nonce, &data, &con.ip_port);
+        ASSERT_EQ(len, packet.size());
+        ASSERT_NE(con.in_buffer, nullptr);
+        EXPECT_GE(data, con.in_buffer);
+        EXPECT_LT(data, con.in_buffer + TCP_IN_BUFFER_SIZE);
+        EXPECT_EQ(std::vector<uint8_t>(data, data + len), packet);
+    }
+
+    uint8_t *data = nullptr;
+    EXPECT_EQ(read_packet_tcp_secure_connection_in_place(logger, &con, recv_nonce, &data, &con.ip_port), 0);
+}
+
+TEST_F(TCPCommonTest, OversizedLengthPrefixKillsConnection)
+{
+    socket.incoming = {0xff, 0xff, 0x00, 0x00};
+
+    uint8_t data[MAX_PACKET_SIZE];
+    EXPECT_EQ(read_packet_tcp_secure_connection(logger, &con, recv_nonce, data, sizeof(data), &con.ip_port), -1);
+}
+
+TEST_F(TCPCommonTest, IdleBuffersAreReleasedOnlyWhenEmpty)
+{
+    uint8_t packet[] = "packet";
+    ASSERT_EQ(write_packet_tcp_secure_connection(logger, &con, packet, sizeof(packet), false), 1);
+    ASSERT_NE(con.out_buffer, nullptr);
+
+    // Queued data is kept.
+    release_idle_buffers(&con);
+    EXPECT_NE(con.out_buffer, nullptr);
+
+    socket.writable = true;
+    EXPECT_EQ(send_pending_data(logger, &con), 0);
+    release_idle_buffers(&con);
+    EXPECT_EQ(con.out_buffer, nullptr);
+
+    // Both buffers are allocated again when they are needed. The first packet
+    // is looped back along with the new ones.
+    loop_back({{1, 2, 3}, {4, 5}});
+    uint8_t data[MAX_PACKET_SIZE];
+    EXPECT_EQ(read_packet_tcp_secure_connection(logger, &con, recv_nonce, data, sizeof(data), &con.ip_port), 7);
+    EXPECT_EQ(read_packet_tcp_secure_connection(logger, &con, recv_nonce, data, sizeof(data), &con.ip_port), 3);
+    release_idle_buffers(&con);
+    EXPECT_NE(con.in_buffer, nullptr);
+
+    EXPECT_EQ(read_packet_tcp_secure_connection(logger, &con, recv_nonce, data, sizeof(data), &con.ip_port), 2);
+    release_idle_buffers(&con);
+    EXPECT_EQ(con.in_buffer, nullptr);
+}
+
+}  // namespace
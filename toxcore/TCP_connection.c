@@ -16,6 +16,7 @@
 #include "attributes.h"
 #include "ccompat.h"
 #include "crypto_core.h"
+#include "ev.h"
 #include "forwarding.h"
 #include "logger.h"
 #include "mem.h"
@@ -60,6 +61,10 @@ struct TCP_Connections {
 
     /* Network profile for all TCP client packets. */
     Net_Profile *_Nullable net_profile;
+
+    /* Event loop the relay connection sockets are registered with, if any. */
+    Ev *_Nullable ev;
+    void *_Nullable ev_data;
 };
 
 static const TCP_Connection_to empty_tcp_connection_to = {0};
@@ -905,6 +910,47 @@ static int set_tcp_connection_status(TCP_Connection_to *_Nonnull con_to, unsigne
     return -1;
 }
 
+/** @brief Register the connection's socket with the Ev for the events it currently waits for. */
+static void tcp_con_sync_ev(TCP_Connections *_Nonnull tcp_c, TCP_con *_Nonnull tcp_con)
+{
+    if (tcp_c->ev == nullptr || tcp_con->status == TCP_CONN_SLEEPING || tcp_con->connection == nullptr) {
+        return;
+    }
+
+    const Ev_Events events = tcp_con_wants_write(tcp_con->connection) ? EV_READ | EV_WRITE : EV_READ;
+
+    if (events == tcp_con->ev_events) {
+        return;
+    }
+
+    const Socket sock = tcp_con_sock(tcp_con->connection);
+    const bool ok = tcp_con->ev_events == 0
+                    ? ev_add(tcp_c->ev, sock, events, tcp_c->ev_data)
+                    : ev_mod(tcp_c->ev, sock, events, tcp_c->ev_data);
+
+    if (!ok) {
+        // Retried on the next sync. Until then the connection is only served
+        // when the loop wakes up for something else.
+        LOGGER_WARNING(tcp_c->logger, "failed to register TCP relay socket %d with the event loop",
+                       net_socket_to_native(sock));
+        return;
+    }
+
+    tcp_con->ev_events = events;
+}
+
+/** @brief Remove the connection's socket from the Ev, then close the connection. */
+static void tcp_con_close(TCP_Connections *_Nonnull tcp_c, TCP_con *_Nonnull tcp_con)
+{
+    if (tcp_con->ev_events != 0) {
+        ev_del(tcp_c->ev, tcp_con_sock(tcp_con->connection));
+        tcp_con->ev_events = 0;
+    }
+
+    kill_tcp_connection(tcp_con->connection);
+    tcp_con->connection = nullptr;
+}
+
 /** @brief Kill a TCP relay connection.
  *
  * return 0 on success.
@@ -930,7 +976,7 @@ int kill_tcp_relay_connection(TCP_Connections *tcp_c, int tcp_connections_number
         --tcp_c->onion_num_conns;
     }
 
-    kill_tcp_connection(tcp_con->connection);
+    tcp_con_close(tcp_c, tcp_con);
 
     return wipe_tcp_connection(tcp_c, tcp_connections_number);
 }
@@ -954,7 +1000,7 @@ static int reconnect_tcp_relay_connection(TCP_Connections *_Nonnull tcp_c, int t
     const IP_Port ip_port = tcp_con_ip_port(tcp_con->connection);
     uint8_t relay_pk[CRYPTO_PUBLIC_KEY_SIZE];
     memcpy(relay_pk, tcp_con_public_key(tcp_con->connection), CRYPTO_PUBLIC_KEY_SIZE);
-    kill_tcp_connection(tcp_con->connection);
+    tcp_con_close(tcp_c, tcp_con);
     tcp_con->connection = new_tcp_connection(tcp_c->logger, tcp_c->mem, tcp_c->mono_time, tcp_c->rng, tcp_c->ns, &ip_port, relay_pk, tcp_c->self_public_key, tcp_c->self_secret_key, &tcp_c->proxy_info,
                           tcp_c->net_profile);
 
@@ -981,6 +1027,7 @@ static int reconnect_tcp_relay_connection(TCP_Connections *_Nonnull tcp_c, int t
     tcp_con->connected_time = 0;
     tcp_con->status = TCP_CONN_VALID;
     tcp_con->unsleep = false;
+    tcp_con_sync_ev(tcp_c, tcp_con);
 
     return 0;
 }
@@ -1008,8 +1055,7 @@ static int sleep_tcp_relay_connection(TCP_Connections *_Nonnull tcp_c, int tcp_c
     tcp_con->ip_port = tcp_con_ip_port(tcp_con->connection);
     memcpy(tcp_con->relay_pk, tcp_con_public_key(tcp_con->connection), CRYPTO_PUBLIC_KEY_SIZE);
 
-    kill_tcp_connection(tcp_con->connection);
-    tcp_con->connection = nullptr;
+    tcp_con_close(tcp_c, tcp_con);
 
     for (uint32_t i = 0; i < tcp_c->connections_length; ++i) {
         TCP_Connection_to *con_to = get_connection(tcp_c, i);
@@ -1059,6 +1105,7 @@ static int unsleep_tcp_relay_connection(TCP_Connections *_Nonnull tcp_c, int tcp
     tcp_con->connected_time = 0;
     tcp_con->status = TCP_CONN_VALID;
     tcp_con->unsleep = false;
+    tcp_con_sync_ev(tcp_c, tcp_con);
 
     return 0;
 }
@@ -1347,6 +1394,7 @@ static int add_tcp_relay_instance(TCP_Connections *_Nonnull tcp_c, const IP_Port
     }
 
     tcp_con->status = TCP_CONN_VALID;
+    tcp_con_sync_ev(tcp_c, tcp_con);
 
     return tcp_connections_number;
 }
@@ -1753,6 +1801,90 @@ void do_tcp_connections(const Logger *logger, TCP_Connections *tcp_c, void *user
     kill_nonused_tcp(tcp_c);
 }
 
+uint64_t tcp_connections_deadline(const TCP_Connections *tcp_c)
+{
+    const bool kill_unused = tcp_c->tcp_connections_length > RECOMMENDED_FRIEND_TCP_CONNECTIONS
+                             && tcp_connected_relays_count(tcp_c) > RECOMMENDED_FRIEND_TCP_CONNECTIONS;
+    uint64_t deadline = UINT64_MAX;
+
+    for (uint32_t i = 0; i < tcp_c->tcp_connections_length; ++i) {
+        const TCP_con *tcp_con = get_tcp_connection(tcp_c, i);
+
+        if (tcp_con == nullptr) {
+            continue;
+        }
+
+        if (tcp_con->status == TCP_CONN_SLEEPING) {
+            if (tcp_con->unsleep) {
+                return 0;
+            }
+
+            continue;
+        }
+
+        if (tcp_con->connection == nullptr) {
+            continue;
+        }
+
+        deadline = min_u64(deadline, tcp_con_deadline(tcp_con->connection));
+
+        /* Connections nobody uses are killed, connections only sleeping friends use are put to sleep. */
+        if (tcp_con->status == TCP_CONN_CONNECTED && !tcp_con->onion
+                && (tcp_con->lock_count == 0 ? kill_unused : tcp_con->lock_count == tcp_con->sleep_count)) {
+            deadline = min_u64(deadline, (tcp_con->connected_time + TCP_CONNECTION_ANNOUNCE_TIMEOUT) * 1000);
+        }
+    }
+
+    return deadline;
+}
+
+uint32_t tcp_connections_copy_interests(const TCP_Connections *tcp_c, Ev_Interest *interests, uint32_t max_interests)
+{
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i < tcp_c->tcp_connections_length; ++i) {
+        const TCP_con *tcp_con = get_tcp_connection(tcp_c, i);
+
+        if (tcp_con == nullptr || tcp_con->status == TCP_CONN_SLEEPING || tcp_con->connection == nullptr) {
+            continue;
+        }
+
+        if (interests != nullptr && count < max_interests) {
+            interests[count].sock = tcp_con_sock(tcp_con->connection);
+            interests[count].events = tcp_con_wants_write(tcp_con->connection) ? EV_READ | EV_WRITE : EV_READ;
+        }
+
+        ++count;
+    }
+
+    return count;
+}
+
+void tcp_connections_sync_ev(TCP_Connections *tcp_c, Ev *ev, void *data)
+{
+    if (tcp_c->ev != nullptr && (tcp_c->ev != ev || tcp_c->ev_data != data)) {
+        for (uint32_t i = 0; i < tcp_c->tcp_connections_length; ++i) {
+            TCP_con *tcp_con = &tcp_c->tcp_connections[i];
+
+            if (tcp_con->ev_events != 0) {
+                ev_del(tcp_c->ev, tcp_con_sock(tcp_con->connection));
+                tcp_con->ev_events = 0;
+            }
+        }
+    }
+
+    tcp_c->ev = ev;
+    tcp_c->ev_data = data;
+
+    for (uint32_t i = 0; i < tcp_c->tcp_connections_length; ++i) {
+        TCP_con *tcp_con = get_tcp_connection(tcp_c, i);
+
+        if (tcp_con != nullptr) {
+            tcp_con_sync_ev(tcp_c, tcp_con);
+        }
+    }
+}
+
 void kill_tcp_connections(TCP_Connections *tcp_c)
 {
     if (tcp_c == nullptr) {
@@ -1760,7 +1892,7 @@ void kill_tcp_connections(TCP_Connections *tcp_c)
     }
 
     for (uint32_t i = 0; i < tcp_c->tcp_connections_length; ++i) {
-        kill_tcp_connection(tcp_c->tcp_connections[i].connection);
+        tcp_con_close(tcp_c, &tcp_c->tcp_connections[i]);
     }
 
     crypto_memzero(tcp_c->self_secret_key, sizeof(tcp_c->self_secret_key));
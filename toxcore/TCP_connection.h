@@ -17,6 +17,7 @@
 #include "TCP_common.h"
 #include "attributes.h"
 #include "crypto_core.h"
+#include "ev.h"
 #include "forwarding.h"
 #include "logger.h"
 #include "mem.h"
@@ -79,6 +80,9 @@ typedef struct TCP_con {
     IP_Port ip_port;
     uint8_t relay_pk[CRYPTO_PUBLIC_KEY_SIZE];
     bool unsleep; /* set to 1 to unsleep connection. */
+
+    /* Events the connection's socket is registered for with the Ev, 0 if it isn't. */
+    Ev_Events ev_events;
 } TCP_con;
 
 typedef struct TCP_Connections TCP_Connections;
@@ -277,5 +281,34 @@ TCP_Connections *_Nullable new_tcp_connections(const Logger *_Nonnull logger, co
 int kill_tcp_relay_connection(TCP_Connections *_Nonnull tcp_c, int tcp_connections_number);
 
 void do_tcp_connections(const Logger *_Nonnull logger, TCP_Connections *_Nonnull tcp_c, void *_Nullable userdata);
+
+/**
+ * @brief The time in milliseconds at which `do_tcp_connections` has timer work
+ *   to do, apart from reading and writing the sockets.
+ *
+ * @retval UINT64_MAX if there is none.
+ */
+uint64_t tcp_connections_deadline(const TCP_Connections *_Nonnull tcp_c);
+
+/**
+ * @brief Copy the sockets of the relay connections and the events
+ *   `do_tcp_connections` waits for on them into @p interests.
+ *
+ * @return the number of sockets, which may be more than @p max_interests.
+ */
+uint32_t tcp_connections_copy_interests(const TCP_Connections *_Nonnull tcp_c, Ev_Interest *_Nullable interests, uint32_t max_interests);
+
+/**
+ * @brief Keep the relay connection sockets registered with @p ev.
+ *
+ * Sockets are added with @p data as their user data and the events from
+ * `tcp_connections_copy_interests`. From then on, connections register their
+ * sockets when they open and remove them before they close, but whether they
+ * wait for writes only changes when this is called again, so it should be
+ * called after each iteration. Passing a different Ev moves the sockets over;
+ * passing NULL removes them all.
+ */
+void tcp_connections_sync_ev(TCP_Connections *_Nonnull tcp_c, Ev *_Nullable ev, void *_Nullable data);
+
 void kill_tcp_connections(TCP_Connections *_Nullable tcp_c);
 #endif /* C_TOXCORE_TOXCORE_TCP_CONNECTION_H */
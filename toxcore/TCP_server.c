@@ -14,7 +14,11 @@
 #endif /* !WIN32 */
 
 #ifdef TCP_SERVER_USE_EPOLL
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
 #endif /* TCP_SERVER_USE_EPOLL */
 
@@ -22,6 +26,7 @@
 #include "attributes.h"
 #include "ccompat.h"
 #include "crypto_core.h"
+#include "ev.h"
 #include "forwarding.h"
 #include "list.h"
 #include "logger.h"
@@ -30,20 +35,42 @@
 #include "net_profile.h"
 #include "network.h"
 #include "onion.h"
+#include "timer_wheel.h"
+#include "util.h"
 
 #ifdef TCP_SERVER_USE_EPOLL
 #define TCP_SOCKET_LISTENING 0
 #define TCP_SOCKET_INCOMING 1
 #define TCP_SOCKET_UNCONFIRMED 2
 #define TCP_SOCKET_CONFIRMED 3
+/** The eventfd that wakes a shard for new messages in its inbox. */
+#define TCP_SOCKET_INBOX 4
+
+/** Bits of a relay connection id that hold the index on its shard; the rest is the shard. */
+#define TCP_SHARD_INDEX_BITS 24
+/** Messages a shard's inbox takes before packets for its clients are dropped. */
+#define TCP_SHARD_INBOX_MAX 8192
+#else
+/** Without epoll, connections are only looked at by polling this often (in ms). */
+#define TCP_SERVER_POLL_INTERVAL 50
 #endif /* TCP_SERVER_USE_EPOLL */
 
+/** Client addresses whose handshake rate is tracked. An address takes over the bucket of one that hashes to the same place. */
+#define TCP_HANDSHAKE_BUCKETS 1024
+/** Seconds a connection has to complete its handshake before its slot may go to a new one. */
+#define TCP_HANDSHAKE_TIMEOUT 10
+
 typedef struct TCP_Secure_Conn {
     uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
     uint32_t index;
     // TODO(iphydf): Add an enum for this (same as in TCP_client.c, probably).
     uint8_t status; /* 0 if not used, 1 if other is offline, 2 if other is online. */
     uint8_t other_id;
+    /* Shard the other end is on. If that's not ours, `index` is the other
+     * connection's index on that shard and `identifier` tells it from a later
+     * connection in the same slot. */
+    uint16_t shard;
+    uint64_t identifier;
 } TCP_Secure_Conn;
 
 typedef struct TCP_Secure_Connection {
@@ -51,18 +78,230 @@ typedef struct TCP_Secure_Connection {
 
     uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
     uint8_t recv_nonce[CRYPTO_NONCE_SIZE]; /* Nonce of received packets. */
-    uint16_t next_packet_length;
-    TCP_Secure_Conn connections[NUM_CLIENT_CONNECTIONS];
+    /* Routing slots, indexed by connection id. Most clients only route to a
+     * few peers, so this grows on demand up to NUM_CLIENT_CONNECTIONS. */
+    TCP_Secure_Conn *_Nullable connections;
+    uint8_t connections_size;
     uint8_t status;
 
     uint64_t identifier;
 
+    /* Until the connection is confirmed, the time it was accepted. */
     uint64_t last_pinged;
     uint64_t ping_id;
+
+    /* What the send gauges count for this connection while it is confirmed,
+     * see `update_send_gauges`. */
+    uint8_t send_backlog_bucket;
+    uint32_t priority_queued;
 } TCP_Secure_Connection;
 
 static const TCP_Secure_Connection empty_tcp_secure_connection = {{nullptr}};
 
+/** @brief A verified client handshake and our answer to it. */
+typedef struct TCP_Handshake_Result {
+    uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
+    uint8_t sent_nonce[CRYPTO_NONCE_SIZE];
+    uint8_t recv_nonce[CRYPTO_NONCE_SIZE];
+    uint8_t response[TCP_SERVER_HANDSHAKE_SIZE];
+} TCP_Handshake_Result;
+
+/** @brief Token bucket of one client address. */
+typedef struct TCP_Handshake_Bucket {
+    uint64_t key;
+    /* Time of the last refill, in milliseconds. */
+    uint64_t refilled;
+    /* Handshakes left, in thousandths. */
+    uint32_t tokens;
+} TCP_Handshake_Bucket;
+
+/** A bucket key no client address has. */
+#define TCP_HANDSHAKE_BUCKET_UNUSED UINT64_MAX
+
+#ifdef TCP_SERVER_USE_EPOLL
+/** A counter that only the server's own thread writes, but any thread may read. */
+typedef _Atomic uint64_t TCP_Counter;
+#else
+typedef uint64_t TCP_Counter;
+#endif /* TCP_SERVER_USE_EPOLL */
+
+typedef struct TCP_Handshake_Counters {
+    TCP_Counter accepted;
+    TCP_Counter rejected;
+    TCP_Counter failed;
+} TCP_Handshake_Counters;
+
+/** @brief What `tcp_server_get_stats` reports of one thread, besides the handshakes. */
+typedef struct TCP_Relay_Counters {
+    TCP_Counter routed_packets;
+    TCP_Counter routed_bytes;
+    TCP_Counter routed_dropped;
+    TCP_Counter kills[TCP_KILL_REASONS];
+
+    /* Gauges, taken once a second by `take_gauges`. */
+    TCP_Counter incoming;
+    TCP_Counter unconfirmed;
+    TCP_Counter accepted;
+    TCP_Counter loop_lag;
+
+    /* Gauges of the send queues, kept up to date by `update_send_gauges`. */
+    TCP_Counter priority_queued;
+    TCP_Counter send_backlog[TCP_SERVER_BACKLOG_BUCKETS];
+} TCP_Relay_Counters;
+
+static void tcp_counter_increment(TCP_Counter *_Nonnull counter)
+{
+#ifdef TCP_SERVER_USE_EPOLL
+    // There is only one writer, so this needs no atomic read-modify-write.
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + 1, memory_order_relaxed);
+#else
+    ++*counter;
+#endif /* TCP_SERVER_USE_EPOLL */
+}
+
+static void tcp_counter_add(TCP_Counter *_Nonnull counter, uint64_t value)
+{
+#ifdef TCP_SERVER_USE_EPOLL
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value, memory_order_relaxed);
+#else
+    *counter += value;
+#endif /* TCP_SERVER_USE_EPOLL */
+}
+
+static void tcp_counter_sub(TCP_Counter *_Nonnull counter, uint64_t value)
+{
+#ifdef TCP_SERVER_USE_EPOLL
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) - value, memory_order_relaxed);
+#else
+    *counter -= value;
+#endif /* TCP_SERVER_USE_EPOLL */
+}
+
+static void tcp_counter_set(TCP_Counter *_Nonnull counter, uint64_t value)
+{
+#ifdef TCP_SERVER_USE_EPOLL
+    atomic_store_explicit(counter, value, memory_order_relaxed);
+#else
+    *counter = value;
+#endif /* TCP_SERVER_USE_EPOLL */
+}
+
+static uint64_t tcp_counter_get(const TCP_Counter *_Nonnull counter)
+{
+#ifdef TCP_SERVER_USE_EPOLL
+    return atomic_load_explicit(counter, memory_order_relaxed);
+#else
+    return *counter;
+#endif /* TCP_SERVER_USE_EPOLL */
+}
+
+#ifdef TCP_SERVER_USE_EPOLL
+typedef enum TCP_Shard_Msg_Type {
+    /** A client connected to the sending shard: drop any older connection with its key. */
+    TCP_SHARD_MSG_CONNECTED,
+    /** A client asked for a route to a peer that isn't on its shard. */
+    TCP_SHARD_MSG_ROUTE,
+    /** The peer had asked for the route as well: the requester's slot is online. */
+    TCP_SHARD_MSG_LINKED,
+    /** The other end of an online slot went away. */
+    TCP_SHARD_MSG_UNLINK,
+    /** A packet to write to one connection. */
+    TCP_SHARD_MSG_SEND,
+    /** An OOB packet for the client with `peer_key`, if it's on this shard. */
+    TCP_SHARD_MSG_OOB,
+    /** An onion request for the thread that runs the onion module. */
+    TCP_SHARD_MSG_ONION_REQUEST,
+    /** A forward request for the thread that runs the forwarding module. */
+    TCP_SHARD_MSG_FORWARD_REQUEST,
+    /**
+     * A client handshake, which goes to a handshake worker and comes back
+     * verified: a `TCP_Handshake_Result`, or nothing if it was invalid.
+     */
+    TCP_SHARD_MSG_HANDSHAKE,
+} TCP_Shard_Msg_Type;
+
+typedef struct TCP_Shard_Node {
+    struct TCP_Shard_Node *_Atomic next;
+} TCP_Shard_Node;
+
+/** @brief A message between the threads of a sharded relay. */
+typedef struct TCP_Shard_Msg {
+    TCP_Shard_Node node;
+    TCP_Shard_Msg_Type type;
+
+    /* The connection and routing slot the message is for. */
+    uint32_t index;
+    uint64_t identifier;
+    uint8_t slot;
+
+    /* The connection and slot on the sending shard, for route messages. */
+    uint16_t from_shard;
+    uint32_t from_index;
+    uint64_t from_identifier;
+    uint8_t from_slot;
+
+    uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t peer_key[CRYPTO_PUBLIC_KEY_SIZE];
+    /* Onion source or forwarding destination. */
+    IP_Port ip_port;
+
+    uint16_t length;
+    uint8_t data[];
+} TCP_Shard_Msg;
+
+/**
+ * @brief Lock-free intrusive multi-producer single-consumer queue.
+ *
+ * Any thread may push; only the thread that owns the server pops. Pushing is
+ * one atomic exchange. The eventfd wakes the owner, and `wake_pending` keeps
+ * producers from writing to it more than once per drain.
+ */
+typedef struct TCP_Shard_Inbox {
+    TCP_Shard_Node *_Atomic head;
+    TCP_Shard_Node *_Nonnull tail;
+    TCP_Shard_Node stub;
+    atomic_uint length;
+    atomic_bool wake_pending;
+    int wake_fd;
+} TCP_Shard_Inbox;
+
+typedef struct TCP_Handshake_Job {
+    /* The shard that gets the result. */
+    TCP_Server *_Nonnull shard;
+    TCP_Shard_Msg *_Nonnull msg;
+} TCP_Handshake_Job;
+
+/**
+ * @brief Threads that verify client handshakes for all shards of a relay.
+ *
+ * Shards queue jobs under the lock. A worker takes the oldest, does the key
+ * agreement and posts the result to the inbox of the shard that queued it.
+ */
+typedef struct TCP_Handshake_Pool {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    bool stopping;
+
+    /* Ring of queued jobs. */
+    TCP_Handshake_Job *_Nonnull jobs;
+    uint32_t capacity;
+    uint32_t start;
+    uint32_t length;
+    /* Jobs a worker has taken but not posted yet. */
+    uint32_t busy;
+
+    pthread_t *_Nonnull threads;
+    uint16_t num_threads;
+
+    const Logger *_Nonnull logger;
+    const Memory *_Nonnull mem;
+    const Random *_Nonnull rng;
+    /* The relay's secret key, in the server that owns the pool. */
+    const uint8_t *_Nonnull secret_key;
+} TCP_Handshake_Pool;
+#endif /* TCP_SERVER_USE_EPOLL */
+
 struct TCP_Server {
     const Logger *_Nonnull logger;
     const Memory *_Nonnull mem;
@@ -73,11 +312,43 @@ struct TCP_Server {
 
 #ifdef TCP_SERVER_USE_EPOLL
     int efd;
+
+    /* Sharded relay, on the server returned to the caller: one server per
+     * thread, each with its own listening sockets and connections. The caller
+     * runs shard 0, which is this server, and owns the onion and forwarding
+     * modules. */
+    TCP_Server *_Nonnull *_Nullable shards;
+    pthread_t *_Nullable threads;
+    uint16_t num_shards;
+    /* Shards 1 to num_threads have their thread running. */
+    uint16_t num_threads;
+    atomic_bool running;
+    /* Connection identifiers are unique across shards, so newer connections can be told apart. */
+    _Atomic uint64_t next_identifier;
+
+    /* On any shard: the server returned to the caller, and our place in its `shards`. */
+    TCP_Server *_Nullable front;
+    uint16_t shard_id;
+    /* Time on the shard's own thread, null on shard 0. */
+    Mono_Time *_Nullable shard_mono_time;
+
+    TCP_Shard_Inbox inbox;
+
+    /* Next ping, ping timeout or idle buffer release of each confirmed connection, by index. */
+    Timer_Wheel *_Nonnull timers;
+
+    /* Handshake workers of the relay, owned by the first shard. */
+    TCP_Handshake_Pool *_Nullable handshake_pool;
+#else
+    /* Second in which the confirmed connections were last pinged and had their idle buffers released. */
     uint64_t last_run_pinged;
 #endif /* TCP_SERVER_USE_EPOLL */
     Socket *_Nullable socks_listening;
     unsigned int num_listening_socks;
 
+    /* Event loop the server is registered with, if any. */
+    Ev *_Nullable ev;
+
     uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
     uint8_t secret_key[CRYPTO_SECRET_KEY_SIZE];
     TCP_Secure_Connection incoming_connection_queue[MAX_INCOMING_CONNECTIONS];
@@ -85,10 +356,28 @@ struct TCP_Server {
     TCP_Secure_Connection unconfirmed_connection_queue[MAX_INCOMING_CONNECTIONS];
     uint16_t unconfirmed_connection_queue_index;
 
+    /* Handshakes per second and burst allowed per client address, if `handshake_buckets` is set. */
+    uint16_t handshake_rate;
+    uint16_t handshake_burst;
+    TCP_Handshake_Bucket *_Nullable handshake_buckets;
+    TCP_Handshake_Counters handshake_counters;
+    TCP_Relay_Counters relay_counters;
+    /* Second in which the gauges of `relay_counters` were last taken. */
+    uint64_t gauges_taken;
+    /* When the caller should run us next, in milliseconds, or 0 if not known. */
+    uint64_t run_due;
+    /* Most we ran late since the gauges were last taken, in milliseconds. */
+    uint64_t loop_lag_max;
+    /* Connections are waiting on the listening sockets until a handshake slot is free. */
+    bool accept_blocked;
+
     TCP_Secure_Connection *_Nullable accepted_connection_array;
     uint32_t size_accepted_connections;
     uint32_t num_accepted_connections;
 
+    /* Accepted connections with packets queued since the last flush. */
+    TCP_Flush_List flush_list;
+
     uint64_t counter;
 
     BS_List accepted_key_list;
@@ -97,8 +386,8 @@ struct TCP_Server {
     Net_Profile *_Nullable net_profile;
 };
 
-static_assert(sizeof(TCP_Server) < 7 * 1024 * 1024,
-              "TCP_Server struct should not grow more; it's already 6MB");
+static_assert(sizeof(TCP_Server) < 512 * 1024,
+              "TCP_Server struct should not grow more; it's already 280KB");
 
 const uint8_t *tcp_server_public_key(const TCP_Server *tcp_server)
 {
@@ -110,6 +399,277 @@ size_t tcp_server_listen_count(const TCP_Server *tcp_server)
     return tcp_server->num_listening_socks;
 }
 
+#ifdef TCP_SERVER_USE_EPOLL
+static bool tcp_shard_inbox_init(TCP_Shard_Inbox *_Nonnull inbox)
+{
+    inbox->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (inbox->wake_fd == -1) {
+        return false;
+    }
+
+    atomic_init(&inbox->stub.next, nullptr);
+    atomic_init(&inbox->head, &inbox->stub);
+    inbox->tail = &inbox->stub;
+    atomic_init(&inbox->length, 0);
+    atomic_init(&inbox->wake_pending, false);
+    return true;
+}
+
+static void tcp_shard_inbox_push(TCP_Shard_Inbox *_Nonnull inbox, TCP_Shard_Node *_Nonnull node)
+{
+    atomic_store_explicit(&node->next, nullptr, memory_order_relaxed);
+    TCP_Shard_Node *prev = atomic_exchange_explicit(&inbox->head, node, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, node, memory_order_release);
+}
+
+/** @brief Pop the oldest message, on the owning thread only.
+ *
+ * Returns null if the inbox is empty, or if the next message is still being
+ * pushed. In that case the producer wakes us again once it is done.
+ */
+static TCP_Shard_Msg *_Nullable tcp_shard_inbox_pop(TCP_Shard_Inbox *_Nonnull inbox)
+{
+    TCP_Shard_Node *tail = inbox->tail;
+    TCP_Shard_Node *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+    if (tail == &inbox->stub) {
+        if (next == nullptr) {
+            return nullptr;
+        }
+
+        inbox->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&next->next, memory_order_acquire);
+    }
+
+    if (next == nullptr) {
+        if (tail != atomic_load_explicit(&inbox->head, memory_order_acquire)) {
+            return nullptr;
+        }
+
+        // `tail` is the last message: put the stub behind it so it can be taken.
+        tcp_shard_inbox_push(inbox, &inbox->stub);
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+        if (next == nullptr) {
+            return nullptr;
+        }
+    }
+
+    inbox->tail = next;
+    atomic_fetch_sub_explicit(&inbox->length, 1, memory_order_relaxed);
+    return (TCP_Shard_Msg *)tail;
+}
+
+static void tcp_shard_inbox_free(const Memory *_Nonnull mem, TCP_Shard_Inbox *_Nonnull inbox)
+{
+    if (inbox->wake_fd == -1) {
+        return;
+    }
+
+    TCP_Shard_Msg *msg;
+
+    while ((msg = tcp_shard_inbox_pop(inbox)) != nullptr) {
+        if (msg->type == TCP_SHARD_MSG_HANDSHAKE) {
+            crypto_memzero(msg->data, msg->length);
+        }
+
+        mem_delete(mem, msg);
+    }
+
+    close(inbox->wake_fd);
+    inbox->wake_fd = -1;
+}
+
+static TCP_Shard_Msg *_Nullable tcp_shard_msg_new(const Memory *_Nonnull mem, TCP_Shard_Msg_Type type, uint16_t length)
+{
+    TCP_Shard_Msg *msg = (TCP_Shard_Msg *)mem_alloc(mem, sizeof(TCP_Shard_Msg) + length);
+
+    if (msg == nullptr) {
+        return nullptr;
+    }
+
+    msg->type = type;
+    msg->length = length;
+    return msg;
+}
+
+/** @brief Hand a message to the thread that owns @p target, taking ownership of it.
+ *
+ * Packets for clients are dropped if the target is too far behind, as they
+ * would be if the client's own send queue was full. Route changes are always
+ * delivered.
+ */
+static void tcp_shard_post(TCP_Server *_Nonnull target, TCP_Shard_Msg *_Nonnull msg)
+{
+    TCP_Shard_Inbox *const inbox = &target->inbox;
+    const unsigned int length = atomic_fetch_add_explicit(&inbox->length, 1, memory_order_relaxed);
+
+    if (length >= TCP_SHARD_INBOX_MAX && (msg->type == TCP_SHARD_MSG_SEND || msg->type == TCP_SHARD_MSG_OOB)) {
+        atomic_fetch_sub_explicit(&inbox->length, 1, memory_order_relaxed);
+        mem_delete(target->mem, msg);
+        return;
+    }
+
+    tcp_shard_inbox_push(inbox, &msg->node);
+
+    if (!atomic_exchange(&inbox->wake_pending, true)) {
+        const uint64_t one = 1;
+
+        if (write(inbox->wake_fd, &one, sizeof(one)) != sizeof(one)) {
+            // Only fails if the counter is about to overflow, so a wakeup is pending anyway.
+        }
+    }
+}
+
+/** @brief Post a copy of @p msg to every other shard, then free it. */
+static void tcp_shard_broadcast(TCP_Server *_Nonnull tcp_server, TCP_Shard_Msg *_Nonnull msg)
+{
+    const TCP_Server *front = tcp_server->front;
+    const size_t size = sizeof(TCP_Shard_Msg) + msg->length;
+
+    for (uint16_t i = 0; i < front->num_shards; ++i) {
+        if (i == tcp_server->shard_id) {
+            continue;
+        }
+
+        TCP_Shard_Msg *copy = (TCP_Shard_Msg *)mem_balloc(tcp_server->mem, size);
+
+        if (copy != nullptr) {
+            memcpy(copy, msg, size);
+            tcp_shard_post(front->shards[i], copy);
+        }
+    }
+
+    mem_delete(tcp_server->mem, msg);
+}
+#endif /* TCP_SERVER_USE_EPOLL */
+
+/** The shard this server is, or 0 if the relay isn't sharded. */
+static uint16_t own_shard_id(const TCP_Server *_Nonnull tcp_server)
+{
+#ifdef TCP_SERVER_USE_EPOLL
+    return tcp_server->shard_id;
+#else
+    return 0;
+#endif /* TCP_SERVER_USE_EPOLL */
+}
+
+/** Whether this server is one shard of a sharded relay. */
+static bool is_shard(const TCP_Server *_Nonnull tcp_server)
+{
+#ifdef TCP_SERVER_USE_EPOLL
+    return tcp_server->front != nullptr;
+#else
+    return false;
+#endif /* TCP_SERVER_USE_EPOLL */
+}
+
+/** Whether @p conn is online with a client on another shard. */
+static bool is_cross_shard(const TCP_Server *_Nonnull tcp_server, const TCP_Secure_Conn *_Nonnull conn)
+{
+    return is_shard(tcp_server) && conn->shard != own_shard_id(tcp_server);
+}
+
+/** @brief The id of a connection in onion and forwarding return addresses.
+ *
+ * The shard (0 if the relay isn't sharded) is in the upper bits.
+ */
+static uint32_t relay_con_id(uint16_t shard, uint32_t index)
+{
+#ifdef TCP_SERVER_USE_EPOLL
+    return ((uint32_t)shard << TCP_SHARD_INDEX_BITS) | index;
+#else
+    return index;
+#endif /* TCP_SERVER_USE_EPOLL */
+}
+
+/** An identifier for a new accepted connection, unique across the shards of a relay. */
+static uint64_t new_connection_identifier(TCP_Server *_Nonnull tcp_server)
+{
+#ifdef TCP_SERVER_USE_EPOLL
+
+    if (is_shard(tcp_server)) {
+        return atomic_fetch_add_explicit(&tcp_server->front->next_identifier, 1, memory_order_relaxed) + 1;
+    }
+
+#endif /* TCP_SERVER_USE_EPOLL */
+
+    return ++tcp_server->counter;
+}
+
+/** @brief Hand a packet for the connection with relay id @p con_id to its shard.
+ *
+ * The packet is @p packet_id followed by @p data.
+ *
+ * @retval true if the connection is on another shard: the packet was posted there or dropped.
+ * @retval false if it is ours to send.
+ */
+static bool tcp_shard_send_remote(TCP_Server *_Nonnull tcp_server, uint32_t con_id, uint64_t identifier,
+                                  uint8_t packet_id, const uint8_t *_Nonnull data, uint16_t length)
+{
+#ifdef TCP_SERVER_USE_EPOLL
+    const uint32_t shard = con_id >> TCP_SHARD_INDEX_BITS;
+
+    if (!is_shard(tcp_server) || shard == tcp_server->shard_id) {
+        return false;
+    }
+
+    if (shard >= tcp_server->front->num_shards) {
+        return true;
+    }
+
+    TCP_Shard_Msg *msg = tcp_shard_msg_new(tcp_server->mem, TCP_SHARD_MSG_SEND, 1 + length);
+
+    if (msg != nullptr) {
+        msg->index = con_id & ((1U << TCP_SHARD_INDEX_BITS) - 1);
+        msg->identifier = identifier;
+        msg->data[0] = packet_id;
+        memcpy(msg->data + 1, data, length);
+        tcp_shard_post(tcp_server->front->shards[shard], msg);
+    }
+
+    return true;
+#else
+    return false;
+#endif /* TCP_SERVER_USE_EPOLL */
+}
+
+/** @brief Hand an onion or forward request to shard 0, which runs those modules.
+ *
+ * The request is @p prefix followed by @p data.
+ *
+ * @retval true if this is another shard: the request was posted or dropped.
+ * @retval false if it is ours to send.
+ */
+static bool tcp_shard_post_request(TCP_Server *_Nonnull tcp_server, bool onion, const IP_Port *_Nonnull ip_port,
+                                   const uint8_t *_Nonnull prefix, uint16_t prefix_length,
+                                   const uint8_t *_Nonnull data, uint16_t length)
+{
+#ifdef TCP_SERVER_USE_EPOLL
+
+    if (!is_shard(tcp_server) || tcp_server->shard_id == 0) {
+        return false;
+    }
+
+    TCP_Shard_Msg *msg = tcp_shard_msg_new(tcp_server->mem,
+                                           onion ? TCP_SHARD_MSG_ONION_REQUEST : TCP_SHARD_MSG_FORWARD_REQUEST,
+                                           prefix_length + length);
+
+    if (msg != nullptr) {
+        msg->ip_port = *ip_port;
+        memcpy(msg->data, prefix, prefix_length);
+        memcpy(msg->data + prefix_length, data, length);
+        tcp_shard_post(tcp_server->front, msg);
+    }
+
+    return true;
+#else
+    return false;
+#endif /* TCP_SERVER_USE_EPOLL */
+}
+
 /** This is needed to compile on Android below API 21 */
 #ifdef TCP_SERVER_USE_EPOLL
 #ifndef EPOLLRDHUP
@@ -130,6 +690,20 @@ static int alloc_new_connections(TCP_Server *_Nonnull tcp_server, uint32_t num)
         return -1;
     }
 
+#ifdef TCP_SERVER_USE_EPOLL
+
+    // The index is stored in the upper 24 bits of the epoll data and of relay connection ids.
+    if (new_size > (1U << TCP_SHARD_INDEX_BITS)) {
+        return -1;
+    }
+
+#endif /* TCP_SERVER_USE_EPOLL */
+
+    // Every connection can be on the flush list once.
+    if (!tcp_flush_list_reserve(tcp_server->mem, &tcp_server->flush_list, new_size)) {
+        return -1;
+    }
+
     TCP_Secure_Connection *new_connections = (TCP_Secure_Connection *)mem_vrealloc(
                 tcp_server->mem, tcp_server->accepted_connection_array,
                 new_size, sizeof(TCP_Secure_Connection));
@@ -151,7 +725,8 @@ static int alloc_new_connections(TCP_Server *_Nonnull tcp_server, uint32_t num)
 static void wipe_secure_connection(TCP_Secure_Connection *_Nonnull con)
 {
     if (con->status != 0) {
-        wipe_priority_list(con->con.mem, con->con.priority_queue_start);
+        wipe_connection_buffers(&con->con);
+        mem_delete(con->con.mem, con->connections);
         crypto_memzero(con, sizeof(TCP_Secure_Connection));
     }
 }
@@ -164,6 +739,8 @@ static void move_secure_connection(TCP_Secure_Connection *_Nonnull con_new, TCP_
 
 static void free_accepted_connection_array(TCP_Server *_Nonnull tcp_server)
 {
+    tcp_flush_list_free(tcp_server->mem, &tcp_server->flush_list);
+
     if (tcp_server->accepted_connection_array == nullptr) {
         return;
     }
@@ -186,7 +763,66 @@ static int get_tcp_connection_index(const TCP_Server *_Nonnull tcp_server, const
     return bs_list_find(&tcp_server->accepted_key_list, public_key);
 }
 
-static int kill_accepted(TCP_Server *_Nonnull tcp_server, int index);
+static int kill_accepted(TCP_Server *_Nonnull tcp_server, int index, TCP_Kill_Reason reason);
+
+/** Which bucket of `TCP_Server_Stats::send_backlog` a connection with @p bytes to send is in. */
+static uint32_t send_backlog_bucket(uint32_t bytes)
+{
+    if (bytes == 0) {
+        return 0;
+    }
+
+    if (bytes <= 2 + MAX_PACKET_SIZE) {
+        return 1;
+    }
+
+    if (bytes <= TCP_OUT_BUFFER_SIZE / 2) {
+        return 2;
+    }
+
+    return bytes <= TCP_OUT_BUFFER_SIZE ? 3 : 4;
+}
+
+/** Count confirmed connection @p conn in the send gauges, as its queues are now. */
+static void count_send_gauges(TCP_Server *_Nonnull tcp_server, TCP_Secure_Connection *_Nonnull conn)
+{
+    TCP_Relay_Counters *const counters = &tcp_server->relay_counters;
+
+    conn->send_backlog_bucket = (uint8_t)send_backlog_bucket(conn->con.out_length + conn->con.priority_queue_bytes);
+    conn->priority_queued = conn->con.priority_queue_length;
+    tcp_counter_increment(&counters->send_backlog[conn->send_backlog_bucket]);
+    tcp_counter_add(&counters->priority_queued, conn->priority_queued);
+}
+
+/** Take @p conn out of the send gauges again. */
+static void uncount_send_gauges(TCP_Server *_Nonnull tcp_server, const TCP_Secure_Connection *_Nonnull conn)
+{
+    TCP_Relay_Counters *const counters = &tcp_server->relay_counters;
+
+    tcp_counter_sub(&counters->send_backlog[conn->send_backlog_bucket], 1);
+    tcp_counter_sub(&counters->priority_queued, conn->priority_queued);
+}
+
+/** @brief Move @p conn to the send gauges that match its queues, if it is confirmed.
+ *
+ * Called after sending the queued data of a connection. Queueing a packet also
+ * queues its connection for `do_tcp_flush`, so the gauges follow the queues
+ * within one run of the server, and `tcp_server_get_stats` never has to look
+ * at the connections.
+ */
+static void update_send_gauges(TCP_Server *_Nonnull tcp_server, TCP_Secure_Connection *_Nonnull conn)
+{
+    if (conn->status != TCP_STATUS_CONFIRMED) {
+        return;
+    }
+
+    const uint32_t bucket = send_backlog_bucket(conn->con.out_length + conn->con.priority_queue_bytes);
+
+    if (bucket != conn->send_backlog_bucket || conn->con.priority_queue_length != conn->priority_queued) {
+        uncount_send_gauges(tcp_server, conn);
+        count_send_gauges(tcp_server, conn);
+    }
+}
 
 /** @brief Add accepted TCP connection to the list.
  *
@@ -198,7 +834,7 @@ static int add_accepted(TCP_Server *_Nonnull tcp_server, const Mono_Time *_Nonnu
     int index = get_tcp_connection_index(tcp_server, con->public_key);
 
     if (index != -1) { /* If an old connection to the same public key exists, kill it. */
-        kill_accepted(tcp_server, index);
+        kill_accepted(tcp_server, index, TCP_KILL_REPLACED);
         index = -1;
     }
 
@@ -222,18 +858,46 @@ static int add_accepted(TCP_Server *_Nonnull tcp_server, const Mono_Time *_Nonnu
         return -1;
     }
 
-    if (!bs_list_add(&tcp_server->accepted_key_list, con->public_key, index)) {
+#ifdef TCP_SERVER_USE_EPOLL
+
+    // Its first look is within a second: the handshake leaves the buffers allocated.
+    if (!timer_wheel_set(tcp_server->timers, index, mono_time_get_ms(mono_time) + 1000)) {
         return -1;
     }
 
-    move_secure_connection(&tcp_server->accepted_connection_array[index], con);
+#endif /* TCP_SERVER_USE_EPOLL */
+
+    if (!bs_list_add(&tcp_server->accepted_key_list, con->public_key, index)) {
+        return -1;
+    }
+
+    move_secure_connection(&tcp_server->accepted_connection_array[index], con);
 
     tcp_server->accepted_connection_array[index].status = TCP_STATUS_CONFIRMED;
     ++tcp_server->num_accepted_connections;
-    tcp_server->accepted_connection_array[index].identifier = ++tcp_server->counter;
+    tcp_server->accepted_connection_array[index].identifier = new_connection_identifier(tcp_server);
     tcp_server->accepted_connection_array[index].last_pinged = mono_time_get(mono_time);
     tcp_server->accepted_connection_array[index].ping_id = 0;
     tcp_server->accepted_connection_array[index].con.net_profile = tcp_server->net_profile;
+    tcp_server->accepted_connection_array[index].con.flush_list = &tcp_server->flush_list;
+    tcp_server->accepted_connection_array[index].con.flush_id = index;
+    tcp_server->accepted_connection_array[index].con.flush_queued = false;
+    count_send_gauges(tcp_server, &tcp_server->accepted_connection_array[index]);
+
+#ifdef TCP_SERVER_USE_EPOLL
+
+    if (is_shard(tcp_server)) {
+        // An older connection with the same key may be on another shard.
+        TCP_Shard_Msg *msg = tcp_shard_msg_new(tcp_server->mem, TCP_SHARD_MSG_CONNECTED, 0);
+
+        if (msg != nullptr) {
+            msg->identifier = tcp_server->accepted_connection_array[index].identifier;
+            memcpy(msg->public_key, tcp_server->accepted_connection_array[index].public_key, CRYPTO_PUBLIC_KEY_SIZE);
+            tcp_shard_broadcast(tcp_server, msg);
+        }
+    }
+
+#endif /* TCP_SERVER_USE_EPOLL */
 
     return index;
 }
@@ -257,9 +921,14 @@ static int del_accepted(TCP_Server *_Nonnull tcp_server, int index)
         return -1;
     }
 
+    uncount_send_gauges(tcp_server, &tcp_server->accepted_connection_array[index]);
     wipe_secure_connection(&tcp_server->accepted_connection_array[index]);
     --tcp_server->num_accepted_connections;
 
+#ifdef TCP_SERVER_USE_EPOLL
+    timer_wheel_cancel(tcp_server->timers, index);
+#endif /* TCP_SERVER_USE_EPOLL */
+
     if (tcp_server->num_accepted_connections == 0) {
         free_accepted_connection_array(tcp_server);
     }
@@ -280,18 +949,18 @@ static void kill_tcp_secure_connection(TCP_Secure_Connection *_Nullable con)
 
 static int rm_connection_index(TCP_Server *_Nonnull tcp_server, TCP_Secure_Connection *_Nonnull con, uint8_t con_number);
 
-/** @brief Kill an accepted TCP_Secure_Connection
+/** @brief Kill an accepted TCP_Secure_Connection, counting it under @p reason.
  *
  * return -1 on failure.
  * return 0 on success.
  */
-static int kill_accepted(TCP_Server *tcp_server, int index)
+static int kill_accepted(TCP_Server *tcp_server, int index, TCP_Kill_Reason reason)
 {
     if ((uint32_t)index >= tcp_server->size_accepted_connections) {
         return -1;
     }
 
-    for (uint32_t i = 0; i < NUM_CLIENT_CONNECTIONS; ++i) {
+    for (uint32_t i = 0; i < tcp_server->accepted_connection_array[index].connections_size; ++i) {
         rm_connection_index(tcp_server, &tcp_server->accepted_connection_array[index], i);
     }
 
@@ -302,87 +971,101 @@ static int kill_accepted(TCP_Server *tcp_server, int index)
     }
 
     kill_sock(tcp_server->ns, sock);
+    tcp_counter_increment(&tcp_server->relay_counters.kills[reason]);
     return 0;
 }
 
-/**
- * @retval 1 if everything went well.
- * @retval -1 if the connection must be killed.
+/** @brief Verify a client handshake and prepare our answer to it.
+ *
+ * This only reads the server's secret key, so handshake workers can run it.
+ *
+ * @retval false if the handshake is invalid.
  */
-static int handle_tcp_handshake(const Logger *_Nonnull logger, TCP_Secure_Connection *_Nonnull con, const uint8_t *_Nonnull data, uint16_t length, const uint8_t *_Nonnull self_secret_key)
+static bool verify_tcp_handshake(const Logger *_Nonnull logger, const Memory *_Nonnull mem, const Random *_Nonnull rng,
+                                 const uint8_t *_Nonnull data, const uint8_t *_Nonnull self_secret_key, TCP_Handshake_Result *_Nonnull result)
 {
-    if (length != TCP_CLIENT_HANDSHAKE_SIZE) {
-        LOGGER_ERROR(logger, "invalid handshake length: %d != %d", length, TCP_CLIENT_HANDSHAKE_SIZE);
-        return -1;
-    }
-
-    if (con->status != TCP_STATUS_CONNECTED) {
-        LOGGER_ERROR(logger, "TCP connection %u not connected", (unsigned int)con->identifier);
-        return -1;
-    }
-
     uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
     encrypt_precompute(data, self_secret_key, shared_key);
     uint8_t plain[TCP_HANDSHAKE_PLAIN_SIZE];
-    int len = decrypt_data_symmetric(con->con.mem, shared_key, data + CRYPTO_PUBLIC_KEY_SIZE,
+    int len = decrypt_data_symmetric(mem, shared_key, data + CRYPTO_PUBLIC_KEY_SIZE,
                                      data + CRYPTO_PUBLIC_KEY_SIZE + CRYPTO_NONCE_SIZE, TCP_HANDSHAKE_PLAIN_SIZE + CRYPTO_MAC_SIZE, plain);
 
     if (len != TCP_HANDSHAKE_PLAIN_SIZE) {
         LOGGER_ERROR(logger, "invalid TCP handshake decrypted length: %d != %d", len, TCP_HANDSHAKE_PLAIN_SIZE);
         crypto_memzero(shared_key, sizeof(shared_key));
-        return -1;
+        return false;
     }
 
-    memcpy(con->public_key, data, CRYPTO_PUBLIC_KEY_SIZE);
+    memcpy(result->public_key, data, CRYPTO_PUBLIC_KEY_SIZE);
     uint8_t temp_secret_key[CRYPTO_SECRET_KEY_SIZE];
     uint8_t resp_plain[TCP_HANDSHAKE_PLAIN_SIZE];
-    crypto_new_keypair(con->con.rng, resp_plain, temp_secret_key);
-    random_nonce(con->con.rng, con->con.sent_nonce);
-    memcpy(resp_plain + CRYPTO_PUBLIC_KEY_SIZE, con->con.sent_nonce, CRYPTO_NONCE_SIZE);
-    memcpy(con->recv_nonce, plain + CRYPTO_PUBLIC_KEY_SIZE, CRYPTO_NONCE_SIZE);
+    crypto_new_keypair(rng, resp_plain, temp_secret_key);
+    random_nonce(rng, result->sent_nonce);
+    memcpy(resp_plain + CRYPTO_PUBLIC_KEY_SIZE, result->sent_nonce, CRYPTO_NONCE_SIZE);
+    memcpy(result->recv_nonce, plain + CRYPTO_PUBLIC_KEY_SIZE, CRYPTO_NONCE_SIZE);
 
-    uint8_t response[TCP_SERVER_HANDSHAKE_SIZE];
-    random_nonce(con->con.rng, response);
+    random_nonce(rng, result->response);
 
-    len = encrypt_data_symmetric(con->con.mem, shared_key, response, resp_plain, TCP_HANDSHAKE_PLAIN_SIZE,
-                                 response + CRYPTO_NONCE_SIZE);
+    len = encrypt_data_symmetric(mem, shared_key, result->response, resp_plain, TCP_HANDSHAKE_PLAIN_SIZE,
+                                 result->response + CRYPTO_NONCE_SIZE);
+    crypto_memzero(shared_key, sizeof(shared_key));
 
     if (len != TCP_HANDSHAKE_PLAIN_SIZE + CRYPTO_MAC_SIZE) {
-        crypto_memzero(shared_key, sizeof(shared_key));
-        return -1;
+        crypto_memzero(temp_secret_key, sizeof(temp_secret_key));
+        return false;
     }
 
-    const IP_Port ipp = {{{0}}};
+    encrypt_precompute(plain, temp_secret_key, result->shared_key);
+    crypto_memzero(temp_secret_key, sizeof(temp_secret_key));
 
-    if (TCP_SERVER_HANDSHAKE_SIZE != net_send(con->con.ns, logger, con->con.sock, response, TCP_SERVER_HANDSHAKE_SIZE, &ipp, con->con.net_profile)) {
-        crypto_memzero(shared_key, sizeof(shared_key));
+    return true;
+}
+
+/** @brief Send our answer to a verified handshake, after which @p con waits for its first packet.
+ *
+ * @retval 1 if everything went well.
+ * @retval -1 if the connection must be killed.
+ */
+static int answer_tcp_handshake(const Logger *_Nonnull logger, TCP_Secure_Connection *_Nonnull con, const TCP_Handshake_Result *_Nonnull result)
+{
+    if (TCP_SERVER_HANDSHAKE_SIZE != net_send(con->con.ns, logger, con->con.sock, result->response, TCP_SERVER_HANDSHAKE_SIZE, &con->con.ip_port, con->con.net_profile)) {
         return -1;
     }
 
-    encrypt_precompute(plain, temp_secret_key, con->con.shared_key);
+    memcpy(con->public_key, result->public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    memcpy(con->con.shared_key, result->shared_key, CRYPTO_SHARED_KEY_SIZE);
+    memcpy(con->con.sent_nonce, result->sent_nonce, CRYPTO_NONCE_SIZE);
+    memcpy(con->recv_nonce, result->recv_nonce, CRYPTO_NONCE_SIZE);
     con->status = TCP_STATUS_UNCONFIRMED;
 
-    crypto_memzero(shared_key, sizeof(shared_key));
-
     return 1;
 }
 
 /**
- * @retval 1 if connection handshake was handled correctly.
- * @retval 0 if we didn't get it yet.
+ * @retval 1 if everything went well.
  * @retval -1 if the connection must be killed.
  */
-static int read_connection_handshake(const Logger *_Nonnull logger, TCP_Secure_Connection *_Nonnull con, const uint8_t *_Nonnull self_secret_key)
+static int handle_tcp_handshake(const Logger *_Nonnull logger, TCP_Secure_Connection *_Nonnull con, const uint8_t *_Nonnull data, uint16_t length, const uint8_t *_Nonnull self_secret_key)
 {
-    uint8_t data[TCP_CLIENT_HANDSHAKE_SIZE];
-    const int len = read_tcp_packet(logger, con->con.mem, con->con.ns, con->con.sock, data, TCP_CLIENT_HANDSHAKE_SIZE, &con->con.ip_port);
+    if (length != TCP_CLIENT_HANDSHAKE_SIZE) {
+        LOGGER_ERROR(logger, "invalid handshake length: %d != %d", length, TCP_CLIENT_HANDSHAKE_SIZE);
+        return -1;
+    }
 
-    if (len == -1) {
-        LOGGER_TRACE(logger, "connection handshake is not ready yet");
-        return 0;
+    if (con->status != TCP_STATUS_CONNECTED) {
+        LOGGER_ERROR(logger, "TCP connection %u not connected", (unsigned int)con->identifier);
+        return -1;
     }
 
-    return handle_tcp_handshake(logger, con, data, len, self_secret_key);
+    TCP_Handshake_Result result;
+    int ret = -1;
+
+    if (verify_tcp_handshake(logger, con->con.mem, con->con.rng, data, self_secret_key, &result)) {
+        ret = answer_tcp_handshake(logger, con, &result);
+    }
+
+    crypto_memzero(&result, sizeof(result));
+    return ret;
 }
 
 /**
@@ -422,6 +1105,35 @@ static int send_disconnect_notification(const Logger *_Nonnull logger, TCP_Secur
     return write_packet_tcp_secure_connection(logger, &con->con, data, sizeof(data), true);
 }
 
+/** @brief Double the number of routing slots of a connection, up to NUM_CLIENT_CONNECTIONS.
+ *
+ * The new slots are free, starting at the old size.
+ *
+ * @retval true on success.
+ * @retval false if the connection has all slots already, or on allocation failure.
+ */
+static bool grow_routing_slots(TCP_Secure_Connection *_Nonnull con)
+{
+    const uint32_t old_size = con->connections_size;
+
+    if (old_size == NUM_CLIENT_CONNECTIONS) {
+        return false;
+    }
+
+    const uint32_t new_size = old_size == 0 ? 4 : min_u32(old_size * 2, NUM_CLIENT_CONNECTIONS);
+    TCP_Secure_Conn *new_connections = (TCP_Secure_Conn *)mem_vrealloc(
+                                           con->con.mem, con->connections, new_size, sizeof(TCP_Secure_Conn));
+
+    if (new_connections == nullptr) {
+        return false;
+    }
+
+    memset(&new_connections[old_size], 0, (new_size - old_size) * sizeof(TCP_Secure_Conn));
+    con->connections = new_connections;
+    con->connections_size = (uint8_t)new_size;
+    return true;
+}
+
 /**
  * @retval 0 on success.
  * @retval -1 on failure (connection must be killed).
@@ -440,7 +1152,7 @@ static int handle_tcp_routing_req(TCP_Server *_Nonnull tcp_server, uint32_t con_
         return 0;
     }
 
-    for (uint32_t i = 0; i < NUM_CLIENT_CONNECTIONS; ++i) {
+    for (uint32_t i = 0; i < con->connections_size; ++i) {
         if (con->connections[i].status != 0) {
             if (pk_equal(public_key, con->connections[i].public_key)) {
                 if (send_routing_response(tcp_server->logger, con, i + NUM_RESERVED_PORTS, public_key) == -1) {
@@ -454,6 +1166,14 @@ static int handle_tcp_routing_req(TCP_Server *_Nonnull tcp_server, uint32_t con_
         }
     }
 
+    if (index == (uint32_t) -1) {
+        const uint32_t old_size = con->connections_size;
+
+        if (grow_routing_slots(con)) {
+            index = old_size;
+        }
+    }
+
     if (index == (uint32_t) -1) {
         if (send_routing_response(tcp_server->logger, con, 0, public_key) == -1) {
             return -1;
@@ -480,7 +1200,7 @@ static int handle_tcp_routing_req(TCP_Server *_Nonnull tcp_server, uint32_t con_
         uint32_t other_id = -1;
         TCP_Secure_Connection *other_conn = &tcp_server->accepted_connection_array[other_index];
 
-        for (uint32_t i = 0; i < NUM_CLIENT_CONNECTIONS; ++i) {
+        for (uint32_t i = 0; i < other_conn->connections_size; ++i) {
             if (other_conn->connections[i].status == 1
                     && pk_equal(other_conn->connections[i].public_key, con->public_key)) {
                 other_id = i;
@@ -492,45 +1212,140 @@ static int handle_tcp_routing_req(TCP_Server *_Nonnull tcp_server, uint32_t con_
             con->connections[index].status = 2;
             con->connections[index].index = other_index;
             con->connections[index].other_id = other_id;
+            con->connections[index].shard = own_shard_id(tcp_server);
             other_conn->connections[other_id].status = 2;
             other_conn->connections[other_id].index = con_id;
             other_conn->connections[other_id].other_id = index;
+            other_conn->connections[other_id].shard = own_shard_id(tcp_server);
             // TODO(irungentoo): return values?
             send_connect_notification(tcp_server->logger, con, index);
             send_connect_notification(tcp_server->logger, other_conn, other_id);
         }
     }
 
+#ifdef TCP_SERVER_USE_EPOLL
+    else if (is_shard(tcp_server)) {
+        // The peer may be on another shard: whichever has it links the route
+        // if the peer asked for us as well.
+        TCP_Shard_Msg *msg = tcp_shard_msg_new(tcp_server->mem, TCP_SHARD_MSG_ROUTE, 0);
+
+        if (msg != nullptr) {
+            msg->from_shard = tcp_server->shard_id;
+            msg->from_index = con_id;
+            msg->from_identifier = con->identifier;
+            msg->from_slot = index;
+            memcpy(msg->public_key, con->public_key, CRYPTO_PUBLIC_KEY_SIZE);
+            memcpy(msg->peer_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
+            tcp_shard_broadcast(tcp_server, msg);
+        }
+    }
+
+#endif /* TCP_SERVER_USE_EPOLL */
+
     return 0;
 }
 
-/**
+/** @brief Write a data packet routed from another client to @p con, counting it.
+ *
+ * @return what `write_packet_tcp_secure_connection` returns.
+ */
+static int write_routed_packet(TCP_Server *_Nonnull tcp_server, TCP_Connection *_Nonnull con, const uint8_t *_Nonnull data, uint16_t length)
+{
+    const int ret = write_packet_tcp_secure_connection(tcp_server->logger, con, data, length, false);
+
+    if (ret == 1) {
+        tcp_counter_increment(&tcp_server->relay_counters.routed_packets);
+        tcp_counter_add(&tcp_server->relay_counters.routed_bytes, length);
+    } else if (ret == 0) {
+        tcp_counter_increment(&tcp_server->relay_counters.routed_dropped);
+    }
+
+    return ret;
+}
+
+/** @brief Pass an OOB packet on to the client it is for.
+ *
+ * @p packet is the whole OOB send packet, with the recipient's public key and
+ * @p length bytes of data. If the recipient is ours, the packet is turned
+ * into the OOB receive packet for it where it is.
+ *
  * @retval 0 on success.
  * @retval -1 on failure (connection must be killed).
  */
-static int handle_tcp_oob_send(TCP_Server *_Nonnull tcp_server, uint32_t con_id, const uint8_t *_Nonnull public_key, const uint8_t *_Nonnull data, uint16_t length)
+static int handle_tcp_oob_send(TCP_Server *_Nonnull tcp_server, uint32_t con_id, uint8_t *_Nonnull packet, uint16_t length)
 {
     if (length == 0 || length > TCP_MAX_OOB_DATA_LENGTH) {
         return -1;
     }
 
     const TCP_Secure_Connection *con = &tcp_server->accepted_connection_array[con_id];
-
-    const int other_index = get_tcp_connection_index(tcp_server, public_key);
+    const int other_index = get_tcp_connection_index(tcp_server, packet + 1);
 
     if (other_index != -1) {
-        const uint16_t resp_packet_size = 1 + CRYPTO_PUBLIC_KEY_SIZE + length;
-        VLA(uint8_t, resp_packet, resp_packet_size);
-        resp_packet[0] = TCP_PACKET_OOB_RECV;
-        memcpy(resp_packet + 1, con->public_key, CRYPTO_PUBLIC_KEY_SIZE);
-        memcpy(resp_packet + 1 + CRYPTO_PUBLIC_KEY_SIZE, data, length);
+        // Both packets are the same size: only the type and the key change.
+        packet[0] = TCP_PACKET_OOB_RECV;
+        memcpy(packet + 1, con->public_key, CRYPTO_PUBLIC_KEY_SIZE);
         write_packet_tcp_secure_connection(tcp_server->logger, &tcp_server->accepted_connection_array[other_index].con,
-                                           resp_packet, resp_packet_size, false);
+                                           packet, 1 + CRYPTO_PUBLIC_KEY_SIZE + length, false);
+    }
+
+#ifdef TCP_SERVER_USE_EPOLL
+    else if (is_shard(tcp_server)) {
+        const uint16_t resp_packet_size = 1 + CRYPTO_PUBLIC_KEY_SIZE + length;
+        TCP_Shard_Msg *msg = tcp_shard_msg_new(tcp_server->mem, TCP_SHARD_MSG_OOB, resp_packet_size);
+
+        if (msg != nullptr) {
+            memcpy(msg->peer_key, packet + 1, CRYPTO_PUBLIC_KEY_SIZE);
+            msg->data[0] = TCP_PACKET_OOB_RECV;
+            memcpy(msg->data + 1, con->public_key, CRYPTO_PUBLIC_KEY_SIZE);
+            memcpy(msg->data + 1 + CRYPTO_PUBLIC_KEY_SIZE, packet + 1 + CRYPTO_PUBLIC_KEY_SIZE, length);
+            tcp_shard_broadcast(tcp_server, msg);
+        }
     }
 
+#endif /* TCP_SERVER_USE_EPOLL */
+
     return 0;
 }
 
+#ifdef TCP_SERVER_USE_EPOLL
+/** @brief Post a route message to the other end of @p link.
+ *
+ * It comes from slot @p slot of our connection @p index, whose client has @p public_key.
+ */
+static void tcp_shard_post_route(TCP_Server *_Nonnull tcp_server, TCP_Shard_Msg_Type type, const TCP_Secure_Conn *_Nonnull link,
+                                 uint32_t index, uint64_t identifier, uint8_t slot, const uint8_t *_Nonnull public_key)
+{
+    if (link->shard >= tcp_server->front->num_shards) {
+        return;
+    }
+
+    TCP_Shard_Msg *msg = tcp_shard_msg_new(tcp_server->mem, type, 0);
+
+    if (msg == nullptr) {
+        return;
+    }
+
+    msg->index = link->index;
+    msg->identifier = link->identifier;
+    msg->slot = link->other_id;
+    msg->from_shard = tcp_server->shard_id;
+    msg->from_index = index;
+    msg->from_identifier = identifier;
+    msg->from_slot = slot;
+    memcpy(msg->public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    tcp_shard_post(tcp_server->front->shards[link->shard], msg);
+}
+
+/** @brief Tell the shard at the other end of an online slot that it's going offline. */
+static void tcp_shard_unlink(TCP_Server *_Nonnull tcp_server, const TCP_Secure_Connection *_Nonnull con, uint8_t con_number)
+{
+    tcp_shard_post_route(tcp_server, TCP_SHARD_MSG_UNLINK, &con->connections[con_number],
+                         (uint32_t)(con - tcp_server->accepted_connection_array), con->identifier, con_number,
+                         con->public_key);
+}
+#endif /* TCP_SERVER_USE_EPOLL */
+
 /** @brief Remove connection with con_number from the connections array of con.
  *
  * return -1 on failure.
@@ -538,12 +1353,16 @@ static int handle_tcp_oob_send(TCP_Server *_Nonnull tcp_server, uint32_t con_id,
  */
 static int rm_connection_index(TCP_Server *tcp_server, TCP_Secure_Connection *con, uint8_t con_number)
 {
-    if (con_number >= NUM_CLIENT_CONNECTIONS) {
+    if (con_number >= con->connections_size) {
         return -1;
     }
 
     if (con->connections[con_number].status != 0) {
-        if (con->connections[con_number].status == 2) {
+        if (con->connections[con_number].status == 2 && is_cross_shard(tcp_server, &con->connections[con_number])) {
+#ifdef TCP_SERVER_USE_EPOLL
+            tcp_shard_unlink(tcp_server, con, con_number);
+#endif /* TCP_SERVER_USE_EPOLL */
+        } else if (con->connections[con_number].status == 2) {
             const uint32_t index = con->connections[con_number].index;
             const uint8_t other_id = con->connections[con_number].other_id;
 
@@ -561,6 +1380,8 @@ static int rm_connection_index(TCP_Server *tcp_server, TCP_Secure_Connection *co
         con->connections[con_number].index = 0;
         con->connections[con_number].other_id = 0;
         con->connections[con_number].status = 0;
+        con->connections[con_number].shard = 0;
+        con->connections[con_number].identifier = 0;
         return 0;
     }
 
@@ -600,6 +1421,12 @@ static int handle_onion_recv_1(void *_Nonnull object, const IP_Port *_Nonnull de
     TCP_Server *tcp_server = (TCP_Server *)object;
     uint32_t index;
 
+    if (net_family_is_tcp_client(dest->ip.family)
+            && tcp_shard_send_remote(tcp_server, dest->ip.ip.v6.uint32[0], dest->ip.ip.v6.uint64[1],
+                                     TCP_PACKET_ONION_RESPONSE, data, length)) {
+        return 0;
+    }
+
     if (!ip_port_to_con_id(tcp_server, dest, &index)) {
         return 1;
     }
@@ -635,6 +1462,10 @@ static bool handle_forward_reply_tcp(void *_Nonnull object, const uint8_t *_Nonn
     net_unpack_u32(sendback_data + 1, &con_id);
     net_unpack_u64(sendback_data + 1 + sizeof(uint32_t), &identifier);
 
+    if (tcp_shard_send_remote(tcp_server, con_id, identifier, TCP_PACKET_FORWARDING, data, length)) {
+        return true;
+    }
+
     if (con_id >= tcp_server->size_accepted_connections) {
         return false;
     }
@@ -657,7 +1488,11 @@ static bool handle_forward_reply_tcp(void *_Nonnull object, const uint8_t *_Nonn
  * @retval 0 on success
  * @retval -1 on failure
  */
-static int handle_tcp_packet(TCP_Server *_Nonnull tcp_server, uint32_t con_id, const uint8_t *_Nonnull data, uint16_t length)
+/** @brief Handle a packet received on accepted connection @p con_id.
+ *
+ * Packets for other clients are forwarded in @p data, which is changed along the way.
+ */
+static int handle_tcp_packet(TCP_Server *_Nonnull tcp_server, uint32_t con_id, uint8_t *_Nonnull data, uint16_t length)
 {
     if (length == 0) {
         return -1;
@@ -736,8 +1571,7 @@ static int handle_tcp_packet(TCP_Server *_Nonnull tcp_server, uint32_t con_id, c
 
             LOGGER_TRACE(tcp_server->logger, "handling oob send for %u", con_id);
 
-            return handle_tcp_oob_send(tcp_server, con_id, data + 1, data + 1 + CRYPTO_PUBLIC_KEY_SIZE,
-                                       length - (1 + CRYPTO_PUBLIC_KEY_SIZE));
+            return handle_tcp_oob_send(tcp_server, con_id, data, length - (1 + CRYPTO_PUBLIC_KEY_SIZE));
         }
 
         case TCP_PACKET_ONION_REQUEST: {
@@ -748,9 +1582,13 @@ static int handle_tcp_packet(TCP_Server *_Nonnull tcp_server, uint32_t con_id, c
                     return -1;
                 }
 
-                const IP_Port source = con_id_to_ip_port(con_id, con->identifier);
-                onion_send_1(tcp_server->onion, data + 1 + CRYPTO_NONCE_SIZE, length - (1 + CRYPTO_NONCE_SIZE), &source,
-                             data + 1);
+                const IP_Port source = con_id_to_ip_port(relay_con_id(own_shard_id(tcp_server), con_id), con->identifier);
+
+                if (!tcp_shard_post_request(tcp_server, true, &source, data + 1, CRYPTO_NONCE_SIZE,
+                                            data + 1 + CRYPTO_NONCE_SIZE, length - (1 + CRYPTO_NONCE_SIZE))) {
+                    onion_send_1(tcp_server->onion, data + 1 + CRYPTO_NONCE_SIZE, length - (1 + CRYPTO_NONCE_SIZE), &source,
+                                 data + 1);
+                }
             }
 
             return 0;
@@ -769,7 +1607,7 @@ static int handle_tcp_packet(TCP_Server *_Nonnull tcp_server, uint32_t con_id, c
             const uint16_t sendback_data_len = 1 + sizeof(uint32_t) + sizeof(uint64_t);
             uint8_t sendback_data[1 + sizeof(uint32_t) + sizeof(uint64_t)];
             sendback_data[0] = SENDBACK_TCP;
-            net_pack_u32(sendback_data + 1, con_id);
+            net_pack_u32(sendback_data + 1, relay_con_id(own_shard_id(tcp_server), con_id));
             net_pack_u64(sendback_data + 1 + sizeof(uint32_t), con->identifier);
 
             IP_Port dest;
@@ -786,7 +1624,11 @@ static int handle_tcp_packet(TCP_Server *_Nonnull tcp_server, uint32_t con_id, c
                 return -1;
             }
 
-            send_forwarding(tcp_server->forwarding, &dest, sendback_data, sendback_data_len, forward_data, forward_data_len);
+            if (!tcp_shard_post_request(tcp_server, false, &dest, sendback_data, sendback_data_len,
+                                        forward_data, forward_data_len)) {
+                send_forwarding(tcp_server->forwarding, &dest, sendback_data, sendback_data_len, forward_data, forward_data_len);
+            }
+
             return 0;
         }
 
@@ -802,7 +1644,7 @@ static int handle_tcp_packet(TCP_Server *_Nonnull tcp_server, uint32_t con_id, c
             const uint8_t c_id = data[0] - NUM_RESERVED_PORTS;
             LOGGER_TRACE(tcp_server->logger, "handling packet id %u for %u", c_id, con_id);
 
-            if (c_id >= NUM_CLIENT_CONNECTIONS) {
+            if (c_id >= con->connections_size) {
                 return -1;
             }
 
@@ -814,15 +1656,19 @@ static int handle_tcp_packet(TCP_Server *_Nonnull tcp_server, uint32_t con_id, c
                 return 0;
             }
 
+            if (is_cross_shard(tcp_server, &con->connections[c_id])) {
+                const TCP_Secure_Conn *const link = &con->connections[c_id];
+                tcp_shard_send_remote(tcp_server, relay_con_id(link->shard, link->index), link->identifier,
+                                      link->other_id + NUM_RESERVED_PORTS, data + 1, length - 1);
+                return 0;
+            }
+
+            // The packet is encrypted for the other end where it is, straight
+            // into that connection's output ring.
             const uint32_t index = con->connections[c_id].index;
-            const uint8_t other_c_id = con->connections[c_id].other_id + NUM_RESERVED_PORTS;
-            VLA(uint8_t, new_data, length);
-            memcpy(new_data, data, length);
-            new_data[0] = other_c_id;
-            const int ret = write_packet_tcp_secure_connection(tcp_server->logger,
-                            &tcp_server->accepted_connection_array[index].con, new_data, length, false);
-
-            if (ret == -1) {
+            data[0] = con->connections[c_id].other_id + NUM_RESERVED_PORTS;
+
+            if (write_routed_packet(tcp_server, &tcp_server->accepted_connection_array[index].con, data, length) == -1) {
                 return -1;
             }
 
@@ -833,7 +1679,7 @@ static int handle_tcp_packet(TCP_Server *_Nonnull tcp_server, uint32_t con_id, c
     return 0;
 }
 
-static int confirm_tcp_connection(TCP_Server *_Nonnull tcp_server, const Mono_Time *_Nonnull mono_time, TCP_Secure_Connection *_Nonnull con, const uint8_t *_Nonnull data, uint16_t length)
+static int confirm_tcp_connection(TCP_Server *_Nonnull tcp_server, const Mono_Time *_Nonnull mono_time, TCP_Secure_Connection *_Nonnull con, uint8_t *_Nonnull data, uint16_t length)
 {
     const int index = add_accepted(tcp_server, mono_time, con);
 
@@ -848,23 +1694,164 @@ static int confirm_tcp_connection(TCP_Server *_Nonnull tcp_server, const Mono_Ti
     if (handle_tcp_packet(tcp_server, index, data, length) == -1) {
         LOGGER_DEBUG(tcp_server->logger, "dropping connection %u: data packet (len=%d) not handled",
                      (unsigned int)con->identifier, length);
-        kill_accepted(tcp_server, index);
+        kill_accepted(tcp_server, index, TCP_KILL_INVALID);
         return -1;
     }
 
     return index;
 }
 
+/** The bucket key of a client address: an IPv4 address, or the /64 network of an IPv6 one. */
+static uint64_t handshake_bucket_key(const IP *_Nonnull ip)
+{
+    if (net_family_is_ipv4(ip->family)) {
+        return 0xFFFF00000000 | ip->ip.v4.uint32;
+    }
+
+    if (ipv6_ipv4_in_v6(&ip->ip.v6)) {
+        return 0xFFFF00000000 | ip->ip.v6.uint32[3];
+    }
+
+    return ip->ip.v6.uint64[0];
+}
+
+/** @brief Take one handshake from the bucket of the client at @p ip.
+ *
+ * @retval false if the client used up its handshakes for now.
+ */
+static bool take_handshake_token(TCP_Server *_Nonnull tcp_server, const Mono_Time *_Nonnull mono_time, const IP *_Nonnull ip)
+{
+    if (tcp_server->handshake_buckets == nullptr || !(net_family_is_ipv4(ip->family) || net_family_is_ipv6(ip->family))) {
+        return true;
+    }
+
+    const uint64_t key = handshake_bucket_key(ip);
+    TCP_Handshake_Bucket *bucket = &tcp_server->handshake_buckets[((key * 0x9E3779B97F4A7C15) >> 32) % TCP_HANDSHAKE_BUCKETS];
+    const uint64_t now = mono_time_get_ms(mono_time);
+    const uint32_t capacity = tcp_server->handshake_burst * 1000;
+
+    if (bucket->key != key) {
+        bucket->key = key;
+        bucket->tokens = capacity;
+    } else if (now > bucket->refilled) {
+        // The rate is per second, so it's also the thousandths of a handshake per millisecond.
+        bucket->tokens = (uint32_t)min_u64(capacity, bucket->tokens + (now - bucket->refilled) * tcp_server->handshake_rate);
+    }
+
+    bucket->refilled = now;
+
+    if (bucket->tokens < 1000) {
+        return false;
+    }
+
+    bucket->tokens -= 1000;
+    return true;
+}
+
+/** Limit the handshakes each client address may start, as given in @p options. */
+static bool tcp_server_set_handshake_limit(TCP_Server *_Nonnull tcp_server, const TCP_Server_Options *_Nonnull options)
+{
+    if (options->handshake_rate == 0) {
+        return true;
+    }
+
+    TCP_Handshake_Bucket *buckets = (TCP_Handshake_Bucket *)mem_valloc(tcp_server->mem, TCP_HANDSHAKE_BUCKETS, sizeof(TCP_Handshake_Bucket));
+
+    if (buckets == nullptr) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < TCP_HANDSHAKE_BUCKETS; ++i) {
+        buckets[i].key = TCP_HANDSHAKE_BUCKET_UNUSED;
+    }
+
+    tcp_server->handshake_buckets = buckets;
+    tcp_server->handshake_rate = options->handshake_rate;
+    tcp_server->handshake_burst = max_u16(options->handshake_burst, 1);
+    return true;
+}
+
+/** @brief Find a slot in @p queue for a new handshake, starting from @p start.
+ *
+ * A slot is free, or holds a connection that took too long with its handshake.
+ *
+ * @return the slot index, or -1 if there is no room for another handshake.
+ */
+static int find_handshake_slot(const TCP_Secure_Connection *_Nonnull queue, uint16_t start, uint64_t now)
+{
+    for (uint32_t i = 0; i < MAX_INCOMING_CONNECTIONS; ++i) {
+        const uint32_t index = (start + i) % MAX_INCOMING_CONNECTIONS;
+
+        if (queue[index].status == TCP_STATUS_NO_STATUS || queue[index].last_pinged + TCP_HANDSHAKE_TIMEOUT <= now) {
+            return (int)index;
+        }
+    }
+
+    return -1;
+}
+
+/** Number of connections in @p queue that are still within their time for the handshake. */
+static uint32_t count_handshakes(const TCP_Secure_Connection *_Nonnull queue, uint64_t now)
+{
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i < MAX_INCOMING_CONNECTIONS; ++i) {
+        if (queue[i].status != TCP_STATUS_NO_STATUS && queue[i].last_pinged + TCP_HANDSHAKE_TIMEOUT > now) {
+            ++count;
+        }
+    }
+
+    return count;
+}
+
+/** @brief Whether there is room to accept another connection.
+ *
+ * Every accepted connection must also find room among the unconfirmed ones
+ * once its handshake is answered, so both queues together hold at most
+ * `MAX_INCOMING_CONNECTIONS` handshakes. Connections that don't fit wait in
+ * the listening sockets' backlog, rather than being closed.
+ */
+static bool can_accept_connection(const TCP_Server *_Nonnull tcp_server, const Mono_Time *_Nonnull mono_time)
+{
+    const uint64_t now = mono_time_get(mono_time);
+    return count_handshakes(tcp_server->incoming_connection_queue, now)
+           + count_handshakes(tcp_server->unconfirmed_connection_queue, now) < MAX_INCOMING_CONNECTIONS;
+}
+
 /**
  * @return index on success
  * @retval -1 on failure
  */
-static int accept_connection(TCP_Server *_Nonnull tcp_server, Socket sock)
+static int accept_connection(TCP_Server *_Nonnull tcp_server, const Mono_Time *_Nonnull mono_time, Socket sock)
 {
     if (!sock_valid(sock)) {
         return -1;
     }
 
+    IP_Port ip_port = {{{0}}};
+
+    if (!net_getpeername(tcp_server->ns, sock, &ip_port)) {
+        ip_reset(&ip_port.ip);
+    }
+
+    if (!take_handshake_token(tcp_server, mono_time, &ip_port.ip)) {
+        Ip_Ntoa ip_str;
+        LOGGER_TRACE(tcp_server->logger, "rejecting connection from %s: too many handshakes", net_ip_ntoa(&ip_port.ip, &ip_str));
+        tcp_counter_increment(&tcp_server->handshake_counters.rejected);
+        kill_sock(tcp_server->ns, sock);
+        return -1;
+    }
+
+    const int index = find_handshake_slot(tcp_server->incoming_connection_queue, tcp_server->incoming_connection_queue_index,
+                                          mono_time_get(mono_time));
+
+    if (index == -1) {
+        LOGGER_DEBUG(tcp_server->logger, "rejecting connection: %d handshakes in progress", MAX_INCOMING_CONNECTIONS);
+        tcp_counter_increment(&tcp_server->handshake_counters.rejected);
+        kill_sock(tcp_server->ns, sock);
+        return -1;
+    }
+
     if (!set_socket_nonblock(tcp_server->ns, sock)) {
         kill_sock(tcp_server->ns, sock);
         return -1;
@@ -875,12 +1862,11 @@ static int accept_connection(TCP_Server *_Nonnull tcp_server, Socket sock)
         return -1;
     }
 
-    const uint16_t index = tcp_server->incoming_connection_queue_index % MAX_INCOMING_CONNECTIONS;
-
     TCP_Secure_Connection *conn = &tcp_server->incoming_connection_queue[index];
 
     if (conn->status != TCP_STATUS_NO_STATUS) {
         LOGGER_DEBUG(tcp_server->logger, "connection %d dropped before accepting", index);
+        tcp_counter_increment(&tcp_server->handshake_counters.failed);
         kill_tcp_secure_connection(conn);
     }
 
@@ -889,13 +1875,16 @@ static int accept_connection(TCP_Server *_Nonnull tcp_server, Socket sock)
     conn->con.mem = tcp_server->mem;
     conn->con.rng = tcp_server->rng;
     conn->con.sock = sock;
-    conn->next_packet_length = 0;
+    conn->con.ip_port = ip_port;
+    conn->identifier = new_connection_identifier(tcp_server);
+    conn->last_pinged = mono_time_get(mono_time);
 
-    ++tcp_server->incoming_connection_queue_index;
+    tcp_server->incoming_connection_queue_index = (uint16_t)(index + 1);
     return index;
 }
 
-static Socket new_listening_tcp_socket(const Logger *_Nonnull logger, const Memory *_Nonnull mem, const Network *_Nonnull ns, Family family, uint16_t port)
+static Socket new_listening_tcp_socket(const Logger *_Nonnull logger, const Memory *_Nonnull mem, const Network *_Nonnull ns, Family family, uint16_t port,
+                                       bool reuseport)
 {
     const Socket sock = net_socket(ns, family, TOX_SOCK_STREAM, TOX_PROTO_TCP);
 
@@ -914,6 +1903,10 @@ static Socket new_listening_tcp_socket(const Logger *_Nonnull logger, const Memo
         ok = set_socket_reuseaddr(ns, sock);
     }
 
+    if (ok && reuseport) {
+        ok = set_socket_reuseport(ns, sock);
+    }
+
     ok = ok && bind_to_port(ns, sock, family, port) && (net_listen(ns, sock, TCP_MAX_BACKLOG) == 0);
 
     if (!ok) {
@@ -928,9 +1921,13 @@ static Socket new_listening_tcp_socket(const Logger *_Nonnull logger, const Memo
     return sock;
 }
 
-TCP_Server *new_tcp_server(const Logger *logger, const Memory *mem, const Random *rng, const Network *ns,
-                           bool ipv6_enabled, uint16_t num_sockets,
-                           const uint16_t *ports, const uint8_t *secret_key, Onion *onion, Forwarding *forwarding)
+/** @brief Create a server without the onion and forwarding modules.
+ *
+ * @param reuseport Bind the listening sockets so that every shard of a relay can listen on the same ports.
+ */
+static TCP_Server *_Nullable tcp_server_new_internal(const Logger *_Nonnull logger, const Memory *_Nonnull mem, const Random *_Nonnull rng, const Network *_Nullable ns,
+        bool ipv6_enabled, uint16_t num_sockets,
+        const uint16_t *_Nullable ports, const uint8_t *_Nonnull secret_key, bool reuseport)
 {
     if (num_sockets == 0 || ports == nullptr) {
         LOGGER_ERROR(logger, "no sockets");
@@ -984,12 +1981,26 @@ TCP_Server *new_tcp_server(const Logger *logger, const Memory *mem, const Random
         return nullptr;
     }
 
+    // The wheel catches up with the clock on the first run, before any timer is set.
+    Timer_Wheel *timers = timer_wheel_new(mem, 0);
+
+    if (timers == nullptr) {
+        LOGGER_ERROR(logger, "timer wheel allocation failed");
+        close(temp->efd);
+        netprof_kill(mem, temp->net_profile);
+        mem_delete(mem, socks_listening);
+        mem_delete(mem, temp);
+        return nullptr;
+    }
+
+    temp->timers = timers;
+
 #endif /* TCP_SERVER_USE_EPOLL */
 
     const Family family = ipv6_enabled ? net_family_ipv6() : net_family_ipv4();
 
     for (uint32_t i = 0; i < num_sockets; ++i) {
-        const Socket sock = new_listening_tcp_socket(logger, mem, ns, family, ports[i]);
+        const Socket sock = new_listening_tcp_socket(logger, mem, ns, family, ports[i], reuseport);
 
         if (!sock_valid(sock)) {
             continue;
@@ -1012,21 +2023,19 @@ TCP_Server *new_tcp_server(const Logger *logger, const Memory *mem, const Random
     }
 
     if (temp->num_listening_socks == 0) {
+#ifdef TCP_SERVER_USE_EPOLL
+        timer_wheel_kill(temp->timers);
+        close(temp->efd);
+#endif /* TCP_SERVER_USE_EPOLL */
         netprof_kill(mem, temp->net_profile);
         mem_delete(mem, temp->socks_listening);
         mem_delete(mem, temp);
         return nullptr;
     }
 
-    if (onion != nullptr) {
-        temp->onion = onion;
-        set_callback_handle_recv_1(onion, &handle_onion_recv_1, temp);
-    }
-
-    if (forwarding != nullptr) {
-        temp->forwarding = forwarding;
-        set_callback_forward_reply(forwarding, &handle_forward_reply_tcp, temp);
-    }
+#ifdef TCP_SERVER_USE_EPOLL
+    temp->inbox.wake_fd = -1;
+#endif /* TCP_SERVER_USE_EPOLL */
 
     memcpy(temp->secret_key, secret_key, CRYPTO_SECRET_KEY_SIZE);
     crypto_derive_public_key(temp->public_key, temp->secret_key);
@@ -1036,59 +2045,524 @@ TCP_Server *new_tcp_server(const Logger *logger, const Memory *mem, const Random
     return temp;
 }
 
-#ifndef TCP_SERVER_USE_EPOLL
-static void do_tcp_accept_new(TCP_Server *_Nonnull tcp_server)
+static void tcp_server_set_modules(TCP_Server *_Nonnull tcp_server, Onion *_Nullable onion, Forwarding *_Nullable forwarding)
 {
-    for (uint32_t sock_idx = 0; sock_idx < tcp_server->num_listening_socks; ++sock_idx) {
-
-        for (uint32_t connection_idx = 0; connection_idx < MAX_INCOMING_CONNECTIONS; ++connection_idx) {
-            const Socket sock = net_accept(tcp_server->ns, tcp_server->socks_listening[sock_idx]);
+    if (onion != nullptr) {
+        tcp_server->onion = onion;
+        set_callback_handle_recv_1(onion, &handle_onion_recv_1, tcp_server);
+    }
 
-            if (accept_connection(tcp_server, sock) == -1) {
-                break;
-            }
+    if (forwarding != nullptr) {
+        tcp_server->forwarding = forwarding;
+        set_callback_forward_reply(forwarding, &handle_forward_reply_tcp, tcp_server);
+    }
+}
+
+#ifdef TCP_SERVER_USE_EPOLL
+static void *_Nullable tcp_handshake_worker(void *_Nonnull arg)
+{
+    TCP_Handshake_Pool *pool = (TCP_Handshake_Pool *)arg;
+
+    pthread_mutex_lock(&pool->lock);
+
+    while (true) {
+        while (!pool->stopping && pool->length == 0) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+
+        if (pool->stopping) {
+            break;
+        }
+
+        const TCP_Handshake_Job job = pool->jobs[pool->start];
+        pool->start = (pool->start + 1) % pool->capacity;
+        --pool->length;
+        ++pool->busy;
+        pthread_mutex_unlock(&pool->lock);
+
+        // The result goes where the client's handshake was.
+        uint8_t data[TCP_CLIENT_HANDSHAKE_SIZE];
+        memcpy(data, job.msg->data, sizeof(data));
+        TCP_Handshake_Result result;
+
+        if (verify_tcp_handshake(pool->logger, pool->mem, pool->rng, data, pool->secret_key, &result)) {
+            memcpy(job.msg->data, &result, sizeof(result));
+        } else {
+            job.msg->length = 0;
+        }
+
+        crypto_memzero(&result, sizeof(result));
+        tcp_shard_post(job.shard, job.msg);
+
+        pthread_mutex_lock(&pool->lock);
+        --pool->busy;
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    return nullptr;
+}
+
+/** @brief Queue the handshake of incoming connection @p i for the workers.
+ *
+ * @retval false if the queue is full.
+ */
+static bool tcp_handshake_submit(TCP_Server *_Nonnull tcp_server, uint32_t i, const uint8_t *_Nonnull data)
+{
+    static_assert(sizeof(TCP_Handshake_Result) >= TCP_CLIENT_HANDSHAKE_SIZE, "handshake result must fit where the handshake was");
+
+    TCP_Handshake_Pool *pool = tcp_server->handshake_pool;
+    TCP_Secure_Connection *conn = &tcp_server->incoming_connection_queue[i];
+    TCP_Shard_Msg *msg = tcp_shard_msg_new(tcp_server->mem, TCP_SHARD_MSG_HANDSHAKE, sizeof(TCP_Handshake_Result));
+
+    if (msg == nullptr) {
+        return false;
+    }
+
+    msg->index = i;
+    msg->identifier = conn->identifier;
+    memcpy(msg->data, data, TCP_CLIENT_HANDSHAKE_SIZE);
+
+    pthread_mutex_lock(&pool->lock);
+    const bool queued = !pool->stopping && pool->length < pool->capacity;
+
+    if (queued) {
+        TCP_Handshake_Job *job = &pool->jobs[(pool->start + pool->length) % pool->capacity];
+        job->shard = tcp_server;
+        job->msg = msg;
+        ++pool->length;
+        pthread_cond_signal(&pool->wake);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!queued) {
+        mem_delete(tcp_server->mem, msg);
+        return false;
+    }
+
+    conn->status = TCP_STATUS_HANDSHAKING;
+    return true;
+}
+
+/** Handshakes waiting for or being verified by a worker. */
+static uint32_t tcp_handshake_pool_queued(TCP_Handshake_Pool *_Nonnull pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    const uint32_t queued = pool->length + pool->busy;
+    pthread_mutex_unlock(&pool->lock);
+    return queued;
+}
+
+/** Stop the workers and drop the handshakes they haven't taken yet. */
+static void tcp_handshake_pool_kill(TCP_Handshake_Pool *_Nullable pool)
+{
+    if (pool == nullptr) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (uint16_t i = 0; i < pool->num_threads; ++i) {
+        pthread_join(pool->threads[i], nullptr);
+    }
+
+    for (uint32_t i = 0; i < pool->length; ++i) {
+        mem_delete(pool->mem, pool->jobs[(pool->start + i) % pool->capacity].msg);
+    }
+
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->lock);
+
+    const Memory *mem = pool->mem;
+    mem_delete(mem, pool->threads);
+    mem_delete(mem, pool->jobs);
+    mem_delete(mem, pool);
+}
+
+/** @brief Start @p num_threads handshake workers for the shards of @p front.
+ *
+ * Each shard has room for `MAX_INCOMING_CONNECTIONS` handshakes, so the
+ * queue has as well.
+ */
+static TCP_Handshake_Pool *_Nullable tcp_handshake_pool_new(TCP_Server *_Nonnull front, uint16_t num_threads)
+{
+    const Memory *mem = front->mem;
+    TCP_Handshake_Pool *pool = (TCP_Handshake_Pool *)mem_alloc(mem, sizeof(TCP_Handshake_Pool));
+
+    if (pool == nullptr) {
+        return nullptr;
+    }
+
+    const uint32_t capacity = (uint32_t)MAX_INCOMING_CONNECTIONS * front->num_shards;
+    TCP_Handshake_Job *jobs = (TCP_Handshake_Job *)mem_valloc(mem, capacity, sizeof(TCP_Handshake_Job));
+    pthread_t *threads = (pthread_t *)mem_valloc(mem, num_threads, sizeof(pthread_t));
+
+    if (jobs == nullptr || threads == nullptr) {
+        mem_delete(mem, threads);
+        mem_delete(mem, jobs);
+        mem_delete(mem, pool);
+        return nullptr;
+    }
+
+    if (pthread_mutex_init(&pool->lock, nullptr) != 0) {
+        mem_delete(mem, threads);
+        mem_delete(mem, jobs);
+        mem_delete(mem, pool);
+        return nullptr;
+    }
+
+    if (pthread_cond_init(&pool->wake, nullptr) != 0) {
+        pthread_mutex_destroy(&pool->lock);
+        mem_delete(mem, threads);
+        mem_delete(mem, jobs);
+        mem_delete(mem, pool);
+        return nullptr;
+    }
+
+    pool->jobs = jobs;
+    pool->capacity = capacity;
+    pool->threads = threads;
+    pool->logger = front->logger;
+    pool->mem = mem;
+    pool->rng = front->rng;
+    pool->secret_key = front->secret_key;
+
+    for (uint16_t i = 0; i < num_threads; ++i) {
+        if (pthread_create(&pool->threads[i], nullptr, &tcp_handshake_worker, pool) != 0) {
+            LOGGER_ERROR(front->logger, "could not start handshake worker %u", i);
+            tcp_handshake_pool_kill(pool);
+            return nullptr;
+        }
+
+        ++pool->num_threads;
+    }
+
+    return pool;
+}
+
+/** Longest a shard's thread sleeps, so it notices when the server is killed even without a wakeup. */
+#define TCP_SHARD_MAX_WAIT 1000
+
+static void *_Nullable tcp_shard_thread(void *_Nonnull arg)
+{
+    TCP_Server *shard = (TCP_Server *)arg;
+    const TCP_Server *front = shard->front;
+
+    while (atomic_load(&front->running)) {
+        mono_time_update(shard->shard_mono_time);
+        do_tcp_server(shard, shard->shard_mono_time);
+
+        const uint32_t interval = tcp_server_run_interval(shard, shard->shard_mono_time);
+        struct pollfd pfd = {shard->efd, POLLIN, 0};
+        poll(&pfd, 1, interval < TCP_SHARD_MAX_WAIT ? (int)interval : TCP_SHARD_MAX_WAIT);
+    }
+
+    return nullptr;
+}
+
+/** Make @p shard shard number @p shard_id of @p front, ready for messages. */
+static bool tcp_shard_init(TCP_Server *_Nonnull shard, TCP_Server *_Nonnull front, uint16_t shard_id)
+{
+    shard->front = front;
+    shard->shard_id = shard_id;
+
+    if (!tcp_shard_inbox_init(&shard->inbox)) {
+        LOGGER_ERROR(shard->logger, "eventfd for shard %u failed", shard_id);
+        return false;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.u64 = (uint64_t)shard->inbox.wake_fd | ((uint64_t)TCP_SOCKET_INBOX << 32);
+    return epoll_ctl(shard->efd, EPOLL_CTL_ADD, shard->inbox.wake_fd, &ev) == 0;
+}
+
+/** Stop the threads of a sharded server and kill all shards but the first. */
+static void tcp_server_kill_shards(TCP_Server *_Nonnull front)
+{
+    atomic_store(&front->running, false);
+
+    for (uint16_t i = 1; i <= front->num_threads; ++i) {
+        const uint64_t one = 1;
+
+        if (write(front->shards[i]->inbox.wake_fd, &one, sizeof(one)) != sizeof(one)) {
+            // The thread wakes up on its own within TCP_SHARD_MAX_WAIT.
+        }
+    }
+
+    // Shards post to each other, so none can go before all threads have stopped.
+    for (uint16_t i = 1; i <= front->num_threads; ++i) {
+        pthread_join(front->threads[i], nullptr);
+    }
+
+    // Handshake workers post to the shards as well.
+    tcp_handshake_pool_kill(front->handshake_pool);
+
+    for (uint16_t i = 0; i < front->num_shards; ++i) {
+        front->shards[i]->handshake_pool = nullptr;
+    }
+
+    for (uint16_t i = 1; i < front->num_shards; ++i) {
+        // The modules belong to the first shard.
+        front->shards[i]->onion = nullptr;
+        front->shards[i]->forwarding = nullptr;
+        kill_tcp_server(front->shards[i]);
+    }
+
+    mem_delete(front->mem, front->shards);
+    mem_delete(front->mem, front->threads);
+    front->shards = nullptr;
+    front->threads = nullptr;
+    front->num_shards = 0;
+    front->num_threads = 0;
+}
+
+static TCP_Server *_Nullable tcp_server_new_sharded(const Logger *_Nonnull logger, const Memory *_Nonnull mem, const Random *_Nonnull rng, const Network *_Nonnull ns,
+        bool ipv6_enabled, uint16_t num_sockets, const uint16_t *_Nonnull ports,
+        const uint8_t *_Nonnull secret_key, Onion *_Nullable onion, Forwarding *_Nullable forwarding,
+        const TCP_Server_Options *_Nonnull options)
+{
+    const uint16_t num_threads = max_u16(options->num_threads, 1);
+    TCP_Server *front = tcp_server_new_internal(logger, mem, rng, ns, ipv6_enabled, num_sockets, ports, secret_key, true);
+
+    if (front == nullptr) {
+        return nullptr;
+    }
+
+    front->shards = (TCP_Server **)mem_valloc(mem, num_threads, sizeof(TCP_Server *));
+    front->threads = (pthread_t *)mem_valloc(mem, num_threads, sizeof(pthread_t));
+    atomic_store(&front->running, true);
+
+    if (front->shards == nullptr || front->threads == nullptr) {
+        kill_tcp_server(front);
+        return nullptr;
+    }
+
+    front->shards[0] = front;
+    front->num_shards = 1;
+
+    if (!tcp_shard_init(front, front, 0) || !tcp_server_set_handshake_limit(front, options)) {
+        kill_tcp_server(front);
+        return nullptr;
+    }
+
+    for (uint16_t i = 1; i < num_threads; ++i) {
+        TCP_Server *shard = tcp_server_new_internal(logger, mem, rng, ns, ipv6_enabled, num_sockets, ports, secret_key, true);
+
+        if (shard == nullptr) {
+            kill_tcp_server(front);
+            return nullptr;
+        }
+
+        front->shards[i] = shard;
+        ++front->num_shards;
+
+        // Shards pass onion and forward requests to the first one, which runs the modules.
+        shard->onion = onion;
+        shard->forwarding = forwarding;
+        shard->shard_mono_time = mono_time_new(mem, nullptr, nullptr);
+
+        if (shard->shard_mono_time == nullptr || !tcp_shard_init(shard, front, i)
+                || !tcp_server_set_handshake_limit(shard, options)) {
+            kill_tcp_server(front);
+            return nullptr;
+        }
+    }
+
+    if (options->handshake_workers > 0) {
+        front->handshake_pool = tcp_handshake_pool_new(front, options->handshake_workers);
+
+        if (front->handshake_pool == nullptr) {
+            kill_tcp_server(front);
+            return nullptr;
+        }
+
+        // Set before the threads start, so they see it.
+        for (uint16_t i = 1; i < num_threads; ++i) {
+            front->shards[i]->handshake_pool = front->handshake_pool;
         }
     }
+
+    for (uint16_t i = 1; i < num_threads; ++i) {
+        if (pthread_create(&front->threads[i], nullptr, &tcp_shard_thread, front->shards[i]) != 0) {
+            LOGGER_ERROR(logger, "could not start thread for shard %u", i);
+            kill_tcp_server(front);
+            return nullptr;
+        }
+
+        ++front->num_threads;
+    }
+
+    tcp_server_set_modules(front, onion, forwarding);
+    return front;
 }
 #endif /* TCP_SERVER_USE_EPOLL */
 
-static int do_incoming(TCP_Server *_Nonnull tcp_server, uint32_t i)
+void tcp_server_options_default(TCP_Server_Options *options)
 {
-    TCP_Secure_Connection *const conn = &tcp_server->incoming_connection_queue[i];
+    options->num_threads = 1;
+    options->handshake_workers = 0;
+    options->handshake_rate = TCP_HANDSHAKE_RATE_DEFAULT;
+    options->handshake_burst = TCP_HANDSHAKE_BURST_DEFAULT;
+}
 
-    if (conn->status != TCP_STATUS_CONNECTED) {
-        return -1;
+TCP_Server *new_tcp_server_with_options(const Logger *logger, const Memory *mem, const Random *rng, const Network *ns,
+                                        bool ipv6_enabled, uint16_t num_sockets, const uint16_t *ports,
+                                        const uint8_t *secret_key, Onion *onion, Forwarding *forwarding,
+                                        const TCP_Server_Options *options)
+{
+    if (options->num_threads > TCP_SERVER_MAX_THREADS) {
+        LOGGER_ERROR(logger, "too many TCP server threads: %u > %u", options->num_threads, TCP_SERVER_MAX_THREADS);
+        return nullptr;
     }
 
-    LOGGER_TRACE(tcp_server->logger, "handling incoming TCP connection %u", i);
+    if (options->handshake_workers > TCP_SERVER_MAX_HANDSHAKE_WORKERS) {
+        LOGGER_ERROR(logger, "too many TCP handshake workers: %u > %u", options->handshake_workers,
+                     TCP_SERVER_MAX_HANDSHAKE_WORKERS);
+        return nullptr;
+    }
 
-    const int ret = read_connection_handshake(tcp_server->logger, conn, tcp_server->secret_key);
+#ifdef TCP_SERVER_USE_EPOLL
 
-    if (ret == -1) {
-        LOGGER_TRACE(tcp_server->logger, "incoming connection %u dropped due to failed handshake", i);
-        kill_tcp_secure_connection(conn);
-        return -1;
+    if (options->num_threads > 1 || options->handshake_workers > 0) {
+        return tcp_server_new_sharded(logger, mem, rng, ns, ipv6_enabled, num_sockets, ports, secret_key, onion, forwarding,
+                                      options);
+    }
+
+#endif /* TCP_SERVER_USE_EPOLL */
+
+    TCP_Server *temp = tcp_server_new_internal(logger, mem, rng, ns, ipv6_enabled, num_sockets, ports, secret_key, false);
+
+    if (temp == nullptr) {
+        return nullptr;
+    }
+
+    if (!tcp_server_set_handshake_limit(temp, options)) {
+        kill_tcp_server(temp);
+        return nullptr;
+    }
+
+    tcp_server_set_modules(temp, onion, forwarding);
+    return temp;
+}
+
+TCP_Server *new_tcp_server(const Logger *logger, const Memory *mem, const Random *rng, const Network *ns,
+                           bool ipv6_enabled, uint16_t num_sockets,
+                           const uint16_t *ports, const uint8_t *secret_key, Onion *onion, Forwarding *forwarding)
+{
+    TCP_Server_Options options;
+    tcp_server_options_default(&options);
+    return new_tcp_server_with_options(logger, mem, rng, ns, ipv6_enabled, num_sockets, ports, secret_key, onion, forwarding,
+                                       &options);
+}
+
+#ifndef TCP_SERVER_USE_EPOLL
+static void do_tcp_accept_new(TCP_Server *_Nonnull tcp_server, const Mono_Time *_Nonnull mono_time)
+{
+    for (uint32_t sock_idx = 0; sock_idx < tcp_server->num_listening_socks; ++sock_idx) {
+
+        for (uint32_t connection_idx = 0; connection_idx < MAX_INCOMING_CONNECTIONS; ++connection_idx) {
+            if (!can_accept_connection(tcp_server, mono_time)) {
+                return;
+            }
+
+            const Socket sock = net_accept(tcp_server->ns, tcp_server->socks_listening[sock_idx]);
+
+            if (!sock_valid(sock)) {
+                break;
+            }
+
+            accept_connection(tcp_server, mono_time, sock);
+        }
     }
+}
+#endif /* TCP_SERVER_USE_EPOLL */
 
-    if (ret != 1) {
+/** @brief Move incoming connection @p i, whose handshake we answered, to the unconfirmed ones.
+ *
+ * @return its index there, or -1 if there was no room.
+ */
+static int move_to_unconfirmed(TCP_Server *_Nonnull tcp_server, const Mono_Time *_Nonnull mono_time, uint32_t i)
+{
+    TCP_Secure_Connection *conn_old = &tcp_server->incoming_connection_queue[i];
+    const int index_new = find_handshake_slot(tcp_server->unconfirmed_connection_queue, tcp_server->unconfirmed_connection_queue_index,
+                          mono_time_get(mono_time));
+
+    if (index_new == -1) {
+        LOGGER_DEBUG(tcp_server->logger, "incoming connection %u dropped: no room for unconfirmed connections", i);
+        tcp_counter_increment(&tcp_server->handshake_counters.failed);
+        kill_tcp_secure_connection(conn_old);
         return -1;
     }
 
-    const int index_new = tcp_server->unconfirmed_connection_queue_index % MAX_INCOMING_CONNECTIONS;
-    TCP_Secure_Connection *conn_old = conn;
     TCP_Secure_Connection *conn_new = &tcp_server->unconfirmed_connection_queue[index_new];
 
     if (conn_new->status != TCP_STATUS_NO_STATUS) {
-        LOGGER_ERROR(tcp_server->logger, "incoming connection %u would overwrite existing", i);
+        LOGGER_DEBUG(tcp_server->logger, "unconfirmed connection %d timed out", index_new);
+        tcp_counter_increment(&tcp_server->handshake_counters.failed);
         kill_tcp_secure_connection(conn_new);
     }
 
     move_secure_connection(conn_new, conn_old);
-    ++tcp_server->unconfirmed_connection_queue_index;
+    tcp_server->unconfirmed_connection_queue_index = (uint16_t)(index_new + 1);
+    tcp_counter_increment(&tcp_server->handshake_counters.accepted);
 
     return index_new;
 }
 
+/** @brief Read the handshake of incoming connection @p i, if it's there.
+ *
+ * With handshake workers, the handshake goes to them and the connection
+ * waits for the result.
+ *
+ * @return the index of the connection among the unconfirmed ones, or -1 if
+ *   it isn't unconfirmed (yet).
+ */
+static int do_incoming(TCP_Server *_Nonnull tcp_server, const Mono_Time *_Nonnull mono_time, uint32_t i)
+{
+    TCP_Secure_Connection *const conn = &tcp_server->incoming_connection_queue[i];
+
+    if (conn->status != TCP_STATUS_CONNECTED) {
+        return -1;
+    }
+
+    LOGGER_TRACE(tcp_server->logger, "handling incoming TCP connection %u", i);
+
+    uint8_t data[TCP_CLIENT_HANDSHAKE_SIZE];
+    const int len = read_tcp_packet(tcp_server->logger, conn->con.mem, conn->con.ns, conn->con.sock, data, sizeof(data), &conn->con.ip_port);
+
+    if (len == -1) {
+        LOGGER_TRACE(tcp_server->logger, "connection handshake is not ready yet");
+        return -1;
+    }
+
+#ifdef TCP_SERVER_USE_EPOLL
+
+    if (tcp_server->handshake_pool != nullptr) {
+        if (!tcp_handshake_submit(tcp_server, i, data)) {
+            LOGGER_DEBUG(tcp_server->logger, "incoming connection %u dropped: too many handshakes queued", i);
+            tcp_counter_increment(&tcp_server->handshake_counters.rejected);
+            kill_tcp_secure_connection(conn);
+        }
+
+        return -1;
+    }
+
+#endif /* TCP_SERVER_USE_EPOLL */
+
+    if (handle_tcp_handshake(tcp_server->logger, conn, data, len, tcp_server->secret_key) == -1) {
+        LOGGER_TRACE(tcp_server->logger, "incoming connection %u dropped due to failed handshake", i);
+        tcp_counter_increment(&tcp_server->handshake_counters.failed);
+        kill_tcp_secure_connection(conn);
+        return -1;
+    }
+
+    return move_to_unconfirmed(tcp_server, mono_time, i);
+}
+
 static int do_unconfirmed(TCP_Server *_Nonnull tcp_server, const Mono_Time *_Nonnull mono_time, uint32_t i)
 {
     TCP_Secure_Connection *const conn = &tcp_server->unconfirmed_connection_queue[i];
@@ -1100,128 +2574,507 @@ static int do_unconfirmed(TCP_Server *_Nonnull tcp_server, const Mono_Time *_Non
     LOGGER_TRACE(tcp_server->logger, "handling unconfirmed TCP connection %u", i);
 
     uint8_t packet[MAX_PACKET_SIZE];
-    const int len = read_packet_tcp_secure_connection(tcp_server->logger, conn->con.mem, conn->con.ns, conn->con.sock, &conn->next_packet_length, conn->con.shared_key, conn->recv_nonce, packet,
-                    sizeof(packet), &conn->con.ip_port);
+    const int len = read_packet_tcp_secure_connection(tcp_server->logger, &conn->con, conn->recv_nonce, packet, sizeof(packet),
+                    &conn->con.ip_port);
 
     if (len == 0) {
         return -1;
     }
 
-    if (len == -1) {
-        kill_tcp_secure_connection(conn);
-        return -1;
+    if (len == -1) {
+        kill_tcp_secure_connection(conn);
+        return -1;
+    }
+
+    return confirm_tcp_connection(tcp_server, mono_time, conn, packet, len);
+}
+
+static bool tcp_process_secure_packet(TCP_Server *_Nonnull tcp_server, uint32_t i)
+{
+    TCP_Secure_Connection *const conn = &tcp_server->accepted_connection_array[i];
+
+    uint8_t *packet = nullptr;
+    const int len = read_packet_tcp_secure_connection_in_place(tcp_server->logger, &conn->con, conn->recv_nonce, &packet,
+                    &conn->con.ip_port);
+    LOGGER_TRACE(tcp_server->logger, "processing packet for %u: %d", i, len);
+
+    if (len == 0) {
+        return false;
+    }
+
+    if (len == -1) {
+        kill_accepted(tcp_server, i, TCP_KILL_CLOSED);
+        return false;
+    }
+
+    if (handle_tcp_packet(tcp_server, i, packet, len) == -1) {
+        LOGGER_TRACE(tcp_server->logger, "dropping connection %u: data packet (len=%d) not handled", i, len);
+        kill_accepted(tcp_server, i, TCP_KILL_INVALID);
+        return false;
+    }
+
+    return true;
+}
+
+static void do_confirmed_recv(TCP_Server *_Nonnull tcp_server, uint32_t i)
+{
+    while (tcp_process_secure_packet(tcp_server, i)) {
+        /* Keep reading until an error occurs or there is no more data to read. */
+    }
+}
+
+#ifndef TCP_SERVER_USE_EPOLL
+static void do_tcp_incoming(TCP_Server *_Nonnull tcp_server, const Mono_Time *_Nonnull mono_time)
+{
+    for (uint32_t i = 0; i < MAX_INCOMING_CONNECTIONS; ++i) {
+        do_incoming(tcp_server, mono_time, i);
+    }
+}
+
+static void do_tcp_unconfirmed(TCP_Server *_Nonnull tcp_server, const Mono_Time *_Nonnull mono_time)
+{
+    for (uint32_t i = 0; i < MAX_INCOMING_CONNECTIONS; ++i) {
+        do_unconfirmed(tcp_server, mono_time, i);
+    }
+}
+#endif /* TCP_SERVER_USE_EPOLL */
+
+/** @brief Ping confirmed connection @p i if it is due, and kill it if it stopped answering.
+ *
+ * @retval false if the connection was killed.
+ */
+static bool do_confirmed_ping(TCP_Server *_Nonnull tcp_server, const Mono_Time *_Nonnull mono_time, uint32_t i)
+{
+    TCP_Secure_Connection *conn = &tcp_server->accepted_connection_array[i];
+
+    if (mono_time_is_timeout(mono_time, conn->last_pinged, TCP_PING_FREQUENCY)) {
+        uint8_t ping[1 + sizeof(uint64_t)];
+        ping[0] = TCP_PACKET_PING;
+        uint64_t ping_id = random_u64(conn->con.rng);
+
+        if (ping_id == 0) {
+            ++ping_id;
+        }
+
+        memcpy(ping + 1, &ping_id, sizeof(uint64_t));
+        const int ret = write_packet_tcp_secure_connection(tcp_server->logger, &conn->con, ping, sizeof(ping), true);
+
+        if (ret == 1) {
+            conn->last_pinged = mono_time_get(mono_time);
+            conn->ping_id = ping_id;
+        } else {
+            if (mono_time_is_timeout(mono_time, conn->last_pinged, TCP_PING_FREQUENCY + TCP_PING_TIMEOUT)) {
+                kill_accepted(tcp_server, i, TCP_KILL_TIMEOUT);
+                return false;
+            }
+        }
+    }
+
+    if (conn->ping_id != 0 && mono_time_is_timeout(mono_time, conn->last_pinged, TCP_PING_TIMEOUT)) {
+        kill_accepted(tcp_server, i, TCP_KILL_TIMEOUT);
+        return false;
+    }
+
+    return true;
+}
+
+#ifdef TCP_SERVER_USE_EPOLL
+/** @brief Set the timer of confirmed connection @p i.
+ *
+ * It goes off at the next ping or ping timeout, or within a second if the
+ * connection has buffers that may become idle.
+ */
+static void schedule_confirmed_timer(TCP_Server *_Nonnull tcp_server, const Mono_Time *_Nonnull mono_time, uint32_t i)
+{
+    const TCP_Secure_Connection *conn = &tcp_server->accepted_connection_array[i];
+    const uint64_t now = mono_time_get_ms(mono_time);
+    const uint64_t timeout = conn->ping_id != 0 ? TCP_PING_TIMEOUT : TCP_PING_FREQUENCY;
+    uint64_t deadline = (conn->last_pinged + timeout) * 1000;
+
+    if (conn->con.in_buffer != nullptr || conn->con.out_buffer != nullptr || deadline <= now) {
+        // Release the buffers, or retry a ping that couldn't be queued, in a second.
+        deadline = min_u64(deadline, now + 1000);
+        deadline = max_u64(deadline, now + 1);
+    }
+
+    timer_wheel_set(tcp_server->timers, i, deadline);
+}
+
+/** Look at connection @p i again within a second, when its buffers may have become idle. */
+static void schedule_buffer_release(TCP_Server *_Nonnull tcp_server, const Mono_Time *_Nonnull mono_time, uint32_t i)
+{
+    if (i < tcp_server->size_accepted_connections
+            && tcp_server->accepted_connection_array[i].status == TCP_STATUS_CONFIRMED) {
+        timer_wheel_set_earlier(tcp_server->timers, i, mono_time_get_ms(mono_time) + 1000);
+    }
+}
+
+/** Handle the confirmed connections whose timer went off. */
+static void do_tcp_confirmed(TCP_Server *_Nonnull tcp_server, const Mono_Time *_Nonnull mono_time)
+{
+    timer_wheel_advance(tcp_server->timers, mono_time_get_ms(mono_time));
+
+    uint32_t i;
+
+    while (timer_wheel_pop(tcp_server->timers, &i)) {
+        if (i >= tcp_server->size_accepted_connections
+                || tcp_server->accepted_connection_array[i].status != TCP_STATUS_CONFIRMED) {
+            continue;
+        }
+
+        if (!do_confirmed_ping(tcp_server, mono_time, i)) {
+            continue;
+        }
+
+        // Most connections on a relay are idle most of the time.
+        release_idle_buffers(&tcp_server->accepted_connection_array[i].con);
+        schedule_confirmed_timer(tcp_server, mono_time, i);
+    }
+}
+#else
+static void do_tcp_confirmed(TCP_Server *_Nonnull tcp_server, const Mono_Time *_Nonnull mono_time)
+{
+    const bool new_second = tcp_server->last_run_pinged != mono_time_get(mono_time);
+    tcp_server->last_run_pinged = mono_time_get(mono_time);
+
+    for (uint32_t i = 0; i < tcp_server->size_accepted_connections; ++i) {
+        TCP_Secure_Connection *conn = &tcp_server->accepted_connection_array[i];
+
+        if (conn->status != TCP_STATUS_CONFIRMED) {
+            continue;
+        }
+
+        if (!do_confirmed_ping(tcp_server, mono_time, i)) {
+            continue;
+        }
+
+        send_pending_data(tcp_server->logger, &conn->con);
+        update_send_gauges(tcp_server, conn);
+        do_confirmed_recv(tcp_server, i);
+
+        if (conn->status != TCP_STATUS_CONFIRMED) {
+            continue;
+        }
+
+        if (new_second) {
+            // Most connections on a relay are idle most of the time.
+            release_idle_buffers(&conn->con);
+        }
+    }
+}
+#endif /* TCP_SERVER_USE_EPOLL */
+
+#ifdef TCP_SERVER_USE_EPOLL
+/** The connection a shard message is addressed to, if it's still there. */
+static TCP_Secure_Connection *_Nullable tcp_shard_msg_connection(TCP_Server *_Nonnull tcp_server, const TCP_Shard_Msg *_Nonnull msg)
+{
+    if (msg->index >= tcp_server->size_accepted_connections) {
+        return nullptr;
+    }
+
+    TCP_Secure_Connection *con = &tcp_server->accepted_connection_array[msg->index];
+
+    if (con->status != TCP_STATUS_CONFIRMED || con->identifier != msg->identifier) {
+        return nullptr;
+    }
+
+    return con;
+}
+
+/** The slot a route message was sent from, as it is linked on our side. */
+static TCP_Secure_Conn tcp_shard_msg_link(const TCP_Shard_Msg *_Nonnull msg)
+{
+    TCP_Secure_Conn link = {{0}};
+    link.status = 2;
+    link.index = msg->from_index;
+    link.other_id = msg->from_slot;
+    link.shard = msg->from_shard;
+    link.identifier = msg->from_identifier;
+    memcpy(link.public_key, msg->public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    return link;
+}
+
+static bool tcp_shard_same_link(const TCP_Secure_Conn *_Nonnull a, const TCP_Secure_Conn *_Nonnull b)
+{
+    return a->status == 2 && a->index == b->index && a->other_id == b->other_id
+           && a->shard == b->shard && a->identifier == b->identifier;
+}
+
+static void tcp_shard_handle_msg(TCP_Server *_Nonnull tcp_server, const TCP_Shard_Msg *_Nonnull msg)
+{
+    switch (msg->type) {
+        case TCP_SHARD_MSG_CONNECTED: {
+            const int index = get_tcp_connection_index(tcp_server, msg->public_key);
+
+            if (index != -1 && tcp_server->accepted_connection_array[index].identifier < msg->identifier) {
+                kill_accepted(tcp_server, index, TCP_KILL_REPLACED);
+            }
+
+            break;
+        }
+
+        case TCP_SHARD_MSG_ROUTE: {
+            const int index = get_tcp_connection_index(tcp_server, msg->peer_key);
+
+            if (index == -1) {
+                break;
+            }
+
+            TCP_Secure_Connection *con = &tcp_server->accepted_connection_array[index];
+
+            for (uint32_t i = 0; i < con->connections_size; ++i) {
+                TCP_Secure_Conn *conn = &con->connections[i];
+
+                if (conn->status != 1 || !pk_equal(conn->public_key, msg->public_key)) {
+                    continue;
+                }
+
+                // The peer asked for the requester first: link both ends.
+                *conn = tcp_shard_msg_link(msg);
+                send_connect_notification(tcp_server->logger, con, i);
+                tcp_shard_post_route(tcp_server, TCP_SHARD_MSG_LINKED, conn, index, con->identifier, i, con->public_key);
+                break;
+            }
+
+            break;
+        }
+
+        case TCP_SHARD_MSG_LINKED: {
+            TCP_Secure_Connection *con = tcp_shard_msg_connection(tcp_server, msg);
+            const TCP_Secure_Conn link = tcp_shard_msg_link(msg);
+
+            if (con != nullptr && msg->slot < con->connections_size) {
+                TCP_Secure_Conn *conn = &con->connections[msg->slot];
+
+                if (conn->status == 1 && pk_equal(conn->public_key, msg->public_key)) {
+                    *conn = link;
+                    send_connect_notification(tcp_server->logger, con, msg->slot);
+                    break;
+                }
+
+                if (tcp_shard_same_link(conn, &link)) {
+                    // Both ends asked at the same time and linked each other.
+                    break;
+                }
+            }
+
+            // Our end is gone or already linked elsewhere.
+            tcp_shard_post_route(tcp_server, TCP_SHARD_MSG_UNLINK, &link, msg->index, msg->identifier, msg->slot,
+                                 msg->peer_key);
+            break;
+        }
+
+        case TCP_SHARD_MSG_UNLINK: {
+            TCP_Secure_Connection *con = tcp_shard_msg_connection(tcp_server, msg);
+            const TCP_Secure_Conn link = tcp_shard_msg_link(msg);
+
+            if (con == nullptr || msg->slot >= con->connections_size
+                    || !tcp_shard_same_link(&con->connections[msg->slot], &link)) {
+                break;
+            }
+
+            TCP_Secure_Conn *conn = &con->connections[msg->slot];
+            conn->status = 1;
+            conn->index = 0;
+            conn->other_id = 0;
+            conn->shard = 0;
+            conn->identifier = 0;
+            send_disconnect_notification(tcp_server->logger, con, msg->slot);
+            break;
+        }
+
+        case TCP_SHARD_MSG_SEND: {
+            TCP_Secure_Connection *con = tcp_shard_msg_connection(tcp_server, msg);
+
+            if (con == nullptr) {
+                break;
+            }
+
+            if (msg->data[0] >= NUM_RESERVED_PORTS) {
+                write_routed_packet(tcp_server, &con->con, msg->data, msg->length);
+            } else {
+                write_packet_tcp_secure_connection(tcp_server->logger, &con->con, msg->data, msg->length, false);
+            }
+
+            break;
+        }
+
+        case TCP_SHARD_MSG_OOB: {
+            const int index = get_tcp_connection_index(tcp_server, msg->peer_key);
+
+            if (index != -1) {
+                write_packet_tcp_secure_connection(tcp_server->logger, &tcp_server->accepted_connection_array[index].con,
+                                                   msg->data, msg->length, false);
+            }
+
+            break;
+        }
+
+        case TCP_SHARD_MSG_ONION_REQUEST: {
+            if (tcp_server->onion != nullptr && msg->length > CRYPTO_NONCE_SIZE) {
+                onion_send_1(tcp_server->onion, msg->data + CRYPTO_NONCE_SIZE, msg->length - CRYPTO_NONCE_SIZE,
+                             &msg->ip_port, msg->data);
+            }
+
+            break;
+        }
+
+        case TCP_SHARD_MSG_FORWARD_REQUEST: {
+            const uint16_t sendback_data_len = 1 + sizeof(uint32_t) + sizeof(uint64_t);
+
+            if (tcp_server->forwarding != nullptr && msg->length >= sendback_data_len) {
+                send_forwarding(tcp_server->forwarding, &msg->ip_port, msg->data, sendback_data_len,
+                                msg->data + sendback_data_len, msg->length - sendback_data_len);
+            }
+
+            break;
+        }
+
+        case TCP_SHARD_MSG_HANDSHAKE: {
+            // Handled by `tcp_handshake_done`.
+            break;
+        }
+    }
+}
+
+/** @brief Watch unconfirmed connection @p index for its first packet.
+ *
+ * Data that arrived while the handshake was answered is reported right away.
+ */
+static void tcp_epoll_watch_unconfirmed(TCP_Server *_Nonnull tcp_server, int index)
+{
+    const Socket sock = tcp_server->unconfirmed_connection_queue[index].con.sock;
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
+    ev.data.u64 = net_socket_to_native(sock) | ((uint64_t)TCP_SOCKET_UNCONFIRMED << 32) | ((uint64_t)index << 40);
+
+    if (epoll_ctl(tcp_server->efd, EPOLL_CTL_MOD, net_socket_to_native(sock), &ev) == -1) {
+        LOGGER_DEBUG(tcp_server->logger, "unconfirmed connection %d was dropped due to epoll error %d", index, net_error());
+        kill_tcp_secure_connection(&tcp_server->unconfirmed_connection_queue[index]);
     }
-
-    return confirm_tcp_connection(tcp_server, mono_time, conn, packet, len);
 }
 
-static bool tcp_process_secure_packet(TCP_Server *_Nonnull tcp_server, uint32_t i)
+/** Answer the handshake a worker verified, if its connection is still there. */
+static void tcp_handshake_done(TCP_Server *_Nonnull tcp_server, const Mono_Time *_Nonnull mono_time, const TCP_Shard_Msg *_Nonnull msg)
 {
-    TCP_Secure_Connection *const conn = &tcp_server->accepted_connection_array[i];
+    TCP_Secure_Connection *conn = &tcp_server->incoming_connection_queue[msg->index];
 
-    uint8_t packet[MAX_PACKET_SIZE];
-    const int len = read_packet_tcp_secure_connection(tcp_server->logger, conn->con.mem, conn->con.ns, conn->con.sock, &conn->next_packet_length, conn->con.shared_key, conn->recv_nonce, packet,
-                    sizeof(packet), &conn->con.ip_port);
-    LOGGER_TRACE(tcp_server->logger, "processing packet for %u: %d", i, len);
-
-    if (len == 0) {
-        return false;
+    if (conn->status != TCP_STATUS_HANDSHAKING || conn->identifier != msg->identifier) {
+        // The connection went away while its handshake was verified.
+        return;
     }
 
-    if (len == -1) {
-        kill_accepted(tcp_server, i);
-        return false;
-    }
+    conn->status = TCP_STATUS_CONNECTED;
 
-    if (handle_tcp_packet(tcp_server, i, packet, len) == -1) {
-        LOGGER_TRACE(tcp_server->logger, "dropping connection %u: data packet (len=%d) not handled", i, len);
-        kill_accepted(tcp_server, i);
-        return false;
+    if (msg->length != sizeof(TCP_Handshake_Result)
+            || answer_tcp_handshake(tcp_server->logger, conn, (const TCP_Handshake_Result *)msg->data) == -1) {
+        LOGGER_TRACE(tcp_server->logger, "incoming connection %u dropped due to failed handshake", msg->index);
+        tcp_counter_increment(&tcp_server->handshake_counters.failed);
+        kill_tcp_secure_connection(conn);
+        return;
     }
 
-    return true;
-}
+    const int index_new = move_to_unconfirmed(tcp_server, mono_time, msg->index);
 
-static void do_confirmed_recv(TCP_Server *_Nonnull tcp_server, uint32_t i)
-{
-    while (tcp_process_secure_packet(tcp_server, i)) {
-        /* Keep reading until an error occurs or there is no more data to read. */
+    if (index_new != -1) {
+        tcp_epoll_watch_unconfirmed(tcp_server, index_new);
     }
 }
 
-#ifndef TCP_SERVER_USE_EPOLL
-static void do_tcp_incoming(TCP_Server *_Nonnull tcp_server)
+/** Handle the messages other shards and the handshake workers posted to us. */
+static void tcp_shard_drain(TCP_Server *_Nonnull tcp_server, const Mono_Time *_Nonnull mono_time)
 {
-    for (uint32_t i = 0; i < MAX_INCOMING_CONNECTIONS; ++i) {
-        do_incoming(tcp_server, i);
+    TCP_Shard_Inbox *const inbox = &tcp_server->inbox;
+
+    // Producers that push from now on wake us again.
+    atomic_store(&inbox->wake_pending, false);
+
+    uint64_t count;
+
+    if (read(inbox->wake_fd, &count, sizeof(count)) != sizeof(count)) {
+        // Nothing to read if another drain already took the wakeup.
     }
-}
 
-static void do_tcp_unconfirmed(TCP_Server *_Nonnull tcp_server, const Mono_Time *_Nonnull mono_time)
-{
-    for (uint32_t i = 0; i < MAX_INCOMING_CONNECTIONS; ++i) {
-        do_unconfirmed(tcp_server, mono_time, i);
+    TCP_Shard_Msg *msg;
+
+    while ((msg = tcp_shard_inbox_pop(inbox)) != nullptr) {
+        if (msg->type == TCP_SHARD_MSG_HANDSHAKE) {
+            tcp_handshake_done(tcp_server, mono_time, msg);
+            crypto_memzero(msg->data, msg->length);
+        } else {
+            tcp_shard_handle_msg(tcp_server, msg);
+        }
+
+        mem_delete(tcp_server->mem, msg);
     }
 }
-#endif /* TCP_SERVER_USE_EPOLL */
 
-static void do_tcp_confirmed(TCP_Server *_Nonnull tcp_server, const Mono_Time *_Nonnull mono_time)
+/** @brief Accept the connections waiting on listening socket @p sock, while there is room for them.
+ *
+ * @return the number of connections accepted.
+ */
+static uint32_t tcp_epoll_accept(TCP_Server *_Nonnull tcp_server, const Mono_Time *_Nonnull mono_time, Socket sock)
 {
-#ifdef TCP_SERVER_USE_EPOLL
+    uint32_t accepted = 0;
 
-    if (tcp_server->last_run_pinged == mono_time_get(mono_time)) {
-        return;
-    }
+    while (true) {
+        // The listening socket is edge-triggered, so we have to come back to
+        // it ourselves once there is room.
+        if (!can_accept_connection(tcp_server, mono_time)) {
+            tcp_server->accept_blocked = true;
+            break;
+        }
 
-    tcp_server->last_run_pinged = mono_time_get(mono_time);
-#endif /* TCP_SERVER_USE_EPOLL */
+        const Socket sock_new = net_accept(tcp_server->ns, sock);
 
-    for (uint32_t i = 0; i < tcp_server->size_accepted_connections; ++i) {
-        TCP_Secure_Connection *conn = &tcp_server->accepted_connection_array[i];
+        if (!sock_valid(sock_new)) {
+            break;
+        }
 
-        if (conn->status != TCP_STATUS_CONFIRMED) {
+        const int index_new = accept_connection(tcp_server, mono_time, sock_new);
+
+        if (index_new == -1) {
             continue;
         }
 
-        if (mono_time_is_timeout(mono_time, conn->last_pinged, TCP_PING_FREQUENCY)) {
-            uint8_t ping[1 + sizeof(uint64_t)];
-            ping[0] = TCP_PACKET_PING;
-            uint64_t ping_id = random_u64(conn->con.rng);
-
-            if (ping_id == 0) {
-                ++ping_id;
-            }
+        struct epoll_event ev;
 
-            memcpy(ping + 1, &ping_id, sizeof(uint64_t));
-            const int ret = write_packet_tcp_secure_connection(tcp_server->logger, &conn->con, ping, sizeof(ping), true);
+        ev.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
 
-            if (ret == 1) {
-                conn->last_pinged = mono_time_get(mono_time);
-                conn->ping_id = ping_id;
-            } else {
-                if (mono_time_is_timeout(mono_time, conn->last_pinged, TCP_PING_FREQUENCY + TCP_PING_TIMEOUT)) {
-                    kill_accepted(tcp_server, i);
-                    continue;
-                }
-            }
-        }
+        ev.data.u64 = net_socket_to_native(sock_new) | ((uint64_t)TCP_SOCKET_INCOMING << 32) | ((uint64_t)index_new << 40);
 
-        if (conn->ping_id != 0 && mono_time_is_timeout(mono_time, conn->last_pinged, TCP_PING_TIMEOUT)) {
-            kill_accepted(tcp_server, i);
+        if (epoll_ctl(tcp_server->efd, EPOLL_CTL_ADD, net_socket_to_native(sock_new), &ev) == -1) {
+            LOGGER_DEBUG(tcp_server->logger, "new connection %d was dropped due to epoll error %d", index_new, net_error());
+            kill_tcp_secure_connection(&tcp_server->incoming_connection_queue[index_new]);
             continue;
         }
 
-        send_pending_data(tcp_server->logger, &conn->con);
+        ++accepted;
+    }
 
-#ifndef TCP_SERVER_USE_EPOLL
+    return accepted;
+}
 
-        do_confirmed_recv(tcp_server, i);
+/** @brief Accept the connections left waiting for lack of room, if there is room now.
+ *
+ * @retval true if any were accepted.
+ */
+static bool tcp_epoll_accept_blocked(TCP_Server *_Nonnull tcp_server, const Mono_Time *_Nonnull mono_time)
+{
+    if (!tcp_server->accept_blocked || !can_accept_connection(tcp_server, mono_time)) {
+        return false;
+    }
 
-#endif /* TCP_SERVER_USE_EPOLL */
+    tcp_server->accept_blocked = false;
+    uint32_t accepted = 0;
+
+    for (uint32_t i = 0; i < tcp_server->num_listening_socks; ++i) {
+        accepted += tcp_epoll_accept(tcp_server, mono_time, tcp_server->socks_listening[i]);
     }
+
+    return accepted > 0;
 }
 
-#ifdef TCP_SERVER_USE_EPOLL
 static bool tcp_epoll_process(TCP_Server *_Nonnull tcp_server, const Mono_Time *_Nonnull mono_time)
 {
 #define MAX_EVENTS 16
@@ -1256,7 +3109,7 @@ static bool tcp_epoll_process(TCP_Server *_Nonnull tcp_server, const Mono_Time *
 
                 case TCP_SOCKET_CONFIRMED: {
                     LOGGER_TRACE(tcp_server->logger, "confirmed connection %d dropped", index);
-                    kill_accepted(tcp_server, index);
+                    kill_accepted(tcp_server, index, TCP_KILL_CLOSED);
                     break;
                 }
             }
@@ -1264,6 +3117,13 @@ static bool tcp_epoll_process(TCP_Server *_Nonnull tcp_server, const Mono_Time *
             continue;
         }
 
+        if ((events[n].events & EPOLLOUT) != 0 && status == TCP_SOCKET_CONFIRMED
+                && (uint32_t)index < tcp_server->size_accepted_connections) {
+            // The socket has room again for data that didn't fit before.
+            send_pending_data(tcp_server->logger, &tcp_server->accepted_connection_array[index].con);
+            update_send_gauges(tcp_server, &tcp_server->accepted_connection_array[index]);
+        }
+
         if ((events[n].events & EPOLLIN) == 0) {
             continue;
         }
@@ -1271,48 +3131,16 @@ static bool tcp_epoll_process(TCP_Server *_Nonnull tcp_server, const Mono_Time *
         switch (status) {
             case TCP_SOCKET_LISTENING: {
                 // socket is from socks_listening, accept connection
-                while (true) {
-                    const Socket sock_new = net_accept(tcp_server->ns, sock);
-
-                    if (!sock_valid(sock_new)) {
-                        break;
-                    }
-
-                    const int index_new = accept_connection(tcp_server, sock_new);
-
-                    if (index_new == -1) {
-                        continue;
-                    }
-
-                    struct epoll_event ev;
-
-                    ev.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
-
-                    ev.data.u64 = net_socket_to_native(sock_new) | ((uint64_t)TCP_SOCKET_INCOMING << 32) | ((uint64_t)index_new << 40);
-
-                    if (epoll_ctl(tcp_server->efd, EPOLL_CTL_ADD, net_socket_to_native(sock_new), &ev) == -1) {
-                        LOGGER_DEBUG(tcp_server->logger, "new connection %d was dropped due to epoll error %d", index, net_error());
-                        kill_tcp_secure_connection(&tcp_server->incoming_connection_queue[index_new]);
-                        continue;
-                    }
-                }
-
+                tcp_epoll_accept(tcp_server, mono_time, sock);
                 break;
             }
 
             case TCP_SOCKET_INCOMING: {
-                const int index_new = do_incoming(tcp_server, index);
+                const int index_new = do_incoming(tcp_server, mono_time, index);
 
                 if (index_new != -1) {
                     LOGGER_TRACE(tcp_server->logger, "incoming connection %d was accepted as %d", index, index_new);
-                    events[n].events = EPOLLIN | EPOLLET | EPOLLRDHUP;
-                    events[n].data.u64 = net_socket_to_native(sock) | ((uint64_t)TCP_SOCKET_UNCONFIRMED << 32) | ((uint64_t)index_new << 40);
-
-                    if (epoll_ctl(tcp_server->efd, EPOLL_CTL_MOD, net_socket_to_native(sock), &events[n]) == -1) {
-                        LOGGER_DEBUG(tcp_server->logger, "incoming connection %d was dropped due to epoll error %d", index, net_error());
-                        kill_tcp_secure_connection(&tcp_server->unconfirmed_connection_queue[index_new]);
-                        break;
-                    }
+                    tcp_epoll_watch_unconfirmed(tcp_server, index_new);
                 }
 
                 break;
@@ -1323,15 +3151,21 @@ static bool tcp_epoll_process(TCP_Server *_Nonnull tcp_server, const Mono_Time *
 
                 if (index_new != -1) {
                     LOGGER_TRACE(tcp_server->logger, "unconfirmed connection %d was confirmed as %d", index, index_new);
-                    events[n].events = EPOLLIN | EPOLLET | EPOLLRDHUP;
+                    // Edge-triggered EPOLLOUT only fires once a full send buffer has room again.
+                    events[n].events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP;
                     events[n].data.u64 = net_socket_to_native(sock) | ((uint64_t)TCP_SOCKET_CONFIRMED << 32) | ((uint64_t)index_new << 40);
 
                     if (epoll_ctl(tcp_server->efd, EPOLL_CTL_MOD, net_socket_to_native(sock), &events[n]) == -1) {
                         // remove from confirmed connections
                         LOGGER_DEBUG(tcp_server->logger, "unconfirmed connection %d was dropped due to epoll error %d", index, net_error());
-                        kill_accepted(tcp_server, index_new);
+                        kill_accepted(tcp_server, index_new, TCP_KILL_ERROR);
                         break;
                     }
+
+                    // Packets received together with the confirmation are
+                    // already in the input buffer and won't trigger an event.
+                    do_confirmed_recv(tcp_server, index_new);
+                    schedule_buffer_release(tcp_server, mono_time, index_new);
                 }
 
                 break;
@@ -1339,6 +3173,12 @@ static bool tcp_epoll_process(TCP_Server *_Nonnull tcp_server, const Mono_Time *
 
             case TCP_SOCKET_CONFIRMED: {
                 do_confirmed_recv(tcp_server, index);
+                schedule_buffer_release(tcp_server, mono_time, index);
+                break;
+            }
+
+            case TCP_SOCKET_INBOX: {
+                tcp_shard_drain(tcp_server, mono_time);
                 break;
             }
         }
@@ -1349,25 +3189,196 @@ static bool tcp_epoll_process(TCP_Server *_Nonnull tcp_server, const Mono_Time *
 
 static void do_tcp_epoll(TCP_Server *_Nonnull tcp_server, const Mono_Time *_Nonnull mono_time)
 {
-    while (tcp_epoll_process(tcp_server, mono_time)) {
-        // Keep processing packets until there are no more FDs ready for reading.
-        continue;
-    }
+    do {
+        while (tcp_epoll_process(tcp_server, mono_time)) {
+            // Keep processing packets until there are no more FDs ready for reading.
+            continue;
+        }
+    } while (tcp_epoll_accept_blocked(tcp_server, mono_time));
 }
 #endif /* TCP_SERVER_USE_EPOLL */
 
+/** Send the packets queued on accepted connections while handling the last events. */
+static void do_tcp_flush(TCP_Server *_Nonnull tcp_server, const Mono_Time *_Nonnull mono_time)
+{
+    TCP_Flush_List *const list = &tcp_server->flush_list;
+
+    for (uint32_t i = 0; i < list->length; ++i) {
+        const uint32_t index = list->ids[i];
+
+        if (index >= tcp_server->size_accepted_connections) {
+            continue;
+        }
+
+        TCP_Secure_Connection *conn = &tcp_server->accepted_connection_array[index];
+
+        // The connection may have been killed (and the slot reused) since.
+        if (conn->status != TCP_STATUS_CONFIRMED || !conn->con.flush_queued) {
+            continue;
+        }
+
+        conn->con.flush_queued = false;
+        send_pending_data(tcp_server->logger, &conn->con);
+        update_send_gauges(tcp_server, conn);
+
+#ifdef TCP_SERVER_USE_EPOLL
+        schedule_buffer_release(tcp_server, mono_time, index);
+#endif /* TCP_SERVER_USE_EPOLL */
+    }
+
+    list->length = 0;
+}
+
+/** @brief Take the gauges of `tcp_server_get_stats` that aren't kept up to date, once a second.
+ *
+ * This only looks at the handshake queues, which have a fixed size, so it
+ * costs the same no matter how many clients are connected.
+ */
+static void take_gauges(TCP_Server *_Nonnull tcp_server, const Mono_Time *_Nonnull mono_time)
+{
+    const uint64_t now = mono_time_get(mono_time);
+
+    if (tcp_server->gauges_taken == now) {
+        return;
+    }
+
+    tcp_server->gauges_taken = now;
+
+    TCP_Relay_Counters *const counters = &tcp_server->relay_counters;
+    tcp_counter_set(&counters->incoming, count_handshakes(tcp_server->incoming_connection_queue, now));
+    tcp_counter_set(&counters->unconfirmed, count_handshakes(tcp_server->unconfirmed_connection_queue, now));
+    tcp_counter_set(&counters->accepted, tcp_server->num_accepted_connections);
+    tcp_counter_set(&counters->loop_lag, tcp_server->loop_lag_max);
+    tcp_server->loop_lag_max = 0;
+}
+
 void do_tcp_server(TCP_Server *tcp_server, const Mono_Time *mono_time)
 {
+    const uint64_t now = mono_time_get_ms(mono_time);
+
+    if (tcp_server->run_due != 0 && now > tcp_server->run_due) {
+        tcp_server->loop_lag_max = max_u64(tcp_server->loop_lag_max, now - tcp_server->run_due);
+    }
+
 #ifdef TCP_SERVER_USE_EPOLL
     do_tcp_epoll(tcp_server, mono_time);
 
 #else
-    do_tcp_accept_new(tcp_server);
-    do_tcp_incoming(tcp_server);
+    do_tcp_accept_new(tcp_server, mono_time);
+    do_tcp_incoming(tcp_server, mono_time);
     do_tcp_unconfirmed(tcp_server, mono_time);
 #endif /* TCP_SERVER_USE_EPOLL */
 
     do_tcp_confirmed(tcp_server, mono_time);
+    do_tcp_flush(tcp_server, mono_time);
+    take_gauges(tcp_server, mono_time);
+
+    // Timer work that comes due from now on and isn't done in time counts as lag.
+#ifdef TCP_SERVER_USE_EPOLL
+    const uint64_t next_run = timer_wheel_next_deadline(tcp_server->timers);
+    tcp_server->run_due = next_run == TIMER_WHEEL_NEVER ? 0 : max_u64(next_run, now);
+#else
+    tcp_server->run_due = now + TCP_SERVER_POLL_INTERVAL;
+#endif /* TCP_SERVER_USE_EPOLL */
+}
+
+bool tcp_server_register_ev(TCP_Server *tcp_server, Ev *ev, void *data)
+{
+    if (tcp_server->ev != nullptr) {
+        return false;
+    }
+
+#ifdef TCP_SERVER_USE_EPOLL
+
+    // The server's own epoll set already tracks every socket, so it is enough
+    // to wake the outer loop whenever that set has something ready.
+    if (!ev_add(ev, net_socket_from_native(tcp_server->efd), EV_READ, data)) {
+        return false;
+    }
+
+#else
+
+    for (uint32_t i = 0; i < tcp_server->num_listening_socks; ++i) {
+        if (!ev_add(ev, tcp_server->socks_listening[i], EV_READ, data)) {
+            for (uint32_t j = 0; j < i; ++j) {
+                ev_del(ev, tcp_server->socks_listening[j]);
+            }
+
+            return false;
+        }
+    }
+
+#endif /* TCP_SERVER_USE_EPOLL */
+
+    tcp_server->ev = ev;
+    return true;
+}
+
+uint32_t tcp_server_copy_interests(const TCP_Server *tcp_server, Ev_Interest *interests, uint32_t max_interests)
+{
+#ifdef TCP_SERVER_USE_EPOLL
+
+    if (interests != nullptr && max_interests > 0) {
+        interests[0].sock = net_socket_from_native(tcp_server->efd);
+        interests[0].events = EV_READ;
+    }
+
+    return 1;
+#else
+
+    for (uint32_t i = 0; i < tcp_server->num_listening_socks && interests != nullptr && i < max_interests; ++i) {
+        interests[i].sock = tcp_server->socks_listening[i];
+        interests[i].events = EV_READ;
+    }
+
+    return tcp_server->num_listening_socks;
+#endif /* TCP_SERVER_USE_EPOLL */
+}
+
+void tcp_server_unregister_ev(TCP_Server *tcp_server)
+{
+    if (tcp_server->ev == nullptr) {
+        return;
+    }
+
+#ifdef TCP_SERVER_USE_EPOLL
+    ev_del(tcp_server->ev, net_socket_from_native(tcp_server->efd));
+#else
+
+    for (uint32_t i = 0; i < tcp_server->num_listening_socks; ++i) {
+        ev_del(tcp_server->ev, tcp_server->socks_listening[i]);
+    }
+
+#endif /* TCP_SERVER_USE_EPOLL */
+
+    tcp_server->ev = nullptr;
+}
+
+uint32_t tcp_server_run_interval(const TCP_Server *tcp_server, const Mono_Time *mono_time)
+{
+    // Packets queued from outside do_tcp_server (e.g. onion responses) are
+    // flushed on the next run.
+    if (tcp_server->flush_list.length != 0) {
+        return 0;
+    }
+
+#ifdef TCP_SERVER_USE_EPOLL
+    const uint64_t next_run = timer_wheel_next_deadline(tcp_server->timers);
+
+    if (next_run == TIMER_WHEEL_NEVER) {
+        return UINT32_MAX;
+    }
+
+    const uint64_t now = mono_time_get_ms(mono_time);
+
+    if (now >= next_run) {
+        return 0;
+    }
+
+    return (uint32_t)min_u64(next_run - now, UINT32_MAX - 1);
+#else
+    return TCP_SERVER_POLL_INTERVAL;
+#endif /* TCP_SERVER_USE_EPOLL */
 }
 
 void kill_tcp_server(TCP_Server *tcp_server)
@@ -1376,6 +3387,16 @@ void kill_tcp_server(TCP_Server *tcp_server)
         return;
     }
 
+    tcp_server_unregister_ev(tcp_server);
+
+#ifdef TCP_SERVER_USE_EPOLL
+
+    if (tcp_server->shards != nullptr) {
+        tcp_server_kill_shards(tcp_server);
+    }
+
+#endif /* TCP_SERVER_USE_EPOLL */
+
     for (uint32_t i = 0; i < tcp_server->num_listening_socks; ++i) {
         kill_sock(tcp_server->ns, tcp_server->socks_listening[i]);
     }
@@ -1392,6 +3413,9 @@ void kill_tcp_server(TCP_Server *tcp_server)
 
 #ifdef TCP_SERVER_USE_EPOLL
     close(tcp_server->efd);
+    timer_wheel_kill(tcp_server->timers);
+    tcp_shard_inbox_free(tcp_server->mem, &tcp_server->inbox);
+    mono_time_free(tcp_server->mem, tcp_server->shard_mono_time);
 #endif /* TCP_SERVER_USE_EPOLL */
 
     for (uint32_t i = 0; i < MAX_INCOMING_CONNECTIONS; ++i) {
@@ -1400,6 +3424,7 @@ void kill_tcp_server(TCP_Server *tcp_server)
     }
 
     free_accepted_connection_array(tcp_server);
+    mem_delete(tcp_server->mem, tcp_server->handshake_buckets);
 
     crypto_memzero(tcp_server->secret_key, sizeof(tcp_server->secret_key));
 
@@ -1408,6 +3433,80 @@ void kill_tcp_server(TCP_Server *tcp_server)
     mem_delete(tcp_server->mem, tcp_server);
 }
 
+static void add_handshake_counters(TCP_Server_Handshake_Stats *_Nonnull stats, const TCP_Handshake_Counters *_Nonnull counters)
+{
+    stats->accepted += tcp_counter_get(&counters->accepted);
+    stats->rejected += tcp_counter_get(&counters->rejected);
+    stats->failed += tcp_counter_get(&counters->failed);
+}
+
+void tcp_server_get_handshake_stats(const TCP_Server *tcp_server, TCP_Server_Handshake_Stats *stats)
+{
+    const TCP_Server_Handshake_Stats empty = {0};
+    *stats = empty;
+
+#ifdef TCP_SERVER_USE_EPOLL
+
+    if (tcp_server->shards != nullptr) {
+        for (uint16_t i = 0; i < tcp_server->num_shards; ++i) {
+            add_handshake_counters(stats, &tcp_server->shards[i]->handshake_counters);
+        }
+
+        if (tcp_server->handshake_pool != nullptr) {
+            stats->queued = tcp_handshake_pool_queued(tcp_server->handshake_pool);
+        }
+
+        return;
+    }
+
+#endif /* TCP_SERVER_USE_EPOLL */
+
+    add_handshake_counters(stats, &tcp_server->handshake_counters);
+}
+
+static void add_relay_counters(TCP_Server_Stats *_Nonnull stats, const TCP_Relay_Counters *_Nonnull counters)
+{
+    stats->incoming += tcp_counter_get(&counters->incoming);
+    stats->unconfirmed += tcp_counter_get(&counters->unconfirmed);
+    stats->accepted += tcp_counter_get(&counters->accepted);
+    stats->routed_packets += tcp_counter_get(&counters->routed_packets);
+    stats->routed_bytes += tcp_counter_get(&counters->routed_bytes);
+    stats->routed_dropped += tcp_counter_get(&counters->routed_dropped);
+    stats->priority_queued += tcp_counter_get(&counters->priority_queued);
+
+    for (uint32_t i = 0; i < TCP_SERVER_BACKLOG_BUCKETS; ++i) {
+        stats->send_backlog[i] += tcp_counter_get(&counters->send_backlog[i]);
+    }
+
+    for (uint32_t i = 0; i < TCP_KILL_REASONS; ++i) {
+        stats->kills[i] += tcp_counter_get(&counters->kills[i]);
+    }
+
+    stats->loop_lag = max_u32(stats->loop_lag, (uint32_t)min_u64(tcp_counter_get(&counters->loop_lag), UINT32_MAX));
+}
+
+void tcp_server_get_stats(const TCP_Server *tcp_server, TCP_Server_Stats *stats)
+{
+    const TCP_Server_Stats empty = {{0}};
+    *stats = empty;
+
+    tcp_server_get_handshake_stats(tcp_server, &stats->handshakes);
+
+#ifdef TCP_SERVER_USE_EPOLL
+
+    if (tcp_server->shards != nullptr) {
+        for (uint16_t i = 0; i < tcp_server->num_shards; ++i) {
+            add_relay_counters(stats, &tcp_server->shards[i]->relay_counters);
+        }
+
+        return;
+    }
+
+#endif /* TCP_SERVER_USE_EPOLL */
+
+    add_relay_counters(stats, &tcp_server->relay_counters);
+}
+
 const Net_Profile *tcp_server_get_net_profile(const TCP_Server *tcp_server)
 {
     if (tcp_server == nullptr) {
@@ -14,6 +14,7 @@
 
 #include "attributes.h"
 #include "crypto_core.h"
+#include "ev.h"
 #include "forwarding.h"
 #include "logger.h"
 #include "mem.h"
@@ -34,25 +35,210 @@ extern "C" {
 
 #define ARRAY_ENTRY_SIZE 6
 
+/** Most threads a sharded TCP server runs on. */
+#define TCP_SERVER_MAX_THREADS 64
+/** Most threads a TCP server verifies handshakes on. */
+#define TCP_SERVER_MAX_HANDSHAKE_WORKERS 64
+
+/** Handshakes per second an IP address may start by default, once it used up its burst. */
+#define TCP_HANDSHAKE_RATE_DEFAULT 10
+/** Handshakes an IP address may start at once by default. */
+#define TCP_HANDSHAKE_BURST_DEFAULT 40
+
 typedef enum TCP_Status {
     TCP_STATUS_NO_STATUS,
     TCP_STATUS_CONNECTED,
     TCP_STATUS_UNCONFIRMED,
     TCP_STATUS_CONFIRMED,
+    /* The handshake is with a handshake worker. */
+    TCP_STATUS_HANDSHAKING,
 } TCP_Status;
 
 typedef struct TCP_Server TCP_Server;
 
+typedef struct TCP_Server_Options {
+    /** Threads the relay runs on, see `new_tcp_server_with_options`. 0 is the same as 1. */
+    uint16_t num_threads;
+    /**
+     * Threads that verify client handshakes and compute their session keys,
+     * so that a burst of new connections doesn't hold up established ones.
+     * 0 verifies handshakes on the relay threads.
+     */
+    uint16_t handshake_workers;
+    /**
+     * Handshakes per second each client IP address (IPv6 /64 network) may
+     * start once it has used up its burst. Connections beyond that are closed
+     * right after they are accepted. 0 disables the limit.
+     */
+    uint16_t handshake_rate;
+    /** Handshakes each client IP address may start at once. */
+    uint16_t handshake_burst;
+} TCP_Server_Options;
+
+/** @brief Handshake counters of a TCP server, summed over its threads. */
+typedef struct TCP_Server_Handshake_Stats {
+    /** Handshakes waiting for or being verified by a handshake worker. */
+    uint32_t queued;
+    /** Handshakes that were verified and answered. */
+    uint64_t accepted;
+    /**
+     * Connections closed before their handshake: over the rate limit, or no
+     * room left with the handshake workers. Connections that find all
+     * handshake slots taken wait in the listen backlog instead.
+     */
+    uint64_t rejected;
+    /** Handshakes that were invalid, or replaced by newer ones before they completed. */
+    uint64_t failed;
+} TCP_Server_Handshake_Stats;
+
+/** Why the server closed a confirmed connection. */
+typedef enum TCP_Kill_Reason {
+    /** The client stopped answering pings. */
+    TCP_KILL_TIMEOUT,
+    /** The client closed the connection, or reading from it failed. */
+    TCP_KILL_CLOSED,
+    /** The client sent a packet the server does not accept. */
+    TCP_KILL_INVALID,
+    /** The client connected again, and the new connection replaced this one. */
+    TCP_KILL_REPLACED,
+    /** The server could not keep the connection going, e.g. out of memory. */
+    TCP_KILL_ERROR,
+} TCP_Kill_Reason;
+
+#define TCP_KILL_REASONS (TCP_KILL_ERROR + 1)
+
+/**
+ * Buckets of `TCP_Server_Stats::send_backlog`: connections with nothing to
+ * send, with up to one full-size packet, up to half of the send buffer, up to
+ * all of it, and with more queued on top of a full send buffer.
+ */
+#define TCP_SERVER_BACKLOG_BUCKETS 5
+
+/**
+ * @brief Load and traffic of a TCP server, summed over its threads.
+ *
+ * Counters go up for the lifetime of the server. The gauges of the send
+ * queues are kept up to date; the others are taken by each thread when it
+ * runs, at most once a second.
+ */
+typedef struct TCP_Server_Stats {
+    TCP_Server_Handshake_Stats handshakes;
+
+    /** Gauge: connections waiting for the client's handshake. */
+    uint32_t incoming;
+    /** Gauge: connections whose handshake was answered, waiting for the client's first packet. */
+    uint32_t unconfirmed;
+    /** Gauge: confirmed connections. */
+    uint32_t accepted;
+
+    /** Data packets passed on from one client to another, and their size in bytes. */
+    uint64_t routed_packets;
+    uint64_t routed_bytes;
+    /** Data packets dropped because the receiving client's send buffer was full. */
+    uint64_t routed_dropped;
+
+    /** Gauge: packets waiting in the priority queues of confirmed connections, behind a full send buffer. */
+    uint32_t priority_queued;
+    /** Gauge: confirmed connections by the number of bytes waiting to be sent to them. */
+    uint32_t send_backlog[TCP_SERVER_BACKLOG_BUCKETS];
+
+    /** Confirmed connections closed by the server, by `TCP_Kill_Reason`. */
+    uint64_t kills[TCP_KILL_REASONS];
+
+    /**
+     * Gauge: in milliseconds, the most any thread ran late in the last second,
+     * after its timer work was due. Anything but a few milliseconds means the
+     * relay can't keep up.
+     */
+    uint32_t loop_lag;
+} TCP_Server_Stats;
+
 const uint8_t *_Nonnull tcp_server_public_key(const TCP_Server *_Nonnull tcp_server);
 size_t tcp_server_listen_count(const TCP_Server *_Nonnull tcp_server);
 
+/** Set @p options to what `new_tcp_server` uses: one thread, no handshake workers and the default rate limit. */
+void tcp_server_options_default(TCP_Server_Options *_Nonnull options);
+
 /** Create new TCP server instance. */
 TCP_Server *_Nullable new_tcp_server(const Logger *_Nonnull logger, const Memory *_Nonnull mem, const Random *_Nonnull rng, const Network *_Nonnull ns,
                                      bool ipv6_enabled, uint16_t num_sockets, const uint16_t *_Nonnull ports,
                                      const uint8_t *_Nonnull secret_key, Onion *_Nullable onion, Forwarding *_Nullable forwarding);
+/**
+ * @brief Create a TCP server with the given @p options.
+ *
+ * With more than one thread, each thread runs a shard of the server with its
+ * own listening sockets on the same ports (SO_REUSEPORT), its own epoll set
+ * and its own connections. Shards hand routing, OOB and onion traffic for
+ * clients on other shards to each other through lock-free queues. The
+ * caller's thread runs the first shard through `do_tcp_server` as usual,
+ * along with the onion and forwarding modules; the server starts the other
+ * threads itself. The net profile of a sharded server only counts the caller's
+ * shard, and each shard applies the handshake rate limit on its own.
+ *
+ * Threads and handshake workers need epoll. Without it, the server runs on
+ * the caller's thread only, as `new_tcp_server` does.
+ *
+ * Returns null if the threads or sockets could not be set up.
+ */
+TCP_Server *_Nullable new_tcp_server_with_options(const Logger *_Nonnull logger, const Memory *_Nonnull mem, const Random *_Nonnull rng, const Network *_Nonnull ns,
+        bool ipv6_enabled, uint16_t num_sockets, const uint16_t *_Nonnull ports,
+        const uint8_t *_Nonnull secret_key, Onion *_Nullable onion, Forwarding *_Nullable forwarding,
+        const TCP_Server_Options *_Nonnull options);
 /** Run the TCP_server */
 void do_tcp_server(TCP_Server *_Nonnull tcp_server, const Mono_Time *_Nonnull mono_time);
 
+/**
+ * @brief Register the server's sockets with an event loop.
+ *
+ * After this, `ev` reports the server as readable whenever `do_tcp_server`
+ * has connections to accept or data to read. With epoll this covers the
+ * listening sockets and all accepted connections, otherwise only the listening
+ * sockets and the connections are polled on `tcp_server_run_interval`.
+ *
+ * The sockets are added with `data` as their user data. `ev` must outlive the
+ * server, or the server must be unregistered first. Returns false if
+ * registration failed.
+ */
+bool tcp_server_register_ev(TCP_Server *_Nonnull tcp_server, Ev *_Nonnull ev, void *_Nullable data);
+
+/** @brief Remove the server's sockets from the event loop it was registered with, if any. */
+void tcp_server_unregister_ev(TCP_Server *_Nonnull tcp_server);
+
+/**
+ * @brief Copy the sockets `tcp_server_register_ev` would register into @p interests.
+ *
+ * For callers that wait on the sockets themselves rather than through an Ev.
+ *
+ * @return the number of sockets, which may be more than @p max_interests.
+ */
+uint32_t tcp_server_copy_interests(const TCP_Server *_Nonnull tcp_server, Ev_Interest *_Nullable interests, uint32_t max_interests);
+
+/**
+ * @brief Return the time in milliseconds before `do_tcp_server()` has timer
+ *   work to do (pings, timeouts, releasing idle buffers).
+ *
+ * With epoll, only connections whose timer is due are looked at, and queued
+ * data is sent when the socket becomes writable. Otherwise all connections
+ * are polled, retrying pending data as well.
+ *
+ * @retval UINT32_MAX if there are no connections to look after.
+ */
+uint32_t tcp_server_run_interval(const TCP_Server *_Nonnull tcp_server, const Mono_Time *_Nonnull mono_time);
+
+/** @brief Get the handshake counters of @p tcp_server, summed over all its threads.
+ *
+ * Safe to call from any thread while the server runs.
+ */
+void tcp_server_get_handshake_stats(const TCP_Server *_Nonnull tcp_server, TCP_Server_Handshake_Stats *_Nonnull stats);
+
+/** @brief Get the load and traffic of @p tcp_server, summed over all its threads.
+ *
+ * Safe to call from any thread while the server runs. The handshake counters
+ * are the same as from `tcp_server_get_handshake_stats`. The handshake rate is
+ * the change of `handshakes.accepted` between two calls.
+ */
+void tcp_server_get_stats(const TCP_Server *_Nonnull tcp_server, TCP_Server_Stats *_Nonnull stats);
+
 /** Kill the TCP server */
 void kill_tcp_server(TCP_Server *_Nullable tcp_server);
 /** @brief Returns a pointer to the net profile associated with `tcp_server`.
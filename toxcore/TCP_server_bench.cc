@@ -0,0 +1,967 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include "../testing/support/doubles/fake_memory.hh"
+#include "TCP_client.h"
+#include "TCP_server.h"
+#include "crypto_core.h"
+#include "logger.h"
+#include "mono_time.h"
+#include "network.h"
+#include "os_memory.h"
+#include "os_network.h"
+#include "os_random.h"
+
+namespace {
+
+/** Packets sent by one client before the relay gets to run. */
+constexpr std::size_t kBurstSize = 32;
+
+constexpr uint16_t kRelayPort = 33551;
+
+/** @brief The OS network, counting the socket calls made by the relay. */
+struct CountingNetwork {
+    const Network *real = os_network();
+    std::size_t sends = 0;
+    std::size_t recvs = 0;
+
+    static CountingNetwork &self(void *obj) { return *static_cast<CountingNetwork *>(obj); }
+
+    Network_Funcs make_funcs() const
+    {
+        Network_Funcs funcs = *real->funcs;
+        funcs.send = [](void *obj, Socket sock, const uint8_t *buf, std::size_t len) {
+            CountingNetwork &net = self(obj);
+            ++net.sends;
+            return net.real->funcs->send(net.real->obj, sock, buf, len);
+        };
+        if (funcs.sendv != nullptr) {
+            funcs.sendv = [](void *obj, Socket sock, const Net_Iovec *iov, std::size_t count) {
+                CountingNetwork &net = self(obj);
+                ++net.sends;
+                return net.real->funcs->sendv(net.real->obj, sock, iov, count);
+            };
+        }
+        funcs.recv = [](void *obj, Socket sock, uint8_t *buf, std::size_t len) {
+            CountingNetwork &net = self(obj);
+            ++net.recvs;
+            return net.real->funcs->recv(net.real->obj, sock, buf, len);
+        };
+        funcs.recvbuf = [](void *obj, Socket sock) {
+            CountingNetwork &net = self(obj);
+            ++net.recvs;
+            return net.real->funcs->recvbuf(net.real->obj, sock);
+        };
+        return funcs;
+    }
+};
+
+struct RelayClient {
+    TCP_Client_Connection *conn = nullptr;
+    std::array<uint8_t, CRYPTO_PUBLIC_KEY_SIZE> pk{};
+    std::array<uint8_t, CRYPTO_SECRET_KEY_SIZE> sk{};
+    uint8_t con_id = 0;
+    bool online = false;
+    std::size_t received = 0;
+};
+
+/**
+ * @brief Throughput of a TCP relay forwarding data between two clients.
+ *
+ * Both clients and the relay run on loopback sockets in this thread. Each
+ * iteration, one client sends a burst of data packets to the other through
+ * the relay. The argument is the packet size. The `sends_per_packet` and
+ * `recvs_per_packet` counters are the socket calls the relay makes per
+ * forwarded packet.
+ */
+class TcpRelayBenchFixture : public benchmark::Fixture {
+public:
+    void SetUp(::benchmark::State &state) override
+    {
+        mem = os_memory();
+        rng = os_random();
+        if (rng == nullptr || counting.real == nullptr) {
+            setup_error = "os_random or os_network failed";
+            return;
+        }
+
+        funcs = counting.make_funcs();
+        relay_ns = Network{&funcs, &counting};
+
+        log = logger_new(mem);
+        mono_time = mono_time_new(mem, nullptr, nullptr);
+        if (log == nullptr || mono_time == nullptr) {
+            setup_error = "failed to create logger or mono_time";
+            return;
+        }
+
+        std::array<uint8_t, CRYPTO_PUBLIC_KEY_SIZE> server_pk;
+        std::array<uint8_t, CRYPTO_SECRET_KEY_SIZE> server_sk;
+        crypto_new_keypair(rng, server_pk.data(), server_sk.data());
+
+        const uint16_t port = kRelayPort;
+        server = new_tcp_server(log, mem, rng, &relay_ns, false, 1, &port, server_sk.data(), nullptr, nullptr);
+        if (server == nullptr) {
+            setup_error = "new_tcp_server failed";
+            return;
+        }
+
+        IP_Port ip_port;
+        ip_port.ip = get_ip4_loopback_ip();
+        ip_port.port = net_htons(kRelayPort);
+
+        for (RelayClient *client : {&alice, &bob}) {
+            crypto_new_keypair(rng, client->pk.data(), client->sk.data());
+            client->conn = new_tcp_connection(log, mem, mono_time, rng, counting.real, &ip_port, server_pk.data(),
+                                              client->pk.data(), client->sk.data(), nullptr, nullptr);
+            if (client->conn == nullptr) {
+                setup_error = "new_tcp_connection failed";
+                return;
+            }
+
+            routing_status_handler(client->conn, on_status, client);
+            routing_data_handler(client->conn, on_data, client);
+        }
+
+        bool requested = false;
+        if (!run_until([&]() {
+                if (!requested && tcp_con_status(alice.conn) == TCP_CLIENT_CONFIRMED
+                        && tcp_con_status(bob.conn) == TCP_CLIENT_CONFIRMED) {
+                    send_routing_request(log, alice.conn, bob.pk.data());
+                    send_routing_request(log, bob.conn, alice.pk.data());
+                    requested = true;
+                }
+                return alice.online && bob.online;
+            })) {
+            setup_error = "clients did not connect through the relay";
+        }
+    }
+
+    void TearDown(const ::benchmark::State &state) override
+    {
+        kill_tcp_connection(alice.conn);
+        kill_tcp_connection(bob.conn);
+        kill_tcp_server(server);
+        mono_time_free(mem, mono_time);
+        logger_kill(log);
+        alice = RelayClient{};
+        bob = RelayClient{};
+        server = nullptr;
+        mono_time = nullptr;
+        log = nullptr;
+    }
+
+protected:
+    static IP get_ip4_loopback_ip()
+    {
+        IP ip;
+        ip_init(&ip, false);
+        ip.ip.v4 = get_ip4_loopback();
+        return ip;
+    }
+
+    static int on_status(void *object, uint32_t number, uint8_t connection_id, uint8_t status)
+    {
+        RelayClient *client = static_cast<RelayClient *>(object);
+        client->con_id = connection_id;
+        client->online = status == 2;
+        return 0;
+    }
+
+    static int on_data(void *object, uint32_t number, uint8_t connection_id, const uint8_t *data, uint16_t length,
+                       void *userdata)
+    {
+        ++static_cast<RelayClient *>(object)->received;
+        return 0;
+    }
+
+    /** Run the relay and both clients until @p done returns true, for at most 5 seconds. */
+    template <typename Done>
+    bool run_until(Done done)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+
+        while (!done()) {
+            if (std::chrono::steady_clock::now() > deadline) {
+                return false;
+            }
+
+            mono_time_update(mono_time);
+            do_tcp_server(server, mono_time);
+            do_tcp_connection(log, mono_time, alice.conn, nullptr);
+            do_tcp_connection(log, mono_time, bob.conn, nullptr);
+        }
+
+        return true;
+    }
+
+    const Memory *mem = nullptr;
+    const Random *rng = nullptr;
+    CountingNetwork counting;
+    Network_Funcs funcs{};
+    Network relay_ns{};
+    Logger *log = nullptr;
+    Mono_Time *mono_time = nullptr;
+    TCP_Server *server = nullptr;
+    RelayClient alice;
+    RelayClient bob;
+    std::string setup_error;
+};
+
+BENCHMARK_DEFINE_F(TcpRelayBenchFixture, Forward)(benchmark::State &state)
+{
+    if (!setup_error.empty()) {
+        state.SkipWithError(setup_error.c_str());
+        return;
+    }
+
+    const std::vector<uint8_t> payload(static_cast<std::size_t>(state.range(0)), 0x42);
+    const std::size_t sends_before = counting.sends;
+    const std::size_t recvs_before = counting.recvs;
+    std::size_t forwarded = 0;
+
+    for (auto _ : state) {
+        for (std::size_t i = 0; i < kBurstSize; ++i) {
+            while (send_data(log, alice.conn, alice.con_id, payload.data(), payload.size()) != 1) {
+                do_tcp_connection(log, mono_time, alice.conn, nullptr);
+                do_tcp_server(server, mono_time);
+                do_tcp_connection(log, mono_time, bob.conn, nullptr);
+            }
+        }
+
+        const std::size_t expected = bob.received + kBurstSize;
+
+        if (!run_until([&]() { return bob.received >= expected; })) {
+            state.SkipWithError("relay stopped forwarding");
+            return;
+        }
+
+        forwarded += kBurstSize;
+    }
+
+    state.SetItemsProcessed(static_cast<int64_t>(forwarded));
+    state.SetBytesProcessed(static_cast<int64_t>(forwarded * payload.size()));
+    state.counters["sends_per_packet"]
+        = static_cast<double>(counting.sends - sends_before) / static_cast<double>(forwarded);
+    state.counters["recvs_per_packet"]
+        = static_cast<double>(counting.recvs - recvs_before) / static_cast<double>(forwarded);
+}
+
+BENCHMARK_REGISTER_F(TcpRelayBenchFixture, Forward)->Arg(64)->Arg(1024)->UseRealTime();
+
+/** Clients connecting at the same time, kept below the listen backlog. */
+constexpr std::size_t kConnectBatchSize = 128;
+
+/** @brief Make sure the process can open @p count more file descriptors. */
+bool reserve_file_descriptors(std::size_t count)
+{
+#ifdef _WIN32
+    return true;
+#else
+    struct rlimit limit;
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+        return false;
+    }
+
+    const rlim_t wanted = count + 64;
+
+    if (limit.rlim_cur >= wanted) {
+        return true;
+    }
+
+    if (limit.rlim_max != RLIM_INFINITY && limit.rlim_max < wanted) {
+        return false;
+    }
+
+    limit.rlim_cur = wanted;
+    return setrlimit(RLIMIT_NOFILE, &limit) == 0;
+#endif
+}
+
+/** @brief Options for a relay on loopback, where all clients share one address. */
+TCP_Server_Options loopback_relay_options()
+{
+    TCP_Server_Options options;
+    tcp_server_options_default(&options);
+    options.handshake_rate = 0;
+    return options;
+}
+
+struct IdleBenchClient {
+    TCP_Client_Connection *conn = nullptr;
+    bool requested = false;
+    bool routed = false;
+};
+
+/** @brief A relay listening on two loopback ports, so clients don't run out of source ports. */
+struct IdleBenchRelay {
+    std::array<uint8_t, CRYPTO_PUBLIC_KEY_SIZE> pk{};
+    std::array<uint16_t, 2> ports = {kRelayPort, kRelayPort + 1};
+    TCP_Server *server = nullptr;
+};
+
+/**
+ * @brief Connect @p clients to the relay, each asking for a route to one peer.
+ *
+ * Most clients only talk to a few peers. The relay runs on @p server_time, the
+ * clients on @p client_time. Clients connect in batches that fit into the
+ * listen backlog.
+ *
+ * @return false if not all clients got their routing response in time.
+ */
+bool connect_idle_clients(Logger *log, const Memory *mem, const Random *rng, const Network *ns,
+                          const IdleBenchRelay &relay, Mono_Time *server_time, Mono_Time *client_time,
+                          std::vector<IdleBenchClient> &clients)
+{
+    for (std::size_t start = 0; start < clients.size(); start += kConnectBatchSize) {
+        const std::size_t end = std::min(start + kConnectBatchSize, clients.size());
+
+        for (std::size_t i = start; i < end; ++i) {
+            std::array<uint8_t, CRYPTO_PUBLIC_KEY_SIZE> pk;
+            std::array<uint8_t, CRYPTO_SECRET_KEY_SIZE> sk;
+            crypto_new_keypair(rng, pk.data(), sk.data());
+
+            IP_Port ip_port;
+            ip_init(&ip_port.ip, false);
+            ip_port.ip.ip.v4 = get_ip4_loopback();
+            ip_port.port = net_htons(relay.ports[i % relay.ports.size()]);
+
+            clients[i].conn = new_tcp_connection(
+                log, mem, client_time, rng, ns, &ip_port, relay.pk.data(), pk.data(), sk.data(), nullptr, nullptr);
+
+            if (clients[i].conn == nullptr) {
+                return false;
+            }
+
+            routing_response_handler(clients[i].conn, [](void *object, uint8_t connection_id, const uint8_t *public_key) {
+                static_cast<IdleBenchClient *>(object)->routed = true;
+                return 0;
+            }, &clients[i]);
+        }
+
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        std::size_t routed = 0;
+
+        while (routed < end - start) {
+            if (std::chrono::steady_clock::now() > deadline) {
+                return false;
+            }
+
+            mono_time_update(server_time);
+            mono_time_update(client_time);
+            do_tcp_server(relay.server, server_time);
+            routed = 0;
+
+            for (std::size_t i = start; i < end; ++i) {
+                IdleBenchClient &client = clients[i];
+                do_tcp_connection(log, client_time, client.conn, nullptr);
+
+                if (!client.requested && tcp_con_status(client.conn) == TCP_CLIENT_CONFIRMED) {
+                    std::array<uint8_t, CRYPTO_PUBLIC_KEY_SIZE> peer;
+                    random_bytes(rng, peer.data(), peer.size());
+                    client.requested = send_routing_request(log, client.conn, peer.data()) == 1;
+                }
+
+                routed += client.routed ? 1 : 0;
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Heap memory the relay uses per accepted connection.
+ *
+ * Connects the given number of clients to a relay over loopback, each routed
+ * to one peer. The `bytes_per_connection` counter is the relay's heap usage
+ * after all clients are connected and idle, minus its usage with no clients,
+ * divided by the number of clients. Both ends of every connection are in this
+ * process, so this needs two file descriptors per client.
+ */
+void BM_AcceptedConnectionMemory(benchmark::State &state)
+{
+    const std::size_t num_clients = static_cast<std::size_t>(state.range(0));
+    const Memory *mem = os_memory();
+    const Random *rng = os_random();
+    const Network *ns = os_network();
+
+    if (rng == nullptr || ns == nullptr) {
+        state.SkipWithError("os_random or os_network failed");
+        return;
+    }
+
+    if (!reserve_file_descriptors(2 * num_clients)) {
+        state.SkipWithError("not enough file descriptors for this many clients");
+        return;
+    }
+
+    for (auto _ : state) {
+        tox::test::FakeMemory server_memory;
+        const Memory server_mem = server_memory.c_memory();
+        Logger *log = logger_new(mem);
+        Mono_Time *mono_time = mono_time_new(mem, nullptr, nullptr);
+
+        IdleBenchRelay relay;
+        std::array<uint8_t, CRYPTO_SECRET_KEY_SIZE> server_sk;
+        crypto_new_keypair(rng, relay.pk.data(), server_sk.data());
+        const TCP_Server_Options options = loopback_relay_options();
+        relay.server = new_tcp_server_with_options(log, &server_mem, rng, ns, false, relay.ports.size(),
+                       relay.ports.data(), server_sk.data(), nullptr, nullptr, &options);
+
+        if (log == nullptr || mono_time == nullptr || relay.server == nullptr) {
+            state.SkipWithError("failed to create the relay");
+            kill_tcp_server(relay.server);
+            mono_time_free(mem, mono_time);
+            logger_kill(log);
+            return;
+        }
+
+        const std::size_t baseline = server_memory.current_allocation();
+        std::vector<IdleBenchClient> clients(num_clients);
+        const bool ok = connect_idle_clients(log, mem, rng, ns, relay, mono_time, mono_time, clients);
+
+        // Keep running until the relay has released the buffers of the now
+        // idle connections, which it does a second after their last activity.
+        const auto settled = std::chrono::steady_clock::now() + std::chrono::milliseconds(1100);
+
+        while (ok && std::chrono::steady_clock::now() < settled) {
+            mono_time_update(mono_time);
+            do_tcp_server(relay.server, mono_time);
+
+            for (IdleBenchClient &client : clients) {
+                do_tcp_connection(log, mono_time, client.conn, nullptr);
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        if (ok) {
+            state.counters["bytes_per_connection"]
+                = static_cast<double>(server_memory.current_allocation() - baseline) / static_cast<double>(num_clients);
+        } else {
+            state.SkipWithError("clients did not connect to the relay");
+        }
+
+        for (IdleBenchClient &client : clients) {
+            kill_tcp_connection(client.conn);
+        }
+
+        kill_tcp_server(relay.server);
+        mono_time_free(mem, mono_time);
+        logger_kill(log);
+    }
+}
+
+BENCHMARK(BM_AcceptedConnectionMemory)
+    ->Arg(1000)
+    ->Arg(10000)
+    ->Arg(50000)
+    ->Iterations(1)
+    ->Unit(benchmark::kMillisecond);
+
+/**
+ * @brief Time one run of the relay takes when its clients are idle.
+ *
+ * Connects the given number of clients, routed to one peer each, and lets
+ * their buffers be released. Each iteration then moves the relay's clock
+ * forward by one second and runs it once, so every iteration is a tick on
+ * which per-second work would be due. Pings are 30 seconds apart, so none of
+ * them fall into the measured ticks.
+ */
+void BM_IdleTick(benchmark::State &state)
+{
+    const std::size_t num_clients = static_cast<std::size_t>(state.range(0));
+    const Memory *mem = os_memory();
+    const Random *rng = os_random();
+    const Network *ns = os_network();
+
+    if (rng == nullptr || ns == nullptr) {
+        state.SkipWithError("os_random or os_network failed");
+        return;
+    }
+
+    if (!reserve_file_descriptors(2 * num_clients)) {
+        state.SkipWithError("not enough file descriptors for this many clients");
+        return;
+    }
+
+    // The relay's clock, in milliseconds.
+    uint64_t server_clock = 1000;
+    Logger *log = logger_new(mem);
+    Mono_Time *server_time = mono_time_new(mem, [](void *user_data) {
+        return *static_cast<uint64_t *>(user_data);
+    }, &server_clock);
+    Mono_Time *client_time = mono_time_new(mem, nullptr, nullptr);
+
+    IdleBenchRelay relay;
+    std::array<uint8_t, CRYPTO_SECRET_KEY_SIZE> server_sk;
+    crypto_new_keypair(rng, relay.pk.data(), server_sk.data());
+    const TCP_Server_Options options = loopback_relay_options();
+    relay.server = new_tcp_server_with_options(log, mem, rng, ns, false, relay.ports.size(), relay.ports.data(),
+                   server_sk.data(), nullptr, nullptr, &options);
+
+    std::vector<IdleBenchClient> clients(num_clients);
+    bool ok = log != nullptr && server_time != nullptr && client_time != nullptr && relay.server != nullptr
+              && connect_idle_clients(log, mem, rng, ns, relay, server_time, client_time, clients);
+
+    if (!ok) {
+        state.SkipWithError("clients did not connect to the relay");
+    }
+
+    // Two seconds for the relay to release the buffers of the handshakes.
+    for (int i = 0; ok && i < 2; ++i) {
+        server_clock += 1000;
+        mono_time_update(server_time);
+        do_tcp_server(relay.server, server_time);
+    }
+
+    for (auto _ : state) {
+        if (!ok) {
+            break;
+        }
+
+        state.PauseTiming();
+        server_clock += 1000;
+        mono_time_update(server_time);
+        state.ResumeTiming();
+
+        do_tcp_server(relay.server, server_time);
+    }
+
+    for (IdleBenchClient &client : clients) {
+        kill_tcp_connection(client.conn);
+    }
+
+    kill_tcp_server(relay.server);
+    mono_time_free(mem, client_time);
+    mono_time_free(mem, server_time);
+    logger_kill(log);
+}
+
+// Iterations are seconds of the relay's clock: stay clear of the first ping.
+BENCHMARK(BM_IdleTick)->Arg(1000)->Arg(10000)->Arg(50000)->Iterations(25)->Unit(benchmark::kMicrosecond);
+
+/** Client pairs talking through the sharded relay. */
+constexpr std::size_t kShardedRelayPairs = 16;
+
+/**
+ * @brief Throughput of a relay sharded over the given number of threads.
+ *
+ * Connects pairs of clients over loopback; the kernel spreads them over the
+ * shards, so most pairs are routed between two shards. Each iteration, every
+ * pair forwards a burst of 1024 byte packets through the relay. The clients
+ * and the relay's first shard run on this thread, the other shards on their
+ * own.
+ */
+void BM_ShardedRelayThroughput(benchmark::State &state)
+{
+    const uint16_t num_threads = static_cast<uint16_t>(state.range(0));
+    const Memory *mem = os_memory();
+    const Random *rng = os_random();
+    const Network *ns = os_network();
+
+    if (rng == nullptr || ns == nullptr) {
+        state.SkipWithError("os_random or os_network failed");
+        return;
+    }
+
+    Logger *log = logger_new(mem);
+    Mono_Time *mono_time = mono_time_new(mem, nullptr, nullptr);
+
+    std::array<uint8_t, CRYPTO_PUBLIC_KEY_SIZE> server_pk;
+    std::array<uint8_t, CRYPTO_SECRET_KEY_SIZE> server_sk;
+    crypto_new_keypair(rng, server_pk.data(), server_sk.data());
+
+    const uint16_t port = kRelayPort;
+    TCP_Server_Options options = loopback_relay_options();
+    options.num_threads = num_threads;
+    TCP_Server *server = new_tcp_server_with_options(
+        log, mem, rng, ns, false, 1, &port, server_sk.data(), nullptr, nullptr, &options);
+
+    std::vector<RelayClient> clients(2 * kShardedRelayPairs);
+    bool ok = log != nullptr && mono_time != nullptr && server != nullptr;
+
+    IP_Port ip_port;
+    ip_init(&ip_port.ip, false);
+    ip_port.ip.ip.v4 = get_ip4_loopback();
+    ip_port.port = net_htons(port);
+
+    for (std::size_t i = 0; ok && i < clients.size(); ++i) {
+        RelayClient &client = clients[i];
+        crypto_new_keypair(rng, client.pk.data(), client.sk.data());
+        client.conn = new_tcp_connection(log, mem, mono_time, rng, ns, &ip_port, server_pk.data(), client.pk.data(),
+                                         client.sk.data(), nullptr, nullptr);
+
+        if (client.conn == nullptr) {
+            ok = false;
+            break;
+        }
+
+        routing_status_handler(client.conn, [](void *object, uint32_t number, uint8_t connection_id, uint8_t status) {
+            RelayClient *c = static_cast<RelayClient *>(object);
+            c->con_id = connection_id;
+            c->online = status == 2;
+            return 0;
+        }, &client);
+        routing_data_handler(client.conn, [](void *object, uint32_t number, uint8_t connection_id, const uint8_t *data,
+        uint16_t length, void *userdata) {
+            ++static_cast<RelayClient *>(object)->received;
+            return 0;
+        }, &client);
+    }
+
+    const auto run_until = [&](auto done) {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+
+        while (!done()) {
+            if (std::chrono::steady_clock::now() > deadline) {
+                return false;
+            }
+
+            mono_time_update(mono_time);
+            do_tcp_server(server, mono_time);
+
+            for (RelayClient &client : clients) {
+                do_tcp_connection(log, mono_time, client.conn, nullptr);
+            }
+        }
+
+        return true;
+    };
+
+    std::vector<bool> requested(clients.size());
+    ok = ok && run_until([&]() {
+        bool all_online = true;
+
+        for (std::size_t i = 0; i < clients.size(); ++i) {
+            RelayClient &peer = clients[i ^ 1];
+
+            if (!requested[i] && tcp_con_status(clients[i].conn) == TCP_CLIENT_CONFIRMED) {
+                requested[i] = send_routing_request(log, clients[i].conn, peer.pk.data()) == 1;
+            }
+
+            all_online = all_online && clients[i].online;
+        }
+
+        return all_online;
+    });
+
+    if (!ok) {
+        state.SkipWithError("clients did not connect through the relay");
+    }
+
+    const std::vector<uint8_t> payload(1024, 0x42);
+    std::size_t forwarded = 0;
+
+    for (auto _ : state) {
+        if (!ok) {
+            break;
+        }
+
+        for (std::size_t i = 0; i < clients.size(); i += 2) {
+            for (std::size_t j = 0; j < kBurstSize; ++j) {
+                while (send_data(log, clients[i].conn, clients[i].con_id, payload.data(), payload.size()) != 1) {
+                    do_tcp_connection(log, mono_time, clients[i].conn, nullptr);
+                    do_tcp_server(server, mono_time);
+                }
+            }
+        }
+
+        forwarded += kShardedRelayPairs * kBurstSize;
+
+        if (!run_until([&]() {
+                std::size_t received = 0;
+
+                for (std::size_t i = 1; i < clients.size(); i += 2) {
+                    received += clients[i].received;
+                }
+
+                return received >= forwarded;
+            })) {
+            state.SkipWithError("relay stopped forwarding");
+            ok = false;
+        }
+    }
+
+    state.SetBytesProcessed(static_cast<int64_t>(forwarded * payload.size()));
+
+    for (RelayClient &client : clients) {
+        kill_tcp_connection(client.conn);
+    }
+
+    kill_tcp_server(server);
+    mono_time_free(mem, mono_time);
+    logger_kill(log);
+}
+
+BENCHMARK(BM_ShardedRelayThroughput)->Arg(1)->Arg(2)->Arg(4)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+/**
+ * @brief A reconnect storm: all clients of a relay connecting at once.
+ *
+ * The first argument is the number of clients, the second the number of
+ * handshake workers. Two established clients keep passing a packet through
+ * the relay while the others connect. Clients whose connection is refused or
+ * times out start over with a new one, as after a relay restart. The measured
+ * time is until the relay answered a routing request from each of them. The counters are the relay's
+ * rejected and failed handshakes, the clients' retries, and the mean and
+ * worst time the established pair waited for its packets.
+ */
+void BM_ReconnectStorm(benchmark::State &state)
+{
+    const std::size_t num_clients = static_cast<std::size_t>(state.range(0));
+    const uint16_t num_workers = static_cast<uint16_t>(state.range(1));
+    const Memory *mem = os_memory();
+    const Random *rng = os_random();
+    const Network *ns = os_network();
+
+    if (rng == nullptr || ns == nullptr) {
+        state.SkipWithError("os_random or os_network failed");
+        return;
+    }
+
+    if (!reserve_file_descriptors(2 * (num_clients + 2))) {
+        state.SkipWithError("not enough file descriptors for this many clients");
+        return;
+    }
+
+    for (auto _ : state) {
+        Logger *log = logger_new(mem);
+        Mono_Time *mono_time = mono_time_new(mem, nullptr, nullptr);
+
+        IdleBenchRelay relay;
+        std::array<uint8_t, CRYPTO_SECRET_KEY_SIZE> server_sk;
+        crypto_new_keypair(rng, relay.pk.data(), server_sk.data());
+        TCP_Server_Options options = loopback_relay_options();
+        options.handshake_workers = num_workers;
+        relay.server = new_tcp_server_with_options(log, mem, rng, ns, false, relay.ports.size(), relay.ports.data(),
+                       server_sk.data(), nullptr, nullptr, &options);
+
+        if (log == nullptr || mono_time == nullptr || relay.server == nullptr) {
+            state.SkipWithError("failed to create the relay");
+            kill_tcp_server(relay.server);
+            mono_time_free(mem, mono_time);
+            logger_kill(log);
+            return;
+        }
+
+        IP_Port ip_port;
+        ip_init(&ip_port.ip, false);
+        ip_port.ip.ip.v4 = get_ip4_loopback();
+
+        std::vector<IdleBenchClient> clients(num_clients);
+
+        const auto connect = [&](std::size_t i) {
+            std::array<uint8_t, CRYPTO_PUBLIC_KEY_SIZE> pk;
+            std::array<uint8_t, CRYPTO_SECRET_KEY_SIZE> sk;
+            crypto_new_keypair(rng, pk.data(), sk.data());
+            ip_port.port = net_htons(relay.ports[i % relay.ports.size()]);
+            clients[i] = IdleBenchClient{};
+            clients[i].conn = new_tcp_connection(
+                log, mem, mono_time, rng, ns, &ip_port, relay.pk.data(), pk.data(), sk.data(), nullptr, nullptr);
+
+            if (clients[i].conn == nullptr) {
+                return false;
+            }
+
+            routing_response_handler(clients[i].conn, [](void *object, uint8_t connection_id, const uint8_t *public_key) {
+                static_cast<IdleBenchClient *>(object)->routed = true;
+                return 0;
+            }, &clients[i]);
+            return true;
+        };
+
+        const auto run_relay = [&]() {
+            mono_time_update(mono_time);
+            do_tcp_server(relay.server, mono_time);
+        };
+
+        // The established pair.
+        std::array<RelayClient, 2> pair;
+        bool ok = true;
+        // Many clients in a row can use up the local ports, which stay taken for a while after they are closed.
+        const char *error = "could not open client connections";
+
+        for (std::size_t i = 0; i < pair.size(); ++i) {
+            RelayClient &client = pair[i];
+            crypto_new_keypair(rng, client.pk.data(), client.sk.data());
+            ip_port.port = net_htons(relay.ports[0]);
+            client.conn = new_tcp_connection(log, mem, mono_time, rng, ns, &ip_port, relay.pk.data(), client.pk.data(),
+                                             client.sk.data(), nullptr, nullptr);
+
+            if (client.conn == nullptr) {
+                ok = false;
+                break;
+            }
+
+            routing_status_handler(client.conn, [](void *object, uint32_t number, uint8_t connection_id, uint8_t status) {
+                RelayClient *c = static_cast<RelayClient *>(object);
+                c->con_id = connection_id;
+                c->online = status == 2;
+                return 0;
+            }, &client);
+            routing_data_handler(client.conn, [](void *object, uint32_t number, uint8_t connection_id,
+            const uint8_t *data, uint16_t length, void *userdata) {
+                ++static_cast<RelayClient *>(object)->received;
+                return 0;
+            }, &client);
+        }
+
+        std::array<bool, 2> requested{};
+        const auto pair_deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+
+        while (ok && !(pair[0].online && pair[1].online)) {
+            if (std::chrono::steady_clock::now() > pair_deadline) {
+                error = "clients did not connect to the relay";
+                ok = false;
+                break;
+            }
+
+            run_relay();
+
+            for (std::size_t i = 0; i < pair.size(); ++i) {
+                do_tcp_connection(log, mono_time, pair[i].conn, nullptr);
+
+                if (!requested[i] && tcp_con_status(pair[i].conn) == TCP_CLIENT_CONFIRMED) {
+                    requested[i] = send_routing_request(log, pair[i].conn, pair[i ^ 1].pk.data()) == 1;
+                }
+            }
+        }
+
+        for (std::size_t i = 0; ok && i < num_clients; ++i) {
+            ok = connect(i);
+        }
+
+        if (ok) {
+            error = "clients did not connect to the relay";
+        }
+
+        const std::vector<uint8_t> payload(64, 0x42);
+        std::size_t sent = 0;
+        std::size_t retries = 0;
+        std::size_t routed = 0;
+        std::chrono::steady_clock::time_point sent_at;
+        std::chrono::duration<double> latency_sum{0};
+        std::chrono::duration<double> latency_max{0};
+
+        const auto start = std::chrono::steady_clock::now();
+        const auto deadline = start + std::chrono::seconds(120);
+
+        while (ok && routed < num_clients) {
+            const auto now = std::chrono::steady_clock::now();
+
+            if (now > deadline) {
+                error = "clients did not connect to the relay";
+                ok = false;
+                break;
+            }
+
+            if (pair[1].received == sent) {
+                if (sent > 0) {
+                    const std::chrono::duration<double> latency = now - sent_at;
+                    latency_sum += latency;
+                    latency_max = std::max(latency_max, latency);
+                }
+
+                if (send_data(log, pair[0].conn, pair[0].con_id, payload.data(), payload.size()) == 1) {
+                    sent_at = now;
+                    ++sent;
+                }
+            }
+
+            run_relay();
+            do_tcp_connection(log, mono_time, pair[0].conn, nullptr);
+            do_tcp_connection(log, mono_time, pair[1].conn, nullptr);
+
+            for (std::size_t i = 0; i < num_clients; ++i) {
+                IdleBenchClient &client = clients[i];
+
+                if (client.routed) {
+                    continue;
+                }
+
+                do_tcp_connection(log, mono_time, client.conn, nullptr);
+                const TCP_Client_Status status = tcp_con_status(client.conn);
+
+                if (status == TCP_CLIENT_CONFIRMED && !client.requested) {
+                    std::array<uint8_t, CRYPTO_PUBLIC_KEY_SIZE> peer;
+                    random_bytes(rng, peer.data(), peer.size());
+                    client.requested = send_routing_request(log, client.conn, peer.data()) == 1;
+                } else if (status == TCP_CLIENT_DISCONNECTED) {
+                    kill_tcp_connection(client.conn);
+                    ++retries;
+
+                    if (!connect(i)) {
+                        error = "could not open client connections";
+                        ok = false;
+                        break;
+                    }
+                }
+
+                routed += client.routed ? 1 : 0;
+            }
+        }
+
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        if (ok) {
+            TCP_Server_Handshake_Stats stats;
+            tcp_server_get_handshake_stats(relay.server, &stats);
+            state.SetIterationTime(elapsed.count());
+            state.counters["rejected"] = static_cast<double>(stats.rejected);
+            state.counters["failed"] = static_cast<double>(stats.failed);
+            state.counters["retries"] = static_cast<double>(retries);
+            state.counters["pair_latency_mean_ms"] = sent > 1 ? 1000 * latency_sum.count() / static_cast<double>(sent - 1) : 0;
+            state.counters["pair_latency_max_ms"] = 1000 * latency_max.count();
+        } else {
+            state.SkipWithError(error);
+        }
+
+        for (IdleBenchClient &client : clients) {
+            kill_tcp_connection(client.conn);
+        }
+
+        for (RelayClient &client : pair) {
+            kill_tcp_connection(client.conn);
+        }
+
+        kill_tcp_server(relay.server);
+        mono_time_free(mem, mono_time);
+        logger_kill(log);
+
+        if (!ok) {
+            return;
+        }
+    }
+}
+
+BENCHMARK(BM_ReconnectStorm)
+    ->Args({2000, 0})
+    ->Args({2000, 2})
+    ->Args({20000, 0})
+    ->Args({20000, 2})
+    ->Iterations(1)
+    ->UseManualTime()
+    ->Unit(benchmark::kMillisecond);
+
+}  // namespace
+
+BENCHMARK_MAIN();
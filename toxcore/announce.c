@@ -23,10 +23,10 @@
 #include "network.h"
 #include "shared_key_cache.h"
 #include "timed_auth.h"
+#include "timer_wheel.h"
 #include "util.h"
 
 /* Settings for the shared key cache */
-#define MAX_KEYS_PER_SLOT 4
 #define KEYS_TIMEOUT 600
 
 uint8_t announce_response_of_request_type(uint8_t request_type)
@@ -48,13 +48,47 @@ uint8_t announce_response_of_request_type(uint8_t request_type)
     }
 }
 
+/** Number of entries allocated when the store is created. It doubles whenever it fills up. */
+#define ANNOUNCE_STORE_MIN_ENTRIES 16
+
 typedef struct Announce_Entry {
     uint64_t store_until;
     uint8_t data_public_key[CRYPTO_PUBLIC_KEY_SIZE];
     uint8_t *_Nullable data;
     uint32_t length;
+    /** Position of the entry in the heap of its store. */
+    uint32_t heap_pos;
 } Announce_Entry;
 
+/**
+ * Stored announcements, in a dense array grown on demand up to the capacity.
+ *
+ * An open addressing hash table finds the entry of a data public key, a
+ * max-heap by distance to our DHT key finds the entry a closer key replaces
+ * when the store is full, and a timer wheel, with entry indices as timer ids,
+ * removes entries when they time out.
+ */
+typedef struct Announce_Store {
+    Announce_Entry *_Nullable entries;
+    /** Entry indices, the one farthest from our DHT key first. */
+    uint32_t *_Nullable heap;
+    /** Entry index + 1 for each hash bucket, 0 for empty buckets. */
+    uint32_t *_Nullable buckets;
+    uint32_t bucket_bits;
+    uint64_t hash_seed;
+    Timer_Wheel *_Nonnull timers;
+
+    /** Number of entries the arrays have room for. */
+    uint32_t allocated;
+    uint32_t size;
+    uint32_t capacity;
+
+    uint64_t stored;
+    uint64_t rejected;
+    uint64_t evicted;
+    uint64_t expired;
+} Announce_Store;
+
 struct Announcements {
     const Logger *_Nonnull log;
     const Memory *_Nonnull mem;
@@ -73,7 +107,7 @@ struct Announcements {
 
     uint64_t start_time;
 
-    Announce_Entry entries[ANNOUNCE_BUCKETS * ANNOUNCE_BUCKET_SIZE];
+    Announce_Store store;
 };
 
 void announce_set_synch_offset(Announcements *announce, int32_t synch_offset)
@@ -90,127 +124,337 @@ static bool entry_is_empty(const Announcements *_Nonnull announce, const Announc
     return mono_time_get(announce->mono_time) >= entry->store_until;
 }
 
-static void delete_entry(Announce_Entry *_Nonnull entry)
+/** @brief Number of hash table bits for @p allocated entries: at most half the buckets are used. */
+static uint32_t store_bucket_bits(uint32_t allocated)
 {
-    entry->store_until = 0;
+    uint32_t bucket_bits = 1;
+
+    while ((UINT32_C(1) << bucket_bits) < allocated * 2) {
+        ++bucket_bits;
+    }
+
+    return bucket_bits;
 }
 
-/** Return bits (at most 8) from pk starting at index as uint8_t */
-static uint8_t truncate_pk_at_index(const uint8_t *_Nonnull pk, uint16_t index, uint16_t bits)
+static uint32_t store_hash(const Announce_Store *_Nonnull store, const uint8_t *_Nonnull public_key)
 {
-    assert(bits < 8);
-    const uint8_t i = index / 8;
-    const uint8_t j = index % 8;
-    return ((uint8_t)((i < CRYPTO_PUBLIC_KEY_SIZE ? pk[i] : 0) << j) >> (8 - bits)) |
-           ((i + 1 < CRYPTO_PUBLIC_KEY_SIZE ? pk[i + 1] : 0) >> (16 - bits - j));
+    // See shared_key_cache_set: the first and last bytes are masked in curve25519.
+    uint64_t bytes;
+    memcpy(&bytes, &public_key[8], sizeof(bytes));
+    return (uint32_t)(((bytes ^ store->hash_seed) * UINT64_C(0x9E3779B97F4A7C15)) >> (64 - store->bucket_bits));
 }
 
-uint16_t announce_get_bucketnum(const uint8_t *base, const uint8_t *pk)
+/** @brief The bucket of @p public_key, or the empty bucket where it would go. */
+static uint32_t store_find_bucket(const Announce_Store *_Nonnull store, const uint8_t *_Nonnull public_key)
 {
-    const uint16_t index = bit_by_bit_cmp(base, pk);
+    const uint32_t mask = (UINT32_C(1) << store->bucket_bits) - 1;
+    uint32_t bucket = store_hash(store, public_key);
 
-    return truncate_pk_at_index(base, index + 1, ANNOUNCE_BUCKET_PREFIX_LENGTH) ^
-           truncate_pk_at_index(pk, index + 1, ANNOUNCE_BUCKET_PREFIX_LENGTH);
-}
+    while (store->buckets[bucket] != 0
+            && !pk_equal(store->entries[store->buckets[bucket] - 1].data_public_key, public_key)) {
+        bucket = (bucket + 1) & mask;
+    }
 
-static Announce_Entry *_Nonnull bucket_of_key(Announcements *_Nonnull announce, const uint8_t *_Nonnull pk)
-{
-    return &announce->entries[announce_get_bucketnum(announce->public_key, pk) * ANNOUNCE_BUCKET_SIZE];
+    return bucket;
 }
 
-static Announce_Entry *_Nullable get_stored(Announcements *_Nonnull announce, const uint8_t *_Nonnull data_public_key)
+/** @brief Empty @p bucket, moving later entries of the probe sequence back so lookups still find them. */
+static void store_clear_bucket(Announce_Store *_Nonnull store, uint32_t bucket)
 {
-    Announce_Entry *const bucket = bucket_of_key(announce, data_public_key);
+    const uint32_t mask = (UINT32_C(1) << store->bucket_bits) - 1;
+    uint32_t hole = bucket;
 
-    for (uint32_t i = 0; i < ANNOUNCE_BUCKET_SIZE; ++i) {
-        if (pk_equal(bucket[i].data_public_key, data_public_key)) {
-            if (entry_is_empty(announce, &bucket[i])) {
-                break;
-            }
+    for (uint32_t next = (hole + 1) & mask; store->buckets[next] != 0; next = (next + 1) & mask) {
+        const uint32_t home = store_hash(store, store->entries[store->buckets[next] - 1].data_public_key);
 
-            return &bucket[i];
+        // The entry can move into the hole if its probe sequence passes it.
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            store->buckets[hole] = store->buckets[next];
+            hole = next;
         }
     }
 
-    return nullptr;
+    store->buckets[hole] = 0;
 }
 
-static const Announce_Entry *_Nonnull bucket_of_key_const(const Announcements *_Nonnull announce, const uint8_t *_Nonnull pk)
+/** @brief Whether the entry at @p index1 is farther from @p self_public_key than the one at @p index2. */
+static bool store_farther(const Announce_Store *_Nonnull store, const uint8_t *_Nonnull self_public_key,
+                          uint32_t index1, uint32_t index2)
 {
-    return &announce->entries[announce_get_bucketnum(announce->public_key, pk) * ANNOUNCE_BUCKET_SIZE];
+    return id_closest(self_public_key, store->entries[index1].data_public_key, store->entries[index2].data_public_key) == 2;
 }
 
-static const Announce_Entry *_Nullable get_stored_const(const Announcements *_Nonnull announce, const uint8_t *_Nonnull data_public_key)
+static void store_heap_set(Announce_Store *_Nonnull store, uint32_t pos, uint32_t index)
 {
-    const Announce_Entry *const bucket = bucket_of_key_const(announce, data_public_key);
+    store->heap[pos] = index;
+    store->entries[index].heap_pos = pos;
+}
 
-    for (uint32_t i = 0; i < ANNOUNCE_BUCKET_SIZE; ++i) {
-        if (pk_equal(bucket[i].data_public_key, data_public_key)) {
-            if (entry_is_empty(announce, &bucket[i])) {
-                break;
-            }
+/** @brief Restore the heap order after the entry at heap position @p pos changed. */
+static void store_heap_fix(Announce_Store *_Nonnull store, const uint8_t *_Nonnull self_public_key, uint32_t pos)
+{
+    const uint32_t index = store->heap[pos];
+
+    while (pos > 0 && store_farther(store, self_public_key, index, store->heap[(pos - 1) / 2])) {
+        store_heap_set(store, pos, store->heap[(pos - 1) / 2]);
+        pos = (pos - 1) / 2;
+    }
+
+    while (2 * pos + 1 < store->size) {
+        uint32_t child = 2 * pos + 1;
 
-            return &bucket[i];
+        if (child + 1 < store->size && store_farther(store, self_public_key, store->heap[child + 1], store->heap[child])) {
+            ++child;
         }
+
+        if (!store_farther(store, self_public_key, store->heap[child], index)) {
+            break;
+        }
+
+        store_heap_set(store, pos, store->heap[child]);
+        pos = child;
     }
 
-    return nullptr;
+    store_heap_set(store, pos, index);
 }
 
-bool announce_on_stored(const Announcements *announce, const uint8_t *data_public_key,
-                        announce_on_retrieve_cb *on_retrieve_callback, void *object)
+/** @brief The timer wheel counts milliseconds, entries time out on whole seconds. */
+static uint64_t store_deadline(uint64_t store_until)
 {
-    const Announce_Entry *const entry = get_stored_const(announce, data_public_key);
+    return store_until * 1000;
+}
 
-    if (entry == nullptr || entry->data == nullptr) {
+/**
+ * @brief Make room for @p allocated entries and rebuild the hash table for them.
+ *
+ * The store is unchanged if this fails, but its arrays may have moved.
+ */
+static bool store_grow(Announce_Store *_Nonnull store, const Memory *_Nonnull mem, uint32_t allocated)
+{
+    assert(allocated > store->allocated);
+
+    const uint32_t bucket_bits = store_bucket_bits(allocated);
+    uint32_t *buckets = (uint32_t *)mem_valloc(mem, UINT32_C(1) << bucket_bits, sizeof(uint32_t));
+
+    if (buckets == nullptr) {
         return false;
     }
 
-    if (on_retrieve_callback != nullptr) {
-        on_retrieve_callback(object, entry->data, entry->length);
+    Announce_Entry *entries = (Announce_Entry *)mem_vrealloc(mem, store->entries, allocated, sizeof(Announce_Entry));
+
+    if (entries == nullptr) {
+        mem_delete(mem, buckets);
+        return false;
+    }
+
+    store->entries = entries;
+
+    uint32_t *heap = (uint32_t *)mem_vrealloc(mem, store->heap, allocated, sizeof(uint32_t));
+
+    if (heap == nullptr) {
+        mem_delete(mem, buckets);
+        return false;
+    }
+
+    store->heap = heap;
+
+    mem_delete(mem, store->buckets);
+    store->buckets = buckets;
+    store->bucket_bits = bucket_bits;
+    store->allocated = allocated;
+
+    for (uint32_t i = 0; i < store->size; ++i) {
+        store->buckets[store_find_bucket(store, store->entries[i].data_public_key)] = i + 1;
     }
 
     return true;
 }
 
+static void store_set_until(Announce_Store *_Nonnull store, uint32_t index, uint64_t store_until)
+{
+    store->entries[index].store_until = store_until;
+    // Can't fail: the timer of every stored entry is already in the wheel.
+    timer_wheel_set(store->timers, index, store_deadline(store_until));
+}
+
+static void store_remove(Announce_Store *_Nonnull store, const Memory *_Nonnull mem,
+                         const uint8_t *_Nonnull self_public_key, uint32_t index)
+{
+    store_clear_bucket(store, store_find_bucket(store, store->entries[index].data_public_key));
+    timer_wheel_cancel(store->timers, index);
+    mem_delete(mem, store->entries[index].data);
+
+    const uint32_t last = store->size - 1;
+    const uint32_t heap_pos = store->entries[index].heap_pos;
+    const uint32_t heap_last = store->heap[last];
+    --store->size;
+
+    if (heap_pos != last) {
+        store_heap_set(store, heap_pos, heap_last);
+        store_heap_fix(store, self_public_key, heap_pos);
+    }
+
+    if (index != last) {
+        // Move the last entry into the gap and point its indices at the new place.
+        const uint32_t bucket = store_find_bucket(store, store->entries[last].data_public_key);
+        store->entries[index] = store->entries[last];
+        store->buckets[bucket] = index + 1;
+        store->heap[store->entries[index].heap_pos] = index;
+
+        timer_wheel_cancel(store->timers, last);
+        store_set_until(store, index, store->entries[index].store_until);
+    }
+
+    memzero((uint8_t *)&store->entries[last], sizeof(Announce_Entry));
+}
+
 /**
- * Return existing entry for this key if it exists, else an empty
- * slot in the key's bucket if one exists, else an entry in the key's bucket
- * of greatest 2-adic distance greater than that of the key bucket if one
- * exists, else nullptr.
+ * @brief Add an entry without data for @p data_public_key, which must not be
+ *   stored yet, to a store that isn't full.
+ *
+ * @retval false if the store could not grow.
  */
-static Announce_Entry *_Nullable find_entry_slot(Announcements *_Nonnull announce, const uint8_t *_Nonnull data_public_key)
+static bool store_add(Announce_Store *_Nonnull store, const Memory *_Nonnull mem, const uint8_t *_Nonnull self_public_key,
+                      const uint8_t *_Nonnull data_public_key, uint64_t store_until, uint32_t *_Nonnull index)
 {
-    Announce_Entry *const bucket = bucket_of_key(announce, data_public_key);
+    assert(store->size < store->capacity);
 
-    Announce_Entry *slot = nullptr;
-    uint16_t min_index = bit_by_bit_cmp(announce->public_key, data_public_key);
+    if (store->size == store->allocated
+            && !store_grow(store, mem, min_u32(store->capacity, store->allocated * 2))) {
+        return false;
+    }
 
-    for (uint32_t i = 0; i < ANNOUNCE_BUCKET_SIZE; ++i) {
-        if (pk_equal(bucket[i].data_public_key, data_public_key)) {
-            return &bucket[i];
-        }
+    if (!timer_wheel_set(store->timers, store->size, store_deadline(store_until))) {
+        return false;
+    }
 
-        if (entry_is_empty(announce, &bucket[i])) {
-            slot = &bucket[i];
-            min_index = 0;
-            continue;
-        }
+    *index = store->size;
+    ++store->size;
+
+    Announce_Entry *const entry = &store->entries[*index];
+    memcpy(entry->data_public_key, data_public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    entry->store_until = store_until;
+    entry->data = nullptr;
+    entry->length = 0;
+
+    store->buckets[store_find_bucket(store, data_public_key)] = *index + 1;
+    store_heap_set(store, *index, *index);
+    store_heap_fix(store, self_public_key, *index);
+
+    return true;
+}
+
+/** @brief Create an empty store for up to @p capacity entries. */
+static bool store_init(Announce_Store *_Nonnull store, const Memory *_Nonnull mem, const Random *_Nonnull rng,
+                       const Mono_Time *_Nonnull mono_time, uint32_t capacity)
+{
+    Timer_Wheel *const timers = timer_wheel_new(mem, store_deadline(mono_time_get(mono_time)));
+
+    if (timers == nullptr) {
+        return false;
+    }
+
+    store->timers = timers;
+    store->hash_seed = random_u64(rng);
+    store->capacity = capacity;
+
+    if (!store_grow(store, mem, min_u32(capacity, ANNOUNCE_STORE_MIN_ENTRIES))) {
+        mem_delete(mem, store->heap);
+        mem_delete(mem, store->entries);
+        timer_wheel_kill(store->timers);
+        return false;
+    }
+
+    return true;
+}
+
+static void store_free(Announce_Store *_Nonnull store, const Memory *_Nonnull mem)
+{
+    for (uint32_t i = 0; i < store->size; ++i) {
+        mem_delete(mem, store->entries[i].data);
+    }
 
-        const uint16_t index = bit_by_bit_cmp(announce->public_key, bucket[i].data_public_key);
+    timer_wheel_kill(store->timers);
+    mem_delete(mem, store->buckets);
+    mem_delete(mem, store->heap);
+    mem_delete(mem, store->entries);
+}
 
-        if (index < min_index) {
-            slot = &bucket[i];
-            min_index = index;
+static void store_remove_expired(Announcements *_Nonnull announce)
+{
+    Announce_Store *const store = &announce->store;
+    const uint64_t now = store_deadline(mono_time_get(announce->mono_time));
+    bool removed;
+
+    /* Removing an entry moves the last one into its place and sets its timer
+     * again, so an expired last entry only shows up on the next advance. */
+    do {
+        timer_wheel_advance(store->timers, now);
+        removed = false;
+
+        uint32_t index;
+
+        while (timer_wheel_pop(store->timers, &index)) {
+            store_remove(store, announce->mem, announce->public_key, index);
+            ++store->expired;
+            removed = true;
         }
+    } while (removed);
+}
+
+/** @brief The index of the entry for @p data_public_key, or -1 if it isn't stored or timed out. */
+static int32_t stored_index(const Announcements *_Nonnull announce, const uint8_t *_Nonnull data_public_key)
+{
+    const Announce_Store *const store = &announce->store;
+    const uint32_t index = store->buckets[store_find_bucket(store, data_public_key)];
+
+    if (index == 0 || entry_is_empty(announce, &store->entries[index - 1])) {
+        return -1;
+    }
+
+    return (int32_t)(index - 1);
+}
+
+static const Announce_Entry *_Nullable get_stored_const(const Announcements *_Nonnull announce, const uint8_t *_Nonnull data_public_key)
+{
+    const int32_t index = stored_index(announce, data_public_key);
+
+    if (index == -1) {
+        return nullptr;
+    }
+
+    return &announce->store.entries[index];
+}
+
+bool announce_on_stored(const Announcements *announce, const uint8_t *data_public_key,
+                        announce_on_retrieve_cb *on_retrieve_callback, void *object)
+{
+    const Announce_Entry *const entry = get_stored_const(announce, data_public_key);
+
+    if (entry == nullptr || entry->data == nullptr) {
+        return false;
     }
 
-    return slot;
+    if (on_retrieve_callback != nullptr) {
+        on_retrieve_callback(object, entry->data, entry->length);
+    }
+
+    return true;
 }
 
+/**
+ * Whether a store request for this key gets an entry: its existing one, a
+ * free one, or the one of the farthest stored key if that is farther.
+ */
 static bool would_accept_store_request(Announcements *_Nonnull announce, const uint8_t *_Nonnull data_public_key)
 {
-    return find_entry_slot(announce, data_public_key) != nullptr;
+    store_remove_expired(announce);
+
+    const Announce_Store *const store = &announce->store;
+
+    return stored_index(announce, data_public_key) != -1
+           || store->size < store->capacity
+           || id_closest(announce->public_key, data_public_key, store->entries[store->heap[0]].data_public_key) == 1;
 }
 
 bool announce_store_data(Announcements *announce, const uint8_t *data_public_key,
@@ -220,31 +464,60 @@ bool announce_store_data(Announcements *announce, const uint8_t *data_public_key
         return false;
     }
 
-    Announce_Entry *entry = find_entry_slot(announce, data_public_key);
-
-    if (entry == nullptr) {
-        return false;
-    }
+    uint8_t *entry_data = nullptr;
 
     if (length > 0) {
         assert(data != nullptr);
 
-        mem_delete(announce->mem, entry->data);
-
-        uint8_t *entry_data = (uint8_t *)mem_balloc(announce->mem, length);
+        entry_data = (uint8_t *)mem_balloc(announce->mem, length);
 
         if (entry_data == nullptr) {
-            entry->data = nullptr;  // TODO(iphydf): Is this necessary?
             return false;
         }
 
         memcpy(entry_data, data, length);
+    }
+
+    store_remove_expired(announce);
+
+    Announce_Store *const store = &announce->store;
+    const uint64_t store_until = mono_time_get(announce->mono_time) + timeout;
+    const int32_t found = stored_index(announce, data_public_key);
+    uint32_t index;
+
+    if (found != -1) {
+        index = (uint32_t)found;
+        store_set_until(store, index, store_until);
+    } else {
+        if (store->size >= store->capacity) {
+            const uint32_t farthest = store->heap[0];
+
+            if (id_closest(announce->public_key, data_public_key, store->entries[farthest].data_public_key) != 1) {
+                mem_delete(announce->mem, entry_data);
+                ++store->rejected;
+                return false;
+            }
+
+            store_remove(store, announce->mem, announce->public_key, farthest);
+            ++store->evicted;
+        }
+
+        if (!store_add(store, announce->mem, announce->public_key, data_public_key, store_until, &index)) {
+            mem_delete(announce->mem, entry_data);
+            ++store->rejected;
+            return false;
+        }
+    }
+
+    Announce_Entry *const entry = &store->entries[index];
+
+    if (entry_data != nullptr) {
+        mem_delete(announce->mem, entry->data);
         entry->data = entry_data;
     }
 
     entry->length = length;
-    memcpy(entry->data_public_key, data_public_key, CRYPTO_PUBLIC_KEY_SIZE);
-    entry->store_until = mono_time_get(announce->mono_time) + timeout;
+    ++store->stored;
 
     return true;
 }
@@ -459,12 +732,17 @@ static int create_reply_plain_store_announce_request(Announcements *_Nonnull ann
             return -1;
         }
 
-        Announce_Entry *stored = get_stored(announce, data_public_key);
+        store_remove_expired(announce);
 
-        if (stored == nullptr) {
+        Announce_Store *const store = &announce->store;
+        const int32_t index = stored_index(announce, data_public_key);
+
+        if (index == -1) {
             return -1;
         }
 
+        const Announce_Entry *const stored = &store->entries[index];
+
         uint8_t stored_hash[CRYPTO_SHA256_SIZE];
         if (stored->data == nullptr) {
             LOGGER_ERROR(announce->log, "Stored data is null for public key.");
@@ -473,10 +751,11 @@ static int create_reply_plain_store_announce_request(Announcements *_Nonnull ann
         crypto_sha256(stored_hash, stored->data, stored->length);
 
         if (!crypto_sha256_eq(announcement, stored_hash)) {
-            delete_entry(stored);
+            store_remove(store, announce->mem, announce->public_key, (uint32_t)index);
             return -1;
         } else {
-            stored->store_until = mono_time_get(announce->mono_time) + timeout;
+            store_set_until(store, (uint32_t)index, mono_time_get(announce->mono_time) + timeout);
+            ++store->stored;
         }
     } else {
         if (!announce_store_data(announce, data_public_key, announcement, announcement_len, timeout)) {
@@ -643,13 +922,19 @@ Announcements *new_announcements(const Logger *log, const Memory *mem, const Ran
     announce->public_key = dht_get_self_public_key(announce->dht);
     announce->secret_key = dht_get_self_secret_key(announce->dht);
     new_hmac_key(announce->rng, announce->hmac_key);
-    Shared_Key_Cache *const shared_keys = shared_key_cache_new(log, mono_time, mem, announce->secret_key, KEYS_TIMEOUT, MAX_KEYS_PER_SLOT);
+    Shared_Key_Cache *const shared_keys = shared_key_cache_new(log, mono_time, mem, announce->secret_key, KEYS_TIMEOUT, SHARED_KEY_CACHE_DEFAULT_CAPACITY);
     if (shared_keys == nullptr) {
         mem_delete(announce->mem, announce);
         return nullptr;
     }
     announce->shared_keys = shared_keys;
 
+    if (!store_init(&announce->store, mem, rng, mono_time, ANNOUNCE_DEFAULT_CAPACITY)) {
+        shared_key_cache_free(announce->shared_keys);
+        mem_delete(announce->mem, announce);
+        return nullptr;
+    }
+
     announce->start_time = mono_time_get(announce->mono_time);
 
     set_callback_forwarded_request(forwarding, forwarded_request_callback, announce);
@@ -661,6 +946,46 @@ Announcements *new_announcements(const Logger *log, const Memory *mem, const Ran
     return announce;
 }
 
+bool announce_set_shared_key_capacity(Announcements *announce, uint32_t capacity)
+{
+    return shared_key_cache_set_capacity(announce->shared_keys, capacity);
+}
+
+void announce_add_shared_key_stats(const Announcements *announce, Shared_Key_Cache_Stats *stats)
+{
+    shared_key_cache_add_stats(announce->shared_keys, stats);
+}
+
+bool announce_set_capacity(Announcements *announce, uint32_t capacity)
+{
+    if (capacity == 0 || capacity > ANNOUNCE_MAX_CAPACITY) {
+        return false;
+    }
+
+    Announce_Store *const store = &announce->store;
+    store_remove_expired(announce);
+
+    while (store->size > capacity) {
+        store_remove(store, announce->mem, announce->public_key, store->heap[0]);
+        ++store->evicted;
+    }
+
+    store->capacity = capacity;
+    return true;
+}
+
+void announce_get_stats(const Announcements *announce, Announce_Stats *stats)
+{
+    const Announce_Store *const store = &announce->store;
+
+    stats->stored = store->stored;
+    stats->rejected = store->rejected;
+    stats->evicted = store->evicted;
+    stats->expired = store->expired;
+    stats->size = store->size;
+    stats->capacity = store->capacity;
+}
+
 void kill_announcements(Announcements *announce)
 {
     if (announce == nullptr) {
@@ -676,9 +1001,7 @@ void kill_announcements(Announcements *announce)
     crypto_memzero(announce->hmac_key, CRYPTO_HMAC_KEY_SIZE);
     shared_key_cache_free(announce->shared_keys);
 
-    for (uint32_t i = 0; i < ANNOUNCE_BUCKETS * ANNOUNCE_BUCKET_SIZE; ++i) {
-        mem_delete(announce->mem, announce->entries[i].data);
-    }
+    store_free(&announce->store, announce->mem);
 
     mem_delete(announce->mem, announce);
 }
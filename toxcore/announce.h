@@ -17,9 +17,23 @@
 #include "mono_time.h"
 #include "network.h"
 #include "rng.h"
+#include "shared_key_cache.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 #define MAX_ANNOUNCEMENT_SIZE 512
 
+/** Number of announcements stored for other peers by default. */
+#define ANNOUNCE_DEFAULT_CAPACITY 256
+
+/**
+ * Largest number of announcements a node can be set to store. Full of
+ * announcements of the maximum size, that is about 600 MiB.
+ */
+#define ANNOUNCE_MAX_CAPACITY (UINT32_C(1) << 20)
+
 typedef void announce_on_retrieve_cb(void *_Nullable object, const uint8_t *_Nullable data, uint16_t length);
 
 uint8_t announce_response_of_request_type(uint8_t request_type);
@@ -39,13 +53,50 @@ bool announce_on_stored(const Announcements *_Nonnull announce, const uint8_t *_
 void announce_set_synch_offset(Announcements *_Nonnull announce, int32_t synch_offset);
 
 void kill_announcements(Announcements *_Nullable announce);
-/* The declarations below are not public, they are exposed only for tests. */
 
-/** @private
- * Return xor of first ANNOUNCE_BUCKET_PREFIX_LENGTH bits from one bit after
- * base and pk first differ
+/**
+ * @brief Sets the capacity of the shared key cache for announce requests. See
+ *   `shared_key_cache_set_capacity`.
+ *
+ * Must be called before other threads use the announcements.
  */
-uint16_t announce_get_bucketnum(const uint8_t *_Nonnull base, const uint8_t *_Nonnull pk);
+bool announce_set_shared_key_capacity(Announcements *_Nonnull announce, uint32_t capacity);
+
+/** @brief Adds the statistics of the shared key cache for announce requests to @p stats. */
+void announce_add_shared_key_stats(const Announcements *_Nonnull announce, Shared_Key_Cache_Stats *_Nonnull stats);
+
+/**
+ * @brief Sets the number of announcements stored for other peers, from 1 to
+ *   `ANNOUNCE_MAX_CAPACITY`.
+ *
+ * When the store is full, a new announcement replaces the one whose key is
+ * farthest from our DHT key, if it is closer. Shrinking the store keeps the
+ * closest announcements. Memory is allocated as announcements are stored, so
+ * a large capacity costs nothing until it is used.
+ *
+ * @retval false if @p capacity is out of range.
+ */
+bool announce_set_capacity(Announcements *_Nonnull announce, uint32_t capacity);
+
+typedef struct Announce_Stats {
+    /** Announcements stored or refreshed. */
+    uint64_t stored;
+    /** Store requests refused because the store was full of closer keys, or couldn't grow. */
+    uint64_t rejected;
+    /** Announcements replaced by one with a closer key, or dropped by shrinking the store. */
+    uint64_t evicted;
+    /** Announcements removed because they timed out. */
+    uint64_t expired;
+    /** Announcements currently stored, including timed out ones not removed yet. */
+    uint32_t size;
+    /** Number of announcements the store can hold. */
+    uint32_t capacity;
+} Announce_Stats;
+
+/** @brief Copies the statistics of the announcement store into @p stats. */
+void announce_get_stats(const Announcements *_Nonnull announce, Announce_Stats *_Nonnull stats);
+
+/* The declarations below are not public, they are exposed only for tests. */
 
 /** @private */
 bool announce_store_data(Announcements *_Nonnull announce, const uint8_t *_Nonnull data_public_key,
@@ -55,15 +106,8 @@ bool announce_store_data(Announcements *_Nonnull announce, const uint8_t *_Nonnu
 #define MIN_MAX_ANNOUNCEMENT_TIMEOUT 10
 #define MAX_ANNOUNCEMENT_TIMEOUT_UPTIME_RATIO 4
 
-/** @private
- * For efficient lookup and updating, entries are stored as a hash table keyed
- * to the first ANNOUNCE_BUCKET_PREFIX_LENGTH bits starting from one bit after
- * the first bit in which data public key first differs from the dht key, with
- * (2-adically) closest keys preferentially stored within a given bucket. A
- * given key appears at most once (even if timed out).
- */
-#define ANNOUNCE_BUCKET_SIZE 8
-#define ANNOUNCE_BUCKET_PREFIX_LENGTH 5
-#define ANNOUNCE_BUCKETS 32 // ANNOUNCE_BUCKETS = 2 ** ANNOUNCE_BUCKET_PREFIX_LENGTH
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
 
 #endif /* C_TOXCORE_TOXCORE_ANNOUNCE_H */
@@ -0,0 +1,232 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+#include "announce.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "../testing/support/public/simulated_environment.hh"
+#include "DHT.h"
+#include "DHT_test_util.hh"
+#include "crypto_core.h"
+#include "forwarding.h"
+#include "mono_time.h"
+
+namespace {
+
+using PublicKey = std::array<std::uint8_t, CRYPTO_PUBLIC_KEY_SIZE>;
+
+constexpr std::uint8_t kData[] = {1, 2, 3, 4};
+constexpr std::uint32_t kTimeout = 60;
+
+class AnnounceTest : public ::testing::Test {
+protected:
+    AnnounceTest()
+        : dht_(env_, 33445)
+        , forwarding_(new_forwarding(dht_.logger(), &dht_.node().c_memory, &dht_.node().c_random, dht_.mono_time(),
+                          dht_.get_dht(), dht_.networking()),
+              [](Forwarding *f) { kill_forwarding(f); })
+        , announce_(forwarding_ == nullptr
+                  ? nullptr
+                  : new_announcements(dht_.logger(), &dht_.node().c_memory, &dht_.node().c_random,
+                        dht_.mono_time(), forwarding_.get(), dht_.get_dht(), dht_.networking()),
+              [](Announcements *a) { kill_announcements(a); })
+    {
+    }
+
+    void SetUp() override { ASSERT_NE(announce_, nullptr); }
+
+    Announcements *announce() { return announce_.get(); }
+
+    std::vector<PublicKey> random_keys(std::size_t count)
+    {
+        std::vector<PublicKey> keys(count);
+
+        for (PublicKey &pk : keys) {
+            random_bytes(&dht_.node().c_random, pk.data(), pk.size());
+        }
+
+        return keys;
+    }
+
+    /** @brief Sorts @p keys by distance to our DHT key, closest first. */
+    void sort_by_distance(std::vector<PublicKey> &keys)
+    {
+        const std::uint8_t *self_pk = dht_get_self_public_key(dht_.get_dht());
+        std::sort(keys.begin(), keys.end(), [self_pk](const PublicKey &a, const PublicKey &b) {
+            return id_closest(self_pk, a.data(), b.data()) == 1;
+        });
+    }
+
+    bool store(const PublicKey &pk, std::uint32_t timeout = kTimeout)
+    {
+        return announce_store_data(announce(), pk.data(), kData, sizeof(kData), timeout);
+    }
+
+    void store_all(const std::vector<PublicKey> &keys)
+    {
+        for (const PublicKey &pk : keys) {
+            store(pk);
+        }
+    }
+
+    bool is_stored(const PublicKey &pk) { return announce_on_stored(announce(), pk.data(), nullptr, nullptr); }
+
+    /** @brief Expects exactly the first @p count of the sorted @p keys to be stored. */
+    void expect_closest_stored(const std::vector<PublicKey> &keys, std::size_t count)
+    {
+        for (std::size_t i = 0; i < keys.size(); ++i) {
+            EXPECT_EQ(is_stored(keys[i]), i < count) << "key " << i;
+        }
+    }
+
+    Announce_Stats stats()
+    {
+        Announce_Stats stats;
+        announce_get_stats(announce(), &stats);
+        return stats;
+    }
+
+    void advance_seconds(std::uint64_t seconds)
+    {
+        env_.advance_time(seconds * 1000);
+        mono_time_update(dht_.mono_time());
+    }
+
+    tox::test::SimulatedEnvironment env_{12345};
+    WrappedDHT dht_;
+    std::unique_ptr<Forwarding, void (*)(Forwarding *)> forwarding_;
+    std::unique_ptr<Announcements, void (*)(Announcements *)> announce_;
+};
+
+TEST_F(AnnounceTest, StoredAnnouncementsAreFound)
+{
+    ASSERT_TRUE(announce_set_capacity(announce(), 1000));
+
+    const std::vector<PublicKey> keys = random_keys(1000);
+
+    for (const PublicKey &pk : keys) {
+        EXPECT_TRUE(store(pk));
+    }
+
+    for (const PublicKey &pk : keys) {
+        EXPECT_TRUE(is_stored(pk));
+    }
+
+    EXPECT_FALSE(is_stored(random_keys(1)[0]));
+    EXPECT_EQ(stats().size, 1000);
+    EXPECT_EQ(stats().stored, 1000);
+    EXPECT_EQ(stats().rejected, 0);
+}
+
+TEST_F(AnnounceTest, StoredDataIsReturned)
+{
+    const PublicKey pk = random_keys(1)[0];
+    ASSERT_TRUE(store(pk));
+
+    std::vector<std::uint8_t> retrieved;
+    EXPECT_TRUE(announce_on_stored(
+        announce(), pk.data(),
+        [](void *object, const std::uint8_t *data, std::uint16_t length) {
+            static_cast<std::vector<std::uint8_t> *>(object)->assign(data, data + length);
+        },
+        &retrieved));
+    EXPECT_EQ(retrieved, std::vector<std::uint8_t>(std::begin(kData), std::end(kData)));
+}
+
+TEST_F(AnnounceTest, FullStoreKeepsTheClosestKeys)
+{
+    ASSERT_TRUE(announce_set_capacity(announce(), 100));
+
+    std::vector<PublicKey> keys = random_keys(2000);
+    store_all(keys);
+
+    sort_by_distance(keys);
+    expect_closest_stored(keys, 100);
+
+    const Announce_Stats s = stats();
+    EXPECT_EQ(s.size, 100);
+    EXPECT_EQ(s.stored + s.rejected, 2000);
+    EXPECT_EQ(s.stored - s.evicted, 100);
+}
+
+TEST_F(AnnounceTest, FartherKeysAreRejectedWhenFull)
+{
+    ASSERT_TRUE(announce_set_capacity(announce(), 10));
+
+    std::vector<PublicKey> keys = random_keys(11);
+    sort_by_distance(keys);
+
+    for (std::size_t i = 0; i < 10; ++i) {
+        EXPECT_TRUE(store(keys[i]));
+    }
+
+    EXPECT_FALSE(store(keys[10]));
+    // Storing again refreshes the entry instead of taking another one.
+    EXPECT_TRUE(store(keys[9]));
+    expect_closest_stored(keys, 10);
+    EXPECT_EQ(stats().rejected, 1);
+}
+
+TEST_F(AnnounceTest, TimedOutAnnouncementsMakeRoom)
+{
+    ASSERT_TRUE(announce_set_capacity(announce(), 10));
+
+    std::vector<PublicKey> keys = random_keys(11);
+    sort_by_distance(keys);
+
+    for (std::size_t i = 0; i < 10; ++i) {
+        ASSERT_TRUE(store(keys[i], i % 2 == 0 ? kTimeout : 2 * kTimeout));
+    }
+
+    advance_seconds(kTimeout);
+
+    for (std::size_t i = 0; i < 10; ++i) {
+        EXPECT_EQ(is_stored(keys[i]), i % 2 == 1) << "key " << i;
+    }
+
+    EXPECT_TRUE(store(keys[10]));
+    EXPECT_TRUE(is_stored(keys[10]));
+    EXPECT_EQ(stats().expired, 5);
+    EXPECT_EQ(stats().size, 6);
+
+    advance_seconds(kTimeout);
+    EXPECT_FALSE(is_stored(keys[1]));
+    EXPECT_FALSE(is_stored(keys[10]));
+}
+
+TEST_F(AnnounceTest, ShrinkingKeepsTheClosestKeys)
+{
+    ASSERT_TRUE(announce_set_capacity(announce(), 64));
+
+    std::vector<PublicKey> keys = random_keys(64);
+    store_all(keys);
+    sort_by_distance(keys);
+
+    ASSERT_TRUE(announce_set_capacity(announce(), 5));
+    expect_closest_stored(keys, 5);
+    EXPECT_EQ(stats().evicted, 59);
+
+    ASSERT_TRUE(announce_set_capacity(announce(), 1000));
+    expect_closest_stored(keys, 5);
+
+    store_all(keys);
+    expect_closest_stored(keys, keys.size());
+}
+
+TEST_F(AnnounceTest, CapacityMustBeInRange)
+{
+    EXPECT_FALSE(announce_set_capacity(announce(), 0));
+    EXPECT_FALSE(announce_set_capacity(announce(), ANNOUNCE_MAX_CAPACITY + 1));
+    EXPECT_TRUE(announce_set_capacity(announce(), 1));
+    EXPECT_EQ(stats().capacity, 1);
+}
+
+}  // namespace
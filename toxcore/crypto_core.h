@@ -353,6 +353,9 @@ int32_t encrypt_precompute(const uint8_t public_key[_Nonnull CRYPTO_PUBLIC_KEY_S
  * using a shared key @ref CRYPTO_SYMMETRIC_KEY_SIZE big and a @ref CRYPTO_NONCE_SIZE
  * byte nonce.
  *
+ * Does not allocate memory; @p mem is kept for API compatibility. The plain
+ * and encrypted buffers may overlap, so messages can be encrypted in place.
+ *
  * @retval -1 if there was a problem.
  * @return length of encrypted data if everything was fine.
  */
@@ -366,12 +369,38 @@ int32_t encrypt_data_symmetric(const Memory *_Nonnull mem, const uint8_t shared_
  * `length - CRYPTO_MAC_SIZE` using a shared key @ref CRYPTO_SYMMETRIC_KEY_SIZE
  * big and a @ref CRYPTO_NONCE_SIZE byte nonce.
  *
+ * Like `encrypt_data_symmetric`, this does not allocate memory and works in
+ * place.
+ *
  * @retval -1 if there was a problem (decryption failed).
  * @return length of plain data if everything was fine.
  */
 int32_t decrypt_data_symmetric(const Memory *_Nonnull mem, const uint8_t shared_key[_Nonnull CRYPTO_SHARED_KEY_SIZE], const uint8_t nonce[_Nonnull CRYPTO_NONCE_SIZE],
                                const uint8_t *_Nonnull encrypted, size_t length, uint8_t *_Nonnull plain);
 
+/** @brief One message for `decrypt_data_symmetric_batch`. */
+typedef struct Crypto_Decrypt_Job {
+    const uint8_t *_Nonnull shared_key;
+    const uint8_t *_Nonnull nonce;
+    const uint8_t *_Nonnull encrypted;
+    size_t length;
+    uint8_t *_Nonnull plain;
+
+    /** Set to the length of plain data, or -1 if decryption failed. */
+    int32_t result;
+} Crypto_Decrypt_Job;
+
+/**
+ * @brief Decrypt several messages with precomputed shared keys.
+ *
+ * Gives the same results as calling `decrypt_data_symmetric` on each job. It
+ * does not allocate memory: each message is decrypted straight from
+ * `encrypted` into `plain`.
+ *
+ * @return the number of jobs that were decrypted successfully.
+ */
+uint32_t decrypt_data_symmetric_batch(Crypto_Decrypt_Job *_Nonnull jobs, uint32_t count);
+
 /**
  * @brief Increment the given nonce by 1 in big endian (rightmost byte incremented first).
  */
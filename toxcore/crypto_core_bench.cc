@@ -0,0 +1,150 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "../testing/support/doubles/fake_memory.hh"
+#include "crypto_core.h"
+#include "os_memory.h"
+#include "os_random.h"
+
+namespace {
+
+/** Packets decrypted per iteration, the size of one net_crypto receive batch. */
+constexpr std::size_t kBatchSize = 32;
+
+using Nonce = std::array<uint8_t, CRYPTO_NONCE_SIZE>;
+
+/**
+ * @brief A batch of data packets encrypted with one shared key.
+ *
+ * The argument is the plain data size: 64 bytes for small messages and acks,
+ * 512 bytes for typical chat traffic and 1300 bytes for full file transfer
+ * packets.
+ */
+class DecryptBenchFixture : public benchmark::Fixture {
+public:
+    void SetUp(::benchmark::State &state) override
+    {
+        mem = os_memory();
+        const Random *rng = os_random();
+        if (rng == nullptr) {
+            return;
+        }
+
+        const std::size_t length = static_cast<std::size_t>(state.range(0));
+        new_symmetric_key(rng, shared_key.data());
+
+        for (std::size_t i = 0; i < kBatchSize; ++i) {
+            std::vector<uint8_t> plain(length);
+            random_bytes(rng, plain.data(), plain.size());
+            random_nonce(rng, nonces[i].data());
+
+            encrypted[i].resize(length + CRYPTO_MAC_SIZE);
+            encrypt_data_symmetric(
+                mem, shared_key.data(), nonces[i].data(), plain.data(), plain.size(), encrypted[i].data());
+            decrypted[i].resize(length);
+        }
+    }
+
+protected:
+    const Memory *mem = nullptr;
+    std::array<uint8_t, CRYPTO_SHARED_KEY_SIZE> shared_key{};
+    std::array<Nonce, kBatchSize> nonces{};
+    std::array<std::vector<uint8_t>, kBatchSize> encrypted;
+    std::array<std::vector<uint8_t>, kBatchSize> decrypted;
+};
+
+/** @brief One `decrypt_data_symmetric` call per packet, as net_crypto used to do. */
+BENCHMARK_DEFINE_F(DecryptBenchFixture, PerPacket)(benchmark::State &state)
+{
+    for (auto _ : state) {
+        for (std::size_t i = 0; i < kBatchSize; ++i) {
+            const int32_t len = decrypt_data_symmetric(mem, shared_key.data(), nonces[i].data(), encrypted[i].data(),
+                                encrypted[i].size(), decrypted[i].data());
+            benchmark::DoNotOptimize(len);
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * kBatchSize);
+    state.SetBytesProcessed(state.iterations() * kBatchSize * state.range(0));
+}
+
+/** @brief The whole batch in one `decrypt_data_symmetric_batch` call. */
+BENCHMARK_DEFINE_F(DecryptBenchFixture, Batch)(benchmark::State &state)
+{
+    std::array<Crypto_Decrypt_Job, kBatchSize> jobs;
+
+    for (auto _ : state) {
+        for (std::size_t i = 0; i < kBatchSize; ++i) {
+            jobs[i] = {shared_key.data(), nonces[i].data(), encrypted[i].data(), encrypted[i].size(),
+                decrypted[i].data(), 0};
+        }
+
+        const uint32_t count = decrypt_data_symmetric_batch(jobs.data(), jobs.size());
+        benchmark::DoNotOptimize(count);
+    }
+
+    state.SetItemsProcessed(state.iterations() * kBatchSize);
+    state.SetBytesProcessed(state.iterations() * kBatchSize * state.range(0));
+}
+
+BENCHMARK_REGISTER_F(DecryptBenchFixture, PerPacket)->Arg(64)->Arg(512)->Arg(1300);
+BENCHMARK_REGISTER_F(DecryptBenchFixture, Batch)->Arg(64)->Arg(512)->Arg(1300);
+
+/**
+ * @brief Heap allocations made by one encrypt/decrypt round trip.
+ *
+ * Runs `encrypt_data_symmetric` and `decrypt_data_symmetric` on a fake
+ * `Memory` that counts every allocation, and reports the count per packet in
+ * the `allocs_per_packet` counter. This should stay at zero: both functions
+ * sit on the per-packet path of net_crypto and the DHT.
+ */
+void BM_SymmetricRoundTripAllocations(benchmark::State &state)
+{
+    const Random *rng = os_random();
+    if (rng == nullptr) {
+        state.SkipWithError("os_random failed");
+        return;
+    }
+
+    tox::test::FakeMemory fake_memory;
+    std::size_t allocations = 0;
+    fake_memory.set_observer([&allocations](bool) { ++allocations; });
+    const Memory mem = fake_memory.c_memory();
+
+    const std::size_t length = static_cast<std::size_t>(state.range(0));
+    std::array<uint8_t, CRYPTO_SHARED_KEY_SIZE> shared_key;
+    Nonce nonce;
+    new_symmetric_key(rng, shared_key.data());
+    random_nonce(rng, nonce.data());
+
+    std::vector<uint8_t> plain(length);
+    std::vector<uint8_t> encrypted(length + CRYPTO_MAC_SIZE);
+    std::vector<uint8_t> decrypted(length);
+    random_bytes(rng, plain.data(), plain.size());
+
+    for (auto _ : state) {
+        const int32_t enc_len = encrypt_data_symmetric(
+            &mem, shared_key.data(), nonce.data(), plain.data(), plain.size(), encrypted.data());
+        const int32_t dec_len = decrypt_data_symmetric(
+            &mem, shared_key.data(), nonce.data(), encrypted.data(), encrypted.size(), decrypted.data());
+        benchmark::DoNotOptimize(enc_len);
+        benchmark::DoNotOptimize(dec_len);
+    }
+
+    state.counters["allocs_per_packet"] = benchmark::Counter(
+        static_cast<double>(allocations) / static_cast<double>(state.iterations()));
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK(BM_SymmetricRoundTripAllocations)->Arg(64)->Arg(512)->Arg(1300);
+
+}  // namespace
+
+BENCHMARK_MAIN();
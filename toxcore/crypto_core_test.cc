@@ -70,6 +70,85 @@ TEST(CryptoCore, EncryptLargeData)
         &c_mem, pk.data(), sk.data(), nonce.data(), plain.data(), plain.size(), encrypted.data());
 }
 
+TEST(CryptoCore, DecryptBatchMatchesSingleDecrypt)
+{
+    SimulatedEnvironment env{12345};
+    auto c_mem = env.fake_memory().c_memory();
+    auto c_rng = env.fake_random().c_random();
+
+    constexpr std::size_t kCount = 4;
+    constexpr std::size_t kLength = 100;
+
+    std::array<std::uint8_t, CRYPTO_SHARED_KEY_SIZE> key;
+    new_symmetric_key(&c_rng, key.data());
+
+    std::array<Nonce, kCount> nonces;
+    std::array<std::vector<std::uint8_t>, kCount> plains;
+    std::array<std::vector<std::uint8_t>, kCount> encrypted;
+    std::array<std::vector<std::uint8_t>, kCount> decrypted;
+    std::array<Crypto_Decrypt_Job, kCount> jobs;
+
+    for (std::size_t i = 0; i < kCount; ++i) {
+        random_nonce(&c_rng, nonces[i].data());
+        plains[i].resize(kLength + i);
+        random_bytes(&c_rng, plains[i].data(), plains[i].size());
+        encrypted[i].resize(plains[i].size() + CRYPTO_MAC_SIZE);
+        ASSERT_EQ(encrypt_data_symmetric(&c_mem, key.data(), nonces[i].data(), plains[i].data(), plains[i].size(),
+                      encrypted[i].data()),
+            static_cast<std::int32_t>(encrypted[i].size()));
+        decrypted[i].resize(plains[i].size());
+        jobs[i] = {key.data(), nonces[i].data(), encrypted[i].data(), encrypted[i].size(), decrypted[i].data(), 0};
+    }
+
+    // Corrupt one message and make another one too short to hold a MAC.
+    encrypted[1][0] ^= 1;
+    jobs[3].length = CRYPTO_MAC_SIZE;
+
+    EXPECT_EQ(decrypt_data_symmetric_batch(jobs.data(), jobs.size()), 2u);
+
+    EXPECT_EQ(jobs[0].result, static_cast<std::int32_t>(plains[0].size()));
+    EXPECT_EQ(decrypted[0], plains[0]);
+    EXPECT_EQ(jobs[1].result, -1);
+    EXPECT_EQ(jobs[2].result, static_cast<std::int32_t>(plains[2].size()));
+    EXPECT_EQ(decrypted[2], plains[2]);
+    EXPECT_EQ(jobs[3].result, -1);
+
+    std::vector<std::uint8_t> single(plains[0].size());
+    EXPECT_EQ(decrypt_data_symmetric(&c_mem, key.data(), nonces[0].data(), encrypted[0].data(), encrypted[0].size(),
+                  single.data()),
+        static_cast<std::int32_t>(plains[0].size()));
+    EXPECT_EQ(single, plains[0]);
+}
+
+TEST(CryptoCore, SymmetricEncryptionWorksInPlaceWithoutAllocating)
+{
+    SimulatedEnvironment env{12345};
+    auto c_mem = env.fake_memory().c_memory();
+    auto c_rng = env.fake_random().c_random();
+
+    std::array<std::uint8_t, CRYPTO_SHARED_KEY_SIZE> key;
+    Nonce nonce;
+    new_symmetric_key(&c_rng, key.data());
+    random_nonce(&c_rng, nonce.data());
+
+    std::vector<std::uint8_t> plain(300);
+    random_bytes(&c_rng, plain.data(), plain.size());
+
+    std::vector<std::uint8_t> buffer(plain.size() + CRYPTO_MAC_SIZE);
+    std::copy(plain.begin(), plain.end(), buffer.begin());
+
+    std::size_t allocations = 0;
+    env.fake_memory().set_observer([&allocations](bool) { ++allocations; });
+
+    ASSERT_EQ(encrypt_data_symmetric(&c_mem, key.data(), nonce.data(), buffer.data(), plain.size(), buffer.data()),
+        static_cast<std::int32_t>(buffer.size()));
+    ASSERT_EQ(decrypt_data_symmetric(&c_mem, key.data(), nonce.data(), buffer.data(), buffer.size(), buffer.data()),
+        static_cast<std::int32_t>(plain.size()));
+
+    EXPECT_EQ(allocations, 0u);
+    EXPECT_TRUE(std::equal(plain.begin(), plain.end(), buffer.begin()));
+}
+
 TEST(CryptoCore, IncrementNonce)
 {
     Nonce nonce{};
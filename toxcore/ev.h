@@ -35,6 +35,14 @@ typedef struct Ev_Result {
     void *_Nullable data;
 } Ev_Result;
 
+/**
+ * @brief A socket and the events its owner waits for on it.
+ */
+typedef struct Ev_Interest {
+    Socket sock;
+    Ev_Events events;
+} Ev_Interest;
+
 /**
  * @brief Add a socket to the monitored set.
  *
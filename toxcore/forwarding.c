@@ -363,7 +363,7 @@ Forwarding *new_forwarding(const Logger *log, const Memory *mem, const Random *r
     forwarding->dht = dht;
     forwarding->net = net;
 
-    networking_registerhandler(forwarding->net, NET_PACKET_FORWARD_REQUEST, &handle_forward_request, forwarding);
+    networking_registerhandler_concurrent(forwarding->net, NET_PACKET_FORWARD_REQUEST, &handle_forward_request, forwarding);
     networking_registerhandler(forwarding->net, NET_PACKET_FORWARD_REPLY, &handle_forward_reply, forwarding);
     networking_registerhandler(forwarding->net, NET_PACKET_FORWARDING, &handle_forwarding, forwarding);
 
@@ -24,6 +24,7 @@
 #include "onion.h"
 #include "onion_announce.h"
 #include "onion_client.h"
+#include "timer_wheel.h"
 #include "util.h"
 
 #define PORTS_PER_DISCOVERY 10
@@ -80,6 +81,9 @@ struct Friend_Connections {
     Friend_Conn *_Nullable conns;
     uint32_t num_cons;
 
+    /* When each connection next needs `do_friend_conn`, keyed by friendcon_id. */
+    Timer_Wheel *_Nonnull timers;
+
     fr_request_cb *_Nullable fr_request_callback;
     void *_Nullable fr_request_object;
 
@@ -118,6 +122,21 @@ static bool friendconn_id_valid(const Friend_Connections *_Nonnull fr_c, int fri
            fr_c->conns[friendcon_id].status != FRIENDCONN_STATUS_NONE;
 }
 
+/**
+ * @brief The time in milliseconds at which `timestamp + timeout < mono_time_get()`
+ *   first becomes true.
+ */
+static uint64_t timeout_deadline_ms(uint64_t timestamp, uint64_t timeout)
+{
+    return (timestamp + timeout + 1) * 1000;
+}
+
+/** @brief Make the next `do_friend_connections` look at this connection. */
+static void schedule_friend_conn(const Friend_Connections *_Nonnull fr_c, int friendcon_id)
+{
+    timer_wheel_set_earlier(fr_c->timers, (uint32_t)friendcon_id, mono_time_get_ms(fr_c->mono_time));
+}
+
 /** @brief Set the size of the friend connections list to num.
  *
  * @retval false if realloc fails.
@@ -177,6 +196,7 @@ static int wipe_friend_conn(Friend_Connections *_Nonnull fr_c, int friendcon_id)
     }
 
     fr_c->conns[friendcon_id] = empty_friend_conn;
+    timer_wheel_cancel(fr_c->timers, (uint32_t)friendcon_id);
 
     uint32_t i;
 
@@ -354,6 +374,7 @@ static void dht_ip_callback(void *_Nonnull object, int32_t number, const IP_Port
     set_direct_ip_port(fr_c->net_crypto, friend_con->crypt_connection_id, ip_port, true);
     friend_con->dht_ip_port = *ip_port;
     friend_con->dht_ip_port_lastrecv = mono_time_get(fr_c->mono_time);
+    schedule_friend_conn(fr_c, number);
 
     if (friend_con->hosting_tcp_relay) {
         friend_add_tcp_relay(fr_c, number, ip_port, friend_con->dht_temp_pk);
@@ -381,6 +402,7 @@ static void change_dht_pk(Friend_Connections *_Nonnull fr_c, int friendcon_id, c
 
     dht_addfriend(fr_c->dht, dht_public_key, dht_ip_callback, fr_c, friendcon_id, &friend_con->dht_lock_token);
     memcpy(friend_con->dht_temp_pk, dht_public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    schedule_friend_conn(fr_c, friendcon_id);
 }
 
 static int handle_status(void *_Nonnull object, int id, bool status, void *_Nullable userdata)
@@ -412,6 +434,8 @@ static int handle_status(void *_Nonnull object, int id, bool status, void *_Null
         friend_con->hosting_tcp_relay = false;
     }
 
+    schedule_friend_conn(fr_c, id);
+
     if (status_changed) {
         if (fr_c->global_status_callback != nullptr) {
             fr_c->global_status_callback(fr_c->global_status_callback_object, id, status, userdata);
@@ -575,6 +599,7 @@ static int handle_new_connections(void *_Nonnull object, const New_Connection *_
     } else {
         friend_con->dht_ip_port = n_c->source;
         friend_con->dht_ip_port_lastrecv = mono_time_get(fr_c->mono_time);
+        schedule_friend_conn(fr_c, friendcon_id);
     }
 
     if (!pk_equal(friend_con->dht_temp_pk, n_c->dht_public_key)) {
@@ -801,6 +826,7 @@ int new_friend_connection(Friend_Connections *fr_c, const uint8_t *real_public_k
 
     recv_tcp_relay_handler(fr_c->onion_c, onion_friendnum, &tcp_relay_node_callback, fr_c, friendcon_id);
     onion_dht_pk_callback(fr_c->onion_c, onion_friendnum, &dht_pk_callback, fr_c, friendcon_id);
+    schedule_friend_conn(fr_c, friendcon_id);
 
     return friendcon_id;
 }
@@ -905,6 +931,13 @@ Friend_Connections *new_friend_connections(
         return nullptr;
     }
 
+    temp->timers = timer_wheel_new(mem, mono_time_get_ms(mono_time));
+
+    if (temp->timers == nullptr) {
+        mem_delete(mem, temp);
+        return nullptr;
+    }
+
     temp->local_discovery_enabled = local_discovery_enabled;
 
     if (temp->local_discovery_enabled) {
@@ -957,51 +990,102 @@ static void lan_discovery(Friend_Connections *_Nonnull fr_c)
     }
 }
 
+/** @brief When `do_friend_conn` next has something to do for this connection. */
+static uint64_t friend_conn_next_deadline(const Friend_Conn *_Nonnull friend_con, uint64_t temp_time)
+{
+    uint64_t deadline = TIMER_WHEEL_NEVER;
+
+    if (friend_con->status == FRIENDCONN_STATUS_CONNECTING) {
+        if (friend_con->dht_lock_token > 0) {
+            deadline = min_u64(deadline, timeout_deadline_ms(friend_con->dht_pk_lastrecv, FRIEND_DHT_TIMEOUT));
+
+            if (friend_con->crypt_connection_id == -1) {
+                /* Creating the crypto connection failed: try again in a second. */
+                deadline = min_u64(deadline, (temp_time + 1) * 1000);
+            }
+        }
+
+        if (!net_family_is_unspec(friend_con->dht_ip_port.ip.family)) {
+            deadline = min_u64(deadline, timeout_deadline_ms(friend_con->dht_ip_port_lastrecv, FRIEND_DHT_TIMEOUT));
+        }
+    } else if (friend_con->status == FRIENDCONN_STATUS_CONNECTED) {
+        deadline = min_u64(deadline, timeout_deadline_ms(friend_con->ping_lastsent, FRIEND_PING_INTERVAL));
+        deadline = min_u64(deadline, timeout_deadline_ms(friend_con->share_relays_lastsent, SHARE_RELAYS_INTERVAL));
+        deadline = min_u64(deadline, timeout_deadline_ms(friend_con->ping_lastrecv, FRIEND_CONNECTION_TIMEOUT));
+    }
+
+    if (deadline <= temp_time * 1000) {
+        /* Sending a ping or relays failed: try again in a second. */
+        deadline = (temp_time + 1) * 1000;
+    }
+
+    return deadline;
+}
+
+static void do_friend_conn(Friend_Connections *_Nonnull fr_c, int friendcon_id, uint64_t temp_time, void *_Nullable userdata)
+{
+    Friend_Conn *friend_con = get_conn(fr_c, friendcon_id);
+
+    if (friend_con == nullptr) {
+        return;
+    }
+
+    if (friend_con->status == FRIENDCONN_STATUS_CONNECTING) {
+        if (friend_con->dht_pk_lastrecv + FRIEND_DHT_TIMEOUT < temp_time) {
+            if (friend_con->dht_lock_token > 0) {
+                dht_delfriend(fr_c->dht, friend_con->dht_temp_pk, friend_con->dht_lock_token);
+                friend_con->dht_lock_token = 0;
+                memzero(friend_con->dht_temp_pk, CRYPTO_PUBLIC_KEY_SIZE);
+            }
+        }
+
+        if (friend_con->dht_ip_port_lastrecv + FRIEND_DHT_TIMEOUT < temp_time) {
+            friend_con->dht_ip_port.ip.family = net_family_unspec();
+        }
+
+        if (friend_con->dht_lock_token > 0) {
+            if (friend_new_connection(fr_c, friendcon_id) == 0) {
+                set_direct_ip_port(fr_c->net_crypto, friend_con->crypt_connection_id, &friend_con->dht_ip_port, false);
+                connect_to_saved_tcp_relays(fr_c, friendcon_id, MAX_FRIEND_TCP_CONNECTIONS / 2); /* Only fill it half up. */
+            }
+        }
+    } else if (friend_con->status == FRIENDCONN_STATUS_CONNECTED) {
+        if (friend_con->ping_lastsent + FRIEND_PING_INTERVAL < temp_time) {
+            send_ping(fr_c, friendcon_id);
+        }
+
+        if (friend_con->share_relays_lastsent + SHARE_RELAYS_INTERVAL < temp_time) {
+            send_relays(fr_c, friendcon_id);
+        }
+
+        if (friend_con->ping_lastrecv + FRIEND_CONNECTION_TIMEOUT < temp_time) {
+            /* If we stopped receiving ping packets, kill it. */
+            crypto_kill(fr_c->net_crypto, friend_con->crypt_connection_id);
+            friend_con->crypt_connection_id = -1;
+            handle_status(fr_c, friendcon_id, false, userdata); /* Going offline. */
+
+            /* The status callbacks may have killed or moved the connection. */
+            friend_con = get_conn(fr_c, friendcon_id);
+
+            if (friend_con == nullptr) {
+                return;
+            }
+        }
+    }
+
+    timer_wheel_set(fr_c->timers, (uint32_t)friendcon_id, friend_conn_next_deadline(friend_con, temp_time));
+}
+
 /** main friend_connections loop. */
 void do_friend_connections(Friend_Connections *fr_c, void *userdata)
 {
     const uint64_t temp_time = mono_time_get(fr_c->mono_time);
+    timer_wheel_advance(fr_c->timers, mono_time_get_ms(fr_c->mono_time));
 
-    for (uint32_t i = 0; i < fr_c->num_cons; ++i) {
-        Friend_Conn *const friend_con = get_conn(fr_c, i);
+    uint32_t friendcon_id;
 
-        if (friend_con != nullptr) {
-            if (friend_con->status == FRIENDCONN_STATUS_CONNECTING) {
-                if (friend_con->dht_pk_lastrecv + FRIEND_DHT_TIMEOUT < temp_time) {
-                    if (friend_con->dht_lock_token > 0) {
-                        dht_delfriend(fr_c->dht, friend_con->dht_temp_pk, friend_con->dht_lock_token);
-                        friend_con->dht_lock_token = 0;
-                        memzero(friend_con->dht_temp_pk, CRYPTO_PUBLIC_KEY_SIZE);
-                    }
-                }
-
-                if (friend_con->dht_ip_port_lastrecv + FRIEND_DHT_TIMEOUT < temp_time) {
-                    friend_con->dht_ip_port.ip.family = net_family_unspec();
-                }
-
-                if (friend_con->dht_lock_token > 0) {
-                    if (friend_new_connection(fr_c, i) == 0) {
-                        set_direct_ip_port(fr_c->net_crypto, friend_con->crypt_connection_id, &friend_con->dht_ip_port, false);
-                        connect_to_saved_tcp_relays(fr_c, i, MAX_FRIEND_TCP_CONNECTIONS / 2); /* Only fill it half up. */
-                    }
-                }
-            } else if (friend_con->status == FRIENDCONN_STATUS_CONNECTED) {
-                if (friend_con->ping_lastsent + FRIEND_PING_INTERVAL < temp_time) {
-                    send_ping(fr_c, i);
-                }
-
-                if (friend_con->share_relays_lastsent + SHARE_RELAYS_INTERVAL < temp_time) {
-                    send_relays(fr_c, i);
-                }
-
-                if (friend_con->ping_lastrecv + FRIEND_CONNECTION_TIMEOUT < temp_time) {
-                    /* If we stopped receiving ping packets, kill it. */
-                    crypto_kill(fr_c->net_crypto, friend_con->crypt_connection_id);
-                    friend_con->crypt_connection_id = -1;
-                    handle_status(fr_c, i, false, userdata); /* Going offline. */
-                }
-            }
-        }
+    while (timer_wheel_pop(fr_c->timers, &friendcon_id)) {
+        do_friend_conn(fr_c, (int)friendcon_id, temp_time, userdata);
     }
 
     if (fr_c->local_discovery_enabled) {
@@ -1009,6 +1093,22 @@ void do_friend_connections(Friend_Connections *fr_c, void *userdata)
     }
 }
 
+uint32_t friend_connections_run_interval(const Friend_Connections *fr_c)
+{
+    const uint64_t now = mono_time_get_ms(fr_c->mono_time);
+    uint64_t next = timer_wheel_next_deadline(fr_c->timers);
+
+    if (fr_c->local_discovery_enabled) {
+        next = min_u64(next, timeout_deadline_ms(fr_c->last_lan_discovery, LAN_DISCOVERY_INTERVAL));
+    }
+
+    if (next <= now) {
+        return 0;
+    }
+
+    return (uint32_t)min_u64(next - now, UINT32_MAX);
+}
+
 /** Free everything related with friend_connections. */
 void kill_friend_connections(Friend_Connections *fr_c)
 {
@@ -1026,5 +1126,6 @@ void kill_friend_connections(Friend_Connections *fr_c)
     }
 
     lan_discovery_kill(fr_c->broadcast);
+    timer_wheel_kill(fr_c->timers);
     mem_delete(fr_c->mem, fr_c);
 }
@@ -157,6 +157,9 @@ Friend_Connections *_Nullable new_friend_connections(const Logger *_Nonnull logg
 /** main friend_connections loop. */
 void do_friend_connections(Friend_Connections *_Nonnull fr_c, void *_Nullable userdata);
 
+/** return the optimal interval in ms for running do_friend_connections. */
+uint32_t friend_connections_run_interval(const Friend_Connections *_Nonnull fr_c);
+
 /** Free everything related with friend_connections. */
 void kill_friend_connections(Friend_Connections *_Nullable fr_c);
 typedef struct Friend_Conn Friend_Conn;
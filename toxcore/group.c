@@ -3744,6 +3744,31 @@ void do_groupchats(Group_Chats *g_c, void *userdata)
     // TODO(irungentoo):
 }
 
+uint64_t groupchats_deadline(const Group_Chats *g_c)
+{
+    bool connected = false;
+
+    for (uint16_t i = 0; i < g_c->num_chats; ++i) {
+        const Group_c *g = get_group_c(g_c, i);
+
+        if (g == nullptr || g->status != GROUPCHAT_STATUS_CONNECTED) {
+            continue;
+        }
+
+        if (g->need_send_name) {
+            return 0;
+        }
+
+        connected = true;
+    }
+
+    if (!connected) {
+        return UINT64_MAX;
+    }
+
+    return (mono_time_get(g_c->mono_time) + 1) * 1000;
+}
+
 /** Free everything related with group chats. */
 void kill_groupchats(Group_Chats *g_c)
 {
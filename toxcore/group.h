@@ -346,6 +346,15 @@ Group_Chats *_Nullable new_groupchats(const Mono_Time *_Nonnull mono_time, const
 
 /** main groupchats loop. */
 void do_groupchats(Group_Chats *_Nonnull g_c, void *_Nullable userdata);
+/**
+ * @brief The time in milliseconds at which `do_groupchats` has timer work to do.
+ *
+ * Conference timers count whole seconds, so connected conferences are looked
+ * at once a second.
+ *
+ * @retval UINT64_MAX if no conference is connected.
+ */
+uint64_t groupchats_deadline(const Group_Chats *_Nonnull g_c);
 /** Free everything related with group chats. */
 void kill_groupchats(Group_Chats *_Nullable g_c);
 #endif /* C_TOXCORE_TOXCORE_GROUP_H */
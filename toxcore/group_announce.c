@@ -466,6 +466,15 @@ void do_gca(const Mono_Time *mono_time, GC_Announces_List *gc_announces_list)
     }
 }
 
+uint64_t gca_deadline(const GC_Announces_List *gc_announces_list)
+{
+    if (gc_announces_list->root_announces == nullptr) {
+        return UINT64_MAX;
+    }
+
+    return (gc_announces_list->last_timeout_check + GCA_DO_GCA_TIMEOUT) * 1000;
+}
+
 void cleanup_gca(GC_Announces_List *gc_announces_list, const uint8_t *chat_id)
 {
     if (gc_announces_list == nullptr || chat_id == nullptr) {
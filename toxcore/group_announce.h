@@ -104,6 +104,9 @@ void kill_gca(GC_Announces_List *_Nullable announces_list);
  */
 void do_gca(const Mono_Time *_Nonnull mono_time, GC_Announces_List *_Nonnull gc_announces_list);
 
+/** @brief The time in milliseconds at which `do_gca` next removes stale announces, or UINT64_MAX if there are none. */
+uint64_t gca_deadline(const GC_Announces_List *_Nonnull gc_announces_list);
+
 /** @brief Frees all dynamically allocated memory associated with an announces list entry.
  *
  * @param gc_announces_list The announces list we want to search through.
@@ -7178,6 +7178,63 @@ void do_gc(GC_Session *c, void *userdata)
     }
 }
 
+uint64_t gc_deadline(const GC_Session *c)
+{
+    uint64_t deadline = UINT64_MAX;
+
+    for (uint32_t i = 0; i < c->chats_index; ++i) {
+        const GC_Chat *chat = &c->chats[i];
+
+        if (chat->connection_state == CS_NONE) {
+            continue;
+        }
+
+        if (chat->flag_exit) {
+            return 0;
+        }
+
+        deadline = min_u64(deadline, (mono_time_get(chat->mono_time) + 1) * 1000);
+
+        if (chat->tcp_conn != nullptr && group_can_handle_packets(chat)) {
+            deadline = min_u64(deadline, tcp_connections_deadline(chat->tcp_conn));
+        }
+    }
+
+    return deadline;
+}
+
+uint32_t gc_copy_interests(const GC_Session *c, Ev_Interest *interests, uint32_t max_interests)
+{
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i < c->chats_index; ++i) {
+        const GC_Chat *chat = &c->chats[i];
+
+        if (chat->connection_state == CS_NONE || chat->tcp_conn == nullptr || !group_can_handle_packets(chat)) {
+            continue;
+        }
+
+        const bool has_room = interests != nullptr && count < max_interests;
+        count += tcp_connections_copy_interests(chat->tcp_conn, has_room ? &interests[count] : nullptr,
+                                                has_room ? max_interests - count : 0);
+    }
+
+    return count;
+}
+
+void gc_sync_ev(const GC_Session *c, Ev *ev, void *data)
+{
+    for (uint32_t i = 0; i < c->chats_index; ++i) {
+        const GC_Chat *chat = &c->chats[i];
+
+        if (chat->connection_state == CS_NONE || chat->tcp_conn == nullptr) {
+            continue;
+        }
+
+        tcp_connections_sync_ev(chat->tcp_conn, group_can_handle_packets(chat) ? ev : nullptr, data);
+    }
+}
+
 /** @brief Set the size of the groupchat list to n.
  *
  * Return true on success.
@@ -18,6 +18,7 @@
 #include "bin_pack.h"
 #include "bin_unpack.h"
 #include "crypto_core.h"
+#include "ev.h"
 #include "group_announce.h"
 #include "group_common.h"
 #include "group_connection.h"
@@ -537,6 +538,32 @@ void gc_callback_voice_state(const Messenger *_Nonnull m, gc_voice_state_cb *_Nu
 
 /** @brief The main loop. Should be called with every Messenger iteration. */
 void do_gc(GC_Session *_Nonnull c, void *_Nullable userdata);
+
+/**
+ * @brief The time in milliseconds at which `do_gc` has timer work to do.
+ *
+ * Group timers count whole seconds, so each group is looked at once a second,
+ * and its relay connections as their own timers need.
+ *
+ * @retval UINT64_MAX if there are no groups.
+ */
+uint64_t gc_deadline(const GC_Session *_Nonnull c);
+
+/**
+ * @brief Copy the sockets of all group relay connections and the events
+ *   `do_gc` waits for on them into @p interests.
+ *
+ * @return the number of sockets, which may be more than @p max_interests.
+ */
+uint32_t gc_copy_interests(const GC_Session *_Nonnull c, Ev_Interest *_Nullable interests, uint32_t max_interests);
+
+/**
+ * @brief Keep the sockets of the group relay connections `do_gc` serves
+ *   registered with @p ev, and remove those of groups it doesn't.
+ *
+ * See `tcp_connections_sync_ev`. Passing NULL removes them all.
+ */
+void gc_sync_ev(const GC_Session *_Nonnull c, Ev *_Nullable ev, void *_Nullable data);
 /**
  * Make sure that DHT is initialized before calling this.
  * Returns a NULL pointer on failure.
@@ -0,0 +1,431 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+#include "key_agreement.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#include "attributes.h"
+#include "ccompat.h"
+#include "crypto_core.h"
+#include "logger.h"
+#include "mem.h"
+#include "network.h"
+#include "shared_key_cache.h"
+
+/** End of a packet list. */
+#define KEY_AGREEMENT_NONE UINT32_MAX
+
+/**
+ * @brief A key that is queued, being computed, or ready to be stored.
+ *
+ * The polling thread fills in the cache and public key before queueing the
+ * job and the worker fills in the result, both under the lock. The packet list
+ * is only ever touched by the polling thread.
+ */
+typedef struct Key_Agreement_Job {
+    Shared_Key_Cache *_Nullable cache;
+    uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
+    bool ok;
+
+    bool in_use;
+    /* Packets waiting for this key, oldest first. */
+    uint32_t first_packet;
+    uint32_t last_packet;
+    uint32_t num_packets;
+} Key_Agreement_Job;
+
+typedef struct Key_Agreement_Packet {
+    IP_Port source;
+    /* Next packet waiting for the same key, or next free packet. */
+    uint32_t next;
+    uint16_t length;
+    uint8_t data[MAX_UDP_PACKET_SIZE];
+} Key_Agreement_Packet;
+
+typedef struct Key_Agreement_Route {
+    Shared_Key_Cache *_Nullable cache;
+    uint16_t public_key_offset;
+} Key_Agreement_Route;
+
+/** @brief Ring of job indices, guarded by the lock. */
+typedef struct Key_Agreement_Ring {
+    uint32_t jobs[KEY_AGREEMENT_MAX_KEYS];
+    uint32_t start;
+    uint32_t length;
+} Key_Agreement_Ring;
+
+struct Key_Agreement {
+    const Logger *_Nonnull log;
+    const Memory *_Nonnull mem;
+    Networking_Core *_Nonnull net;
+
+    /* Indexed by packet id. */
+    Key_Agreement_Route routes[256];
+
+    Key_Agreement_Job jobs[KEY_AGREEMENT_MAX_KEYS];
+    uint32_t free_jobs[KEY_AGREEMENT_MAX_KEYS];
+    uint32_t num_free_jobs;
+
+    Key_Agreement_Packet *_Nonnull packets;
+    uint32_t free_packet;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    bool stopping;
+    /* Jobs for the workers, and jobs the workers finished. */
+    Key_Agreement_Ring queued;
+    Key_Agreement_Ring done;
+
+    pthread_t *_Nonnull threads;
+    uint32_t num_threads;
+
+    uint64_t parked;
+    uint64_t dropped;
+    uint64_t computed;
+};
+
+static void key_agreement_ring_push(Key_Agreement_Ring *_Nonnull ring, uint32_t job)
+{
+    ring->jobs[(ring->start + ring->length) % KEY_AGREEMENT_MAX_KEYS] = job;
+    ++ring->length;
+}
+
+static uint32_t key_agreement_ring_pop(Key_Agreement_Ring *_Nonnull ring)
+{
+    const uint32_t job = ring->jobs[ring->start];
+    ring->start = (ring->start + 1) % KEY_AGREEMENT_MAX_KEYS;
+    --ring->length;
+    return job;
+}
+
+static void *_Nullable key_agreement_worker(void *_Nonnull arg)
+{
+    Key_Agreement *ka = (Key_Agreement *)arg;
+
+    pthread_mutex_lock(&ka->lock);
+
+    while (true) {
+        while (!ka->stopping && ka->queued.length == 0) {
+            pthread_cond_wait(&ka->wake, &ka->lock);
+        }
+
+        if (ka->stopping) {
+            break;
+        }
+
+        const uint32_t index = key_agreement_ring_pop(&ka->queued);
+        Key_Agreement_Job *job = &ka->jobs[index];
+        pthread_mutex_unlock(&ka->lock);
+
+        const bool ok = shared_key_cache_compute(job->cache, job->public_key, job->shared_key);
+
+        pthread_mutex_lock(&ka->lock);
+        job->ok = ok;
+        key_agreement_ring_push(&ka->done, index);
+    }
+
+    pthread_mutex_unlock(&ka->lock);
+    return nullptr;
+}
+
+/** @brief The job computing the key for @p public_key in @p cache, if there is one. */
+static Key_Agreement_Job *_Nullable key_agreement_find_job(Key_Agreement *_Nonnull ka, const Shared_Key_Cache *_Nonnull cache,
+        const uint8_t *_Nonnull public_key)
+{
+    if (ka->num_free_jobs == KEY_AGREEMENT_MAX_KEYS) {
+        return nullptr;
+    }
+
+    for (uint32_t i = 0; i < KEY_AGREEMENT_MAX_KEYS; ++i) {
+        Key_Agreement_Job *job = &ka->jobs[i];
+
+        if (job->in_use && job->cache == cache && pk_equal(job->public_key, public_key)) {
+            return job;
+        }
+    }
+
+    return nullptr;
+}
+
+/** @brief Queue the computation of the key for @p public_key in @p cache.
+ *
+ * @return nullptr if too many keys are pending already.
+ */
+static Key_Agreement_Job *_Nullable key_agreement_start_job(Key_Agreement *_Nonnull ka, Shared_Key_Cache *_Nonnull cache,
+        const uint8_t *_Nonnull public_key)
+{
+    if (ka->num_free_jobs == 0) {
+        return nullptr;
+    }
+
+    const uint32_t index = ka->free_jobs[--ka->num_free_jobs];
+    Key_Agreement_Job *job = &ka->jobs[index];
+    job->in_use = true;
+    job->first_packet = KEY_AGREEMENT_NONE;
+    job->last_packet = KEY_AGREEMENT_NONE;
+    job->num_packets = 0;
+
+    pthread_mutex_lock(&ka->lock);
+    job->cache = cache;
+    memcpy(job->public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    key_agreement_ring_push(&ka->queued, index);
+    pthread_cond_signal(&ka->wake);
+    pthread_mutex_unlock(&ka->lock);
+
+    return job;
+}
+
+static void key_agreement_park(Key_Agreement *_Nonnull ka, Shared_Key_Cache *_Nonnull cache, const uint8_t *_Nonnull public_key,
+                               const IP_Port *_Nonnull source, const uint8_t *_Nonnull packet, uint16_t length)
+{
+    if (ka->free_packet == KEY_AGREEMENT_NONE || length > MAX_UDP_PACKET_SIZE) {
+        ++ka->dropped;
+        return;
+    }
+
+    Key_Agreement_Job *job = key_agreement_find_job(ka, cache, public_key);
+
+    if (job == nullptr) {
+        job = key_agreement_start_job(ka, cache, public_key);
+    }
+
+    if (job == nullptr || job->num_packets == KEY_AGREEMENT_PACKETS_PER_KEY) {
+        ++ka->dropped;
+        return;
+    }
+
+    const uint32_t index = ka->free_packet;
+    Key_Agreement_Packet *parked = &ka->packets[index];
+    ka->free_packet = parked->next;
+
+    parked->source = *source;
+    parked->next = KEY_AGREEMENT_NONE;
+    parked->length = length;
+    memcpy(parked->data, packet, length);
+
+    if (job->last_packet == KEY_AGREEMENT_NONE) {
+        job->first_packet = index;
+    } else {
+        ka->packets[job->last_packet].next = index;
+    }
+
+    job->last_packet = index;
+    ++job->num_packets;
+    ++ka->parked;
+}
+
+static bool key_agreement_gate(void *_Nullable object, const IP_Port *_Nonnull source, const uint8_t *_Nonnull packet, uint16_t length)
+{
+    Key_Agreement *ka = (Key_Agreement *)object;
+    const Key_Agreement_Route *route = &ka->routes[packet[0]];
+
+    if (route->cache == nullptr || length < route->public_key_offset + CRYPTO_PUBLIC_KEY_SIZE) {
+        return true;
+    }
+
+    const uint8_t *public_key = &packet[route->public_key_offset];
+
+    if (shared_key_cache_contains(route->cache, public_key)) {
+        return true;
+    }
+
+    key_agreement_park(ka, route->cache, public_key, source, packet, length);
+    return false;
+}
+
+/** @brief Store the key of a finished job and hand its packets to their handlers. */
+static void key_agreement_finish(Key_Agreement *_Nonnull ka, uint32_t index, void *_Nullable userdata)
+{
+    Key_Agreement_Job *job = &ka->jobs[index];
+
+    if (job->ok) {
+        shared_key_cache_insert(job->cache, job->public_key, job->shared_key);
+        ++ka->computed;
+    }
+
+    crypto_memzero(job->shared_key, sizeof(job->shared_key));
+
+    uint32_t next = job->first_packet;
+
+    while (next != KEY_AGREEMENT_NONE) {
+        Key_Agreement_Packet *parked = &ka->packets[next];
+
+        // Without a key, the handler would only try to compute it again.
+        if (job->ok) {
+            networking_handle_packet(ka->net, &parked->source, parked->data, parked->length, userdata);
+        }
+
+        const uint32_t freed = next;
+        next = parked->next;
+        parked->next = ka->free_packet;
+        ka->free_packet = freed;
+    }
+
+    job->in_use = false;
+    ka->free_jobs[ka->num_free_jobs] = index;
+    ++ka->num_free_jobs;
+}
+
+void key_agreement_poll(Key_Agreement *ka, void *userdata)
+{
+    uint32_t done[KEY_AGREEMENT_MAX_KEYS];
+    uint32_t count = 0;
+
+    pthread_mutex_lock(&ka->lock);
+
+    while (ka->done.length > 0) {
+        done[count] = key_agreement_ring_pop(&ka->done);
+        ++count;
+    }
+
+    pthread_mutex_unlock(&ka->lock);
+
+    for (uint32_t i = 0; i < count; ++i) {
+        key_agreement_finish(ka, done[i], userdata);
+    }
+}
+
+uint32_t key_agreement_run_interval(Key_Agreement *ka)
+{
+    if (ka->num_free_jobs == KEY_AGREEMENT_MAX_KEYS) {
+        return UINT32_MAX;
+    }
+
+    pthread_mutex_lock(&ka->lock);
+    const bool ready = ka->done.length > 0;
+    pthread_mutex_unlock(&ka->lock);
+
+    return ready ? 0 : 1;
+}
+
+void key_agreement_get_stats(Key_Agreement *ka, Key_Agreement_Stats *stats)
+{
+    stats->parked = ka->parked;
+    stats->dropped = ka->dropped;
+    stats->computed = ka->computed;
+    stats->pending = KEY_AGREEMENT_MAX_KEYS - ka->num_free_jobs;
+}
+
+void key_agreement_register(Key_Agreement *ka, uint8_t packet_id, Shared_Key_Cache *cache, uint16_t public_key_offset)
+{
+    ka->routes[packet_id].cache = cache;
+    ka->routes[packet_id].public_key_offset = public_key_offset;
+    networking_set_gate(ka->net, packet_id, &key_agreement_gate, ka);
+}
+
+/** @brief Wake up and join the first @p count workers. */
+static void key_agreement_stop(Key_Agreement *_Nonnull ka, uint32_t count)
+{
+    pthread_mutex_lock(&ka->lock);
+    ka->stopping = true;
+    pthread_cond_broadcast(&ka->wake);
+    pthread_mutex_unlock(&ka->lock);
+
+    for (uint32_t i = 0; i < count; ++i) {
+        pthread_join(ka->threads[i], nullptr);
+    }
+}
+
+static void key_agreement_free(Key_Agreement *_Nonnull ka)
+{
+    for (uint32_t i = 0; i < KEY_AGREEMENT_MAX_KEYS; ++i) {
+        crypto_memzero(ka->jobs[i].shared_key, sizeof(ka->jobs[i].shared_key));
+    }
+
+    pthread_cond_destroy(&ka->wake);
+    pthread_mutex_destroy(&ka->lock);
+
+    const Memory *mem = ka->mem;
+    mem_delete(mem, ka->threads);
+    mem_delete(mem, ka->packets);
+    mem_delete(mem, ka);
+}
+
+Key_Agreement *key_agreement_new(const Logger *log, const Memory *mem, Networking_Core *net, uint32_t num_threads)
+{
+    if (num_threads == 0 || num_threads > KEY_AGREEMENT_MAX_THREADS) {
+        return nullptr;
+    }
+
+    Key_Agreement *ka = (Key_Agreement *)mem_alloc(mem, sizeof(Key_Agreement));
+
+    if (ka == nullptr) {
+        return nullptr;
+    }
+
+    Key_Agreement_Packet *packets = (Key_Agreement_Packet *)mem_valloc(mem, KEY_AGREEMENT_MAX_PARKED, sizeof(Key_Agreement_Packet));
+    pthread_t *threads = (pthread_t *)mem_valloc(mem, num_threads, sizeof(pthread_t));
+
+    if (packets == nullptr || threads == nullptr) {
+        mem_delete(mem, threads);
+        mem_delete(mem, packets);
+        mem_delete(mem, ka);
+        return nullptr;
+    }
+
+    if (pthread_mutex_init(&ka->lock, nullptr) != 0) {
+        mem_delete(mem, threads);
+        mem_delete(mem, packets);
+        mem_delete(mem, ka);
+        return nullptr;
+    }
+
+    if (pthread_cond_init(&ka->wake, nullptr) != 0) {
+        pthread_mutex_destroy(&ka->lock);
+        mem_delete(mem, threads);
+        mem_delete(mem, packets);
+        mem_delete(mem, ka);
+        return nullptr;
+    }
+
+    ka->log = log;
+    ka->mem = mem;
+    ka->net = net;
+    ka->packets = packets;
+    ka->threads = threads;
+
+    for (uint32_t i = 0; i < KEY_AGREEMENT_MAX_KEYS; ++i) {
+        ka->free_jobs[i] = KEY_AGREEMENT_MAX_KEYS - 1 - i;
+    }
+
+    ka->num_free_jobs = KEY_AGREEMENT_MAX_KEYS;
+
+    for (uint32_t i = 0; i < KEY_AGREEMENT_MAX_PARKED; ++i) {
+        packets[i].next = i + 1 < KEY_AGREEMENT_MAX_PARKED ? i + 1 : KEY_AGREEMENT_NONE;
+    }
+
+    ka->free_packet = 0;
+
+    for (uint32_t i = 0; i < num_threads; ++i) {
+        if (pthread_create(&ka->threads[i], nullptr, &key_agreement_worker, ka) != 0) {
+            LOGGER_ERROR(log, "could not start key agreement worker %u", i);
+            key_agreement_stop(ka, i);
+            key_agreement_free(ka);
+            return nullptr;
+        }
+    }
+
+    ka->num_threads = num_threads;
+
+    return ka;
+}
+
+void key_agreement_kill(Key_Agreement *ka)
+{
+    if (ka == nullptr) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < 256; ++i) {
+        if (ka->routes[i].cache != nullptr) {
+            networking_set_gate(ka->net, (uint8_t)i, nullptr, nullptr);
+        }
+    }
+
+    key_agreement_stop(ka, ka->num_threads);
+    key_agreement_free(ka);
+}
@@ -0,0 +1,111 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+/** @file
+ * @brief Shared key computation off the packet path.
+ *
+ * Computing a shared key takes tens of microseconds, far longer than handling
+ * a packet whose key is cached. This stage sits in front of the handlers of
+ * packets that carry the sender's public key at a fixed offset. Packets whose
+ * key is cached go straight to their handler. All others are parked while a
+ * pool of worker threads computes their keys, and are handed to their handler
+ * by `key_agreement_poll` once the key is in the cache. That way a flood of
+ * packets from new peers doesn't delay packets from the peers we know.
+ */
+#ifndef C_TOXCORE_TOXCORE_KEY_AGREEMENT_H
+#define C_TOXCORE_TOXCORE_KEY_AGREEMENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "attributes.h"
+#include "logger.h"
+#include "mem.h"
+#include "network.h"
+#include "shared_key_cache.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Upper bound for the number of worker threads. */
+#define KEY_AGREEMENT_MAX_THREADS 64
+
+/** Number of distinct keys that can be queued or computed at once. */
+#define KEY_AGREEMENT_MAX_KEYS 256
+
+/** Number of packets that can be parked at once. */
+#define KEY_AGREEMENT_MAX_PARKED 1024
+
+/** Number of packets that can wait for the same key. Further packets are dropped. */
+#define KEY_AGREEMENT_PACKETS_PER_KEY 8
+
+typedef struct Key_Agreement Key_Agreement;
+
+typedef struct Key_Agreement_Stats {
+    /** Packets that had to wait for their key. */
+    uint64_t parked;
+    /** Packets dropped because too many were waiting already. */
+    uint64_t dropped;
+    /** Keys computed by the workers. */
+    uint64_t computed;
+    /** Keys queued or being computed right now. */
+    uint32_t pending;
+} Key_Agreement_Stats;
+
+/**
+ * @brief Starts @p num_threads workers computing keys for packets received on @p net.
+ *
+ * @return nullptr if @p num_threads is 0 or above `KEY_AGREEMENT_MAX_THREADS`,
+ *   or on allocation or thread creation failure.
+ */
+Key_Agreement *_Nullable key_agreement_new(const Logger *_Nonnull log, const Memory *_Nonnull mem, Networking_Core *_Nonnull net,
+        uint32_t num_threads);
+
+/**
+ * @brief Removes the gates, stops the workers and drops all parked packets.
+ *
+ * Must be called before the caches registered with `key_agreement_register`
+ * are freed.
+ */
+void key_agreement_kill(Key_Agreement *_Nullable ka);
+
+/**
+ * @brief Parks packets beginning with @p packet_id until @p cache has the key
+ *   of their sender.
+ *
+ * @param public_key_offset Position of the sender's public key in the packet.
+ *   Packets too short to contain it go to their handler right away, which
+ *   rejects them.
+ *
+ * The handler should use `shared_key_cache_get` or `shared_key_cache_lookup`
+ * on the same cache, which then finds the key.
+ */
+void key_agreement_register(Key_Agreement *_Nonnull ka, uint8_t packet_id, Shared_Key_Cache *_Nonnull cache,
+                            uint16_t public_key_offset);
+
+/**
+ * @brief Stores the keys the workers computed and hands their packets to
+ *   the handlers.
+ *
+ * Call this from the thread that calls `networking_poll`, right after it.
+ */
+void key_agreement_poll(Key_Agreement *_Nonnull ka, void *_Nullable userdata);
+
+/**
+ * @brief Milliseconds until `key_agreement_poll` should be called again.
+ *
+ * 0 if keys are ready, 1 while keys are being computed, `UINT32_MAX` if
+ * nothing is pending.
+ */
+uint32_t key_agreement_run_interval(Key_Agreement *_Nonnull ka);
+
+/** @brief Copies the counters of @p ka into @p stats. */
+void key_agreement_get_stats(Key_Agreement *_Nonnull ka, Key_Agreement_Stats *_Nonnull stats);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* C_TOXCORE_TOXCORE_KEY_AGREEMENT_H */
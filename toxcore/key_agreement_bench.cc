@@ -0,0 +1,287 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "crypto_core.h"
+#include "key_agreement.h"
+#include "logger.h"
+#include "mono_time.h"
+#include "net.h"
+#include "network.h"
+#include "os_memory.h"
+#include "os_network.h"
+#include "shared_key_cache.h"
+
+namespace {
+
+using PublicKey = std::array<uint8_t, CRYPTO_PUBLIC_KEY_SIZE>;
+
+constexpr uint8_t kBenchPacketId = 0xf0;
+constexpr uint16_t kPublicKeyOffset = 1;
+/** Packets sent per iteration, known and new peers mixed. */
+constexpr int kBurstSize = 128;
+/** Peers whose keys are cached, like the nodes close to us in the DHT. */
+constexpr std::size_t kKnownPeers = 64;
+
+/** Packet layout: id, sender public key, send time, whether the sender is known. */
+constexpr std::size_t kTimeOffset = kPublicKeyOffset + CRYPTO_PUBLIC_KEY_SIZE;
+constexpr std::size_t kKnownOffset = kTimeOffset + sizeof(int64_t);
+constexpr std::size_t kPacketSize = kKnownOffset + 1;
+
+int64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+struct Receiver {
+    Shared_Key_Cache *cache = nullptr;
+    /** Time from sending to handling each packet of a known peer. */
+    std::vector<int64_t> known_latencies_ns;
+    int64_t handled = 0;
+};
+
+/** Handles a packet like the DHT and onion handlers do: get the key, then use it. */
+int handle_bench_packet(void *object, const IP_Port *source, const uint8_t *packet, uint16_t length, void *userdata)
+{
+    Receiver *receiver = static_cast<Receiver *>(object);
+
+    if (length != kPacketSize) {
+        return 1;
+    }
+
+    uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
+
+    if (!shared_key_cache_get(receiver->cache, packet + kPublicKeyOffset, shared_key)) {
+        return 1;
+    }
+
+    benchmark::DoNotOptimize(shared_key);
+    ++receiver->handled;
+
+    if (packet[kKnownOffset] != 0) {
+        int64_t sent;
+        std::memcpy(&sent, packet + kTimeOffset, sizeof(sent));
+        receiver->known_latencies_ns.push_back(now_ns() - sent);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Latency of packets from peers with a cached key while packets from
+ *   new peers flood the node, as during a scan.
+ *
+ * Arguments are the number of key agreement workers (0 computes keys in the
+ * handler, on the receiving thread) and the number of packets from new peers
+ * for each packet from a known peer. Each iteration sends one burst over
+ * loopback and polls until every packet is handled or dropped.
+ */
+class KeyAgreementBenchFixture : public benchmark::Fixture {
+public:
+    void SetUp(::benchmark::State &state) override
+    {
+        ns = os_network();
+        if (ns == nullptr) {
+            setup_error = "os_network failed";
+            return;
+        }
+        mem = os_memory();
+        log = logger_new(mem);
+        mono_time = mono_time_new(mem, nullptr, nullptr);
+
+        IP ip;
+        ip_init(&ip, false);
+        ip.ip.v4 = get_ip4_loopback();
+
+        receiver = new_networking_ex(log, mem, ns, &ip, 33445, 33545, nullptr);
+        sender = new_networking_ex(log, mem, ns, &ip, 33445, 33545, nullptr);
+        if (log == nullptr || mono_time == nullptr || receiver == nullptr || sender == nullptr) {
+            setup_error = "new_networking_ex failed";
+            return;
+        }
+
+        std::mt19937 rng(42);
+        std::uniform_int_distribution<int> byte(0, 255);
+
+        for (uint8_t &b : self_sk) {
+            b = static_cast<uint8_t>(byte(rng));
+        }
+
+        // Room for every key the flood brings in, so the known peers stay cached.
+        cache = shared_key_cache_new(log, mono_time, mem, self_sk.data(), 600, 1 << 16);
+        if (cache == nullptr) {
+            setup_error = "shared_key_cache_new failed";
+            return;
+        }
+
+        known.resize(kKnownPeers);
+
+        for (PublicKey &pk : known) {
+            for (uint8_t &b : pk) {
+                b = static_cast<uint8_t>(byte(rng));
+            }
+
+            shared_key_cache_lookup(cache, pk.data());
+        }
+
+        recv.cache = cache;
+        networking_registerhandler(receiver, kBenchPacketId, &handle_bench_packet, &recv);
+
+        const uint32_t workers = static_cast<uint32_t>(state.range(0));
+
+        if (workers > 0) {
+            ka = key_agreement_new(log, mem, receiver, workers);
+            if (ka == nullptr) {
+                setup_error = "key_agreement_new failed";
+                return;
+            }
+            key_agreement_register(ka, kBenchPacketId, cache, kPublicKeyOffset);
+        }
+
+        dest.ip = ip;
+        dest.port = net_port(receiver);
+    }
+
+    void TearDown(const ::benchmark::State &state) override
+    {
+        key_agreement_kill(ka);
+        shared_key_cache_free(cache);
+        kill_networking(sender);
+        kill_networking(receiver);
+        mono_time_free(mem, mono_time);
+        logger_kill(log);
+        ka = nullptr;
+        cache = nullptr;
+        sender = nullptr;
+        receiver = nullptr;
+        mono_time = nullptr;
+        log = nullptr;
+        recv = Receiver{};
+    }
+
+    void send(const uint8_t *public_key, bool is_known)
+    {
+        uint8_t packet[kPacketSize];
+        packet[0] = kBenchPacketId;
+        std::memcpy(packet + kPublicKeyOffset, public_key, CRYPTO_PUBLIC_KEY_SIZE);
+        const int64_t sent = now_ns();
+        std::memcpy(packet + kTimeOffset, &sent, sizeof(sent));
+        packet[kKnownOffset] = is_known ? 1 : 0;
+        sendpacket(sender, &dest, packet, sizeof(packet));
+    }
+
+    /** @brief Receive until the socket stays empty and no key is pending. */
+    void drain()
+    {
+        for (int idle = 0; idle < 100;) {
+            const int64_t before = recv.handled;
+            networking_poll(receiver, nullptr);
+
+            if (ka != nullptr) {
+                key_agreement_poll(ka, nullptr);
+
+                if (key_agreement_run_interval(ka) != UINT32_MAX) {
+                    // Let the workers have the CPU, as the event loop would.
+                    std::this_thread::yield();
+                    idle = 0;
+                    continue;
+                }
+            }
+
+            idle = recv.handled == before ? idle + 1 : 0;
+        }
+    }
+
+protected:
+    const Network *ns = nullptr;
+    const Memory *mem = nullptr;
+    Logger *log = nullptr;
+    Mono_Time *mono_time = nullptr;
+    Networking_Core *sender = nullptr;
+    Networking_Core *receiver = nullptr;
+    std::array<uint8_t, CRYPTO_SECRET_KEY_SIZE> self_sk{};
+    Shared_Key_Cache *cache = nullptr;
+    Key_Agreement *ka = nullptr;
+    std::vector<PublicKey> known;
+    IP_Port dest{};
+    Receiver recv;
+    std::string setup_error;
+};
+
+double percentile_us(std::vector<int64_t> &sorted_ns, double p)
+{
+    if (sorted_ns.empty()) {
+        return 0.0;
+    }
+
+    const std::size_t i = std::min(sorted_ns.size() - 1, static_cast<std::size_t>(p * static_cast<double>(sorted_ns.size())));
+    return static_cast<double>(sorted_ns[i]) / 1000.0;
+}
+
+BENCHMARK_DEFINE_F(KeyAgreementBenchFixture, KnownPeerLatency)(benchmark::State &state)
+{
+    if (!setup_error.empty()) {
+        state.SkipWithError(setup_error.c_str());
+        return;
+    }
+
+    const int new_per_known = static_cast<int>(state.range(1));
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<int> byte(0, 255);
+    std::size_t next_known = 0;
+    PublicKey fresh;
+
+    for (auto _ : state) {
+        for (int i = 0; i < kBurstSize; ++i) {
+            if (i % (new_per_known + 1) == new_per_known) {
+                send(known[next_known].data(), true);
+                next_known = (next_known + 1) % known.size();
+                continue;
+            }
+
+            for (uint8_t &b : fresh) {
+                b = static_cast<uint8_t>(byte(rng));
+            }
+
+            send(fresh.data(), false);
+        }
+
+        drain();
+    }
+
+    std::sort(recv.known_latencies_ns.begin(), recv.known_latencies_ns.end());
+    state.counters["known_p50_us"] = percentile_us(recv.known_latencies_ns, 0.5);
+    state.counters["known_p99_us"] = percentile_us(recv.known_latencies_ns, 0.99);
+    state.counters["known_max_us"] = percentile_us(recv.known_latencies_ns, 1.0);
+    state.counters["handled"] = static_cast<double>(recv.handled);
+    state.SetItemsProcessed(state.iterations() * kBurstSize);
+
+    if (ka != nullptr) {
+        Key_Agreement_Stats stats;
+        key_agreement_get_stats(ka, &stats);
+        state.counters["dropped"] = static_cast<double>(stats.dropped);
+    }
+}
+
+BENCHMARK_REGISTER_F(KeyAgreementBenchFixture, KnownPeerLatency)
+    ->ArgNames({"workers", "new_per_known"})
+    ->ArgsProduct({{0, 1, 4}, {0, 3, 15}})
+    ->UseRealTime();
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,283 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+// clang-format off
+#include "../testing/support/public/simulated_environment.hh"
+#include "key_agreement.h"
+// clang-format on
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "crypto_core.h"
+#include "logger.h"
+#include "mono_time.h"
+#include "network.h"
+#include "shared_key_cache.h"
+
+namespace {
+
+using PublicKey = std::array<uint8_t, CRYPTO_PUBLIC_KEY_SIZE>;
+
+constexpr uint8_t kPacketId = 0xf0;
+constexpr uint16_t kPublicKeyOffset = 1;
+
+struct Received {
+    Shared_Key_Cache *cache = nullptr;
+    std::vector<std::vector<uint8_t>> packets;
+    /** Whether the key of each packet was in the cache when its handler ran. */
+    std::vector<bool> key_cached;
+};
+
+class KeyAgreementTest : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        alice_node = env.create_node(33445);
+        bob_node = env.create_node(33446);
+        mem = &bob_node->c_memory;
+
+        log = logger_new(mem);
+        mono_time = mono_time_new(
+            mem,
+            [](void *user_data) -> uint64_t {
+                return static_cast<tox::test::SimulatedEnvironment *>(user_data)->fake_clock().current_time_ms();
+            },
+            &env);
+        mono_time_update(mono_time);
+
+        IP ip;
+        ip_init(&ip, false);
+        // The nodes' own sockets use their ports already.
+        alice = new_networking_ex(log, &alice_node->c_memory, &alice_node->c_network, &ip, 33545, 33545, nullptr);
+        bob = new_networking_ex(log, mem, &bob_node->c_network, &ip, 33546, 33546, nullptr);
+        ASSERT_NE(alice, nullptr);
+        ASSERT_NE(bob, nullptr);
+
+        crypto_new_keypair(&bob_node->c_random, bob_pk, bob_sk);
+        cache = shared_key_cache_new(log, mono_time, mem, bob_sk, 60, 64);
+        ASSERT_NE(cache, nullptr);
+        received.cache = cache;
+
+        networking_registerhandler(
+            bob, kPacketId,
+            [](void *object, const IP_Port *, const uint8_t *packet, uint16_t length, void *) {
+                Received *r = static_cast<Received *>(object);
+                r->packets.emplace_back(packet, packet + length);
+                r->key_cached.push_back(length >= kPublicKeyOffset + CRYPTO_PUBLIC_KEY_SIZE
+                                        && shared_key_cache_contains(r->cache, packet + kPublicKeyOffset));
+                return 0;
+            },
+            &received);
+
+        ka = key_agreement_new(log, mem, bob, 2);
+        ASSERT_NE(ka, nullptr);
+        key_agreement_register(ka, kPacketId, cache, kPublicKeyOffset);
+
+        dest.ip = bob_node->node->ip;
+        dest.port = net_htons(33546);
+    }
+
+    void TearDown() override
+    {
+        key_agreement_kill(ka);
+        shared_key_cache_free(cache);
+        kill_networking(bob);
+        kill_networking(alice);
+        mono_time_free(mem, mono_time);
+        logger_kill(log);
+    }
+
+    PublicKey new_public_key()
+    {
+        PublicKey pk;
+        uint8_t sk[CRYPTO_SECRET_KEY_SIZE];
+        crypto_new_keypair(&alice_node->c_random, pk.data(), sk);
+        return pk;
+    }
+
+    void send(const PublicKey &pk, uint8_t tag)
+    {
+        uint8_t packet[1 + CRYPTO_PUBLIC_KEY_SIZE + 1];
+        packet[0] = kPacketId;
+        std::memcpy(packet + 1, pk.data(), pk.size());
+        packet[sizeof(packet) - 1] = tag;
+        ASSERT_EQ(sendpacket(alice, &dest, packet, sizeof(packet)), sizeof(packet));
+    }
+
+    void receive()
+    {
+        env.advance_time(10);
+        mono_time_update(mono_time);
+        networking_poll(bob, nullptr);
+    }
+
+    /** @brief Poll until nothing is pending any more, or give up after a while. */
+    void finish_pending()
+    {
+        for (int i = 0; i < 1000 && key_agreement_run_interval(ka) != UINT32_MAX; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            key_agreement_poll(ka, nullptr);
+        }
+    }
+
+    tox::test::SimulatedEnvironment env{12345};
+    std::unique_ptr<tox::test::ScopedToxSystem> alice_node;
+    std::unique_ptr<tox::test::ScopedToxSystem> bob_node;
+    const Memory *mem = nullptr;
+    Logger *log = nullptr;
+    Mono_Time *mono_time = nullptr;
+    Networking_Core *alice = nullptr;
+    Networking_Core *bob = nullptr;
+    uint8_t bob_pk[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t bob_sk[CRYPTO_SECRET_KEY_SIZE];
+    Shared_Key_Cache *cache = nullptr;
+    Key_Agreement *ka = nullptr;
+    IP_Port dest{};
+    Received received;
+};
+
+TEST_F(KeyAgreementTest, PacketsFromKnownKeysAreHandledRightAway)
+{
+    const PublicKey pk = new_public_key();
+    ASSERT_NE(shared_key_cache_lookup(cache, pk.data()), nullptr);
+
+    send(pk, 1);
+    receive();
+
+    ASSERT_EQ(received.packets.size(), 1);
+    EXPECT_TRUE(received.key_cached[0]);
+
+    Key_Agreement_Stats stats;
+    key_agreement_get_stats(ka, &stats);
+    EXPECT_EQ(stats.parked, 0);
+    EXPECT_EQ(key_agreement_run_interval(ka), UINT32_MAX);
+}
+
+TEST_F(KeyAgreementTest, PacketsFromNewKeysWaitForTheirKey)
+{
+    const PublicKey pk = new_public_key();
+
+    send(pk, 1);
+    receive();
+
+    EXPECT_TRUE(received.packets.empty());
+    EXPECT_NE(key_agreement_run_interval(ka), UINT32_MAX);
+
+    finish_pending();
+
+    ASSERT_EQ(received.packets.size(), 1);
+    EXPECT_TRUE(received.key_cached[0]);
+    EXPECT_EQ(received.packets[0][0], kPacketId);
+    EXPECT_EQ(std::memcmp(received.packets[0].data() + 1, pk.data(), pk.size()), 0);
+
+    uint8_t expected[CRYPTO_SHARED_KEY_SIZE];
+    encrypt_precompute(pk.data(), bob_sk, expected);
+    const uint8_t *shared_key = shared_key_cache_lookup(cache, pk.data());
+    ASSERT_NE(shared_key, nullptr);
+    EXPECT_EQ(std::memcmp(shared_key, expected, sizeof(expected)), 0);
+
+    Key_Agreement_Stats stats;
+    key_agreement_get_stats(ka, &stats);
+    EXPECT_EQ(stats.parked, 1);
+    EXPECT_EQ(stats.computed, 1);
+    EXPECT_EQ(stats.dropped, 0);
+    EXPECT_EQ(stats.pending, 0);
+}
+
+TEST_F(KeyAgreementTest, KnownKeysDontWaitBehindNewKeys)
+{
+    const PublicKey known = new_public_key();
+    ASSERT_NE(shared_key_cache_lookup(cache, known.data()), nullptr);
+
+    for (uint8_t i = 0; i < 10; ++i) {
+        send(new_public_key(), i);
+    }
+
+    send(known, 100);
+    receive();
+
+    // Only the packet from the known peer got through before the keys were computed.
+    ASSERT_EQ(received.packets.size(), 1);
+    EXPECT_EQ(received.packets[0].back(), 100);
+
+    finish_pending();
+
+    EXPECT_EQ(received.packets.size(), 11);
+
+    for (bool cached : received.key_cached) {
+        EXPECT_TRUE(cached);
+    }
+}
+
+TEST_F(KeyAgreementTest, PacketsForTheSameKeyShareOneComputationAndKeepTheirOrder)
+{
+    const PublicKey pk = new_public_key();
+
+    for (uint8_t i = 0; i < 3; ++i) {
+        send(pk, i);
+    }
+
+    receive();
+    finish_pending();
+
+    ASSERT_EQ(received.packets.size(), 3);
+
+    for (uint8_t i = 0; i < 3; ++i) {
+        EXPECT_EQ(received.packets[i].back(), i);
+    }
+
+    Key_Agreement_Stats stats;
+    key_agreement_get_stats(ka, &stats);
+    EXPECT_EQ(stats.parked, 3);
+    EXPECT_EQ(stats.computed, 1);
+}
+
+TEST_F(KeyAgreementTest, TooManyPacketsForOneKeyAreDropped)
+{
+    const PublicKey pk = new_public_key();
+
+    for (uint8_t i = 0; i < KEY_AGREEMENT_PACKETS_PER_KEY + 2; ++i) {
+        send(pk, i);
+    }
+
+    receive();
+    finish_pending();
+
+    EXPECT_EQ(received.packets.size(), KEY_AGREEMENT_PACKETS_PER_KEY);
+
+    Key_Agreement_Stats stats;
+    key_agreement_get_stats(ka, &stats);
+    EXPECT_EQ(stats.dropped, 2);
+}
+
+TEST_F(KeyAgreementTest, ShortPacketsGoStraightToTheHandler)
+{
+    const uint8_t packet[] = {kPacketId, 1, 2, 3};
+    ASSERT_EQ(sendpacket(alice, &dest, packet, sizeof(packet)), sizeof(packet));
+    receive();
+
+    ASSERT_EQ(received.packets.size(), 1);
+    EXPECT_EQ(received.packets[0].size(), sizeof(packet));
+}
+
+TEST_F(KeyAgreementTest, KillRemovesTheGate)
+{
+    key_agreement_kill(ka);
+    ka = nullptr;
+
+    send(new_public_key(), 1);
+    receive();
+
+    ASSERT_EQ(received.packets.size(), 1);
+    EXPECT_FALSE(received.key_cached[0]);
+}
+
+}  // namespace
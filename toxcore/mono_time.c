@@ -26,10 +26,20 @@
 #include <sys/time.h>
 #endif /* OS_WIN32 */
 
+/* MSVC toolsets that build C99 and the ESP toolchain lack usable 64-bit C11
+ * atomics, so they keep the lock-based path. */
+#if !defined(ESP_PLATFORM) && !defined(__STDC_NO_ATOMICS__) && defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define MONO_TIME_ATOMIC
+#endif /* C11 atomics */
+
 #ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
 #include <assert.h>
 #endif /* FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION */
+#ifdef MONO_TIME_ATOMIC
+#include <stdatomic.h>
+#elif !defined(ESP_PLATFORM)
 #include <pthread.h>
+#endif /* MONO_TIME_ATOMIC */
 #include <time.h>
 
 #include "attributes.h"
@@ -39,13 +49,22 @@
 
 /** don't call into system billions of times for no reason */
 struct Mono_Time {
+#ifdef MONO_TIME_ATOMIC
+    /**
+     * Written only by `mono_time_update()`, but may be read from other
+     * threads. Publishing it atomically keeps readers from seeing a torn
+     * value without making every read take a lock.
+     */
+    _Atomic uint64_t cur_time;
+#else
     uint64_t cur_time;
+#endif /* MONO_TIME_ATOMIC */
     uint64_t base_time;
 
-#ifndef ESP_PLATFORM
+#if !defined(MONO_TIME_ATOMIC) && !defined(ESP_PLATFORM)
     /** protect @ref cur_time from concurrent access */
     pthread_rwlock_t *_Nonnull time_update_lock;
-#endif /* ESP_PLATFORM */
+#endif /* !MONO_TIME_ATOMIC && !ESP_PLATFORM */
 
     mono_time_current_time_cb *_Nonnull current_time_callback;
     void *_Nullable user_data;
@@ -115,7 +134,7 @@ Mono_Time *mono_time_new(const Memory *mem, mono_time_current_time_cb *current_t
         return nullptr;
     }
 
-#ifndef ESP_PLATFORM
+#if !defined(MONO_TIME_ATOMIC) && !defined(ESP_PLATFORM)
     pthread_rwlock_t *const rwlock = (pthread_rwlock_t *)mem_alloc(mem, sizeof(pthread_rwlock_t));
 
     if (rwlock == nullptr) {
@@ -130,11 +149,15 @@ Mono_Time *mono_time_new(const Memory *mem, mono_time_current_time_cb *current_t
     }
 
     mono_time->time_update_lock = rwlock;
-#endif /* ESP_PLATFORM */
+#endif /* !MONO_TIME_ATOMIC && !ESP_PLATFORM */
 
     mono_time_set_current_time_callback(mono_time, current_time_callback, user_data);
 
+#ifdef MONO_TIME_ATOMIC
+    atomic_init(&mono_time->cur_time, 0);
+#else
     mono_time->cur_time = 0;
+#endif /* MONO_TIME_ATOMIC */
 #ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
     // Maximum reproducibility. Never return time = 0.
     mono_time->base_time = 1000000000;
@@ -154,10 +177,10 @@ void mono_time_free(const Memory *mem, Mono_Time *mono_time)
     if (mono_time == nullptr) {
         return;
     }
-#ifndef ESP_PLATFORM
+#if !defined(MONO_TIME_ATOMIC) && !defined(ESP_PLATFORM)
     pthread_rwlock_destroy(mono_time->time_update_lock);
     mem_delete(mem, mono_time->time_update_lock);
-#endif /* ESP_PLATFORM */
+#endif /* !MONO_TIME_ATOMIC && !ESP_PLATFORM */
     mem_delete(mem, mono_time);
 }
 
@@ -166,6 +189,9 @@ void mono_time_update(Mono_Time *mono_time)
     const uint64_t cur_time =
         mono_time->base_time + mono_time->current_time_callback(mono_time->user_data);
 
+#ifdef MONO_TIME_ATOMIC
+    atomic_store_explicit(&mono_time->cur_time, cur_time, memory_order_release);
+#else
 #ifndef ESP_PLATFORM
     pthread_rwlock_wrlock(mono_time->time_update_lock);
 #endif /* ESP_PLATFORM */
@@ -173,10 +199,14 @@ void mono_time_update(Mono_Time *mono_time)
 #ifndef ESP_PLATFORM
     pthread_rwlock_unlock(mono_time->time_update_lock);
 #endif /* ESP_PLATFORM */
+#endif /* MONO_TIME_ATOMIC */
 }
 
 uint64_t mono_time_get_ms(const Mono_Time *mono_time)
 {
+#ifdef MONO_TIME_ATOMIC
+    return atomic_load_explicit(&mono_time->cur_time, memory_order_acquire);
+#else
 #if !defined(ESP_PLATFORM) && !defined(FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION)
     // Fuzzing is only single thread for now, no locking needed */
     pthread_rwlock_rdlock(mono_time->time_update_lock);
@@ -186,6 +216,7 @@ uint64_t mono_time_get_ms(const Mono_Time *mono_time)
     pthread_rwlock_unlock(mono_time->time_update_lock);
 #endif /* !ESP_PLATFORM */
     return cur_time;
+#endif /* MONO_TIME_ATOMIC */
 }
 
 uint64_t mono_time_get(const Mono_Time *mono_time)
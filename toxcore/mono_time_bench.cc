@@ -0,0 +1,177 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+#include "DHT.h"
+#include "crypto_core.h"
+#include "logger.h"
+#include "mono_time.h"
+#include "network.h"
+#include "os_memory.h"
+#include "os_network.h"
+#include "os_random.h"
+
+namespace {
+
+/** Number of distinct nodes offered to the DHT, enough to fill most of the close list. */
+constexpr uint32_t kNumNodes = 20000;
+
+/**
+ * A clock that moves forward by one second every time it is read, so that
+ * every `do_dht` call does a full pass instead of returning early.
+ */
+uint64_t ticking_clock(void *user_data)
+{
+    uint64_t *now = static_cast<uint64_t *>(user_data);
+    *now += 1000;
+    return *now;
+}
+
+/** @brief One Mono_Time shared by all benchmark threads. */
+Mono_Time *shared_mono_time()
+{
+    static Mono_Time *const mono_time = mono_time_new(os_memory(), nullptr, nullptr);
+    return mono_time;
+}
+
+/**
+ * @brief Cost of reading the time, with the given number of threads reading
+ *   it at once.
+ */
+void BM_GetMs(benchmark::State &state)
+{
+    Mono_Time *mono_time = shared_mono_time();
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(mono_time_get_ms(mono_time));
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_GetMs)->ThreadRange(1, 8);
+
+void BM_IsTimeout(benchmark::State &state)
+{
+    Mono_Time *mono_time = shared_mono_time();
+    const uint64_t start = mono_time_get(mono_time);
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(mono_time_is_timeout(mono_time, start, 10));
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_IsTimeout)->ThreadRange(1, 8);
+
+/**
+ * @brief Reading the time while the first thread keeps updating it, as when
+ *   the main loop runs next to threads that only read the time.
+ */
+void BM_GetMsWhileUpdating(benchmark::State &state)
+{
+    Mono_Time *mono_time = shared_mono_time();
+
+    for (auto _ : state) {
+        if (state.thread_index() == 0) {
+            mono_time_update(mono_time);
+        } else {
+            benchmark::DoNotOptimize(mono_time_get_ms(mono_time));
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_GetMsWhileUpdating)->ThreadRange(2, 8);
+
+/**
+ * @brief One `do_dht` iteration on a DHT with a well populated close list.
+ *
+ * Each iteration checks the timeouts of every close and friend client, so
+ * this shows what the clock reads cost in a real loop.
+ */
+class MonoTimeDhtFixture : public benchmark::Fixture {
+public:
+    void SetUp(::benchmark::State &state) override
+    {
+        mem = os_memory();
+        rng = os_random();
+        ns = os_network();
+        if (rng == nullptr || ns == nullptr) {
+            setup_error = "os_random or os_network failed";
+            return;
+        }
+
+        log = logger_new(mem);
+        mono_time = mono_time_new(mem, ticking_clock, &now);
+        net = new_networking_no_udp(log, mem, ns);
+        if (log == nullptr || mono_time == nullptr || net == nullptr) {
+            setup_error = "failed to create networking";
+            return;
+        }
+
+        dht = new_dht(log, mem, rng, ns, mono_time, net, true, true);
+        if (dht == nullptr) {
+            setup_error = "new_dht failed";
+            return;
+        }
+
+        for (uint32_t i = 0; i < kNumNodes; ++i) {
+            std::array<uint8_t, CRYPTO_PUBLIC_KEY_SIZE> pk;
+            random_bytes(rng, pk.data(), pk.size());
+
+            IP_Port ip_port{};
+            ip_port.ip.family = net_family_ipv4();
+            ip_port.ip.ip.v4.uint32 = net_htonl(0x0a000000 + i);
+            ip_port.port = net_htons(33445);
+
+            addto_lists(dht, &ip_port, pk.data());
+        }
+    }
+
+    void TearDown(const ::benchmark::State &state) override
+    {
+        kill_dht(dht);
+        kill_networking(net);
+        mono_time_free(mem, mono_time);
+        logger_kill(log);
+        dht = nullptr;
+        net = nullptr;
+        mono_time = nullptr;
+        log = nullptr;
+    }
+
+protected:
+    const Memory *mem = nullptr;
+    const Random *rng = nullptr;
+    const Network *ns = nullptr;
+    Logger *log = nullptr;
+    uint64_t now = 0;
+    Mono_Time *mono_time = nullptr;
+    Networking_Core *net = nullptr;
+    DHT *dht = nullptr;
+    std::string setup_error;
+};
+
+BENCHMARK_DEFINE_F(MonoTimeDhtFixture, DoDht)(benchmark::State &state)
+{
+    if (!setup_error.empty()) {
+        state.SkipWithError(setup_error.c_str());
+        return;
+    }
+
+    for (auto _ : state) {
+        mono_time_update(mono_time);
+        do_dht(dht);
+    }
+}
+BENCHMARK_REGISTER_F(MonoTimeDhtFixture, DoDht);
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -5,6 +5,10 @@
 
 #include <gtest/gtest.h>
 
+#include <atomic>
+#include <thread>
+#include <vector>
+
 #include "attributes.h"
 #include "mono_time_test_util.hh"
 
@@ -107,4 +111,60 @@ TEST(MonoTime, CustomTime)
     mono_time_free(&c_mem, mono_time);
 }
 
+TEST(MonoTime, ReadersOnOtherThreadsSeeTimeOnlyMoveForward)
+{
+    SimulatedEnvironment env{12345};
+    auto c_mem = env.fake_memory().c_memory();
+    Mono_Time *mono_time = mono_time_new(&c_mem, nullptr, nullptr);
+    ASSERT_NE(mono_time, nullptr);
+
+    // Large steps so a torn read of the 64 bit value would show up as a jump.
+    std::uint64_t test_time = 0;
+    mono_time_set_current_time_callback(
+        mono_time,
+        [](void *_Nullable user_data) {
+            std::uint64_t *now = static_cast<std::uint64_t *>(user_data);
+            *now += UINT64_C(0x100000001);
+            return *now;
+        },
+        &test_time);
+    mono_time_update(mono_time);
+    std::uint64_t const first = mono_time_get_ms(mono_time);
+
+    std::atomic<bool> done{false};
+    std::atomic<bool> bad_read{false};
+    std::vector<std::thread> readers;
+
+    for (int i = 0; i < 4; ++i) {
+        readers.emplace_back([&] {
+            std::uint64_t last = first;
+
+            while (!done.load()) {
+                std::uint64_t const now = mono_time_get_ms(mono_time);
+
+                if (now < last || (now - first) % UINT64_C(0x100000001) != 0) {
+                    bad_read = true;
+                }
+
+                last = now;
+            }
+        });
+    }
+
+    for (int i = 0; i < 100000; ++i) {
+        mono_time_update(mono_time);
+    }
+
+    done = true;
+
+    for (std::thread &reader : readers) {
+        reader.join();
+    }
+
+    EXPECT_FALSE(bad_read);
+    EXPECT_EQ(mono_time_get_ms(mono_time), first + UINT64_C(100000) * UINT64_C(0x100000001));
+
+    mono_time_free(&c_mem, mono_time);
+}
+
 }  // namespace
@@ -5,6 +5,8 @@
 
 #include "net.h"
 
+#include "ccompat.h"
+
 int net_socket_to_native(Socket sock)
 {
     return (force int)sock.value;
@@ -96,6 +98,78 @@ int ns_freeaddrinfo(const Network *ns, const Memory *mem, IP_Port *addrs)
     return ns->funcs->freeaddrinfo(ns->obj, mem, addrs);
 }
 
+int ns_recvfrom_batch(const Network *ns, Socket sock, Net_Recv_Msg *msgs, size_t count)
+{
+    if (ns->funcs->recvfrom_batch != nullptr) {
+        return ns->funcs->recvfrom_batch(ns->obj, sock, msgs, count);
+    }
+
+    size_t i;
+
+    for (i = 0; i < count; ++i) {
+        const int len = ns->funcs->recvfrom(ns->obj, sock, msgs[i].buf, msgs[i].size, &msgs[i].addr);
+
+        if (len < 0) {
+            break;
+        }
+
+        msgs[i].length = (size_t)len;
+    }
+
+    return i == 0 && count != 0 ? -1 : (int)i;
+}
+
+int ns_sendto_batch(const Network *ns, Socket sock, const Net_Send_Msg *msgs, size_t count)
+{
+    if (ns->funcs->sendto_batch != nullptr) {
+        return ns->funcs->sendto_batch(ns->obj, sock, msgs, count);
+    }
+
+    size_t i;
+
+    for (i = 0; i < count; ++i) {
+        if (ns->funcs->sendto(ns->obj, sock, msgs[i].buf, msgs[i].length, &msgs[i].addr) < 0) {
+            break;
+        }
+    }
+
+    return i == 0 && count != 0 ? -1 : (int)i;
+}
+
+int ns_sendv(const Network *ns, Socket sock, const Net_Iovec *iov, size_t count)
+{
+    if (ns->funcs->sendv != nullptr) {
+        return ns->funcs->sendv(ns->obj, sock, iov, count);
+    }
+
+    int sent = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        const int len = ns->funcs->send(ns->obj, sock, iov[i].buf, iov[i].length);
+
+        if (len < 0) {
+            return sent == 0 ? -1 : sent;
+        }
+
+        sent += len;
+
+        if ((size_t)len != iov[i].length) {
+            break;
+        }
+    }
+
+    return sent;
+}
+
+int ns_getpeername(const Network *ns, Socket sock, IP_Port *addr)
+{
+    if (ns->funcs->getpeername == nullptr) {
+        return -1;
+    }
+
+    return ns->funcs->getpeername(ns->obj, sock, addr);
+}
+
 size_t net_pack_bool(uint8_t *bytes, bool v)
 {
     bytes[0] = v ? 1 : 0;
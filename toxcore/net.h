@@ -97,6 +97,53 @@ typedef Socket net_socket_cb(void *_Nullable obj, int domain, int type, int prot
 typedef int net_socket_nonblock_cb(void *_Nullable obj, Socket sock, bool nonblock);
 typedef int net_getsockopt_cb(void *_Nullable obj, Socket sock, int level, int optname, void *_Nonnull optval, size_t *_Nonnull optlen);
 typedef int net_setsockopt_cb(void *_Nullable obj, Socket sock, int level, int optname, const void *_Nonnull optval, size_t optlen);
+/** Maximum number of datagrams passed to a single batched send or receive call. */
+#define NET_MAX_BATCH_SIZE 64
+
+/** A datagram slot for `ns_recvfrom_batch`. */
+typedef struct Net_Recv_Msg {
+    /** Buffer to receive into, of `size` bytes. */
+    uint8_t *_Nonnull buf;
+    size_t size;
+    /** Set to the number of bytes received. 0 if the datagram should be ignored. */
+    size_t length;
+    /** Set to the sender's address. */
+    IP_Port addr;
+} Net_Recv_Msg;
+
+/** A datagram for `ns_sendto_batch`. */
+typedef struct Net_Send_Msg {
+    const uint8_t *_Nonnull buf;
+    size_t length;
+    IP_Port addr;
+} Net_Send_Msg;
+
+/** @brief Receive up to `count` datagrams in one call.
+ *
+ * @return the number of message slots filled, or -1 on error.
+ */
+typedef int net_recvfrom_batch_cb(void *_Nullable obj, Socket sock, Net_Recv_Msg *_Nonnull msgs, size_t count);
+/** @brief Send up to `count` datagrams in one call.
+ *
+ * @return the number of messages sent, or -1 if the first one could not be sent.
+ */
+typedef int net_sendto_batch_cb(void *_Nullable obj, Socket sock, const Net_Send_Msg *_Nonnull msgs, size_t count);
+
+/** Maximum number of buffers passed to a single vectored send call. */
+#define NET_MAX_SEND_VECS 16
+
+/** A buffer for `ns_sendv`. */
+typedef struct Net_Iovec {
+    const uint8_t *_Nonnull buf;
+    size_t length;
+} Net_Iovec;
+
+/** @brief Send up to `count` buffers on a stream socket as if they were one, like `writev`.
+ *
+ * @return the number of bytes sent, or -1 on error.
+ */
+typedef int net_sendv_cb(void *_Nullable obj, Socket sock, const Net_Iovec *_Nonnull iov, size_t count);
+typedef int net_getpeername_cb(void *_Nullable obj, Socket sock, IP_Port *_Nonnull addr);
 typedef int net_getaddrinfo_cb(void *_Nullable obj, const Memory *_Nonnull mem, const char *_Nonnull address, int family, int protocol, IP_Port *_Nullable *_Nonnull addrs);
 typedef int net_freeaddrinfo_cb(void *_Nullable obj, const Memory *_Nonnull mem, IP_Port *_Nullable addrs);
 
@@ -117,6 +164,13 @@ typedef struct Network_Funcs {
     net_setsockopt_cb *_Nullable setsockopt;
     net_getaddrinfo_cb *_Nullable getaddrinfo;
     net_freeaddrinfo_cb *_Nullable freeaddrinfo;
+    /* Optional: if not set, the batch functions fall back to recvfrom/sendto. */
+    net_recvfrom_batch_cb *_Nullable recvfrom_batch;
+    net_sendto_batch_cb *_Nullable sendto_batch;
+    /* Optional: if not set, `ns_sendv` sends one buffer at a time. */
+    net_sendv_cb *_Nullable sendv;
+    /* Optional: if not set, the address of the other end of a stream socket is unknown. */
+    net_getpeername_cb *_Nullable getpeername;
 } Network_Funcs;
 
 typedef struct Network {
@@ -140,6 +194,10 @@ int ns_getsockopt(const Network *_Nonnull ns, Socket sock, int level, int optnam
 int ns_setsockopt(const Network *_Nonnull ns, Socket sock, int level, int optname, const void *_Nonnull optval, size_t optlen);
 int ns_getaddrinfo(const Network *_Nonnull ns, const Memory *_Nonnull mem, const char *_Nonnull address, int family, int protocol, IP_Port *_Nullable *_Nonnull addrs);
 int ns_freeaddrinfo(const Network *_Nonnull ns, const Memory *_Nonnull mem, IP_Port *_Nullable addrs);
+int ns_recvfrom_batch(const Network *_Nonnull ns, Socket sock, Net_Recv_Msg *_Nonnull msgs, size_t count);
+int ns_sendto_batch(const Network *_Nonnull ns, Socket sock, const Net_Send_Msg *_Nonnull msgs, size_t count);
+int ns_sendv(const Network *_Nonnull ns, Socket sock, const Net_Iovec *_Nonnull iov, size_t count);
+int ns_getpeername(const Network *_Nonnull ns, Socket sock, IP_Port *_Nonnull addr);
 
 bool net_family_is_unspec(Family family);
 bool net_family_is_ipv4(Family family);
@@ -220,6 +278,7 @@ bool net_join_multicast(const Network *_Nonnull ns, Socket sock, Family family);
 bool net_set_socket_nonblock(const Network *_Nonnull ns, Socket sock);
 bool net_set_socket_nosigpipe(const Network *_Nonnull ns, Socket sock);
 bool net_set_socket_reuseaddr(const Network *_Nonnull ns, Socket sock);
+bool net_set_socket_reuseport(const Network *_Nonnull ns, Socket sock);
 bool net_set_socket_dualstack(const Network *_Nonnull ns, Socket sock);
 bool net_set_socket_buffer_size(const Network *_Nonnull ns, Socket sock, int size);
 bool net_set_socket_broadcast(const Network *_Nonnull ns, Socket sock);
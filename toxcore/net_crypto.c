@@ -10,6 +10,7 @@
  */
 #include "net_crypto.h"
 
+#include <assert.h>
 #include <pthread.h>
 #include <string.h>
 
@@ -26,6 +27,7 @@
 #include "mono_time.h"
 #include "net_profile.h"
 #include "network.h"
+#include "timer_wheel.h"
 #include "util.h"
 
 typedef struct Packet_Data {
@@ -34,6 +36,38 @@ typedef struct Packet_Data {
     uint8_t data[MAX_CRYPTO_DATA_SIZE];
 } Packet_Data;
 
+/** @brief Free list entry of the packet pool.
+ *
+ * A pooled buffer is either handed out as a Packet_Data or linked into the
+ * pool's free list, never both, so the link can share the packet storage.
+ */
+typedef union Packet_Pool_Node {
+    Packet_Data packet;
+    union Packet_Pool_Node *_Nullable next;
+} Packet_Pool_Node;
+
+/** @brief Per-Net_Crypto cache of Packet_Data buffers.
+ *
+ * Lossless packets are buffered in the send and receive arrays until they are
+ * acknowledged or delivered. Recycling their buffers here saves an allocator
+ * round trip per packet under sustained load.
+ */
+typedef struct Packet_Pool {
+    const Memory *_Nonnull mem;
+
+    Packet_Pool_Node *_Nullable free_list;
+    uint32_t num_free;
+    uint32_t num_in_use;
+
+    /* Free buffers are never retained beyond this number. */
+    uint32_t high_watermark;
+    /* Once load drops below this number, free buffers beyond it are released. */
+    uint32_t low_watermark;
+
+    uint64_t hits;
+    uint64_t misses;
+} Packet_Pool;
+
 typedef struct Packets_Array {
     Packet_Data *_Nullable buffer[CRYPTO_PACKET_BUFFER_SIZE];
     uint32_t  buffer_start;
@@ -54,6 +88,52 @@ typedef enum Crypto_Conn_State {
     CRYPTO_CONN_ESTABLISHED,         /* the connection is established */
 } Crypto_Conn_State;
 
+/**
+ * Per-tick scheduling state of a crypto connection.
+ *
+ * do_net_crypto looks at every connection on every tick, but most of the time
+ * only needs the state, timers and rate counters. These live in a compact
+ * array next to the connections, so the scan does not have to stride over
+ * the packet buffers in Crypto_Connection.
+ */
+typedef struct Crypto_Connection_Hot {
+    Crypto_Conn_State status; /* See Crypto_Conn_State documentation */
+
+    bool has_temp_packet; /* Whether there is a temp_packet to send repeatedly. */
+    uint32_t temp_packet_num_sent;
+    uint64_t temp_packet_sent_time; /* The time at which the last temp_packet was sent in ms. */
+    uint64_t last_request_packet_sent;
+
+    uint64_t direct_lastrecv_timev4; /* The Time at which we last received a direct packet in ms. */
+    uint64_t direct_lastrecv_timev6;
+
+    /* TCP_connection connection_number */
+    unsigned int connection_number_tcp;
+    uint64_t last_tcp_sent; /* Time the last TCP packet was sent. */
+
+    uint32_t packet_counter;
+    double packet_recv_rate;
+    uint64_t packet_counter_set;
+
+    double packet_send_rate;
+    uint32_t packets_left;
+    uint64_t last_packets_left_set;
+    double last_packets_left_rem;
+
+    double packet_send_rate_requested;
+    uint32_t packets_left_requested;
+    uint64_t last_packets_left_requested_set;
+    double last_packets_left_requested_rem;
+
+    uint32_t packets_sent;
+    uint32_t packets_resent;
+    uint64_t last_congestion_event;
+    uint64_t rtt_time;
+} Crypto_Connection_Hot;
+
+static const Crypto_Connection_Hot empty_crypto_connection_hot = {CRYPTO_CONN_FREE};
+
+/** Keys, buffers and callbacks of a crypto connection. See Crypto_Connection_Hot for the rest. */
 typedef struct Crypto_Connection {
     uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE]; /* The real public key of the peer. */
     uint8_t recv_nonce[CRYPTO_NONCE_SIZE]; /* Nonce of received packets. */
@@ -62,21 +142,14 @@ typedef struct Crypto_Connection {
     uint8_t sessionsecret_key[CRYPTO_SECRET_KEY_SIZE]; /* Our private key for this session. */
     uint8_t peersessionpublic_key[CRYPTO_PUBLIC_KEY_SIZE]; /* The public key of the peer. */
     uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE]; /* The precomputed shared key from encrypt_precompute. */
-    Crypto_Conn_State status; /* See Crypto_Conn_State documentation */
     uint64_t cookie_request_number; /* number used in the cookie request packets for this connection */
     uint8_t dht_public_key[CRYPTO_PUBLIC_KEY_SIZE]; /* The dht public key of the peer */
 
     uint8_t *_Nullable temp_packet; /* Where the cookie request/handshake packet is stored while it is being sent. */
     uint16_t temp_packet_length;
-    uint64_t temp_packet_sent_time; /* The time at which the last temp_packet was sent in ms. */
-    uint32_t temp_packet_num_sent;
 
     IP_Port ip_portv4; /* The ip and port to contact this guy directly.*/
     IP_Port ip_portv6;
-    uint64_t direct_lastrecv_timev4; /* The Time at which we last received a direct packet in ms. */
-    uint64_t direct_lastrecv_timev6;
-
-    uint64_t last_tcp_sent; /* Time the last TCP packet was sent. */
 
     Packets_Array send_array;
     Packets_Array recv_array;
@@ -93,34 +166,12 @@ typedef struct Crypto_Connection {
     void *_Nullable connection_lossy_data_callback_object;
     int connection_lossy_data_callback_id;
 
-    uint64_t last_request_packet_sent;
     uint64_t direct_send_attempt_time;
 
-    uint32_t packet_counter;
-    double packet_recv_rate;
-    uint64_t packet_counter_set;
-
-    double packet_send_rate;
-    uint32_t packets_left;
-    uint64_t last_packets_left_set;
-    double last_packets_left_rem;
-
-    double packet_send_rate_requested;
-    uint32_t packets_left_requested;
-    uint64_t last_packets_left_requested_set;
-    double last_packets_left_requested_rem;
-
     uint32_t last_sendqueue_size[CONGESTION_QUEUE_ARRAY_SIZE];
     uint32_t last_sendqueue_counter;
     long signed int last_num_packets_sent[CONGESTION_LAST_SENT_ARRAY_SIZE];
     long signed int last_num_packets_resent[CONGESTION_LAST_SENT_ARRAY_SIZE];
-    uint32_t packets_sent;
-    uint32_t packets_resent;
-    uint64_t last_congestion_event;
-    uint64_t rtt_time;
-
-    /* TCP_connection connection_number */
-    unsigned int connection_number_tcp;
 
     bool maximum_speed_reached;
 
@@ -129,7 +180,21 @@ typedef struct Crypto_Connection {
     uint32_t dht_pk_callback_number;
 } Crypto_Connection;
 
-static const Crypto_Connection empty_crypto_connection = {{0}};
+/** Number of UDP data packets that are decrypted together. */
+#define CRYPTO_UDP_QUEUE_SIZE 32
+
+/** A UDP data packet waiting for `flush_udp_data_packets`. */
+typedef struct Crypto_Queued_Packet {
+    int crypt_connection_id;
+    bool ipv4;
+    uint16_t length;
+    uint8_t packet[MAX_CRYPTO_PACKET_SIZE];
+
+    /* Filled in when the queue is flushed. */
+    uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
+    uint8_t nonce[CRYPTO_NONCE_SIZE];
+    uint8_t data[MAX_CRYPTO_PACKET_SIZE];
+} Crypto_Queued_Packet;
 
 struct Net_Crypto {
     const Logger *_Nonnull log;
@@ -144,7 +209,10 @@ struct Net_Crypto {
 
     TCP_Connections *_Nonnull tcp_c;
 
-    Crypto_Connection *_Nullable crypto_connections;
+    /* Connections are allocated one by one, a free slot is null. */
+    Crypto_Connection *_Nullable *_Nullable crypto_connections;
+    /* Scheduling state, same indices as crypto_connections. */
+    Crypto_Connection_Hot *_Nullable crypto_connections_hot;
 
     uint32_t crypto_connections_length; /* Length of connections array. */
 
@@ -158,11 +226,21 @@ struct Net_Crypto {
     new_connection_cb *_Nullable new_connection_callback;
     void *_Nullable new_connection_callback_object;
 
-    /* The current optimal sleep time */
-    uint32_t current_sleep_time;
+    /* Next time each connection needs do_crypto_connection, in ms. */
+    Timer_Wheel *_Nonnull timers;
 
     BS_List ip_port_list;
 
+    /* Recycled Packet_Data buffers for the send and receive arrays. */
+    Packet_Pool *_Nonnull packet_pool;
+
+    /* UDP data packets received since the last flush, in arrival order. */
+    Crypto_Queued_Packet *_Nonnull udp_queue;
+    uint32_t udp_queue_length;
+
+    /* Real public key -> crypt_connection_id lookup. */
+    BS_List public_key_list;
+
     /* Rate limiter for cookie requests */
     uint64_t cookie_request_last_time;
     uint32_t cookie_request_tokens;
@@ -189,11 +267,11 @@ static bool crypt_connection_id_is_valid(const Net_Crypto *_Nonnull c, int crypt
         return false;
     }
 
-    if (c->crypto_connections == nullptr) {
+    if (c->crypto_connections_hot == nullptr) {
         return false;
     }
 
-    const Crypto_Conn_State status = c->crypto_connections[crypt_connection_id].status;
+    const Crypto_Conn_State status = c->crypto_connections_hot[crypt_connection_id].status;
 
     return status != CRYPTO_CONN_NO_CONNECTION && status != CRYPTO_CONN_FREE;
 }
@@ -598,7 +676,22 @@ static Crypto_Connection *_Nullable get_crypto_connection(const Net_Crypto *_Non
         return nullptr;
     }
 
-    return &c->crypto_connections[crypt_connection_id];
+    return c->crypto_connections[crypt_connection_id];
+}
+
+static Crypto_Connection_Hot *_Nullable get_crypto_connection_hot(const Net_Crypto *_Nonnull c, int crypt_connection_id)
+{
+    if (!crypt_connection_id_is_valid(c, crypt_connection_id)) {
+        return nullptr;
+    }
+
+    return &c->crypto_connections_hot[crypt_connection_id];
+}
+
+/** @brief Make the next do_net_crypto run do_crypto_connection for this connection. */
+static void schedule_crypto_connection(const Net_Crypto *_Nonnull c, int crypt_connection_id)
+{
+    timer_wheel_set_earlier(c->timers, (uint32_t)crypt_connection_id, current_time_monotonic(c->mono_time));
 }
 
 /** @brief Associate an ip_port to a connection.
@@ -654,15 +747,16 @@ static IP_Port return_ip_port_connection(const Net_Crypto *_Nonnull c, int crypt
         return empty;
     }
 
+    const Crypto_Connection_Hot *hot = &c->crypto_connections_hot[crypt_connection_id];
     const uint64_t current_time = mono_time_get(c->mono_time);
     bool v6 = false;
     bool v4 = false;
 
-    if ((UDP_DIRECT_TIMEOUT + conn->direct_lastrecv_timev4) > current_time) {
+    if ((UDP_DIRECT_TIMEOUT + hot->direct_lastrecv_timev4) > current_time) {
         v4 = true;
     }
 
-    if ((UDP_DIRECT_TIMEOUT + conn->direct_lastrecv_timev6) > current_time) {
+    if ((UDP_DIRECT_TIMEOUT + hot->direct_lastrecv_timev6) > current_time) {
         v6 = true;
     }
 
@@ -710,6 +804,8 @@ static int send_packet_to(const Net_Crypto *_Nonnull c, int crypt_connection_id,
         return -1;
     }
 
+    Crypto_Connection_Hot *hot = &c->crypto_connections_hot[crypt_connection_id];
+
     bool direct_send_attempt = false;
 
     const IP_Port ip_port = return_ip_port_connection(c, crypt_connection_id);
@@ -742,10 +838,10 @@ static int send_packet_to(const Net_Crypto *_Nonnull c, int crypt_connection_id,
         }
     }
 
-    const int ret = send_packet_tcp_connection(c->tcp_c, conn->connection_number_tcp, data, length);
+    const int ret = send_packet_tcp_connection(c->tcp_c, hot->connection_number_tcp, data, length);
 
     if (ret == 0) {
-        conn->last_tcp_sent = current_time_monotonic(c->mono_time);
+        hot->last_tcp_sent = current_time_monotonic(c->mono_time);
     }
 
     if (direct_send_attempt) {
@@ -755,6 +851,97 @@ static int send_packet_to(const Net_Crypto *_Nonnull c, int crypt_connection_id,
     return ret;
 }
 
+/*** START: Packet pool functions */
+
+static Packet_Pool *_Nullable packet_pool_new(const Memory *_Nonnull mem)
+{
+    Packet_Pool *pool = (Packet_Pool *)mem_alloc(mem, sizeof(Packet_Pool));
+
+    if (pool == nullptr) {
+        return nullptr;
+    }
+
+    pool->mem = mem;
+    pool->high_watermark = CRYPTO_PACKET_POOL_HIGH_WATERMARK;
+    pool->low_watermark = CRYPTO_PACKET_POOL_LOW_WATERMARK;
+    return pool;
+}
+
+/** @brief Release free buffers until at most `keep` remain in the pool. */
+static void packet_pool_release(Packet_Pool *_Nonnull pool, uint32_t keep)
+{
+    while (pool->num_free > keep) {
+        Packet_Pool_Node *node = pool->free_list;
+        assert(node != nullptr);
+        pool->free_list = node->next;
+        --pool->num_free;
+        mem_delete(pool->mem, node);
+    }
+}
+
+static void packet_pool_kill(Packet_Pool *_Nullable pool)
+{
+    if (pool == nullptr) {
+        return;
+    }
+
+    packet_pool_release(pool, 0);
+    mem_delete(pool->mem, pool);
+}
+
+/** @brief Take a packet buffer from the pool, allocating a new one if the pool is empty.
+ *
+ * @return nullptr if the pool is empty and allocation failed.
+ */
+static Packet_Data *_Nullable packet_pool_get(Packet_Pool *_Nonnull pool)
+{
+    Packet_Pool_Node *node = pool->free_list;
+
+    if (node != nullptr) {
+        pool->free_list = node->next;
+        --pool->num_free;
+        ++pool->hits;
+    } else {
+        node = (Packet_Pool_Node *)mem_alloc(pool->mem, sizeof(Packet_Pool_Node));
+
+        if (node == nullptr) {
+            return nullptr;
+        }
+
+        ++pool->misses;
+    }
+
+    ++pool->num_in_use;
+    return &node->packet;
+}
+
+/** @brief Return a packet buffer to the pool, freeing it if the pool is full. */
+static void packet_pool_put(Packet_Pool *_Nonnull pool, Packet_Data *_Nonnull packet)
+{
+    Packet_Pool_Node *node = (Packet_Pool_Node *)packet;
+    assert(pool->num_in_use > 0);
+    --pool->num_in_use;
+
+    if (pool->num_free >= pool->high_watermark) {
+        mem_delete(pool->mem, node);
+        return;
+    }
+
+    node->next = pool->free_list;
+    pool->free_list = node;
+    ++pool->num_free;
+}
+
+/** @brief Shrink the pool back to its low watermark once the load has dropped. */
+static void packet_pool_trim(Packet_Pool *_Nonnull pool)
+{
+    if (pool->num_in_use < pool->low_watermark) {
+        packet_pool_release(pool, pool->low_watermark);
+    }
+}
+
+/*** END: Packet pool functions */
+
 /*** START: Array Related functions */
 
 /** @brief Return number of packets in array
@@ -770,7 +957,7 @@ static uint32_t num_packets_array(const Packets_Array *_Nonnull array)
  * @retval -1 on failure.
  * @retval 0 on success.
  */
-static int add_data_to_buffer(const Memory *_Nonnull mem, Packets_Array *_Nonnull array, uint32_t number, const Packet_Data *_Nonnull data)
+static int add_data_to_buffer(Packet_Pool *_Nonnull pool, Packets_Array *_Nonnull array, uint32_t number, const Packet_Data *_Nonnull data)
 {
     if (number - array->buffer_start >= CRYPTO_PACKET_BUFFER_SIZE) {
         return -1;
@@ -782,7 +969,7 @@ static int add_data_to_buffer(const Memory *_Nonnull mem, Packets_Array *_Nonnul
         return -1;
     }
 
-    Packet_Data *new_d = (Packet_Data *)mem_alloc(mem, sizeof(Packet_Data));
+    Packet_Data *new_d = packet_pool_get(pool);
 
     if (new_d == nullptr) {
         return -1;
@@ -827,7 +1014,7 @@ static int get_data_pointer(const Packets_Array *_Nonnull array, Packet_Data *_N
  * @retval -1 on failure.
  * @return packet number on success.
  */
-static int64_t add_data_end_of_buffer(const Logger *_Nonnull logger, const Memory *_Nonnull mem, Packets_Array *_Nonnull array, const Packet_Data *_Nonnull data)
+static int64_t add_data_end_of_buffer(const Logger *_Nonnull logger, Packet_Pool *_Nonnull pool, Packets_Array *_Nonnull array, const Packet_Data *_Nonnull data)
 {
     const uint32_t num_spots = num_packets_array(array);
 
@@ -836,7 +1023,7 @@ static int64_t add_data_end_of_buffer(const Logger *_Nonnull logger, const Memor
         return -1;
     }
 
-    Packet_Data *new_d = (Packet_Data *)mem_alloc(mem, sizeof(Packet_Data));
+    Packet_Data *new_d = packet_pool_get(pool);
 
     if (new_d == nullptr) {
         LOGGER_ERROR(logger, "packet data allocation failed");
@@ -855,7 +1042,7 @@ static int64_t add_data_end_of_buffer(const Logger *_Nonnull logger, const Memor
  * @retval -1 on failure.
  * @return packet number on success.
  */
-static int64_t read_data_beg_buffer(const Memory *_Nonnull mem, Packets_Array *_Nonnull array, Packet_Data *_Nonnull data)
+static int64_t read_data_beg_buffer(Packet_Pool *_Nonnull pool, Packets_Array *_Nonnull array, Packet_Data *_Nonnull data)
 {
     if (array->buffer_end == array->buffer_start) {
         return -1;
@@ -870,7 +1057,7 @@ static int64_t read_data_beg_buffer(const Memory *_Nonnull mem, Packets_Array *_
     *data = *array->buffer[num];
     const uint32_t id = array->buffer_start;
     ++array->buffer_start;
-    mem_delete(mem, array->buffer[num]);
+    packet_pool_put(pool, array->buffer[num]);
     array->buffer[num] = nullptr;
     return id;
 }
@@ -880,7 +1067,7 @@ static int64_t read_data_beg_buffer(const Memory *_Nonnull mem, Packets_Array *_
  * @retval -1 on failure.
  * @retval 0 on success
  */
-static int clear_buffer_until(const Memory *_Nonnull mem, Packets_Array *_Nonnull array, uint32_t number)
+static int clear_buffer_until(Packet_Pool *_Nonnull pool, Packets_Array *_Nonnull array, uint32_t number)
 {
     const uint32_t num_spots = num_packets_array(array);
 
@@ -894,7 +1081,7 @@ static int clear_buffer_until(const Memory *_Nonnull mem, Packets_Array *_Nonnul
         const uint32_t num = i % CRYPTO_PACKET_BUFFER_SIZE;
 
         if (array->buffer[num] != nullptr) {
-            mem_delete(mem, array->buffer[num]);
+            packet_pool_put(pool, array->buffer[num]);
             array->buffer[num] = nullptr;
         }
     }
@@ -903,7 +1090,7 @@ static int clear_buffer_until(const Memory *_Nonnull mem, Packets_Array *_Nonnul
     return 0;
 }
 
-static int clear_buffer(const Memory *_Nonnull mem, Packets_Array *_Nonnull array)
+static int clear_buffer(Packet_Pool *_Nonnull pool, Packets_Array *_Nonnull array)
 {
     uint32_t i;
 
@@ -911,7 +1098,7 @@ static int clear_buffer(const Memory *_Nonnull mem, Packets_Array *_Nonnull arra
         const uint32_t num = i % CRYPTO_PACKET_BUFFER_SIZE;
 
         if (array->buffer[num] != nullptr) {
-            mem_delete(mem, array->buffer[num]);
+            packet_pool_put(pool, array->buffer[num]);
             array->buffer[num] = nullptr;
         }
     }
@@ -999,7 +1186,7 @@ static int generate_request_packet(uint8_t *_Nonnull data, uint16_t length, cons
  * @retval -1 on failure.
  * @return number of requested packets on success.
  */
-static int handle_request_packet(const Memory *_Nonnull mem, const Mono_Time *_Nonnull mono_time, Packets_Array *_Nonnull send_array, const uint8_t *_Nonnull data, uint16_t length,
+static int handle_request_packet(Packet_Pool *_Nonnull pool, const Mono_Time *_Nonnull mono_time, Packets_Array *_Nonnull send_array, const uint8_t *_Nonnull data, uint16_t length,
                                  uint64_t *_Nonnull latest_send_time, uint64_t rtt_time)
 {
     if (length == 0) {
@@ -1047,7 +1234,7 @@ static int handle_request_packet(const Memory *_Nonnull mem, const Mono_Time *_N
             if (send_array->buffer[num] != nullptr) {
                 l_sent_time = max_u64(l_sent_time, send_array->buffer[num]->sent_time);
 
-                mem_delete(mem, send_array->buffer[num]);
+                packet_pool_put(pool, send_array->buffer[num]);
                 send_array->buffer[num] = nullptr;
             }
         }
@@ -1198,7 +1385,7 @@ static int64_t send_lossless_packet(const Net_Crypto *_Nonnull c, int crypt_conn
     dt.sent_time = 0;
     dt.length = length;
     memcpy(dt.data, data, length);
-    const int64_t packet_num = add_data_end_of_buffer(c->log, c->mem, &conn->send_array, &dt);
+    const int64_t packet_num = add_data_end_of_buffer(c->log, c->packet_pool, &conn->send_array, &dt);
 
     if (packet_num == -1) {
         return -1;
@@ -1235,6 +1422,30 @@ static uint16_t get_nonce_uint16(const uint8_t *_Nonnull nonce)
 
 #define DATA_NUM_THRESHOLD 21845
 
+/** @brief Work out the full nonce of a data packet from the 16 bit number in it.
+ *
+ * @return how far the packet number is ahead of the receive nonce.
+ */
+static uint16_t data_packet_nonce(const Crypto_Connection *_Nonnull conn, const uint8_t *_Nonnull packet,
+                                  uint8_t nonce[_Nonnull CRYPTO_NONCE_SIZE])
+{
+    memcpy(nonce, conn->recv_nonce, CRYPTO_NONCE_SIZE);
+    const uint16_t num_cur_nonce = get_nonce_uint16(nonce);
+    uint16_t num;
+    net_unpack_u16(packet + 1, &num);
+    const uint16_t diff = num - num_cur_nonce;
+    increment_nonce_number(nonce, diff);
+    return diff;
+}
+
+/** @brief Move the receive nonce forward once packets get far enough ahead of it. */
+static void data_packet_accepted(Crypto_Connection *_Nonnull conn, uint16_t diff)
+{
+    if (diff > DATA_NUM_THRESHOLD * 2) {
+        increment_nonce_number(conn->recv_nonce, DATA_NUM_THRESHOLD);
+    }
+}
+
 /** @brief Handle a data packet.
  * Decrypt packet of length and put it into data.
  * data must be at least MAX_DATA_DATA_PACKET_SIZE big.
@@ -1257,12 +1468,7 @@ static int handle_data_packet(const Net_Crypto *_Nonnull c, int crypt_connection
     }
 
     uint8_t nonce[CRYPTO_NONCE_SIZE];
-    memcpy(nonce, conn->recv_nonce, CRYPTO_NONCE_SIZE);
-    const uint16_t num_cur_nonce = get_nonce_uint16(nonce);
-    uint16_t num;
-    net_unpack_u16(packet + 1, &num);
-    const uint16_t diff = num - num_cur_nonce;
-    increment_nonce_number(nonce, diff);
+    const uint16_t diff = data_packet_nonce(conn, packet, nonce);
     const int len = decrypt_data_symmetric(c->mem, conn->shared_key, nonce, packet + 1 + sizeof(uint16_t),
                                            length - (1 + sizeof(uint16_t)), data);
 
@@ -1270,10 +1476,7 @@ static int handle_data_packet(const Net_Crypto *_Nonnull c, int crypt_connection
         return -1;
     }
 
-    if (diff > DATA_NUM_THRESHOLD * 2) {
-        increment_nonce_number(conn->recv_nonce, DATA_NUM_THRESHOLD);
-    }
-
+    data_packet_accepted(conn, diff);
     return len;
 }
 
@@ -1380,11 +1583,14 @@ static int new_temp_packet(const Net_Crypto *_Nonnull c, int crypt_connection_id
         mem_delete(c->mem, conn->temp_packet);
     }
 
+    Crypto_Connection_Hot *hot = &c->crypto_connections_hot[crypt_connection_id];
     memcpy(temp_packet, packet, length);
     conn->temp_packet = temp_packet;
     conn->temp_packet_length = length;
-    conn->temp_packet_sent_time = 0;
-    conn->temp_packet_num_sent = 0;
+    hot->has_temp_packet = true;
+    hot->temp_packet_sent_time = 0;
+    hot->temp_packet_num_sent = 0;
+    schedule_crypto_connection(c, crypt_connection_id);
     return 0;
 }
 
@@ -1405,10 +1611,12 @@ static int clear_temp_packet(const Net_Crypto *_Nonnull c, int crypt_connection_
         mem_delete(c->mem, conn->temp_packet);
     }
 
+    Crypto_Connection_Hot *hot = &c->crypto_connections_hot[crypt_connection_id];
     conn->temp_packet = nullptr;
     conn->temp_packet_length = 0;
-    conn->temp_packet_sent_time = 0;
-    conn->temp_packet_num_sent = 0;
+    hot->has_temp_packet = false;
+    hot->temp_packet_sent_time = 0;
+    hot->temp_packet_num_sent = 0;
     return 0;
 }
 
@@ -1433,8 +1641,9 @@ static int send_temp_packet(const Net_Crypto *_Nonnull c, int crypt_connection_i
         return -1;
     }
 
-    conn->temp_packet_sent_time = current_time_monotonic(c->mono_time);
-    ++conn->temp_packet_num_sent;
+    Crypto_Connection_Hot *hot = &c->crypto_connections_hot[crypt_connection_id];
+    hot->temp_packet_sent_time = current_time_monotonic(c->mono_time);
+    ++hot->temp_packet_num_sent;
     return 0;
 }
 
@@ -1500,28 +1709,21 @@ static void connection_kill(Net_Crypto *_Nonnull c, int crypt_connection_id, voi
     crypto_kill(c, crypt_connection_id);
 }
 
-/** @brief Handle a received data packet.
+/** @brief Handle the decrypted contents of a data packet.
  *
  * @retval -1 on failure.
  * @retval 0 on success.
  */
-static int handle_data_packet_core(Net_Crypto *_Nonnull c, int crypt_connection_id, const uint8_t *_Nonnull packet, uint16_t length,
-                                   bool udp, void *_Nullable userdata)
+static int handle_decrypted_data_packet(Net_Crypto *_Nonnull c, int crypt_connection_id, const uint8_t *_Nonnull data, uint16_t len,
+                                        bool udp, void *_Nullable userdata)
 {
-    if (length > MAX_CRYPTO_PACKET_SIZE || length <= CRYPTO_DATA_PACKET_MIN_SIZE) {
-        return -1;
-    }
-
     Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
 
     if (conn == nullptr) {
         return -1;
     }
 
-    uint8_t data[MAX_DATA_DATA_PACKET_SIZE];
-    const int len = handle_data_packet(c, crypt_connection_id, data, packet, length);
-
-    if (len <= (int)(sizeof(uint32_t) * 2)) {
+    if (len <= sizeof(uint32_t) * 2) {
         return -1;
     }
 
@@ -1541,7 +1743,7 @@ static int handle_data_packet_core(Net_Crypto *_Nonnull c, int crypt_connection_
             rtt_calc_time = packet_time->sent_time;
         }
 
-        if (clear_buffer_until(c->mem, &conn->send_array, buffer_start) != 0) {
+        if (clear_buffer_until(c->packet_pool, &conn->send_array, buffer_start) != 0) {
             return -1;
         }
     }
@@ -1563,13 +1765,25 @@ static int handle_data_packet_core(Net_Crypto *_Nonnull c, int crypt_connection_
         return 0;
     }
 
-    if (conn->status == CRYPTO_CONN_NOT_CONFIRMED) {
+    Crypto_Connection_Hot *hot = &c->crypto_connections_hot[crypt_connection_id];
+
+    if (hot->status == CRYPTO_CONN_NOT_CONFIRMED) {
         clear_temp_packet(c, crypt_connection_id);
-        conn->status = CRYPTO_CONN_ESTABLISHED;
+        hot->status = CRYPTO_CONN_ESTABLISHED;
+        schedule_crypto_connection(c, crypt_connection_id);
 
         if (conn->connection_status_callback != nullptr) {
             conn->connection_status_callback(conn->connection_status_callback_object, conn->connection_status_callback_id,
                                              true, userdata);
+
+            /* conn might get killed in callback. */
+            conn = get_crypto_connection(c, crypt_connection_id);
+
+            if (conn == nullptr) {
+                return -1;
+            }
+
+            hot = &c->crypto_connections_hot[crypt_connection_id];
         }
     }
 
@@ -1577,12 +1791,12 @@ static int handle_data_packet_core(Net_Crypto *_Nonnull c, int crypt_connection_
         uint64_t rtt_time;
 
         if (udp) {
-            rtt_time = conn->rtt_time;
+            rtt_time = hot->rtt_time;
         } else {
             rtt_time = DEFAULT_TCP_PING_CONNECTION;
         }
 
-        const int requested = handle_request_packet(c->mem, c->mono_time, &conn->send_array, real_data, real_length, &rtt_calc_time, rtt_time);
+        const int requested = handle_request_packet(c->packet_pool, c->mono_time, &conn->send_array, real_data, real_length, &rtt_calc_time, rtt_time);
 
         if (requested == -1) {
             return -1;
@@ -1594,12 +1808,12 @@ static int handle_data_packet_core(Net_Crypto *_Nonnull c, int crypt_connection_
         dt.length = real_length;
         memcpy(dt.data, real_data, real_length);
 
-        if (add_data_to_buffer(c->mem, &conn->recv_array, num, &dt) != 0) {
+        if (add_data_to_buffer(c->packet_pool, &conn->recv_array, num, &dt) != 0) {
             return -1;
         }
 
         while (true) {
-            const int ret = read_data_beg_buffer(c->mem, &conn->recv_array, &dt);
+            const int ret = read_data_beg_buffer(c->packet_pool, &conn->recv_array, &dt);
 
             if (ret == -1) {
                 break;
@@ -1619,7 +1833,8 @@ static int handle_data_packet_core(Net_Crypto *_Nonnull c, int crypt_connection_
         }
 
         /* Packet counter. */
-        ++conn->packet_counter;
+        hot = &c->crypto_connections_hot[crypt_connection_id];
+        ++hot->packet_counter;
     } else if (real_data[0] >= PACKET_ID_RANGE_LOSSY_START && real_data[0] <= PACKET_ID_RANGE_LOSSY_END) {
 
         set_buffer_end(&conn->recv_array, num);
@@ -1632,17 +1847,47 @@ static int handle_data_packet_core(Net_Crypto *_Nonnull c, int crypt_connection_
         return -1;
     }
 
-    if (rtt_calc_time != 0) {
+    hot = get_crypto_connection_hot(c, crypt_connection_id);
+
+    if (rtt_calc_time != 0 && hot != nullptr) {
         const uint64_t rtt_time = current_time_monotonic(c->mono_time) - rtt_calc_time;
 
-        if (rtt_time < conn->rtt_time) {
-            conn->rtt_time = rtt_time;
+        if (rtt_time < hot->rtt_time) {
+            hot->rtt_time = rtt_time;
         }
     }
 
     return 0;
 }
 
+/** @brief Handle a received data packet.
+ *
+ * @retval -1 on failure.
+ * @retval 0 on success.
+ */
+static int handle_data_packet_core(Net_Crypto *_Nonnull c, int crypt_connection_id, const uint8_t *_Nonnull packet, uint16_t length,
+                                   bool udp, void *_Nullable userdata)
+{
+    if (length > MAX_CRYPTO_PACKET_SIZE || length <= CRYPTO_DATA_PACKET_MIN_SIZE) {
+        return -1;
+    }
+
+    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+
+    if (conn == nullptr) {
+        return -1;
+    }
+
+    uint8_t data[MAX_DATA_DATA_PACKET_SIZE];
+    const int len = handle_data_packet(c, crypt_connection_id, data, packet, length);
+
+    if (len == -1) {
+        return -1;
+    }
+
+    return handle_decrypted_data_packet(c, crypt_connection_id, data, (uint16_t)len, udp, userdata);
+}
+
 static int handle_packet_cookie_response(const Net_Crypto *_Nonnull c, int crypt_connection_id, const uint8_t *_Nonnull packet, uint16_t length)
 {
     Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
@@ -1651,7 +1896,9 @@ static int handle_packet_cookie_response(const Net_Crypto *_Nonnull c, int crypt
         return -1;
     }
 
-    if (conn->status != CRYPTO_CONN_COOKIE_REQUESTING) {
+    Crypto_Connection_Hot *hot = &c->crypto_connections_hot[crypt_connection_id];
+
+    if (hot->status != CRYPTO_CONN_COOKIE_REQUESTING) {
         return -1;
     }
 
@@ -1670,7 +1917,7 @@ static int handle_packet_cookie_response(const Net_Crypto *_Nonnull c, int crypt
         return -1;
     }
 
-    conn->status = CRYPTO_CONN_HANDSHAKE_SENT;
+    hot->status = CRYPTO_CONN_HANDSHAKE_SENT;
     return 0;
 }
 
@@ -1682,9 +1929,11 @@ static int handle_packet_crypto_hs(const Net_Crypto *_Nonnull c, int crypt_conne
         return -1;
     }
 
-    if (conn->status != CRYPTO_CONN_COOKIE_REQUESTING
-            && conn->status != CRYPTO_CONN_HANDSHAKE_SENT
-            && conn->status != CRYPTO_CONN_NOT_CONFIRMED) {
+    Crypto_Connection_Hot *hot = &c->crypto_connections_hot[crypt_connection_id];
+
+    if (hot->status != CRYPTO_CONN_COOKIE_REQUESTING
+            && hot->status != CRYPTO_CONN_HANDSHAKE_SENT
+            && hot->status != CRYPTO_CONN_NOT_CONFIRMED) {
         return -1;
     }
 
@@ -1700,13 +1949,14 @@ static int handle_packet_crypto_hs(const Net_Crypto *_Nonnull c, int crypt_conne
     if (pk_equal(dht_public_key, conn->dht_public_key)) {
         encrypt_precompute(conn->peersessionpublic_key, conn->sessionsecret_key, conn->shared_key);
 
-        if (conn->status == CRYPTO_CONN_COOKIE_REQUESTING) {
+        if (hot->status == CRYPTO_CONN_COOKIE_REQUESTING) {
             if (create_send_handshake(c, crypt_connection_id, cookie, dht_public_key) != 0) {
                 return -1;
             }
         }
 
-        conn->status = CRYPTO_CONN_NOT_CONFIRMED;
+        hot->status = CRYPTO_CONN_NOT_CONFIRMED;
+        schedule_crypto_connection(c, crypt_connection_id);
     } else {
         if (conn->dht_pk_callback != nullptr) {
             conn->dht_pk_callback(conn->dht_pk_callback_object, conn->dht_pk_callback_number, dht_public_key, userdata);
@@ -1724,7 +1974,9 @@ static int handle_packet_crypto_data(Net_Crypto *_Nonnull c, int crypt_connectio
         return -1;
     }
 
-    if (conn->status != CRYPTO_CONN_NOT_CONFIRMED && conn->status != CRYPTO_CONN_ESTABLISHED) {
+    const Crypto_Connection_Hot *hot = &c->crypto_connections_hot[crypt_connection_id];
+
+    if (hot->status != CRYPTO_CONN_NOT_CONFIRMED && hot->status != CRYPTO_CONN_ESTABLISHED) {
         return -1;
     }
 
@@ -1758,7 +2010,10 @@ static int handle_packet_connection(Net_Crypto *_Nonnull c, int crypt_connection
     }
 }
 
-/** @brief Set the size of the friend list to numfriends.
+/** @brief Set the size of the connection arrays to num.
+ *
+ * Only the pointer and hot arrays are resized, the connections themselves are
+ * allocated in `create_crypto_connection`.
  *
  * @retval -1 if mem_vrealloc fails.
  * @retval 0 if it succeeds.
@@ -1767,32 +2022,51 @@ static int realloc_cryptoconnection(Net_Crypto *_Nonnull c, uint32_t num)
 {
     if (num == 0) {
         mem_delete(c->mem, c->crypto_connections);
+        mem_delete(c->mem, c->crypto_connections_hot);
         c->crypto_connections = nullptr;
+        c->crypto_connections_hot = nullptr;
         return 0;
     }
 
-    Crypto_Connection *newcrypto_connections = (Crypto_Connection *)mem_vrealloc(
-                c->mem, c->crypto_connections, num, sizeof(Crypto_Connection));
+    Crypto_Connection **newcrypto_connections = (Crypto_Connection **)mem_vrealloc(
+                c->mem, c->crypto_connections, num, sizeof(Crypto_Connection *));
 
     if (newcrypto_connections == nullptr) {
         return -1;
     }
 
     c->crypto_connections = newcrypto_connections;
+
+    Crypto_Connection_Hot *newcrypto_connections_hot = (Crypto_Connection_Hot *)mem_vrealloc(
+                c->mem, c->crypto_connections_hot, num, sizeof(Crypto_Connection_Hot));
+
+    if (newcrypto_connections_hot == nullptr) {
+        return -1;
+    }
+
+    c->crypto_connections_hot = newcrypto_connections_hot;
     return 0;
 }
 
-/** @brief Create a new empty crypto connection.
+/** @brief Create a new empty crypto connection for the peer with the given real public key.
+ *
+ * The public key is added to the lookup list used by `getcryptconnection_id`.
  *
  * @retval -1 on failure.
  * @return connection id on success.
  */
-static int create_crypto_connection(Net_Crypto *_Nonnull c)
+static int create_crypto_connection(Net_Crypto *_Nonnull c, const uint8_t *_Nonnull public_key)
 {
+    Crypto_Connection *conn = (Crypto_Connection *)mem_alloc(c->mem, sizeof(Crypto_Connection));
+
+    if (conn == nullptr) {
+        return -1;
+    }
+
     int id = -1;
 
     for (uint32_t i = 0; i < c->crypto_connections_length; ++i) {
-        if (c->crypto_connections[i].status == CRYPTO_CONN_FREE) {
+        if (c->crypto_connections_hot[i].status == CRYPTO_CONN_FREE) {
             id = i;
             break;
         }
@@ -1802,22 +2076,42 @@ static int create_crypto_connection(Net_Crypto *_Nonnull c)
         if (realloc_cryptoconnection(c, c->crypto_connections_length + 1) == 0) {
             id = c->crypto_connections_length;
             ++c->crypto_connections_length;
-            c->crypto_connections[id] = empty_crypto_connection;
+            c->crypto_connections[id] = nullptr;
+            c->crypto_connections_hot[id] = empty_crypto_connection_hot;
         }
     }
 
-    if (id != -1) {
-        // Memsetting float/double to 0 is non-portable, so we explicitly set them to 0
-        c->crypto_connections[id].packet_recv_rate = 0.0;
-        c->crypto_connections[id].packet_send_rate = 0.0;
-        c->crypto_connections[id].last_packets_left_rem = 0.0;
-        c->crypto_connections[id].packet_send_rate_requested = 0.0;
-        c->crypto_connections[id].last_packets_left_requested_rem = 0.0;
+    if (id == -1) {
+        mem_delete(c->mem, conn);
+        return -1;
+    }
+
+    if (!bs_list_add(&c->public_key_list, public_key, id)) {
+        // Either out of memory or a connection to this key already exists.
+        if (id + 1 == (int)c->crypto_connections_length) {
+            --c->crypto_connections_length;
+            realloc_cryptoconnection(c, c->crypto_connections_length);
+        }
 
-        // TODO(Green-Sky): This enum is likely unneeded and the same as FREE.
-        c->crypto_connections[id].status = CRYPTO_CONN_NO_CONNECTION;
+        mem_delete(c->mem, conn);
+        return -1;
     }
 
+    memcpy(conn->public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    c->crypto_connections[id] = conn;
+
+    Crypto_Connection_Hot *hot = &c->crypto_connections_hot[id];
+
+    // Memsetting float/double to 0 is non-portable, so we explicitly set them to 0
+    hot->packet_recv_rate = 0.0;
+    hot->packet_send_rate = 0.0;
+    hot->last_packets_left_rem = 0.0;
+    hot->packet_send_rate_requested = 0.0;
+    hot->last_packets_left_requested_rem = 0.0;
+
+    // TODO(Green-Sky): This enum is likely unneeded and the same as FREE.
+    hot->status = CRYPTO_CONN_NO_CONNECTION;
+
     return id;
 }
 
@@ -1832,11 +2126,11 @@ static int wipe_crypto_connection(Net_Crypto *_Nonnull c, int crypt_connection_i
         return -1;
     }
 
-    if (c->crypto_connections == nullptr) {
+    if (c->crypto_connections == nullptr || c->crypto_connections_hot == nullptr) {
         return -1;
     }
 
-    const Crypto_Conn_State status = c->crypto_connections[crypt_connection_id].status;
+    const Crypto_Conn_State status = c->crypto_connections_hot[crypt_connection_id].status;
 
     if (status == CRYPTO_CONN_FREE) {
         return -1;
@@ -1844,11 +2138,17 @@ static int wipe_crypto_connection(Net_Crypto *_Nonnull c, int crypt_connection_i
 
     uint32_t i;
 
-    crypto_memzero(&c->crypto_connections[crypt_connection_id], sizeof(Crypto_Connection));
+    Crypto_Connection *conn = c->crypto_connections[crypt_connection_id];
+    bs_list_remove(&c->public_key_list, conn->public_key, crypt_connection_id);
+    crypto_memzero(conn, sizeof(Crypto_Connection));
+    mem_delete(c->mem, conn);
+    c->crypto_connections[crypt_connection_id] = nullptr;
+    c->crypto_connections_hot[crypt_connection_id] = empty_crypto_connection_hot;
+    timer_wheel_cancel(c->timers, (uint32_t)crypt_connection_id);
 
     /* check if we can resize the connections array */
     for (i = c->crypto_connections_length; i != 0; --i) {
-        if (c->crypto_connections[i - 1].status != CRYPTO_CONN_FREE) {
+        if (c->crypto_connections_hot[i - 1].status != CRYPTO_CONN_FREE) {
             break;
         }
     }
@@ -1868,17 +2168,13 @@ static int wipe_crypto_connection(Net_Crypto *_Nonnull c, int crypt_connection_i
  */
 static int getcryptconnection_id(const Net_Crypto *_Nonnull c, const uint8_t *_Nonnull public_key)
 {
-    for (uint32_t i = 0; i < c->crypto_connections_length; ++i) {
-        if (!crypt_connection_id_is_valid(c, i)) {
-            continue;
-        }
+    const int id = bs_list_find(&c->public_key_list, public_key);
 
-        if (pk_equal(public_key, c->crypto_connections[i].public_key)) {
-            return i;
-        }
+    if (id == -1 || !crypt_connection_id_is_valid(c, id)) {
+        return -1;
     }
 
-    return -1;
+    return id;
 }
 
 /** @brief Add a source to the crypto connection.
@@ -1890,9 +2186,9 @@ static int getcryptconnection_id(const Net_Crypto *_Nonnull c, const uint8_t *_N
  */
 static int crypto_connection_add_source(Net_Crypto *_Nonnull c, int crypt_connection_id, const IP_Port *_Nonnull source)
 {
-    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+    Crypto_Connection_Hot *hot = get_crypto_connection_hot(c, crypt_connection_id);
 
-    if (conn == nullptr) {
+    if (hot == nullptr) {
         return -1;
     }
 
@@ -1902,9 +2198,9 @@ static int crypto_connection_add_source(Net_Crypto *_Nonnull c, int crypt_connec
         }
 
         if (net_family_is_ipv4(source->ip.family)) {
-            conn->direct_lastrecv_timev4 = mono_time_get(c->mono_time);
+            hot->direct_lastrecv_timev4 = mono_time_get(c->mono_time);
         } else {
-            conn->direct_lastrecv_timev6 = mono_time_get(c->mono_time);
+            hot->direct_lastrecv_timev6 = mono_time_get(c->mono_time);
         }
 
         return 0;
@@ -1913,7 +2209,7 @@ static int crypto_connection_add_source(Net_Crypto *_Nonnull c, int crypt_connec
     unsigned int tcp_connections_number;
 
     if (ip_port_to_tcp_connections_number(source, &tcp_connections_number)) {
-        if (add_tcp_number_relay_connection(c->tcp_c, conn->connection_number_tcp, tcp_connections_number) == 0) {
+        if (add_tcp_number_relay_connection(c->tcp_c, hot->connection_number_tcp, tcp_connections_number) == 0) {
             return 1;
         }
     }
@@ -1967,10 +2263,12 @@ static int handle_new_connection_handshake(Net_Crypto *_Nonnull c, const IP_Port
             return -1;
         }
 
+        Crypto_Connection_Hot *hot = &c->crypto_connections_hot[crypt_connection_id];
+
         if (!pk_equal(n_c.dht_public_key, conn->dht_public_key)) {
             connection_kill(c, crypt_connection_id, userdata);
         } else {
-            if (conn->status != CRYPTO_CONN_COOKIE_REQUESTING && conn->status != CRYPTO_CONN_HANDSHAKE_SENT) {
+            if (hot->status != CRYPTO_CONN_COOKIE_REQUESTING && hot->status != CRYPTO_CONN_HANDSHAKE_SENT) {
                 mem_delete(c->mem, n_c.cookie);
                 return -1;
             }
@@ -1986,7 +2284,7 @@ static int handle_new_connection_handshake(Net_Crypto *_Nonnull c, const IP_Port
                 return -1;
             }
 
-            conn->status = CRYPTO_CONN_NOT_CONFIRMED;
+            hot->status = CRYPTO_CONN_NOT_CONFIRMED;
             mem_delete(c->mem, n_c.cookie);
             return 0;
         }
@@ -2008,14 +2306,15 @@ int accept_crypto_connection(Net_Crypto *c, const New_Connection *n_c)
         return -1;
     }
 
-    const int crypt_connection_id = create_crypto_connection(c);
+    const int crypt_connection_id = create_crypto_connection(c, n_c->public_key);
 
     if (crypt_connection_id == -1) {
         LOGGER_ERROR(c->log, "Could not create new crypto connection");
         return -1;
     }
 
-    Crypto_Connection *conn = &c->crypto_connections[crypt_connection_id];
+    Crypto_Connection *conn = c->crypto_connections[crypt_connection_id];
+    Crypto_Connection_Hot *hot = &c->crypto_connections_hot[crypt_connection_id];
 
     if (n_c->cookie_length != COOKIE_LENGTH) {
         wipe_crypto_connection(c, crypt_connection_id);
@@ -2029,26 +2328,25 @@ int accept_crypto_connection(Net_Crypto *c, const New_Connection *n_c)
         return -1;
     }
 
-    conn->connection_number_tcp = connection_number_tcp;
-    memcpy(conn->public_key, n_c->public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    hot->connection_number_tcp = connection_number_tcp;
     memcpy(conn->recv_nonce, n_c->recv_nonce, CRYPTO_NONCE_SIZE);
     memcpy(conn->peersessionpublic_key, n_c->peersessionpublic_key, CRYPTO_PUBLIC_KEY_SIZE);
     random_nonce(c->rng, conn->sent_nonce);
     crypto_new_keypair(c->rng, conn->sessionpublic_key, conn->sessionsecret_key);
     encrypt_precompute(conn->peersessionpublic_key, conn->sessionsecret_key, conn->shared_key);
-    conn->status = CRYPTO_CONN_NOT_CONFIRMED;
+    hot->status = CRYPTO_CONN_NOT_CONFIRMED;
 
     if (create_send_handshake(c, crypt_connection_id, n_c->cookie, n_c->dht_public_key) != 0) {
-        kill_tcp_connection_to(c->tcp_c, conn->connection_number_tcp);
+        kill_tcp_connection_to(c->tcp_c, hot->connection_number_tcp);
         wipe_crypto_connection(c, crypt_connection_id);
         return -1;
     }
 
     memcpy(conn->dht_public_key, n_c->dht_public_key, CRYPTO_PUBLIC_KEY_SIZE);
-    conn->packet_send_rate = CRYPTO_PACKET_MIN_RATE;
-    conn->packet_send_rate_requested = CRYPTO_PACKET_MIN_RATE;
-    conn->packets_left = CRYPTO_MIN_QUEUE_LENGTH;
-    conn->rtt_time = DEFAULT_PING_CONNECTION;
+    hot->packet_send_rate = CRYPTO_PACKET_MIN_RATE;
+    hot->packet_send_rate_requested = CRYPTO_PACKET_MIN_RATE;
+    hot->packets_left = CRYPTO_MIN_QUEUE_LENGTH;
+    hot->rtt_time = DEFAULT_PING_CONNECTION;
     crypto_connection_add_source(c, crypt_connection_id, &n_c->source);
     return crypt_connection_id;
 }
@@ -2067,13 +2365,14 @@ int new_crypto_connection(Net_Crypto *c, const uint8_t *real_public_key, const u
         return crypt_connection_id;
     }
 
-    crypt_connection_id = create_crypto_connection(c);
+    crypt_connection_id = create_crypto_connection(c, real_public_key);
 
     if (crypt_connection_id == -1) {
         return -1;
     }
 
-    Crypto_Connection *conn = &c->crypto_connections[crypt_connection_id];
+    Crypto_Connection *conn = c->crypto_connections[crypt_connection_id];
+    Crypto_Connection_Hot *hot = &c->crypto_connections_hot[crypt_connection_id];
 
     const int connection_number_tcp = new_tcp_connection_to(c->tcp_c, dht_public_key, crypt_connection_id);
 
@@ -2082,15 +2381,14 @@ int new_crypto_connection(Net_Crypto *c, const uint8_t *real_public_key, const u
         return -1;
     }
 
-    conn->connection_number_tcp = connection_number_tcp;
-    memcpy(conn->public_key, real_public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    hot->connection_number_tcp = connection_number_tcp;
     random_nonce(c->rng, conn->sent_nonce);
     crypto_new_keypair(c->rng, conn->sessionpublic_key, conn->sessionsecret_key);
-    conn->status = CRYPTO_CONN_COOKIE_REQUESTING;
-    conn->packet_send_rate = CRYPTO_PACKET_MIN_RATE;
-    conn->packet_send_rate_requested = CRYPTO_PACKET_MIN_RATE;
-    conn->packets_left = CRYPTO_MIN_QUEUE_LENGTH;
-    conn->rtt_time = DEFAULT_PING_CONNECTION;
+    hot->status = CRYPTO_CONN_COOKIE_REQUESTING;
+    hot->packet_send_rate = CRYPTO_PACKET_MIN_RATE;
+    hot->packet_send_rate_requested = CRYPTO_PACKET_MIN_RATE;
+    hot->packets_left = CRYPTO_MIN_QUEUE_LENGTH;
+    hot->rtt_time = DEFAULT_PING_CONNECTION;
     memcpy(conn->dht_public_key, dht_public_key, CRYPTO_PUBLIC_KEY_SIZE);
 
     conn->cookie_request_number = random_u64(c->rng);
@@ -2099,7 +2397,7 @@ int new_crypto_connection(Net_Crypto *c, const uint8_t *real_public_key, const u
     if (create_cookie_request(c, cookie_request, conn->dht_public_key, conn->cookie_request_number,
                               conn->shared_key) != sizeof(cookie_request)
             || new_temp_packet(c, crypt_connection_id, cookie_request, sizeof(cookie_request)) != 0) {
-        kill_tcp_connection_to(c->tcp_c, conn->connection_number_tcp);
+        kill_tcp_connection_to(c->tcp_c, hot->connection_number_tcp);
         wipe_crypto_connection(c, crypt_connection_id);
         return -1;
     }
@@ -2116,9 +2414,9 @@ int new_crypto_connection(Net_Crypto *c, const uint8_t *real_public_key, const u
  */
 int set_direct_ip_port(Net_Crypto *c, int crypt_connection_id, const IP_Port *ip_port, bool connected)
 {
-    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+    Crypto_Connection_Hot *hot = get_crypto_connection_hot(c, crypt_connection_id);
 
-    if (conn == nullptr) {
+    if (hot == nullptr) {
         return -1;
     }
 
@@ -2129,9 +2427,9 @@ int set_direct_ip_port(Net_Crypto *c, int crypt_connection_id, const IP_Port *ip
     const uint64_t direct_lastrecv_time = connected ? mono_time_get(c->mono_time) : 0;
 
     if (net_family_is_ipv4(ip_port->ip.family)) {
-        conn->direct_lastrecv_timev4 = direct_lastrecv_time;
+        hot->direct_lastrecv_timev4 = direct_lastrecv_time;
     } else {
-        conn->direct_lastrecv_timev6 = direct_lastrecv_time;
+        hot->direct_lastrecv_timev6 = direct_lastrecv_time;
     }
 
     return 0;
@@ -2145,14 +2443,14 @@ static int tcp_data_callback(void *_Nonnull object, int crypt_connection_id, con
         return -1;
     }
 
-    const Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+    const Crypto_Connection_Hot *hot = get_crypto_connection_hot(c, crypt_connection_id);
 
-    if (conn == nullptr) {
+    if (hot == nullptr) {
         return -1;
     }
 
     if (packet[0] == NET_PACKET_COOKIE_REQUEST) {
-        return tcp_handle_cookie_request(c, conn->connection_number_tcp, packet, length);
+        return tcp_handle_cookie_request(c, hot->connection_number_tcp, packet, length);
     }
 
     const int ret = handle_packet_connection(c, crypt_connection_id, packet, length, false, userdata);
@@ -2197,13 +2495,13 @@ static int tcp_oob_callback(void *_Nonnull object, const uint8_t *_Nonnull publi
  */
 int add_tcp_relay_peer(Net_Crypto *c, int crypt_connection_id, const IP_Port *ip_port, const uint8_t *public_key)
 {
-    const Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+    const Crypto_Connection_Hot *hot = get_crypto_connection_hot(c, crypt_connection_id);
 
-    if (conn == nullptr) {
+    if (hot == nullptr) {
         return -1;
     }
 
-    return add_tcp_relay_connection(c->tcp_c, conn->connection_number_tcp, ip_port, public_key);
+    return add_tcp_relay_connection(c->tcp_c, hot->connection_number_tcp, ip_port, public_key);
 }
 
 /** @brief Add a tcp relay to the array.
@@ -2290,31 +2588,6 @@ uint32_t copy_connected_tcp_relays_index(const Net_Crypto *c, Node_format *tcp_r
     return tcp_copy_connected_relays_index(c->tcp_c, tcp_relays, num, idx);
 }
 
-static void do_tcp(Net_Crypto *_Nonnull c, void *_Nullable userdata)
-{
-    do_tcp_connections(c->log, c->tcp_c, userdata);
-
-    for (uint32_t i = 0; i < c->crypto_connections_length; ++i) {
-        const Crypto_Connection *conn = get_crypto_connection(c, i);
-
-        if (conn == nullptr) {
-            continue;
-        }
-
-        if (conn->status != CRYPTO_CONN_ESTABLISHED) {
-            continue;
-        }
-
-        bool direct_connected = false;
-
-        if (!crypto_connection_status(c, i, &direct_connected, nullptr)) {
-            continue;
-        }
-
-        set_tcp_connection_to_status(c->tcp_c, conn->connection_number_tcp, !direct_connected);
-    }
-}
-
 /** @brief Set function to be called when connection with crypt_connection_id goes connects/disconnects.
  *
  * The set function should return -1 on failure and 0 on success.
@@ -2423,6 +2696,133 @@ static int crypto_id_ip_port(const Net_Crypto *_Nonnull c, const IP_Port *_Nonnu
 
 #define CRYPTO_MIN_PACKET_SIZE (1 + sizeof(uint16_t) + CRYPTO_MAC_SIZE)
 
+static void udp_packet_received(const Net_Crypto *_Nonnull c, int crypt_connection_id, bool ipv4)
+{
+    Crypto_Connection_Hot *hot = get_crypto_connection_hot(c, crypt_connection_id);
+
+    if (hot == nullptr) {
+        return;
+    }
+
+    if (ipv4) {
+        hot->direct_lastrecv_timev4 = mono_time_get(c->mono_time);
+    } else {
+        hot->direct_lastrecv_timev6 = mono_time_get(c->mono_time);
+    }
+}
+
+/** @brief Handle a queued UDP data packet after the whole queue was decrypted.
+ *
+ * @param len the result of decrypting the packet.
+ */
+static void handle_queued_data_packet(Net_Crypto *_Nonnull c, const Crypto_Queued_Packet *_Nonnull entry, int32_t len,
+                                      void *_Nullable userdata)
+{
+    const int crypt_connection_id = entry->crypt_connection_id;
+    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+
+    if (conn == nullptr) {
+        return;
+    }
+
+    const Crypto_Connection_Hot *hot = &c->crypto_connections_hot[crypt_connection_id];
+
+    if (hot->status != CRYPTO_CONN_NOT_CONFIRMED && hot->status != CRYPTO_CONN_ESTABLISHED) {
+        return;
+    }
+
+    uint8_t nonce[CRYPTO_NONCE_SIZE];
+    const uint16_t diff = data_packet_nonce(conn, entry->packet, nonce);
+    int ret;
+
+    if (memcmp(nonce, entry->nonce, CRYPTO_NONCE_SIZE) != 0
+            || memcmp(conn->shared_key, entry->shared_key, CRYPTO_SHARED_KEY_SIZE) != 0) {
+        /* An earlier packet in the queue moved the receive nonce on, or the
+         * connection was replaced: decrypt it again with the current state. */
+        ret = handle_data_packet_core(c, crypt_connection_id, entry->packet, entry->length, true, userdata);
+    } else {
+        if (len == -1) {
+            return;
+        }
+
+        data_packet_accepted(conn, diff);
+        ret = handle_decrypted_data_packet(c, crypt_connection_id, entry->data, (uint16_t)len, true, userdata);
+    }
+
+    if (ret == 0) {
+        udp_packet_received(c, crypt_connection_id, entry->ipv4);
+    }
+}
+
+/** @brief Decrypt all queued UDP data packets at once, then handle them in arrival order. */
+static void flush_udp_data_packets(Net_Crypto *_Nonnull c, void *_Nullable userdata)
+{
+    const uint32_t count = c->udp_queue_length;
+
+    if (count == 0) {
+        return;
+    }
+
+    Crypto_Decrypt_Job jobs[CRYPTO_UDP_QUEUE_SIZE];
+
+    for (uint32_t i = 0; i < count; ++i) {
+        Crypto_Queued_Packet *const entry = &c->udp_queue[i];
+        const Crypto_Connection *conn = get_crypto_connection(c, entry->crypt_connection_id);
+
+        jobs[i].shared_key = entry->shared_key;
+        jobs[i].nonce = entry->nonce;
+        jobs[i].encrypted = entry->packet + 1 + sizeof(uint16_t);
+        jobs[i].length = 0;
+        jobs[i].plain = entry->data;
+
+        if (conn != nullptr) {
+            memcpy(entry->shared_key, conn->shared_key, CRYPTO_SHARED_KEY_SIZE);
+            data_packet_nonce(conn, entry->packet, entry->nonce);
+            jobs[i].length = entry->length - (1 + sizeof(uint16_t));
+        }
+    }
+
+    decrypt_data_symmetric_batch(jobs, count);
+
+    for (uint32_t i = 0; i < count; ++i) {
+        Crypto_Queued_Packet *const entry = &c->udp_queue[i];
+        handle_queued_data_packet(c, entry, jobs[i].result, userdata);
+        crypto_memzero(entry->shared_key, sizeof(entry->shared_key));
+    }
+
+    c->udp_queue_length = 0;
+}
+
+/** @brief Queue a UDP data packet for an established or confirming connection.
+ *
+ * @retval false if the packet can't be queued and must be handled right away.
+ */
+static bool queue_udp_data_packet(Net_Crypto *_Nonnull c, int crypt_connection_id, const IP_Port *_Nonnull source,
+                                  const uint8_t *_Nonnull packet, uint16_t length, void *_Nullable userdata)
+{
+    const Crypto_Connection_Hot *hot = get_crypto_connection_hot(c, crypt_connection_id);
+
+    if (hot == nullptr || (hot->status != CRYPTO_CONN_NOT_CONFIRMED && hot->status != CRYPTO_CONN_ESTABLISHED)) {
+        return false;
+    }
+
+    if (length <= CRYPTO_DATA_PACKET_MIN_SIZE || length > MAX_CRYPTO_PACKET_SIZE) {
+        return false;
+    }
+
+    if (c->udp_queue_length == CRYPTO_UDP_QUEUE_SIZE) {
+        flush_udp_data_packets(c, userdata);
+    }
+
+    Crypto_Queued_Packet *const entry = &c->udp_queue[c->udp_queue_length];
+    entry->crypt_connection_id = crypt_connection_id;
+    entry->ipv4 = net_family_is_ipv4(source->ip.family);
+    entry->length = length;
+    memcpy(entry->packet, packet, length);
+    ++c->udp_queue_length;
+    return true;
+}
+
 /** @brief Handle raw UDP packets coming directly from the socket.
  *
  * Handles:
@@ -2453,22 +2853,19 @@ static int udp_handle_packet(void *_Nonnull object, const IP_Port *_Nonnull sour
         return 0;
     }
 
-    if (handle_packet_connection(c, crypt_connection_id, packet, length, true, userdata) != 0) {
-        return 1;
+    if (packet[0] == NET_PACKET_CRYPTO_DATA
+            && queue_udp_data_packet(c, crypt_connection_id, source, packet, length, userdata)) {
+        return 0;
     }
 
-    Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+    /* Handshakes can change the keys and nonces, so handle everything before them first. */
+    flush_udp_data_packets(c, userdata);
 
-    if (conn == nullptr) {
-        return -1;
-    }
-
-    if (net_family_is_ipv4(source->ip.family)) {
-        conn->direct_lastrecv_timev4 = mono_time_get(c->mono_time);
-    } else {
-        conn->direct_lastrecv_timev6 = mono_time_get(c->mono_time);
+    if (handle_packet_connection(c, crypt_connection_id, packet, length, true, userdata) != 0) {
+        return 1;
     }
 
+    udp_packet_received(c, crypt_connection_id, net_family_is_ipv4(source->ip.family));
     return 0;
 }
 
@@ -2492,240 +2889,264 @@ static int udp_handle_packet(void *_Nonnull object, const IP_Port *_Nonnull sour
  */
 #define SEND_QUEUE_RATIO 2.0
 
-static void send_crypto_packets(Net_Crypto *_Nonnull c)
+/** @brief Do the periodic work of a connection and set its next deadline.
+ *
+ * Called from do_net_crypto whenever the timer of the connection expires.
+ */
+static void do_crypto_connection(Net_Crypto *_Nonnull c, int crypt_connection_id, uint64_t temp_time, void *_Nullable userdata)
 {
-    const uint64_t temp_time = current_time_monotonic(c->mono_time);
-    double total_send_rate = 0;
-    uint32_t peak_request_packet_interval = -1;
+    Crypto_Connection_Hot *hot = get_crypto_connection_hot(c, crypt_connection_id);
 
-    for (uint32_t i = 0; i < c->crypto_connections_length; ++i) {
-        Crypto_Connection *conn = get_crypto_connection(c, i);
+    if (hot == nullptr) {
+        return;
+    }
 
-        if (conn == nullptr) {
-            continue;
-        }
+    const bool handshaking = hot->status == CRYPTO_CONN_COOKIE_REQUESTING || hot->status == CRYPTO_CONN_HANDSHAKE_SENT
+                             || hot->status == CRYPTO_CONN_NOT_CONFIRMED;
 
-        if ((CRYPTO_SEND_PACKET_INTERVAL + conn->temp_packet_sent_time) < temp_time) {
-            send_temp_packet(c, i);
-        }
+    if (handshaking && hot->temp_packet_num_sent >= MAX_NUM_SENDPACKET_TRIES) {
+        connection_kill(c, crypt_connection_id, userdata);
+        return;
+    }
 
-        if ((conn->status == CRYPTO_CONN_NOT_CONFIRMED || conn->status == CRYPTO_CONN_ESTABLISHED)
-                && (CRYPTO_SEND_PACKET_INTERVAL + conn->last_request_packet_sent) < temp_time) {
-            if (send_request_packet(c, i) == 0) {
-                conn->last_request_packet_sent = temp_time;
-            }
+    if (hot->status == CRYPTO_CONN_ESTABLISHED) {
+        bool direct_connected = false;
+        crypto_connection_status(c, crypt_connection_id, &direct_connected, nullptr);
+        set_tcp_connection_to_status(c->tcp_c, hot->connection_number_tcp, !direct_connected);
+    }
+
+    if (hot->has_temp_packet && (CRYPTO_SEND_PACKET_INTERVAL + hot->temp_packet_sent_time) < temp_time) {
+        send_temp_packet(c, crypt_connection_id);
+    }
+
+    if ((hot->status == CRYPTO_CONN_NOT_CONFIRMED || hot->status == CRYPTO_CONN_ESTABLISHED)
+            && (CRYPTO_SEND_PACKET_INTERVAL + hot->last_request_packet_sent) < temp_time) {
+        if (send_request_packet(c, crypt_connection_id) == 0) {
+            hot->last_request_packet_sent = temp_time;
         }
+    }
 
-        if (conn->status == CRYPTO_CONN_ESTABLISHED) {
-            if (conn->packet_recv_rate > CRYPTO_PACKET_MIN_RATE) {
-                double request_packet_interval = REQUEST_PACKETS_COMPARE_CONSTANT / ((num_packets_array(
-                                                     &conn->recv_array) + 1.0) / (conn->packet_recv_rate + 1.0));
+    uint64_t request_deadline = TIMER_WHEEL_NEVER;
 
-                const double request_packet_interval2 = ((CRYPTO_PACKET_MIN_RATE / conn->packet_recv_rate) *
-                                                        (double)CRYPTO_SEND_PACKET_INTERVAL) + (double)PACKET_COUNTER_AVERAGE_INTERVAL;
+    if (hot->status == CRYPTO_CONN_ESTABLISHED) {
+        Crypto_Connection *conn = c->crypto_connections[crypt_connection_id];
 
-                if (request_packet_interval2 < request_packet_interval) {
-                    request_packet_interval = request_packet_interval2;
-                }
+        if (hot->packet_recv_rate > CRYPTO_PACKET_MIN_RATE) {
+            double request_packet_interval = REQUEST_PACKETS_COMPARE_CONSTANT / ((num_packets_array(
+                                                 &conn->recv_array) + 1.0) / (hot->packet_recv_rate + 1.0));
 
-                if (request_packet_interval < PACKET_COUNTER_AVERAGE_INTERVAL) {
-                    request_packet_interval = PACKET_COUNTER_AVERAGE_INTERVAL;
-                }
+            const double request_packet_interval2 = ((CRYPTO_PACKET_MIN_RATE / hot->packet_recv_rate) *
+                                                    (double)CRYPTO_SEND_PACKET_INTERVAL) + (double)PACKET_COUNTER_AVERAGE_INTERVAL;
 
-                if (request_packet_interval > CRYPTO_SEND_PACKET_INTERVAL) {
-                    request_packet_interval = CRYPTO_SEND_PACKET_INTERVAL;
-                }
+            if (request_packet_interval2 < request_packet_interval) {
+                request_packet_interval = request_packet_interval2;
+            }
 
-                if (temp_time - conn->last_request_packet_sent > (uint64_t)request_packet_interval) {
-                    if (send_request_packet(c, i) == 0) {
-                        conn->last_request_packet_sent = temp_time;
-                    }
-                }
+            if (request_packet_interval < PACKET_COUNTER_AVERAGE_INTERVAL) {
+                request_packet_interval = PACKET_COUNTER_AVERAGE_INTERVAL;
+            }
 
-                if (request_packet_interval < peak_request_packet_interval) {
-                    peak_request_packet_interval = request_packet_interval;
+            if (request_packet_interval > CRYPTO_SEND_PACKET_INTERVAL) {
+                request_packet_interval = CRYPTO_SEND_PACKET_INTERVAL;
+            }
+
+            if (temp_time - hot->last_request_packet_sent > (uint64_t)request_packet_interval) {
+                if (send_request_packet(c, crypt_connection_id) == 0) {
+                    hot->last_request_packet_sent = temp_time;
                 }
             }
 
-            if ((PACKET_COUNTER_AVERAGE_INTERVAL + conn->packet_counter_set) < temp_time) {
-                const double dt = (double)(temp_time - conn->packet_counter_set);
+            request_deadline = hot->last_request_packet_sent + (uint64_t)request_packet_interval + 1;
+        }
 
-                conn->packet_recv_rate = (double)conn->packet_counter / (dt / 1000.0);
-                conn->packet_counter = 0;
-                conn->packet_counter_set = temp_time;
+        if ((PACKET_COUNTER_AVERAGE_INTERVAL + hot->packet_counter_set) < temp_time) {
+            const double dt = (double)(temp_time - hot->packet_counter_set);
 
-                const uint32_t packets_sent = conn->packets_sent;
-                conn->packets_sent = 0;
+            hot->packet_recv_rate = (double)hot->packet_counter / (dt / 1000.0);
+            hot->packet_counter = 0;
+            hot->packet_counter_set = temp_time;
 
-                const uint32_t packets_resent = conn->packets_resent;
-                conn->packets_resent = 0;
+            const uint32_t packets_sent = hot->packets_sent;
+            hot->packets_sent = 0;
 
-                /* conjestion control
-                 *  calculate a new value of conn->packet_send_rate based on some data
-                 */
+            const uint32_t packets_resent = hot->packets_resent;
+            hot->packets_resent = 0;
 
-                const unsigned int pos = conn->last_sendqueue_counter % CONGESTION_QUEUE_ARRAY_SIZE;
-                conn->last_sendqueue_size[pos] = num_packets_array(&conn->send_array);
+            /* conjestion control
+             *  calculate a new value of hot->packet_send_rate based on some data
+             */
 
-                long signed int sum = 0;
-                sum = (long signed int)conn->last_sendqueue_size[pos] -
-                      (long signed int)conn->last_sendqueue_size[(pos + 1) % CONGESTION_QUEUE_ARRAY_SIZE];
+            const unsigned int pos = conn->last_sendqueue_counter % CONGESTION_QUEUE_ARRAY_SIZE;
+            conn->last_sendqueue_size[pos] = num_packets_array(&conn->send_array);
 
-                const unsigned int n_p_pos = conn->last_sendqueue_counter % CONGESTION_LAST_SENT_ARRAY_SIZE;
-                conn->last_num_packets_sent[n_p_pos] = packets_sent;
-                conn->last_num_packets_resent[n_p_pos] = packets_resent;
+            long signed int sum = 0;
+            sum = (long signed int)conn->last_sendqueue_size[pos] -
+                  (long signed int)conn->last_sendqueue_size[(pos + 1) % CONGESTION_QUEUE_ARRAY_SIZE];
 
-                conn->last_sendqueue_counter = (conn->last_sendqueue_counter + 1) %
-                                               (CONGESTION_QUEUE_ARRAY_SIZE * CONGESTION_LAST_SENT_ARRAY_SIZE);
+            const unsigned int n_p_pos = conn->last_sendqueue_counter % CONGESTION_LAST_SENT_ARRAY_SIZE;
+            conn->last_num_packets_sent[n_p_pos] = packets_sent;
+            conn->last_num_packets_resent[n_p_pos] = packets_resent;
 
-                bool direct_connected = false;
-                /* return value can be ignored since the `if` above ensures the connection is established */
-                crypto_connection_status(c, i, &direct_connected, nullptr);
+            conn->last_sendqueue_counter = (conn->last_sendqueue_counter + 1) %
+                                           (CONGESTION_QUEUE_ARRAY_SIZE * CONGESTION_LAST_SENT_ARRAY_SIZE);
 
-                /* When switching from TCP to UDP, don't change the packet send rate for CONGESTION_EVENT_TIMEOUT ms. */
-                if (!(direct_connected && conn->last_tcp_sent + CONGESTION_EVENT_TIMEOUT > temp_time)) {
-                    long signed int total_sent = 0;
-                    long signed int total_resent = 0;
+            bool direct_connected = false;
+            /* return value can be ignored since the `if` above ensures the connection is established */
+            crypto_connection_status(c, crypt_connection_id, &direct_connected, nullptr);
 
-                    // TODO(irungentoo): use real delay
-                    unsigned int delay = (unsigned int)(((double)conn->rtt_time / PACKET_COUNTER_AVERAGE_INTERVAL) + 0.5);
-                    const unsigned int packets_set_rem_array = CONGESTION_LAST_SENT_ARRAY_SIZE - CONGESTION_QUEUE_ARRAY_SIZE;
+            /* When switching from TCP to UDP, don't change the packet send rate for CONGESTION_EVENT_TIMEOUT ms. */
+            if (!(direct_connected && hot->last_tcp_sent + CONGESTION_EVENT_TIMEOUT > temp_time)) {
+                long signed int total_sent = 0;
+                long signed int total_resent = 0;
 
-                    if (delay > packets_set_rem_array) {
-                        delay = packets_set_rem_array;
-                    }
+                // TODO(irungentoo): use real delay
+                unsigned int delay = (unsigned int)(((double)hot->rtt_time / PACKET_COUNTER_AVERAGE_INTERVAL) + 0.5);
+                const unsigned int packets_set_rem_array = CONGESTION_LAST_SENT_ARRAY_SIZE - CONGESTION_QUEUE_ARRAY_SIZE;
 
-                    for (unsigned j = 0; j < CONGESTION_QUEUE_ARRAY_SIZE; ++j) {
-                        const unsigned int ind = (j + (packets_set_rem_array  - delay) + n_p_pos) % CONGESTION_LAST_SENT_ARRAY_SIZE;
-                        total_sent += conn->last_num_packets_sent[ind];
-                        total_resent += conn->last_num_packets_resent[ind];
-                    }
+                if (delay > packets_set_rem_array) {
+                    delay = packets_set_rem_array;
+                }
+
+                for (unsigned j = 0; j < CONGESTION_QUEUE_ARRAY_SIZE; ++j) {
+                    const unsigned int ind = (j + (packets_set_rem_array  - delay) + n_p_pos) % CONGESTION_LAST_SENT_ARRAY_SIZE;
+                    total_sent += conn->last_num_packets_sent[ind];
+                    total_resent += conn->last_num_packets_resent[ind];
+                }
 
-                    if (sum > 0) {
-                        total_sent -= sum;
-                    } else {
-                        if (total_resent > -sum) {
-                            total_resent = -sum;
-                        }
+                if (sum > 0) {
+                    total_sent -= sum;
+                } else {
+                    if (total_resent > -sum) {
+                        total_resent = -sum;
                     }
+                }
 
-                    /* if queue is too big only allow resending packets. */
-                    const uint32_t npackets = num_packets_array(&conn->send_array);
-                    double min_speed = 1000.0 * (((double)total_sent) / ((double)CONGESTION_QUEUE_ARRAY_SIZE *
-                                                 PACKET_COUNTER_AVERAGE_INTERVAL));
+                /* if queue is too big only allow resending packets. */
+                const uint32_t npackets = num_packets_array(&conn->send_array);
+                double min_speed = 1000.0 * (((double)total_sent) / ((double)CONGESTION_QUEUE_ARRAY_SIZE *
+                                             PACKET_COUNTER_AVERAGE_INTERVAL));
 
-                    const double min_speed_request = 1000.0 * (((double)(total_sent + total_resent)) / (
-                                                         (double)CONGESTION_QUEUE_ARRAY_SIZE * PACKET_COUNTER_AVERAGE_INTERVAL));
+                const double min_speed_request = 1000.0 * (((double)(total_sent + total_resent)) / (
+                                                     (double)CONGESTION_QUEUE_ARRAY_SIZE * PACKET_COUNTER_AVERAGE_INTERVAL));
 
-                    if (min_speed < CRYPTO_PACKET_MIN_RATE) {
-                        min_speed = CRYPTO_PACKET_MIN_RATE;
-                    }
+                if (min_speed < CRYPTO_PACKET_MIN_RATE) {
+                    min_speed = CRYPTO_PACKET_MIN_RATE;
+                }
 
-                    const double send_array_ratio = (double)npackets / min_speed;
+                const double send_array_ratio = (double)npackets / min_speed;
 
-                    // TODO(irungentoo): Improve formula?
-                    if (send_array_ratio > SEND_QUEUE_RATIO && CRYPTO_MIN_QUEUE_LENGTH < npackets) {
-                        conn->packet_send_rate = min_speed * (1.0 / (send_array_ratio / SEND_QUEUE_RATIO));
-                    } else if (conn->last_congestion_event + CONGESTION_EVENT_TIMEOUT < temp_time) {
-                        conn->packet_send_rate = min_speed * 1.2;
-                    } else {
-                        conn->packet_send_rate = min_speed * 0.9;
-                    }
+                // TODO(irungentoo): Improve formula?
+                if (send_array_ratio > SEND_QUEUE_RATIO && CRYPTO_MIN_QUEUE_LENGTH < npackets) {
+                    hot->packet_send_rate = min_speed * (1.0 / (send_array_ratio / SEND_QUEUE_RATIO));
+                } else if (hot->last_congestion_event + CONGESTION_EVENT_TIMEOUT < temp_time) {
+                    hot->packet_send_rate = min_speed * 1.2;
+                } else {
+                    hot->packet_send_rate = min_speed * 0.9;
+                }
 
-                    conn->packet_send_rate_requested = min_speed_request * 1.2;
+                hot->packet_send_rate_requested = min_speed_request * 1.2;
 
-                    if (conn->packet_send_rate < CRYPTO_PACKET_MIN_RATE) {
-                        conn->packet_send_rate = CRYPTO_PACKET_MIN_RATE;
-                    }
+                if (hot->packet_send_rate < CRYPTO_PACKET_MIN_RATE) {
+                    hot->packet_send_rate = CRYPTO_PACKET_MIN_RATE;
+                }
 
-                    if (conn->packet_send_rate_requested < conn->packet_send_rate) {
-                        conn->packet_send_rate_requested = conn->packet_send_rate;
-                    }
+                if (hot->packet_send_rate_requested < hot->packet_send_rate) {
+                    hot->packet_send_rate_requested = hot->packet_send_rate;
                 }
             }
+        }
 
-            if (conn->last_packets_left_set == 0 || conn->last_packets_left_requested_set == 0) {
-                conn->last_packets_left_requested_set = temp_time;
-                conn->last_packets_left_set = temp_time;
-                conn->packets_left_requested = CRYPTO_MIN_QUEUE_LENGTH;
-                conn->packets_left = CRYPTO_MIN_QUEUE_LENGTH;
-            } else {
-                if (((uint64_t)((1000.0 / conn->packet_send_rate) + 0.5) + conn->last_packets_left_set) <= temp_time) {
-                    double n_packets = conn->packet_send_rate * (((double)(temp_time - conn->last_packets_left_set)) / 1000.0);
-                    n_packets += conn->last_packets_left_rem;
-
-                    const uint32_t num_packets = n_packets;
-                    const double rem = n_packets - (double)num_packets;
+        if (hot->last_packets_left_set == 0 || hot->last_packets_left_requested_set == 0) {
+            hot->last_packets_left_requested_set = temp_time;
+            hot->last_packets_left_set = temp_time;
+            hot->packets_left_requested = CRYPTO_MIN_QUEUE_LENGTH;
+            hot->packets_left = CRYPTO_MIN_QUEUE_LENGTH;
+        } else {
+            if (((uint64_t)((1000.0 / hot->packet_send_rate) + 0.5) + hot->last_packets_left_set) <= temp_time) {
+                double n_packets = hot->packet_send_rate * (((double)(temp_time - hot->last_packets_left_set)) / 1000.0);
+                n_packets += hot->last_packets_left_rem;
 
-                    if (conn->packets_left > num_packets * 4 + CRYPTO_MIN_QUEUE_LENGTH) {
-                        conn->packets_left = num_packets * 4 + CRYPTO_MIN_QUEUE_LENGTH;
-                    } else {
-                        conn->packets_left += num_packets;
-                    }
+                const uint32_t num_packets = n_packets;
+                const double rem = n_packets - (double)num_packets;
 
-                    conn->last_packets_left_set = temp_time;
-                    conn->last_packets_left_rem = rem;
+                if (hot->packets_left > num_packets * 4 + CRYPTO_MIN_QUEUE_LENGTH) {
+                    hot->packets_left = num_packets * 4 + CRYPTO_MIN_QUEUE_LENGTH;
+                } else {
+                    hot->packets_left += num_packets;
                 }
 
-                if (((uint64_t)((1000.0 / conn->packet_send_rate_requested) + 0.5) + conn->last_packets_left_requested_set) <=
-                        temp_time) {
-                    double n_packets = conn->packet_send_rate_requested * (((double)(temp_time - conn->last_packets_left_requested_set)) /
-                                       1000.0);
-                    n_packets += conn->last_packets_left_requested_rem;
+                hot->last_packets_left_set = temp_time;
+                hot->last_packets_left_rem = rem;
+            }
 
-                    const uint32_t num_packets = n_packets;
-                    const double rem = n_packets - (double)num_packets;
-                    conn->packets_left_requested = num_packets;
+            if (((uint64_t)((1000.0 / hot->packet_send_rate_requested) + 0.5) + hot->last_packets_left_requested_set) <=
+                    temp_time) {
+                double n_packets = hot->packet_send_rate_requested * (((double)(temp_time - hot->last_packets_left_requested_set)) /
+                                   1000.0);
+                n_packets += hot->last_packets_left_requested_rem;
 
-                    conn->last_packets_left_requested_set = temp_time;
-                    conn->last_packets_left_requested_rem = rem;
-                }
+                const uint32_t num_packets = n_packets;
+                const double rem = n_packets - (double)num_packets;
+                hot->packets_left_requested = num_packets;
 
-                if (conn->packets_left > conn->packets_left_requested) {
-                    conn->packets_left_requested = conn->packets_left;
-                }
+                hot->last_packets_left_requested_set = temp_time;
+                hot->last_packets_left_requested_rem = rem;
             }
 
-            const int ret = send_requested_packets(c, i, conn->packets_left_requested);
+            if (hot->packets_left > hot->packets_left_requested) {
+                hot->packets_left_requested = hot->packets_left;
+            }
+        }
 
-            if (ret != -1) {
-                conn->packets_left_requested -= ret;
-                conn->packets_resent += ret;
+        const int ret = send_requested_packets(c, crypt_connection_id, hot->packets_left_requested);
 
-                if ((unsigned int)ret < conn->packets_left) {
-                    conn->packets_left -= ret;
-                } else {
-                    conn->last_congestion_event = temp_time;
-                    conn->packets_left = 0;
-                }
-            }
+        if (ret != -1) {
+            hot->packets_left_requested -= ret;
+            hot->packets_resent += ret;
 
-            if (conn->packet_send_rate > CRYPTO_PACKET_MIN_RATE * 1.5) {
-                total_send_rate += conn->packet_send_rate;
+            if ((unsigned int)ret < hot->packets_left) {
+                hot->packets_left -= ret;
+            } else {
+                hot->last_congestion_event = temp_time;
+                hot->packets_left = 0;
             }
         }
     }
 
-    c->current_sleep_time = -1;
-    uint32_t sleep_time = peak_request_packet_interval;
+    uint64_t next = TIMER_WHEEL_NEVER;
+
+    if (hot->has_temp_packet) {
+        next = hot->temp_packet_sent_time + CRYPTO_SEND_PACKET_INTERVAL + 1;
+
+        if (handshaking && hot->temp_packet_num_sent >= MAX_NUM_SENDPACKET_TRIES) {
+            /* Give up on the next run. */
+            next = temp_time;
+        }
+    }
 
-    if (c->current_sleep_time > sleep_time) {
-        c->current_sleep_time = sleep_time;
+    if (hot->status == CRYPTO_CONN_NOT_CONFIRMED || hot->status == CRYPTO_CONN_ESTABLISHED) {
+        next = min_u64(next, hot->last_request_packet_sent + CRYPTO_SEND_PACKET_INTERVAL + 1);
     }
 
-    if (total_send_rate > CRYPTO_PACKET_MIN_RATE) {
-        sleep_time = 1000.0 / total_send_rate;
+    if (hot->status == CRYPTO_CONN_ESTABLISHED) {
+        next = min_u64(next, request_deadline);
+        next = min_u64(next, hot->packet_counter_set + PACKET_COUNTER_AVERAGE_INTERVAL + 1);
 
-        if (c->current_sleep_time > sleep_time) {
-            c->current_sleep_time = sleep_time + 1;
+        if (hot->packet_send_rate > CRYPTO_PACKET_MIN_RATE * 1.5) {
+            next = min_u64(next, temp_time + (uint64_t)(1000.0 / hot->packet_send_rate) + 1);
         }
     }
 
-    sleep_time = CRYPTO_SEND_PACKET_INTERVAL;
+    if (next == TIMER_WHEEL_NEVER) {
+        return;
+    }
 
-    if (c->current_sleep_time > sleep_time) {
-        c->current_sleep_time = sleep_time;
+    if (next <= temp_time) {
+        /* Something that was due could not be sent, try again a bit later. */
+        next = temp_time + PACKET_COUNTER_AVERAGE_INTERVAL;
     }
+
+    timer_wheel_set(c->timers, crypt_connection_id, next);
 }
 
 /**
@@ -2749,10 +3170,11 @@ uint32_t crypto_num_free_sendqueue_slots(const Net_Crypto *c, int crypt_connecti
         return 0;
     }
 
+    const Crypto_Connection_Hot *hot = &c->crypto_connections_hot[crypt_connection_id];
     const uint32_t max_packets = CRYPTO_PACKET_BUFFER_SIZE - num_packets_array(&conn->send_array);
 
-    if (conn->packets_left < max_packets) {
-        return conn->packets_left;
+    if (hot->packets_left < max_packets) {
+        return hot->packets_left;
     }
 
     return max_packets;
@@ -2788,12 +3210,14 @@ int64_t write_cryptpacket(const Net_Crypto *c, int crypt_connection_id, const ui
         return -1;
     }
 
-    if (conn->status != CRYPTO_CONN_ESTABLISHED) {
+    Crypto_Connection_Hot *hot = &c->crypto_connections_hot[crypt_connection_id];
+
+    if (hot->status != CRYPTO_CONN_ESTABLISHED) {
         LOGGER_WARNING(c->log, "attempted to send packet to non-established connection %d", crypt_connection_id);
         return -1;
     }
 
-    if (congestion_control && conn->packets_left == 0) {
+    if (congestion_control && hot->packets_left == 0) {
         LOGGER_ERROR(c->log, "congestion control: rejecting packet of length %d on crypt connection %d", length,
                      crypt_connection_id);
         return -1;
@@ -2806,9 +3230,9 @@ int64_t write_cryptpacket(const Net_Crypto *c, int crypt_connection_id, const ui
     }
 
     if (congestion_control) {
-        --conn->packets_left;
-        --conn->packets_left_requested;
-        ++conn->packets_sent;
+        --hot->packets_left;
+        --hot->packets_left_requested;
+        ++hot->packets_sent;
     }
 
     return ret;
@@ -2888,17 +3312,19 @@ int crypto_kill(Net_Crypto *c, int crypt_connection_id)
     int ret = -1;
 
     if (conn != nullptr) {
-        if (conn->status == CRYPTO_CONN_ESTABLISHED) {
+        const Crypto_Connection_Hot *hot = &c->crypto_connections_hot[crypt_connection_id];
+
+        if (hot->status == CRYPTO_CONN_ESTABLISHED) {
             send_kill_packet(c, crypt_connection_id);
         }
 
-        kill_tcp_connection_to(c->tcp_c, conn->connection_number_tcp);
+        kill_tcp_connection_to(c->tcp_c, hot->connection_number_tcp);
 
         bs_list_remove(&c->ip_port_list, (uint8_t *)&conn->ip_portv4, crypt_connection_id);
         bs_list_remove(&c->ip_port_list, (uint8_t *)&conn->ip_portv6, crypt_connection_id);
         clear_temp_packet(c, crypt_connection_id);
-        clear_buffer(c->mem, &conn->send_array);
-        clear_buffer(c->mem, &conn->recv_array);
+        clear_buffer(c->packet_pool, &conn->send_array);
+        clear_buffer(c->packet_pool, &conn->recv_array);
         ret = wipe_crypto_connection(c, crypt_connection_id);
     }
 
@@ -2908,9 +3334,9 @@ int crypto_kill(Net_Crypto *c, int crypt_connection_id)
 bool crypto_connection_status(const Net_Crypto *c, int crypt_connection_id, bool *direct_connected,
                               uint32_t *online_tcp_relays)
 {
-    const Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
+    const Crypto_Connection_Hot *hot = get_crypto_connection_hot(c, crypt_connection_id);
 
-    if (conn == nullptr) {
+    if (hot == nullptr) {
         return false;
     }
 
@@ -2919,14 +3345,14 @@ bool crypto_connection_status(const Net_Crypto *c, int crypt_connection_id, bool
 
         const uint64_t current_time = mono_time_get(c->mono_time);
 
-        if ((UDP_DIRECT_TIMEOUT + conn->direct_lastrecv_timev4) > current_time ||
-                (UDP_DIRECT_TIMEOUT + conn->direct_lastrecv_timev6) > current_time) {
+        if ((UDP_DIRECT_TIMEOUT + hot->direct_lastrecv_timev4) > current_time ||
+                (UDP_DIRECT_TIMEOUT + hot->direct_lastrecv_timev6) > current_time) {
             *direct_connected = true;
         }
     }
 
     if (online_tcp_relays != nullptr) {
-        *online_tcp_relays = tcp_connection_to_online_tcp_relays(c->tcp_c, conn->connection_number_tcp);
+        *online_tcp_relays = tcp_connection_to_online_tcp_relays(c->tcp_c, hot->connection_number_tcp);
     }
 
     return true;
@@ -2992,20 +3418,52 @@ Net_Crypto *new_net_crypto(const Logger *log, const Memory *mem, const Random *r
 
     temp->tcp_c = tcp_c;
 
+    Packet_Pool *const packet_pool = packet_pool_new(mem);
+
+    if (packet_pool == nullptr) {
+        kill_tcp_connections(tcp_c);
+        mem_delete(mem, temp);
+        return nullptr;
+    }
+
+    temp->packet_pool = packet_pool;
+
+    Timer_Wheel *const timers = timer_wheel_new(mem, current_time_monotonic(mono_time));
+
+    if (timers == nullptr) {
+        packet_pool_kill(packet_pool);
+        kill_tcp_connections(tcp_c);
+        mem_delete(mem, temp);
+        return nullptr;
+    }
+
+    temp->timers = timers;
+
+    Crypto_Queued_Packet *const udp_queue = (Crypto_Queued_Packet *)mem_valloc(mem, CRYPTO_UDP_QUEUE_SIZE, sizeof(Crypto_Queued_Packet));
+
+    if (udp_queue == nullptr) {
+        timer_wheel_kill(timers);
+        packet_pool_kill(packet_pool);
+        kill_tcp_connections(tcp_c);
+        mem_delete(mem, temp);
+        return nullptr;
+    }
+
+    temp->udp_queue = udp_queue;
+
     set_packet_tcp_connection_callback(temp->tcp_c, &tcp_data_callback, temp);
     set_oob_packet_tcp_connection_callback(temp->tcp_c, &tcp_oob_callback, temp);
 
     new_keys(temp);
     new_symmetric_key(rng, temp->secret_symmetric_key);
 
-    temp->current_sleep_time = CRYPTO_SEND_PACKET_INTERVAL;
-
     networking_registerhandler(net, NET_PACKET_COOKIE_REQUEST, &udp_handle_cookie_request, temp);
     networking_registerhandler(net, NET_PACKET_COOKIE_RESPONSE, &udp_handle_packet, temp);
     networking_registerhandler(net, NET_PACKET_CRYPTO_HS, &udp_handle_packet, temp);
     networking_registerhandler(net, NET_PACKET_CRYPTO_DATA, &udp_handle_packet, temp);
 
     bs_list_init(&temp->ip_port_list, mem, sizeof(IP_Port), 8, ipport_cmp_handler);
+    bs_list_init(&temp->public_key_list, mem, CRYPTO_PUBLIC_KEY_SIZE, 8, memcmp);
 
     temp->cookie_request_tokens = COOKIE_REQUEST_MAX_TOKENS;
     temp->cookie_request_last_time = mono_time_get_ms(mono_time);
@@ -3013,46 +3471,39 @@ Net_Crypto *new_net_crypto(const Logger *log, const Memory *mem, const Random *r
     return temp;
 }
 
-static void kill_timedout(Net_Crypto *_Nonnull c, void *_Nullable userdata)
+/** return the optimal interval in ms for running do_net_crypto. */
+uint32_t crypto_run_interval(const Net_Crypto *c)
 {
-    for (uint32_t i = 0; i < c->crypto_connections_length; ++i) {
-        const Crypto_Connection *conn = get_crypto_connection(c, i);
-        if (conn == nullptr) {
-            continue;
-        }
-
-        if (conn->status == CRYPTO_CONN_COOKIE_REQUESTING || conn->status == CRYPTO_CONN_HANDSHAKE_SENT
-                || conn->status == CRYPTO_CONN_NOT_CONFIRMED) {
-            if (conn->temp_packet_num_sent < MAX_NUM_SENDPACKET_TRIES) {
-                continue;
-            }
-
-            connection_kill(c, i, userdata);
-        }
-
-#if 0
+    if (c->udp_queue_length != 0) {
+        return 0;
+    }
 
-        if (conn->status == CRYPTO_CONN_ESTABLISHED) {
-            // TODO(irungentoo): add a timeout here?
-            /* do_timeout_here(); */
-        }
+    const uint64_t next = min_u64(timer_wheel_next_deadline(c->timers), tcp_connections_deadline(c->tcp_c));
+    const uint64_t now = current_time_monotonic(c->mono_time);
 
-#endif /* 0 */
+    if (next <= now) {
+        return 0;
     }
-}
 
-/** return the optimal interval in ms for running do_net_crypto. */
-uint32_t crypto_run_interval(const Net_Crypto *c)
-{
-    return c->current_sleep_time;
+    return (uint32_t)min_u64(next - now, UINT32_MAX);
 }
 
 /** Main loop. */
 void do_net_crypto(Net_Crypto *c, void *userdata)
 {
-    kill_timedout(c, userdata);
-    do_tcp(c, userdata);
-    send_crypto_packets(c);
+    flush_udp_data_packets(c, userdata);
+    do_tcp_connections(c->log, c->tcp_c, userdata);
+
+    const uint64_t temp_time = current_time_monotonic(c->mono_time);
+    timer_wheel_advance(c->timers, temp_time);
+
+    uint32_t crypt_connection_id;
+
+    while (timer_wheel_pop(c->timers, &crypt_connection_id)) {
+        do_crypto_connection(c, (int)crypt_connection_id, temp_time, userdata);
+    }
+
+    packet_pool_trim(c->packet_pool);
 }
 
 void kill_net_crypto(Net_Crypto *c)
@@ -3068,7 +3519,12 @@ void kill_net_crypto(Net_Crypto *c)
     }
 
     kill_tcp_connections(c->tcp_c);
+    packet_pool_kill(c->packet_pool);
+    timer_wheel_kill(c->timers);
+    crypto_memzero(c->udp_queue, CRYPTO_UDP_QUEUE_SIZE * sizeof(Crypto_Queued_Packet));
+    mem_delete(mem, c->udp_queue);
     bs_list_free(&c->ip_port_list);
+    bs_list_free(&c->public_key_list);
     networking_registerhandler(c->net, NET_PACKET_COOKIE_REQUEST, nullptr, nullptr);
     networking_registerhandler(c->net, NET_PACKET_COOKIE_RESPONSE, nullptr, nullptr);
     networking_registerhandler(c->net, NET_PACKET_CRYPTO_HS, nullptr, nullptr);
@@ -3077,6 +3533,23 @@ void kill_net_crypto(Net_Crypto *c)
     mem_delete(mem, c);
 }
 
+void nc_set_packet_pool_watermarks(Net_Crypto *c, uint32_t low_watermark, uint32_t high_watermark)
+{
+    Packet_Pool *pool = c->packet_pool;
+    pool->high_watermark = high_watermark;
+    pool->low_watermark = min_u32(low_watermark, high_watermark);
+    packet_pool_release(pool, high_watermark);
+}
+
+void nc_get_packet_pool_stats(const Net_Crypto *c, Net_Crypto_Packet_Pool_Stats *stats)
+{
+    const Packet_Pool *pool = c->packet_pool;
+    stats->hits = pool->hits;
+    stats->misses = pool->misses;
+    stats->num_free = pool->num_free;
+    stats->num_in_use = pool->num_in_use;
+}
+
 void nc_testonly_get_secrets(const Net_Crypto *c, int conn_id, uint8_t *shared_key, uint8_t *sent_nonce, uint8_t *recv_nonce)
 {
     const Crypto_Connection *conn = get_crypto_connection(c, conn_id);
@@ -107,6 +107,18 @@ typedef enum Packet_Id {
 /** Max size of data in packets */
 #define MAX_CRYPTO_DATA_SIZE (MAX_CRYPTO_PACKET_SIZE - CRYPTO_DATA_PACKET_MIN_SIZE)
 
+/**
+ * Default maximum number of free packet buffers kept for reuse by a Net_Crypto
+ * instance. Buffers released beyond this are returned to the allocator.
+ */
+#define CRYPTO_PACKET_POOL_HIGH_WATERMARK 1024
+
+/**
+ * Default number of free packet buffers kept once the number of buffered
+ * packets drops below it.
+ */
+#define CRYPTO_PACKET_POOL_LOW_WATERMARK CRYPTO_MIN_QUEUE_LENGTH
+
 /** Interval in ms between sending cookie request/handshake packets. */
 #define CRYPTO_SEND_PACKET_INTERVAL 1000
 
@@ -394,6 +406,26 @@ uint32_t crypto_run_interval(const Net_Crypto *_Nonnull c);
 void do_net_crypto(Net_Crypto *_Nonnull c, void *_Nullable userdata);
 void kill_net_crypto(Net_Crypto *_Nullable c);
 
+/** @brief Set the number of free packet buffers kept for reuse.
+ *
+ * @param low_watermark number of free buffers kept when the load drops below it.
+ * @param high_watermark maximum number of free buffers ever kept.
+ */
+void nc_set_packet_pool_watermarks(Net_Crypto *_Nonnull c, uint32_t low_watermark, uint32_t high_watermark);
+
+typedef struct Net_Crypto_Packet_Pool_Stats {
+    /** Packet buffers served from the pool. */
+    uint64_t hits;
+    /** Packet buffers that had to be allocated. */
+    uint64_t misses;
+    /** Free buffers currently held by the pool. */
+    uint32_t num_free;
+    /** Buffers currently holding queued packets. */
+    uint32_t num_in_use;
+} Net_Crypto_Packet_Pool_Stats;
+
+void nc_get_packet_pool_stats(const Net_Crypto *_Nonnull c, Net_Crypto_Packet_Pool_Stats *_Nonnull stats);
+
 /** Unit test support functions. Do not use outside tests. */
 void nc_testonly_get_secrets(const Net_Crypto *_Nonnull c, int conn_id, uint8_t *_Nonnull shared_key, uint8_t *_Nonnull sent_nonce, uint8_t *_Nonnull recv_nonce);
 
@@ -0,0 +1,149 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+#include "DHT.h"
+#include "TCP_client.h"
+#include "crypto_core.h"
+#include "logger.h"
+#include "mono_time.h"
+#include "net_crypto.h"
+#include "net_profile.h"
+#include "network.h"
+#include "os_memory.h"
+#include "os_network.h"
+#include "os_random.h"
+
+namespace {
+
+using PublicKey = std::array<uint8_t, CRYPTO_PUBLIC_KEY_SIZE>;
+
+const uint8_t *get_shared_key_sent(void *obj, const uint8_t *public_key)
+{
+    return dht_get_shared_key_sent(static_cast<DHT *>(obj), public_key);
+}
+
+const uint8_t *get_self_public_key(const void *obj)
+{
+    return dht_get_self_public_key(static_cast<const DHT *>(obj));
+}
+
+const uint8_t *get_self_secret_key(const void *obj)
+{
+    return dht_get_self_secret_key(static_cast<const DHT *>(obj));
+}
+
+const Net_Crypto_DHT_Funcs dht_funcs = {
+    get_shared_key_sent,
+    get_self_public_key,
+    get_self_secret_key,
+};
+
+/**
+ * @brief Cost of one `do_net_crypto` tick with many idle connections.
+ *
+ * The argument is the number of connections. None of them has a peer, and the
+ * clock never moves, so no packet is ever due: the tick only scans the
+ * connection state.
+ */
+class NetCryptoBenchFixture : public benchmark::Fixture {
+public:
+    void SetUp(::benchmark::State &state) override
+    {
+        mem = os_memory();
+        rng = os_random();
+        ns = os_network();
+        if (rng == nullptr || ns == nullptr) {
+            setup_error = "os_random or os_network failed";
+            return;
+        }
+
+        log = logger_new(mem);
+        mono_time = mono_time_new(mem, [](void *) -> uint64_t { return 1; }, nullptr);
+        net = new_networking_no_udp(log, mem, ns);
+        tcp_np = netprof_new(log, mem);
+        if (log == nullptr || mono_time == nullptr || net == nullptr || tcp_np == nullptr) {
+            setup_error = "failed to create networking";
+            return;
+        }
+
+        dht = new_dht(log, mem, rng, ns, mono_time, net, true, false);
+        if (dht == nullptr) {
+            setup_error = "new_dht failed";
+            return;
+        }
+
+        const TCP_Proxy_Info proxy_info = {{0}, TCP_PROXY_NONE};
+        net_crypto = new_net_crypto(log, mem, rng, ns, mono_time, net, dht, &dht_funcs, &proxy_info, tcp_np);
+        if (net_crypto == nullptr) {
+            setup_error = "new_net_crypto failed";
+            return;
+        }
+
+        for (int64_t i = 0; i < state.range(0); ++i) {
+            PublicKey real_pk;
+            PublicKey dht_pk;
+            random_bytes(rng, real_pk.data(), real_pk.size());
+            random_bytes(rng, dht_pk.data(), dht_pk.size());
+
+            if (new_crypto_connection(net_crypto, real_pk.data(), dht_pk.data()) == -1) {
+                setup_error = "new_crypto_connection failed";
+                return;
+            }
+        }
+    }
+
+    void TearDown(const ::benchmark::State &state) override
+    {
+        kill_net_crypto(net_crypto);
+        kill_dht(dht);
+        netprof_kill(mem, tcp_np);
+        kill_networking(net);
+        mono_time_free(mem, mono_time);
+        logger_kill(log);
+        net_crypto = nullptr;
+        dht = nullptr;
+        tcp_np = nullptr;
+        net = nullptr;
+        mono_time = nullptr;
+        log = nullptr;
+    }
+
+protected:
+    const Memory *mem = nullptr;
+    const Random *rng = nullptr;
+    const Network *ns = nullptr;
+    Logger *log = nullptr;
+    Mono_Time *mono_time = nullptr;
+    Networking_Core *net = nullptr;
+    Net_Profile *tcp_np = nullptr;
+    DHT *dht = nullptr;
+    Net_Crypto *net_crypto = nullptr;
+    std::string setup_error;
+};
+
+BENCHMARK_DEFINE_F(NetCryptoBenchFixture, IdleTick)(benchmark::State &state)
+{
+    if (!setup_error.empty()) {
+        state.SkipWithError(setup_error.c_str());
+        return;
+    }
+
+    for (auto _ : state) {
+        do_net_crypto(net_crypto, nullptr);
+    }
+
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK_REGISTER_F(NetCryptoBenchFixture, IdleTick)->Arg(1000)->Arg(10000);
+
+}  // namespace
+
+BENCHMARK_MAIN();
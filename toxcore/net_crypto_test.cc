@@ -261,6 +261,61 @@ TEST_F(NetCryptoTest, EndToEndDataExchange)
     EXPECT_TRUE(data_received) << "Bob did not receive the correct data";
 }
 
+TEST_F(NetCryptoTest, PacketPoolRecyclesBuffers)
+{
+    NetCryptoNode alice(env, 33445);
+    NetCryptoNode bob(env, 33446);
+
+    int alice_conn_id = alice.connect_to(bob);
+    ASSERT_NE(alice_conn_id, -1);
+
+    auto start = env.clock().current_time_ms();
+    int bob_conn_id = -1;
+    bool connected = false;
+
+    while ((env.clock().current_time_ms() - start) < 5000) {
+        alice.poll();
+        bob.poll();
+        env.advance_time(10);
+
+        bob_conn_id = bob.get_connection_id_by_pk(alice.real_public_key());
+        if (alice.is_connected(alice_conn_id) && bob_conn_id != -1
+            && bob.is_connected(bob_conn_id)) {
+            connected = true;
+            break;
+        }
+    }
+    ASSERT_TRUE(connected);
+
+    for (std::uint8_t i = 0; i < 4; ++i) {
+        std::vector<std::uint8_t> message = {160, 'P', 'o', 'o', 'l', i};
+        ASSERT_TRUE(alice.send_data(alice_conn_id, message));
+
+        start = env.clock().current_time_ms();
+        while ((env.clock().current_time_ms() - start) < 1000
+            && bob.get_last_received_data(bob_conn_id) != message) {
+            alice.poll();
+            bob.poll();
+            env.advance_time(10);
+        }
+        ASSERT_EQ(bob.get_last_received_data(bob_conn_id), message);
+    }
+
+    // Bob's receive buffers are handed back to the pool as soon as the data is
+    // delivered, so only the first packet needed a fresh allocation.
+    Net_Crypto_Packet_Pool_Stats stats;
+    nc_get_packet_pool_stats(bob.get_net_crypto(), &stats);
+    EXPECT_EQ(stats.misses, 1);
+    EXPECT_GE(stats.hits, 3);
+    EXPECT_EQ(stats.num_in_use, 0);
+    EXPECT_EQ(stats.num_free, 1);
+
+    // Without a pool, every buffer is freed immediately.
+    nc_set_packet_pool_watermarks(bob.get_net_crypto(), 0, 0);
+    nc_get_packet_pool_stats(bob.get_net_crypto(), &stats);
+    EXPECT_EQ(stats.num_free, 0);
+}
+
 TEST_F(NetCryptoTest, ConnectionTimeout)
 {
     NetCryptoNode alice(env, 33445);
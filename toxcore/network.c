@@ -11,6 +11,7 @@
 
 #include <assert.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -31,6 +32,7 @@ static_assert(sizeof(IP4) == SIZE_IP4, "IP4 size must be 4");
 // TODO(iphydf): Stop relying on this. We memcpy this struct (and IP4 above)
 // into packets but really should be serialising it properly.
 static_assert(sizeof(IP6) == SIZE_IP6, "IP6 size must be 16");
+static_assert(NET_BATCH_SIZE <= NET_MAX_BATCH_SIZE, "NET_BATCH_SIZE must fit in one batch call");
 
 IP4 get_ip4_broadcast(void)
 {
@@ -71,6 +73,23 @@ int net_send(const Network *ns, const Logger *log,
     return res;
 }
 
+int net_sendv(const Network *ns, const Logger *log,
+              Socket sock, const Net_Iovec *iov, size_t count, const IP_Port *ip_port, Net_Profile *net_profile)
+{
+    if (count == 0) {
+        return 0;
+    }
+
+    const int res = ns_sendv(ns, sock, iov, count);
+
+    if (res > 0) {
+        netprof_record_packet(net_profile, iov[0].buf[0], res, PACKET_DIRECTION_SEND);
+    }
+
+    net_log_data(log, "T=>", iov[0].buf, iov[0].length, ip_port, res);
+    return res;
+}
+
 int net_recv(const Network *ns, const Logger *log,
              Socket sock, uint8_t *buf, size_t len, const IP_Port *ip_port)
 {
@@ -89,6 +108,11 @@ Socket net_accept(const Network *ns, Socket sock)
     return ns_accept(ns, sock);
 }
 
+bool net_getpeername(const Network *ns, Socket sock, IP_Port *ip_port)
+{
+    return ns_getpeername(ns, sock, ip_port) == 0;
+}
+
 /** Close the socket. */
 void kill_sock(const Network *ns, Socket sock)
 {
@@ -110,6 +134,11 @@ bool set_socket_reuseaddr(const Network *ns, Socket sock)
     return net_set_socket_reuseaddr(ns, sock);
 }
 
+bool set_socket_reuseport(const Network *ns, Socket sock)
+{
+    return net_set_socket_reuseport(ns, sock);
+}
+
 bool set_socket_dualstack(const Network *ns, Socket sock)
 {
     return net_set_socket_dualstack(ns, sock);
@@ -118,8 +147,21 @@ bool set_socket_dualstack(const Network *ns, Socket sock)
 typedef struct Packet_Handler {
     packet_handler_cb *_Nullable function;
     void *_Nullable object;
+    bool concurrent;
+    net_gate_cb *_Nullable gate;
+    void *_Nullable gate_object;
 } Packet_Handler;
 
+/** Buffers for batched UDP I/O, see `networking_set_batching`. */
+typedef struct Net_Batch {
+    uint8_t recv_data[NET_BATCH_SIZE][MAX_UDP_PACKET_SIZE];
+    Net_Recv_Msg recv_msgs[NET_BATCH_SIZE];
+
+    uint8_t send_data[NET_BATCH_SIZE][MAX_UDP_PACKET_SIZE];
+    Net_Send_Msg send_msgs[NET_BATCH_SIZE];
+    uint32_t send_count;
+} Net_Batch;
+
 struct Networking_Core {
     const Logger *_Nonnull log;
     const Memory *_Nonnull mem;
@@ -132,6 +174,16 @@ struct Networking_Core {
     Socket sock;
 
     Net_Profile *_Nullable udp_net_profile;
+
+    /* Non-null if batched I/O is enabled. */
+    Net_Batch *_Nullable batch;
+
+    /* Guards the send batch and the send counters of the net profile. Only set
+     * once a dispatcher may run handlers on other threads. */
+    pthread_mutex_t *_Nullable send_lock;
+
+    net_dispatch_cb *_Nullable dispatcher;
+    void *_Nullable dispatcher_object;
 };
 
 Family net_family(const Networking_Core *net)
@@ -144,37 +196,50 @@ uint16_t net_port(const Networking_Core *net)
     return net->port;
 }
 
+Socket net_sock(const Networking_Core *net)
+{
+    if (net_family_is_unspec(net->family)) {
+        return net_invalid_socket();
+    }
+
+    return net->sock;
+}
+
 /* Basic network functions:
  */
 
-int net_send_packet(const Networking_Core *net, const IP_Port *ip_port, Net_Packet packet)
+/** @brief Check that a packet can be sent to ip_port and convert the address for our socket.
+ *
+ * @retval true if the packet can be sent to `ipp_copy`.
+ */
+static bool net_prepare_send(const Networking_Core *_Nonnull net, const IP_Port *_Nonnull ip_port, IP_Port *_Nonnull ipp_copy, uint16_t length)
 {
-    IP_Port ipp_copy = *ip_port;
+    *ipp_copy = *ip_port;
 
     if (net_family_is_unspec(ip_port->ip.family)) {
         // TODO(iphydf): Make this an error. Currently this fails sometimes when
         // called from DHT.c:do_ping_and_sendnode_requests.
-        return -1;
+        return false;
     }
 
     if (net_family_is_unspec(net->family)) { /* Socket not initialized */
         // TODO(iphydf): Make this an error. Currently, the onion client calls
         // this via DHT nodes requests.
-        LOGGER_WARNING(net->log, "attempted to send message of length %u on uninitialised socket", packet.length);
-        return -1;
+        LOGGER_WARNING(net->log, "attempted to send message of length %u on uninitialised socket", length);
+        return false;
     }
 
     /* socket TOX_AF_INET, but target IP NOT: can't send */
-    if (net_family_is_ipv4(net->family) && !net_family_is_ipv4(ipp_copy.ip.family)) {
+    if (net_family_is_ipv4(net->family) && !net_family_is_ipv4(ipp_copy->ip.family)) {
         // TODO(iphydf): Make this an error. Occasionally we try to send to an
         // all-zero ip_port.
         Ip_Ntoa ip_str;
         LOGGER_WARNING(net->log, "attempted to send message with network family %d (probably IPv6) on IPv4 socket (%s)",
-                       ipp_copy.ip.family.value, net_ip_ntoa(&ipp_copy.ip, &ip_str));
-        return -1;
+                       ipp_copy->ip.family.value, net_ip_ntoa(&ipp_copy->ip, &ip_str));
+        return false;
     }
 
-    if (net_family_is_ipv4(ipp_copy.ip.family) && net_family_is_ipv6(net->family)) {
+    if (net_family_is_ipv4(ipp_copy->ip.family) && net_family_is_ipv6(net->family)) {
         /* must convert to IPV4-in-IPV6 address */
         IP6 ip6;
 
@@ -183,10 +248,130 @@ int net_send_packet(const Networking_Core *net, const IP_Port *ip_port, Net_Pack
         ip6.uint32[0] = 0;
         ip6.uint32[1] = 0;
         ip6.uint32[2] = net_htonl(0xFFFF);
-        ip6.uint32[3] = ipp_copy.ip.ip.v4.uint32;
+        ip6.uint32[3] = ipp_copy->ip.ip.v4.uint32;
+
+        ipp_copy->ip.family = net_family_ipv6();
+        ipp_copy->ip.ip.v6 = ip6;
+    }
 
-        ipp_copy.ip.family = net_family_ipv6();
-        ipp_copy.ip.ip.v6 = ip6;
+    return true;
+}
+
+static pthread_mutex_t *_Nullable net_send_lock_new(const Memory *_Nonnull mem)
+{
+    pthread_mutex_t *const lock = (pthread_mutex_t *)mem_alloc(mem, sizeof(pthread_mutex_t));
+
+    if (lock == nullptr) {
+        return nullptr;
+    }
+
+    if (pthread_mutex_init(lock, nullptr) != 0) {
+        mem_delete(mem, lock);
+        return nullptr;
+    }
+
+    return lock;
+}
+
+static void net_send_lock_kill(const Memory *_Nonnull mem, pthread_mutex_t *_Nullable lock)
+{
+    if (lock == nullptr) {
+        return;
+    }
+
+    pthread_mutex_destroy(lock);
+    mem_delete(mem, lock);
+}
+
+static void net_lock_send(const Networking_Core *_Nonnull net)
+{
+    if (net->send_lock != nullptr) {
+        pthread_mutex_lock(net->send_lock);
+    }
+}
+
+static void net_unlock_send(const Networking_Core *_Nonnull net)
+{
+    if (net->send_lock != nullptr) {
+        pthread_mutex_unlock(net->send_lock);
+    }
+}
+
+/** @brief Send all queued packets. The caller must hold the send lock. */
+static void networking_flush_locked(const Networking_Core *_Nonnull net, Net_Batch *_Nonnull batch)
+{
+    uint32_t sent = 0;
+
+    while (sent < batch->send_count) {
+        const int res = ns_sendto_batch(net->ns, net->sock, &batch->send_msgs[sent], batch->send_count - sent);
+
+        if (res <= 0) {
+            // Drop the packet that could not be sent and carry on with the rest,
+            // the same as a failed sendto in the unbatched path.
+            const Net_Send_Msg *msg = &batch->send_msgs[sent];
+            net_log_data(net->log, "O=>", msg->buf, (uint16_t)msg->length, &msg->addr, -1);
+            ++sent;
+            continue;
+        }
+
+        sent += (uint32_t)res;
+    }
+
+    batch->send_count = 0;
+}
+
+void networking_flush(const Networking_Core *net)
+{
+    Net_Batch *const batch = net->batch;
+
+    if (batch == nullptr) {
+        return;
+    }
+
+    net_lock_send(net);
+    networking_flush_locked(net, batch);
+    net_unlock_send(net);
+}
+
+/** @brief Queue a packet for the next `networking_flush`.
+ *
+ * The caller must hold the send lock.
+ *
+ * @return the packet length.
+ */
+static int net_queue_packet(const Networking_Core *_Nonnull net, Net_Batch *_Nonnull batch, const IP_Port *_Nonnull ip_port, const IP_Port *_Nonnull ipp_copy, Net_Packet packet)
+{
+    if (batch->send_count == NET_BATCH_SIZE) {
+        networking_flush_locked(net, batch);
+    }
+
+    const uint32_t idx = batch->send_count;
+    memcpy(batch->send_data[idx], packet.data, packet.length);
+    batch->send_msgs[idx].buf = batch->send_data[idx];
+    batch->send_msgs[idx].length = packet.length;
+    batch->send_msgs[idx].addr = *ipp_copy;
+    ++batch->send_count;
+
+    net_log_data(net->log, "O=>", packet.data, packet.length, ip_port, packet.length);
+    netprof_record_packet(net->udp_net_profile, packet.data[0], packet.length, PACKET_DIRECTION_SEND);
+
+    return packet.length;
+}
+
+int net_send_packet(const Networking_Core *net, const IP_Port *ip_port, Net_Packet packet)
+{
+    IP_Port ipp_copy;
+
+    if (!net_prepare_send(net, ip_port, &ipp_copy, packet.length)) {
+        return -1;
+    }
+
+    if (net->batch != nullptr && packet.length > 0 && packet.length <= MAX_UDP_PACKET_SIZE) {
+        // Only queued: a send error in networking_flush drops it silently.
+        net_lock_send(net);
+        const int res = net_queue_packet(net, net->batch, ip_port, &ipp_copy, packet);
+        net_unlock_send(net);
+        return res;
     }
 
     const long res = ns_sendto(net->ns, net->sock, packet.data, packet.length, &ipp_copy);
@@ -195,7 +380,9 @@ int net_send_packet(const Networking_Core *net, const IP_Port *ip_port, Net_Pack
     assert(res <= INT_MAX);
 
     if (res == packet.length && packet.data != nullptr) {
+        net_lock_send(net);
         netprof_record_packet(net->udp_net_profile, packet.data[0], packet.length, PACKET_DIRECTION_SEND);
+        net_unlock_send(net);
     }
 
     return (int)res;
@@ -212,6 +399,25 @@ int sendpacket(const Networking_Core *net, const IP_Port *ip_port, const uint8_t
     return net_send_packet(net, ip_port, packet);
 }
 
+/** Convert IPv4-in-IPv6 sender addresses back to plain IPv4. */
+static void unmap_ipv4_in_ipv6(IP_Port *_Nonnull ip_port)
+{
+    if (net_family_is_ipv6(ip_port->ip.family) && ipv6_ipv4_in_v6(&ip_port->ip.ip.v6)) {
+        ip_port->ip.family = net_family_ipv4();
+        ip_port->ip.ip.v4.uint32 = ip_port->ip.ip.v6.uint32[3];
+    }
+}
+
+static void log_recv_error(const Logger *_Nonnull log)
+{
+    const int error = net_error();
+
+    if (!net_should_ignore_recv_error(error)) {
+        Net_Strerror error_str;
+        LOGGER_ERROR(log, "unexpected error reading from socket: %u, %s", (unsigned int)error, net_strerror(error, &error_str));
+    }
+}
+
 /** @brief Function to receive data
  * ip and port of sender is put into ip_port.
  * Packet data is put into data.
@@ -225,22 +431,13 @@ static int receivepacket(const Network *_Nonnull ns, const Logger *_Nonnull log,
     const int fail_or_len = ns_recvfrom(ns, sock, data, MAX_UDP_PACKET_SIZE, ip_port);
 
     if (fail_or_len < 0) {
-        const int error = net_error();
-
-        if (!net_should_ignore_recv_error(error)) {
-            Net_Strerror error_str;
-            LOGGER_ERROR(log, "unexpected error reading from socket: %u, %s", (unsigned int)error, net_strerror(error, &error_str));
-        }
-
+        log_recv_error(log);
         return -1; /* Nothing received. */
     }
 
     *length = (uint32_t)fail_or_len;
 
-    if (net_family_is_ipv6(ip_port->ip.family) && ipv6_ipv4_in_v6(&ip_port->ip.ip.v6)) {
-        ip_port->ip.family = net_family_ipv4();
-        ip_port->ip.ip.v4.uint32 = ip_port->ip.ip.v6.uint32[3];
-    }
+    unmap_ipv4_in_ipv6(ip_port);
 
     net_log_data(log, "=>O", data, MAX_UDP_PACKET_SIZE, ip_port, *length);
 
@@ -251,6 +448,125 @@ void networking_registerhandler(Networking_Core *net, uint8_t byte, packet_handl
 {
     net->packethandlers[byte].function = cb;
     net->packethandlers[byte].object = object;
+    net->packethandlers[byte].concurrent = false;
+}
+
+void networking_registerhandler_concurrent(Networking_Core *net, uint8_t byte, packet_handler_cb *cb, void *object)
+{
+    networking_registerhandler(net, byte, cb, object);
+    net->packethandlers[byte].concurrent = cb != nullptr;
+}
+
+bool networking_set_dispatcher(Networking_Core *net, net_dispatch_cb *cb, void *object)
+{
+    // The lock stays once allocated: handlers on other threads may still be
+    // sending after the dispatcher is reset.
+    if (cb != nullptr && net->send_lock == nullptr) {
+        net->send_lock = net_send_lock_new(net->mem);
+
+        if (net->send_lock == nullptr) {
+            return false;
+        }
+    }
+
+    net->dispatcher = cb;
+    net->dispatcher_object = object;
+    return true;
+}
+
+void networking_set_gate(Networking_Core *net, uint8_t byte, net_gate_cb *cb, void *object)
+{
+    net->packethandlers[byte].gate = cb;
+    net->packethandlers[byte].gate_object = object;
+}
+
+/** @brief Run the handler of a packet, through the dispatcher if there is one. */
+static void networking_run_handler(const Networking_Core *_Nonnull net, const Packet_Handler *_Nonnull handler,
+                                   const IP_Port *_Nonnull ip_port, const uint8_t *_Nonnull data, uint16_t length,
+                                   void *_Nullable userdata)
+{
+    if (net->dispatcher != nullptr) {
+        net->dispatcher(net->dispatcher_object, handler->function, handler->object, ip_port, data, length,
+                        handler->concurrent, userdata);
+        return;
+    }
+
+    handler->function(handler->object, ip_port, data, length, userdata);
+}
+
+static void networking_dispatch(const Networking_Core *_Nonnull net, const IP_Port *_Nonnull ip_port, const uint8_t *_Nonnull data, uint32_t length,
+                                void *_Nullable userdata)
+{
+    if (length < 1) {
+        return;
+    }
+
+    netprof_record_packet(net->udp_net_profile, data[0], length, PACKET_DIRECTION_RECV);
+
+    const Packet_Handler *const handler = &net->packethandlers[data[0]];
+
+    if (handler->function == nullptr) {
+        // TODO(https://github.com/TokTok/c-toxcore/issues/1115): Make this
+        // a warning or error again.
+        LOGGER_DEBUG(net->log, "[%02u] -- Packet has no handler", data[0]);
+        return;
+    }
+
+    if (handler->gate != nullptr && !handler->gate(handler->gate_object, ip_port, data, length)) {
+        return;
+    }
+
+    networking_run_handler(net, handler, ip_port, data, length, userdata);
+}
+
+void networking_handle_packet(const Networking_Core *net, const IP_Port *ip_port, const uint8_t *data, uint16_t length,
+                              void *userdata)
+{
+    if (length < 1) {
+        return;
+    }
+
+    const Packet_Handler *const handler = &net->packethandlers[data[0]];
+
+    if (handler->function == nullptr) {
+        return;
+    }
+
+    networking_run_handler(net, handler, ip_port, data, length, userdata);
+}
+
+static void networking_poll_batched(const Networking_Core *_Nonnull net, Net_Batch *_Nonnull batch, void *_Nullable userdata)
+{
+    while (true) {
+        for (uint32_t i = 0; i < NET_BATCH_SIZE; ++i) {
+            Net_Recv_Msg *msg = &batch->recv_msgs[i];
+            memset(&msg->addr, 0, sizeof(msg->addr));
+            msg->buf = batch->recv_data[i];
+            msg->size = MAX_UDP_PACKET_SIZE;
+            msg->length = 0;
+        }
+
+        const int count = ns_recvfrom_batch(net->ns, net->sock, batch->recv_msgs, NET_BATCH_SIZE);
+
+        if (count <= 0) {
+            log_recv_error(net->log);
+            break;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            Net_Recv_Msg *msg = &batch->recv_msgs[i];
+            unmap_ipv4_in_ipv6(&msg->addr);
+            net_log_data(net->log, "=>O", msg->buf, MAX_UDP_PACKET_SIZE, &msg->addr, msg->length);
+            networking_dispatch(net, &msg->addr, msg->buf, (uint32_t)msg->length, userdata);
+        }
+
+        // Send the replies to this batch before reading the next one.
+        networking_flush(net);
+
+        if (count < NET_BATCH_SIZE) {
+            break;
+        }
+    }
 }
 
 void networking_poll(const Networking_Core *net, void *userdata)
@@ -260,28 +576,35 @@ void networking_poll(const Networking_Core *net, void *userdata)
         return;
     }
 
+    if (net->batch != nullptr) {
+        networking_poll_batched(net, net->batch, userdata);
+        return;
+    }
+
     IP_Port ip_port;
     uint8_t data[MAX_UDP_PACKET_SIZE] = {0};
     uint32_t length;
 
     while (receivepacket(net->ns, net->log, net->sock, &ip_port, data, &length) != -1) {
-        if (length < 1) {
-            continue;
-        }
-
-        netprof_record_packet(net->udp_net_profile, data[0], length, PACKET_DIRECTION_RECV);
-
-        const Packet_Handler *const handler = &net->packethandlers[data[0]];
+        networking_dispatch(net, &ip_port, data, length, userdata);
+    }
+}
 
-        if (handler->function == nullptr) {
-            // TODO(https://github.com/TokTok/c-toxcore/issues/1115): Make this
-            // a warning or error again.
-            LOGGER_DEBUG(net->log, "[%02u] -- Packet has no handler", data[0]);
-            continue;
-        }
+bool networking_set_batching(Networking_Core *net, bool enabled)
+{
+    if (!enabled) {
+        networking_flush(net);
+        mem_delete(net->mem, net->batch);
+        net->batch = nullptr;
+        return true;
+    }
 
-        handler->function(handler->object, &ip_port, data, length, userdata);
+    if (net->batch != nullptr) {
+        return true;
     }
+
+    net->batch = (Net_Batch *)mem_alloc(net->mem, sizeof(Net_Batch));
+    return net->batch != nullptr;
 }
 
 /** @brief Initialize networking.
@@ -407,7 +730,7 @@ Networking_Core *new_networking_ex(
         addr.port = 0;
         portptr = &addr.port;
     } else {
-        mem_delete(mem, temp);
+        kill_networking(temp);
         return nullptr;
     }
 
@@ -522,9 +845,12 @@ void kill_networking(Networking_Core *net)
 
     if (!net_family_is_unspec(net->family)) {
         /* Socket is initialized, so we close it. */
+        networking_flush(net);
         kill_sock(net->ns, net->sock);
     }
 
+    mem_delete(net->mem, net->batch);
+    net_send_lock_kill(net->mem, net->send_lock);
     netprof_kill(net->mem, net->udp_net_profile);
     mem_delete(net->mem, net);
 }
@@ -108,6 +108,22 @@ bool sock_valid(Socket sock);
  */
 int net_send(const Network *_Nonnull ns, const Logger *_Nonnull log, Socket sock, const uint8_t *_Nonnull buf, size_t len, const IP_Port *_Nonnull ip_port,
              Net_Profile *_Nullable net_profile);
+/**
+ * Sends several buffers in one call, like writev(sockfd, iov, count).
+ *
+ * The first byte of the first buffer is recorded in the network profile as
+ * the packet id, like in `net_send`.
+ *
+ * @param ns System network object.
+ * @param log Logger object.
+ * @param sock Socket to send data with.
+ * @param iov Buffers to send, in order.
+ * @param count Number of buffers, at most @ref NET_MAX_SEND_VECS.
+ * @param ip_port IP and port to send data to.
+ * @param net_profile Network profile to record the packet.
+ */
+int net_sendv(const Network *_Nonnull ns, const Logger *_Nonnull log, Socket sock, const Net_Iovec *_Nonnull iov, size_t count,
+              const IP_Port *_Nonnull ip_port, Net_Profile *_Nullable net_profile);
 /**
  * Calls recv(sockfd, buf, len, MSG_NOSIGNAL).
  *
@@ -128,6 +144,13 @@ int net_listen(const Network *_Nonnull ns, Socket sock, int backlog);
  */
 Socket net_accept(const Network *_Nonnull ns, Socket sock);
 
+/**
+ * @brief Get the address of the other end of a connected stream socket.
+ *
+ * @retval false if the address is not known.
+ */
+bool net_getpeername(const Network *_Nonnull ns, Socket sock, IP_Port *_Nonnull ip_port);
+
 /**
  * return the size of data in the tcp recv buffer.
  * return 0 on failure.
@@ -258,6 +281,14 @@ typedef struct Networking_Core Networking_Core;
 Family net_family(const Networking_Core *_Nonnull net);
 uint16_t net_port(const Networking_Core *_Nonnull net);
 
+/**
+ * @brief The UDP socket, for registering with an event loop.
+ *
+ * Becomes readable when `networking_poll` has packets to handle. Invalid if
+ * the instance was created without UDP.
+ */
+Socket net_sock(const Networking_Core *_Nonnull net);
+
 /** Close the socket. */
 void kill_sock(const Network *_Nonnull ns, Socket sock);
 
@@ -282,6 +313,14 @@ bool set_socket_nosigpipe(const Network *_Nonnull ns, Socket sock);
  */
 bool set_socket_reuseaddr(const Network *_Nonnull ns, Socket sock);
 
+/**
+ * Enable SO_REUSEPORT on socket, so several sockets can listen on the same
+ * port and the kernel spreads incoming connections across them.
+ *
+ * @return true on success, false on failure or if the platform lacks it.
+ */
+bool set_socket_reuseport(const Network *_Nonnull ns, Socket sock);
+
 /**
  * Set socket to dual (IPv4 + IPv6 socket)
  *
@@ -303,6 +342,11 @@ typedef struct Net_Packet {
 
 /**
  * Function to send a network packet to a given IP/port.
+ *
+ * @return the number of bytes sent, or -1 on error. In batched mode (see
+ *   `networking_set_batching`) the packet is only queued, so the length means
+ *   "queued", not "sent": if the system call in `networking_flush` later fails,
+ *   the packet is dropped and the caller is not told.
  */
 int net_send_packet(const Networking_Core *_Nonnull net, const IP_Port *_Nonnull ip_port, Net_Packet packet);
 
@@ -313,10 +357,90 @@ int net_send_packet(const Networking_Core *_Nonnull net, const IP_Port *_Nonnull
  */
 int sendpacket(const Networking_Core *_Nonnull net, const IP_Port *_Nonnull ip_port, const uint8_t *_Nonnull data, uint16_t length);
 
+/** @brief Send all packets queued by `net_send_packet` in batched mode.
+ *
+ * Does nothing if batching is disabled.
+ */
+void networking_flush(const Networking_Core *_Nonnull net);
+
 /** Function to call when packet beginning with byte is received. */
 void networking_registerhandler(Networking_Core *_Nonnull net, uint8_t byte, packet_handler_cb *_Nullable cb, void *_Nullable object);
+
+/** @brief Like `networking_registerhandler`, but marks the handler as thread-safe.
+ *
+ * A concurrent handler may be run by a dispatcher (see `networking_set_dispatcher`)
+ * on any thread, at the same time as other concurrent handlers. It must only
+ * read state that is otherwise modified by serial handlers and the owner's main
+ * loop, and must protect anything it writes with its own lock.
+ */
+void networking_registerhandler_concurrent(Networking_Core *_Nonnull net, uint8_t byte, packet_handler_cb *_Nullable cb, void *_Nullable object);
+
+/** @brief Called by `networking_poll` for each received packet that has a handler.
+ *
+ * `concurrent` is true if the handler was registered with
+ * `networking_registerhandler_concurrent`. The packet data is only valid for
+ * the duration of the call, so a dispatcher that defers the handler must copy it.
+ */
+typedef void net_dispatch_cb(void *_Nullable object, packet_handler_cb *_Nonnull handler, void *_Nullable handler_object,
+                             const IP_Port *_Nonnull source, const uint8_t *_Nonnull packet, uint16_t length, bool concurrent,
+                             void *_Nullable userdata);
+
+/** @brief Hand received packets to `cb` instead of calling their handlers directly.
+ *
+ * Pass nullptr to go back to calling handlers from `networking_poll`.
+ * Once a dispatcher has been set, `net_send_packet` and `networking_flush` may
+ * be called from any thread, so handlers can reply from wherever the dispatcher
+ * runs them. Without one, sending takes no lock.
+ *
+ * @retval false if the send lock could not be allocated, in which case the
+ *   dispatcher is unchanged.
+ */
+bool networking_set_dispatcher(Networking_Core *_Nonnull net, net_dispatch_cb *_Nullable cb, void *_Nullable object);
+
+/** @brief Called by `networking_poll` for each received packet of a type that has a gate.
+ *
+ * Runs on the receiving thread, before the packet goes to its handler or the
+ * dispatcher. The packet data is only valid for the duration of the call.
+ *
+ * @retval true to handle the packet now.
+ * @retval false if the gate dropped the packet or kept a copy to hand over
+ *   later with `networking_handle_packet`.
+ */
+typedef bool net_gate_cb(void *_Nullable object, const IP_Port *_Nonnull source, const uint8_t *_Nonnull packet, uint16_t length);
+
+/** @brief Put a gate in front of the handler for packets beginning with `byte`.
+ *
+ * The gate stays when the handler is replaced. Pass nullptr to remove it.
+ */
+void networking_set_gate(Networking_Core *_Nonnull net, uint8_t byte, net_gate_cb *_Nullable cb, void *_Nullable object);
+
+/** @brief Hand a packet that a gate held back to its handler, through the dispatcher if one is set.
+ *
+ * Does not ask the gate again. Call it from the thread that calls `networking_poll`.
+ */
+void networking_handle_packet(const Networking_Core *_Nonnull net, const IP_Port *_Nonnull source, const uint8_t *_Nonnull packet,
+                              uint16_t length, void *_Nullable userdata);
+
 /** Call this several times a second. */
 void networking_poll(const Networking_Core *_Nonnull net, void *_Nullable userdata);
+
+/** Number of datagrams received or sent per system call in batched mode. */
+#define NET_BATCH_SIZE 32
+
+/** @brief Enable or disable batched UDP I/O.
+ *
+ * In batched mode, `networking_poll` reads up to NET_BATCH_SIZE datagrams per
+ * system call and `net_send_packet` queues outgoing packets instead of sending
+ * them right away. Queued packets are sent together after each received batch
+ * has been handled, or by an explicit `networking_flush`, which the owner must
+ * call at the end of each iteration of its main loop.
+ *
+ * Uses recvmmsg/sendmmsg where the Network backend supports it and falls back
+ * to one recvfrom/sendto per packet otherwise.
+ *
+ * @retval false if the batch buffers could not be allocated.
+ */
+bool networking_set_batching(Networking_Core *_Nonnull net, bool enabled);
 typedef enum Net_Err_Connect {
     NET_ERR_CONNECT_OK,
     NET_ERR_CONNECT_INVALID_FAMILY,
@@ -0,0 +1,130 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "logger.h"
+#include "net.h"
+#include "network.h"
+#include "os_memory.h"
+#include "os_network.h"
+
+namespace {
+
+constexpr uint8_t kBenchPacketId = 0xf0;
+constexpr int kBurstSize = 256;
+constexpr uint16_t kPacketSize = 100;
+
+struct RecvCounter {
+    int64_t packets = 0;
+};
+
+/**
+ * @brief UDP packets per second over loopback, with and without batched I/O.
+ *
+ * Arg 0 uses one sendto/recvfrom per packet, Arg 1 enables batching on both
+ * the sending and the receiving Networking_Core.
+ */
+class NetworkBatchBenchFixture : public benchmark::Fixture {
+public:
+    void SetUp(::benchmark::State &state) override
+    {
+        ns = os_network();
+        if (ns == nullptr) {
+            setup_error = "os_network failed";
+            return;
+        }
+        mem = os_memory();
+        log = logger_new(mem);
+
+        IP ip;
+        ip_init(&ip, false);
+        ip.ip.v4 = get_ip4_loopback();
+
+        receiver = new_networking_ex(log, mem, ns, &ip, 33445, 33545, nullptr);
+        sender = new_networking_ex(log, mem, ns, &ip, 33445, 33545, nullptr);
+        if (receiver == nullptr || sender == nullptr) {
+            setup_error = "new_networking_ex failed";
+            return;
+        }
+
+        const bool batched = state.range(0) != 0;
+        if (!networking_set_batching(receiver, batched) || !networking_set_batching(sender, batched)) {
+            setup_error = "networking_set_batching failed";
+            return;
+        }
+
+        networking_registerhandler(
+            receiver, kBenchPacketId,
+            [](void *object, const IP_Port *, const uint8_t *, uint16_t, void *) {
+                ++static_cast<RecvCounter *>(object)->packets;
+                return 0;
+            },
+            &counter);
+
+        dest.ip = ip;
+        dest.port = net_port(receiver);
+    }
+
+    void TearDown(const ::benchmark::State &state) override
+    {
+        kill_networking(sender);
+        kill_networking(receiver);
+        sender = nullptr;
+        receiver = nullptr;
+        logger_kill(log);
+        log = nullptr;
+        counter = RecvCounter{};
+    }
+
+protected:
+    const Network *ns = nullptr;
+    const Memory *mem = nullptr;
+    Logger *log = nullptr;
+    Networking_Core *sender = nullptr;
+    Networking_Core *receiver = nullptr;
+    IP_Port dest{};
+    RecvCounter counter;
+    std::string setup_error;
+};
+
+BENCHMARK_DEFINE_F(NetworkBatchBenchFixture, Loopback)(benchmark::State &state)
+{
+    if (!setup_error.empty()) {
+        state.SkipWithError(setup_error.c_str());
+        return;
+    }
+
+    std::vector<uint8_t> packet(kPacketSize, 0xab);
+    packet[0] = kBenchPacketId;
+
+    for (auto _ : state) {
+        const int64_t expected = counter.packets + kBurstSize;
+
+        for (int i = 0; i < kBurstSize; ++i) {
+            sendpacket(sender, &dest, packet.data(), packet.size());
+        }
+        networking_flush(sender);
+
+        // Loopback UDP may still drop under pressure, so stop after a few idle polls.
+        for (int idle = 0; counter.packets < expected && idle < 100;) {
+            const int64_t before = counter.packets;
+            networking_poll(receiver, nullptr);
+            idle = counter.packets == before ? idle + 1 : 0;
+        }
+    }
+
+    state.SetItemsProcessed(counter.packets);
+    state.counters["sent"] = static_cast<double>(state.iterations() * kBurstSize);
+}
+
+BENCHMARK_REGISTER_F(NetworkBatchBenchFixture, Loopback)->Arg(0)->Arg(1);
+
+}  // namespace
+
+BENCHMARK_MAIN();
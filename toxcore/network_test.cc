@@ -6,7 +6,9 @@
 #include <gtest/gtest.h>
 
 #include <cstring>
+#include <memory>
 
+#include "logger.h"
 #include "network_test_util.hh"
 
 namespace {
@@ -175,4 +177,73 @@ TEST(IpportCmp, InvalidAlwaysComparesEqual)
     EXPECT_EQ(ipport_cmp_handler(&a, &b, sizeof(IP_Port)), 0);
 }
 
+TEST(NetworkingBatching, QueuedPacketsAreDeliveredAfterFlush)
+{
+    tox::test::SimulatedEnvironment env{12345};
+    auto alice_node = env.create_node(33445);
+    auto bob_node = env.create_node(33446);
+
+    std::unique_ptr<Logger, void (*)(Logger *)> log{
+        logger_new(&alice_node->c_memory), logger_kill};
+
+    // The nodes already have 33445 and 33446 bound, so use ports that are still free.
+    IP ip;
+    ip_init(&ip, false);
+    std::unique_ptr<Networking_Core, void (*)(Networking_Core *)> alice{
+        new_networking_ex(log.get(), &alice_node->c_memory, &alice_node->c_network, &ip, 33545,
+            33545, nullptr),
+        kill_networking};
+    std::unique_ptr<Networking_Core, void (*)(Networking_Core *)> bob{
+        new_networking_ex(
+            log.get(), &bob_node->c_memory, &bob_node->c_network, &ip, 33546, 33546, nullptr),
+        kill_networking};
+    ASSERT_NE(alice, nullptr);
+    ASSERT_NE(bob, nullptr);
+
+    // The fake network has no batch functions, so this also covers the fallback path.
+    ASSERT_TRUE(networking_set_batching(alice.get(), true));
+    ASSERT_TRUE(networking_set_batching(bob.get(), true));
+
+    int received = 0;
+    networking_registerhandler(
+        bob.get(), 0xf0,
+        [](void *object, const IP_Port *, const uint8_t *, uint16_t length, void *) {
+            EXPECT_EQ(length, 3);
+            ++*static_cast<int *>(object);
+            return 0;
+        },
+        &received);
+
+    IP_Port dest;
+    dest.ip = bob_node->node->ip;
+    dest.port = net_htons(33546);
+    const uint8_t packet[] = {0xf0, 1, 2};
+
+    const auto deliver = [&]() {
+        for (int i = 0; i < 10; ++i) {
+            env.advance_time(10);
+            networking_poll(bob.get(), nullptr);
+        }
+    };
+
+    for (int i = 0; i < NET_BATCH_SIZE; ++i) {
+        EXPECT_EQ(sendpacket(alice.get(), &dest, packet, sizeof(packet)), sizeof(packet));
+    }
+
+    // A full queue is only sent when it is flushed or another packet needs room.
+    deliver();
+    EXPECT_EQ(received, 0);
+
+    for (int i = 0; i < 5; ++i) {
+        EXPECT_EQ(sendpacket(alice.get(), &dest, packet, sizeof(packet)), sizeof(packet));
+    }
+
+    deliver();
+    EXPECT_EQ(received, NET_BATCH_SIZE);
+
+    networking_flush(alice.get());
+    deliver();
+    EXPECT_EQ(received, NET_BATCH_SIZE + 5);
+}
+
 }  // namespace
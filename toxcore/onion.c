@@ -9,12 +9,14 @@
 #include "onion.h"
 
 #include <assert.h>
+#include <pthread.h>
 #include <string.h>
 
 #include "DHT.h"
 #include "attributes.h"
 #include "ccompat.h"
 #include "crypto_core.h"
+#include "key_agreement.h"
 #include "logger.h"
 #include "mem.h"
 #include "mono_time.h"
@@ -34,7 +36,6 @@
 #define KEY_REFRESH_INTERVAL (2 * 60 * 60)
 
 // Settings for the shared key cache
-#define MAX_KEYS_PER_SLOT 4
 #define KEYS_TIMEOUT 600
 
 /** Change symmetric keys every 2 hours to make paths expire eventually. */
@@ -46,6 +47,32 @@ static void change_symmetric_key(Onion *_Nonnull onion)
     }
 }
 
+static void onion_lock_key(const Onion *_Nonnull onion)
+{
+    if (onion->key_lock != nullptr) {
+        pthread_mutex_lock(onion->key_lock);
+    }
+}
+
+static void onion_unlock_key(const Onion *_Nonnull onion)
+{
+    if (onion->key_lock != nullptr) {
+        pthread_mutex_unlock(onion->key_lock);
+    }
+}
+
+/** @brief Refresh the symmetric key if needed and copy it into `key`.
+ *
+ * The onion handlers are concurrent, so they work on a copy of the key.
+ */
+static void get_symmetric_key(Onion *_Nonnull onion, uint8_t key[_Nonnull CRYPTO_SYMMETRIC_KEY_SIZE])
+{
+    onion_lock_key(onion);
+    change_symmetric_key(onion);
+    memcpy(key, onion->secret_symmetric_key, CRYPTO_SYMMETRIC_KEY_SIZE);
+    onion_unlock_key(onion);
+}
+
 /** packing and unpacking functions */
 static void ip_pack_to_bytes(uint8_t *_Nonnull data, const IP *_Nonnull source)
 {
@@ -311,54 +338,8 @@ int send_onion_response(const Logger *log, const Networking_Core *net,
     return 0;
 }
 
-static int handle_send_initial(void *_Nonnull object, const IP_Port *_Nonnull source, const uint8_t *_Nonnull packet, uint16_t length, void *_Nonnull userdata)
-{
-    Onion *onion = (Onion *)object;
-
-    if (length > ONION_MAX_PACKET_SIZE) {
-        LOGGER_TRACE(onion->log, "invalid initial onion packet length: %u (max: %u)",
-                     length, (unsigned int)ONION_MAX_PACKET_SIZE);
-        return 1;
-    }
-
-    if (length <= 1 + SEND_1) {
-        LOGGER_TRACE(onion->log, "initial onion packet cannot contain SEND_1 packet: %u <= %u",
-                     length, (unsigned int)(1 + SEND_1));
-        return 1;
-    }
-
-    change_symmetric_key(onion);
-
-    const int nonce_start = 1;
-    const int public_key_start = nonce_start + CRYPTO_NONCE_SIZE;
-    const int ciphertext_start = public_key_start + CRYPTO_PUBLIC_KEY_SIZE;
-
-    const int ciphertext_length = length - ciphertext_start;
-    const int plaintext_length = ciphertext_length - CRYPTO_MAC_SIZE;
-
-    uint8_t plain[ONION_MAX_PACKET_SIZE];
-    const uint8_t *public_key = &packet[public_key_start];
-    const uint8_t *shared_key = shared_key_cache_lookup(onion->shared_keys_1, public_key);
-
-    if (shared_key == nullptr) {
-        /* Error looking up/deriving the shared key */
-        LOGGER_TRACE(onion->log, "shared onion key lookup failed for pk %02x%02x...",
-                     public_key[0], public_key[1]);
-        return 1;
-    }
-
-    const int len = decrypt_data_symmetric(
-                        onion->mem, shared_key, &packet[nonce_start], &packet[ciphertext_start], ciphertext_length, plain);
-
-    if (len != plaintext_length) {
-        LOGGER_TRACE(onion->log, "decrypt failed: %d != %d", len, plaintext_length);
-        return 1;
-    }
-
-    return onion_send_1(onion, plain, len, source, packet + 1);
-}
-
-int onion_send_1(const Onion *onion, const uint8_t *plain, uint16_t len, const IP_Port *source, const uint8_t *nonce)
+static int onion_send_1_with_key(const Onion *_Nonnull onion, const uint8_t *_Nonnull secret_symmetric_key,
+                                 const uint8_t *_Nonnull plain, uint16_t len, const IP_Port *_Nonnull source, const uint8_t *_Nonnull nonce)
 {
     const uint16_t max_len = ONION_MAX_PACKET_SIZE + SIZE_IPPORT - (1 + CRYPTO_NONCE_SIZE + ONION_RETURN_1);
     if (len > max_len) {
@@ -386,7 +367,7 @@ int onion_send_1(const Onion *onion, const uint8_t *plain, uint16_t len, const I
     uint16_t data_len = 1 + CRYPTO_NONCE_SIZE + (len - SIZE_IPPORT);
     uint8_t *ret_part = data + data_len;
     random_nonce(onion->rng, ret_part);
-    len = encrypt_data_symmetric(onion->mem, onion->secret_symmetric_key, ret_part, ip_port, SIZE_IPPORT,
+    len = encrypt_data_symmetric(onion->mem, secret_symmetric_key, ret_part, ip_port, SIZE_IPPORT,
                                  ret_part + CRYPTO_NONCE_SIZE);
 
     if (len != SIZE_IPPORT + CRYPTO_MAC_SIZE) {
@@ -405,6 +386,64 @@ int onion_send_1(const Onion *onion, const uint8_t *plain, uint16_t len, const I
     return 0;
 }
 
+int onion_send_1(const Onion *onion, const uint8_t *plain, uint16_t len, const IP_Port *source, const uint8_t *nonce)
+{
+    uint8_t secret_symmetric_key[CRYPTO_SYMMETRIC_KEY_SIZE];
+    onion_lock_key(onion);
+    memcpy(secret_symmetric_key, onion->secret_symmetric_key, CRYPTO_SYMMETRIC_KEY_SIZE);
+    onion_unlock_key(onion);
+
+    return onion_send_1_with_key(onion, secret_symmetric_key, plain, len, source, nonce);
+}
+
+static int handle_send_initial(void *_Nonnull object, const IP_Port *_Nonnull source, const uint8_t *_Nonnull packet, uint16_t length, void *_Nonnull userdata)
+{
+    Onion *onion = (Onion *)object;
+
+    if (length > ONION_MAX_PACKET_SIZE) {
+        LOGGER_TRACE(onion->log, "invalid initial onion packet length: %u (max: %u)",
+                     length, (unsigned int)ONION_MAX_PACKET_SIZE);
+        return 1;
+    }
+
+    if (length <= 1 + SEND_1) {
+        LOGGER_TRACE(onion->log, "initial onion packet cannot contain SEND_1 packet: %u <= %u",
+                     length, (unsigned int)(1 + SEND_1));
+        return 1;
+    }
+
+    uint8_t secret_symmetric_key[CRYPTO_SYMMETRIC_KEY_SIZE];
+    get_symmetric_key(onion, secret_symmetric_key);
+
+    const int nonce_start = 1;
+    const int public_key_start = nonce_start + CRYPTO_NONCE_SIZE;
+    const int ciphertext_start = public_key_start + CRYPTO_PUBLIC_KEY_SIZE;
+
+    const int ciphertext_length = length - ciphertext_start;
+    const int plaintext_length = ciphertext_length - CRYPTO_MAC_SIZE;
+
+    uint8_t plain[ONION_MAX_PACKET_SIZE];
+    const uint8_t *public_key = &packet[public_key_start];
+    uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
+
+    if (!shared_key_cache_get(onion->shared_keys_1, public_key, shared_key)) {
+        /* Error looking up/deriving the shared key */
+        LOGGER_TRACE(onion->log, "shared onion key lookup failed for pk %02x%02x...",
+                     public_key[0], public_key[1]);
+        return 1;
+    }
+
+    const int len = decrypt_data_symmetric(
+                        onion->mem, shared_key, &packet[nonce_start], &packet[ciphertext_start], ciphertext_length, plain);
+
+    if (len != plaintext_length) {
+        LOGGER_TRACE(onion->log, "decrypt failed: %d != %d", len, plaintext_length);
+        return 1;
+    }
+
+    return onion_send_1_with_key(onion, secret_symmetric_key, plain, len, source, packet + 1);
+}
+
 static int handle_send_1(void *_Nonnull object, const IP_Port *_Nonnull source, const uint8_t *_Nonnull packet, uint16_t length, void *_Nonnull userdata)
 {
     Onion *onion = (Onion *)object;
@@ -417,13 +456,14 @@ static int handle_send_1(void *_Nonnull object, const IP_Port *_Nonnull source,
         return 1;
     }
 
-    change_symmetric_key(onion);
+    uint8_t secret_symmetric_key[CRYPTO_SYMMETRIC_KEY_SIZE];
+    get_symmetric_key(onion, secret_symmetric_key);
 
     uint8_t plain[ONION_MAX_PACKET_SIZE];
     const uint8_t *public_key = packet + 1 + CRYPTO_NONCE_SIZE;
-    const uint8_t *shared_key = shared_key_cache_lookup(onion->shared_keys_2, public_key);
+    uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
 
-    if (shared_key == nullptr) {
+    if (!shared_key_cache_get(onion->shared_keys_2, public_key, shared_key)) {
         /* Error looking up/deriving the shared key */
         return 1;
     }
@@ -451,7 +491,7 @@ static int handle_send_1(void *_Nonnull object, const IP_Port *_Nonnull source,
     uint8_t ret_data[RETURN_1 + SIZE_IPPORT];
     ipport_pack(ret_data, source);
     memcpy(ret_data + SIZE_IPPORT, packet + (length - RETURN_1), RETURN_1);
-    len = encrypt_data_symmetric(onion->mem, onion->secret_symmetric_key, ret_part, ret_data, sizeof(ret_data),
+    len = encrypt_data_symmetric(onion->mem, secret_symmetric_key, ret_part, ret_data, sizeof(ret_data),
                                  ret_part + CRYPTO_NONCE_SIZE);
 
     if (len != RETURN_2 - CRYPTO_NONCE_SIZE) {
@@ -482,13 +522,14 @@ static int handle_send_2(void *_Nonnull object, const IP_Port *_Nonnull source,
         return 1;
     }
 
-    change_symmetric_key(onion);
+    uint8_t secret_symmetric_key[CRYPTO_SYMMETRIC_KEY_SIZE];
+    get_symmetric_key(onion, secret_symmetric_key);
 
     uint8_t plain[ONION_MAX_PACKET_SIZE];
     const uint8_t *public_key = packet + 1 + CRYPTO_NONCE_SIZE;
-    const uint8_t *shared_key = shared_key_cache_lookup(onion->shared_keys_3, public_key);
+    uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
 
-    if (shared_key == nullptr) {
+    if (!shared_key_cache_get(onion->shared_keys_3, public_key, shared_key)) {
         /* Error looking up/deriving the shared key */
         return 1;
     }
@@ -523,7 +564,7 @@ static int handle_send_2(void *_Nonnull object, const IP_Port *_Nonnull source,
     uint8_t ret_data[RETURN_2 + SIZE_IPPORT];
     ipport_pack(ret_data, source);
     memcpy(ret_data + SIZE_IPPORT, packet + (length - RETURN_2), RETURN_2);
-    len = encrypt_data_symmetric(onion->mem, onion->secret_symmetric_key, ret_part, ret_data, sizeof(ret_data),
+    len = encrypt_data_symmetric(onion->mem, secret_symmetric_key, ret_part, ret_data, sizeof(ret_data),
                                  ret_part + CRYPTO_NONCE_SIZE);
 
     if (len != RETURN_3 - CRYPTO_NONCE_SIZE) {
@@ -561,10 +602,11 @@ static int handle_recv_3(void *_Nonnull object, const IP_Port *_Nonnull source,
         return 1;
     }
 
-    change_symmetric_key(onion);
+    uint8_t secret_symmetric_key[CRYPTO_SYMMETRIC_KEY_SIZE];
+    get_symmetric_key(onion, secret_symmetric_key);
 
     uint8_t plain[SIZE_IPPORT + RETURN_2];
-    const int len = decrypt_data_symmetric(onion->mem, onion->secret_symmetric_key, packet + 1, packet + 1 + CRYPTO_NONCE_SIZE,
+    const int len = decrypt_data_symmetric(onion->mem, secret_symmetric_key, packet + 1, packet + 1 + CRYPTO_NONCE_SIZE,
                                            SIZE_IPPORT + RETURN_2 + CRYPTO_MAC_SIZE, plain);
 
     if ((uint32_t)len != sizeof(plain)) {
@@ -613,10 +655,11 @@ static int handle_recv_2(void *_Nonnull object, const IP_Port *_Nonnull source,
         return 1;
     }
 
-    change_symmetric_key(onion);
+    uint8_t secret_symmetric_key[CRYPTO_SYMMETRIC_KEY_SIZE];
+    get_symmetric_key(onion, secret_symmetric_key);
 
     uint8_t plain[SIZE_IPPORT + RETURN_1];
-    const int len = decrypt_data_symmetric(onion->mem, onion->secret_symmetric_key, packet + 1, packet + 1 + CRYPTO_NONCE_SIZE,
+    const int len = decrypt_data_symmetric(onion->mem, secret_symmetric_key, packet + 1, packet + 1 + CRYPTO_NONCE_SIZE,
                                            SIZE_IPPORT + RETURN_1 + CRYPTO_MAC_SIZE, plain);
 
     if ((uint32_t)len != sizeof(plain)) {
@@ -664,10 +707,11 @@ static int handle_recv_1(void *_Nonnull object, const IP_Port *_Nonnull source,
         return 1;
     }
 
-    change_symmetric_key(onion);
+    uint8_t secret_symmetric_key[CRYPTO_SYMMETRIC_KEY_SIZE];
+    get_symmetric_key(onion, secret_symmetric_key);
 
     uint8_t plain[SIZE_IPPORT];
-    const int len = decrypt_data_symmetric(onion->mem, onion->secret_symmetric_key, packet + 1, packet + 1 + CRYPTO_NONCE_SIZE,
+    const int len = decrypt_data_symmetric(onion->mem, secret_symmetric_key, packet + 1, packet + 1 + CRYPTO_NONCE_SIZE,
                                            SIZE_IPPORT + CRYPTO_MAC_SIZE, plain);
 
     if ((uint32_t)len != SIZE_IPPORT) {
@@ -696,10 +740,25 @@ static int handle_recv_1(void *_Nonnull object, const IP_Port *_Nonnull source,
     return 0;
 }
 
+/** @brief Register the RECV_1 handler.
+ *
+ * It can only run concurrently while there is no recv_1 callback, since the
+ * callback (e.g. the TCP server) is not thread-safe.
+ */
+static void register_recv_1(Onion *_Nonnull onion)
+{
+    if (onion->recv_1_function == nullptr) {
+        networking_registerhandler_concurrent(onion->net, NET_PACKET_ONION_RECV_1, &handle_recv_1, onion);
+    } else {
+        networking_registerhandler(onion->net, NET_PACKET_ONION_RECV_1, &handle_recv_1, onion);
+    }
+}
+
 void set_callback_handle_recv_1(Onion *onion, onion_recv_1_cb *function, void *object)
 {
     onion->recv_1_function = function;
     onion->callback_object = object;
+    register_recv_1(onion);
 }
 
 Onion *new_onion(const Logger *log, const Memory *mem, const Mono_Time *mono_time, const Random *rng, DHT *dht, Networking_Core *net)
@@ -724,9 +783,9 @@ Onion *new_onion(const Logger *log, const Memory *mem, const Mono_Time *mono_tim
     onion->timestamp = mono_time_get(onion->mono_time);
 
     const uint8_t *secret_key = dht_get_self_secret_key(dht);
-    Shared_Key_Cache *const temp_shared_keys_1 = shared_key_cache_new(log, mono_time, mem, secret_key, KEYS_TIMEOUT, MAX_KEYS_PER_SLOT);
-    Shared_Key_Cache *const temp_shared_keys_2 = shared_key_cache_new(log, mono_time, mem, secret_key, KEYS_TIMEOUT, MAX_KEYS_PER_SLOT);
-    Shared_Key_Cache *const temp_shared_keys_3 = shared_key_cache_new(log, mono_time, mem, secret_key, KEYS_TIMEOUT, MAX_KEYS_PER_SLOT);
+    Shared_Key_Cache *const temp_shared_keys_1 = shared_key_cache_new(log, mono_time, mem, secret_key, KEYS_TIMEOUT, SHARED_KEY_CACHE_DEFAULT_CAPACITY);
+    Shared_Key_Cache *const temp_shared_keys_2 = shared_key_cache_new(log, mono_time, mem, secret_key, KEYS_TIMEOUT, SHARED_KEY_CACHE_DEFAULT_CAPACITY);
+    Shared_Key_Cache *const temp_shared_keys_3 = shared_key_cache_new(log, mono_time, mem, secret_key, KEYS_TIMEOUT, SHARED_KEY_CACHE_DEFAULT_CAPACITY);
 
     if (temp_shared_keys_1 == nullptr || temp_shared_keys_2 == nullptr || temp_shared_keys_3 == nullptr) {
         shared_key_cache_free(temp_shared_keys_3);
@@ -741,17 +800,62 @@ Onion *new_onion(const Logger *log, const Memory *mem, const Mono_Time *mono_tim
     onion->shared_keys_2 = temp_shared_keys_2;
     onion->shared_keys_3 = temp_shared_keys_3;
 
-    networking_registerhandler(onion->net, NET_PACKET_ONION_SEND_INITIAL, &handle_send_initial, onion);
-    networking_registerhandler(onion->net, NET_PACKET_ONION_SEND_1, &handle_send_1, onion);
-    networking_registerhandler(onion->net, NET_PACKET_ONION_SEND_2, &handle_send_2, onion);
+    networking_registerhandler_concurrent(onion->net, NET_PACKET_ONION_SEND_INITIAL, &handle_send_initial, onion);
+    networking_registerhandler_concurrent(onion->net, NET_PACKET_ONION_SEND_1, &handle_send_1, onion);
+    networking_registerhandler_concurrent(onion->net, NET_PACKET_ONION_SEND_2, &handle_send_2, onion);
 
-    networking_registerhandler(onion->net, NET_PACKET_ONION_RECV_3, &handle_recv_3, onion);
-    networking_registerhandler(onion->net, NET_PACKET_ONION_RECV_2, &handle_recv_2, onion);
-    networking_registerhandler(onion->net, NET_PACKET_ONION_RECV_1, &handle_recv_1, onion);
+    networking_registerhandler_concurrent(onion->net, NET_PACKET_ONION_RECV_3, &handle_recv_3, onion);
+    networking_registerhandler_concurrent(onion->net, NET_PACKET_ONION_RECV_2, &handle_recv_2, onion);
+    register_recv_1(onion);
 
     return onion;
 }
 
+bool onion_set_shared_key_capacity(Onion *onion, uint32_t capacity)
+{
+    return shared_key_cache_set_capacity(onion->shared_keys_1, capacity)
+           && shared_key_cache_set_capacity(onion->shared_keys_2, capacity)
+           && shared_key_cache_set_capacity(onion->shared_keys_3, capacity);
+}
+
+bool onion_enable_thread_safety(Onion *onion)
+{
+    if (!shared_key_cache_enable_thread_safety(onion->shared_keys_1)
+            || !shared_key_cache_enable_thread_safety(onion->shared_keys_2)
+            || !shared_key_cache_enable_thread_safety(onion->shared_keys_3)) {
+        return false;
+    }
+
+    if (onion->key_lock != nullptr) {
+        return true;
+    }
+
+    pthread_mutex_t *const key_lock = (pthread_mutex_t *)mem_alloc(onion->mem, sizeof(pthread_mutex_t));
+
+    if (key_lock == nullptr || pthread_mutex_init(key_lock, nullptr) != 0) {
+        mem_delete(onion->mem, key_lock);
+        return false;
+    }
+
+    onion->key_lock = key_lock;
+    return true;
+}
+
+void onion_add_shared_key_stats(const Onion *onion, Shared_Key_Cache_Stats *stats)
+{
+    shared_key_cache_add_stats(onion->shared_keys_1, stats);
+    shared_key_cache_add_stats(onion->shared_keys_2, stats);
+    shared_key_cache_add_stats(onion->shared_keys_3, stats);
+}
+
+void onion_register_key_agreement(Onion *onion, Key_Agreement *ka)
+{
+    const uint16_t public_key_offset = 1 + CRYPTO_NONCE_SIZE;
+    key_agreement_register(ka, NET_PACKET_ONION_SEND_INITIAL, onion->shared_keys_1, public_key_offset);
+    key_agreement_register(ka, NET_PACKET_ONION_SEND_1, onion->shared_keys_2, public_key_offset);
+    key_agreement_register(ka, NET_PACKET_ONION_SEND_2, onion->shared_keys_3, public_key_offset);
+}
+
 void kill_onion(Onion *onion)
 {
     if (onion == nullptr) {
@@ -772,5 +876,10 @@ void kill_onion(Onion *onion)
     shared_key_cache_free(onion->shared_keys_2);
     shared_key_cache_free(onion->shared_keys_3);
 
+    if (onion->key_lock != nullptr) {
+        pthread_mutex_destroy(onion->key_lock);
+        mem_delete(onion->mem, onion->key_lock);
+    }
+
     mem_delete(onion->mem, onion);
 }
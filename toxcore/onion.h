@@ -9,11 +9,13 @@
 #ifndef C_TOXCORE_TOXCORE_ONION_H
 #define C_TOXCORE_TOXCORE_ONION_H
 
+#include <pthread.h>
 #include <stdint.h>
 
 #include "DHT.h"
 #include "attributes.h"
 #include "crypto_core.h"
+#include "key_agreement.h"
 #include "logger.h"
 #include "mem.h"
 #include "mono_time.h"
@@ -37,6 +39,9 @@ typedef struct Onion {
     Networking_Core *_Nonnull net;
     uint8_t secret_symmetric_key[CRYPTO_SYMMETRIC_KEY_SIZE];
     uint64_t timestamp;
+    /* Guards secret_symmetric_key and timestamp against concurrent packet handlers.
+     * Only set by onion_enable_thread_safety. */
+    pthread_mutex_t *_Nullable key_lock;
 
     Shared_Key_Cache *_Nonnull shared_keys_1;
     Shared_Key_Cache *_Nonnull shared_keys_2;
@@ -152,6 +157,30 @@ Onion *_Nullable new_onion(const Logger *_Nonnull log, const Memory *_Nonnull me
 
 void kill_onion(Onion *_Nullable onion);
 
+/**
+ * @brief Sets the capacity of the shared key caches for each of the three onion
+ *   layers. See `shared_key_cache_set_capacity`.
+ *
+ * Must be called before other threads use the onion.
+ */
+bool onion_set_shared_key_capacity(Onion *_Nonnull onion, uint32_t capacity);
+
+/**
+ * @brief Allocates the locks that let the onion's concurrent packet handlers
+ *   run on other threads (see `networking_set_dispatcher`).
+ *
+ * Must be called before other threads use the onion.
+ *
+ * @retval false if a lock could not be allocated.
+ */
+bool onion_enable_thread_safety(Onion *_Nonnull onion);
+
+/** @brief Adds the statistics of the onion's shared key caches to @p stats. */
+void onion_add_shared_key_stats(const Onion *_Nonnull onion, Shared_Key_Cache_Stats *_Nonnull stats);
+
+/** @brief Lets @p ka compute the shared keys of onion packets on all three hops. */
+void onion_register_key_agreement(Onion *_Nonnull onion, Key_Agreement *_Nonnull ka);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -9,6 +9,7 @@
 #include "onion_announce.h"
 
 #include <assert.h>
+#include <pthread.h>
 #include <string.h>
 
 #include "DHT.h"
@@ -16,13 +17,13 @@
 #include "attributes.h"
 #include "ccompat.h"
 #include "crypto_core.h"
+#include "key_agreement.h"
 #include "logger.h"
 #include "mem.h"
 #include "mono_time.h"
 #include "network.h"
 #include "onion.h"
 #include "shared_key_cache.h"
-#include "sort.h"
 #include "timed_auth.h"
 #include "util.h"
 
@@ -40,20 +41,55 @@
 #define ONION_MINIMAL_SIZE (ONION_PING_ID_SIZE + CRYPTO_PUBLIC_KEY_SIZE * 2 + ONION_ANNOUNCE_SENDBACK_DATA_LENGTH)
 
 /* Settings for the shared key cache */
-#define MAX_KEYS_PER_SLOT 4
 #define KEYS_TIMEOUT 600
 
 static_assert(ONION_PING_ID_SIZE == CRYPTO_PUBLIC_KEY_SIZE,
               "announce response packets assume that ONION_PING_ID_SIZE is equal to CRYPTO_PUBLIC_KEY_SIZE");
 
+/** Marks the ends of the announce time list. */
+#define ENTRY_NONE UINT32_MAX
+
 typedef struct Onion_Announce_Entry {
     uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
     IP_Port ret_ip_port;
     uint8_t ret[ONION_RETURN_3];
     uint8_t data_public_key[CRYPTO_PUBLIC_KEY_SIZE];
     uint64_t announce_time;
+
+    /** Position in the distance heap. */
+    uint32_t heap_pos;
+    /** Neighbours in the announce time list, `ENTRY_NONE` at its ends. */
+    uint32_t older;
+    uint32_t newer;
 } Onion_Announce_Entry;
 
+/**
+ * The announcements we store, indexed three ways:
+ * - by public key, in an open addressing hash table, for lookups;
+ * - by distance to our DHT public key, in a heap whose root is the farthest
+ *   entry, to find the entry a closer announcement replaces when we're full;
+ * - by announce time, in a list from the oldest to the newest entry, to drop
+ *   the entries that timed out.
+ *
+ * The first `size` entries are in use. Removing an entry moves the last one
+ * into its place. The heap order assumes our DHT key doesn't change while
+ * entries are stored.
+ */
+typedef struct Onion_Announce_Store {
+    Onion_Announce_Entry *_Nonnull entries;
+    /** Entry indices in heap order. */
+    uint32_t *_Nonnull heap;
+    /** Entry index + 1 for each bucket, 0 for empty buckets. */
+    uint32_t *_Nonnull buckets;
+    uint32_t bucket_bits;
+    /** Random, so peers can't pick keys that land in the same bucket. */
+    uint64_t hash_seed;
+    uint32_t capacity;
+    uint32_t size;
+    uint32_t oldest;
+    uint32_t newest;
+} Onion_Announce_Store;
+
 struct Onion_Announce {
     const Logger *_Nonnull log;
     const Mono_Time *_Nonnull mono_time;
@@ -61,7 +97,7 @@ struct Onion_Announce {
     const Memory *_Nonnull mem;
     DHT *_Nonnull dht;
     Networking_Core *_Nonnull net;
-    Onion_Announce_Entry entries[ONION_ANNOUNCE_MAX_ENTRIES];
+    Onion_Announce_Store store;
     uint8_t hmac_key[CRYPTO_HMAC_KEY_SIZE];
 
     Shared_Key_Cache *_Nonnull shared_keys_recv;
@@ -69,24 +105,32 @@ struct Onion_Announce {
     uint16_t extra_data_max_size;
     pack_extra_data_cb *_Nullable extra_data_callback;
     void *_Nullable extra_data_object;
+
+    /* Guards the store and the extra data object against concurrent requests.
+     * Only set by onion_announce_enable_thread_safety. */
+    pthread_mutex_t *_Nullable lock;
 };
 
-void onion_announce_extra_data_callback(Onion_Announce *onion_a, uint16_t extra_data_max_size,
-                                        pack_extra_data_cb *extra_data_callback, void *extra_data_object)
+static void onion_announce_lock(const Onion_Announce *_Nonnull onion_a)
 {
-    onion_a->extra_data_max_size = extra_data_max_size;
-    onion_a->extra_data_callback = extra_data_callback;
-    onion_a->extra_data_object = extra_data_object;
+    if (onion_a->lock != nullptr) {
+        pthread_mutex_lock(onion_a->lock);
+    }
 }
 
-uint8_t *onion_announce_entry_public_key(Onion_Announce *onion_a, uint32_t entry)
+static void onion_announce_unlock(const Onion_Announce *_Nonnull onion_a)
 {
-    return onion_a->entries[entry].public_key;
+    if (onion_a->lock != nullptr) {
+        pthread_mutex_unlock(onion_a->lock);
+    }
 }
 
-void onion_announce_entry_set_time(Onion_Announce *onion_a, uint32_t entry, uint64_t announce_time)
+void onion_announce_extra_data_callback(Onion_Announce *onion_a, uint16_t extra_data_max_size,
+                                        pack_extra_data_cb *extra_data_callback, void *extra_data_object)
 {
-    onion_a->entries[entry].announce_time = announce_time;
+    onion_a->extra_data_max_size = extra_data_max_size;
+    onion_a->extra_data_callback = extra_data_callback;
+    onion_a->extra_data_object = extra_data_object;
 }
 
 /** @brief Create an onion announce request packet in packet of max_packet_length.
@@ -264,129 +308,245 @@ int send_data_request(
     return 0;
 }
 
-/** @brief check if public key is in entries list
- *
- * return -1 if no
- * return position in list if yes
- */
-static int in_entries(const Onion_Announce *_Nonnull onion_a, const uint8_t *_Nonnull public_key)
+/** @brief Number of hash table bits for @p capacity entries: at most half the buckets are used. */
+static uint32_t store_bucket_bits(uint32_t capacity)
 {
-    for (unsigned int i = 0; i < ONION_ANNOUNCE_MAX_ENTRIES; ++i) {
-        if (!mono_time_is_timeout(onion_a->mono_time, onion_a->entries[i].announce_time, ONION_ANNOUNCE_TIMEOUT)
-                && pk_equal(onion_a->entries[i].public_key, public_key)) {
-            return i;
-        }
+    uint32_t bucket_bits = 1;
+
+    while ((UINT32_C(1) << bucket_bits) < capacity * 2) {
+        ++bucket_bits;
     }
 
-    return -1;
+    return bucket_bits;
 }
 
-typedef struct Onion_Announce_Entry_Cmp {
-    const Memory *_Nonnull mem;
-    const Mono_Time *_Nonnull mono_time;
-    const uint8_t *_Nonnull comp_public_key;
-} Onion_Announce_Entry_Cmp;
+static uint32_t store_hash(const Onion_Announce_Store *_Nonnull store, const uint8_t *_Nonnull public_key)
+{
+    // See shared_key_cache_set: the first and last bytes are masked in curve25519.
+    uint64_t bytes;
+    memcpy(&bytes, &public_key[8], sizeof(bytes));
+    return (uint32_t)(((bytes ^ store->hash_seed) * UINT64_C(0x9E3779B97F4A7C15)) >> (64 - store->bucket_bits));
+}
 
-static int onion_announce_entry_cmp(const Onion_Announce_Entry_Cmp *_Nonnull cmp, const Onion_Announce_Entry *_Nonnull entry1, const Onion_Announce_Entry *_Nonnull entry2)
+/** @brief The bucket of @p public_key, or the empty bucket where it would go. */
+static uint32_t store_find_bucket(const Onion_Announce_Store *_Nonnull store, const uint8_t *_Nonnull public_key)
 {
-    const bool t1 = mono_time_is_timeout(cmp->mono_time, entry1->announce_time, ONION_ANNOUNCE_TIMEOUT);
-    const bool t2 = mono_time_is_timeout(cmp->mono_time, entry2->announce_time, ONION_ANNOUNCE_TIMEOUT);
+    const uint32_t mask = (UINT32_C(1) << store->bucket_bits) - 1;
+    uint32_t bucket = store_hash(store, public_key);
 
-    if (t1 && t2) {
-        return 0;
+    while (store->buckets[bucket] != 0
+            && !pk_equal(store->entries[store->buckets[bucket] - 1].public_key, public_key)) {
+        bucket = (bucket + 1) & mask;
     }
 
-    if (t1) {
-        return -1;
-    }
+    return bucket;
+}
 
-    if (t2) {
-        return 1;
+/** @brief Empty @p bucket, moving later entries of the probe sequence back so lookups still find them. */
+static void store_clear_bucket(Onion_Announce_Store *_Nonnull store, uint32_t bucket)
+{
+    const uint32_t mask = (UINT32_C(1) << store->bucket_bits) - 1;
+    uint32_t hole = bucket;
+
+    for (uint32_t next = (hole + 1) & mask; store->buckets[next] != 0; next = (next + 1) & mask) {
+        const uint32_t home = store_hash(store, store->entries[store->buckets[next] - 1].public_key);
+
+        // The entry can move into the hole if its probe sequence passes it.
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            store->buckets[hole] = store->buckets[next];
+            hole = next;
+        }
     }
 
-    const int closest = id_closest(cmp->comp_public_key, entry1->public_key, entry2->public_key);
+    store->buckets[hole] = 0;
+}
 
-    if (closest == 1) {
-        return 1;
+/** @brief Whether the entry at @p index1 is farther from @p self_public_key than the one at @p index2. */
+static bool store_farther(const Onion_Announce_Store *_Nonnull store, const uint8_t *_Nonnull self_public_key,
+                          uint32_t index1, uint32_t index2)
+{
+    return id_closest(self_public_key, store->entries[index1].public_key, store->entries[index2].public_key) == 2;
+}
+
+static void store_heap_set(Onion_Announce_Store *_Nonnull store, uint32_t pos, uint32_t index)
+{
+    store->heap[pos] = index;
+    store->entries[index].heap_pos = pos;
+}
+
+/** @brief Restore the heap order after the entry at heap position @p pos changed. */
+static void store_heap_fix(Onion_Announce_Store *_Nonnull store, const uint8_t *_Nonnull self_public_key, uint32_t pos)
+{
+    const uint32_t index = store->heap[pos];
+
+    while (pos > 0 && store_farther(store, self_public_key, index, store->heap[(pos - 1) / 2])) {
+        store_heap_set(store, pos, store->heap[(pos - 1) / 2]);
+        pos = (pos - 1) / 2;
     }
 
-    if (closest == 2) {
-        return -1;
+    while (2 * pos + 1 < store->size) {
+        uint32_t child = 2 * pos + 1;
+
+        if (child + 1 < store->size && store_farther(store, self_public_key, store->heap[child + 1], store->heap[child])) {
+            ++child;
+        }
+
+        if (!store_farther(store, self_public_key, store->heap[child], index)) {
+            break;
+        }
+
+        store_heap_set(store, pos, store->heap[child]);
+        pos = child;
     }
 
-    return 0;
+    store_heap_set(store, pos, index);
 }
 
-static bool onion_announce_entry_less_handler(const void *_Nonnull object, const void *_Nonnull a, const void *_Nonnull b)
+static void store_list_unlink(Onion_Announce_Store *_Nonnull store, uint32_t index)
 {
-    const Onion_Announce_Entry_Cmp *cmp = (const Onion_Announce_Entry_Cmp *)object;
-    const Onion_Announce_Entry *entry1 = (const Onion_Announce_Entry *)a;
-    const Onion_Announce_Entry *entry2 = (const Onion_Announce_Entry *)b;
+    const Onion_Announce_Entry *entry = &store->entries[index];
 
-    return onion_announce_entry_cmp(cmp, entry1, entry2) < 0;
+    if (entry->older != ENTRY_NONE) {
+        store->entries[entry->older].newer = entry->newer;
+    } else {
+        store->oldest = entry->newer;
+    }
+
+    if (entry->newer != ENTRY_NONE) {
+        store->entries[entry->newer].older = entry->older;
+    } else {
+        store->newest = entry->older;
+    }
 }
 
-static const void *_Nonnull onion_announce_entry_get_handler(const void *_Nonnull arr, uint32_t index)
+static void store_list_append(Onion_Announce_Store *_Nonnull store, uint32_t index)
 {
-    const Onion_Announce_Entry *entries = (const Onion_Announce_Entry *)arr;
-    return &entries[index];
+    Onion_Announce_Entry *entry = &store->entries[index];
+    entry->older = store->newest;
+    entry->newer = ENTRY_NONE;
+
+    if (store->newest != ENTRY_NONE) {
+        store->entries[store->newest].newer = index;
+    } else {
+        store->oldest = index;
+    }
+
+    store->newest = index;
 }
 
-static void onion_announce_entry_set_handler(void *_Nonnull arr, uint32_t index, const void *_Nonnull val)
+static void store_remove(Onion_Announce_Store *_Nonnull store, const uint8_t *_Nonnull self_public_key, uint32_t index)
 {
-    Onion_Announce_Entry *entries = (Onion_Announce_Entry *)arr;
-    const Onion_Announce_Entry *entry = (const Onion_Announce_Entry *)val;
-    entries[index] = *entry;
+    store_clear_bucket(store, store_find_bucket(store, store->entries[index].public_key));
+    store_list_unlink(store, index);
+
+    const uint32_t last = store->size - 1;
+    const uint32_t heap_pos = store->entries[index].heap_pos;
+    const uint32_t heap_last = store->heap[last];
+    --store->size;
+
+    if (heap_pos != last) {
+        store_heap_set(store, heap_pos, heap_last);
+        store_heap_fix(store, self_public_key, heap_pos);
+    }
+
+    if (index != last) {
+        // Move the last entry into the gap and point its indices at the new place.
+        const uint32_t bucket = store_find_bucket(store, store->entries[last].public_key);
+        store->entries[index] = store->entries[last];
+        store->buckets[bucket] = index + 1;
+
+        const Onion_Announce_Entry *entry = &store->entries[index];
+        store->heap[entry->heap_pos] = index;
+
+        if (entry->older != ENTRY_NONE) {
+            store->entries[entry->older].newer = index;
+        } else {
+            store->oldest = index;
+        }
+
+        if (entry->newer != ENTRY_NONE) {
+            store->entries[entry->newer].older = index;
+        } else {
+            store->newest = index;
+        }
+    }
+
+    memzero((uint8_t *)&store->entries[last], sizeof(Onion_Announce_Entry));
 }
 
-static void *_Nonnull onion_announce_entry_subarr_handler(void *_Nonnull arr, uint32_t index, uint32_t size)
+/** @brief Add an entry for @p public_key, which must not be stored yet, to a store that isn't full. */
+static uint32_t store_add(Onion_Announce_Store *_Nonnull store, const uint8_t *_Nonnull self_public_key,
+                          const uint8_t *_Nonnull public_key)
 {
-    Onion_Announce_Entry *entries = (Onion_Announce_Entry *)arr;
-    return &entries[index];
+    const uint32_t index = store->size;
+    ++store->size;
+
+    memcpy(store->entries[index].public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    store->buckets[store_find_bucket(store, public_key)] = index + 1;
+    store_heap_set(store, index, index);
+    store_heap_fix(store, self_public_key, index);
+    store_list_append(store, index);
+
+    return index;
 }
 
-static void *_Nullable onion_announce_entry_alloc_handler(const void *_Nonnull object, uint32_t size)
+/** @brief Allocate an empty store for @p capacity entries. */
+static bool store_init(Onion_Announce_Store *_Nonnull store, const Memory *_Nonnull mem, const Random *_Nonnull rng,
+                       uint32_t capacity)
 {
-    const Onion_Announce_Entry_Cmp *cmp = (const Onion_Announce_Entry_Cmp *)object;
-    Onion_Announce_Entry *tmp = (Onion_Announce_Entry *)mem_valloc(cmp->mem, size, sizeof(Onion_Announce_Entry));
-
-    if (tmp == nullptr) {
-        return nullptr;
+    const uint32_t bucket_bits = store_bucket_bits(capacity);
+    Onion_Announce_Entry *entries = (Onion_Announce_Entry *)mem_valloc(mem, capacity, sizeof(Onion_Announce_Entry));
+    uint32_t *heap = (uint32_t *)mem_valloc(mem, capacity, sizeof(uint32_t));
+    uint32_t *buckets = (uint32_t *)mem_valloc(mem, UINT32_C(1) << bucket_bits, sizeof(uint32_t));
+
+    if (entries == nullptr || heap == nullptr || buckets == nullptr) {
+        mem_delete(mem, buckets);
+        mem_delete(mem, heap);
+        mem_delete(mem, entries);
+        return false;
     }
 
-    return tmp;
+    store->entries = entries;
+    store->heap = heap;
+    store->buckets = buckets;
+    store->bucket_bits = bucket_bits;
+    store->hash_seed = random_u64(rng);
+    store->capacity = capacity;
+    store->size = 0;
+    store->oldest = ENTRY_NONE;
+    store->newest = ENTRY_NONE;
+    return true;
 }
 
-static void onion_announce_entry_delete_handler(const void *_Nonnull object, void *_Nonnull arr, uint32_t size)
+static void store_free(Onion_Announce_Store *_Nonnull store, const Memory *_Nonnull mem)
 {
-    const Onion_Announce_Entry_Cmp *cmp = (const Onion_Announce_Entry_Cmp *)object;
-    mem_delete(cmp->mem, arr);
+    mem_delete(mem, store->buckets);
+    mem_delete(mem, store->heap);
+    mem_delete(mem, store->entries);
 }
 
-static const Sort_Funcs onion_announce_entry_cmp_funcs = {
-    onion_announce_entry_less_handler,
-    onion_announce_entry_get_handler,
-    onion_announce_entry_set_handler,
-    onion_announce_entry_subarr_handler,
-    onion_announce_entry_alloc_handler,
-    onion_announce_entry_delete_handler,
-};
-
-static void sort_onion_announce_list(const Memory *_Nonnull mem, const Mono_Time *_Nonnull mono_time, Onion_Announce_Entry *_Nonnull list, unsigned int length,
-                                     const uint8_t *_Nonnull comp_public_key)
+/** @brief check if public key is in entries list
+ *
+ * return -1 if no
+ * return position in list if yes
+ */
+static int in_entries(const Onion_Announce *_Nonnull onion_a, const uint8_t *_Nonnull public_key)
 {
-    // Pass comp_public_key to sort with each Onion_Announce_Entry entry, so the
-    // comparison function can use it as the base of comparison.
-    const Onion_Announce_Entry_Cmp cmp = {
-        mem,
-        mono_time,
-        comp_public_key,
-    };
+    const Onion_Announce_Store *store = &onion_a->store;
+    const uint32_t index = store->buckets[store_find_bucket(store, public_key)];
 
-    merge_sort(list, length, &cmp, &onion_announce_entry_cmp_funcs);
+    if (index == 0
+            || mono_time_is_timeout(onion_a->mono_time, store->entries[index - 1].announce_time, ONION_ANNOUNCE_TIMEOUT)) {
+        return -1;
+    }
+
+    return (int)(index - 1);
 }
 
 /** @brief add entry to entries list
+ *
+ * If the list is full, the entry replaces the one farthest from our DHT key,
+ * if it is closer.
  *
  * return -1 if failure
  * return position if added
@@ -394,36 +554,63 @@ static void sort_onion_announce_list(const Memory *_Nonnull mem, const Mono_Time
 static int add_to_entries(Onion_Announce *_Nonnull onion_a, const IP_Port *_Nonnull ret_ip_port, const uint8_t *_Nonnull public_key, const uint8_t *_Nonnull data_public_key,
                           const uint8_t *_Nonnull ret)
 {
-    int pos = in_entries(onion_a, public_key);
+    Onion_Announce_Store *store = &onion_a->store;
+    const uint8_t *self_public_key = dht_get_self_public_key(onion_a->dht);
 
-    if (pos == -1) {
-        for (unsigned i = 0; i < ONION_ANNOUNCE_MAX_ENTRIES; ++i) {
-            if (mono_time_is_timeout(onion_a->mono_time, onion_a->entries[i].announce_time, ONION_ANNOUNCE_TIMEOUT)) {
-                pos = i;
-            }
-        }
+    while (store->oldest != ENTRY_NONE
+            && mono_time_is_timeout(onion_a->mono_time, store->entries[store->oldest].announce_time, ONION_ANNOUNCE_TIMEOUT)) {
+        store_remove(store, self_public_key, store->oldest);
     }
 
-    if (pos == -1) {
-        if (id_closest(dht_get_self_public_key(onion_a->dht), public_key, onion_a->entries[0].public_key) == 1) {
-            pos = 0;
+    const uint32_t found = store->buckets[store_find_bucket(store, public_key)];
+    uint32_t pos;
+
+    if (found != 0) {
+        pos = found - 1;
+        store_list_unlink(store, pos);
+        store_list_append(store, pos);
+    } else {
+        if (store->size == store->capacity) {
+            const uint32_t farthest = store->heap[0];
+
+            if (id_closest(self_public_key, public_key, store->entries[farthest].public_key) != 1) {
+                return -1;
+            }
+
+            store_remove(store, self_public_key, farthest);
         }
-    }
 
-    if (pos == -1) {
-        return -1;
+        pos = store_add(store, self_public_key, public_key);
     }
 
-    memcpy(onion_a->entries[pos].public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
-    onion_a->entries[pos].ret_ip_port = *ret_ip_port;
-    memcpy(onion_a->entries[pos].ret, ret, ONION_RETURN_3);
-    memcpy(onion_a->entries[pos].data_public_key, data_public_key, CRYPTO_PUBLIC_KEY_SIZE);
-    onion_a->entries[pos].announce_time = mono_time_get(onion_a->mono_time);
+    Onion_Announce_Entry *entry = &store->entries[pos];
+    entry->ret_ip_port = *ret_ip_port;
+    memcpy(entry->ret, ret, ONION_RETURN_3);
+    memcpy(entry->data_public_key, data_public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    entry->announce_time = mono_time_get(onion_a->mono_time);
 
-    sort_onion_announce_list(onion_a->mem, onion_a->mono_time,
-                             onion_a->entries, ONION_ANNOUNCE_MAX_ENTRIES,
-                             dht_get_self_public_key(onion_a->dht));
-    return in_entries(onion_a, public_key);
+    return (int)pos;
+}
+
+bool onion_announce_entry_add(Onion_Announce *onion_a, const uint8_t *public_key, const uint8_t *data_public_key)
+{
+    const IP_Port ret_ip_port = {{{0}}};
+    const uint8_t ret[ONION_RETURN_3] = {0};
+
+    onion_announce_lock(onion_a);
+    const int pos = add_to_entries(onion_a, &ret_ip_port, public_key, data_public_key, ret);
+    onion_announce_unlock(onion_a);
+
+    return pos != -1;
+}
+
+bool onion_announce_entry_exists(const Onion_Announce *onion_a, const uint8_t *public_key)
+{
+    onion_announce_lock(onion_a);
+    const int pos = in_entries(onion_a, public_key);
+    onion_announce_unlock(onion_a);
+
+    return pos != -1;
 }
 
 static void make_announce_payload_helper(const Onion_Announce *_Nonnull onion_a, const uint8_t *_Nonnull ping_id, uint8_t *_Nonnull response, int index,
@@ -435,8 +622,10 @@ static void make_announce_payload_helper(const Onion_Announce *_Nonnull onion_a,
         return;
     }
 
-    if (pk_equal(onion_a->entries[index].public_key, packet_public_key)) {
-        if (!pk_equal(onion_a->entries[index].data_public_key, data_public_key)) {
+    const Onion_Announce_Entry *entry = &onion_a->store.entries[index];
+
+    if (pk_equal(entry->public_key, packet_public_key)) {
+        if (!pk_equal(entry->data_public_key, data_public_key)) {
             response[0] = 0;
             memcpy(response + 1, ping_id, ONION_PING_ID_SIZE);
         } else {
@@ -445,7 +634,7 @@ static void make_announce_payload_helper(const Onion_Announce *_Nonnull onion_a,
         }
     } else {
         response[0] = 1;
-        memcpy(response + 1, onion_a->entries[index].data_public_key, CRYPTO_PUBLIC_KEY_SIZE);
+        memcpy(response + 1, entry->data_public_key, CRYPTO_PUBLIC_KEY_SIZE);
     }
 }
 
@@ -473,9 +662,9 @@ static int handle_announce_request_common(
     pack_extra_data_cb *_Nullable pack_extra_data_callback)
 {
     const uint8_t *packet_public_key = packet + 1 + CRYPTO_NONCE_SIZE;
-    const uint8_t *shared_key = shared_key_cache_lookup(onion_a->shared_keys_recv, packet_public_key);
+    uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
 
-    if (shared_key == nullptr) {
+    if (!shared_key_cache_get(onion_a->shared_keys_recv, packet_public_key, shared_key)) {
         /* Error looking up/deriving the shared key */
         return 1;
     }
@@ -507,16 +696,6 @@ static int handle_announce_request_common(
     memzero(&ping_id_data[CRYPTO_PUBLIC_KEY_SIZE + packed_len], SIZE_IPPORT - packed_len);
     const uint8_t *data_public_key = plain + ONION_PING_ID_SIZE + CRYPTO_PUBLIC_KEY_SIZE;
 
-    int index;
-
-    if (check_timed_auth(onion_a->mono_time, PING_ID_TIMEOUT, onion_a->hmac_key,
-                         ping_id_data, ping_id_data_len, plain)) {
-        index = add_to_entries(onion_a, source, packet_public_key, data_public_key,
-                               packet + (length - ONION_RETURN_3));
-    } else {
-        index = in_entries(onion_a, plain + ONION_PING_ID_SIZE);
-    }
-
     /* Respond with a announce response packet */
     Node_format nodes_list[MAX_SENT_NODES];
     const unsigned int num_nodes =
@@ -542,8 +721,22 @@ static int handle_announce_request_common(
     generate_timed_auth(onion_a->mono_time, PING_ID_TIMEOUT, onion_a->hmac_key,
                         ping_id_data, ping_id_data_len, ping_id);
 
+    onion_announce_lock(onion_a);
+
+    int index;
+
+    if (check_timed_auth(onion_a->mono_time, PING_ID_TIMEOUT, onion_a->hmac_key,
+                         ping_id_data, ping_id_data_len, plain)) {
+        index = add_to_entries(onion_a, source, packet_public_key, data_public_key,
+                               packet + (length - ONION_RETURN_3));
+    } else {
+        index = in_entries(onion_a, plain + ONION_PING_ID_SIZE);
+    }
+
     make_announce_payload_helper(onion_a, ping_id, response, index, packet_public_key, data_public_key);
 
+    onion_announce_unlock(onion_a);
+
     int nodes_length = 0;
 
     if (num_nodes != 0) {
@@ -564,11 +757,16 @@ static int handle_announce_request_common(
         response[1 + ONION_PING_ID_SIZE] = (uint8_t)num_nodes;
     }
 
-    const int extra_size = pack_extra_data_callback == nullptr ? 0
-                           : pack_extra_data_callback(onion_a->extra_data_object,
-                                   onion_a->log, onion_a->mem, onion_a->mono_time, num_nodes,
-                                   plain + ONION_MINIMAL_SIZE, length - ANNOUNCE_REQUEST_MIN_SIZE_RECV,
-                                   response, response_size, offset);
+    int extra_size = 0;
+
+    if (pack_extra_data_callback != nullptr) {
+        onion_announce_lock(onion_a);
+        extra_size = pack_extra_data_callback(onion_a->extra_data_object,
+                                              onion_a->log, onion_a->mem, onion_a->mono_time, num_nodes,
+                                              plain + ONION_MINIMAL_SIZE, length - ANNOUNCE_REQUEST_MIN_SIZE_RECV,
+                                              response, response_size, offset);
+        onion_announce_unlock(onion_a);
+    }
 
     if (extra_size == -1) {
         mem_delete(onion_a->mem, response);
@@ -661,8 +859,19 @@ static int handle_data_request(void *_Nonnull object, const IP_Port *_Nonnull so
         return 1;
     }
 
+    IP_Port ret_ip_port;
+    uint8_t ret[ONION_RETURN_3];
+
+    onion_announce_lock(onion_a);
     const int index = in_entries(onion_a, packet + 1);
 
+    if (index != -1) {
+        ret_ip_port = onion_a->store.entries[index].ret_ip_port;
+        memcpy(ret, onion_a->store.entries[index].ret, ONION_RETURN_3);
+    }
+
+    onion_announce_unlock(onion_a);
+
     if (index == -1) {
         return 1;
     }
@@ -672,8 +881,7 @@ static int handle_data_request(void *_Nonnull object, const IP_Port *_Nonnull so
     data[0] = NET_PACKET_ONION_DATA_RESPONSE;
     memcpy(data + 1, packet + 1 + CRYPTO_PUBLIC_KEY_SIZE, length - (1 + CRYPTO_PUBLIC_KEY_SIZE + ONION_RETURN_3));
 
-    if (send_onion_response(onion_a->log, onion_a->net, &onion_a->entries[index].ret_ip_port, data, data_size,
-                            onion_a->entries[index].ret) == -1) {
+    if (send_onion_response(onion_a->log, onion_a->net, &ret_ip_port, data, data_size, ret) == -1) {
         return 1;
     }
 
@@ -693,13 +901,19 @@ Onion_Announce *new_onion_announce(const Logger *log, const Memory *mem, const R
         return nullptr;
     }
 
-    Shared_Key_Cache *const shared_keys_recv = shared_key_cache_new(log, mono_time, mem, dht_get_self_secret_key(dht), KEYS_TIMEOUT, MAX_KEYS_PER_SLOT);
+    Shared_Key_Cache *const shared_keys_recv = shared_key_cache_new(log, mono_time, mem, dht_get_self_secret_key(dht), KEYS_TIMEOUT, SHARED_KEY_CACHE_DEFAULT_CAPACITY);
     if (shared_keys_recv == nullptr) {
         mem_delete(mem, onion_a);
         return nullptr;
     }
     onion_a->shared_keys_recv = shared_keys_recv;
 
+    if (!store_init(&onion_a->store, mem, rng, ONION_ANNOUNCE_MAX_ENTRIES)) {
+        shared_key_cache_free(shared_keys_recv);
+        mem_delete(mem, onion_a);
+        return nullptr;
+    }
+
     onion_a->log = log;
     onion_a->rng = rng;
     onion_a->mem = mem;
@@ -711,13 +925,90 @@ Onion_Announce *new_onion_announce(const Logger *log, const Memory *mem, const R
     onion_a->extra_data_object = nullptr;
     new_hmac_key(rng, onion_a->hmac_key);
 
-    networking_registerhandler(onion_a->net, NET_PACKET_ANNOUNCE_REQUEST, &handle_announce_request, onion_a);
-    networking_registerhandler(onion_a->net, NET_PACKET_ANNOUNCE_REQUEST_OLD, &handle_announce_request_old, onion_a);
-    networking_registerhandler(onion_a->net, NET_PACKET_ONION_DATA_REQUEST, &handle_data_request, onion_a);
+    networking_registerhandler_concurrent(onion_a->net, NET_PACKET_ANNOUNCE_REQUEST, &handle_announce_request, onion_a);
+    networking_registerhandler_concurrent(onion_a->net, NET_PACKET_ANNOUNCE_REQUEST_OLD, &handle_announce_request_old, onion_a);
+    networking_registerhandler_concurrent(onion_a->net, NET_PACKET_ONION_DATA_REQUEST, &handle_data_request, onion_a);
 
     return onion_a;
 }
 
+bool onion_announce_set_shared_key_capacity(Onion_Announce *onion_a, uint32_t capacity)
+{
+    return shared_key_cache_set_capacity(onion_a->shared_keys_recv, capacity);
+}
+
+bool onion_announce_enable_thread_safety(Onion_Announce *onion_a)
+{
+    if (!shared_key_cache_enable_thread_safety(onion_a->shared_keys_recv)) {
+        return false;
+    }
+
+    if (onion_a->lock != nullptr) {
+        return true;
+    }
+
+    pthread_mutex_t *const lock = (pthread_mutex_t *)mem_alloc(onion_a->mem, sizeof(pthread_mutex_t));
+
+    if (lock == nullptr || pthread_mutex_init(lock, nullptr) != 0) {
+        mem_delete(onion_a->mem, lock);
+        return false;
+    }
+
+    onion_a->lock = lock;
+    return true;
+}
+
+bool onion_announce_set_capacity(Onion_Announce *onion_a, uint32_t capacity)
+{
+    if (capacity < 1 || capacity > ONION_ANNOUNCE_MAX_CAPACITY) {
+        return false;
+    }
+
+    Onion_Announce_Store store;
+
+    if (!store_init(&store, onion_a->mem, onion_a->rng, capacity)) {
+        return false;
+    }
+
+    onion_announce_lock(onion_a);
+
+    Onion_Announce_Store *old_store = &onion_a->store;
+    const uint8_t *self_public_key = dht_get_self_public_key(onion_a->dht);
+
+    // Keep the closest entries, and move them over from the oldest.
+    while (old_store->size > capacity) {
+        store_remove(old_store, self_public_key, old_store->heap[0]);
+    }
+
+    for (uint32_t i = old_store->oldest; i != ENTRY_NONE; i = old_store->entries[i].newer) {
+        const Onion_Announce_Entry *old_entry = &old_store->entries[i];
+        const uint32_t pos = store_add(&store, self_public_key, old_entry->public_key);
+        Onion_Announce_Entry *entry = &store.entries[pos];
+        entry->ret_ip_port = old_entry->ret_ip_port;
+        memcpy(entry->ret, old_entry->ret, ONION_RETURN_3);
+        memcpy(entry->data_public_key, old_entry->data_public_key, CRYPTO_PUBLIC_KEY_SIZE);
+        entry->announce_time = old_entry->announce_time;
+    }
+
+    store_free(old_store, onion_a->mem);
+    onion_a->store = store;
+
+    onion_announce_unlock(onion_a);
+    return true;
+}
+
+void onion_announce_add_shared_key_stats(const Onion_Announce *onion_a, Shared_Key_Cache_Stats *stats)
+{
+    shared_key_cache_add_stats(onion_a->shared_keys_recv, stats);
+}
+
+void onion_announce_register_key_agreement(Onion_Announce *onion_a, Key_Agreement *ka)
+{
+    const uint16_t public_key_offset = 1 + CRYPTO_NONCE_SIZE;
+    key_agreement_register(ka, NET_PACKET_ANNOUNCE_REQUEST, onion_a->shared_keys_recv, public_key_offset);
+    key_agreement_register(ka, NET_PACKET_ANNOUNCE_REQUEST_OLD, onion_a->shared_keys_recv, public_key_offset);
+}
+
 void kill_onion_announce(Onion_Announce *onion_a)
 {
     if (onion_a == nullptr) {
@@ -730,6 +1021,12 @@ void kill_onion_announce(Onion_Announce *onion_a)
 
     crypto_memzero(onion_a->hmac_key, CRYPTO_HMAC_KEY_SIZE);
     shared_key_cache_free(onion_a->shared_keys_recv);
+    store_free(&onion_a->store, onion_a->mem);
+
+    if (onion_a->lock != nullptr) {
+        pthread_mutex_destroy(onion_a->lock);
+        mem_delete(onion_a->mem, onion_a->lock);
+    }
 
     mem_delete(onion_a->mem, onion_a);
 }
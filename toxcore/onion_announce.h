@@ -14,15 +14,20 @@
 #include "DHT.h"
 #include "attributes.h"
 #include "crypto_core.h"
+#include "key_agreement.h"
 #include "logger.h"
 #include "mem.h"
 #include "mono_time.h"
 #include "net.h"
 #include "network.h"
 #include "onion.h"
+#include "shared_key_cache.h"
 #include "timed_auth.h"
 
+/** Default number of announcements stored, see `onion_announce_set_capacity`. */
 #define ONION_ANNOUNCE_MAX_ENTRIES 160
+/** Largest supported number of stored announcements, about 320 MiB of entries. */
+#define ONION_ANNOUNCE_MAX_CAPACITY (UINT32_C(1) << 20)
 #define ONION_ANNOUNCE_TIMEOUT 300
 #define ONION_PING_ID_SIZE TIMED_AUTH_SIZE
 #define ONION_MAX_EXTRA_DATA_SIZE 136
@@ -51,8 +56,8 @@ extern "C" {
 typedef struct Onion_Announce Onion_Announce;
 
 /** These two are not public; they are for tests only! */
-uint8_t *_Nullable onion_announce_entry_public_key(Onion_Announce *_Nonnull onion_a, uint32_t entry);
-void onion_announce_entry_set_time(Onion_Announce *_Nonnull onion_a, uint32_t entry, uint64_t announce_time);
+bool onion_announce_entry_add(Onion_Announce *_Nonnull onion_a, const uint8_t *_Nonnull public_key, const uint8_t *_Nonnull data_public_key);
+bool onion_announce_entry_exists(const Onion_Announce *_Nonnull onion_a, const uint8_t *_Nonnull public_key);
 
 /** @brief Create an onion announce request packet in packet of max_packet_length.
  *
@@ -136,6 +141,39 @@ Onion_Announce *_Nullable new_onion_announce(const Logger *_Nonnull log, const M
 
 void kill_onion_announce(Onion_Announce *_Nullable onion_a);
 
+/**
+ * @brief Sets the number of announcements stored, keeping the ones closest to
+ *   our DHT key if there are too many.
+ *
+ * @retval false if the capacity is 0 or above `ONION_ANNOUNCE_MAX_CAPACITY`,
+ *   or allocation failed, in which case the store is unchanged.
+ */
+bool onion_announce_set_capacity(Onion_Announce *_Nonnull onion_a, uint32_t capacity);
+
+/**
+ * @brief Sets the capacity of the shared key cache for announce requests. See
+ *   `shared_key_cache_set_capacity`.
+ *
+ * Must be called before other threads use the onion announce.
+ */
+bool onion_announce_set_shared_key_capacity(Onion_Announce *_Nonnull onion_a, uint32_t capacity);
+
+/**
+ * @brief Allocates the locks that let the announce and data request handlers
+ *   run on other threads (see `networking_set_dispatcher`).
+ *
+ * Must be called before other threads use the onion announce.
+ *
+ * @retval false if a lock could not be allocated.
+ */
+bool onion_announce_enable_thread_safety(Onion_Announce *_Nonnull onion_a);
+
+/** @brief Adds the statistics of the shared key cache for announce requests to @p stats. */
+void onion_announce_add_shared_key_stats(const Onion_Announce *_Nonnull onion_a, Shared_Key_Cache_Stats *_Nonnull stats);
+
+/** @brief Lets @p ka compute the shared keys of announce requests. */
+void onion_announce_register_key_agreement(Onion_Announce *_Nonnull onion_a, Key_Agreement *_Nonnull ka);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -0,0 +1,197 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "DHT.h"
+#include "crypto_core.h"
+#include "logger.h"
+#include "mono_time.h"
+#include "network.h"
+#include "onion.h"
+#include "onion_announce.h"
+#include "os_memory.h"
+#include "os_network.h"
+#include "os_random.h"
+
+namespace {
+
+using PublicKey = std::array<uint8_t, CRYPTO_PUBLIC_KEY_SIZE>;
+using Packet = std::array<uint8_t, ONION_ANNOUNCE_REQUEST_MIN_SIZE + ONION_RETURN_3>;
+
+/** Number of distinct clients sending announce requests. */
+constexpr std::size_t kNumClients = 256;
+
+/**
+ * @brief Announce handling cost with a full announce store.
+ *
+ * The argument is the store capacity: the default of 160 entries, and the
+ * 10k and 100k a bootstrap node with spare memory can hold.
+ */
+class OnionAnnounceBenchFixture : public benchmark::Fixture {
+public:
+    void SetUp(::benchmark::State &state) override
+    {
+        mem = os_memory();
+        rng = os_random();
+        ns = os_network();
+        if (rng == nullptr || ns == nullptr) {
+            setup_error = "os_random or os_network failed";
+            return;
+        }
+
+        log = logger_new(mem);
+        mono_time = mono_time_new(mem, nullptr, nullptr);
+        net = new_networking_no_udp(log, mem, ns);
+        if (log == nullptr || mono_time == nullptr || net == nullptr) {
+            setup_error = "failed to create networking";
+            return;
+        }
+
+        dht = new_dht(log, mem, rng, ns, mono_time, net, true, true);
+        onion_a = dht == nullptr ? nullptr : new_onion_announce(log, mem, rng, mono_time, dht, net);
+        if (onion_a == nullptr) {
+            setup_error = "new_onion_announce failed";
+            return;
+        }
+
+        const uint32_t capacity = static_cast<uint32_t>(state.range(0));
+        if (!onion_announce_set_capacity(onion_a, capacity)) {
+            setup_error = "onion_announce_set_capacity failed";
+            return;
+        }
+
+        stored.resize(capacity);
+        for (PublicKey &pk : stored) {
+            random_bytes(rng, pk.data(), pk.size());
+            onion_announce_entry_add(onion_a, pk.data(), pk.data());
+        }
+    }
+
+    void TearDown(const ::benchmark::State &state) override
+    {
+        kill_onion_announce(onion_a);
+        kill_dht(dht);
+        kill_networking(net);
+        mono_time_free(mem, mono_time);
+        logger_kill(log);
+        onion_a = nullptr;
+        dht = nullptr;
+        net = nullptr;
+        mono_time = nullptr;
+        log = nullptr;
+        stored.clear();
+    }
+
+protected:
+    const Memory *mem = nullptr;
+    const Random *rng = nullptr;
+    const Network *ns = nullptr;
+    Logger *log = nullptr;
+    Mono_Time *mono_time = nullptr;
+    Networking_Core *net = nullptr;
+    DHT *dht = nullptr;
+    Onion_Announce *onion_a = nullptr;
+    std::vector<PublicKey> stored;
+    std::string setup_error;
+};
+
+/**
+ * @brief Announce requests searching for stored keys, through the packet
+ *   handler: decryption, store lookup, close nodes and the encrypted response.
+ *
+ * The shared keys of the clients are cached after the first round, as for
+ * clients that announce periodically.
+ */
+BENCHMARK_DEFINE_F(OnionAnnounceBenchFixture, AnnounceRequest)(benchmark::State &state)
+{
+    if (!setup_error.empty()) {
+        state.SkipWithError(setup_error.c_str());
+        return;
+    }
+
+    const uint8_t *self_pk = dht_get_self_public_key(dht);
+    const uint8_t ping_id[ONION_PING_ID_SIZE] = {0};
+    std::vector<Packet> packets(kNumClients);
+
+    for (std::size_t i = 0; i < packets.size(); ++i) {
+        uint8_t client_pk[CRYPTO_PUBLIC_KEY_SIZE];
+        uint8_t client_sk[CRYPTO_SECRET_KEY_SIZE];
+        crypto_new_keypair(rng, client_pk, client_sk);
+
+        const uint8_t *search_pk = stored[i % stored.size()].data();
+        if (create_announce_request(mem, rng, packets[i].data(), ONION_ANNOUNCE_REQUEST_MIN_SIZE, self_pk, client_pk,
+                                    client_sk, ping_id, search_pk, client_pk, i) != ONION_ANNOUNCE_REQUEST_MIN_SIZE) {
+            state.SkipWithError("create_announce_request failed");
+            return;
+        }
+
+        random_bytes(rng, packets[i].data() + ONION_ANNOUNCE_REQUEST_MIN_SIZE, ONION_RETURN_3);
+    }
+
+    IP_Port source{};
+    source.ip.family = net_family_ipv4();
+    source.ip.ip.v4 = get_ip4_loopback();
+    source.port = net_htons(33445);
+
+    std::size_t next = 0;
+
+    for (auto _ : state) {
+        const Packet &packet = packets[next];
+        networking_handle_packet(net, &source, packet.data(), packet.size(), nullptr);
+        next = (next + 1) % packets.size();
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_REGISTER_F(OnionAnnounceBenchFixture, AnnounceRequest)
+    ->ArgName("entries")
+    ->Arg(ONION_ANNOUNCE_MAX_ENTRIES)
+    ->Arg(10000)
+    ->Arg(100000);
+
+/**
+ * @brief Storing announcements from new keys in a full store: each one
+ *   replaces the farthest entry or is rejected.
+ */
+BENCHMARK_DEFINE_F(OnionAnnounceBenchFixture, StoreAnnouncement)(benchmark::State &state)
+{
+    if (!setup_error.empty()) {
+        state.SkipWithError(setup_error.c_str());
+        return;
+    }
+
+    std::vector<PublicKey> keys(4096);
+    for (PublicKey &pk : keys) {
+        random_bytes(rng, pk.data(), pk.size());
+    }
+
+    std::size_t next = 0;
+    int64_t stored_count = 0;
+
+    for (auto _ : state) {
+        const PublicKey &pk = keys[next];
+        stored_count += onion_announce_entry_add(onion_a, pk.data(), pk.data()) ? 1 : 0;
+        next = (next + 1) % keys.size();
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.counters["stored"] = benchmark::Counter(static_cast<double>(stored_count), benchmark::Counter::kAvgIterations);
+}
+
+BENCHMARK_REGISTER_F(OnionAnnounceBenchFixture, StoreAnnouncement)
+    ->ArgName("entries")
+    ->Arg(ONION_ANNOUNCE_MAX_ENTRIES)
+    ->Arg(10000)
+    ->Arg(100000);
+
+}  // namespace
+
+BENCHMARK_MAIN();
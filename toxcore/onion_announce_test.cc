@@ -0,0 +1,174 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+#include "onion_announce.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "../testing/support/public/simulated_environment.hh"
+#include "DHT.h"
+#include "DHT_test_util.hh"
+#include "crypto_core.h"
+#include "mono_time.h"
+
+namespace {
+
+using PublicKey = std::array<std::uint8_t, CRYPTO_PUBLIC_KEY_SIZE>;
+
+class OnionAnnounceTest : public ::testing::Test {
+protected:
+    OnionAnnounceTest()
+        : dht_(env_, 33445)
+        , onion_a_(new_onion_announce(dht_.logger(), &dht_.node().c_memory, &dht_.node().c_random,
+                       dht_.mono_time(), dht_.get_dht(), dht_.networking()),
+              [](Onion_Announce *a) { kill_onion_announce(a); })
+    {
+    }
+
+    void SetUp() override { ASSERT_NE(onion_a_, nullptr); }
+
+    Onion_Announce *onion_a() { return onion_a_.get(); }
+
+    std::vector<PublicKey> random_keys(std::size_t count)
+    {
+        std::vector<PublicKey> keys(count);
+
+        for (PublicKey &pk : keys) {
+            random_bytes(&dht_.node().c_random, pk.data(), pk.size());
+        }
+
+        return keys;
+    }
+
+    /** @brief Sorts @p keys by distance to our DHT key, closest first. */
+    void sort_by_distance(std::vector<PublicKey> &keys)
+    {
+        const std::uint8_t *self_pk = dht_get_self_public_key(dht_.get_dht());
+        std::sort(keys.begin(), keys.end(), [self_pk](const PublicKey &a, const PublicKey &b) {
+            return id_closest(self_pk, a.data(), b.data()) == 1;
+        });
+    }
+
+    void add_all(const std::vector<PublicKey> &keys)
+    {
+        for (const PublicKey &pk : keys) {
+            onion_announce_entry_add(onion_a(), pk.data(), pk.data());
+        }
+    }
+
+    /** @brief Expects exactly the first @p count of the sorted @p keys to be stored. */
+    void expect_closest_stored(const std::vector<PublicKey> &keys, std::size_t count)
+    {
+        for (std::size_t i = 0; i < keys.size(); ++i) {
+            EXPECT_EQ(onion_announce_entry_exists(onion_a(), keys[i].data()), i < count) << "key " << i;
+        }
+    }
+
+    void advance_seconds(std::uint64_t seconds)
+    {
+        env_.advance_time(seconds * 1000);
+        mono_time_update(dht_.mono_time());
+    }
+
+    tox::test::SimulatedEnvironment env_{12345};
+    WrappedDHT dht_;
+    std::unique_ptr<Onion_Announce, void (*)(Onion_Announce *)> onion_a_;
+};
+
+TEST_F(OnionAnnounceTest, AddedEntriesAreFound)
+{
+    const std::vector<PublicKey> keys = random_keys(ONION_ANNOUNCE_MAX_ENTRIES);
+
+    for (const PublicKey &pk : keys) {
+        EXPECT_TRUE(onion_announce_entry_add(onion_a(), pk.data(), pk.data()));
+    }
+
+    for (const PublicKey &pk : keys) {
+        EXPECT_TRUE(onion_announce_entry_exists(onion_a(), pk.data()));
+    }
+
+    EXPECT_FALSE(onion_announce_entry_exists(onion_a(), random_keys(1)[0].data()));
+}
+
+TEST_F(OnionAnnounceTest, FullStoreKeepsTheClosestKeys)
+{
+    ASSERT_TRUE(onion_announce_set_capacity(onion_a(), 100));
+
+    std::vector<PublicKey> keys = random_keys(2000);
+    add_all(keys);
+
+    sort_by_distance(keys);
+    expect_closest_stored(keys, 100);
+}
+
+TEST_F(OnionAnnounceTest, FartherKeysAreRejectedWhenFull)
+{
+    ASSERT_TRUE(onion_announce_set_capacity(onion_a(), 10));
+
+    std::vector<PublicKey> keys = random_keys(11);
+    sort_by_distance(keys);
+
+    for (std::size_t i = 0; i < 10; ++i) {
+        EXPECT_TRUE(onion_announce_entry_add(onion_a(), keys[i].data(), keys[i].data()));
+    }
+
+    EXPECT_FALSE(onion_announce_entry_add(onion_a(), keys[10].data(), keys[10].data()));
+    // Announcing again refreshes the entry instead of taking another one.
+    EXPECT_TRUE(onion_announce_entry_add(onion_a(), keys[9].data(), keys[9].data()));
+    expect_closest_stored(keys, 10);
+}
+
+TEST_F(OnionAnnounceTest, TimedOutEntriesMakeRoom)
+{
+    ASSERT_TRUE(onion_announce_set_capacity(onion_a(), 10));
+
+    std::vector<PublicKey> keys = random_keys(11);
+    sort_by_distance(keys);
+    add_all(std::vector<PublicKey>(keys.begin(), keys.begin() + 10));
+
+    advance_seconds(ONION_ANNOUNCE_TIMEOUT / 2);
+    // Keep the closest one alive.
+    ASSERT_TRUE(onion_announce_entry_add(onion_a(), keys[0].data(), keys[0].data()));
+    advance_seconds(ONION_ANNOUNCE_TIMEOUT / 2 + 2);
+
+    EXPECT_TRUE(onion_announce_entry_exists(onion_a(), keys[0].data()));
+    EXPECT_FALSE(onion_announce_entry_exists(onion_a(), keys[1].data()));
+
+    EXPECT_TRUE(onion_announce_entry_add(onion_a(), keys[10].data(), keys[10].data()));
+    EXPECT_TRUE(onion_announce_entry_exists(onion_a(), keys[0].data()));
+    EXPECT_TRUE(onion_announce_entry_exists(onion_a(), keys[10].data()));
+}
+
+TEST_F(OnionAnnounceTest, ShrinkingKeepsTheClosestKeys)
+{
+    ASSERT_TRUE(onion_announce_set_capacity(onion_a(), 64));
+
+    std::vector<PublicKey> keys = random_keys(64);
+    add_all(keys);
+    sort_by_distance(keys);
+
+    ASSERT_TRUE(onion_announce_set_capacity(onion_a(), 5));
+    expect_closest_stored(keys, 5);
+
+    ASSERT_TRUE(onion_announce_set_capacity(onion_a(), 1000));
+    expect_closest_stored(keys, 5);
+
+    add_all(keys);
+    expect_closest_stored(keys, keys.size());
+}
+
+TEST_F(OnionAnnounceTest, CapacityMustBeInRange)
+{
+    EXPECT_FALSE(onion_announce_set_capacity(onion_a(), 0));
+    EXPECT_FALSE(onion_announce_set_capacity(onion_a(), ONION_ANNOUNCE_MAX_CAPACITY + 1));
+    EXPECT_TRUE(onion_announce_set_capacity(onion_a(), 1));
+}
+
+}  // namespace
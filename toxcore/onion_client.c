@@ -31,6 +31,7 @@
 #include "ping_array.h"
 #include "sort.h"
 #include "timed_auth.h"
+#include "timer_wheel.h"
 #include "util.h"
 
 /** @brief defines for the array size and timeout for onion announce packets. */
@@ -131,6 +132,9 @@ struct Onion_Client {
 
     BS_List        friends_lookup;
 
+    /* When each friend next needs `do_friend`, keyed by friend number. */
+    Timer_Wheel   *_Nonnull friend_timers;
+
     Onion_Node clients_announce_list[MAX_ONION_CLIENTS_ANNOUNCE];
     uint64_t last_announce;
 
@@ -167,6 +171,12 @@ struct Onion_Client {
     void *_Nullable group_announce_response_user_data;
 };
 
+/** @brief Make the next `do_onion_client` look at this friend. */
+static void schedule_friend(const Onion_Client *_Nonnull onion_c, uint32_t friend_num)
+{
+    timer_wheel_set_earlier(onion_c->friend_timers, friend_num, mono_time_get_ms(onion_c->mono_time));
+}
+
 uint32_t onion_get_friend_count(const Onion_Client *const onion_c)
 {
     return onion_c->num_friends;
@@ -812,6 +822,7 @@ static int client_add_to_list(Onion_Client *_Nonnull onion_c, uint32_t num, cons
         node_list = onion_c->friends_list[num - 1].clients_list;
         reference_id = onion_c->friends_list[num - 1].real_public_key;
         list_length = MAX_ONION_CLIENTS;
+        schedule_friend(onion_c, num - 1);
     }
 
     sort_onion_node_list(onion_c->mem, onion_c->mono_time, node_list, list_length, reference_id);
@@ -1570,6 +1581,7 @@ int onion_addfriend(Onion_Client *onion_c, const uint8_t *public_key)
         return -1;
     }
 
+    schedule_friend(onion_c, index);
     return index;
 }
 
@@ -1597,6 +1609,7 @@ int onion_delfriend(Onion_Client *onion_c, int friend_num)
     }
 
     crypto_memzero(&onion_c->friends_list[friend_num], sizeof(Onion_Friend));
+    timer_wheel_cancel(onion_c->friend_timers, (uint32_t)friend_num);
     uint32_t i;
 
     for (i = onion_c->num_friends; i != 0; --i) {
@@ -1675,6 +1688,7 @@ int onion_set_friend_dht_pubkey(Onion_Client *onion_c, int friend_num, const uin
 
     onion_c->friends_list[friend_num].know_dht_public_key = true;
     memcpy(onion_c->friends_list[friend_num].dht_public_key, dht_key, CRYPTO_PUBLIC_KEY_SIZE);
+    schedule_friend(onion_c, friend_num);
 
     return 0;
 }
@@ -1741,6 +1755,7 @@ int onion_set_friend_online(Onion_Client *onion_c, int friend_num, bool is_onlin
         onion_c->friends_list[friend_num].run_count = 0;
     }
 
+    schedule_friend(onion_c, friend_num);
     return 0;
 }
 
@@ -1770,6 +1785,20 @@ static void populate_path_nodes(Onion_Client *_Nonnull onion_c)
 /* Max exponent when calculating the announce request interval */
 #define MAX_RUN_COUNT_EXPONENT 12
 
+/** @brief How often, in seconds, we ping each of the friend's nodes. */
+static uint32_t friend_announce_interval(const Onion_Friend *_Nonnull o_friend)
+{
+    if (o_friend->run_count <= ANNOUNCE_FRIEND_RUN_COUNT_BEGINNING) {
+        return ANNOUNCE_FRIEND_NEW_INTERVAL;
+    }
+
+    // how often we ping a node for a friend depends on how many times we've already tried.
+    // the interval increases exponentially, as the longer a friend has been offline, the less
+    // likely the case is that they're online and failed to find us
+    const uint32_t c = 1 << min_u32(MAX_RUN_COUNT_EXPONENT, o_friend->run_count - 2);
+    return min_u32(c, ANNOUNCE_FRIEND_MAX_INTERVAL);
+}
+
 static void do_friend(Onion_Client *_Nonnull onion_c, uint32_t friendnum)
 {
     if (friendnum >= onion_c->num_friends) {
@@ -1782,20 +1811,10 @@ static void do_friend(Onion_Client *_Nonnull onion_c, uint32_t friendnum)
         return;
     }
 
-    uint32_t interval;
+    const uint32_t interval = friend_announce_interval(o_friend);
     const uint64_t tm = mono_time_get(onion_c->mono_time);
     const bool friend_is_new = o_friend->run_count <= ANNOUNCE_FRIEND_RUN_COUNT_BEGINNING;
 
-    if (!friend_is_new) {
-        // how often we ping a node for a friend depends on how many times we've already tried.
-        // the interval increases exponentially, as the longer a friend has been offline, the less
-        // likely the case is that they're online and failed to find us
-        const uint32_t c = 1 << min_u32(MAX_RUN_COUNT_EXPONENT, o_friend->run_count - 2);
-        interval = min_u32(c, ANNOUNCE_FRIEND_MAX_INTERVAL);
-    } else {
-        interval = ANNOUNCE_FRIEND_NEW_INTERVAL;
-    }
-
     if (o_friend->is_online) {
         return;
     }
@@ -1889,6 +1908,53 @@ static void do_friend(Onion_Client *_Nonnull onion_c, uint32_t friendnum)
     }
 }
 
+/**
+ * @brief The second in which `do_friend` next has something to do for this friend.
+ *
+ * Mirrors the timeouts checked by `do_friend`. Anything that can make one of
+ * them earlier from outside, like a new node or the friend going offline,
+ * calls `schedule_friend` instead.
+ */
+static uint64_t friend_next_run(const Mono_Time *_Nonnull mono_time, const Onion_Friend *_Nonnull o_friend, uint64_t tm)
+{
+    if (!o_friend->is_valid || o_friend->is_online) {
+        return TIMER_WHEEL_NEVER;
+    }
+
+    const uint32_t interval = friend_announce_interval(o_friend);
+    uint64_t next = min_u64(o_friend->last_dht_pk_onion_sent + ONION_DHTPK_SEND_INTERVAL,
+                            o_friend->last_dht_pk_dht_sent + DHT_DHTPK_SEND_INTERVAL);
+    uint16_t count = 0;
+
+    for (unsigned i = 0; i < MAX_ONION_CLIENTS; ++i) {
+        const Onion_Node *node = &o_friend->clients_list[i];
+
+        if (onion_node_timed_out(node, mono_time)) {
+            continue;
+        }
+
+        ++count;
+
+        if (node->pings_since_last_response >= ONION_NODE_MAX_PINGS) {
+            /* Not pinged any more, but counts as alive until it times out. */
+            next = min_u64(next, node->last_pinged + ONION_NODE_TIMEOUT);
+            continue;
+        }
+
+        next = min_u64(next, max_u64(o_friend->time_last_pinged + interval / (MAX_ONION_CLIENTS / 2),
+                                     node->last_pinged + interval));
+    }
+
+    if (count <= MAX_ONION_CLIENTS / 2) {
+        next = tm + 1;
+    } else if (count < MAX_ONION_CLIENTS) {
+        next = min_u64(next, o_friend->last_populated + ANNOUNCE_POPULATE_TIMEOUT);
+    }
+
+    /* Failed sends are retried once a second, as `do_onion_client` does. */
+    return max_u64(next, tm + 1);
+}
+
 /** Function to call when onion data packet with contents beginning with byte is received. */
 void oniondata_registerhandler(Onion_Client *onion_c, uint8_t byte, oniondata_handler_cb *cb, void *object)
 {
@@ -2111,6 +2177,7 @@ static void reset_friend_run_counts(Onion_Client *_Nonnull onion_c)
 
         if (o_friend->is_valid) {
             o_friend->run_count = 0;
+            schedule_friend(onion_c, i);
         }
     }
 }
@@ -2164,9 +2231,23 @@ void do_onion_client(Onion_Client *onion_c)
         set_tcp_onion_status(nc_get_tcp_c(onion_c->c), !onion_c->udp_connected);
     }
 
+    /* Friends that came due while we were not connected stay due until we are. */
+    timer_wheel_advance(onion_c->friend_timers, mono_time_get_ms(onion_c->mono_time));
+
     if (onion_connection_status(onion_c) != ONION_CONNECTION_STATUS_NONE) {
-        for (uint32_t i = 0; i < onion_c->num_friends; ++i) {
-            do_friend(onion_c, i);
+        const uint64_t tm = mono_time_get(onion_c->mono_time);
+        uint32_t friendnum;
+
+        while (timer_wheel_pop(onion_c->friend_timers, &friendnum)) {
+            do_friend(onion_c, friendnum);
+
+            if (friendnum < onion_c->num_friends) {
+                const uint64_t next = friend_next_run(onion_c->mono_time, &onion_c->friends_list[friendnum], tm);
+
+                if (next != TIMER_WHEEL_NEVER) {
+                    timer_wheel_set(onion_c->friend_timers, friendnum, next * 1000);
+                }
+            }
         }
     }
 
@@ -2177,6 +2258,18 @@ void do_onion_client(Onion_Client *onion_c)
     onion_c->last_run = mono_time_get(onion_c->mono_time);
 }
 
+uint32_t onion_client_run_interval(const Onion_Client *onion_c)
+{
+    /* Self announces and path upkeep run once a second, friends never more often. */
+    const uint64_t now = mono_time_get_ms(onion_c->mono_time);
+
+    if (onion_c->last_run != now / 1000) {
+        return 0;
+    }
+
+    return (uint32_t)(1000 - now % 1000);
+}
+
 Onion_Client *new_onion_client(const Logger *logger, const Memory *mem, const Random *rng, const Mono_Time *mono_time, Net_Crypto *c,
                                DHT *dht, Networking_Core *net)
 {
@@ -2198,6 +2291,15 @@ Onion_Client *new_onion_client(const Logger *logger, const Memory *mem, const Ra
     }
     onion_c->announce_ping_array = temp_ping_array;
 
+    Timer_Wheel *const friend_timers = timer_wheel_new(mem, mono_time_get_ms(mono_time));
+
+    if (friend_timers == nullptr) {
+        ping_array_kill(temp_ping_array);
+        mem_delete(mem, onion_c);
+        return nullptr;
+    }
+    onion_c->friend_timers = friend_timers;
+
     onion_c->mono_time = mono_time;
     onion_c->logger = logger;
     onion_c->rng = rng;
@@ -2229,6 +2331,7 @@ void kill_onion_client(Onion_Client *onion_c)
     const Memory *mem = onion_c->mem;
 
     ping_array_kill(onion_c->announce_ping_array);
+    timer_wheel_kill(onion_c->friend_timers);
     realloc_onion_friends(onion_c, 0);
     bs_list_free(&onion_c->friends_lookup);
     networking_registerhandler(onion_c->net, NET_PACKET_ANNOUNCE_RESPONSE, nullptr, nullptr);
@@ -197,6 +197,9 @@ typedef bool onion_group_announce_cb(Onion_Client *_Nonnull onion_c, uint32_t se
 void onion_group_announce_register(Onion_Client *_Nonnull onion_c, onion_group_announce_cb *_Nullable func, void *_Nullable user_data);
 void do_onion_client(Onion_Client *_Nonnull onion_c);
 
+/** return the optimal interval in ms for running do_onion_client. */
+uint32_t onion_client_run_interval(const Onion_Client *_Nonnull onion_c);
+
 Onion_Client *_Nullable new_onion_client(const Logger *_Nonnull logger, const Memory *_Nonnull mem, const Random *_Nonnull rng, const Mono_Time *_Nonnull mono_time, Net_Crypto *_Nonnull c,
         DHT *_Nonnull dht, Networking_Core *_Nonnull net);
 
@@ -12,6 +12,11 @@
 #define __EXTENSIONS__ 1
 #endif /* __sun */
 
+// For recvmmsg/sendmmsg on Linux.
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif /* defined(__linux__) && !defined(_GNU_SOURCE) */
+
 // For Linux (and some BSDs).
 #ifndef _XOPEN_SOURCE
 #define _XOPEN_SOURCE 700
@@ -49,6 +54,7 @@
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #ifdef __sun
@@ -363,6 +369,19 @@ static Socket sys_accept(void *_Nullable obj, Socket sock)
     return net_socket_from_native(accept(net_socket_to_native(sock), nullptr, nullptr));
 }
 
+static int sys_getpeername(void *_Nullable obj, Socket sock, IP_Port *_Nonnull addr)
+{
+    Network_Addr naddr = {{0}};
+    socklen_t addrlen = sizeof(naddr.addr);
+
+    if (getpeername(net_socket_to_native(sock), (struct sockaddr *)&naddr.addr, &addrlen) != 0) {
+        return -1;
+    }
+
+    naddr.size = addrlen;
+    return network_addr_to_ip_port(&naddr, addr) ? 0 : -1;
+}
+
 static int sys_bind(void *_Nullable obj, Socket sock, const IP_Port *_Nonnull addr)
 {
     Network_Addr naddr;
@@ -436,6 +455,108 @@ static int sys_recvfrom(void *_Nullable obj, Socket sock, uint8_t *_Nonnull buf,
     return ret;
 }
 
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+#define OS_NETWORK_HAVE_MMSG
+#endif /* defined(__linux__) && defined(MSG_WAITFORONE) */
+
+#ifdef OS_NETWORK_HAVE_MMSG
+static int sys_recvfrom_batch(void *_Nullable obj, Socket sock, Net_Recv_Msg *_Nonnull msgs, size_t count)
+{
+    struct mmsghdr hdrs[NET_MAX_BATCH_SIZE];
+    struct iovec iovs[NET_MAX_BATCH_SIZE];
+    Network_Addr naddrs[NET_MAX_BATCH_SIZE];
+
+    if (count > NET_MAX_BATCH_SIZE) {
+        count = NET_MAX_BATCH_SIZE;
+    }
+
+    memset(hdrs, 0, count * sizeof(hdrs[0]));
+
+    for (size_t i = 0; i < count; ++i) {
+        iovs[i].iov_base = msgs[i].buf;
+        iovs[i].iov_len = msgs[i].size;
+        hdrs[i].msg_hdr.msg_name = &naddrs[i].addr;
+        hdrs[i].msg_hdr.msg_namelen = sizeof(naddrs[i].addr);
+        hdrs[i].msg_hdr.msg_iov = &iovs[i];
+        hdrs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    const int ret = recvmmsg(net_socket_to_native(sock), hdrs, (unsigned int)count, 0, nullptr);
+
+    for (int i = 0; i < ret; ++i) {
+        naddrs[i].size = hdrs[i].msg_hdr.msg_namelen;
+        msgs[i].length = hdrs[i].msg_len;
+
+        if (!network_addr_to_ip_port(&naddrs[i], &msgs[i].addr)) {
+            // Ignore packets from unknown families
+            msgs[i].length = 0;
+        }
+    }
+
+    return ret;
+}
+
+static int sys_sendto_batch(void *_Nullable obj, Socket sock, const Net_Send_Msg *_Nonnull msgs, size_t count)
+{
+    struct mmsghdr hdrs[NET_MAX_BATCH_SIZE];
+    struct iovec iovs[NET_MAX_BATCH_SIZE];
+    Network_Addr naddrs[NET_MAX_BATCH_SIZE];
+
+    if (count > NET_MAX_BATCH_SIZE) {
+        count = NET_MAX_BATCH_SIZE;
+    }
+
+    memset(hdrs, 0, count * sizeof(hdrs[0]));
+
+    for (size_t i = 0; i < count; ++i) {
+        ip_port_to_network_addr(&msgs[i].addr, &naddrs[i]);
+
+        if (naddrs[i].size == 0) {
+            // Send everything before the invalid address; the caller skips it.
+            count = i;
+            break;
+        }
+
+        iovs[i].iov_base = (void *)(uintptr_t)msgs[i].buf;
+        iovs[i].iov_len = msgs[i].length;
+        hdrs[i].msg_hdr.msg_name = &naddrs[i].addr;
+        hdrs[i].msg_hdr.msg_namelen = (socklen_t)naddrs[i].size;
+        hdrs[i].msg_hdr.msg_iov = &iovs[i];
+        hdrs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    if (count == 0) {
+        return -1;
+    }
+
+    return sendmmsg(net_socket_to_native(sock), hdrs, (unsigned int)count, 0);
+}
+#endif /* OS_NETWORK_HAVE_MMSG */
+
+#ifndef OS_WIN32
+static int sys_sendv(void *_Nullable obj, Socket sock, const Net_Iovec *_Nonnull iov, size_t count)
+{
+    struct iovec iovs[NET_MAX_SEND_VECS];
+
+    if (count > NET_MAX_SEND_VECS) {
+        count = NET_MAX_SEND_VECS;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        iovs[i].iov_base = (void *)(uintptr_t)iov[i].buf;
+        iovs[i].iov_len = iov[i].length;
+    }
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iovs;
+    msg.msg_iovlen = count;
+
+    // sendmsg rather than writev, so MSG_NOSIGNAL applies like in sys_send.
+    return (int)sendmsg(net_socket_to_native(sock), &msg, MSG_NOSIGNAL);
+}
+#endif /* OS_WIN32 */
+
 static Socket sys_socket(void *_Nullable obj, int domain, int type, int proto)
 {
     const int platform_domain = make_family(domain);
@@ -562,6 +683,19 @@ static const Network_Funcs os_network_funcs = {
     sys_setsockopt,
     sys_getaddrinfo,
     sys_freeaddrinfo,
+#ifdef OS_NETWORK_HAVE_MMSG
+    sys_recvfrom_batch,
+    sys_sendto_batch,
+#else
+    nullptr,
+    nullptr,
+#endif /* OS_NETWORK_HAVE_MMSG */
+#ifndef OS_WIN32
+    sys_sendv,
+#else
+    nullptr,
+#endif /* OS_WIN32 */
+    sys_getpeername,
 };
 const Network os_network_obj = {&os_network_funcs, nullptr};
 
@@ -688,6 +822,16 @@ bool net_set_socket_reuseaddr(const Network *ns, Socket sock)
 #endif /* OS_WIN32 */
 }
 
+bool net_set_socket_reuseport(const Network *ns, Socket sock)
+{
+#ifdef SO_REUSEPORT
+    int set = 1;
+    return ns_setsockopt(ns, sock, SOL_SOCKET, SO_REUSEPORT, &set, sizeof(set)) == 0;
+#else
+    return false;
+#endif /* SO_REUSEPORT */
+}
+
 bool net_set_socket_dualstack(const Network *ns, Socket sock)
 {
     int ipv6only = 0;
@@ -9,6 +9,7 @@
  */
 #include "ping.h"
 
+#include <pthread.h>
 #include <string.h>
 
 #include "DHT.h"
@@ -38,8 +39,26 @@ struct Ping {
     Ping_Array  *_Nonnull ping_array;
     Node_format to_ping[MAX_TO_PING];
     uint64_t    last_to_ping;
+
+    /* Guards ping_array and to_ping, which concurrent request handlers modify via ping_add.
+     * Only set by ping_enable_thread_safety. */
+    pthread_mutex_t *_Nullable lock;
 };
 
+static void ping_lock(const Ping *_Nonnull ping)
+{
+    if (ping->lock != nullptr) {
+        pthread_mutex_lock(ping->lock);
+    }
+}
+
+static void ping_unlock(const Ping *_Nonnull ping)
+{
+    if (ping->lock != nullptr) {
+        pthread_mutex_unlock(ping->lock);
+    }
+}
+
 #define PING_PLAIN_SIZE (1 + sizeof(uint64_t))
 #define DHT_PING_SIZE (1 + CRYPTO_PUBLIC_KEY_SIZE + CRYPTO_NONCE_SIZE + PING_PLAIN_SIZE + CRYPTO_MAC_SIZE)
 #define PING_DATA_SIZE (CRYPTO_PUBLIC_KEY_SIZE + sizeof(IP_Port))
@@ -55,12 +74,19 @@ void ping_send_request(Ping *ping, const IP_Port *ipp, const uint8_t *public_key
     }
 
     // generate key to encrypt ping_id with recipient privkey
-    const uint8_t *shared_key = dht_get_shared_key_sent(ping->dht, public_key);
+    uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
+
+    if (!dht_copy_shared_key_sent(ping->dht, public_key, shared_key)) {
+        return;
+    }
+
     // Generate random ping_id.
     uint8_t data[PING_DATA_SIZE];
     pk_copy(data, public_key);
     memcpy(data + CRYPTO_PUBLIC_KEY_SIZE, ipp, sizeof(IP_Port));
+    ping_lock(ping);
     ping_id = ping_array_add(ping->ping_array, ping->mono_time, ping->rng, data, sizeof(data));
+    ping_unlock(ping);
 
     if (ping_id == 0) {
         return;
@@ -130,7 +156,11 @@ static int handle_ping_request(void *_Nonnull object, const IP_Port *_Nonnull so
         return 1;
     }
 
-    const uint8_t *shared_key = dht_get_shared_key_recv(dht, packet + 1);
+    uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
+
+    if (!dht_copy_shared_key_recv(dht, packet + 1, shared_key)) {
+        return 1;
+    }
 
     uint8_t ping_plain[PING_PLAIN_SIZE];
 
@@ -242,6 +272,28 @@ static bool in_list(const Client_data *_Nonnull list, uint16_t length, const Mon
     return false;
 }
 
+/** @brief Put a node into the to_ping list. The caller must hold the ping lock. */
+static int32_t ping_add_to_ping(Ping *_Nonnull ping, const uint8_t *_Nonnull public_key, const IP_Port *_Nonnull ip_port)
+{
+    for (unsigned int i = 0; i < MAX_TO_PING; ++i) {
+        if (!ip_isset(&ping->to_ping[i].ip_port.ip)) {
+            memcpy(ping->to_ping[i].public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
+            ipport_copy(&ping->to_ping[i].ip_port, ip_port);
+            return 0;
+        }
+
+        if (pk_equal(ping->to_ping[i].public_key, public_key)) {
+            return -1;
+        }
+    }
+
+    if (add_to_list(ping->to_ping, MAX_TO_PING, public_key, ip_port, dht_get_self_public_key(ping->dht))) {
+        return 0;
+    }
+
+    return -1;
+}
+
 /** @brief Add nodes to the to_ping list.
  * All nodes in this list are pinged every TIME_TO_PING seconds
  * and are then removed from the list.
@@ -262,7 +314,9 @@ int32_t ping_add(Ping *ping, const uint8_t *public_key, const IP_Port *ip_port)
         return -1;
     }
 
-    if (in_list(dht_get_close_clientlist(ping->dht), LCLIENT_LIST, ping->mono_time, public_key, ip_port)) {
+    const Client_data *const close_client = dht_find_close_client(ping->dht, public_key);
+
+    if (close_client != nullptr && in_list(close_client, 1, ping->mono_time, public_key, ip_port)) {
         return -1;
     }
 
@@ -273,23 +327,11 @@ int32_t ping_add(Ping *ping, const uint8_t *public_key, const IP_Port *ip_port)
         return -1;
     }
 
-    for (unsigned int i = 0; i < MAX_TO_PING; ++i) {
-        if (!ip_isset(&ping->to_ping[i].ip_port.ip)) {
-            memcpy(ping->to_ping[i].public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
-            ipport_copy(&ping->to_ping[i].ip_port, ip_port);
-            return 0;
-        }
-
-        if (pk_equal(ping->to_ping[i].public_key, public_key)) {
-            return -1;
-        }
-    }
+    ping_lock(ping);
+    const int32_t ret = ping_add_to_ping(ping, public_key, ip_port);
+    ping_unlock(ping);
 
-    if (add_to_list(ping->to_ping, MAX_TO_PING, public_key, ip_port, dht_get_self_public_key(ping->dht))) {
-        return 0;
-    }
-
-    return -1;
+    return ret;
 }
 
 /** @brief Ping all the valid nodes in the to_ping list every TIME_TO_PING seconds.
@@ -346,12 +388,29 @@ Ping *ping_new(const Memory *mem, const Mono_Time *mono_time, const Random *rng,
     ping->mem = mem;
     ping->dht = dht;
     ping->net = net;
-    networking_registerhandler(ping->net, NET_PACKET_PING_REQUEST, &handle_ping_request, dht);
+    networking_registerhandler_concurrent(ping->net, NET_PACKET_PING_REQUEST, &handle_ping_request, dht);
     networking_registerhandler(ping->net, NET_PACKET_PING_RESPONSE, &handle_ping_response, dht);
 
     return ping;
 }
 
+bool ping_enable_thread_safety(Ping *ping)
+{
+    if (ping->lock != nullptr) {
+        return true;
+    }
+
+    pthread_mutex_t *const lock = (pthread_mutex_t *)mem_alloc(ping->mem, sizeof(pthread_mutex_t));
+
+    if (lock == nullptr || pthread_mutex_init(lock, nullptr) != 0) {
+        mem_delete(ping->mem, lock);
+        return false;
+    }
+
+    ping->lock = lock;
+    return true;
+}
+
 void ping_kill(const Memory *mem, Ping *ping)
 {
     if (ping == nullptr) {
@@ -362,5 +421,10 @@ void ping_kill(const Memory *mem, Ping *ping)
     networking_registerhandler(ping->net, NET_PACKET_PING_RESPONSE, nullptr, nullptr);
     ping_array_kill(ping->ping_array);
 
+    if (ping->lock != nullptr) {
+        pthread_mutex_destroy(ping->lock);
+        mem_delete(mem, ping->lock);
+    }
+
     mem_delete(mem, ping);
 }
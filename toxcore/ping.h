@@ -10,6 +10,7 @@
 #ifndef C_TOXCORE_TOXCORE_PING_H
 #define C_TOXCORE_TOXCORE_PING_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "DHT.h"
@@ -25,6 +26,15 @@ typedef struct Ping Ping;
 Ping *_Nullable ping_new(const Memory *_Nonnull mem, const Mono_Time *_Nonnull mono_time, const Random *_Nonnull rng, DHT *_Nonnull dht, Networking_Core *_Nonnull net);
 
 void ping_kill(const Memory *_Nonnull mem, Ping *_Nullable ping);
+
+/** @brief Allocate the lock that lets concurrent request handlers call ping_add.
+ *
+ * Call before packets are handled on other threads.
+ *
+ * @retval false if the lock could not be allocated.
+ */
+bool ping_enable_thread_safety(Ping *_Nonnull ping);
+
 /** @brief Add nodes to the to_ping list.
  * All nodes in this list are pinged every TIME_TO_PING seconds
  * and are then removed from the list.
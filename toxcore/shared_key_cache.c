@@ -4,6 +4,7 @@
 
 #include "shared_key_cache.h"
 
+#include <pthread.h>
 #include <stdint.h>
 #include <string.h>     // memcpy(...)
 
@@ -21,15 +22,36 @@ typedef struct Shared_Key {
 } Shared_Key;
 
 struct Shared_Key_Cache {
+    /** `SHARED_KEY_CACHE_WAYS` keys for each of the `1 << set_bits` sets. */
     Shared_Key *_Nonnull keys;
+    uint32_t set_bits;
+    /** Next set to look for timed out keys in, see `shared_key_cache_sweep`. */
+    uint32_t sweep_set;
     const uint8_t *_Nonnull self_secret_key;
     uint64_t timeout; /** After this time (in seconds), a key is erased on the next housekeeping cycle */
     const Mono_Time *_Nonnull mono_time;
     const Memory *_Nonnull mem;
     const Logger *_Nonnull log;
-    uint8_t keys_per_slot;
+    /** Counters and size, protected by @ref lock like the keys. */
+    Shared_Key_Cache_Stats stats;
+    /** Only set by `shared_key_cache_enable_thread_safety`. */
+    pthread_mutex_t *_Nullable lock;
 };
 
+static void shared_key_cache_lock(const Shared_Key_Cache *_Nonnull cache)
+{
+    if (cache->lock != nullptr) {
+        pthread_mutex_lock(cache->lock);
+    }
+}
+
+static void shared_key_cache_unlock(const Shared_Key_Cache *_Nonnull cache)
+{
+    if (cache->lock != nullptr) {
+        pthread_mutex_unlock(cache->lock);
+    }
+}
+
 static bool shared_key_is_empty(const Logger *_Nonnull log, const Shared_Key *_Nonnull k)
 {
     LOGGER_ASSERT(log, k != nullptr, "shared key must not be NULL");
@@ -46,9 +68,172 @@ static void shared_key_set_empty(const Logger *_Nonnull log, Shared_Key *_Nonnul
     LOGGER_ASSERT(log, shared_key_is_empty(log, k), "shared key must be empty after clearing it");
 }
 
-Shared_Key_Cache *shared_key_cache_new(const Logger *log, const Mono_Time *mono_time, const Memory *mem, const uint8_t *self_secret_key, uint64_t timeout, uint8_t keys_per_slot)
+static uint32_t shared_key_cache_num_sets(uint32_t set_bits)
+{
+    return UINT32_C(1) << set_bits;
+}
+
+/** @brief Number of sets needed for `capacity` keys, as a power of two. */
+static uint32_t shared_key_cache_set_bits(uint32_t capacity)
+{
+    uint32_t set_bits = 0;
+
+    while (shared_key_cache_num_sets(set_bits) * SHARED_KEY_CACHE_WAYS < capacity) {
+        ++set_bits;
+    }
+
+    return set_bits;
+}
+
+static size_t shared_key_cache_size_bytes(uint32_t set_bits)
+{
+    return (size_t)shared_key_cache_num_sets(set_bits) * SHARED_KEY_CACHE_WAYS * sizeof(Shared_Key);
+}
+
+/** @brief Allocates zeroed, memory-locked storage for `1 << set_bits` sets. */
+static Shared_Key *_Nullable shared_key_cache_alloc_keys(const Memory *_Nonnull mem, uint32_t set_bits)
+{
+    const uint32_t count = shared_key_cache_num_sets(set_bits) * SHARED_KEY_CACHE_WAYS;
+    Shared_Key *keys = (Shared_Key *)mem_valloc(mem, count, sizeof(Shared_Key));
+
+    if (keys == nullptr) {
+        return nullptr;
+    }
+
+    crypto_memlock(keys, shared_key_cache_size_bytes(set_bits));
+    return keys;
+}
+
+static void shared_key_cache_free_keys(const Memory *_Nonnull mem, Shared_Key *_Nonnull keys, uint32_t set_bits)
+{
+    // Don't leave key material in memory
+    crypto_memzero(keys, shared_key_cache_size_bytes(set_bits));
+    crypto_memunlock(keys, shared_key_cache_size_bytes(set_bits));
+    mem_delete(mem, keys);
+}
+
+/** @brief The first key of the set that `public_key` belongs to. */
+static Shared_Key *_Nonnull shared_key_cache_set(Shared_Key *_Nonnull keys, uint32_t set_bits, const uint8_t *_Nonnull public_key)
+{
+    if (set_bits == 0) {
+        return keys;
+    }
+
+    // We can't use the first and last bytes because they are masked in
+    // curve25519. Public keys are uniformly distributed otherwise, but a peer
+    // can pick keys that share a few bytes, so mix all 8 bytes into the index.
+    uint64_t bytes;
+    memcpy(&bytes, &public_key[8], sizeof(bytes));
+    const uint32_t set = (uint32_t)((bytes * UINT64_C(0x9E3779B97F4A7C15)) >> (64 - set_bits));
+    return &keys[(size_t)set * SHARED_KEY_CACHE_WAYS];
+}
+
+static bool shared_key_timed_out(const Shared_Key_Cache *_Nonnull cache, const Shared_Key *_Nonnull k, uint64_t cur_time)
+{
+    return (k->time_last_requested + cache->timeout) < cur_time;
+}
+
+/** @brief Find the key for `public_key` in its set and evict keys that timed out.
+ *
+ * @param victim Receives the entry to replace if the key isn't found: an empty
+ *   one if there is any, the least recently used one otherwise.
+ *
+ * The caller must hold the cache lock.
+ */
+static Shared_Key *_Nullable shared_key_cache_find(Shared_Key_Cache *_Nonnull cache, Shared_Key *_Nonnull set,
+        const uint8_t *_Nonnull public_key, uint64_t cur_time, Shared_Key *_Nonnull *_Nonnull victim)
+{
+    Shared_Key *found = nullptr;
+    Shared_Key *oldest = &set[0];
+
+    for (size_t i = 0; i < SHARED_KEY_CACHE_WAYS; ++i) {
+        Shared_Key *const k = &set[i];
+
+        if (!shared_key_is_empty(cache->log, k)) {
+            if (shared_key_timed_out(cache, k, cur_time)) {
+                shared_key_set_empty(cache->log, k);
+                ++cache->stats.expired;
+                --cache->stats.size;
+            } else if (found == nullptr && pk_equal(public_key, k->public_key)) {
+                k->time_last_requested = cur_time;
+                found = k;
+            }
+        }
+
+        // Empty entries have time 0, so they are picked first.
+        if (k->time_last_requested < oldest->time_last_requested) {
+            oldest = k;
+        }
+    }
+
+    *victim = oldest;
+    return found;
+}
+
+/**
+ * @brief Evicts the timed out keys of one set, a different one each time.
+ *
+ * Called on every miss, so keys of peers that are gone are wiped eventually
+ * even if no other key is ever looked up in their set.
+ *
+ * The caller must hold the cache lock.
+ */
+static void shared_key_cache_sweep(Shared_Key_Cache *_Nonnull cache, uint64_t cur_time)
 {
-    if (mono_time == nullptr || self_secret_key == nullptr || timeout == 0 || keys_per_slot == 0) {
+    Shared_Key *const set = &cache->keys[(size_t)cache->sweep_set * SHARED_KEY_CACHE_WAYS];
+    cache->sweep_set = (cache->sweep_set + 1) & (shared_key_cache_num_sets(cache->set_bits) - 1);
+
+    for (size_t i = 0; i < SHARED_KEY_CACHE_WAYS; ++i) {
+        if (!shared_key_is_empty(cache->log, &set[i]) && shared_key_timed_out(cache, &set[i], cur_time)) {
+            shared_key_set_empty(cache->log, &set[i]);
+            ++cache->stats.expired;
+            --cache->stats.size;
+        }
+    }
+}
+
+/** @brief Stores `public_key` in `victim`, replacing whatever key was there.
+ *
+ * The caller must hold the cache lock and fill in the shared key.
+ */
+static void shared_key_cache_claim(Shared_Key_Cache *_Nonnull cache, Shared_Key *_Nonnull victim,
+                                   const uint8_t *_Nonnull public_key, uint64_t cur_time)
+{
+    if (shared_key_is_empty(cache->log, victim)) {
+        ++cache->stats.size;
+    } else {
+        ++cache->stats.evictions;
+    }
+
+    memcpy(victim->public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    victim->time_last_requested = cur_time;
+}
+
+/** @brief Stores a computed key, unless the cache already has one for `public_key`.
+ *
+ * Another thread may have inserted the same key while the caller was computing
+ * it, in which case the cache keeps the existing entry.
+ *
+ * The caller must hold the cache lock.
+ */
+static void shared_key_cache_insert_locked(Shared_Key_Cache *_Nonnull cache, const uint8_t *_Nonnull public_key,
+        const uint8_t *_Nonnull shared_key, uint64_t cur_time)
+{
+    shared_key_cache_sweep(cache, cur_time);
+
+    Shared_Key *const set = shared_key_cache_set(cache->keys, cache->set_bits, public_key);
+    Shared_Key *victim;
+
+    if (shared_key_cache_find(cache, set, public_key, cur_time, &victim) == nullptr) {
+        shared_key_cache_claim(cache, victim, public_key, cur_time);
+        memcpy(victim->shared_key, shared_key, CRYPTO_SHARED_KEY_SIZE);
+    }
+}
+
+Shared_Key_Cache *shared_key_cache_new(const Logger *log, const Mono_Time *mono_time, const Memory *mem, const uint8_t *self_secret_key, uint64_t timeout, uint32_t capacity)
+{
+    if (mono_time == nullptr || self_secret_key == nullptr || timeout == 0 || capacity == 0
+            || capacity > SHARED_KEY_CACHE_MAX_CAPACITY) {
         return nullptr;
     }
 
@@ -65,23 +250,22 @@ Shared_Key_Cache *shared_key_cache_new(const Logger *log, const Mono_Time *mono_
     }
 
     res->self_secret_key = self_secret_key;
+    res->timeout = timeout;
     res->mono_time = mono_time;
     res->mem = mem;
     res->log = log;
-    res->keys_per_slot = keys_per_slot;
 
-    // We take one byte from the public key for each bucket and store keys_per_slot elements there
-    const size_t cache_size = 256 * keys_per_slot;
-    Shared_Key *keys = (Shared_Key *)mem_valloc(mem, cache_size, sizeof(Shared_Key));
+    const uint32_t set_bits = shared_key_cache_set_bits(capacity);
+    Shared_Key *keys = shared_key_cache_alloc_keys(mem, set_bits);
 
     if (keys == nullptr) {
         mem_delete(mem, res);
         return nullptr;
     }
 
-    crypto_memlock(keys, cache_size * sizeof(Shared_Key));
-
     res->keys = keys;
+    res->set_bits = set_bits;
+    res->stats.capacity = shared_key_cache_num_sets(set_bits) * SHARED_KEY_CACHE_WAYS;
 
     return res;
 }
@@ -92,78 +276,211 @@ void shared_key_cache_free(Shared_Key_Cache *cache)
         return;
     }
 
-    const size_t cache_size = 256 * cache->keys_per_slot;
-    // Don't leave key material in memory
-    crypto_memzero(cache->keys, cache_size * sizeof(Shared_Key));
-    crypto_memunlock(cache->keys, cache_size * sizeof(Shared_Key));
-    mem_delete(cache->mem, cache->keys);
+    shared_key_cache_free_keys(cache->mem, cache->keys, cache->set_bits);
+
+    if (cache->lock != nullptr) {
+        pthread_mutex_destroy(cache->lock);
+        mem_delete(cache->mem, cache->lock);
+    }
+
     mem_delete(cache->mem, cache);
 }
 
-/* NOTE: On each lookup housekeeping is performed to evict keys that did timeout. */
-const uint8_t *shared_key_cache_lookup(Shared_Key_Cache *cache, const uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE])
+bool shared_key_cache_enable_thread_safety(Shared_Key_Cache *cache)
 {
-    // caching the time is not necessary, but calls to mono_time_get(...) are not free
-    const uint64_t cur_time = mono_time_get(cache->mono_time);
-    // We can't use the first and last bytes because they are masked in curve25519. Selected 8 for good alignment.
-    const uint8_t bucket_idx = public_key[8];
-    Shared_Key *bucket_start = &cache->keys[bucket_idx * cache->keys_per_slot];
+    if (cache->lock != nullptr) {
+        return true;
+    }
 
-    const uint8_t *found = nullptr;
+    pthread_mutex_t *const lock = (pthread_mutex_t *)mem_alloc(cache->mem, sizeof(pthread_mutex_t));
 
-    // Perform lookup
-    for (size_t i = 0; i < cache->keys_per_slot; ++i) {
-        if (shared_key_is_empty(cache->log, &bucket_start[i])) {
-            continue;
-        }
+    if (lock == nullptr) {
+        return false;
+    }
 
-        if (pk_equal(public_key, bucket_start[i].public_key)) {
-            found = bucket_start[i].shared_key;
-            bucket_start[i].time_last_requested = cur_time;
-            break;
-        }
+    if (pthread_mutex_init(lock, nullptr) != 0) {
+        mem_delete(cache->mem, lock);
+        return false;
+    }
+
+    cache->lock = lock;
+    return true;
+}
+
+bool shared_key_cache_set_capacity(Shared_Key_Cache *cache, uint32_t capacity)
+{
+    if (capacity == 0 || capacity > SHARED_KEY_CACHE_MAX_CAPACITY) {
+        return false;
+    }
+
+    const uint32_t set_bits = shared_key_cache_set_bits(capacity);
+
+    if (set_bits == cache->set_bits) {
+        return true;
+    }
+
+    Shared_Key *keys = shared_key_cache_alloc_keys(cache->mem, set_bits);
+
+    if (keys == nullptr) {
+        return false;
     }
 
-    // Perform housekeeping for this bucket
-    for (size_t i = 0; i < cache->keys_per_slot; ++i) {
-        if (shared_key_is_empty(cache->log, &bucket_start[i])) {
+    const size_t old_count = (size_t)shared_key_cache_num_sets(cache->set_bits) * SHARED_KEY_CACHE_WAYS;
+    uint32_t size = 0;
+
+    for (size_t i = 0; i < old_count; ++i) {
+        const Shared_Key *const k = &cache->keys[i];
+
+        if (shared_key_is_empty(cache->log, k)) {
             continue;
         }
 
-        const bool timed_out = (bucket_start[i].time_last_requested + cache->timeout) < cur_time;
-        if (timed_out) {
-            shared_key_set_empty(cache->log, &bucket_start[i]);
+        Shared_Key *const set = shared_key_cache_set(keys, set_bits, k->public_key);
+        Shared_Key *victim = &set[0];
+
+        for (size_t j = 1; j < SHARED_KEY_CACHE_WAYS; ++j) {
+            if (set[j].time_last_requested < victim->time_last_requested) {
+                victim = &set[j];
+            }
+        }
+
+        // When shrinking, keep the most recently used keys of each set.
+        if (k->time_last_requested > victim->time_last_requested) {
+            if (shared_key_is_empty(cache->log, victim)) {
+                ++size;
+            }
+
+            *victim = *k;
         }
     }
 
-    if (found == nullptr) {
-        // Insert into cache
+    shared_key_cache_free_keys(cache->mem, cache->keys, cache->set_bits);
 
-        uint64_t oldest_timestamp = UINT64_MAX;
-        size_t oldest_index = 0;
+    cache->keys = keys;
+    cache->set_bits = set_bits;
+    cache->sweep_set = 0;
+    cache->stats.size = size;
+    cache->stats.capacity = shared_key_cache_num_sets(set_bits) * SHARED_KEY_CACHE_WAYS;
 
-        /*
-         *  Find least recently used entry, unused entries are prioritised,
-         *  because their time_last_requested field is zeroed.
-         */
-        for (size_t i = 0; i < cache->keys_per_slot; ++i) {
-            if (bucket_start[i].time_last_requested < oldest_timestamp) {
-                oldest_timestamp = bucket_start[i].time_last_requested;
-                oldest_index = i;
-            }
-        }
+    return true;
+}
+
+void shared_key_cache_add_stats(const Shared_Key_Cache *cache, Shared_Key_Cache_Stats *stats)
+{
+    shared_key_cache_lock(cache);
+
+    stats->hits += cache->stats.hits;
+    stats->misses += cache->stats.misses;
+    stats->evictions += cache->stats.evictions;
+    stats->expired += cache->stats.expired;
+    stats->size += cache->stats.size;
+    stats->capacity += cache->stats.capacity;
+
+    shared_key_cache_unlock(cache);
+}
+
+/* NOTE: On each lookup housekeeping is performed to evict keys that did timeout. */
+const uint8_t *shared_key_cache_lookup(Shared_Key_Cache *cache, const uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE])
+{
+    const uint64_t cur_time = mono_time_get(cache->mono_time);
+
+    shared_key_cache_lock(cache);
+
+    Shared_Key *const set = shared_key_cache_set(cache->keys, cache->set_bits, public_key);
+    Shared_Key *victim;
+    Shared_Key *found = shared_key_cache_find(cache, set, public_key, cur_time, &victim);
+
+    if (found != nullptr) {
+        ++cache->stats.hits;
+        shared_key_cache_unlock(cache);
+        return found->shared_key;
+    }
+
+    ++cache->stats.misses;
+    shared_key_cache_sweep(cache, cur_time);
 
-        // Compute the shared key for the cache
-        if (encrypt_precompute(public_key, cache->self_secret_key, bucket_start[oldest_index].shared_key) != 0) {
-            // Don't put anything in the cache on error
-            return nullptr;
+    // Compute the shared key for the cache
+    if (encrypt_precompute(public_key, cache->self_secret_key, victim->shared_key) != 0) {
+        // Don't leave a half written entry in the cache on error
+        if (!shared_key_is_empty(cache->log, victim)) {
+            shared_key_set_empty(cache->log, victim);
+            --cache->stats.size;
         }
 
-        // update cache entry
-        memcpy(bucket_start[oldest_index].public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
-        bucket_start[oldest_index].time_last_requested = cur_time;
-        found = bucket_start[oldest_index].shared_key;
+        shared_key_cache_unlock(cache);
+        return nullptr;
+    }
+
+    shared_key_cache_claim(cache, victim, public_key, cur_time);
+    found = victim;
+
+    shared_key_cache_unlock(cache);
+
+    return found->shared_key;
+}
+
+bool shared_key_cache_get(Shared_Key_Cache *cache, const uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE],
+                          uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE])
+{
+    const uint64_t cur_time = mono_time_get(cache->mono_time);
+
+    shared_key_cache_lock(cache);
+
+    Shared_Key *set = shared_key_cache_set(cache->keys, cache->set_bits, public_key);
+    Shared_Key *victim;
+    const Shared_Key *found = shared_key_cache_find(cache, set, public_key, cur_time, &victim);
+
+    if (found != nullptr) {
+        ++cache->stats.hits;
+        memcpy(shared_key, found->shared_key, CRYPTO_SHARED_KEY_SIZE);
+        shared_key_cache_unlock(cache);
+        return true;
     }
 
+    ++cache->stats.misses;
+    shared_key_cache_unlock(cache);
+
+    // Compute the key without holding the lock, so other threads can use the
+    // cache in the meantime.
+    if (encrypt_precompute(public_key, cache->self_secret_key, shared_key) != 0) {
+        return false;
+    }
+
+    shared_key_cache_lock(cache);
+    shared_key_cache_insert_locked(cache, public_key, shared_key, cur_time);
+    shared_key_cache_unlock(cache);
+
+    return true;
+}
+
+bool shared_key_cache_contains(Shared_Key_Cache *cache, const uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE])
+{
+    const uint64_t cur_time = mono_time_get(cache->mono_time);
+
+    shared_key_cache_lock(cache);
+
+    Shared_Key *const set = shared_key_cache_set(cache->keys, cache->set_bits, public_key);
+    Shared_Key *victim;
+    const bool found = shared_key_cache_find(cache, set, public_key, cur_time, &victim) != nullptr;
+
+    shared_key_cache_unlock(cache);
+
     return found;
 }
+
+bool shared_key_cache_compute(const Shared_Key_Cache *cache, const uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE],
+                              uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE])
+{
+    return encrypt_precompute(public_key, cache->self_secret_key, shared_key) == 0;
+}
+
+void shared_key_cache_insert(Shared_Key_Cache *cache, const uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE],
+                             const uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE])
+{
+    const uint64_t cur_time = mono_time_get(cache->mono_time);
+
+    shared_key_cache_lock(cache);
+    ++cache->stats.misses;
+    shared_key_cache_insert_locked(cache, public_key, shared_key, cur_time);
+    shared_key_cache_unlock(cache);
+}
@@ -5,6 +5,7 @@
 #ifndef C_TOXCORE_TOXCORE_SHARED_KEY_CACHE_H
 #define C_TOXCORE_TOXCORE_SHARED_KEY_CACHE_H
 
+#include <stdbool.h>
 #include <stdint.h>     // uint*_t
 
 #include "attributes.h"
@@ -19,21 +20,85 @@ extern "C" {
 
 /**
  * This implements a cache for shared keys, since key generation is expensive.
+ *
+ * Keys are kept in sets of `SHARED_KEY_CACHE_WAYS` entries, selected by a hash
+ * of the public key, so a lookup only ever looks at one set no matter how big
+ * the cache is. When a set is full, its least recently used key is replaced.
  */
 
 typedef struct Shared_Key_Cache Shared_Key_Cache;
 
+/** Number of keys in each set of the cache. */
+#define SHARED_KEY_CACHE_WAYS 8
+
+/** Capacity of the caches in the DHT, onion and announce modules unless configured otherwise. */
+#define SHARED_KEY_CACHE_DEFAULT_CAPACITY 1024
+
+/** Largest supported capacity, about 300 MiB of keys. */
+#define SHARED_KEY_CACHE_MAX_CAPACITY (UINT32_C(1) << 22)
+
+typedef struct Shared_Key_Cache_Stats {
+    /** Lookups answered from the cache. */
+    uint64_t hits;
+    /** Keys that had to be computed, by a lookup or for `shared_key_cache_insert`. */
+    uint64_t misses;
+    /** Keys replaced by a new key before they timed out. */
+    uint64_t evictions;
+    /** Keys removed because they were not used for the timeout. */
+    uint64_t expired;
+    /** Keys currently in the cache. */
+    uint32_t size;
+    /** Number of keys the cache can hold. */
+    uint32_t capacity;
+} Shared_Key_Cache_Stats;
+
 /**
  * @brief Initializes a new shared key cache.
  * @param mono_time Time object for retrieving current time.
  * @param self_secret_key Our own secret key of length CRYPTO_SECRET_KEY_SIZE,
  * it must not change during the lifetime of the cache.
- * @param timeout Number of milliseconds, after which a key should be evicted.
- * @param keys_per_slot There are 256 slots, this controls how many keys are stored per slot and the size of the cache.
+ * @param timeout Number of seconds, after which an unused key is evicted.
+ * @param capacity Number of keys the cache can hold, rounded up to a power of
+ *   two and at least `SHARED_KEY_CACHE_WAYS`. At most `SHARED_KEY_CACHE_MAX_CAPACITY`.
  * @return nullptr on error.
  */
 Shared_Key_Cache *_Nullable shared_key_cache_new(const Logger *_Nonnull log, const Mono_Time *_Nonnull mono_time, const Memory *_Nonnull mem, const uint8_t *_Nonnull self_secret_key, uint64_t timeout,
-        uint8_t keys_per_slot);
+        uint32_t capacity);
+
+/**
+ * @brief Changes the number of keys the cache can hold, keeping the cached keys
+ *   that still fit.
+ *
+ * This moves the keys to new storage, so it invalidates all pointers returned
+ * by `shared_key_cache_lookup` and must not run concurrently with any other
+ * use of the cache. Call it while setting up, before other threads use it.
+ *
+ * @param capacity See `shared_key_cache_new`.
+ * @retval true on success.
+ * @retval false if the capacity is out of range or allocation failed, in which
+ *   case the cache is unchanged.
+ */
+bool shared_key_cache_set_capacity(Shared_Key_Cache *_Nonnull cache, uint32_t capacity);
+
+/**
+ * @brief Allocates the lock that makes the functions marked thread-safe below
+ *   safe to call from several threads.
+ *
+ * Without it, the cache takes no locks and must only be used by one thread at
+ * a time. Call it before a second thread uses the cache. Calling it again does
+ * nothing.
+ *
+ * @retval false if the lock could not be allocated.
+ */
+bool shared_key_cache_enable_thread_safety(Shared_Key_Cache *_Nonnull cache);
+
+/**
+ * @brief Adds the counters, size and capacity of the cache to @p stats.
+ *
+ * Start with a zeroed @p stats to get the numbers of one cache, or add several
+ * caches to get their totals.
+ */
+void shared_key_cache_add_stats(const Shared_Key_Cache *_Nonnull cache, Shared_Key_Cache_Stats *_Nonnull stats);
 
 /**
  * @brief Deletes the cache and frees all resources.
@@ -50,6 +115,50 @@ void shared_key_cache_free(Shared_Key_Cache *_Nullable cache);
  */
 const uint8_t *_Nullable shared_key_cache_lookup(Shared_Key_Cache *_Nonnull cache, const uint8_t public_key[_Nonnull CRYPTO_PUBLIC_KEY_SIZE]);
 
+/**
+ * @brief Thread-safe variant of `shared_key_cache_lookup` that copies the key out.
+ *
+ * The returned pointer of `shared_key_cache_lookup` can be invalidated by a
+ * concurrent lookup that evicts its entry. This function copies the key while
+ * holding the cache lock instead, and computes missing keys without holding it.
+ *
+ * @param shared_key Receives the shared key of length CRYPTO_SHARED_KEY_SIZE.
+ * @retval true on success.
+ * @retval false if the key could not be computed.
+ */
+bool shared_key_cache_get(Shared_Key_Cache *_Nonnull cache, const uint8_t public_key[_Nonnull CRYPTO_PUBLIC_KEY_SIZE],
+                          uint8_t shared_key[_Nonnull CRYPTO_SHARED_KEY_SIZE]);
+
+/**
+ * @brief Checks whether the cache has a key for @p public_key that hasn't timed out.
+ *
+ * Neither computes a missing key nor counts as a hit or miss. Thread-safe.
+ */
+bool shared_key_cache_contains(Shared_Key_Cache *_Nonnull cache, const uint8_t public_key[_Nonnull CRYPTO_PUBLIC_KEY_SIZE]);
+
+/**
+ * @brief Computes the shared key for @p public_key without touching the cache.
+ *
+ * Only reads the secret key the cache was created with, so it can run on any
+ * thread, at the same time as anything else. Store the result with
+ * `shared_key_cache_insert`.
+ *
+ * @retval true on success.
+ */
+bool shared_key_cache_compute(const Shared_Key_Cache *_Nonnull cache, const uint8_t public_key[_Nonnull CRYPTO_PUBLIC_KEY_SIZE],
+                              uint8_t shared_key[_Nonnull CRYPTO_SHARED_KEY_SIZE]);
+
+/**
+ * @brief Stores a key computed by `shared_key_cache_compute`.
+ *
+ * Counts as a miss, like the lookup that would otherwise have computed it.
+ * Keeps the existing entry if the cache already has one for @p public_key.
+ * Like a missing lookup, this can evict keys, so it invalidates the pointers
+ * returned by `shared_key_cache_lookup`. Thread-safe.
+ */
+void shared_key_cache_insert(Shared_Key_Cache *_Nonnull cache, const uint8_t public_key[_Nonnull CRYPTO_PUBLIC_KEY_SIZE],
+                             const uint8_t shared_key[_Nonnull CRYPTO_SHARED_KEY_SIZE]);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
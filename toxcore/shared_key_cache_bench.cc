@@ -0,0 +1,148 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <array>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "crypto_core.h"
+#include "logger.h"
+#include "mono_time.h"
+#include "os_memory.h"
+#include "shared_key_cache.h"
+
+namespace {
+
+using PublicKey = std::array<uint8_t, CRYPTO_PUBLIC_KEY_SIZE>;
+
+/** Seconds after which unused keys expire, as in the DHT and onion modules. */
+constexpr uint64_t kKeysTimeout = 600;
+
+/** Lookups in the replayed request stream. */
+constexpr std::size_t kStreamLength = 1 << 20;
+
+/** Simulated lookups per second, as on a busy bootstrap node. */
+constexpr uint64_t kLookupsPerSecond = 500;
+
+/**
+ * @brief A stream of public keys as a bootstrap node sees them.
+ *
+ * Peers are picked with a Zipf distribution (s = 1): a few peers that are close
+ * to us in the DHT or use us as a relay send most requests, while the long
+ * tail of peers only passes by once or twice.
+ */
+class KeyStream {
+public:
+    KeyStream(std::size_t num_peers, uint32_t seed)
+    {
+        std::mt19937 rng(seed);
+        std::uniform_int_distribution<int> byte(0, 255);
+
+        peers_.resize(num_peers);
+
+        for (PublicKey &pk : peers_) {
+            for (uint8_t &b : pk) {
+                b = static_cast<uint8_t>(byte(rng));
+            }
+        }
+
+        std::vector<double> weights(num_peers);
+
+        for (std::size_t i = 0; i < num_peers; ++i) {
+            weights[i] = 1.0 / static_cast<double>(i + 1);
+        }
+
+        std::discrete_distribution<std::size_t> zipf(weights.begin(), weights.end());
+        stream_.resize(kStreamLength);
+
+        for (uint32_t &index : stream_) {
+            index = static_cast<uint32_t>(zipf(rng));
+        }
+    }
+
+    const uint8_t *at(std::size_t i) const { return peers_[stream_[i % stream_.size()]].data(); }
+
+private:
+    std::vector<PublicKey> peers_;
+    std::vector<uint32_t> stream_;
+};
+
+const KeyStream &key_stream(std::size_t num_peers)
+{
+    static const KeyStream stream_10k(10000, 1);
+    static const KeyStream stream_100k(100000, 2);
+    return num_peers <= 10000 ? stream_10k : stream_100k;
+}
+
+uint64_t simulated_clock(void *user_data)
+{
+    return *static_cast<const uint64_t *>(user_data);
+}
+
+/**
+ * @brief Replays the key stream through one cache.
+ *
+ * Arguments are the cache capacity and the number of distinct peers. Each
+ * iteration is one lookup, and the simulated clock moves forward so that keys
+ * of peers that went quiet expire as they would in a real node.
+ */
+void BM_ReplayZipf(benchmark::State &state)
+{
+    const uint32_t capacity = static_cast<uint32_t>(state.range(0));
+    const KeyStream &stream = key_stream(static_cast<std::size_t>(state.range(1)));
+
+    const Memory *mem = os_memory();
+    Logger *log = logger_new(mem);
+    uint64_t now_ms = 1000;
+    Mono_Time *mono_time = mono_time_new(mem, simulated_clock, &now_ms);
+
+    std::array<uint8_t, CRYPTO_SECRET_KEY_SIZE> self_sk{};
+    self_sk.fill(0x42);
+
+    Shared_Key_Cache *cache = shared_key_cache_new(log, mono_time, mem, self_sk.data(), kKeysTimeout, capacity);
+
+    if (cache == nullptr) {
+        state.SkipWithError("shared_key_cache_new failed");
+        mono_time_free(mem, mono_time);
+        logger_kill(log);
+        return;
+    }
+
+    std::size_t i = 0;
+
+    for (auto _ : state) {
+        if (i % kLookupsPerSecond == 0) {
+            now_ms += 1000;
+            mono_time_update(mono_time);
+        }
+
+        benchmark::DoNotOptimize(shared_key_cache_lookup(cache, stream.at(i)));
+        ++i;
+    }
+
+    Shared_Key_Cache_Stats stats{};
+    shared_key_cache_add_stats(cache, &stats);
+
+    const double lookups = static_cast<double>(stats.hits + stats.misses);
+    state.counters["hit_rate"] = lookups == 0 ? 0.0 : static_cast<double>(stats.hits) / lookups;
+    state.counters["evictions"] = static_cast<double>(stats.evictions);
+    state.counters["expired"] = static_cast<double>(stats.expired);
+    state.counters["size"] = stats.size;
+    state.SetItemsProcessed(state.iterations());
+
+    shared_key_cache_free(cache);
+    mono_time_free(mem, mono_time);
+    logger_kill(log);
+}
+BENCHMARK(BM_ReplayZipf)
+    ->ArgNames({"capacity", "peers"})
+    ->ArgsProduct({{1024, 16384, 65536}, {10000, 100000}})
+    ->Iterations(kStreamLength);
+
+}  // namespace
+
+BENCHMARK_MAIN();
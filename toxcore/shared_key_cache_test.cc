@@ -9,6 +9,8 @@
 #include <cstdint>
 #include <cstring>
 #include <memory>
+#include <thread>
+#include <vector>
 
 #include "../testing/support/public/simulation.hh"
 #include "attributes.h"
@@ -39,7 +41,7 @@ protected:
 
         logger = logger_new(&node->c_memory);
 
-        cache = shared_key_cache_new(logger, mono_time, &node->c_memory, alice_sk, 10000, 4);
+        cache = shared_key_cache_new(logger, mono_time, &node->c_memory, alice_sk, 10, 4);
         ASSERT_NE(cache, nullptr);
     }
 
@@ -77,6 +79,68 @@ TEST_F(SharedKeyCacheTest, BasicLookup)
     EXPECT_EQ(std::memcmp(shared1, expected, CRYPTO_SHARED_KEY_SIZE), 0);
 }
 
+TEST_F(SharedKeyCacheTest, GetCopiesCachedKey)
+{
+    std::uint8_t bob_pk[CRYPTO_PUBLIC_KEY_SIZE], bob_sk[CRYPTO_SECRET_KEY_SIZE];
+    crypto_new_keypair(&node->c_random, bob_pk, bob_sk);
+
+    std::uint8_t shared[CRYPTO_SHARED_KEY_SIZE];
+    ASSERT_TRUE(shared_key_cache_get(cache, bob_pk, shared));
+
+    std::uint8_t expected[CRYPTO_SHARED_KEY_SIZE];
+    encrypt_precompute(bob_pk, alice_sk, expected);
+    EXPECT_EQ(std::memcmp(shared, expected, CRYPTO_SHARED_KEY_SIZE), 0);
+
+    // The key computed by get is inserted into the cache.
+    const std::uint8_t *cached = shared_key_cache_lookup(cache, bob_pk);
+    ASSERT_NE(cached, nullptr);
+    EXPECT_EQ(std::memcmp(cached, expected, CRYPTO_SHARED_KEY_SIZE), 0);
+}
+
+TEST_F(SharedKeyCacheTest, ConcurrentGet)
+{
+    ASSERT_TRUE(shared_key_cache_enable_thread_safety(cache));
+
+    constexpr int kNumKeys = 64;
+    std::vector<std::vector<std::uint8_t>> pks;
+    std::vector<std::vector<std::uint8_t>> expected;
+
+    for (int i = 0; i < kNumKeys; ++i) {
+        std::uint8_t pk[CRYPTO_PUBLIC_KEY_SIZE], sk[CRYPTO_SECRET_KEY_SIZE];
+        crypto_new_keypair(&node->c_random, pk, sk);
+        std::uint8_t key[CRYPTO_SHARED_KEY_SIZE];
+        encrypt_precompute(pk, alice_sk, key);
+        pks.emplace_back(pk, pk + CRYPTO_PUBLIC_KEY_SIZE);
+        expected.emplace_back(key, key + CRYPTO_SHARED_KEY_SIZE);
+    }
+
+    std::vector<int> mismatches(4);
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t] {
+            for (int round = 0; round < 10; ++round) {
+                for (int i = 0; i < kNumKeys; ++i) {
+                    const int k = (i + t * 7) % kNumKeys;
+                    std::uint8_t shared[CRYPTO_SHARED_KEY_SIZE];
+                    if (!shared_key_cache_get(cache, pks[k].data(), shared)
+                            || std::memcmp(shared, expected[k].data(), CRYPTO_SHARED_KEY_SIZE) != 0) {
+                        ++mismatches[t];
+                    }
+                }
+            }
+        });
+    }
+
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+
+    for (int t = 0; t < 4; ++t) {
+        EXPECT_EQ(mismatches[t], 0);
+    }
+}
+
 TEST_F(SharedKeyCacheTest, TimeoutEviction)
 {
     std::uint8_t bob_pk[CRYPTO_PUBLIC_KEY_SIZE], bob_sk[CRYPTO_SECRET_KEY_SIZE];
@@ -89,64 +153,74 @@ TEST_F(SharedKeyCacheTest, TimeoutEviction)
     // Should re-compute/re-insert after timeout
     const std::uint8_t *shared = shared_key_cache_lookup(cache, bob_pk);
     ASSERT_NE(shared, nullptr);
+
+    Shared_Key_Cache_Stats stats{};
+    shared_key_cache_add_stats(cache, &stats);
+    EXPECT_EQ(stats.expired, 1);
+    EXPECT_EQ(stats.misses, 2);
+}
+
+TEST_F(SharedKeyCacheTest, KeysLiveUntilTimeout)
+{
+    std::uint8_t bob_pk[CRYPTO_PUBLIC_KEY_SIZE], bob_sk[CRYPTO_SECRET_KEY_SIZE];
+    crypto_new_keypair(&node->c_random, bob_pk, bob_sk);
+
+    const std::uint8_t *shared1 = shared_key_cache_lookup(cache, bob_pk);
+    sim->advance_time(5000);  // Well within the 10s timeout
+    mono_time_update(mono_time);
+    const std::uint8_t *shared2 = shared_key_cache_lookup(cache, bob_pk);
+    EXPECT_EQ(shared1, shared2);
+
+    Shared_Key_Cache_Stats stats{};
+    shared_key_cache_add_stats(cache, &stats);
+    EXPECT_EQ(stats.hits, 1);
+    EXPECT_EQ(stats.misses, 1);
+    EXPECT_EQ(stats.expired, 0);
 }
 
-TEST_F(SharedKeyCacheTest, SlotExhaustionAndLRU)
+TEST_F(SharedKeyCacheTest, SetExhaustionAndLRU)
 {
-    // Fill one bucket (4 slots)
+    // The fixture's cache is a single set of SHARED_KEY_CACHE_WAYS keys.
     std::vector<std::vector<std::uint8_t>> pks;
     // Store pointers to verify cache hits (stable memory addresses)
     std::vector<const std::uint8_t *> pointers;
-    std::uint8_t target_hash = 0x42;
 
-    for (int i = 0; i < 5; ++i) {
+    for (int i = 0; i < SHARED_KEY_CACHE_WAYS + 1; ++i) {
         std::uint8_t pk[CRYPTO_PUBLIC_KEY_SIZE], sk[CRYPTO_SECRET_KEY_SIZE];
-        while (true) {
-            crypto_new_keypair(&node->c_random, pk, sk);
-            if (pk[8] == target_hash)
-                break;
-        }
+        crypto_new_keypair(&node->c_random, pk, sk);
         pks.push_back(std::vector<std::uint8_t>(pk, pk + CRYPTO_PUBLIC_KEY_SIZE));
         sim->advance_time(100);
         mono_time_update(mono_time);
         pointers.push_back(shared_key_cache_lookup(cache, pk));
     }
 
-    // 5th lookup should have evicted the oldest (LRU)
-    bool reused = false;
-    for (int i = 0; i < 4; ++i) {
-        if (pointers[4] == pointers[i])
-            reused = true;
-    }
-    EXPECT_TRUE(reused);
+    // The last lookup should have evicted the oldest (LRU)
+    EXPECT_EQ(pointers[SHARED_KEY_CACHE_WAYS], pointers[0]);
 
-    // Most recent should still be cached
+    // The others should still be cached
     EXPECT_EQ(shared_key_cache_lookup(cache, pks[1].data()), pointers[1]);
+
+    Shared_Key_Cache_Stats stats{};
+    shared_key_cache_add_stats(cache, &stats);
+    EXPECT_EQ(stats.capacity, SHARED_KEY_CACHE_WAYS);
+    EXPECT_EQ(stats.size, SHARED_KEY_CACHE_WAYS);
+    EXPECT_EQ(stats.misses, SHARED_KEY_CACHE_WAYS + 1);
+    EXPECT_EQ(stats.evictions, 1);
+    EXPECT_EQ(stats.hits, 1);
 }
 
 TEST_F(SharedKeyCacheTest, HashDistribution)
 {
     const int total_keys = 256;
+    ASSERT_TRUE(shared_key_cache_set_capacity(cache, 4096));
+
     std::vector<std::vector<std::uint8_t>> pks;
     // Store pointers to verify cache hits (stable memory addresses)
     std::vector<const std::uint8_t *> pointers;
 
-    // Fill cache with keys having unique hashes
     for (int i = 0; i < total_keys; ++i) {
         std::uint8_t pk[CRYPTO_PUBLIC_KEY_SIZE], sk[CRYPTO_SECRET_KEY_SIZE];
-        while (true) {
-            crypto_new_keypair(&node->c_random, pk, sk);
-            std::uint8_t h = pk[8];
-            bool duplicate = false;
-            for (const auto &existing : pks) {
-                if (existing[8] == h) {
-                    duplicate = true;
-                    break;
-                }
-            }
-            if (!duplicate)
-                break;
-        }
+        crypto_new_keypair(&node->c_random, pk, sk);
         pks.push_back(std::vector<std::uint8_t>(pk, pk + CRYPTO_PUBLIC_KEY_SIZE));
         pointers.push_back(shared_key_cache_lookup(cache, pk));
     }
@@ -158,6 +232,67 @@ TEST_F(SharedKeyCacheTest, HashDistribution)
             hits++;
     }
     EXPECT_EQ(hits, total_keys);
+
+    Shared_Key_Cache_Stats stats{};
+    shared_key_cache_add_stats(cache, &stats);
+    EXPECT_EQ(stats.evictions, 0);
+    EXPECT_EQ(stats.size, total_keys);
+}
+
+TEST_F(SharedKeyCacheTest, SetCapacityKeepsKeys)
+{
+    std::vector<std::vector<std::uint8_t>> pks;
+
+    for (int i = 0; i < SHARED_KEY_CACHE_WAYS; ++i) {
+        std::uint8_t pk[CRYPTO_PUBLIC_KEY_SIZE], sk[CRYPTO_SECRET_KEY_SIZE];
+        crypto_new_keypair(&node->c_random, pk, sk);
+        pks.push_back(std::vector<std::uint8_t>(pk, pk + CRYPTO_PUBLIC_KEY_SIZE));
+        ASSERT_NE(shared_key_cache_lookup(cache, pk), nullptr);
+    }
+
+    ASSERT_TRUE(shared_key_cache_set_capacity(cache, 1000));
+    EXPECT_FALSE(shared_key_cache_set_capacity(cache, 0));
+    EXPECT_FALSE(shared_key_cache_set_capacity(cache, SHARED_KEY_CACHE_MAX_CAPACITY + 1));
+
+    for (const auto &pk : pks) {
+        std::uint8_t shared[CRYPTO_SHARED_KEY_SIZE];
+        ASSERT_TRUE(shared_key_cache_get(cache, pk.data(), shared));
+
+        std::uint8_t expected[CRYPTO_SHARED_KEY_SIZE];
+        encrypt_precompute(pk.data(), alice_sk, expected);
+        EXPECT_EQ(std::memcmp(shared, expected, CRYPTO_SHARED_KEY_SIZE), 0);
+    }
+
+    Shared_Key_Cache_Stats stats{};
+    shared_key_cache_add_stats(cache, &stats);
+    EXPECT_EQ(stats.capacity, 1024);  // Rounded up to a power of two
+    EXPECT_EQ(stats.size, SHARED_KEY_CACHE_WAYS);
+    EXPECT_EQ(stats.hits, SHARED_KEY_CACHE_WAYS);
+}
+
+TEST_F(SharedKeyCacheTest, IdleKeysAreSweptOnMisses)
+{
+    ASSERT_TRUE(shared_key_cache_set_capacity(cache, 64));
+
+    std::uint8_t bob_pk[CRYPTO_PUBLIC_KEY_SIZE], bob_sk[CRYPTO_SECRET_KEY_SIZE];
+    crypto_new_keypair(&node->c_random, bob_pk, bob_sk);
+    shared_key_cache_lookup(cache, bob_pk);
+
+    sim->advance_time(11000);  // Past 10s timeout
+    mono_time_update(mono_time);
+
+    // Each miss sweeps one of the 8 sets, so Bob's key is gone after 8 misses
+    // for other keys, whichever set they land in.
+    for (int i = 0; i < 8; ++i) {
+        std::uint8_t pk[CRYPTO_PUBLIC_KEY_SIZE], sk[CRYPTO_SECRET_KEY_SIZE];
+        crypto_new_keypair(&node->c_random, pk, sk);
+        shared_key_cache_lookup(cache, pk);
+    }
+
+    Shared_Key_Cache_Stats stats{};
+    shared_key_cache_add_stats(cache, &stats);
+    EXPECT_EQ(stats.expired, 1);
+    EXPECT_EQ(stats.size, 8);
 }
 
 }  // namespace
@@ -0,0 +1,409 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+/**
+ * Hierarchical timer wheel with 1 ms resolution.
+ *
+ * Level 0 has one slot per millisecond for the next 64 ms, level 1 one slot
+ * per 64 ms for the next 4 s, and so on. Timers in higher levels are moved
+ * down ("cascaded") when the wheel reaches the start of their slot, so every
+ * timer is touched at most once per level. Deadlines beyond the top level are
+ * parked in its last slot and re-sorted when it is cascaded.
+ */
+#include "timer_wheel.h"
+
+#include <string.h>
+
+#include "attributes.h"
+#include "ccompat.h"
+#include "mem.h"
+
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+#define TIMER_WHEEL_SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+
+/** Milliseconds covered by the whole wheel. */
+#define TIMER_WHEEL_RANGE (UINT64_C(1) << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS))
+
+/** List of timers that expired since the last call to `timer_wheel_advance`. */
+#define TIMER_WHEEL_EXPIRED (TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS)
+/** List of timers that `timer_wheel_pop` hands out, taken from the expired list by `timer_wheel_advance`. */
+#define TIMER_WHEEL_READY (TIMER_WHEEL_EXPIRED + 1)
+/** Slot of a timer without a pending deadline. */
+#define TIMER_WHEEL_UNSET (TIMER_WHEEL_READY + 1)
+
+#define TIMER_WHEEL_NONE UINT32_MAX
+
+typedef struct Timer_Wheel_Entry {
+    uint64_t deadline;
+    uint32_t prev;
+    uint32_t next;
+    uint16_t slot;
+} Timer_Wheel_Entry;
+
+struct Timer_Wheel {
+    const Memory *_Nonnull mem;
+
+    Timer_Wheel_Entry *_Nullable entries;
+    uint32_t entries_size;
+
+    /* Heads of the per-slot lists, plus the expired and ready lists. */
+    uint32_t heads[TIMER_WHEEL_READY + 1];
+    /* Number of timers on each level, not counting expired ones. */
+    uint32_t counts[TIMER_WHEEL_LEVELS];
+
+    uint64_t now;
+};
+
+static uint32_t slot_level(uint16_t slot)
+{
+    return slot / TIMER_WHEEL_SLOTS;
+}
+
+static void entry_link(Timer_Wheel *_Nonnull tw, uint32_t id, uint16_t slot)
+{
+    Timer_Wheel_Entry *const entry = &tw->entries[id];
+    const uint32_t head = tw->heads[slot];
+
+    entry->slot = slot;
+    entry->prev = TIMER_WHEEL_NONE;
+    entry->next = head;
+
+    if (head != TIMER_WHEEL_NONE) {
+        tw->entries[head].prev = id;
+    }
+
+    tw->heads[slot] = id;
+
+    if (slot < TIMER_WHEEL_EXPIRED) {
+        ++tw->counts[slot_level(slot)];
+    }
+}
+
+static void entry_unlink(Timer_Wheel *_Nonnull tw, uint32_t id)
+{
+    Timer_Wheel_Entry *const entry = &tw->entries[id];
+
+    if (entry->prev != TIMER_WHEEL_NONE) {
+        tw->entries[entry->prev].next = entry->next;
+    } else {
+        tw->heads[entry->slot] = entry->next;
+    }
+
+    if (entry->next != TIMER_WHEEL_NONE) {
+        tw->entries[entry->next].prev = entry->prev;
+    }
+
+    if (entry->slot < TIMER_WHEEL_EXPIRED) {
+        --tw->counts[slot_level(entry->slot)];
+    }
+
+    entry->slot = TIMER_WHEEL_UNSET;
+}
+
+/** Put a timer into the slot for its deadline, relative to the current time. */
+static void entry_place(Timer_Wheel *_Nonnull tw, uint32_t id)
+{
+    const uint64_t deadline = tw->entries[id].deadline;
+
+    if (deadline <= tw->now) {
+        entry_link(tw, id, TIMER_WHEEL_EXPIRED);
+        return;
+    }
+
+    const uint64_t delta = deadline - tw->now;
+    uint64_t when = deadline;
+    uint32_t level = 0;
+
+    while (level + 1 < TIMER_WHEEL_LEVELS && delta >= UINT64_C(1) << (TIMER_WHEEL_SLOT_BITS * (level + 1))) {
+        ++level;
+    }
+
+    if (delta >= TIMER_WHEEL_RANGE) {
+        when = tw->now + TIMER_WHEEL_RANGE - 1;
+    }
+
+    const uint32_t index = (uint32_t)(when >> (TIMER_WHEEL_SLOT_BITS * level)) & TIMER_WHEEL_SLOT_MASK;
+    entry_link(tw, id, (uint16_t)(level * TIMER_WHEEL_SLOTS + index));
+}
+
+/** Re-sort all timers in a slot relative to the current time. */
+static void slot_cascade(Timer_Wheel *_Nonnull tw, uint16_t slot)
+{
+    uint32_t id = tw->heads[slot];
+
+    while (id != TIMER_WHEEL_NONE) {
+        const uint32_t next = tw->entries[id].next;
+        entry_unlink(tw, id);
+        entry_place(tw, id);
+        id = next;
+    }
+}
+
+static uint32_t pending_count(const Timer_Wheel *_Nonnull tw)
+{
+    uint32_t count = 0;
+
+    for (uint32_t level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+        count += tw->counts[level];
+    }
+
+    return count;
+}
+
+static bool entries_reserve(Timer_Wheel *_Nonnull tw, uint32_t id)
+{
+    if (id < tw->entries_size) {
+        return true;
+    }
+
+    if (id == TIMER_WHEEL_NONE) {
+        return false;
+    }
+
+    uint32_t new_size = tw->entries_size < 8 ? 8 : tw->entries_size;
+
+    while (new_size <= id) {
+        new_size = new_size > UINT32_MAX / 2 ? TIMER_WHEEL_NONE : new_size * 2;
+    }
+
+    Timer_Wheel_Entry *entries = (Timer_Wheel_Entry *)mem_vrealloc(tw->mem, tw->entries, new_size, sizeof(Timer_Wheel_Entry));
+
+    if (entries == nullptr) {
+        return false;
+    }
+
+    for (uint32_t i = tw->entries_size; i < new_size; ++i) {
+        entries[i].deadline = 0;
+        entries[i].prev = TIMER_WHEEL_NONE;
+        entries[i].next = TIMER_WHEEL_NONE;
+        entries[i].slot = TIMER_WHEEL_UNSET;
+    }
+
+    tw->entries = entries;
+    tw->entries_size = new_size;
+    return true;
+}
+
+Timer_Wheel *timer_wheel_new(const Memory *mem, uint64_t now)
+{
+    Timer_Wheel *tw = (Timer_Wheel *)mem_alloc(mem, sizeof(Timer_Wheel));
+
+    if (tw == nullptr) {
+        return nullptr;
+    }
+
+    tw->mem = mem;
+    tw->now = now;
+
+    for (uint32_t i = 0; i <= TIMER_WHEEL_READY; ++i) {
+        tw->heads[i] = TIMER_WHEEL_NONE;
+    }
+
+    return tw;
+}
+
+void timer_wheel_kill(Timer_Wheel *tw)
+{
+    if (tw == nullptr) {
+        return;
+    }
+
+    mem_delete(tw->mem, tw->entries);
+    mem_delete(tw->mem, tw);
+}
+
+bool timer_wheel_set(Timer_Wheel *tw, uint32_t id, uint64_t deadline)
+{
+    if (!entries_reserve(tw, id)) {
+        return false;
+    }
+
+    if (tw->entries[id].slot != TIMER_WHEEL_UNSET) {
+        entry_unlink(tw, id);
+    }
+
+    tw->entries[id].deadline = deadline;
+    entry_place(tw, id);
+    return true;
+}
+
+bool timer_wheel_set_earlier(Timer_Wheel *tw, uint32_t id, uint64_t deadline)
+{
+    if (timer_wheel_is_set(tw, id) && tw->entries[id].deadline <= deadline) {
+        return true;
+    }
+
+    return timer_wheel_set(tw, id, deadline);
+}
+
+void timer_wheel_cancel(Timer_Wheel *tw, uint32_t id)
+{
+    if (timer_wheel_is_set(tw, id)) {
+        entry_unlink(tw, id);
+    }
+}
+
+bool timer_wheel_is_set(const Timer_Wheel *tw, uint32_t id)
+{
+    return id < tw->entries_size && tw->entries[id].slot != TIMER_WHEEL_UNSET;
+}
+
+/** Re-sort all pending timers relative to the current time. */
+static void wheel_rebase(Timer_Wheel *_Nonnull tw)
+{
+    for (uint16_t slot = 0; slot < TIMER_WHEEL_EXPIRED; ++slot) {
+        slot_cascade(tw, slot);
+    }
+}
+
+/** Move the expired timers to the front of the ready list. */
+static void wheel_take_expired(Timer_Wheel *_Nonnull tw)
+{
+    const uint32_t head = tw->heads[TIMER_WHEEL_EXPIRED];
+
+    if (head == TIMER_WHEEL_NONE) {
+        return;
+    }
+
+    uint32_t tail = head;
+
+    for (uint32_t id = head; id != TIMER_WHEEL_NONE; id = tw->entries[id].next) {
+        tw->entries[id].slot = TIMER_WHEEL_READY;
+        tail = id;
+    }
+
+    const uint32_t ready = tw->heads[TIMER_WHEEL_READY];
+    tw->entries[tail].next = ready;
+
+    if (ready != TIMER_WHEEL_NONE) {
+        tw->entries[ready].prev = tail;
+    }
+
+    tw->heads[TIMER_WHEEL_READY] = head;
+    tw->heads[TIMER_WHEEL_EXPIRED] = TIMER_WHEEL_NONE;
+}
+
+static void wheel_advance(Timer_Wheel *_Nonnull tw, uint64_t now)
+{
+    if (now < tw->now) {
+        /* The clock was replaced by one that is behind: start over from its time. */
+        tw->now = now;
+        wheel_rebase(tw);
+        return;
+    }
+
+    if (now - tw->now >= TIMER_WHEEL_RANGE) {
+        /* Every slot would come around at least once, so just re-sort them all. */
+        tw->now = now;
+        wheel_rebase(tw);
+        return;
+    }
+
+    while (tw->now < now) {
+        uint32_t lowest = 0;
+
+        while (lowest < TIMER_WHEEL_LEVELS && tw->counts[lowest] == 0) {
+            ++lowest;
+        }
+
+        if (lowest == TIMER_WHEEL_LEVELS) {
+            tw->now = now;
+            break;
+        }
+
+        if (lowest > 0) {
+            /* Nothing below this level: skip to the next time it cascades. */
+            const uint32_t shift = TIMER_WHEEL_SLOT_BITS * lowest;
+            const uint64_t next = ((tw->now >> shift) + 1) << shift;
+
+            if (next > now) {
+                tw->now = now;
+                break;
+            }
+
+            tw->now = next;
+        } else {
+            ++tw->now;
+        }
+
+        const uint64_t t = tw->now;
+
+        for (uint32_t level = TIMER_WHEEL_LEVELS - 1; level > 0; --level) {
+            const uint32_t shift = TIMER_WHEEL_SLOT_BITS * level;
+
+            if ((t & ((UINT64_C(1) << shift) - 1)) == 0) {
+                slot_cascade(tw, (uint16_t)(level * TIMER_WHEEL_SLOTS + ((t >> shift) & TIMER_WHEEL_SLOT_MASK)));
+            }
+        }
+
+        slot_cascade(tw, (uint16_t)(t & TIMER_WHEEL_SLOT_MASK));
+    }
+}
+
+void timer_wheel_advance(Timer_Wheel *tw, uint64_t now)
+{
+    wheel_advance(tw, now);
+    wheel_take_expired(tw);
+}
+
+bool timer_wheel_pop(Timer_Wheel *tw, uint32_t *id)
+{
+    const uint32_t head = tw->heads[TIMER_WHEEL_READY];
+
+    if (head == TIMER_WHEEL_NONE) {
+        return false;
+    }
+
+    entry_unlink(tw, head);
+    *id = head;
+    return true;
+}
+
+uint64_t timer_wheel_next_deadline(const Timer_Wheel *tw)
+{
+    if (tw->heads[TIMER_WHEEL_EXPIRED] != TIMER_WHEEL_NONE || tw->heads[TIMER_WHEEL_READY] != TIMER_WHEEL_NONE) {
+        return tw->now;
+    }
+
+    if (pending_count(tw) == 0) {
+        return TIMER_WHEEL_NEVER;
+    }
+
+    uint64_t next = TIMER_WHEEL_NEVER;
+
+    if (tw->counts[0] != 0) {
+        for (uint32_t i = 1; i < TIMER_WHEEL_SLOTS; ++i) {
+            if (tw->heads[(tw->now + i) & TIMER_WHEEL_SLOT_MASK] != TIMER_WHEEL_NONE) {
+                next = tw->now + i;
+                break;
+            }
+        }
+    }
+
+    for (uint32_t level = 1; level < TIMER_WHEEL_LEVELS; ++level) {
+        if (tw->counts[level] == 0) {
+            continue;
+        }
+
+        const uint32_t shift = TIMER_WHEEL_SLOT_BITS * level;
+
+        for (uint32_t i = 1; i <= TIMER_WHEEL_SLOTS; ++i) {
+            const uint64_t block = (tw->now >> shift) + i;
+
+            if (tw->heads[level * TIMER_WHEEL_SLOTS + (block & TIMER_WHEEL_SLOT_MASK)] != TIMER_WHEEL_NONE) {
+                const uint64_t cascade_time = block << shift;
+
+                if (cascade_time < next) {
+                    next = cascade_time;
+                }
+
+                break;
+            }
+        }
+    }
+
+    return next;
+}
@@ -0,0 +1,102 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+/** @file
+ * @brief Hierarchical timer wheel for per-connection deadlines.
+ *
+ * Timers are identified by small integers chosen by the owner, usually the
+ * index of a connection or friend. Each id has at most one pending deadline.
+ * Deadlines are in milliseconds on whatever clock the owner passes to
+ * `timer_wheel_advance`, and expire in no particular order within the same
+ * millisecond.
+ */
+#ifndef C_TOXCORE_TOXCORE_TIMER_WHEEL_H
+#define C_TOXCORE_TOXCORE_TIMER_WHEEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "attributes.h"
+#include "mem.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Returned by `timer_wheel_next_deadline` when no timer is pending. */
+#define TIMER_WHEEL_NEVER UINT64_MAX
+
+typedef struct Timer_Wheel Timer_Wheel;
+
+/**
+ * @brief Create a timer wheel whose current time is @p now.
+ *
+ * @return nullptr on allocation failure.
+ */
+Timer_Wheel *_Nullable timer_wheel_new(const Memory *_Nonnull mem, uint64_t now);
+
+void timer_wheel_kill(Timer_Wheel *_Nullable tw);
+
+/**
+ * @brief Set the deadline of timer @p id, replacing any pending deadline.
+ *
+ * A deadline at or before the current time of the wheel expires on the next
+ * call to `timer_wheel_advance`, so a timer re-armed while handling it is not
+ * popped again by the same `timer_wheel_pop` loop.
+ *
+ * @retval false if the id table could not be grown.
+ */
+bool timer_wheel_set(Timer_Wheel *_Nonnull tw, uint32_t id, uint64_t deadline);
+
+/**
+ * @brief Set the deadline of timer @p id unless it already expires earlier.
+ *
+ * @retval false if the id table could not be grown.
+ */
+bool timer_wheel_set_earlier(Timer_Wheel *_Nonnull tw, uint32_t id, uint64_t deadline);
+
+/** @brief Remove the pending deadline of timer @p id, if any. */
+void timer_wheel_cancel(Timer_Wheel *_Nonnull tw, uint32_t id);
+
+/** @brief Whether timer @p id has a pending deadline. */
+bool timer_wheel_is_set(const Timer_Wheel *_Nonnull tw, uint32_t id);
+
+/**
+ * @brief Move the current time of the wheel to @p now.
+ *
+ * All timers with a deadline at or before @p now become ready for
+ * `timer_wheel_pop`. If @p now is earlier than the current time, for example
+ * because the owner switched to another clock, the pending timers are sorted
+ * again relative to @p now; timers that already expired stay expired.
+ */
+void timer_wheel_advance(Timer_Wheel *_Nonnull tw, uint64_t now);
+
+/**
+ * @brief Take one timer that expired by the last `timer_wheel_advance` off the
+ *   wheel.
+ *
+ * The timer is no longer pending afterwards, so the caller can set a new
+ * deadline for it while handling it. A loop popping until this returns false
+ * handles each timer at most once, whatever deadlines it sets.
+ *
+ * @retval true and sets @p id if a timer had expired.
+ * @retval false if no timer is ready.
+ */
+bool timer_wheel_pop(Timer_Wheel *_Nonnull tw, uint32_t *_Nonnull id);
+
+/**
+ * @brief A time at or before the earliest pending deadline.
+ *
+ * Exact for deadlines in the next 64 ms. Further deadlines are rounded down
+ * to the time at which the wheel needs to be advanced to re-sort them.
+ *
+ * @return TIMER_WHEEL_NEVER if no timer is pending.
+ */
+uint64_t timer_wheel_next_deadline(const Timer_Wheel *_Nonnull tw);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* C_TOXCORE_TOXCORE_TIMER_WHEEL_H */
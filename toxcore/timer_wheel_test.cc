@@ -0,0 +1,231 @@
+#include "timer_wheel.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "os_memory.h"
+
+namespace {
+
+struct Timer_Wheel_Deleter {
+    void operator()(Timer_Wheel *tw) { timer_wheel_kill(tw); }
+};
+
+using Timer_Wheel_Ptr = std::unique_ptr<Timer_Wheel, Timer_Wheel_Deleter>;
+
+std::vector<uint32_t> pop_all(Timer_Wheel *tw)
+{
+    std::vector<uint32_t> ids;
+    uint32_t id;
+
+    while (timer_wheel_pop(tw, &id)) {
+        ids.push_back(id);
+    }
+
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+TEST(TimerWheel, EmptyWheelHasNoDeadline)
+{
+    Timer_Wheel_Ptr tw(timer_wheel_new(os_memory(), 1000));
+    ASSERT_NE(tw, nullptr);
+
+    EXPECT_EQ(timer_wheel_next_deadline(tw.get()), TIMER_WHEEL_NEVER);
+    timer_wheel_advance(tw.get(), 1000000);
+    EXPECT_EQ(pop_all(tw.get()), std::vector<uint32_t>{});
+}
+
+TEST(TimerWheel, PastDeadlineExpiresOnNextAdvance)
+{
+    Timer_Wheel_Ptr tw(timer_wheel_new(os_memory(), 1000));
+    ASSERT_NE(tw, nullptr);
+
+    ASSERT_TRUE(timer_wheel_set(tw.get(), 3, 500));
+    EXPECT_EQ(timer_wheel_next_deadline(tw.get()), 1000);
+    EXPECT_EQ(pop_all(tw.get()), std::vector<uint32_t>{});
+    timer_wheel_advance(tw.get(), 1000);
+    EXPECT_EQ(pop_all(tw.get()), std::vector<uint32_t>{3});
+    EXPECT_FALSE(timer_wheel_is_set(tw.get(), 3));
+}
+
+TEST(TimerWheel, ExpiresAtDeadlineAndNotBefore)
+{
+    Timer_Wheel_Ptr tw(timer_wheel_new(os_memory(), 0));
+    ASSERT_NE(tw, nullptr);
+
+    ASSERT_TRUE(timer_wheel_set(tw.get(), 0, 10));
+    ASSERT_TRUE(timer_wheel_set(tw.get(), 1, 5000));
+    ASSERT_TRUE(timer_wheel_set(tw.get(), 2, 300000));
+    EXPECT_EQ(timer_wheel_next_deadline(tw.get()), 10);
+
+    timer_wheel_advance(tw.get(), 9);
+    EXPECT_EQ(pop_all(tw.get()), std::vector<uint32_t>{});
+    timer_wheel_advance(tw.get(), 10);
+    EXPECT_EQ(pop_all(tw.get()), std::vector<uint32_t>{0});
+
+    timer_wheel_advance(tw.get(), 4999);
+    EXPECT_EQ(pop_all(tw.get()), std::vector<uint32_t>{});
+    timer_wheel_advance(tw.get(), 5000);
+    EXPECT_EQ(pop_all(tw.get()), std::vector<uint32_t>{1});
+
+    EXPECT_LE(timer_wheel_next_deadline(tw.get()), 300000);
+    timer_wheel_advance(tw.get(), 299999);
+    EXPECT_EQ(pop_all(tw.get()), std::vector<uint32_t>{});
+    timer_wheel_advance(tw.get(), 300000);
+    EXPECT_EQ(pop_all(tw.get()), std::vector<uint32_t>{2});
+}
+
+TEST(TimerWheel, DeadlineBeyondRangeIsNotLost)
+{
+    Timer_Wheel_Ptr tw(timer_wheel_new(os_memory(), 7));
+    ASSERT_NE(tw, nullptr);
+
+    const uint64_t far = UINT64_C(1) << 40;
+    ASSERT_TRUE(timer_wheel_set(tw.get(), 0, far));
+
+    for (uint64_t now = 7; now < far; now += UINT64_C(1) << 23) {
+        timer_wheel_advance(tw.get(), now);
+        ASSERT_EQ(pop_all(tw.get()), std::vector<uint32_t>{});
+        ASSERT_LE(timer_wheel_next_deadline(tw.get()), far);
+    }
+
+    timer_wheel_advance(tw.get(), far);
+    EXPECT_EQ(pop_all(tw.get()), std::vector<uint32_t>{0});
+}
+
+TEST(TimerWheel, SetReplacesAndCancelRemoves)
+{
+    Timer_Wheel_Ptr tw(timer_wheel_new(os_memory(), 0));
+    ASSERT_NE(tw, nullptr);
+
+    ASSERT_TRUE(timer_wheel_set(tw.get(), 1, 100));
+    ASSERT_TRUE(timer_wheel_set(tw.get(), 1, 200));
+    ASSERT_TRUE(timer_wheel_set_earlier(tw.get(), 1, 300));
+    ASSERT_TRUE(timer_wheel_set(tw.get(), 2, 100));
+    timer_wheel_cancel(tw.get(), 2);
+
+    timer_wheel_advance(tw.get(), 199);
+    EXPECT_EQ(pop_all(tw.get()), std::vector<uint32_t>{});
+
+    ASSERT_TRUE(timer_wheel_set_earlier(tw.get(), 1, 150));
+    timer_wheel_advance(tw.get(), 199);
+    EXPECT_EQ(pop_all(tw.get()), std::vector<uint32_t>{1});
+    EXPECT_EQ(timer_wheel_next_deadline(tw.get()), TIMER_WHEEL_NEVER);
+}
+
+TEST(TimerWheel, RearmingWhilePoppingDoesNotSpin)
+{
+    Timer_Wheel_Ptr tw(timer_wheel_new(os_memory(), 1000));
+    ASSERT_NE(tw, nullptr);
+
+    ASSERT_TRUE(timer_wheel_set(tw.get(), 0, 1000));
+    ASSERT_TRUE(timer_wheel_set(tw.get(), 1, 1000));
+    timer_wheel_advance(tw.get(), 1000);
+
+    std::vector<uint32_t> popped;
+    uint32_t id;
+
+    while (timer_wheel_pop(tw.get(), &id)) {
+        ASSERT_LT(popped.size(), 2);
+        popped.push_back(id);
+        // Already due again, as with a deadline computed on another clock.
+        ASSERT_TRUE(timer_wheel_set(tw.get(), id, 500));
+    }
+
+    std::sort(popped.begin(), popped.end());
+    EXPECT_EQ(popped, (std::vector<uint32_t>{0, 1}));
+
+    timer_wheel_advance(tw.get(), 1000);
+    EXPECT_EQ(pop_all(tw.get()), (std::vector<uint32_t>{0, 1}));
+}
+
+TEST(TimerWheel, ClockGoingBackwardsRebasesTheWheel)
+{
+    Timer_Wheel_Ptr tw(timer_wheel_new(os_memory(), 20000000));
+    ASSERT_NE(tw, nullptr);
+
+    ASSERT_TRUE(timer_wheel_set(tw.get(), 0, 20000000 + 500));
+    ASSERT_TRUE(timer_wheel_set(tw.get(), 1, 20000000 - 100));
+
+    // The owner switched to a clock about 13 seconds behind.
+    const uint64_t now = 20000000 - 13600;
+    timer_wheel_advance(tw.get(), now);
+    // Timers that had expired stay expired.
+    EXPECT_EQ(pop_all(tw.get()), std::vector<uint32_t>{1});
+
+    // Deadlines on the new clock work as usual, also when set while popping.
+    ASSERT_TRUE(timer_wheel_set(tw.get(), 1, now + 1000));
+    timer_wheel_advance(tw.get(), now + 999);
+    EXPECT_EQ(pop_all(tw.get()), std::vector<uint32_t>{});
+    timer_wheel_advance(tw.get(), now + 1000);
+
+    uint32_t id;
+    int pops = 0;
+
+    while (timer_wheel_pop(tw.get(), &id)) {
+        ASSERT_EQ(id, 1);
+        ASSERT_LT(++pops, 2);
+        ASSERT_TRUE(timer_wheel_set(tw.get(), id, now + 1000));
+    }
+
+    EXPECT_EQ(timer_wheel_next_deadline(tw.get()), now + 1000);
+
+    // The timer set on the old clock fires when the new clock gets there.
+    timer_wheel_advance(tw.get(), 20000000 + 499);
+    EXPECT_EQ(pop_all(tw.get()), std::vector<uint32_t>{1});
+    timer_wheel_advance(tw.get(), 20000000 + 500);
+    EXPECT_EQ(pop_all(tw.get()), std::vector<uint32_t>{0});
+}
+
+TEST(TimerWheel, MatchesNaiveScheduleAndNeverFiresLate)
+{
+    Timer_Wheel_Ptr tw(timer_wheel_new(os_memory(), 12345));
+    ASSERT_NE(tw, nullptr);
+
+    std::mt19937_64 rng(42);
+    std::map<uint32_t, uint64_t> expected;
+    uint64_t now = 12345;
+
+    for (int round = 0; round < 20000; ++round) {
+        const uint32_t id = rng() % 256;
+        const uint64_t delay = rng() % 4 == 0 ? rng() % 1000000 : rng() % 200;
+
+        if (rng() % 8 == 0) {
+            timer_wheel_cancel(tw.get(), id);
+            expected.erase(id);
+        } else {
+            ASSERT_TRUE(timer_wheel_set(tw.get(), id, now + delay));
+            expected[id] = now + delay;
+        }
+
+        uint64_t next_expected = TIMER_WHEEL_NEVER;
+        for (const auto &[timer_id, deadline] : expected) {
+            next_expected = std::min(next_expected, deadline);
+        }
+        ASSERT_LE(timer_wheel_next_deadline(tw.get()), next_expected);
+
+        now += rng() % 3000;
+        timer_wheel_advance(tw.get(), now);
+
+        std::vector<uint32_t> due;
+        for (auto it = expected.begin(); it != expected.end();) {
+            if (it->second <= now) {
+                due.push_back(it->first);
+                it = expected.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        ASSERT_EQ(pop_all(tw.get()), due) << "round " << round;
+    }
+}
+
+}  // namespace
@@ -722,6 +722,7 @@ static Tox *_Nullable tox_new_system(const struct Tox_Options *_Nullable options
     m_options.hole_punching_enabled = tox_options_get_hole_punching_enabled(opts);
     m_options.local_discovery_enabled = tox_options_get_local_discovery_enabled(opts);
     m_options.dht_announcements_enabled = tox_options_get_dht_announcements_enabled(opts);
+    m_options.dht_announcements_capacity = tox_options_get_experimental_dht_announcements_capacity(opts);
     m_options.groups_persistence_enabled = tox_options_get_experimental_groups_persistence(opts);
 
     if (m_options.udp_disabled) {
@@ -1244,6 +1245,7 @@ void tox_iterate_with_options(Tox *_Nonnull tox, const Tox_Iterate_Options *_Nul
     struct Tox_Userdata tox_data = { tox, user_data };
     do_messenger(tox->m, &tox_data);
     do_groupchats(tox->m->conferences_object, &tox_data);
+    messenger_sync_ev(tox->m);
 
     tox_unlock(tox);
 }
@@ -189,6 +189,15 @@ void tox_options_set_experimental_disable_dns(Tox_Options *_Nonnull options, boo
 {
     options->experimental_disable_dns = experimental_disable_dns;
 }
+uint32_t tox_options_get_experimental_dht_announcements_capacity(const Tox_Options *_Nonnull options)
+{
+    return options->experimental_dht_announcements_capacity;
+}
+void tox_options_set_experimental_dht_announcements_capacity(
+    Tox_Options *_Nonnull options, uint32_t experimental_dht_announcements_capacity)
+{
+    options->experimental_dht_announcements_capacity = experimental_dht_announcements_capacity;
+}
 bool tox_options_get_experimental_owned_data(const Tox_Options *_Nonnull options)
 {
     return options->experimental_owned_data;
@@ -256,6 +265,7 @@ void tox_options_default(Tox_Options *_Nonnull options)
         tox_options_set_experimental_thread_safety(options, false);
         tox_options_set_experimental_groups_persistence(options, false);
         tox_options_set_experimental_disable_dns(options, false);
+        tox_options_set_experimental_dht_announcements_capacity(options, 256);
         tox_options_set_experimental_owned_data(options, false);
     }
 }
@@ -284,6 +284,19 @@ struct Tox_Options {
      */
     bool experimental_disable_dns;
 
+    /**
+     * @brief Number of DHT announcements this instance stores for other peers.
+     *
+     * Has no effect if dht_announcements_enabled is false. When the store is
+     * full, only announcements whose key is closer to our DHT key than the
+     * farthest stored one are accepted. Memory is only used for announcements
+     * actually stored, up to about 600 bytes each. Values outside [1, 1048576]
+     * are ignored.
+     *
+     * Default: 256.
+     */
+    uint32_t experimental_dht_announcements_capacity;
+
     /**
      * @brief Whether the savedata data is owned by the Tox_Options object.
      *
@@ -398,6 +411,11 @@ bool tox_options_get_experimental_disable_dns(const Tox_Options *options);
 
 void tox_options_set_experimental_disable_dns(Tox_Options *options, bool experimental_disable_dns);
 
+uint32_t tox_options_get_experimental_dht_announcements_capacity(const Tox_Options *options);
+
+void tox_options_set_experimental_dht_announcements_capacity(
+    Tox_Options *options, uint32_t experimental_dht_announcements_capacity);
+
 /**
  * @brief Initialises a Tox_Options object with the default options.
  *
@@ -12,22 +12,29 @@
 
 #include "DHT.h"
 #include "Messenger.h"
+#include "announce.h"
 #include "TCP_server.h"
 #include "ccompat.h"
 #include "crypto_core.h"
+#include "ev.h"
+#include "group.h"
 #include "group_chats.h"
 #include "group_common.h"
 #include "logger.h"
 #include "mem.h"
+#include "mono_time.h"
 #include "net.h"
 #include "net_crypto.h"
 #include "net_profile.h"
 #include "network.h"
+#include "onion.h"
+#include "onion_announce.h"
 #include "os_memory.h"
 #include "os_network.h"
 #include "os_random.h"
 #include "tox.h"
 #include "tox_struct.h"  // IWYU pragma: keep
+#include "util.h"
 
 #define SET_ERROR_PARAMETER(param, x) \
     do {                              \
@@ -182,6 +189,120 @@ uint16_t tox_dht_get_num_closelist_announce_capable(const Tox *tox)
     return num_cap;
 }
 
+void tox_get_shared_key_stats(const Tox *tox, Tox_Shared_Key_Stats *stats)
+{
+    assert(tox != nullptr);
+    assert(stats != nullptr);
+
+    Shared_Key_Cache_Stats total = {0};
+
+    tox_lock(tox);
+
+    dht_add_shared_key_stats(tox->m->dht, &total);
+    onion_add_shared_key_stats(tox->m->onion, &total);
+    onion_announce_add_shared_key_stats(tox->m->onion_a, &total);
+
+    if (tox->m->announce != nullptr) {
+        announce_add_shared_key_stats(tox->m->announce, &total);
+    }
+
+    tox_unlock(tox);
+
+    stats->hits = total.hits;
+    stats->misses = total.misses;
+    stats->evictions = total.evictions;
+    stats->expired = total.expired;
+    stats->size = total.size;
+    stats->capacity = total.capacity;
+}
+
+void tox_get_announce_stats(const Tox *tox, Tox_Announce_Stats *stats)
+{
+    assert(tox != nullptr);
+    assert(stats != nullptr);
+
+    Announce_Stats announce_stats = {0};
+
+    tox_lock(tox);
+
+    if (tox->m->announce != nullptr) {
+        announce_get_stats(tox->m->announce, &announce_stats);
+    }
+
+    tox_unlock(tox);
+
+    stats->stored = announce_stats.stored;
+    stats->rejected = announce_stats.rejected;
+    stats->evicted = announce_stats.evicted;
+    stats->expired = announce_stats.expired;
+    stats->size = announce_stats.size;
+    stats->capacity = announce_stats.capacity;
+}
+
+uint32_t tox_get_sockets(const Tox *tox, Tox_Socket *sockets, uint32_t max_sockets)
+{
+    assert(tox != nullptr);
+    tox_lock(tox);
+    const uint32_t count = messenger_copy_interests(tox->m, nullptr, 0);
+    const uint32_t copy_count = min_u32(count, max_sockets);
+
+    if (sockets == nullptr || copy_count == 0) {
+        tox_unlock(tox);
+        return count;
+    }
+
+    Ev_Interest *interests = (Ev_Interest *)mem_valloc(tox->sys.mem, copy_count, sizeof(Ev_Interest));
+
+    if (interests == nullptr) {
+        tox_unlock(tox);
+        return 0;
+    }
+
+    messenger_copy_interests(tox->m, interests, copy_count);
+    tox_unlock(tox);
+
+    for (uint32_t i = 0; i < copy_count; ++i) {
+        sockets[i].fd = net_socket_to_native(interests[i].sock);
+        sockets[i].wants_write = (interests[i].events & EV_WRITE) != 0;
+    }
+
+    mem_delete(tox->sys.mem, interests);
+    return count;
+}
+
+uint32_t tox_timer_interval(const Tox *tox)
+{
+    assert(tox != nullptr);
+    tox_lock(tox);
+    uint32_t ret = messenger_timer_interval(tox->m);
+
+    if (tox->m->conferences_object != nullptr) {
+        const uint64_t deadline = groupchats_deadline(tox->m->conferences_object);
+        const uint64_t now = mono_time_get_ms(tox->mono_time);
+        ret = deadline <= now ? 0 : (uint32_t)min_u64(ret, deadline - now);
+    }
+
+    tox_unlock(tox);
+    return ret;
+}
+
+bool tox_register_ev(Tox *tox, Ev *ev)
+{
+    assert(tox != nullptr);
+    tox_lock(tox);
+    const bool ret = messenger_register_ev(tox->m, ev, tox);
+    tox_unlock(tox);
+    return ret;
+}
+
+void tox_unregister_ev(Tox *tox)
+{
+    assert(tox != nullptr);
+    tox_lock(tox);
+    messenger_unregister_ev(tox->m);
+    tox_unlock(tox);
+}
+
 size_t tox_group_peer_get_ip_address_size(const Tox *tox, uint32_t group_number, uint32_t peer_id,
         Tox_Err_Group_Peer_Query *error)
 {
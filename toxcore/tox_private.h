@@ -23,6 +23,7 @@ typedef uint64_t tox_mono_time_cb(void *_Nullable user_data);
 typedef struct Random Random;
 typedef struct Network Network;
 typedef struct Memory Memory;
+typedef struct Ev Ev;
 
 typedef struct Tox_System {
     tox_mono_time_cb *_Nullable mono_time_callback;
@@ -220,6 +221,186 @@ uint16_t tox_dht_get_num_closelist(const Tox *_Nonnull tox);
  */
 uint16_t tox_dht_get_num_closelist_announce_capable(const Tox *_Nonnull tox);
 
+/*******************************************************************************
+ *
+ * :: Shared key caches
+ *
+ ******************************************************************************/
+
+/**
+ * Statistics of the caches of shared keys used by the DHT, onion and announce
+ * code. Computing a shared key is the most expensive part of answering a
+ * request from a peer that is not in the cache.
+ */
+typedef struct Tox_Shared_Key_Stats {
+    /**
+     * Lookups answered from a cache.
+     */
+    uint64_t hits;
+
+    /**
+     * Lookups that had to compute the shared key.
+     */
+    uint64_t misses;
+
+    /**
+     * Keys replaced by a new key before they timed out. Many evictions mean
+     * the caches are too small for the number of peers.
+     */
+    uint64_t evictions;
+
+    /**
+     * Keys removed because they were not used for 10 minutes.
+     */
+    uint64_t expired;
+
+    /**
+     * Keys currently cached, over all caches.
+     */
+    uint32_t size;
+
+    /**
+     * Number of keys all caches together can hold.
+     */
+    uint32_t capacity;
+} Tox_Shared_Key_Stats;
+
+/**
+ * Copy the statistics of all shared key caches of this instance into `stats`.
+ * The counters start at 0 when the instance is created.
+ */
+void tox_get_shared_key_stats(const Tox *_Nonnull tox, Tox_Shared_Key_Stats *_Nonnull stats);
+
+/*******************************************************************************
+ *
+ * :: DHT announcement store
+ *
+ ******************************************************************************/
+
+/**
+ * Statistics of the DHT announcements this instance stores for other peers.
+ * See `tox_options_set_experimental_dht_announcements_capacity`.
+ */
+typedef struct Tox_Announce_Stats {
+    /**
+     * Announcements stored or refreshed.
+     */
+    uint64_t stored;
+
+    /**
+     * Store requests refused because the store was full of announcements
+     * closer to our DHT key. Many rejections mean a larger store would serve
+     * more peers.
+     */
+    uint64_t rejected;
+
+    /**
+     * Announcements replaced by one closer to our DHT key.
+     */
+    uint64_t evicted;
+
+    /**
+     * Announcements removed because they timed out.
+     */
+    uint64_t expired;
+
+    /**
+     * Announcements currently stored.
+     */
+    uint32_t size;
+
+    /**
+     * Number of announcements the store can hold.
+     */
+    uint32_t capacity;
+} Tox_Announce_Stats;
+
+/**
+ * Copy the statistics of the DHT announcement store into `stats`. The counters
+ * start at 0 when the instance is created. All values are 0 if DHT
+ * announcements are disabled.
+ */
+void tox_get_announce_stats(const Tox *_Nonnull tox, Tox_Announce_Stats *_Nonnull stats);
+
+/*******************************************************************************
+ *
+ * :: Event loop integration
+ *
+ ******************************************************************************/
+
+/**
+ * A socket that tox_iterate reads from or writes to.
+ */
+typedef struct Tox_Socket {
+    /**
+     * The native socket: a file descriptor, or a SOCKET on Windows.
+     */
+    int fd;
+
+    /**
+     * True if tox_iterate also has data queued for this socket, so it should
+     * run when the socket becomes writable as well as when it is readable.
+     */
+    bool wants_write;
+} Tox_Socket;
+
+/**
+ * Copy the sockets tox_iterate reads from and writes to into `sockets`.
+ *
+ * An application that waits on these sockets, for at most
+ * tox_timer_interval milliseconds, and calls tox_iterate when one of them
+ * is ready or the time is up, does not need to call tox_iterate any more
+ * often than that. The set changes as TCP relay connections come and go, so
+ * it must be copied again after each tox_iterate.
+ *
+ * @param sockets Array of `max_sockets` entries, or NULL to only count them.
+ *
+ * @return the number of sockets, which may be more than `max_sockets`. Only
+ *   the first `max_sockets` are copied. Returns 0 if memory allocation failed.
+ */
+uint32_t tox_get_sockets(const Tox *_Nonnull tox, Tox_Socket *_Nullable sockets, uint32_t max_sockets);
+
+/**
+ * Return the time in milliseconds before tox_iterate has timer work to do.
+ *
+ * Unlike tox_iteration_interval, this does not account for data arriving on
+ * the sockets, so it is only suitable for applications that also wait on the
+ * sockets from tox_get_sockets. Resends, pings, announces, group timers and
+ * file chunk requests are all accounted for. It can be several seconds when
+ * nothing is going on.
+ */
+uint32_t tox_timer_interval(const Tox *_Nonnull tox);
+
+/**
+ * Register the sockets tox_iterate reads from and writes to with an event loop.
+ *
+ * These are the sockets tox_get_sockets returns, but toxcore keeps the
+ * registrations up to date itself: relay sockets are added when their
+ * connections open and removed before they close, and the events each socket
+ * waits for are updated at the end of every tox_iterate. Every Ev_Result for
+ * these sockets has the Tox instance as its data, so many instances can share
+ * one loop.
+ *
+ * The application then calls tox_iterate on an instance only when ev_run
+ * reports one of its sockets, or when tox_timer_interval has passed since its
+ * last tox_iterate. Sending data outside tox_iterate, e.g. with
+ * tox_friend_send_message, does not update the registrations, so the
+ * application should also iterate soon after such calls.
+ *
+ * The Ev must outlive the Tox instance, or tox_unregister_ev must be called
+ * before it is freed.
+ *
+ * @return true on success, false if an Ev is already registered or a socket
+ *   could not be added to it.
+ */
+bool tox_register_ev(Tox *_Nonnull tox, Ev *_Nonnull ev);
+
+/**
+ * Remove the sockets from the event loop registered with tox_register_ev, if
+ * any.
+ */
+void tox_unregister_ev(Tox *_Nonnull tox);
+
 /*******************************************************************************
  *
  * :: Network profiler